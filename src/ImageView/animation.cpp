@@ -0,0 +1,321 @@
+#include <Windows.h>
+#include <wincodec.h>
+#include <string.h>
+
+#include "animation.hpp"
+#include "pixel_conversion.hpp"
+#include "com_utility.hpp"
+#include "defer.hpp"
+#include "error.hpp"
+
+
+// Returns unsigned integer metadata 'name', or 'default_value' if it's missing.
+static UINT read_metadata_uint(IWICMetadataQueryReader* reader, const wchar_t* name, UINT default_value)
+{
+    PROPVARIANT value;
+    PropVariantInit(&value);
+    if (FAILED(reader->GetMetadataByName(name, &value)))
+        return default_value;
+    defer(PropVariantClear(&value));
+
+    switch (value.vt)
+    {
+        case VT_UI1:
+            return value.bVal;
+        case VT_UI2:
+            return value.uiVal;
+        case VT_UI4:
+            return value.ulVal;
+    }
+
+    return default_value;
+}
+
+static void clear_rect(const Image_Buffer& image, const RECT& rect)
+{
+    for (LONG y = rect.top; y < rect.bottom; ++y)
+        memset(image.row(y) + rect.left, 0, sizeof(UINT32) * (rect.right - rect.left));
+}
+
+static void copy_rect(const Image_Buffer& source, const RECT& rect, const Image_Buffer& destination)
+{
+    for (LONG y = rect.top; y < rect.bottom; ++y)
+        memcpy(destination.row(y) + rect.left, source.row(y) + rect.left, sizeof(UINT32) * (rect.right - rect.left));
+}
+
+// Draws premultiplied 'source' rows over 'rect' of 'canvas'. GIF pixels are either opaque or transparent,
+// so blending is rarely done.
+static void blend_over(const Image_Buffer& source, const Image_Buffer& canvas, const RECT& rect)
+{
+    const int width = rect.right - rect.left;
+    for (LONG y = rect.top; y < rect.bottom; ++y)
+    {
+        const UINT32* from = source.row(y - rect.top);
+        UINT32* to = canvas.row(y) + rect.left;
+        for (int x = 0; x < width; ++x)
+        {
+            const UINT32 pixel = from[x];
+            const UINT32 alpha = pixel >> 24;
+            if (alpha == 255)
+            {
+                to[x] = pixel;
+            }
+            else if (alpha != 0)
+            {
+                const UINT32 inverse = 255 - alpha;
+                const UINT32 under = to[x];
+                const UINT32 rb = ((under & 0x00FF00FF) * inverse + 0x00800080) >> 8 & 0x00FF00FF;
+                const UINT32 ag = ((under >> 8 & 0x00FF00FF) * inverse + 0x00800080) & 0xFF00FF00;
+                to[x] = pixel + rb + ag;
+            }
+        }
+    }
+}
+
+static void union_rect(RECT* rect, const RECT& other)
+{
+    if (other.left >= other.right || other.top >= other.bottom)
+        return;
+
+    if (rect->left >= rect->right || rect->top >= rect->bottom)
+    {
+        *rect = other;
+        return;
+    }
+
+    rect->left = min(rect->left, other.left);
+    rect->top = min(rect->top, other.top);
+    rect->right = max(rect->right, other.right);
+    rect->bottom = max(rect->bottom, other.bottom);
+}
+
+bool Animation::open(IWICImagingFactory* wic, IWICBitmapDecoder* decoder)
+{
+    E_VERIFY_NULL_R(wic, false);
+    E_VERIFY_NULL_R(decoder, false);
+
+    close();
+
+    UINT count = 0;
+    if (FAILED(decoder->GetFrameCount(&count)) || count < 2)
+        return false;
+
+    // Canvas is the logical screen of the GIF, frames are placed on it.
+    UINT width = 0;
+    UINT height = 0;
+    IWICMetadataQueryReader* reader = nullptr;
+    if (SUCCEEDED(decoder->GetMetadataQueryReader(&reader)))
+    {
+        width = read_metadata_uint(reader, L"/logscrdesc/Width", 0);
+        height = read_metadata_uint(reader, L"/logscrdesc/Height", 0);
+        reader->Release();
+    }
+
+    if (width == 0 || height == 0)
+    {
+        IWICBitmapFrameDecode* frame = nullptr;
+        if (FAILED(decoder->GetFrame(0, &frame)))
+            return false;
+        HRESULT hr = frame->GetSize(&width, &height);
+        frame->Release();
+        if (FAILED(hr) || width == 0 || height == 0)
+            return false;
+    }
+
+    const size_t frame_bytes = static_cast<size_t>(width) * height * sizeof(UINT32);
+    ring_count = static_cast<int>(min(max(max_ring_bytes / frame_bytes, static_cast<size_t>(min_ring_frames)), static_cast<size_t>(max_ring_frames)));
+
+    bool is_allocated = canvas.allocate(static_cast<int>(width), static_cast<int>(height)) &&
+        saved.allocate(static_cast<int>(width), static_cast<int>(height)) &&
+        frame_pixels.allocate(static_cast<int>(width), static_cast<int>(height));
+    for (int i = 0; i < ring_count && is_allocated; ++i)
+        is_allocated = ring[i].pixels.allocate(static_cast<int>(width), static_cast<int>(height));
+
+    if (!is_allocated)
+    {
+        LOG_ERROR(L"Not enough memory to play %ux%u animation.\n", width, height);
+        close();
+        return false;
+    }
+
+    this->wic = wic;
+    this->decoder = decoder;
+    wic->AddRef();
+    decoder->AddRef();
+    frame_count = count;
+    next_frame = 0;
+    composer.composed = 0;
+    composer.presented = 0;
+    composer.is_composing = 0;
+    composer.is_cancelled = 0;
+    composer.has_failed = 0;
+
+    return true;
+}
+
+void Animation::close()
+{
+    InterlockedExchange(&composer.is_cancelled, 1);
+    g_job_pool->wait(&composer.group);
+
+    for (int i = 0; i < max_ring_frames; ++i)
+        ring[i].pixels.release();
+    ring_count = 0;
+    canvas.release();
+    saved.release();
+    frame_pixels.release();
+
+    safe_release(decoder);
+    safe_release(wic);
+    frame_count = 0;
+}
+
+void Animation::start()
+{
+    if (!is_open())
+        return;
+
+    if (InterlockedCompareExchange(&composer.is_composing, 1, 0) == 0)
+        submit();
+}
+
+const Animation::Composed_Frame* Animation::peek() const
+{
+    if (!is_open() || composer.presented >= composer.composed)
+        return nullptr;
+
+    return &ring[composer.presented % ring_count];
+}
+
+void Animation::pop()
+{
+    if (!is_open() || composer.presented >= composer.composed)
+        return;
+
+    InterlockedIncrement(&composer.presented);
+
+    // Composer stops when the ring is full, the freed slot starts it again.
+    if (!composer.has_failed && InterlockedCompareExchange(&composer.is_composing, 1, 0) == 0)
+        submit();
+}
+
+void Animation::submit()
+{
+    // Without worker threads frames are composed right away.
+    if (g_job_pool->get_thread_count() == 0 || !g_job_pool->submit(run_composer, this, 0, &composer.group))
+        run_composer(this, 0);
+}
+
+HRESULT Animation::compose_next(Composed_Frame* target)
+{
+    const RECT canvas_rect = { 0, 0, canvas.width, canvas.height };
+    RECT dirty = {};
+
+    // What the last frame left is cleared or restored before the next one is drawn, each loop starts
+    // from an empty canvas.
+    if (next_frame == 0)
+    {
+        clear_rect(canvas, canvas_rect);
+        dirty = canvas_rect;
+    }
+    else if (last_disposal == Disposal_Background)
+    {
+        clear_rect(canvas, last_rect);
+        dirty = last_rect;
+    }
+    else if (last_disposal == Disposal_Previous)
+    {
+        copy_rect(saved, last_rect, canvas);
+        dirty = last_rect;
+    }
+
+    IWICBitmapFrameDecode* frame = nullptr;
+    HRESULT hr = decoder->GetFrame(next_frame, &frame);
+    if (FAILED(hr))
+        return hr;
+    defer(frame->Release());
+
+    UINT width = 0;
+    UINT height = 0;
+    hr = frame->GetSize(&width, &height);
+    if (FAILED(hr))
+        return hr;
+
+    UINT left = 0;
+    UINT top = 0;
+    UINT delay = 0;
+    Disposal disposal = Disposal_None;
+    IWICMetadataQueryReader* reader = nullptr;
+    if (SUCCEEDED(frame->GetMetadataQueryReader(&reader)))
+    {
+        left = read_metadata_uint(reader, L"/imgdesc/Left", 0);
+        top = read_metadata_uint(reader, L"/imgdesc/Top", 0);
+        // Delay is in hundredths of a second.
+        delay = read_metadata_uint(reader, L"/grctlext/Delay", 0) * 10;
+        disposal = static_cast<Disposal>(read_metadata_uint(reader, L"/grctlext/Disposal", Disposal_None));
+        reader->Release();
+    }
+
+    // Parts of the frame outside of the canvas are not decoded.
+    RECT rect;
+    rect.left = static_cast<LONG>(min(left, static_cast<UINT>(canvas.width)));
+    rect.top = static_cast<LONG>(min(top, static_cast<UINT>(canvas.height)));
+    rect.right = static_cast<LONG>(min(static_cast<UINT64>(left) + width, static_cast<UINT64>(canvas.width)));
+    rect.bottom = static_cast<LONG>(min(static_cast<UINT64>(top) + height, static_cast<UINT64>(canvas.height)));
+
+    if (disposal == Disposal_Previous)
+        copy_rect(canvas, rect, saved);
+
+    if (rect.right > rect.left && rect.bottom > rect.top)
+    {
+        const WICRect source_rect = { 0, 0, rect.right - rect.left, rect.bottom - rect.top };
+        hr = Pixel_Conversion::copy_pixels(wic, frame, source_rect, frame_pixels.pixels, frame_pixels.stride);
+        if (FAILED(hr))
+            return hr;
+
+        blend_over(frame_pixels, canvas, rect);
+        union_rect(&dirty, rect);
+    }
+
+    // Canvas is copied whole, the slot held a frame several frames back.
+    memcpy(target->pixels.pixels, canvas.pixels, canvas.size_in_bytes());
+    target->dirty = dirty;
+    target->delay_ms = delay < min_delay_ms ? default_delay_ms : delay;
+
+    last_disposal = disposal;
+    last_rect = rect;
+    next_frame = (next_frame + 1) % frame_count;
+
+    return S_OK;
+}
+
+void Animation::run_composer(void* context, int)
+{
+    Animation* animation = static_cast<Animation*>(context);
+    Composer& composer = animation->composer;
+
+    for (;;)
+    {
+        while (!composer.is_cancelled && !animation->is_ring_full())
+        {
+            HRESULT hr = animation->compose_next(&animation->ring[composer.composed % animation->ring_count]);
+            if (FAILED(hr))
+            {
+                LOG_HRESULT_ERROR(hr, L"Unable to compose animation frame %u.\n", animation->next_frame);
+                InterlockedExchange(&composer.has_failed, 1);
+                break;
+            }
+
+            InterlockedIncrement(&composer.composed);
+        }
+
+        InterlockedExchange(&composer.is_composing, 0);
+
+        // A frame presented after the ring was found full may not have seen the composer stop.
+        if (composer.is_cancelled || composer.has_failed || animation->is_ring_full() ||
+            InterlockedCompareExchange(&composer.is_composing, 1, 0) != 0)
+        {
+            break;
+        }
+    }
+}
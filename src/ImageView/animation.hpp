@@ -0,0 +1,93 @@
+#pragma once
+#include <Windows.h>
+#include <wincodec.h>
+
+#include "image_buffer.hpp"
+#include "job_pool.hpp"
+
+// Playback of an animated GIF. Frames are decoded and composed on the job pool ahead of presentation:
+// each frame is drawn over what the previous one left as its disposal method says, and only the
+// rectangles it touches are changed. Composed frames go to a ring of a few canvases the window thread
+// presents them from, the composer stops when the ring is full and goes on when a frame is presented.
+// Memory depends on the size of the animation, not on how many frames it has.
+//
+// Opened and presented from the window thread.
+struct Animation
+{
+    static const int max_ring_frames = 8;
+    static const int min_ring_frames = 2;
+    // Ring is smaller for large animations, it doesn't take more than this.
+    static const size_t max_ring_bytes = 64 * 1024 * 1024;
+    // Delays shorter than this are played at 'default_delay_ms', like browsers do.
+    static const UINT min_delay_ms = 20;
+    static const UINT default_delay_ms = 100;
+
+    struct Composed_Frame
+    {
+        Image_Buffer pixels;
+        // Part that differs from the frame before, whole canvas for the first frame of a loop.
+        RECT dirty;
+        UINT delay_ms;
+    };
+
+    // Returns false if the image has a single frame, or its canvas can't be allocated. 'decoder' is
+    // referenced until 'close' and must not be used by anything else while it's open.
+    bool open(IWICImagingFactory* wic, IWICBitmapDecoder* decoder);
+    // Stops composing and releases the ring.
+    void close();
+    inline bool is_open() const { return frame_count > 1; }
+    inline bool has_failed() const { return composer.has_failed != 0; }
+    inline int get_width() const { return canvas.width; }
+    inline int get_height() const { return canvas.height; }
+
+    // Starts composing frames on the job pool.
+    void start();
+    // Next composed frame to present, or null if the composer is behind.
+    const Composed_Frame* peek() const;
+    // Frees the frame returned by 'peek' for the composer.
+    void pop();
+
+private:
+    enum Disposal : UINT
+    {
+        Disposal_None = 0,
+        Disposal_Keep = 1,
+        Disposal_Background = 2,
+        Disposal_Previous = 3,
+    };
+
+    struct Composer
+    {
+        Job_Group group;
+        // Frames composed and presented since 'start', frame 'n' is in ring slot n % ring_count.
+        volatile LONG composed = 0;
+        volatile LONG presented = 0;
+        // Set while a job composes, the one who sets it submits the job.
+        volatile LONG is_composing = 0;
+        volatile LONG is_cancelled = 0;
+        volatile LONG has_failed = 0;
+    };
+
+    IWICImagingFactory* wic = nullptr;
+    IWICBitmapDecoder* decoder = nullptr;
+    UINT frame_count = 0;
+
+    Composed_Frame ring[max_ring_frames];
+    int ring_count = 0;
+    Composer composer;
+
+    // Used by the composer only.
+    Image_Buffer canvas;
+    // Canvas under the last frame, restored when its disposal is 'Disposal_Previous'.
+    Image_Buffer saved;
+    Image_Buffer frame_pixels;
+    UINT next_frame = 0;
+    Disposal last_disposal = Disposal_None;
+    RECT last_rect = {};
+
+    inline bool is_ring_full() const { return composer.composed - composer.presented >= ring_count; }
+    // Composes the next frame into 'target'.
+    HRESULT compose_next(Composed_Frame* target);
+    void submit();
+    static void run_composer(void* context, int);
+};
@@ -0,0 +1,1115 @@
+#include <Windows.h>
+#include <math.h>
+#include <string.h>
+
+#include "bcn_decoder.hpp"
+#include "cpu_features.hpp"
+#include "error.hpp"
+
+#if CPU_X86
+    #include <intrin.h>
+    #include <immintrin.h>
+#endif
+
+typedef void (*Decode_Row_Func)(const BYTE* blocks, int block_count, UINT32* destination, UINT stride);
+
+// Interpolation weights of BC6H and BC7 indices, out of 64.
+static const BYTE weights2[4] = { 0, 21, 43, 64 };
+static const BYTE weights3[8] = { 0, 9, 18, 27, 37, 46, 55, 64 };
+static const BYTE weights4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+// Subset of each pixel in partitions of two subsets, bit i is pixel i. BC6H uses the first 32.
+static const UINT16 partitions2[64] = {
+    0xCCCC, 0x8888, 0xEEEE, 0xECC8, 0xC880, 0xFEEC, 0xFEC8, 0xEC80,
+    0xC800, 0xFFEC, 0xFE80, 0xE800, 0xFFE8, 0xFF00, 0xFFF0, 0xF000,
+    0xF710, 0x008E, 0x7100, 0x08CE, 0x008C, 0x7310, 0x3100, 0x8CCE,
+    0x088C, 0x3110, 0x6666, 0x366C, 0x17E8, 0x0FF0, 0x718E, 0x399C,
+    0xAAAA, 0xF0F0, 0x5A5A, 0x33CC, 0x3C3C, 0x55AA, 0x9696, 0xA55A,
+    0x73CE, 0x13C8, 0x324C, 0x3BDC, 0x6996, 0xC33C, 0x9966, 0x0660,
+    0x0272, 0x04E4, 0x4E40, 0x2720, 0xC936, 0x936C, 0x39C6, 0x639C,
+    0x9336, 0x9CC6, 0x817E, 0xE718, 0xCCF0, 0x0FCC, 0x7744, 0xEE22,
+};
+
+// Subset of each pixel in partitions of three subsets, bits 2i and 2i + 1 are pixel i.
+static const UINT32 partitions3[64] = {
+    0xAA685050, 0x6A5A5040, 0x5A5A4200, 0x5450A0A8, 0xA5A50000, 0xA0A05050, 0x5555A0A0, 0x5A5A5050,
+    0xAA550000, 0xAA555500, 0xAAAA5500, 0x90909090, 0x94949494, 0xA4A4A4A4, 0xA9A59450, 0x2A0A4250,
+    0xA5945040, 0x0A425054, 0xA5A5A500, 0x55A0A0A0, 0xA8A85454, 0x6A6A4040, 0xA4A45000, 0x1A1A0500,
+    0x0050A4A4, 0xAAA59090, 0x14696914, 0x69691400, 0xA08585A0, 0xAA821414, 0x50A4A450, 0x6A5A0200,
+    0xA9A58000, 0x5090A0A8, 0xA8A09050, 0x24242424, 0x00AA5500, 0x24924924, 0x24499224, 0x50A50A50,
+    0x500AA550, 0xAAAA4444, 0x66660000, 0xA5A0A5A0, 0x50A050A0, 0x69286928, 0x44AAAA44, 0x66666600,
+    0xAA444444, 0x54A854A8, 0x95809580, 0x96969600, 0xA85454A8, 0x80959580, 0xAA141414, 0x96960000,
+    0xAAAA1414, 0xA05050A0, 0xA0A5A5A0, 0x96000000, 0x40804080, 0xA9A8A9A8, 0xAAAAAA44, 0x2A4A5254,
+};
+
+// Pixels of the second subset, and of the second and third, whose index is a bit shorter. Index of
+// pixel 0 always is.
+static const BYTE anchors2[64] = {
+    15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+    15,  2,  8,  2,  2,  8,  8, 15,  2,  8,  2,  2,  8,  8,  2,  2,
+    15, 15,  6,  8,  2,  8, 15, 15,  2,  8,  2,  2,  2, 15, 15,  6,
+     6,  2,  6,  8, 15, 15,  2,  2, 15, 15, 15, 15, 15,  2,  2, 15,
+};
+
+static const BYTE anchors3_second[64] = {
+     3,  3, 15, 15,  8,  3, 15, 15,  8,  8,  6,  6,  6,  5,  3,  3,
+     3,  3,  8, 15,  3,  3,  6, 10,  5,  8,  8,  6,  8,  5, 15, 15,
+     8, 15,  3,  5,  6, 10,  8, 15, 15,  3, 15,  5, 15, 15, 15, 15,
+     3, 15,  5,  5,  5,  8,  5, 10,  5, 10,  8, 13, 15, 12,  3,  3,
+};
+
+static const BYTE anchors3_third[64] = {
+    15,  8,  8,  3, 15, 15,  3,  8, 15, 15, 15, 15, 15, 15, 15,  8,
+    15,  8, 15,  3, 15,  8, 15,  8,  3, 15,  6, 10, 15, 15, 10,  8,
+    15,  3, 15, 10, 10,  8,  9, 10,  6, 15,  8, 15,  3,  6,  6,  8,
+    15,  3, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,  3, 15, 15,  8,
+};
+
+struct Bc7_Mode
+{
+    BYTE subsets;
+    BYTE partition_bits;
+    BYTE rotation_bits;
+    BYTE index_selection_bits;
+    BYTE color_bits;
+    BYTE alpha_bits;
+    // P-bit is the lowest bit of all channels of an endpoint, or of both endpoints of a subset.
+    BYTE has_endpoint_pbits;
+    BYTE has_shared_pbits;
+    BYTE index_bits;
+    // Modes 4 and 5 have a second set of indices, for alpha or for color.
+    BYTE index_bits2;
+};
+
+static const Bc7_Mode bc7_modes[8] = {
+    { 3, 4, 0, 0, 4, 0, 1, 0, 3, 0 },
+    { 2, 6, 0, 0, 6, 0, 0, 1, 3, 0 },
+    { 3, 6, 0, 0, 5, 0, 0, 0, 2, 0 },
+    { 2, 6, 0, 0, 7, 0, 1, 0, 2, 0 },
+    { 1, 0, 2, 1, 5, 6, 0, 0, 2, 3 },
+    { 1, 0, 2, 0, 7, 8, 0, 0, 2, 2 },
+    { 1, 0, 0, 0, 7, 7, 1, 0, 4, 0 },
+    { 2, 6, 0, 0, 5, 5, 1, 0, 2, 0 },
+};
+
+// Endpoint channels of BC6H, 'R1' is red of the second endpoint.
+enum Bc6h_Field : BYTE
+{
+    R0, G0, B0,
+    R1, G1, B1,
+    R2, G2, B2,
+    R3, G3, B3,
+};
+
+// Bits of a field stored next to each other in a block.
+struct Bc6h_Segment
+{
+    BYTE field;
+    BYTE shift;
+    BYTE count;
+};
+
+// Modes differ in precision of endpoints and in where their bits are, fields are scattered through the
+// block. Mode is 2 bits, or 5 when the lower 2 are at least 2.
+struct Bc6h_Mode
+{
+    BYTE mode;
+    BYTE subsets;
+    BYTE is_transformed;
+    BYTE endpoint_bits;
+    // Precision of R, G and B of endpoints stored as differences from the first one.
+    BYTE delta_bits[3];
+    BYTE segment_count;
+    Bc6h_Segment segments[24];
+};
+
+static const Bc6h_Mode bc6h_modes[] = {
+    { 0x00, 2, 1, 10, { 5, 5, 5 }, 19, {
+        { G2, 4, 1 }, { B2, 4, 1 }, { B3, 4, 1 }, { R0, 0, 10 }, { G0, 0, 10 }, { B0, 0, 10 }, { R1, 0, 5 },
+        { G3, 4, 1 }, { G2, 0, 4 }, { G1, 0, 5 }, { B3, 0, 1 }, { G3, 0, 4 }, { B1, 0, 5 }, { B3, 1, 1 },
+        { B2, 0, 4 }, { R2, 0, 5 }, { B3, 2, 1 }, { R3, 0, 5 }, { B3, 3, 1 } } },
+    { 0x01, 2, 1, 7, { 6, 6, 6 }, 23, {
+        { G2, 5, 1 }, { G3, 4, 1 }, { G3, 5, 1 }, { R0, 0, 7 }, { B3, 0, 1 }, { B3, 1, 1 }, { B2, 4, 1 },
+        { G0, 0, 7 }, { B2, 5, 1 }, { B3, 2, 1 }, { G2, 4, 1 }, { B0, 0, 7 }, { B3, 3, 1 }, { B3, 5, 1 },
+        { B3, 4, 1 }, { R1, 0, 6 }, { G2, 0, 4 }, { G1, 0, 6 }, { G3, 0, 4 }, { B1, 0, 6 }, { B2, 0, 4 },
+        { R2, 0, 6 }, { R3, 0, 6 } } },
+    { 0x02, 2, 1, 11, { 5, 4, 4 }, 18, {
+        { R0, 0, 10 }, { G0, 0, 10 }, { B0, 0, 10 }, { R1, 0, 5 }, { R0, 10, 1 }, { G2, 0, 4 }, { G1, 0, 4 },
+        { G0, 10, 1 }, { B3, 0, 1 }, { G3, 0, 4 }, { B1, 0, 4 }, { B0, 10, 1 }, { B3, 1, 1 }, { B2, 0, 4 },
+        { R2, 0, 5 }, { B3, 2, 1 }, { R3, 0, 5 }, { B3, 3, 1 } } },
+    { 0x06, 2, 1, 11, { 4, 5, 4 }, 20, {
+        { R0, 0, 10 }, { G0, 0, 10 }, { B0, 0, 10 }, { R1, 0, 4 }, { R0, 10, 1 }, { G3, 4, 1 }, { G2, 0, 4 },
+        { G1, 0, 5 }, { G0, 10, 1 }, { G3, 0, 4 }, { B1, 0, 4 }, { B0, 10, 1 }, { B3, 1, 1 }, { B2, 0, 4 },
+        { R2, 0, 4 }, { B3, 0, 1 }, { B3, 2, 1 }, { R3, 0, 4 }, { G2, 4, 1 }, { B3, 3, 1 } } },
+    { 0x0A, 2, 1, 11, { 4, 4, 5 }, 20, {
+        { R0, 0, 10 }, { G0, 0, 10 }, { B0, 0, 10 }, { R1, 0, 4 }, { R0, 10, 1 }, { B2, 4, 1 }, { G2, 0, 4 },
+        { G1, 0, 4 }, { G0, 10, 1 }, { B3, 0, 1 }, { G3, 0, 4 }, { B1, 0, 5 }, { B0, 10, 1 }, { B2, 0, 4 },
+        { R2, 0, 4 }, { B3, 1, 1 }, { B3, 2, 1 }, { R3, 0, 4 }, { B3, 4, 1 }, { B3, 3, 1 } } },
+    { 0x0E, 2, 1, 9, { 5, 5, 5 }, 19, {
+        { R0, 0, 9 }, { B2, 4, 1 }, { G0, 0, 9 }, { G2, 4, 1 }, { B0, 0, 9 }, { B3, 4, 1 }, { R1, 0, 5 },
+        { G3, 4, 1 }, { G2, 0, 4 }, { G1, 0, 5 }, { B3, 0, 1 }, { G3, 0, 4 }, { B1, 0, 5 }, { B3, 1, 1 },
+        { B2, 0, 4 }, { R2, 0, 5 }, { B3, 2, 1 }, { R3, 0, 5 }, { B3, 3, 1 } } },
+    { 0x12, 2, 1, 8, { 6, 5, 5 }, 19, {
+        { R0, 0, 8 }, { G3, 4, 1 }, { B2, 4, 1 }, { G0, 0, 8 }, { B3, 2, 1 }, { G2, 4, 1 }, { B0, 0, 8 },
+        { B3, 3, 1 }, { B3, 4, 1 }, { R1, 0, 6 }, { G2, 0, 4 }, { G1, 0, 5 }, { B3, 0, 1 }, { G3, 0, 4 },
+        { B1, 0, 5 }, { B3, 1, 1 }, { B2, 0, 4 }, { R2, 0, 6 }, { R3, 0, 6 } } },
+    { 0x16, 2, 1, 8, { 5, 6, 5 }, 21, {
+        { R0, 0, 8 }, { B3, 0, 1 }, { B2, 4, 1 }, { G0, 0, 8 }, { G2, 5, 1 }, { G2, 4, 1 }, { B0, 0, 8 },
+        { G3, 5, 1 }, { B3, 4, 1 }, { R1, 0, 5 }, { G3, 4, 1 }, { G2, 0, 4 }, { G1, 0, 6 }, { G3, 0, 4 },
+        { B1, 0, 5 }, { B3, 1, 1 }, { B2, 0, 4 }, { R2, 0, 5 }, { B3, 2, 1 }, { R3, 0, 5 }, { B3, 3, 1 } } },
+    { 0x1A, 2, 1, 8, { 5, 5, 6 }, 21, {
+        { R0, 0, 8 }, { B3, 1, 1 }, { B2, 4, 1 }, { G0, 0, 8 }, { B2, 5, 1 }, { G2, 4, 1 }, { B0, 0, 8 },
+        { B3, 5, 1 }, { B3, 4, 1 }, { R1, 0, 5 }, { G3, 4, 1 }, { G2, 0, 4 }, { G1, 0, 5 }, { B3, 0, 1 },
+        { G3, 0, 4 }, { B1, 0, 6 }, { B2, 0, 4 }, { R2, 0, 5 }, { B3, 2, 1 }, { R3, 0, 5 }, { B3, 3, 1 } } },
+    { 0x1E, 2, 0, 6, { 6, 6, 6 }, 23, {
+        { R0, 0, 6 }, { G3, 4, 1 }, { B3, 0, 1 }, { B3, 1, 1 }, { B2, 4, 1 }, { G0, 0, 6 }, { G2, 5, 1 },
+        { B2, 5, 1 }, { B3, 2, 1 }, { G2, 4, 1 }, { B0, 0, 6 }, { G3, 5, 1 }, { B3, 3, 1 }, { B3, 5, 1 },
+        { B3, 4, 1 }, { R1, 0, 6 }, { G2, 0, 4 }, { G1, 0, 6 }, { G3, 0, 4 }, { B1, 0, 6 }, { B2, 0, 4 },
+        { R2, 0, 6 }, { R3, 0, 6 } } },
+    { 0x03, 1, 0, 10, { 10, 10, 10 }, 6, {
+        { R0, 0, 10 }, { G0, 0, 10 }, { B0, 0, 10 }, { R1, 0, 10 }, { G1, 0, 10 }, { B1, 0, 10 } } },
+    { 0x07, 1, 1, 11, { 9, 9, 9 }, 9, {
+        { R0, 0, 10 }, { G0, 0, 10 }, { B0, 0, 10 }, { R1, 0, 9 }, { R0, 10, 1 }, { G1, 0, 9 }, { G0, 10, 1 },
+        { B1, 0, 9 }, { B0, 10, 1 } } },
+    // High bits of the first endpoint are stored from the highest one down.
+    { 0x0B, 1, 1, 12, { 8, 8, 8 }, 12, {
+        { R0, 0, 10 }, { G0, 0, 10 }, { B0, 0, 10 }, { R1, 0, 8 }, { R0, 11, 1 }, { R0, 10, 1 }, { G1, 0, 8 },
+        { G0, 11, 1 }, { G0, 10, 1 }, { B1, 0, 8 }, { B0, 11, 1 }, { B0, 10, 1 } } },
+    { 0x0F, 1, 1, 16, { 4, 4, 4 }, 24, {
+        { R0, 0, 10 }, { G0, 0, 10 }, { B0, 0, 10 }, { R1, 0, 4 }, { R0, 15, 1 }, { R0, 14, 1 }, { R0, 13, 1 },
+        { R0, 12, 1 }, { R0, 11, 1 }, { R0, 10, 1 }, { G1, 0, 4 }, { G0, 15, 1 }, { G0, 14, 1 }, { G0, 13, 1 },
+        { G0, 12, 1 }, { G0, 11, 1 }, { G0, 10, 1 }, { B1, 0, 4 }, { B0, 15, 1 }, { B0, 14, 1 }, { B0, 13, 1 },
+        { B0, 12, 1 }, { B0, 11, 1 }, { B0, 10, 1 } } },
+};
+
+// Reads bits of a 16 byte block from the lowest one up.
+struct Bit_Reader
+{
+    UINT64 low;
+    UINT64 high;
+    int position;
+};
+
+static inline void start_reading(Bit_Reader* reader, const BYTE* block, int position)
+{
+    memcpy(&reader->low, block, sizeof(UINT64));
+    memcpy(&reader->high, block + sizeof(UINT64), sizeof(UINT64));
+    reader->position = position;
+}
+
+// Reads up to 16 bits.
+static inline UINT32 read_bits(Bit_Reader* reader, int count)
+{
+    const int position = reader->position;
+    UINT64 bits;
+    if (position >= 64)
+        bits = reader->high >> (position - 64);
+    else if (position + count <= 64)
+        bits = reader->low >> position;
+    else
+        bits = (reader->low >> position) | (reader->high << (64 - position));
+
+    reader->position += count;
+    return static_cast<UINT32>(bits) & ((1u << count) - 1);
+}
+
+static inline UINT32 pack_bgra(UINT32 r, UINT32 g, UINT32 b, UINT32 a)
+{
+    return (a << 24) | (r << 16) | (g << 8) | b;
+}
+
+// Same as round(color * alpha / 255).
+static inline UINT32 premultiply_channel(UINT32 color, UINT32 alpha)
+{
+    UINT32 t = color * alpha + 128;
+    return (t + (t >> 8)) >> 8;
+}
+
+static inline UINT32 premultiply_pixel(UINT32 pixel)
+{
+    UINT32 a = pixel >> 24;
+    if (a == 0xFF)
+        return pixel;
+
+    UINT32 r = premultiply_channel((pixel >> 16) & 0xFF, a);
+    UINT32 g = premultiply_channel((pixel >> 8) & 0xFF, a);
+    UINT32 b = premultiply_channel(pixel & 0xFF, a);
+
+    return (a << 24) | (r << 16) | (g << 8) | b;
+}
+
+static inline UINT32* destination_row(UINT32* destination, UINT stride, int y)
+{
+    return reinterpret_cast<UINT32*>(reinterpret_cast<BYTE*>(destination) + static_cast<size_t>(y) * stride);
+}
+
+// Colors of a BC1 block as BGRA. When the first endpoint is not greater than the second, there are three
+// colors and transparent black, unless it's the color of a BC2 or BC3 block.
+static inline void bc1_colors(const BYTE* block, bool has_transparent_black, UINT32 colors[4])
+{
+    const UINT32 c0 = block[0] | (block[1] << 8);
+    const UINT32 c1 = block[2] | (block[3] << 8);
+
+    const UINT32 r0 = ((c0 >> 8) & 0xF8) | (c0 >> 13);
+    const UINT32 g0 = ((c0 >> 3) & 0xFC) | ((c0 >> 9) & 0x03);
+    const UINT32 b0 = ((c0 << 3) & 0xF8) | ((c0 >> 2) & 0x07);
+    const UINT32 r1 = ((c1 >> 8) & 0xF8) | (c1 >> 13);
+    const UINT32 g1 = ((c1 >> 3) & 0xFC) | ((c1 >> 9) & 0x03);
+    const UINT32 b1 = ((c1 << 3) & 0xF8) | ((c1 >> 2) & 0x07);
+
+    colors[0] = pack_bgra(r0, g0, b0, 255);
+    colors[1] = pack_bgra(r1, g1, b1, 255);
+    if (c0 > c1 || !has_transparent_black)
+    {
+        colors[2] = pack_bgra((2 * r0 + r1) / 3, (2 * g0 + g1) / 3, (2 * b0 + b1) / 3, 255);
+        colors[3] = pack_bgra((r0 + 2 * r1) / 3, (g0 + 2 * g1) / 3, (b0 + 2 * b1) / 3, 255);
+    }
+    else
+    {
+        colors[2] = pack_bgra((r0 + r1) / 2, (g0 + g1) / 2, (b0 + b1) / 2, 255);
+        colors[3] = 0;
+    }
+}
+
+// Values of a BC4 block, or of BC3 alpha: two endpoints and 6 values between them, or 4 values
+// between them, 0 and 255.
+static inline void bc4_values(const BYTE* block, BYTE values[8])
+{
+    const UINT32 v0 = block[0];
+    const UINT32 v1 = block[1];
+    values[0] = static_cast<BYTE>(v0);
+    values[1] = static_cast<BYTE>(v1);
+
+    if (v0 > v1)
+    {
+        for (UINT32 i = 1; i < 7; ++i)
+            values[i + 1] = static_cast<BYTE>(((7 - i) * v0 + i * v1) / 7);
+    }
+    else
+    {
+        for (UINT32 i = 1; i < 5; ++i)
+            values[i + 1] = static_cast<BYTE>(((5 - i) * v0 + i * v1) / 5);
+        values[6] = 0;
+        values[7] = 255;
+    }
+}
+
+// Signed values of a BC4 block mapped from [-1, 1] to [0, 255].
+static inline void bc4_signed_values(const BYTE* block, BYTE values[8])
+{
+    // -128 is the same as -127, endpoints are moved to [0, 254] so they're interpolated as unsigned.
+    const int s0 = static_cast<signed char>(block[0]);
+    const int s1 = static_cast<signed char>(block[1]);
+    const int v0 = max(s0, -127) + 127;
+    const int v1 = max(s1, -127) + 127;
+
+    int unmapped[8];
+    unmapped[0] = v0 * 7;
+    unmapped[1] = v1 * 7;
+    if (s0 > s1)
+    {
+        for (int i = 1; i < 7; ++i)
+            unmapped[i + 1] = (7 - i) * v0 + i * v1;
+    }
+    else
+    {
+        for (int i = 1; i < 5; ++i)
+            unmapped[i + 1] = ((5 - i) * v0 + i * v1) * 7 / 5;
+        unmapped[6] = 0;
+        unmapped[7] = 254 * 7;
+    }
+
+    for (int i = 0; i < 8; ++i)
+        values[i] = static_cast<BYTE>((unmapped[i] * 255 + 127 * 7) / (254 * 7));
+}
+
+// 3-bit indices of a BC4 block, one per byte.
+static inline void bc4_indices(const BYTE* block, BYTE indices[16])
+{
+    UINT64 bits = 0;
+    for (int i = 0; i < 6; ++i)
+        bits |= static_cast<UINT64>(block[2 + i]) << (8 * i);
+
+    for (int i = 0; i < 16; ++i)
+        indices[i] = static_cast<BYTE>((bits >> (3 * i)) & 7);
+}
+
+template<bool Is_Signed>
+static inline void bc4_decode_channel(const BYTE* block, BYTE channel[16])
+{
+    BYTE values[8];
+    BYTE indices[16];
+    if (Is_Signed)
+        bc4_signed_values(block, values);
+    else
+        bc4_values(block, values);
+    bc4_indices(block, indices);
+
+    for (int i = 0; i < 16; ++i)
+        channel[i] = values[indices[i]];
+}
+
+// Endpoints of the subset of each pixel and weights of the second one, which pixels of BC6H and BC7 blocks
+// are interpolated from.
+struct Unpacked_Block
+{
+    // RGBA bytes for BC7, 16-bit R, G and B for BC6H.
+    UINT32 low[16][4];
+    UINT32 high[16][4];
+    // Out of 64, for R, G, B and A.
+    UINT16 weights[16][4];
+    // Alpha is swapped with R, G or B after BC7 pixels are interpolated.
+    int rotation;
+};
+
+static inline int bc7_subset(int subsets, int partition, int pixel)
+{
+    if (subsets == 2)
+        return (partitions2[partition] >> pixel) & 1;
+    if (subsets == 3)
+        return (partitions3[partition] >> (2 * pixel)) & 3;
+    return 0;
+}
+
+static inline bool is_anchor(int subsets, int partition, int pixel)
+{
+    if (pixel == 0)
+        return true;
+    if (subsets == 2)
+        return pixel == anchors2[partition];
+    if (subsets == 3)
+        return pixel == anchors3_second[partition] || pixel == anchors3_third[partition];
+    return false;
+}
+
+static inline const BYTE* weights_for_bits(int bits)
+{
+    return bits == 2 ? weights2 : (bits == 3 ? weights3 : weights4);
+}
+
+// Expands 'bits' wide value to 8 bits by repeating its high bits.
+static inline UINT32 expand_bits(UINT32 value, int bits)
+{
+    return (value << (8 - bits)) | (value >> (2 * bits - 8));
+}
+
+static void bc7_unpack(const BYTE* block, Unpacked_Block* unpacked)
+{
+    // Mode is the number of zero bits before the first one, a block without one is transparent black.
+    int mode = 0;
+    while (mode < 8 && (block[0] & (1 << mode)) == 0)
+        ++mode;
+
+    if (mode == 8)
+    {
+        memset(unpacked, 0, sizeof(Unpacked_Block));
+        return;
+    }
+
+    const Bc7_Mode& m = bc7_modes[mode];
+    Bit_Reader reader;
+    start_reading(&reader, block, mode + 1);
+
+    const int partition = static_cast<int>(read_bits(&reader, m.partition_bits));
+    unpacked->rotation = static_cast<int>(read_bits(&reader, m.rotation_bits));
+    const UINT32 index_selection = read_bits(&reader, m.index_selection_bits);
+
+    // Channels of all endpoints are stored one channel after another.
+    const int endpoint_count = 2 * m.subsets;
+    UINT32 endpoints[6][4];
+    for (int c = 0; c < 3; ++c)
+    {
+        for (int e = 0; e < endpoint_count; ++e)
+            endpoints[e][c] = read_bits(&reader, m.color_bits);
+    }
+    for (int e = 0; e < endpoint_count; ++e)
+        endpoints[e][3] = read_bits(&reader, m.alpha_bits);
+
+    int color_bits = m.color_bits;
+    int alpha_bits = m.alpha_bits;
+    if (m.has_endpoint_pbits || m.has_shared_pbits)
+    {
+        UINT32 pbits[6];
+        if (m.has_endpoint_pbits)
+        {
+            for (int e = 0; e < endpoint_count; ++e)
+                pbits[e] = read_bits(&reader, 1);
+        }
+        else
+        {
+            for (int s = 0; s < m.subsets; ++s)
+                pbits[2 * s] = pbits[2 * s + 1] = read_bits(&reader, 1);
+        }
+
+        for (int e = 0; e < endpoint_count; ++e)
+        {
+            for (int c = 0; c < 4; ++c)
+                endpoints[e][c] = (endpoints[e][c] << 1) | pbits[e];
+        }
+
+        ++color_bits;
+        ++alpha_bits;
+    }
+
+    for (int e = 0; e < endpoint_count; ++e)
+    {
+        for (int c = 0; c < 3; ++c)
+            endpoints[e][c] = expand_bits(endpoints[e][c], color_bits);
+        endpoints[e][3] = m.alpha_bits > 0 ? expand_bits(endpoints[e][3], alpha_bits) : 255;
+    }
+
+    UINT32 indices[16];
+    for (int i = 0; i < 16; ++i)
+        indices[i] = read_bits(&reader, m.index_bits - (is_anchor(m.subsets, partition, i) ? 1 : 0));
+
+    // Second indices are for alpha, or for color when index selection bit is set.
+    const BYTE* color_weights = weights_for_bits(m.index_bits);
+    const BYTE* alpha_weights = color_weights;
+    UINT32 alpha_indices[16];
+    const UINT32* color_index = indices;
+    const UINT32* alpha_index = indices;
+    if (m.index_bits2 > 0)
+    {
+        for (int i = 0; i < 16; ++i)
+            alpha_indices[i] = read_bits(&reader, m.index_bits2 - (i == 0 ? 1 : 0));
+
+        alpha_weights = weights_for_bits(m.index_bits2);
+        alpha_index = alpha_indices;
+        if (index_selection != 0)
+        {
+            const BYTE* swapped_weights = color_weights;
+            color_weights = alpha_weights;
+            alpha_weights = swapped_weights;
+            color_index = alpha_indices;
+            alpha_index = indices;
+        }
+    }
+
+    for (int i = 0; i < 16; ++i)
+    {
+        const int subset = bc7_subset(m.subsets, partition, i);
+        const UINT16 color_weight = color_weights[color_index[i]];
+        for (int c = 0; c < 4; ++c)
+        {
+            unpacked->low[i][c] = endpoints[2 * subset][c];
+            unpacked->high[i][c] = endpoints[2 * subset + 1][c];
+            unpacked->weights[i][c] = color_weight;
+        }
+        unpacked->weights[i][3] = alpha_weights[alpha_index[i]];
+    }
+}
+
+static inline int sign_extend(int value, int bits)
+{
+    const int sign = 1 << (bits - 1);
+    return (value & (sign - 1)) - (value & sign);
+}
+
+// Scales quantized endpoint to 16 bits, 'finish_unquantize' scales interpolated values to half floats.
+static inline int unquantize(int value, int bits, bool is_signed)
+{
+    if (!is_signed)
+    {
+        if (bits >= 15 || value == 0)
+            return value;
+        if (value == (1 << bits) - 1)
+            return 0xFFFF;
+        return ((value << 16) + 0x8000) >> bits;
+    }
+
+    if (bits >= 16)
+        return value;
+
+    const bool is_negative = value < 0;
+    int magnitude = is_negative ? -value : value;
+    if (magnitude == 0)
+        return 0;
+
+    if (magnitude >= (1 << (bits - 1)) - 1)
+        magnitude = 0x7FFF;
+    else
+        magnitude = ((magnitude << 15) + 0x4000) >> (bits - 1);
+
+    return is_negative ? -magnitude : magnitude;
+}
+
+static void bc6h_unpack(const BYTE* block, bool is_signed, Unpacked_Block* unpacked)
+{
+    Bit_Reader reader;
+    start_reading(&reader, block, 0);
+
+    UINT32 mode_bits = read_bits(&reader, 2);
+    if (mode_bits >= 2)
+        mode_bits |= read_bits(&reader, 3) << 2;
+
+    const Bc6h_Mode* m = nullptr;
+    for (int i = 0; i < ARRAYSIZE(bc6h_modes) && m == nullptr; ++i)
+    {
+        if (bc6h_modes[i].mode == mode_bits)
+            m = &bc6h_modes[i];
+    }
+
+    // Reserved modes decode to black.
+    memset(unpacked, 0, sizeof(Unpacked_Block));
+    if (m == nullptr)
+        return;
+
+    int fields[12] = {};
+    for (int i = 0; i < m->segment_count; ++i)
+    {
+        const Bc6h_Segment& segment = m->segments[i];
+        fields[segment.field] |= static_cast<int>(read_bits(&reader, segment.count)) << segment.shift;
+    }
+
+    const int partition = m->subsets == 2 ? static_cast<int>(read_bits(&reader, 5)) : 0;
+
+    // Other endpoints are differences from the first one when the mode is transformed.
+    const int bits = m->endpoint_bits;
+    const int endpoint_count = 2 * m->subsets;
+    if (is_signed)
+    {
+        for (int c = 0; c < 3; ++c)
+            fields[c] = sign_extend(fields[c], bits);
+    }
+
+    for (int e = 1; e < endpoint_count; ++e)
+    {
+        for (int c = 0; c < 3; ++c)
+        {
+            int& value = fields[3 * e + c];
+            if (m->is_transformed)
+            {
+                value = (fields[c] + sign_extend(value, m->delta_bits[c])) & ((1 << bits) - 1);
+                if (is_signed)
+                    value = sign_extend(value, bits);
+            }
+            else if (is_signed)
+            {
+                value = sign_extend(value, bits);
+            }
+        }
+    }
+
+    for (int i = 0; i < 3 * endpoint_count; ++i)
+        fields[i] = unquantize(fields[i], bits, is_signed);
+
+    const int index_bits = m->subsets == 2 ? 3 : 4;
+    const BYTE* weights = weights_for_bits(index_bits);
+    for (int i = 0; i < 16; ++i)
+    {
+        const int subset = m->subsets == 2 ? (partitions2[partition] >> i) & 1 : 0;
+        const int anchor_bit = (i == 0 || (m->subsets == 2 && i == anchors2[partition])) ? 1 : 0;
+        const UINT16 weight = weights[read_bits(&reader, index_bits - anchor_bit)];
+        for (int c = 0; c < 3; ++c)
+        {
+            // Signed values are kept in unsigned fields, they're interpolated as int.
+            unpacked->low[i][c] = static_cast<UINT32>(fields[6 * subset + c]);
+            unpacked->high[i][c] = static_cast<UINT32>(fields[6 * subset + 3 + c]);
+            unpacked->weights[i][c] = weight;
+        }
+    }
+}
+
+static inline float half_to_float(UINT32 half)
+{
+    const UINT32 exponent = (half >> 10) & 0x1F;
+    const UINT32 mantissa = half & 0x3FF;
+    if (exponent == 0)
+        return ldexpf(static_cast<float>(mantissa), -24);
+
+    return ldexpf(static_cast<float>(mantissa | 0x400), static_cast<int>(exponent) - 25);
+}
+
+// Maps non-negative half floats up to the largest finite one to sRGB bytes, 1.0 and above is 255.
+static const int half_table_size = 0x7C00;
+
+struct Half_Table
+{
+    BYTE to_srgb[half_table_size];
+};
+
+static Half_Table make_half_table()
+{
+    Half_Table table;
+    for (int i = 0; i < half_table_size; ++i)
+    {
+        const float linear = min(half_to_float(static_cast<UINT32>(i)), 1.0f);
+        const float srgb = linear <= 0.0031308f ? linear * 12.92f : 1.055f * powf(linear, 1.0f / 2.4f) - 0.055f;
+        table.to_srgb[i] = static_cast<BYTE>(255.0f * srgb + 0.5f);
+    }
+
+    return table;
+}
+
+static const Half_Table& get_half_table()
+{
+    static const Half_Table table = make_half_table();
+    return table;
+}
+
+// Interpolates 16-bit BC6H endpoints and scales the result to half float, negative values are black.
+template<bool Is_Signed>
+static inline BYTE bc6h_channel(const Unpacked_Block& unpacked, int pixel, int channel, const Half_Table& table)
+{
+    const int low = static_cast<int>(unpacked.low[pixel][channel]);
+    const int high = static_cast<int>(unpacked.high[pixel][channel]);
+    const int weight = unpacked.weights[pixel][channel];
+    const int value = (low * (64 - weight) + high * weight + 32) >> 6;
+
+    int half;
+    if (Is_Signed)
+        half = value < 0 ? 0 : (value * 31) >> 5;
+    else
+        half = (value * 31) >> 6;
+
+    return table.to_srgb[min(half, half_table_size - 1)];
+}
+
+#pragma region Scalar
+static void decode_bc1_scalar(const BYTE* blocks, int block_count, UINT32* destination, UINT stride)
+{
+    for (int i = 0; i < block_count; ++i)
+    {
+        const BYTE* block = blocks + 8 * i;
+        UINT32 colors[4];
+        bc1_colors(block, true, colors);
+
+        // Colors are opaque or transparent black, so they're premultiplied already.
+        for (int y = 0; y < 4; ++y)
+        {
+            UINT32* row = destination_row(destination, stride, y) + 4 * i;
+            const UINT32 indices = block[4 + y];
+            for (int x = 0; x < 4; ++x)
+                row[x] = colors[(indices >> (2 * x)) & 3];
+        }
+    }
+}
+
+template<bool Is_Bc3>
+static void decode_bc2_bc3_scalar(const BYTE* blocks, int block_count, UINT32* destination, UINT stride)
+{
+    for (int i = 0; i < block_count; ++i)
+    {
+        const BYTE* block = blocks + 16 * i;
+        UINT32 colors[4];
+        bc1_colors(block + 8, false, colors);
+
+        BYTE alpha[16];
+        if (Is_Bc3)
+        {
+            bc4_decode_channel<false>(block, alpha);
+        }
+        else
+        {
+            for (int k = 0; k < 16; ++k)
+                alpha[k] = static_cast<BYTE>(((block[k / 2] >> (4 * (k & 1))) & 0x0F) * 17);
+        }
+
+        for (int y = 0; y < 4; ++y)
+        {
+            UINT32* row = destination_row(destination, stride, y) + 4 * i;
+            const UINT32 indices = block[12 + y];
+            for (int x = 0; x < 4; ++x)
+            {
+                const UINT32 color = colors[(indices >> (2 * x)) & 3] & 0x00FFFFFF;
+                row[x] = premultiply_pixel(color | (static_cast<UINT32>(alpha[4 * y + x]) << 24));
+            }
+        }
+    }
+}
+
+template<bool Is_Signed>
+static void decode_bc4_scalar(const BYTE* blocks, int block_count, UINT32* destination, UINT stride)
+{
+    for (int i = 0; i < block_count; ++i)
+    {
+        BYTE gray[16];
+        bc4_decode_channel<Is_Signed>(blocks + 8 * i, gray);
+
+        for (int y = 0; y < 4; ++y)
+        {
+            UINT32* row = destination_row(destination, stride, y) + 4 * i;
+            for (int x = 0; x < 4; ++x)
+            {
+                const UINT32 value = gray[4 * y + x];
+                row[x] = pack_bgra(value, value, value, 255);
+            }
+        }
+    }
+}
+
+template<bool Is_Signed>
+static void decode_bc5_scalar(const BYTE* blocks, int block_count, UINT32* destination, UINT stride)
+{
+    for (int i = 0; i < block_count; ++i)
+    {
+        BYTE red[16];
+        BYTE green[16];
+        bc4_decode_channel<Is_Signed>(blocks + 16 * i, red);
+        bc4_decode_channel<Is_Signed>(blocks + 16 * i + 8, green);
+
+        for (int y = 0; y < 4; ++y)
+        {
+            UINT32* row = destination_row(destination, stride, y) + 4 * i;
+            for (int x = 0; x < 4; ++x)
+                row[x] = pack_bgra(red[4 * y + x], green[4 * y + x], 0, 255);
+        }
+    }
+}
+
+template<bool Is_Signed>
+static void decode_bc6h_scalar(const BYTE* blocks, int block_count, UINT32* destination, UINT stride)
+{
+    const Half_Table& table = get_half_table();
+    Unpacked_Block unpacked;
+
+    for (int i = 0; i < block_count; ++i)
+    {
+        bc6h_unpack(blocks + 16 * i, Is_Signed, &unpacked);
+
+        for (int y = 0; y < 4; ++y)
+        {
+            UINT32* row = destination_row(destination, stride, y) + 4 * i;
+            for (int x = 0; x < 4; ++x)
+            {
+                const int pixel = 4 * y + x;
+                row[x] = pack_bgra(bc6h_channel<Is_Signed>(unpacked, pixel, 0, table), bc6h_channel<Is_Signed>(unpacked, pixel, 1, table),
+                    bc6h_channel<Is_Signed>(unpacked, pixel, 2, table), 255);
+            }
+        }
+    }
+}
+
+static void decode_bc7_scalar(const BYTE* blocks, int block_count, UINT32* destination, UINT stride)
+{
+    Unpacked_Block unpacked;
+
+    for (int i = 0; i < block_count; ++i)
+    {
+        bc7_unpack(blocks + 16 * i, &unpacked);
+
+        for (int y = 0; y < 4; ++y)
+        {
+            UINT32* row = destination_row(destination, stride, y) + 4 * i;
+            for (int x = 0; x < 4; ++x)
+            {
+                const int pixel = 4 * y + x;
+                UINT32 rgba[4];
+                for (int c = 0; c < 4; ++c)
+                {
+                    const UINT32 weight = unpacked.weights[pixel][c];
+                    rgba[c] = (unpacked.low[pixel][c] * (64 - weight) + unpacked.high[pixel][c] * weight + 32) >> 6;
+                }
+
+                if (unpacked.rotation != 0)
+                {
+                    const UINT32 alpha = rgba[3];
+                    rgba[3] = rgba[unpacked.rotation - 1];
+                    rgba[unpacked.rotation - 1] = alpha;
+                }
+
+                row[x] = premultiply_pixel(pack_bgra(rgba[0], rgba[1], rgba[2], rgba[3]));
+            }
+        }
+    }
+}
+#pragma endregion
+
+#if CPU_X86
+#pragma region SSSE3
+static inline __m128i premultiply_ssse3(__m128i pixels)
+{
+    const __m128i alpha_mask = _mm_set1_epi32(0xFF000000);
+
+    // Most pixels are opaque even in textures with alpha channel.
+    __m128i opaque = _mm_cmpeq_epi32(_mm_or_si128(pixels, _mm_set1_epi32(0x00FFFFFF)), _mm_set1_epi32(-1));
+    if (_mm_movemask_epi8(opaque) == 0xFFFF)
+        return pixels;
+
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i bias = _mm_set1_epi16(128);
+    // Alpha of each pixel widened to 16 bits and repeated for B, G and R, alpha itself is multiplied by zero.
+    const __m128i alpha_lo_shuffle = _mm_setr_epi8(3, -1, 3, -1, 3, -1, -1, -1, 7, -1, 7, -1, 7, -1, -1, -1);
+    const __m128i alpha_hi_shuffle = _mm_setr_epi8(11, -1, 11, -1, 11, -1, -1, -1, 15, -1, 15, -1, 15, -1, -1, -1);
+
+    __m128i lo = _mm_mullo_epi16(_mm_unpacklo_epi8(pixels, zero), _mm_shuffle_epi8(pixels, alpha_lo_shuffle));
+    __m128i hi = _mm_mullo_epi16(_mm_unpackhi_epi8(pixels, zero), _mm_shuffle_epi8(pixels, alpha_hi_shuffle));
+
+    lo = _mm_add_epi16(lo, bias);
+    hi = _mm_add_epi16(hi, bias);
+    lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+    hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+
+    return _mm_or_si128(_mm_packus_epi16(lo, hi), _mm_and_si128(pixels, alpha_mask));
+}
+
+// Picks BGRA 'colors' of a row of 4 pixels by their 2-bit indices in 'indices'. Index bits of each pixel
+// are tested to build a shuffle that takes the 4 bytes of its color.
+static inline __m128i select_colors_ssse3(__m128i colors, UINT32 indices)
+{
+    const __m128i low_bits = _mm_setr_epi32(0x01, 0x04, 0x10, 0x40);
+    const __m128i high_bits = _mm_setr_epi32(0x02, 0x08, 0x20, 0x80);
+    const __m128i bytes = _mm_set1_epi32(0x03020100);
+
+    const __m128i index = _mm_set1_epi32(static_cast<int>(indices));
+    const __m128i is_low = _mm_cmpeq_epi32(_mm_and_si128(index, low_bits), low_bits);
+    const __m128i is_high = _mm_cmpeq_epi32(_mm_and_si128(index, high_bits), high_bits);
+    const __m128i shuffle = _mm_or_si128(bytes,
+        _mm_or_si128(_mm_and_si128(is_low, _mm_set1_epi8(4)), _mm_and_si128(is_high, _mm_set1_epi8(8))));
+
+    return _mm_shuffle_epi8(colors, shuffle);
+}
+
+static inline __m128i load_colors(const UINT32 colors[4])
+{
+    return _mm_loadu_si128(reinterpret_cast<const __m128i*>(colors));
+}
+
+// All 16 values of a BC4 block picked from its 8 values with one shuffle.
+template<bool Is_Signed>
+static inline __m128i bc4_decode_ssse3(const BYTE* block)
+{
+    BYTE values[16] = {};
+    BYTE indices[16];
+    if (Is_Signed)
+        bc4_signed_values(block, values);
+    else
+        bc4_values(block, values);
+    bc4_indices(block, indices);
+
+    return _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(values)),
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(indices)));
+}
+
+// Shuffles that move values of row y of a block to byte 'channel' of 4 pixels, other bytes are zero.
+static inline __m128i row_to_channel(int y, int channel)
+{
+    alignas(16) signed char shuffle[16];
+    for (int x = 0; x < 4; ++x)
+    {
+        for (int c = 0; c < 4; ++c)
+            shuffle[4 * x + c] = c == channel ? static_cast<signed char>(4 * y + x) : -1;
+    }
+
+    return _mm_load_si128(reinterpret_cast<const __m128i*>(shuffle));
+}
+
+static void decode_bc1_ssse3(const BYTE* blocks, int block_count, UINT32* destination, UINT stride)
+{
+    for (int i = 0; i < block_count; ++i)
+    {
+        const BYTE* block = blocks + 8 * i;
+        UINT32 colors[4];
+        bc1_colors(block, true, colors);
+        const __m128i palette = load_colors(colors);
+
+        for (int y = 0; y < 4; ++y)
+        {
+            UINT32* row = destination_row(destination, stride, y) + 4 * i;
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(row), select_colors_ssse3(palette, block[4 + y]));
+        }
+    }
+}
+
+template<bool Is_Bc3>
+static void decode_bc2_bc3_ssse3(const BYTE* blocks, int block_count, UINT32* destination, UINT stride)
+{
+    const __m128i color_mask = _mm_set1_epi32(0x00FFFFFF);
+    const __m128i alpha_shuffles[4] = { row_to_channel(0, 3), row_to_channel(1, 3), row_to_channel(2, 3), row_to_channel(3, 3) };
+
+    for (int i = 0; i < block_count; ++i)
+    {
+        const BYTE* block = blocks + 16 * i;
+        UINT32 colors[4];
+        bc1_colors(block + 8, false, colors);
+        const __m128i palette = _mm_and_si128(load_colors(colors), color_mask);
+
+        __m128i alpha;
+        if (Is_Bc3)
+        {
+            alpha = bc4_decode_ssse3<false>(block);
+        }
+        else
+        {
+            // Low and high nibbles of each byte are alpha of two pixels, scaled from 4 bits by 17.
+            const __m128i packed = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(block));
+            const __m128i nibble = _mm_set1_epi8(0x0F);
+            alpha = _mm_unpacklo_epi8(_mm_and_si128(packed, nibble), _mm_and_si128(_mm_srli_epi16(packed, 4), nibble));
+            alpha = _mm_or_si128(alpha, _mm_slli_epi16(alpha, 4));
+        }
+
+        for (int y = 0; y < 4; ++y)
+        {
+            UINT32* row = destination_row(destination, stride, y) + 4 * i;
+            __m128i pixels = _mm_or_si128(select_colors_ssse3(palette, block[12 + y]), _mm_shuffle_epi8(alpha, alpha_shuffles[y]));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(row), premultiply_ssse3(pixels));
+        }
+    }
+}
+
+template<bool Is_Signed>
+static void decode_bc4_ssse3(const BYTE* blocks, int block_count, UINT32* destination, UINT stride)
+{
+    const __m128i alpha = _mm_set1_epi32(0xFF000000);
+    __m128i gray_shuffles[4];
+    for (int y = 0; y < 4; ++y)
+        gray_shuffles[y] = _mm_setr_epi8(4 * y, 4 * y, 4 * y, -1, 4 * y + 1, 4 * y + 1, 4 * y + 1, -1,
+            4 * y + 2, 4 * y + 2, 4 * y + 2, -1, 4 * y + 3, 4 * y + 3, 4 * y + 3, -1);
+
+    for (int i = 0; i < block_count; ++i)
+    {
+        const __m128i gray = bc4_decode_ssse3<Is_Signed>(blocks + 8 * i);
+
+        for (int y = 0; y < 4; ++y)
+        {
+            UINT32* row = destination_row(destination, stride, y) + 4 * i;
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(row), _mm_or_si128(_mm_shuffle_epi8(gray, gray_shuffles[y]), alpha));
+        }
+    }
+}
+
+template<bool Is_Signed>
+static void decode_bc5_ssse3(const BYTE* blocks, int block_count, UINT32* destination, UINT stride)
+{
+    const __m128i alpha = _mm_set1_epi32(0xFF000000);
+    const __m128i red_shuffles[4] = { row_to_channel(0, 2), row_to_channel(1, 2), row_to_channel(2, 2), row_to_channel(3, 2) };
+    const __m128i green_shuffles[4] = { row_to_channel(0, 1), row_to_channel(1, 1), row_to_channel(2, 1), row_to_channel(3, 1) };
+
+    for (int i = 0; i < block_count; ++i)
+    {
+        const __m128i red = bc4_decode_ssse3<Is_Signed>(blocks + 16 * i);
+        const __m128i green = bc4_decode_ssse3<Is_Signed>(blocks + 16 * i + 8);
+
+        for (int y = 0; y < 4; ++y)
+        {
+            UINT32* row = destination_row(destination, stride, y) + 4 * i;
+            const __m128i pixels = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(red, red_shuffles[y]), _mm_shuffle_epi8(green, green_shuffles[y])), alpha);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(row), pixels);
+        }
+    }
+}
+
+// Interpolates two pixels of an unpacked BC7 block, channels are widened to 16 bits.
+static inline __m128i bc7_interpolate_sse2(const Unpacked_Block& unpacked, int pixel)
+{
+    const __m128i low = _mm_packs_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(unpacked.low[pixel])),
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(unpacked.low[pixel + 1])));
+    const __m128i high = _mm_packs_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(unpacked.high[pixel])),
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(unpacked.high[pixel + 1])));
+    const __m128i weights = _mm_loadu_si128(reinterpret_cast<const __m128i*>(unpacked.weights[pixel]));
+    const __m128i inverse = _mm_sub_epi16(_mm_set1_epi16(64), weights);
+
+    const __m128i sum = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(low, inverse), _mm_mullo_epi16(high, weights)), _mm_set1_epi16(32));
+    return _mm_srli_epi16(sum, 6);
+}
+
+static void decode_bc7_ssse3(const BYTE* blocks, int block_count, UINT32* destination, UINT stride)
+{
+    // RGBA to BGRA, with alpha swapped with R, G or B for rotations 1 to 3.
+    const __m128i rotations[4] = {
+        _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15),
+        _mm_setr_epi8(2, 1, 3, 0, 6, 5, 7, 4, 10, 9, 11, 8, 14, 13, 15, 12),
+        _mm_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13),
+        _mm_setr_epi8(3, 1, 0, 2, 7, 5, 4, 6, 11, 9, 8, 10, 15, 13, 12, 14),
+    };
+
+    Unpacked_Block unpacked;
+
+    for (int i = 0; i < block_count; ++i)
+    {
+        bc7_unpack(blocks + 16 * i, &unpacked);
+        const __m128i rotation = rotations[unpacked.rotation];
+
+        for (int y = 0; y < 4; ++y)
+        {
+            UINT32* row = destination_row(destination, stride, y) + 4 * i;
+            const __m128i pixels = _mm_packus_epi16(bc7_interpolate_sse2(unpacked, 4 * y), bc7_interpolate_sse2(unpacked, 4 * y + 2));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(row), premultiply_ssse3(_mm_shuffle_epi8(pixels, rotation)));
+        }
+    }
+}
+#pragma endregion
+#endif
+
+struct Bcn_Kernels
+{
+    Decode_Row_Func decode_row[static_cast<int>(Bcn_Format::NUM_FORMATS)];
+
+    inline void set(Bcn_Format format, Decode_Row_Func func) {
+        decode_row[static_cast<int>(format)] = func;
+    }
+};
+
+static Bcn_Kernels select_kernels(const Cpu_Features& features)
+{
+    Bcn_Kernels k;
+    k.set(Bcn_Format::Unknown,     nullptr);
+    k.set(Bcn_Format::Bc1,         decode_bc1_scalar);
+    k.set(Bcn_Format::Bc2,         decode_bc2_bc3_scalar<false>);
+    k.set(Bcn_Format::Bc3,         decode_bc2_bc3_scalar<true>);
+    k.set(Bcn_Format::Bc4,         decode_bc4_scalar<false>);
+    k.set(Bcn_Format::Bc4_Signed,  decode_bc4_scalar<true>);
+    k.set(Bcn_Format::Bc5,         decode_bc5_scalar<false>);
+    k.set(Bcn_Format::Bc5_Signed,  decode_bc5_scalar<true>);
+    k.set(Bcn_Format::Bc6h,        decode_bc6h_scalar<false>);
+    k.set(Bcn_Format::Bc6h_Signed, decode_bc6h_scalar<true>);
+    k.set(Bcn_Format::Bc7,         decode_bc7_scalar);
+
+#if CPU_X86
+    // BC6H endpoints are 16-bit and interpolated in 32 bits, it stays scalar.
+    if (features.has_ssse3)
+    {
+        k.set(Bcn_Format::Bc1,        decode_bc1_ssse3);
+        k.set(Bcn_Format::Bc2,        decode_bc2_bc3_ssse3<false>);
+        k.set(Bcn_Format::Bc3,        decode_bc2_bc3_ssse3<true>);
+        k.set(Bcn_Format::Bc4,        decode_bc4_ssse3<false>);
+        k.set(Bcn_Format::Bc4_Signed, decode_bc4_ssse3<true>);
+        k.set(Bcn_Format::Bc5,        decode_bc5_ssse3<false>);
+        k.set(Bcn_Format::Bc5_Signed, decode_bc5_ssse3<true>);
+        k.set(Bcn_Format::Bc7,        decode_bc7_ssse3);
+    }
+#endif
+
+    return k;
+}
+
+static const Bcn_Kernels& get_kernels()
+{
+    static const Bcn_Kernels kernels = select_kernels(g_cpu_features);
+    return kernels;
+}
+
+int Bcn_Decoder::bytes_per_block(Bcn_Format format)
+{
+    switch (format)
+    {
+        case Bcn_Format::Bc1:
+        case Bcn_Format::Bc4:
+        case Bcn_Format::Bc4_Signed:
+            return 8;
+        case Bcn_Format::Unknown:
+        case Bcn_Format::NUM_FORMATS:
+            return 0;
+    }
+
+    return 16;
+}
+
+void Bcn_Decoder::decode_row(Bcn_Format format, const BYTE* blocks, int block_count, UINT32* destination, UINT stride)
+{
+    E_VERIFY(format != Bcn_Format::Unknown && format < Bcn_Format::NUM_FORMATS);
+    E_VERIFY_NULL(blocks);
+    E_VERIFY_NULL(destination);
+
+    get_kernels().decode_row[static_cast<int>(format)](blocks, block_count, destination, stride);
+}
+
+void Bcn_Decoder::decode_row(Bcn_Format format, const Cpu_Features& features, const BYTE* blocks, int block_count, UINT32* destination,
+    UINT stride)
+{
+    E_VERIFY(format != Bcn_Format::Unknown && format < Bcn_Format::NUM_FORMATS);
+    E_VERIFY_NULL(blocks);
+    E_VERIFY_NULL(destination);
+
+    select_kernels(features).decode_row[static_cast<int>(format)](blocks, block_count, destination, stride);
+}
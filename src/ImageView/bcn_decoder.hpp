@@ -0,0 +1,42 @@
+#pragma once
+#include <Windows.h>
+
+struct Cpu_Features;
+
+// Block compressed texture formats of DDS files. Pixels are stored in blocks of 4x4, each compressed
+// on its own to 8 or 16 bytes.
+enum class Bcn_Format
+{
+    Unknown,
+    Bc1,          // RGB with 1-bit alpha (DXT1).
+    Bc2,          // RGB with explicit 4-bit alpha (DXT3).
+    Bc3,          // RGB with interpolated alpha (DXT5).
+    Bc4,          // Single channel, shown as gray.
+    Bc4_Signed,
+    Bc5,          // Two channels, shown as red and green (normal maps).
+    Bc5_Signed,
+    Bc6h,         // HDR RGB in half floats, shown clamped to [0, 1] and encoded to sRGB.
+    Bc6h_Signed,
+    Bc7,          // RGBA with per block modes and partitions.
+
+    NUM_FORMATS
+};
+
+// Decodes rows of blocks to 32bppPBGRA. BC1 to BC5 kernels pick palette entries for a whole row of
+// a block with one shuffle, BC6H and BC7 unpack their modes and partitions with scalar code and share
+// conversion to PBGRA with the others. Kernels are selected once at runtime using g_cpu_features.
+struct Bcn_Decoder
+{
+    static const int block_size = 4;
+
+    // Returns 8 or 16, or 0 for Bcn_Format::Unknown.
+    static int bytes_per_block(Bcn_Format format);
+
+    // Decodes 'block_count' consecutive blocks of a block row to 'block_size' rows of 'block_size' * 'block_count'
+    // pixels at 'destination'.
+    static void decode_row(Bcn_Format format, const BYTE* blocks, int block_count, UINT32* destination, UINT stride);
+    // Same with kernels selected for 'features', which must be a subset of g_cpu_features. Lets tests
+    // compare SIMD kernels with scalar ones.
+    static void decode_row(Bcn_Format format, const Cpu_Features& features, const BYTE* blocks, int block_count, UINT32* destination,
+        UINT stride);
+};
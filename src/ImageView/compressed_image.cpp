@@ -0,0 +1,347 @@
+#include <Windows.h>
+#include <string.h>
+
+#include "compressed_image.hpp"
+#include "error.hpp"
+
+// Operations, first byte of every code. Two highest bits select the operation, except for full pixels
+// which use the two largest values a run can't have.
+static const BYTE op_index = 0x00; // 00iiiiii: pixel from slot i of recently seen pixels.
+static const BYTE op_diff  = 0x40; // 01bbggrr: each channel differs from previous pixel by -2..1, alpha is the same.
+static const BYTE op_luma  = 0x80; // 10gggggg, rrrrbbbb: green differs by -32..31, red and blue by -8..7 more than green.
+static const BYTE op_run   = 0xC0; // 11nnnnnn: previous pixel repeated n + 1 times, up to 62.
+static const BYTE op_bgr   = 0xFE; // Blue, green and red bytes follow, alpha is the same.
+static const BYTE op_bgra  = 0xFF; // Blue, green, red and alpha bytes follow.
+
+static const int max_run = 62;
+static const UINT32 initial_pixel = 0xFF000000;
+// Longest code, used to size buffer for a band that doesn't compress at all.
+static const int max_code_size = 5;
+
+
+static inline int index_slot(UINT32 pixel)
+{
+    return static_cast<int>((pixel * 2654435761u) >> 26);
+}
+
+// Difference of byte 'shift' of two pixels, wrapped to -128..127.
+static inline int channel_difference(UINT32 a, UINT32 b, int shift)
+{
+    return static_cast<signed char>(static_cast<BYTE>((a >> shift) - (b >> shift)));
+}
+
+static size_t compress_band(const Image_Buffer& image, int first_row, int row_count, BYTE* output)
+{
+    UINT32 index[64] = {};
+    UINT32 previous = initial_pixel;
+    int run = 0;
+    BYTE* out = output;
+
+    for (int y = first_row; y < first_row + row_count; ++y)
+    {
+        const UINT32* row = image.row(y);
+        for (int x = 0; x < image.width; ++x)
+        {
+            const UINT32 pixel = row[x];
+            if (pixel == previous)
+            {
+                if (++run == max_run)
+                {
+                    *out++ = op_run | static_cast<BYTE>(run - 1);
+                    run = 0;
+                }
+                continue;
+            }
+
+            if (run > 0)
+            {
+                *out++ = op_run | static_cast<BYTE>(run - 1);
+                run = 0;
+            }
+
+            // Decoder updates the slot for every pixel, encoder has to do the same to stay in sync.
+            const int slot = index_slot(pixel);
+            if (index[slot] == pixel)
+            {
+                *out++ = op_index | static_cast<BYTE>(slot);
+                index[index_slot(previous)] = previous;
+                previous = pixel;
+                continue;
+            }
+
+            index[index_slot(previous)] = previous;
+            index[slot] = pixel;
+
+            if ((pixel ^ previous) >> 24 != 0)
+            {
+                *out++ = op_bgra;
+                memcpy(out, &pixel, 4);
+                out += 4;
+                previous = pixel;
+                continue;
+            }
+
+            const int db = channel_difference(pixel, previous, 0);
+            const int dg = channel_difference(pixel, previous, 8);
+            const int dr = channel_difference(pixel, previous, 16);
+            const int db_dg = db - dg;
+            const int dr_dg = dr - dg;
+
+            if (db >= -2 && db <= 1 && dg >= -2 && dg <= 1 && dr >= -2 && dr <= 1)
+            {
+                *out++ = op_diff | static_cast<BYTE>(((db + 2) << 4) | ((dg + 2) << 2) | (dr + 2));
+            }
+            else if (dg >= -32 && dg <= 31 && db_dg >= -8 && db_dg <= 7 && dr_dg >= -8 && dr_dg <= 7)
+            {
+                *out++ = op_luma | static_cast<BYTE>(dg + 32);
+                *out++ = static_cast<BYTE>(((dr_dg + 8) << 4) | (db_dg + 8));
+            }
+            else
+            {
+                *out++ = op_bgr;
+                memcpy(out, &pixel, 3);
+                out += 3;
+            }
+
+            previous = pixel;
+        }
+    }
+
+    if (run > 0)
+        *out++ = op_run | static_cast<BYTE>(run - 1);
+
+    return static_cast<size_t>(out - output);
+}
+
+static bool decompress_band(const BYTE* input, size_t size, const Image_Buffer& image, int first_row, int row_count)
+{
+    UINT32 index[64] = {};
+    UINT32 previous = initial_pixel;
+    int run = 0;
+    const BYTE* in = input;
+    const BYTE* in_end = input + size;
+
+    for (int y = first_row; y < first_row + row_count; ++y)
+    {
+        UINT32* row = image.row(y);
+        for (int x = 0; x < image.width; ++x)
+        {
+            if (run > 0)
+            {
+                --run;
+                row[x] = previous;
+                continue;
+            }
+
+            if (in == in_end)
+                return false;
+
+            UINT32 pixel;
+            const BYTE op = *in++;
+            if (op == op_bgr)
+            {
+                if (in_end - in < 3)
+                    return false;
+                pixel = (previous & 0xFF000000) | in[0] | (in[1] << 8) | (in[2] << 16);
+                in += 3;
+            }
+            else if (op == op_bgra)
+            {
+                if (in_end - in < 4)
+                    return false;
+                memcpy(&pixel, in, 4);
+                in += 4;
+            }
+            else if ((op & 0xC0) == op_index)
+            {
+                pixel = index[op & 0x3F];
+            }
+            else if ((op & 0xC0) == op_diff)
+            {
+                const int db = ((op >> 4) & 3) - 2;
+                const int dg = ((op >> 2) & 3) - 2;
+                const int dr = (op & 3) - 2;
+                pixel = (previous & 0xFF000000) |
+                    static_cast<BYTE>(previous + db) |
+                    (static_cast<BYTE>((previous >> 8) + dg) << 8) |
+                    (static_cast<BYTE>((previous >> 16) + dr) << 16);
+            }
+            else if ((op & 0xC0) == op_luma)
+            {
+                if (in == in_end)
+                    return false;
+                const int dg = (op & 0x3F) - 32;
+                const int dr = dg + (*in >> 4) - 8;
+                const int db = dg + (*in & 0x0F) - 8;
+                ++in;
+                pixel = (previous & 0xFF000000) |
+                    static_cast<BYTE>(previous + db) |
+                    (static_cast<BYTE>((previous >> 8) + dg) << 8) |
+                    (static_cast<BYTE>((previous >> 16) + dr) << 16);
+            }
+            else
+            {
+                run = op & 0x3F;
+                pixel = previous;
+            }
+
+            index[index_slot(previous)] = previous;
+            index[index_slot(pixel)] = pixel;
+            row[x] = pixel;
+            previous = pixel;
+        }
+    }
+
+    return run == 0 && in == in_end;
+}
+
+struct Compress_Job
+{
+    const Image_Buffer* image;
+    Compressed_Image* compressed;
+    volatile LONG failed;
+};
+
+static void compress_band_job(void* context, int band)
+{
+    Compress_Job* job = (Compress_Job*)context;
+    const Image_Buffer& image = *job->image;
+    Compressed_Image& compressed = *job->compressed;
+
+    const int first_row = band * Compressed_Image::band_height;
+    const int row_count = min(Compressed_Image::band_height, image.height - first_row);
+
+    // Compressed into worst case sized buffer, which is shrunk afterwards.
+    const size_t max_size = static_cast<size_t>(image.width) * row_count * max_code_size;
+    BYTE* buffer = (BYTE*)g_standard_allocator->allocate(max_size);
+    if (buffer == nullptr)
+    {
+        InterlockedExchange(&job->failed, 1);
+        return;
+    }
+
+    const size_t size = compress_band(image, first_row, row_count, buffer);
+    BYTE* shrunk = (BYTE*)g_standard_allocator->reallocate(buffer, max(size, (size_t)1));
+    compressed.bands[band] = shrunk != nullptr ? shrunk : buffer;
+    compressed.band_sizes[band] = static_cast<UINT32>(size);
+}
+
+bool Compressed_Image::compress(const Image_Buffer& image, Job_Pool* pool)
+{
+    E_VERIFY_R(!image.is_empty(), false);
+    release();
+
+    const int count = (image.height + band_height - 1) / band_height;
+    bands = (BYTE**)g_standard_allocator->allocate(sizeof(BYTE*) * count);
+    band_sizes = (UINT32*)g_standard_allocator->allocate(sizeof(UINT32) * count);
+    if (bands == nullptr || band_sizes == nullptr)
+    {
+        release();
+        return false;
+    }
+
+    memset(bands, 0, sizeof(BYTE*) * count);
+    width = image.width;
+    height = image.height;
+    band_count = count;
+
+    Compress_Job job;
+    job.image = &image;
+    job.compressed = this;
+    job.failed = 0;
+
+    if (pool != nullptr)
+    {
+        pool->parallel_for(band_count, compress_band_job, &job);
+    }
+    else
+    {
+        for (int i = 0; i < band_count; ++i)
+            compress_band_job(&job, i);
+    }
+
+    if (job.failed != 0)
+    {
+        release();
+        return false;
+    }
+
+    return true;
+}
+
+struct Decompress_Job
+{
+    const Compressed_Image* compressed;
+    const Image_Buffer* image;
+    volatile LONG failed;
+};
+
+static void decompress_band_job(void* context, int band)
+{
+    Decompress_Job* job = (Decompress_Job*)context;
+    const Compressed_Image& compressed = *job->compressed;
+
+    const int first_row = band * Compressed_Image::band_height;
+    const int row_count = min(Compressed_Image::band_height, compressed.height - first_row);
+    if (!decompress_band(compressed.bands[band], compressed.band_sizes[band], *job->image, first_row, row_count))
+        InterlockedExchange(&job->failed, 1);
+}
+
+bool Compressed_Image::decompress(Image_Buffer* image, Job_Pool* pool) const
+{
+    E_VERIFY_NULL_R(image, false);
+    E_VERIFY_R(!is_empty(), false);
+
+    if (!image->allocate(width, height))
+        return false;
+
+    Decompress_Job job;
+    job.compressed = this;
+    job.image = image;
+    job.failed = 0;
+
+    if (pool != nullptr)
+    {
+        pool->parallel_for(band_count, decompress_band_job, &job);
+    }
+    else
+    {
+        for (int i = 0; i < band_count; ++i)
+            decompress_band_job(&job, i);
+    }
+
+    if (job.failed != 0)
+    {
+        LOG_ERROR(L"Compressed image data is corrupted.\n");
+        image->release();
+        return false;
+    }
+
+    return true;
+}
+
+void Compressed_Image::release()
+{
+    if (bands != nullptr)
+    {
+        for (int i = 0; i < band_count; ++i)
+            g_standard_allocator->deallocate(bands[i]);
+    }
+
+    g_standard_allocator->deallocate(bands);
+    g_standard_allocator->deallocate(band_sizes);
+    bands = nullptr;
+    band_sizes = nullptr;
+    band_count = 0;
+    width = 0;
+    height = 0;
+}
+
+size_t Compressed_Image::size_in_bytes() const
+{
+    size_t size = (sizeof(BYTE*) + sizeof(UINT32)) * band_count;
+    for (int i = 0; i < band_count; ++i)
+        size += band_sizes[i];
+
+    return size;
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include <Windows.h>
+
+#include "image_buffer.hpp"
+#include "job_pool.hpp"
+
+// Image_Buffer compressed losslessly, photos take about 40-50% of raw PBGRA. Every pixel is coded as
+// a run of the previous one, a reference to a recently seen one, or a small difference to the previous
+// one, similar to QOI. Rows are split into bands that are compressed and decompressed independently
+// on threads of the job pool.
+struct Compressed_Image
+{
+    static const int band_height = 64;
+
+    int width = 0;
+    int height = 0;
+    int band_count = 0;
+    BYTE** bands = nullptr;
+    UINT32* band_sizes = nullptr;
+
+    // Returns false if there's not enough memory, nothing is kept then.
+    bool compress(const Image_Buffer& image, Job_Pool* pool = g_job_pool);
+    // Allocates 'image' and decompresses pixels to it. Returns false on failure, 'image' is empty then.
+    bool decompress(Image_Buffer* image, Job_Pool* pool = g_job_pool) const;
+    void release();
+
+    inline bool is_empty() const { return bands == nullptr; }
+    size_t size_in_bytes() const;
+};
@@ -0,0 +1,47 @@
+#include <Windows.h>
+#include <intrin.h>
+
+#include "cpu_features.hpp"
+
+const Cpu_Features g_cpu_features = Cpu_Features::detect();
+
+
+Cpu_Features Cpu_Features::detect()
+{
+    Cpu_Features features;
+
+    SYSTEM_INFO system_info;
+    GetSystemInfo(&system_info);
+    if (system_info.dwNumberOfProcessors > 0)
+        features.logical_processor_count = static_cast<int>(system_info.dwNumberOfProcessors);
+
+#if CPU_X86
+    int info[4];
+    __cpuid(info, 0);
+    int max_leaf = info[0];
+
+    if (max_leaf >= 1)
+    {
+        __cpuid(info, 1);
+        features.has_sse2  = (info[3] & (1 << 26)) != 0;
+        features.has_ssse3 = (info[2] & (1 << 9))  != 0;
+        features.has_sse41 = (info[2] & (1 << 19)) != 0;
+
+        // AVX state must be enabled by OS, otherwise using YMM registers faults.
+        bool has_osxsave = (info[2] & (1 << 27)) != 0;
+        bool has_avx     = (info[2] & (1 << 28)) != 0;
+        bool os_saves_ymm = has_osxsave && has_avx && (_xgetbv(0) & 0x6) == 0x6;
+
+        if (os_saves_ymm && max_leaf >= 7)
+        {
+            __cpuidex(info, 7, 0);
+            features.has_avx2 = (info[1] & (1 << 5)) != 0;
+        }
+    }
+#elif CPU_ARM
+    // NEON is mandatory for Windows on ARM.
+    features.has_neon = true;
+#endif
+
+    return features;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#if defined(_M_IX86) || defined(_M_X64)
+    #define CPU_X86 1
+#elif defined(_M_ARM) || defined(_M_ARM64)
+    #define CPU_ARM 1
+#endif
+
+// Instruction sets available on the machine we're running on. Used to select SIMD kernels at runtime.
+struct Cpu_Features
+{
+    bool has_sse2  = false;
+    bool has_ssse3 = false;
+    bool has_sse41 = false;
+    bool has_avx2  = false;
+    bool has_neon  = false;
+
+    int logical_processor_count = 1;
+
+    static Cpu_Features detect();
+};
+
+extern const Cpu_Features g_cpu_features;
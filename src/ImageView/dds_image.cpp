@@ -0,0 +1,313 @@
+#include <Windows.h>
+#include <wincodec.h>
+#include <string.h>
+#include <limits.h>
+
+#include "dds_image.hpp"
+#include "allocator.hpp"
+#include "error.hpp"
+
+// Layout of the header that follows the "DDS " magic, offsets are from the start of the file.
+static const int magic_size = 4;
+static const int header_size = 124;
+static const int dx10_header_size = 20;
+static const int offset_height = 12;
+static const int offset_width = 16;
+static const int offset_depth = 24;
+static const int offset_mip_count = 28;
+static const int offset_pixel_format_flags = 80;
+static const int offset_four_cc = 84;
+static const int offset_caps2 = 112;
+static const int offset_dxgi_format = 128;
+static const int offset_resource_dimension = 132;
+
+static const UINT32 pixel_format_four_cc = 0x4;
+static const UINT32 caps2_volume = 0x200000;
+static const UINT32 resource_dimension_texture3d = 4;
+
+// Textures are at most 16384 pixels on a side, this leaves room for anything sane.
+static const int max_dimension = 65536;
+
+static inline constexpr UINT32 four_cc(char a, char b, char c, char d)
+{
+    return static_cast<UINT32>(static_cast<BYTE>(a)) | static_cast<UINT32>(static_cast<BYTE>(b)) << 8 |
+        static_cast<UINT32>(static_cast<BYTE>(c)) << 16 | static_cast<UINT32>(static_cast<BYTE>(d)) << 24;
+}
+
+static inline UINT32 read_u32(const char* data)
+{
+    UINT32 value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+// DXT2 and DXT4 are premultiplied variants nobody writes anymore, WIC takes them.
+static Bcn_Format format_from_four_cc(UINT32 code)
+{
+    switch (code)
+    {
+        case four_cc('D', 'X', 'T', '1'):
+            return Bcn_Format::Bc1;
+        case four_cc('D', 'X', 'T', '3'):
+            return Bcn_Format::Bc2;
+        case four_cc('D', 'X', 'T', '5'):
+            return Bcn_Format::Bc3;
+        case four_cc('A', 'T', 'I', '1'):
+        case four_cc('B', 'C', '4', 'U'):
+            return Bcn_Format::Bc4;
+        case four_cc('B', 'C', '4', 'S'):
+            return Bcn_Format::Bc4_Signed;
+        case four_cc('A', 'T', 'I', '2'):
+        case four_cc('B', 'C', '5', 'U'):
+            return Bcn_Format::Bc5;
+        case four_cc('B', 'C', '5', 'S'):
+            return Bcn_Format::Bc5_Signed;
+    }
+
+    return Bcn_Format::Unknown;
+}
+
+// Values of DXGI_FORMAT, typeless and sRGB variants decode the same.
+static Bcn_Format format_from_dxgi(UINT32 dxgi_format)
+{
+    switch (dxgi_format)
+    {
+        case 70: case 71: case 72:
+            return Bcn_Format::Bc1;
+        case 73: case 74: case 75:
+            return Bcn_Format::Bc2;
+        case 76: case 77: case 78:
+            return Bcn_Format::Bc3;
+        case 79: case 80:
+            return Bcn_Format::Bc4;
+        case 81:
+            return Bcn_Format::Bc4_Signed;
+        case 82: case 83:
+            return Bcn_Format::Bc5;
+        case 84:
+            return Bcn_Format::Bc5_Signed;
+        case 94: case 95:
+            return Bcn_Format::Bc6h;
+        case 96:
+            return Bcn_Format::Bc6h_Signed;
+        case 97: case 98: case 99:
+            return Bcn_Format::Bc7;
+    }
+
+    return Bcn_Format::Unknown;
+}
+
+HRESULT Dds_Image::open(const String& file_path)
+{
+    close();
+
+    HRESULT hr = file.open(file_path);
+    if (FAILED(hr))
+        return hr;
+
+    if (file.size < magic_size + header_size)
+    {
+        close();
+        return WINCODEC_ERR_BADHEADER;
+    }
+
+    // Whole file is mapped, only pages of the blocks that are decoded are ever read. File larger than the
+    // address space, on x86, is refused, a view of a truncated size would be read past its end.
+    if (file.size > static_cast<UINT64>(SIZE_MAX))
+    {
+        close();
+        return HRESULT_FROM_WIN32(ERROR_FILE_TOO_LARGE);
+    }
+
+    hr = file.map_view(0, static_cast<size_t>(file.size), &view);
+    if (FAILED(hr))
+    {
+        view = nullptr;
+        close();
+        return hr;
+    }
+
+    hr = parse_header();
+    if (FAILED(hr))
+    {
+        close();
+        return hr;
+    }
+
+    return S_OK;
+}
+
+HRESULT Dds_Image::parse_header()
+{
+    if (read_u32(view) != four_cc('D', 'D', 'S', ' ') || read_u32(view + magic_size) != header_size)
+        return WINCODEC_ERR_BADHEADER;
+
+    const UINT32 width = read_u32(view + offset_width);
+    const UINT32 height = read_u32(view + offset_height);
+    if (width == 0 || height == 0 || width > max_dimension || height > max_dimension)
+        return WINCODEC_ERR_BADHEADER;
+
+    const UINT32 code = (read_u32(view + offset_pixel_format_flags) & pixel_format_four_cc) != 0 ? read_u32(view + offset_four_cc) : 0;
+    UINT64 data_offset = magic_size + header_size;
+    bool is_volume = false;
+
+    if (code == four_cc('D', 'X', '1', '0'))
+    {
+        if (file.size < data_offset + dx10_header_size)
+            return WINCODEC_ERR_BADHEADER;
+
+        format = format_from_dxgi(read_u32(view + offset_dxgi_format));
+        is_volume = read_u32(view + offset_resource_dimension) == resource_dimension_texture3d;
+        data_offset += dx10_header_size;
+    }
+    else
+    {
+        format = format_from_four_cc(code);
+        is_volume = (read_u32(view + offset_caps2) & caps2_volume) != 0;
+    }
+
+    if (format == Bcn_Format::Unknown)
+        return WINCODEC_ERR_UNSUPPORTEDPIXELFORMAT;
+
+    const UINT32 depth = is_volume ? max(read_u32(view + offset_depth), 1u) : 1;
+    const int count = static_cast<int>(min(max(read_u32(view + offset_mip_count), 1u), static_cast<UINT32>(max_levels)));
+    const UINT64 block_bytes = Bcn_Decoder::bytes_per_block(format);
+
+    // Levels of the first texture follow each other, slices of a volume level are stored together.
+    // Levels that the file is too short for are dropped.
+    UINT64 offset = data_offset;
+    for (int level = 0; level < count; ++level)
+    {
+        const int level_width = max(static_cast<int>(width >> level), 1);
+        const int level_height = max(static_cast<int>(height >> level), 1);
+        const UINT64 level_depth = max(depth >> level, 1u);
+        const UINT64 size = static_cast<UINT64>((level_width + 3) / 4) * ((level_height + 3) / 4) * block_bytes * level_depth;
+        if (offset + size > file.size)
+            break;
+
+        widths[level] = level_width;
+        heights[level] = level_height;
+        offsets[level] = offset;
+        offset += size;
+        level_count = level + 1;
+
+        if (level_width == 1 && level_height == 1)
+            break;
+    }
+
+    return level_count > 0 ? S_OK : WINCODEC_ERR_BADIMAGE;
+}
+
+void Dds_Image::close()
+{
+    if (view != nullptr)
+    {
+        file.unmap_view(view);
+        view = nullptr;
+    }
+
+    file.close();
+    format = Bcn_Format::Unknown;
+    level_count = 0;
+}
+
+int Dds_Image::choose_level(int width, int height) const
+{
+    E_VERIFY_R(is_open(), 0);
+
+    int level = 0;
+    while (level + 1 < level_count && (widths[level + 1] >= width || heights[level + 1] >= height))
+        ++level;
+
+    return level;
+}
+
+bool Dds_Image::decode_block_rows(const Copy_Job& job, int first_block_row, int end_block_row) const
+{
+    const WICRect& rect = job.rect;
+    const int block_bytes = Bcn_Decoder::bytes_per_block(format);
+    const int blocks_wide = (widths[job.level] + 3) / 4;
+    const int first_block = rect.X / 4;
+    const int block_count = (rect.X + rect.Width + 3) / 4 - first_block;
+    const bool is_aligned = rect.X % 4 == 0 && rect.Width % 4 == 0;
+
+    // Block rows partly outside of 'rect' are decoded to 'strip' and the part inside is copied.
+    UINT32* strip = nullptr;
+    const UINT strip_stride = static_cast<UINT>(block_count) * 4 * sizeof(UINT32);
+
+    for (int block_row = first_block_row; block_row < end_block_row; ++block_row)
+    {
+        const BYTE* blocks = reinterpret_cast<const BYTE*>(view) + offsets[job.level] +
+            (static_cast<size_t>(block_row) * blocks_wide + first_block) * block_bytes;
+        const int top = block_row * 4;
+        const int first_y = max(top, rect.Y);
+        const int end_y = min(top + 4, rect.Y + rect.Height);
+
+        if (is_aligned && first_y == top && end_y == top + 4)
+        {
+            UINT32* destination = reinterpret_cast<UINT32*>(job.destination + static_cast<size_t>(top - rect.Y) * job.stride);
+            Bcn_Decoder::decode_row(format, blocks, block_count, destination, job.stride);
+            continue;
+        }
+
+        if (strip == nullptr)
+        {
+            strip = (UINT32*)g_standard_allocator->allocate(static_cast<size_t>(strip_stride) * 4);
+            if (strip == nullptr)
+                return false;
+        }
+
+        Bcn_Decoder::decode_row(format, blocks, block_count, strip, strip_stride);
+        for (int y = first_y; y < end_y; ++y)
+        {
+            const BYTE* from = reinterpret_cast<const BYTE*>(strip) + static_cast<size_t>(y - top) * strip_stride +
+                (rect.X - first_block * 4) * sizeof(UINT32);
+            memcpy(job.destination + static_cast<size_t>(y - rect.Y) * job.stride, from, rect.Width * sizeof(UINT32));
+        }
+    }
+
+    g_standard_allocator->deallocate(strip);
+    return true;
+}
+
+void Dds_Image::copy_band_job(void* context, int band)
+{
+    Copy_Job* job = (Copy_Job*)context;
+
+    const int first_block_row = job->first_block_row + band * band_block_rows;
+    const int end_block_row = min(first_block_row + band_block_rows, job->end_block_row);
+    if (!job->image->decode_block_rows(*job, first_block_row, end_block_row))
+        InterlockedExchange(&job->failed, 1);
+}
+
+HRESULT Dds_Image::copy_pixels(int level, const WICRect& rect, BYTE* destination, UINT stride, Job_Pool* pool) const
+{
+    E_VERIFY_R(is_open(), E_UNEXPECTED);
+    E_VERIFY_R(level >= 0 && level < level_count, E_INVALIDARG);
+    E_VERIFY_NULL_R(destination, E_INVALIDARG);
+    E_VERIFY_R(rect.X >= 0 && rect.Y >= 0 && rect.Width > 0 && rect.Height > 0, E_INVALIDARG);
+    E_VERIFY_R(rect.X + rect.Width <= widths[level] && rect.Y + rect.Height <= heights[level], E_INVALIDARG);
+
+    Copy_Job job;
+    job.image = this;
+    job.level = level;
+    job.rect = rect;
+    job.destination = destination;
+    job.stride = stride;
+    job.first_block_row = rect.Y / 4;
+    job.end_block_row = (rect.Y + rect.Height + 3) / 4;
+    job.failed = 0;
+
+    const int band_count = (job.end_block_row - job.first_block_row + band_block_rows - 1) / band_block_rows;
+    if (pool != nullptr && band_count > 1)
+    {
+        pool->parallel_for(band_count, copy_band_job, &job);
+    }
+    else
+    {
+        for (int i = 0; i < band_count; ++i)
+            copy_band_job(&job, i);
+    }
+
+    return job.failed != 0 ? E_OUTOFMEMORY : S_OK;
+}
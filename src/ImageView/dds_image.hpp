@@ -0,0 +1,56 @@
+#pragma once
+#include <Windows.h>
+#include <wincodec.h>
+
+#include "bcn_decoder.hpp"
+#include "file_system_utility.hpp"
+#include "job_pool.hpp"
+#include "string.hpp"
+
+// DDS texture with block compressed pixels, read from a mapped file. Mip levels stored in the file are
+// used as they are, only blocks under the requested rectangle are decoded, rows of blocks are split
+// into bands decoded on threads of the job pool. Arrays and cube maps show their first texture, volume
+// textures their first slice.
+//
+// DDS files in other formats are left to WIC, 'open' fails with WINCODEC_ERR_UNSUPPORTEDPIXELFORMAT.
+struct Dds_Image
+{
+    static const int max_levels = 16;
+    static const int band_block_rows = 16;
+
+    Bcn_Format format = Bcn_Format::Unknown;
+    int level_count = 0;
+    int widths[max_levels];
+    int heights[max_levels];
+
+    HRESULT open(const String& file_path);
+    void close();
+    inline bool is_open() const { return level_count > 0; }
+
+    // Smallest level that is at least 'width' wide or 'height' tall, the last one if none is.
+    int choose_level(int width, int height) const;
+
+    // Decodes 'rect' of 'level' to 32bppPBGRA at 'destination'.
+    HRESULT copy_pixels(int level, const WICRect& rect, BYTE* destination, UINT stride, Job_Pool* pool = g_job_pool) const;
+
+private:
+    struct Copy_Job
+    {
+        const Dds_Image* image;
+        int level;
+        WICRect rect;
+        BYTE* destination;
+        UINT stride;
+        int first_block_row;
+        int end_block_row;
+        volatile LONG failed;
+    };
+
+    Mapped_File file;
+    const char* view = nullptr;
+    UINT64 offsets[max_levels];
+
+    HRESULT parse_header();
+    bool decode_block_rows(const Copy_Job& job, int first_block_row, int end_block_row) const;
+    static void copy_band_job(void* context, int band);
+};
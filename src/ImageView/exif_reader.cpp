@@ -0,0 +1,935 @@
+#include <Windows.h>
+#include <shlwapi.h>
+#include <string.h>
+
+#include "exif_reader.hpp"
+#include "allocator.hpp"
+#include "com_utility.hpp"
+#include "defer.hpp"
+#include "error.hpp"
+
+#pragma comment(lib, "Shlwapi.lib")
+
+// Embedded JPEGs larger than this are not previews.
+static const UINT32 max_embedded_size = 16 * 1024 * 1024;
+
+static const BYTE exif_signature[] = { 'E', 'x', 'i', 'f', 0, 0 };
+static const BYTE mpf_signature[] = { 'M', 'P', 'F', 0 };
+static const char xmp_signature[] = "http://ns.adobe.com/xap/1.0/";
+static const char photoshop_signature[] = "Photoshop 3.0";
+
+// TIFF tags.
+static const UINT16 tag_orientation = 0x0112;
+static const UINT16 tag_exif_ifd = 0x8769;
+static const UINT16 tag_thumbnail_offset = 0x0201;
+static const UINT16 tag_thumbnail_length = 0x0202;
+static const UINT16 tag_pixel_x_dimension = 0xA002;
+static const UINT16 tag_pixel_y_dimension = 0xA003;
+static const UINT16 tag_mp_entry = 0xB002;
+static const UINT16 tag_make = 0x010F;
+static const UINT16 tag_model = 0x0110;
+static const UINT16 tag_gps_ifd = 0x8825;
+static const UINT16 tag_exposure_time = 0x829A;
+static const UINT16 tag_f_number = 0x829D;
+static const UINT16 tag_iso = 0x8827;
+static const UINT16 tag_date_time_original = 0x9003;
+static const UINT16 tag_focal_length = 0x920A;
+static const UINT16 tag_lens_model = 0xA434;
+static const UINT16 tag_gps_latitude_ref = 0x0001;
+static const UINT16 tag_gps_latitude = 0x0002;
+static const UINT16 tag_gps_longitude_ref = 0x0003;
+static const UINT16 tag_gps_longitude = 0x0004;
+
+static const UINT16 type_ascii = 2;
+static const UINT16 type_short = 3;
+static const UINT16 type_long = 4;
+static const UINT16 type_rational = 5;
+static const UINT16 type_srational = 10;
+
+// Photoshop image resource with IPTC-IIM records, and IIM datasets of creation date and time in record 2.
+static const UINT16 photoshop_resource_iptc = 0x0404;
+static const BYTE iptc_date_created = 55;
+static const BYTE iptc_time_created = 60;
+
+// MP entry image types of previews, VGA and full HD sized.
+static const UINT32 mp_type_large_thumbnail_vga = 0x010001;
+static const UINT32 mp_type_large_thumbnail_full_hd = 0x010002;
+
+
+static inline UINT16 read_be16(const BYTE* p)
+{
+    return static_cast<UINT16>((p[0] << 8) | p[1]);
+}
+
+// Parts of a TIFF file past the probe, read as tags point at them. IFDs and values of TIFF files can be
+// anywhere, editors often append them after the pixels. A few windows are kept and a broken file can't make
+// it read more than 'max_reads' of them.
+struct Tiff_File_Windows
+{
+    static const int max_windows = 4;
+    static const int max_reads = 16;
+    static const UINT32 window_size = Exif_Reader::probe_size;
+
+    HANDLE file = INVALID_HANDLE_VALUE;
+    BYTE* buffer = nullptr;
+    UINT32 offsets[max_windows] = {};
+    UINT32 sizes[max_windows] = {};
+    int read_count = 0;
+
+    // Returns pointer to 'length' bytes at 'offset' of the file, or null if they're not in it.
+    const BYTE* find(UINT32 offset, UINT32 length)
+    {
+        if (length > window_size)
+            return nullptr;
+
+        for (int i = 0; i < min(read_count, max_windows); ++i)
+        {
+            if (offset >= offsets[i] && sizes[i] >= length && offset - offsets[i] <= sizes[i] - length)
+                return buffer + i * window_size + (offset - offsets[i]);
+        }
+
+        if (read_count == max_reads || file == INVALID_HANDLE_VALUE)
+            return nullptr;
+
+        if (buffer == nullptr)
+        {
+            buffer = (BYTE*)g_standard_allocator->allocate(max_windows * window_size);
+            if (buffer == nullptr)
+                return nullptr;
+        }
+
+        // Oldest window is replaced. IFD entries are read in order, they're at the start of the window.
+        const int window = read_count++ % max_windows;
+        OVERLAPPED position = {};
+        position.Offset = offset;
+        DWORD read_size = 0;
+        sizes[window] = 0;
+        if (!ReadFile(file, buffer + window * window_size, window_size, &read_size, &position) || read_size < length)
+            return nullptr;
+
+        offsets[window] = offset;
+        sizes[window] = read_size;
+        return buffer + window * window_size;
+    }
+};
+
+// TIFF structure of EXIF and MPF segments, or of a TIFF file. Reads outside of the data return zero, so a
+// truncated or broken segment just has no tags. With 'windows' set, reads past the data come from the file.
+struct Tiff_Reader
+{
+    const BYTE* data;
+    UINT32 size;
+    bool is_big_endian;
+    Tiff_File_Windows* windows = nullptr;
+
+    bool initialize(const BYTE* tiff_data, UINT32 tiff_size)
+    {
+        data = tiff_data;
+        size = tiff_size;
+        if (size < 8)
+            return false;
+
+        if (data[0] == 'I' && data[1] == 'I')
+            is_big_endian = false;
+        else if (data[0] == 'M' && data[1] == 'M')
+            is_big_endian = true;
+        else
+            return false;
+
+        return u16(2) == 42;
+    }
+
+    // Pointer to 'length' bytes at 'offset', or null.
+    const BYTE* at(UINT32 offset, UINT32 length) const
+    {
+        if (offset <= size && size - offset >= length)
+            return data + offset;
+
+        return windows != nullptr ? windows->find(offset, length) : nullptr;
+    }
+
+    UINT16 u16(UINT32 offset) const
+    {
+        const BYTE* p = at(offset, 2);
+        if (p == nullptr)
+            return 0;
+
+        return is_big_endian ? static_cast<UINT16>((p[0] << 8) | p[1]) : static_cast<UINT16>(p[0] | (p[1] << 8));
+    }
+
+    UINT32 u32(UINT32 offset) const
+    {
+        const BYTE* p = at(offset, 4);
+        if (p == nullptr)
+            return 0;
+
+        return is_big_endian
+            ? (static_cast<UINT32>(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3]
+            : static_cast<UINT32>(p[0]) | (p[1] << 8) | (p[2] << 16) | (static_cast<UINT32>(p[3]) << 24);
+    }
+
+    inline UINT16 entry_count(UINT32 ifd) const { return u16(ifd); }
+    inline UINT32 entry(UINT32 ifd, int index) const { return ifd + 2 + static_cast<UINT32>(index) * 12; }
+    inline UINT32 next_ifd(UINT32 ifd) const { return u32(ifd + 2 + static_cast<UINT32>(entry_count(ifd)) * 12); }
+
+    // Value of a SHORT or LONG entry with one value, which is stored in the entry itself.
+    UINT32 entry_value(UINT32 entry) const
+    {
+        const UINT16 type = u16(entry + 2);
+        if (type == type_short)
+            return u16(entry + 8);
+        if (type == type_long)
+            return u32(entry + 8);
+
+        return 0;
+    }
+
+    // Value of an ASCII entry, cut to fit 'capacity' with the terminating zero. Trailing spaces are removed,
+    // cameras pad make and model with them.
+    void entry_string(UINT32 entry, char* text, int capacity) const
+    {
+        text[0] = 0;
+        if (u16(entry + 2) != type_ascii)
+            return;
+
+        // Only the part that fits is read, the rest of a long value can be past the end of the file.
+        const UINT32 value_count = u32(entry + 4);
+        const UINT32 offset = value_count <= 4 ? entry + 8 : u32(entry + 8);
+        const UINT32 count = min(value_count, static_cast<UINT32>(capacity - 1));
+        const BYTE* value = at(offset, count);
+        if (value == nullptr)
+            return;
+
+        int length = 0;
+        while (static_cast<UINT32>(length) < count && value[length] != 0)
+        {
+            text[length] = static_cast<char>(value[length]);
+            ++length;
+        }
+
+        while (length > 0 && text[length - 1] == ' ')
+            --length;
+        text[length] = 0;
+    }
+
+    // Value at 'index' of a RATIONAL or SRATIONAL entry, zero if there's none.
+    double entry_rational(UINT32 entry, UINT32 index) const
+    {
+        const UINT16 type = u16(entry + 2);
+        if ((type != type_rational && type != type_srational) || index >= u32(entry + 4))
+            return 0.0;
+
+        const UINT32 offset = u32(entry + 8) + index * 8;
+        const UINT32 numerator = u32(offset);
+        const UINT32 denominator = u32(offset + 4);
+        if (denominator == 0)
+            return 0.0;
+
+        if (type == type_srational)
+            return static_cast<double>(static_cast<INT32>(numerator)) / static_cast<INT32>(denominator);
+
+        return static_cast<double>(numerator) / denominator;
+    }
+};
+
+// Returns value of 'count' decimal digits, or -1 if they're not all digits.
+static int parse_digits(const char* text, int count)
+{
+    int value = 0;
+    for (int i = 0; i < count; ++i)
+    {
+        if (text[i] < '0' || text[i] > '9')
+            return -1;
+
+        value = value * 10 + (text[i] - '0');
+    }
+
+    return value;
+}
+
+static UINT64 make_date(int year, int month, int day, int hour, int minute, int second)
+{
+    // Unknown dates are written as zeros or spaces, those are left out.
+    if (year < 1601 || month < 1 || month > 12 || day < 1 || day > 31 || hour < 0 || hour > 23 || minute < 0 || minute > 59 ||
+        second < 0 || second > 60)
+        return 0;
+
+    SYSTEMTIME time = {};
+    time.wYear = static_cast<WORD>(year);
+    time.wMonth = static_cast<WORD>(month);
+    time.wDay = static_cast<WORD>(day);
+    time.wHour = static_cast<WORD>(hour);
+    time.wMinute = static_cast<WORD>(minute);
+    time.wSecond = static_cast<WORD>(min(second, 59));
+
+    FILETIME file_time;
+    if (!SystemTimeToFileTime(&time, &file_time))
+        return 0;
+
+    return (static_cast<UINT64>(file_time.dwHighDateTime) << 32) | file_time.dwLowDateTime;
+}
+
+// Date as "YYYY:MM:DD HH:MM:SS" in EXIF or "YYYY-MM-DDTHH:MM:SS" in XMP, time is optional in XMP.
+static UINT64 parse_date(const char* text, int length)
+{
+    if (length < 10)
+        return 0;
+
+    const int year = parse_digits(text, 4);
+    const int month = parse_digits(text + 5, 2);
+    const int day = parse_digits(text + 8, 2);
+    if (length < 16)
+        return make_date(year, month, day, 0, 0, 0);
+
+    const int hour = parse_digits(text + 11, 2);
+    const int minute = parse_digits(text + 14, 2);
+    const int second = length >= 19 ? parse_digits(text + 17, 2) : 0;
+
+    return make_date(year, month, day, hour, minute, second);
+}
+
+static bool starts_with_ignore_case(const char* text, const char* prefix, int prefix_length)
+{
+    for (int i = 0; i < prefix_length; ++i)
+    {
+        char a = text[i];
+        char b = prefix[i];
+        if (a >= 'a' && a <= 'z')
+            a -= 'a' - 'A';
+        if (b >= 'a' && b <= 'z')
+            b -= 'a' - 'A';
+        if (a != b)
+            return false;
+    }
+
+    return true;
+}
+
+// Camera name is make and model, but most models already start with the first word of make ("Canon", "Canon EOS R5").
+static void set_camera(const char* make, const char* model, Photo_Metadata* metadata)
+{
+    int make_word = 0;
+    while (make[make_word] != 0 && make[make_word] != ' ')
+        ++make_word;
+
+    char* camera = metadata->camera;
+    const int capacity = ARRAYSIZE(metadata->camera);
+    if (make_word == 0 || starts_with_ignore_case(model, make, make_word))
+        strncpy_s(camera, capacity, model, _TRUNCATE);
+    else if (model[0] == 0)
+        strncpy_s(camera, capacity, make, _TRUNCATE);
+    else
+        _snprintf_s(camera, capacity, _TRUNCATE, "%s %s", make, model);
+}
+
+static void parse_gps(const Tiff_Reader& tiff, UINT32 gps_ifd, Photo_Metadata* metadata)
+{
+    double latitude = 0.0;
+    double longitude = 0.0;
+    bool has_latitude = false;
+    bool has_longitude = false;
+    char latitude_ref[2] = {};
+    char longitude_ref[2] = {};
+    for (int i = 0; i < tiff.entry_count(gps_ifd); ++i)
+    {
+        const UINT32 entry = tiff.entry(gps_ifd, i);
+        switch (tiff.u16(entry))
+        {
+            case tag_gps_latitude_ref:
+                tiff.entry_string(entry, latitude_ref, ARRAYSIZE(latitude_ref));
+                break;
+            case tag_gps_longitude_ref:
+                tiff.entry_string(entry, longitude_ref, ARRAYSIZE(longitude_ref));
+                break;
+            case tag_gps_latitude:
+                // Degrees, minutes and seconds.
+                latitude = tiff.entry_rational(entry, 0) + tiff.entry_rational(entry, 1) / 60.0 + tiff.entry_rational(entry, 2) / 3600.0;
+                has_latitude = true;
+                break;
+            case tag_gps_longitude:
+                longitude = tiff.entry_rational(entry, 0) + tiff.entry_rational(entry, 1) / 60.0 + tiff.entry_rational(entry, 2) / 3600.0;
+                has_longitude = true;
+                break;
+        }
+    }
+
+    // Some cameras write zeros when they have no fix.
+    if (!has_latitude || !has_longitude || (latitude == 0.0 && longitude == 0.0) || latitude > 90.0 || longitude > 180.0)
+        return;
+
+    metadata->has_location = true;
+    metadata->latitude = static_cast<float>(latitude_ref[0] == 'S' ? -latitude : latitude);
+    metadata->longitude = static_cast<float>(longitude_ref[0] == 'W' ? -longitude : longitude);
+}
+
+static void parse_exif_metadata(const Tiff_Reader& tiff, Photo_Metadata* metadata)
+{
+    const UINT32 ifd0 = tiff.u32(4);
+    UINT32 exif_ifd = 0;
+    UINT32 gps_ifd = 0;
+    char make[32] = {};
+    char model[64] = {};
+    for (int i = 0; i < tiff.entry_count(ifd0); ++i)
+    {
+        const UINT32 entry = tiff.entry(ifd0, i);
+        switch (tiff.u16(entry))
+        {
+            case tag_make:
+                tiff.entry_string(entry, make, ARRAYSIZE(make));
+                break;
+            case tag_model:
+                tiff.entry_string(entry, model, ARRAYSIZE(model));
+                break;
+            case tag_exif_ifd:
+                exif_ifd = tiff.entry_value(entry);
+                break;
+            case tag_gps_ifd:
+                gps_ifd = tiff.entry_value(entry);
+                break;
+        }
+    }
+
+    set_camera(make, model, metadata);
+
+    for (int i = 0; exif_ifd != 0 && i < tiff.entry_count(exif_ifd); ++i)
+    {
+        const UINT32 entry = tiff.entry(exif_ifd, i);
+        switch (tiff.u16(entry))
+        {
+            case tag_date_time_original:
+            {
+                char date[20];
+                tiff.entry_string(entry, date, ARRAYSIZE(date));
+                const UINT64 date_taken = parse_date(date, static_cast<int>(strlen(date)));
+                if (date_taken != 0)
+                    metadata->date_taken = date_taken;
+                break;
+            }
+            case tag_exposure_time:
+                metadata->exposure_time = static_cast<float>(tiff.entry_rational(entry, 0));
+                break;
+            case tag_f_number:
+                metadata->f_number = static_cast<float>(tiff.entry_rational(entry, 0));
+                break;
+            case tag_focal_length:
+                metadata->focal_length = static_cast<float>(tiff.entry_rational(entry, 0));
+                break;
+            case tag_iso:
+                metadata->iso = static_cast<int>(tiff.entry_value(entry));
+                break;
+            case tag_lens_model:
+                tiff.entry_string(entry, metadata->lens, ARRAYSIZE(metadata->lens));
+                break;
+        }
+    }
+
+    if (gps_ifd != 0)
+        parse_gps(tiff, gps_ifd, metadata);
+}
+
+// Finds value of XMP property 'name', which is either an attribute (name="value") or an element (<name>value<).
+static const char* find_xmp_value(const char* xml, int size, const char* name, int* length)
+{
+    const int name_length = static_cast<int>(strlen(name));
+    for (int i = 0; i + name_length + 2 <= size; ++i)
+    {
+        if (xml[i] != name[0] || memcmp(xml + i, name, name_length) != 0)
+            continue;
+
+        int start = i + name_length;
+        char terminator;
+        if (xml[start] == '=' && (xml[start + 1] == '"' || xml[start + 1] == '\''))
+        {
+            terminator = xml[start + 1];
+            start += 2;
+        }
+        else if (xml[start] == '>')
+        {
+            terminator = '<';
+            start += 1;
+        }
+        else
+        {
+            continue;
+        }
+
+        int end = start;
+        while (end < size && xml[end] != terminator)
+            ++end;
+        if (end == size)
+            return nullptr;
+
+        *length = end - start;
+        return xml + start;
+    }
+
+    return nullptr;
+}
+
+static void parse_xmp(const char* xml, int size, Photo_Metadata* metadata)
+{
+    int length;
+    const char* rating = find_xmp_value(xml, size, "xmp:Rating", &length);
+    if (rating != nullptr && length > 0)
+    {
+        const bool is_negative = rating[0] == '-';
+        const int stars = parse_digits(rating + is_negative, 1);
+        if (stars >= 1 && stars <= 5 && !is_negative)
+            metadata->rating = stars;
+        else if (is_negative && stars >= 1)
+            metadata->rating = -1;
+    }
+
+    // Editors that don't write EXIF keep capture date here.
+    static const char* const date_names[] = { "exif:DateTimeOriginal", "photoshop:DateCreated", "xmp:CreateDate" };
+    for (int i = 0; i < ARRAYSIZE(date_names) && metadata->date_taken == 0; ++i)
+    {
+        const char* date = find_xmp_value(xml, size, date_names[i], &length);
+        if (date != nullptr)
+            metadata->date_taken = parse_date(date, length);
+    }
+}
+
+// Photoshop image resources: "8BIM", id, padded Pascal string name, size and padded data. IPTC-IIM resource
+// is a list of datasets: 0x1C, record, dataset, size and data.
+static void parse_iptc(const BYTE* data, UINT32 size, Photo_Metadata* metadata)
+{
+    UINT32 position = 0;
+    while (position + 12 <= size && memcmp(data + position, "8BIM", 4) == 0)
+    {
+        const UINT16 id = read_be16(data + position + 4);
+        const UINT32 name_size = (1u + data[position + 6] + 1u) & ~1u;
+        const UINT32 size_offset = position + 6 + name_size;
+        if (size_offset + 4 > size)
+            return;
+
+        const UINT32 resource_size = (static_cast<UINT32>(read_be16(data + size_offset)) << 16) | read_be16(data + size_offset + 2);
+        const UINT32 resource = size_offset + 4;
+        if (resource_size > size - resource)
+            return;
+
+        if (id != photoshop_resource_iptc)
+        {
+            position = resource + ((resource_size + 1) & ~1u);
+            continue;
+        }
+
+        int date = -1;
+        int time = 0;
+        for (UINT32 dataset = resource; dataset + 5 <= resource + resource_size && data[dataset] == 0x1C;)
+        {
+            const UINT32 dataset_size = read_be16(data + dataset + 3);
+            const UINT32 value = dataset + 5;
+            if ((dataset_size & 0x8000) != 0 || dataset_size > resource + resource_size - value)
+                break; // Extended datasets are not used for dates.
+
+            if (data[dataset + 1] == 2 && data[dataset + 2] == iptc_date_created && dataset_size >= 8)
+                date = static_cast<int>(value);
+            else if (data[dataset + 1] == 2 && data[dataset + 2] == iptc_time_created && dataset_size >= 6)
+                time = static_cast<int>(value);
+
+            dataset = value + dataset_size;
+        }
+
+        // "CCYYMMDD" and "HHMMSS+HHMM".
+        if (date >= 0 && metadata->date_taken == 0)
+        {
+            const char* d = reinterpret_cast<const char*>(data + date);
+            const char* t = reinterpret_cast<const char*>(data + time);
+            metadata->date_taken = time != 0
+                ? make_date(parse_digits(d, 4), parse_digits(d + 4, 2), parse_digits(d + 6, 2), parse_digits(t, 2), parse_digits(t + 2, 2), parse_digits(t + 4, 2))
+                : make_date(parse_digits(d, 4), parse_digits(d + 4, 2), parse_digits(d + 6, 2), 0, 0, 0);
+        }
+
+        return;
+    }
+}
+
+// 'tiff_offset' is where TIFF data starts in the file, 'segment_size' is how large it is even if only
+// 'tiff_size' bytes of it were read.
+static void parse_exif(const BYTE* tiff_data, UINT32 tiff_size, UINT32 segment_size, UINT32 tiff_offset, Exif_Info* info)
+{
+    Tiff_Reader tiff;
+    if (!tiff.initialize(tiff_data, tiff_size))
+        return;
+
+    // IFD0 describes the main image.
+    const UINT32 ifd0 = tiff.u32(4);
+    UINT32 exif_ifd = 0;
+    for (int i = 0; i < tiff.entry_count(ifd0); ++i)
+    {
+        const UINT32 entry = tiff.entry(ifd0, i);
+        const UINT16 tag = tiff.u16(entry);
+        if (tag == tag_orientation)
+        {
+            const UINT32 orientation = tiff.entry_value(entry);
+            if (orientation >= 1 && orientation <= 8)
+                info->orientation = static_cast<int>(orientation);
+        }
+        else if (tag == tag_exif_ifd)
+        {
+            exif_ifd = tiff.entry_value(entry);
+        }
+    }
+
+    // Frame header comes after EXIF and has the final say about the size.
+    if (exif_ifd != 0 && info->width == 0)
+    {
+        for (int i = 0; i < tiff.entry_count(exif_ifd); ++i)
+        {
+            const UINT32 entry = tiff.entry(exif_ifd, i);
+            const UINT16 tag = tiff.u16(entry);
+            if (tag == tag_pixel_x_dimension)
+                info->width = static_cast<int>(tiff.entry_value(entry));
+            else if (tag == tag_pixel_y_dimension)
+                info->height = static_cast<int>(tiff.entry_value(entry));
+        }
+    }
+
+    // IFD1 describes the thumbnail, its JPEG is within the segment.
+    const UINT32 ifd1 = ifd0 != 0 ? tiff.next_ifd(ifd0) : 0;
+    if (ifd1 == 0)
+        return;
+
+    UINT32 offset = 0;
+    UINT32 length = 0;
+    for (int i = 0; i < tiff.entry_count(ifd1); ++i)
+    {
+        const UINT32 entry = tiff.entry(ifd1, i);
+        const UINT16 tag = tiff.u16(entry);
+        if (tag == tag_thumbnail_offset)
+            offset = tiff.entry_value(entry);
+        else if (tag == tag_thumbnail_length)
+            length = tiff.entry_value(entry);
+    }
+
+    if (offset != 0 && length != 0 && offset < segment_size && length <= segment_size - offset)
+    {
+        info->thumbnail_offset = tiff_offset + offset;
+        info->thumbnail_size = length;
+    }
+}
+
+// Offsets of MP entries are relative to the start of MPF TIFF data, at 'tiff_offset' in the file.
+static void parse_mpf(const BYTE* tiff_data, UINT32 tiff_size, UINT32 tiff_offset, Exif_Info* info)
+{
+    Tiff_Reader tiff;
+    if (!tiff.initialize(tiff_data, tiff_size))
+        return;
+
+    const UINT32 index_ifd = tiff.u32(4);
+    for (int i = 0; i < tiff.entry_count(index_ifd); ++i)
+    {
+        const UINT32 entry = tiff.entry(index_ifd, i);
+        if (tiff.u16(entry) != tag_mp_entry)
+            continue;
+
+        // 16 bytes per image: attributes, size, offset and two dependent image entries. First one is the main image.
+        const UINT32 count = min(tiff.u32(entry + 4) / 16, tiff_size / 16);
+        const UINT32 entries = tiff.u32(entry + 8);
+        for (UINT32 image = 1; image < count; ++image)
+        {
+            const UINT32 mp_entry = entries + image * 16;
+            const UINT32 type = tiff.u32(mp_entry) & 0xFFFFFF;
+            const UINT32 size = tiff.u32(mp_entry + 4);
+            const UINT32 offset = tiff.u32(mp_entry + 8);
+            if (type != mp_type_large_thumbnail_vga && type != mp_type_large_thumbnail_full_hd)
+                continue;
+            if (offset == 0 || size == 0 || size > max_embedded_size || offset > MAXDWORD - tiff_offset)
+                continue;
+
+            if (size > info->preview_size)
+            {
+                info->preview_offset = tiff_offset + offset;
+                info->preview_size = size;
+            }
+        }
+
+        return;
+    }
+}
+
+bool Exif_Reader::parse(const BYTE* data, int size, Exif_Info* info, Photo_Metadata* metadata)
+{
+    E_VERIFY_NULL_R(data, false);
+    E_VERIFY_NULL_R(info, false);
+
+    *info = Exif_Info();
+    if (metadata != nullptr)
+    {
+        *metadata = Photo_Metadata();
+
+        // TIFF file is one TIFF structure, EXIF tags are in its first IFD like in the EXIF segment.
+        Tiff_Reader tiff;
+        if (tiff.initialize(data, static_cast<UINT32>(max(size, 0))))
+        {
+            parse_exif_metadata(tiff, metadata);
+            return true;
+        }
+    }
+
+    if (size < 4 || data[0] != 0xFF || data[1] != 0xD8)
+        return false;
+
+    int position = 2;
+    while (position + 4 <= size)
+    {
+        if (data[position] != 0xFF)
+            break; // Broken file, what's found so far is kept.
+
+        const BYTE marker = data[position + 1];
+        if (marker == 0xFF)
+        {
+            // Fill byte.
+            ++position;
+            continue;
+        }
+
+        // Markers without a segment.
+        if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD8))
+        {
+            position += 2;
+            continue;
+        }
+
+        // Entropy coded data follows start of scan, the rest of the file is not looked at.
+        if (marker == 0xDA || marker == 0xD9)
+            break;
+
+        const int length = read_be16(data + position + 2);
+        if (length < 2)
+            break;
+
+        const BYTE* segment = data + position + 4;
+        const UINT32 segment_size = static_cast<UINT32>(length - 2);
+        const UINT32 available = static_cast<UINT32>(min(length - 2, size - position - 4));
+        const UINT32 segment_offset = static_cast<UINT32>(position + 4);
+
+        if (marker == 0xE1 && available >= sizeof(exif_signature) && memcmp(segment, exif_signature, sizeof(exif_signature)) == 0)
+        {
+            parse_exif(segment + sizeof(exif_signature), available - sizeof(exif_signature), segment_size - sizeof(exif_signature),
+                segment_offset + sizeof(exif_signature), info);
+
+            Tiff_Reader tiff;
+            if (metadata != nullptr && tiff.initialize(segment + sizeof(exif_signature), available - sizeof(exif_signature)))
+                parse_exif_metadata(tiff, metadata);
+        }
+        else if (marker == 0xE1 && metadata != nullptr && available >= sizeof(xmp_signature) &&
+            memcmp(segment, xmp_signature, sizeof(xmp_signature)) == 0)
+        {
+            parse_xmp(reinterpret_cast<const char*>(segment) + sizeof(xmp_signature), static_cast<int>(available - sizeof(xmp_signature)), metadata);
+        }
+        else if (marker == 0xED && metadata != nullptr && available >= sizeof(photoshop_signature) &&
+            memcmp(segment, photoshop_signature, sizeof(photoshop_signature)) == 0)
+        {
+            parse_iptc(segment + sizeof(photoshop_signature), available - sizeof(photoshop_signature), metadata);
+        }
+        else if (marker == 0xE2 && available >= sizeof(mpf_signature) && memcmp(segment, mpf_signature, sizeof(mpf_signature)) == 0)
+        {
+            parse_mpf(segment + sizeof(mpf_signature), available - sizeof(mpf_signature), segment_offset + sizeof(mpf_signature), info);
+        }
+        else if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC)
+        {
+            // Start of frame: precision, height, width.
+            if (available >= 5)
+            {
+                info->height = read_be16(segment + 1);
+                info->width = read_be16(segment + 3);
+            }
+            break;
+        }
+
+        position += 2 + length;
+    }
+
+    return true;
+}
+
+HRESULT Exif_Reader::read(HANDLE file, Exif_Info* info, Photo_Metadata* metadata)
+{
+    E_VERIFY_R(file != INVALID_HANDLE_VALUE, E_INVALIDARG);
+    E_VERIFY_NULL_R(info, E_INVALIDARG);
+
+    BYTE* data = (BYTE*)g_standard_allocator->allocate(probe_size);
+    if (data == nullptr)
+        return E_OUTOFMEMORY;
+    defer(g_standard_allocator->deallocate(data));
+
+    OVERLAPPED position = {};
+    DWORD read_size = 0;
+    if (!ReadFile(file, data, probe_size, &read_size, &position))
+        return HRESULT_FROM_WIN32(GetLastError());
+
+    // TIFF file's IFDs and values past the probe are read from the file as they're parsed.
+    Tiff_Reader tiff;
+    if (metadata != nullptr && tiff.initialize(data, read_size))
+    {
+        Tiff_File_Windows windows;
+        windows.file = file;
+        defer(g_standard_allocator->deallocate(windows.buffer));
+        tiff.windows = &windows;
+
+        *info = Exif_Info();
+        *metadata = Photo_Metadata();
+        parse_exif_metadata(tiff, metadata);
+        return S_OK;
+    }
+
+    return parse(data, static_cast<int>(read_size), info, metadata) ? S_OK : S_FALSE;
+}
+
+HRESULT Exif_Reader::create_embedded_decoder(IWICImagingFactory* wic, HANDLE file, UINT32 offset, UINT32 size, IWICBitmapDecoder** decoder)
+{
+    E_VERIFY_NULL_R(wic, E_INVALIDARG);
+    E_VERIFY_R(file != INVALID_HANDLE_VALUE, E_INVALIDARG);
+    E_VERIFY_NULL_R(decoder, E_INVALIDARG);
+
+    if (size < 4 || size > max_embedded_size)
+        return WINCODEC_ERR_BADIMAGE;
+
+    BYTE* data = (BYTE*)g_standard_allocator->allocate(size);
+    if (data == nullptr)
+        return E_OUTOFMEMORY;
+    defer(g_standard_allocator->deallocate(data));
+
+    OVERLAPPED position = {};
+    position.Offset = offset;
+    DWORD read_size = 0;
+    if (!ReadFile(file, data, size, &read_size, &position))
+        return HRESULT_FROM_WIN32(GetLastError());
+
+    // Offsets come from the file, they're not trusted to point at a JPEG.
+    if (read_size != size || data[0] != 0xFF || data[1] != 0xD8)
+        return WINCODEC_ERR_BADIMAGE;
+
+    IStream* stream = SHCreateMemStream(data, size);
+    if (stream == nullptr)
+        return E_OUTOFMEMORY;
+    defer(safe_release(stream));
+
+    return wic->CreateDecoderFromStream(stream, nullptr, WICDecodeMetadataCacheOnDemand, decoder);
+}
+
+HRESULT Exif_Reader::open_embedded_frame(IWICImagingFactory* wic, HANDLE file, const Exif_Info& info, Embedded_Image image,
+    UINT width, UINT height, IWICBitmapFrameDecode** frame, UINT* frame_width, UINT* frame_height)
+{
+    E_VERIFY_NULL_R(frame, E_INVALIDARG);
+    E_VERIFY_NULL_R(frame_width, E_INVALIDARG);
+    E_VERIFY_NULL_R(frame_height, E_INVALIDARG);
+    E_VERIFY_R(width > 0 && height > 0, E_INVALIDARG);
+
+    const UINT32 offset = image == Embedded_Image::Preview ? info.preview_offset : info.thumbnail_offset;
+    const UINT32 size = image == Embedded_Image::Preview ? info.preview_size : info.thumbnail_size;
+    if (size == 0)
+        return S_FALSE;
+
+    IWICBitmapDecoder* decoder = nullptr;
+    HRESULT hr = create_embedded_decoder(wic, file, offset, size, &decoder);
+    if (FAILED(hr))
+        return hr;
+    defer(safe_release(decoder));
+
+    IWICBitmapFrameDecode* embedded = nullptr;
+    hr = decoder->GetFrame(0, &embedded);
+    if (FAILED(hr))
+        return hr;
+
+    UINT embedded_width = 0;
+    UINT embedded_height = 0;
+    hr = embedded->GetSize(&embedded_width, &embedded_height);
+    if (FAILED(hr) || embedded_width == 0 || embedded_height == 0)
+    {
+        safe_release(embedded);
+        return FAILED(hr) ? hr : S_FALSE;
+    }
+
+    // Thumbnails of 3:2 photos are often 4:3 with black bars.
+    const UINT64 embedded_cross = static_cast<UINT64>(embedded_width) * height;
+    const UINT64 image_cross = static_cast<UINT64>(width) * embedded_height;
+    const UINT64 difference = embedded_cross > image_cross ? embedded_cross - image_cross : image_cross - embedded_cross;
+    if (50 * difference > image_cross)
+    {
+        safe_release(embedded);
+        return S_FALSE;
+    }
+
+    *frame = embedded;
+    *frame_width = embedded_width;
+    *frame_height = embedded_height;
+    return S_OK;
+}
+
+int Exif_Reader::read_orientation(const String& path)
+{
+    HANDLE file = CreateFileW(path.data, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return 1;
+    defer(CloseHandle(file));
+
+    Exif_Info info;
+    return read(file, &info) == S_OK ? info.orientation : 1;
+}
+
+// Sets every tiff:Orientation of XMP packet 'xml' to 1. The packet keeps its size, digits after the
+// first one are blanked.
+static void reset_xmp_orientation(char* xml, int size)
+{
+    int position = 0;
+    int length = 0;
+    const char* value = nullptr;
+    while ((value = find_xmp_value(xml + position, size - position, "tiff:Orientation", &length)) != nullptr)
+    {
+        const int start = static_cast<int>(value - xml);
+        bool is_set = false;
+        for (int i = start; i < start + length; ++i)
+        {
+            if (xml[i] >= '0' && xml[i] <= '9')
+            {
+                xml[i] = is_set ? ' ' : '1';
+                is_set = true;
+            }
+        }
+
+        position = start + length;
+    }
+}
+
+bool Exif_Reader::reset_orientation(BYTE* data, UINT32 size)
+{
+    E_VERIFY_NULL_R(data, false);
+
+    // Viewers that read XMP would still turn the image by its orientation, so it's reset too.
+    if (size >= sizeof(xmp_signature) && memcmp(data, xmp_signature, sizeof(xmp_signature)) == 0)
+    {
+        reset_xmp_orientation(reinterpret_cast<char*>(data) + sizeof(xmp_signature), static_cast<int>(size - sizeof(xmp_signature)));
+        return true;
+    }
+
+    if (size < sizeof(exif_signature) || memcmp(data, exif_signature, sizeof(exif_signature)) != 0)
+        return false;
+
+    BYTE* tiff_data = data + sizeof(exif_signature);
+    Tiff_Reader tiff;
+    if (!tiff.initialize(tiff_data, size - sizeof(exif_signature)))
+        return false;
+
+    // Values are written in the byte order of the segment, only where a read of them succeeds.
+    const UINT32 ifd0 = tiff.u32(4);
+    for (int i = 0; i < tiff.entry_count(ifd0); ++i)
+    {
+        const UINT32 entry = tiff.entry(ifd0, i);
+        if (tiff.u16(entry) != tag_orientation || tiff.u16(entry + 2) != type_short || entry + 10 > tiff.size)
+            continue;
+
+        tiff_data[entry + 8] = static_cast<BYTE>(tiff.is_big_endian ? 0 : 1);
+        tiff_data[entry + 9] = static_cast<BYTE>(tiff.is_big_endian ? 1 : 0);
+    }
+
+    // Thumbnail still shows the old orientation, IFD1 that describes it is left out of the chain.
+    const UINT32 next_ifd = ifd0 + 2 + static_cast<UINT32>(tiff.entry_count(ifd0)) * 12;
+    if (ifd0 != 0 && next_ifd <= tiff.size && tiff.size - next_ifd >= 4)
+        memset(tiff_data + next_ifd, 0, 4);
+
+    return true;
+}
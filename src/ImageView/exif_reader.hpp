@@ -0,0 +1,78 @@
+#pragma once
+#include <Windows.h>
+#include <wincodec.h>
+
+#include "string.hpp"
+
+// What's found in the first segments of a JPEG file, see Exif_Reader.
+struct Exif_Info
+{
+    // EXIF orientation, 1 is upright. 2 to 8 are mirrored and rotated as in the EXIF specification.
+    int orientation = 1;
+    // Size of the main image from its frame header or EXIF, zero if it's not known.
+    int width = 0;
+    int height = 0;
+    // Embedded JPEGs, offsets are from the start of the file and size is zero if there's none. Thumbnail is
+    // the small one in EXIF (usually 160x120), preview is the largest one in MPF (camera preview of a few megapixels).
+    UINT32 thumbnail_offset = 0;
+    UINT32 thumbnail_size = 0;
+    UINT32 preview_offset = 0;
+    UINT32 preview_size = 0;
+};
+
+// Embedded JPEGs of Exif_Info.
+enum class Embedded_Image
+{
+    Thumbnail,
+    Preview,
+};
+
+// Photo metadata found at the start of a JPEG or TIFF file, see Exif_Reader. Zero or empty if not found.
+struct Photo_Metadata
+{
+    // Capture time as FILETIME ticks. Cameras record local time without a time zone, so it's not UTC.
+    // EXIF DateTimeOriginal is used, then XMP and IPTC dates.
+    UINT64 date_taken = 0;
+    // UTF-8, make and model joined unless model already starts with make.
+    char camera[48] = {};
+    char lens[48] = {};
+    // Seconds, f-number and millimeters.
+    float exposure_time = 0.0f;
+    float f_number = 0.0f;
+    float focal_length = 0.0f;
+    int iso = 0;
+    // Degrees, south and west are negative.
+    bool has_location = false;
+    float latitude = 0.0f;
+    float longitude = 0.0f;
+    // XMP rating, 1 to 5 stars or -1 for rejected.
+    int rating = 0;
+};
+
+// Finds EXIF orientation and embedded thumbnail and preview of a JPEG without decoding it. They're in the
+// APP1 (EXIF) and APP2 (MPF) segments at the start of the file, so only 'probe_size' bytes are read.
+// Preview pixels are at the end of the file, they're read only when it's decoded. Photo metadata comes
+// from the same EXIF segment, APP1 XMP and APP13 IPTC. TIFF files have EXIF tags in their first IFD,
+// only metadata is read from those. Their IFDs can be anywhere in the file, parts past the probe are read
+// as tags point at them.
+struct Exif_Reader
+{
+    static const int probe_size = 64 * 1024;
+
+    // Parses segments of JPEG whose first 'size' bytes are in 'data'. Returns false if it's not a JPEG, or
+    // a TIFF when 'metadata' is requested. 'metadata' is optional, it's not parsed when it's null.
+    static bool parse(const BYTE* data, int size, Exif_Info* info, Photo_Metadata* metadata = nullptr);
+    // Reads first 'probe_size' bytes of 'file' and parses them. Returns S_FALSE if it's not a JPEG.
+    static HRESULT read(HANDLE file, Exif_Info* info, Photo_Metadata* metadata = nullptr);
+    // Creates decoder of embedded JPEG at 'offset' of 'file'. Its bytes are copied, 'file' can be closed afterwards.
+    static HRESULT create_embedded_decoder(IWICImagingFactory* wic, HANDLE file, UINT32 offset, UINT32 size, IWICBitmapDecoder** decoder);
+    // Opens first frame of embedded 'image' of 'file' and sets its size. Returns S_FALSE if there's none or
+    // its aspect ratio differs from the 'width' x 'height' image by more than 2%, it would be shown stretched.
+    static HRESULT open_embedded_frame(IWICImagingFactory* wic, HANDLE file, const Exif_Info& info, Embedded_Image image,
+        UINT width, UINT height, IWICBitmapFrameDecode** frame, UINT* frame_width, UINT* frame_height);
+    // Orientation of JPEG file at 'path', 1 if it has none or can't be read.
+    static int read_orientation(const String& path);
+    // Sets orientation in EXIF or XMP segment 'data', the 'size' bytes after its length, to 1 and unlinks
+    // EXIF thumbnail, for an image whose pixels were turned to how it's shown. Returns false if it's neither.
+    static bool reset_orientation(BYTE* data, UINT32 size);
+};
@@ -162,6 +162,78 @@ HRESULT File_System_Utility::read_file_contents(const String& file_path, void**
     return S_OK;
 }
 
+HRESULT Mapped_File::open(const String& file_path)
+{
+    E_VERIFY_R(!String::is_null_or_empty(file_path), E_INVALIDARG);
+    E_VERIFY_R(file == INVALID_HANDLE_VALUE, E_UNEXPECTED); // Call 'close' first!
+
+    SYSTEM_INFO system_info;
+    GetSystemInfo(&system_info);
+    allocation_granularity = system_info.dwAllocationGranularity;
+
+    file = CreateFileW(file_path.data, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return HRESULT_FROM_WIN32(GetLastError());
+
+    if (!GetFileSizeEx(file, (LARGE_INTEGER*)&size))
+    {
+        HRESULT hr = HRESULT_FROM_WIN32(GetLastError());
+        close();
+        return hr;
+    }
+
+    // Empty files cannot be mapped, there is nothing to view anyway.
+    if (size == 0)
+        return S_OK;
+
+    mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping == 0)
+    {
+        HRESULT hr = HRESULT_FROM_WIN32(GetLastError());
+        close();
+        return hr;
+    }
+
+    return S_OK;
+}
+
+void Mapped_File::close()
+{
+    if (mapping != 0)
+    {
+        CloseHandle(mapping);
+        mapping = 0;
+    }
+
+    if (file != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(file);
+        file = INVALID_HANDLE_VALUE;
+    }
+
+    size = 0;
+}
+
+HRESULT Mapped_File::map_view(UINT64 offset, size_t view_size, const char** view)
+{
+    E_VERIFY_NULL_R(view, E_INVALIDARG);
+    E_VERIFY_R(mapping != 0, E_UNEXPECTED);
+    E_VERIFY_R(offset % allocation_granularity == 0, E_INVALIDARG);
+    E_VERIFY_R(offset + view_size <= size, E_INVALIDARG);
+
+    void* data = MapViewOfFile(mapping, FILE_MAP_READ, (DWORD)(offset >> 32), (DWORD)(offset & 0xFFFFFFFF), view_size);
+    if (data == nullptr)
+        return HRESULT_FROM_WIN32(GetLastError());
+
+    *view = static_cast<const char*>(data);
+    return S_OK;
+}
+
+void Mapped_File::unmap_view(const char* view)
+{
+    if (view != nullptr)
+        UnmapViewOfFile(view);
+}
 
 HRESULT File_System_Utility::select_file_in_explorer(const String& file)
 {
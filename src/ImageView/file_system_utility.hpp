@@ -16,6 +16,23 @@ struct File_Info
     String path;
 };
 
+// Read-only file mapping. Views are mapped in windows, so files larger than the address space
+// (over 2 GB on x86) can still be streamed.
+struct Mapped_File
+{
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = 0;
+    UINT64 size = 0;
+    // View offsets must be multiple of this value.
+    UINT64 allocation_granularity = 64 * 1024;
+
+    HRESULT open(const String& file_path);
+    void close();
+
+    HRESULT map_view(UINT64 offset, size_t view_size, const char** view);
+    void unmap_view(const char* view);
+};
+
 typedef bool(*Get_Folder_Files_Filter)(const WIN32_FIND_DATA& file_data, void* userdata);
 
 struct File_System_Utility
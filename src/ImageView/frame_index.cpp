@@ -0,0 +1,138 @@
+#include <Windows.h>
+#include <wincodec.h>
+
+#include "frame_index.hpp"
+#include "defer.hpp"
+#include "error.hpp"
+
+
+// TIFF NewSubfileType tag, bit 0 is set for a reduced resolution version of another subfile.
+static const wchar_t* new_subfile_type_query = L"/ifd/{ushort=254}";
+static const ULONG subfile_reduced_resolution = 1;
+
+static bool is_reduced_resolution(IWICBitmapFrameDecode* frame)
+{
+    IWICMetadataQueryReader* reader = nullptr;
+    if (FAILED(frame->GetMetadataQueryReader(&reader)))
+        return false;
+    defer(reader->Release());
+
+    PROPVARIANT value;
+    PropVariantInit(&value);
+    if (FAILED(reader->GetMetadataByName(new_subfile_type_query, &value)))
+        return false;
+    defer(PropVariantClear(&value));
+
+    switch (value.vt)
+    {
+        case VT_UI4:
+            return (value.ulVal & subfile_reduced_resolution) != 0;
+        case VT_UI2:
+            return (value.uiVal & subfile_reduced_resolution) != 0;
+    }
+
+    return false;
+}
+
+bool Frame_Index::is_listed(Image_Format format)
+{
+    return format == Image_Format::Tiff || format == Image_Format::Ico;
+}
+
+HRESULT Frame_Index::scan(IWICBitmapDecoder* decoder, Image_Format format)
+{
+    E_VERIFY_NULL_R(decoder, E_INVALIDARG);
+
+    clear();
+    if (!is_listed(format))
+        return S_OK;
+
+    UINT frame_count = 0;
+    HRESULT hr = decoder->GetFrameCount(&frame_count);
+    if (FAILED(hr))
+        return hr;
+
+    if (!frames.reserve(static_cast<int>(frame_count)))
+        return E_OUTOFMEMORY;
+
+    for (UINT i = 0; i < frame_count; ++i)
+    {
+        IWICBitmapFrameDecode* frame = nullptr;
+        hr = decoder->GetFrame(i, &frame);
+        if (FAILED(hr))
+            break;
+        defer(frame->Release());
+
+        Frame entry = { i, 0, 0 };
+        hr = frame->GetSize(&entry.width, &entry.height);
+        if (FAILED(hr))
+            break;
+
+        if (entry.width == 0 || entry.height == 0)
+            continue;
+
+        // Sizes of an icon are one page, reduced resolution subfiles belong to the page before them.
+        const bool is_new_page = pages.is_empty() ||
+            (format == Image_Format::Tiff && !is_reduced_resolution(frame));
+        if (is_new_page)
+        {
+            const Page page = { frames.count, 0 };
+            if (!pages.push_back(page))
+                return E_OUTOFMEMORY;
+        }
+
+        frames.push_back(entry);
+        ++pages.data[pages.count - 1].frame_count;
+    }
+
+    // Frames that were listed are still shown when a later one is broken.
+    if (FAILED(hr) && frames.is_empty())
+    {
+        clear();
+        return hr;
+    }
+
+    return S_OK;
+}
+
+void Frame_Index::clear()
+{
+    frames.count = 0;
+    pages.count = 0;
+}
+
+void Frame_Index::swap(Frame_Index* other)
+{
+    E_VERIFY_NULL(other);
+
+    const Frame_Index swapped = *this;
+    *this = *other;
+    *other = swapped;
+}
+
+UINT Frame_Index::choose_frame(int page, int width, int height) const
+{
+    if (!pages.is_valid_index(page))
+        return 0;
+
+    const Page& listed = pages.data[page];
+    const Frame* best = nullptr;
+    const Frame* largest = nullptr;
+    for (int i = listed.first_frame; i < listed.first_frame + listed.frame_count; ++i)
+    {
+        const Frame& frame = frames.data[i];
+        const UINT64 area = static_cast<UINT64>(frame.width) * frame.height;
+        if (largest == nullptr || area > static_cast<UINT64>(largest->width) * largest->height)
+            largest = &frame;
+
+        // Fit to window scales it down to fill one side, or doesn't scale it at all.
+        const bool fills = frame.width >= static_cast<UINT>(width) || frame.height >= static_cast<UINT>(height);
+        if (fills && (best == nullptr || area < static_cast<UINT64>(best->width) * best->height))
+            best = &frame;
+    }
+
+    if (best == nullptr)
+        best = largest;
+
+    return best != nullptr ? best->index : 0;
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include <Windows.h>
+#include <wincodec.h>
+
+#include "sequence.hpp"
+#include "image_format.hpp"
+
+// Pages of the current file and the decoder frames each of them is stored in, listed once from frame
+// headers when the file is opened, pixels are never decoded. A page is one picture: a page of a TIFF,
+// or an icon with all its sizes. Frames of a page are that picture at other resolutions, reduced
+// resolution subfiles of a TIFF follow the full resolution one. Only the frame that fits the display
+// is decoded.
+//
+// Frames of a GIF are parts of one animation, not pages, so a GIF is a single page like any other
+// file that is not listed.
+struct Frame_Index
+{
+    struct Frame
+    {
+        UINT index;
+        UINT width;
+        UINT height;
+    };
+
+    struct Page
+    {
+        int first_frame;
+        int frame_count;
+    };
+
+    // True for formats whose files can have more pages or resolutions than the first frame.
+    static bool is_listed(Image_Format format);
+
+    // Lists pages and frames of a file in 'format' opened by 'decoder'.
+    HRESULT scan(IWICBitmapDecoder* decoder, Image_Format format);
+    // Makes it a single page of frame 0.
+    void clear();
+    // Exchanges pages and frames with 'other'.
+    void swap(Frame_Index* other);
+
+    inline int get_page_count() const { return pages.count > 0 ? pages.count : 1; }
+    // Decoder frame of 'page' to show in 'width' x 'height' pixels: the smallest one that fills it at
+    // fit to window scale, or the largest one when none does.
+    UINT choose_frame(int page, int width, int height) const;
+
+private:
+    Sequence<Frame> frames;
+    Sequence<Page> pages;
+};
@@ -0,0 +1,36 @@
+#include "image_buffer.hpp"
+#include "error.hpp"
+
+
+bool Image_Buffer::allocate(int width, int height, IAllocator* allocator)
+{
+    E_VERIFY_R(width > 0 && height > 0, false);
+    E_VERIFY_NULL_R(allocator, false);
+
+    release();
+
+    const UINT stride = sizeof(UINT32) * static_cast<UINT>(width);
+    BYTE* pixels = (BYTE*)allocator->allocate(static_cast<size_t>(stride) * height);
+    if (pixels == nullptr)
+        return false;
+
+    this->pixels = pixels;
+    this->width = width;
+    this->height = height;
+    this->stride = stride;
+    this->allocator = allocator;
+
+    return true;
+}
+
+void Image_Buffer::release()
+{
+    if (allocator != nullptr)
+        allocator->deallocate(pixels);
+
+    pixels = nullptr;
+    width = 0;
+    height = 0;
+    stride = 0;
+    allocator = nullptr;
+}
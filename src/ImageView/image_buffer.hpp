@@ -0,0 +1,23 @@
+#pragma once
+#include <Windows.h>
+
+#include "allocator.hpp"
+
+// 32bppPBGRA pixels in system memory.
+struct Image_Buffer
+{
+    BYTE* pixels = nullptr;
+    int width = 0;
+    int height = 0;
+    // Distance between rows in bytes.
+    UINT stride = 0;
+    // Null if 'pixels' are not owned by this buffer.
+    IAllocator* allocator = nullptr;
+
+    bool allocate(int width, int height, IAllocator* allocator = g_standard_allocator);
+    void release();
+
+    inline bool is_empty() const { return pixels == nullptr; }
+    inline UINT32* row(int y) const { return reinterpret_cast<UINT32*>(pixels + static_cast<size_t>(y) * stride); }
+    inline size_t size_in_bytes() const { return static_cast<size_t>(stride) * height; }
+};
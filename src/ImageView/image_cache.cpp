@@ -0,0 +1,360 @@
+#include "image_cache.hpp"
+#include "windows_utility.hpp"
+#include "error.hpp"
+
+
+Image_Cache  g_image_cache_obj;
+Image_Cache* g_image_cache = &g_image_cache_obj;
+
+
+void Image_Cache::set_budget(size_t budget)
+{
+    this->budget = budget;
+    trim(budget, -1, true);
+}
+
+void Image_Cache::set_compressed_budget(size_t budget)
+{
+    compressed_budget = budget;
+    trim_compressed(budget);
+}
+
+void Image_Cache::report_statistics() const
+{
+    const int lookups = statistics.hits + statistics.compressed_hits + statistics.misses;
+    if (lookups == 0)
+        return;
+
+    debug(L"Image cache: %d%% hits, %d%% compressed hits, %d%% misses of %d. Restore %.1f ms, compression %.1f ms on average. "
+        L"%zu KB decoded in %d images, %zu KB compressed in %d images.\n",
+        statistics.hits * 100 / lookups, statistics.compressed_hits * 100 / lookups, statistics.misses * 100 / lookups, lookups,
+        statistics.compressed_hits > 0 ? statistics.restore_ms / statistics.compressed_hits : 0.0,
+        statistics.compressed_count > 0 ? statistics.compress_ms / statistics.compressed_count : 0.0,
+        size_in_bytes / 1024, entry_count, compressed_size_in_bytes / 1024, compressed_count);
+}
+
+Mip_Pyramid* Image_Cache::find(const String& path, const FILETIME& date_modified, UINT frame)
+{
+    int index = find_index(path, date_modified, frame);
+    if (index < 0)
+    {
+        // Hits in the compressed tier are counted by 'restore'.
+        if (find_compressed_index(path, date_modified, frame) < 0)
+            ++statistics.misses;
+        return nullptr;
+    }
+
+    ++statistics.hits;
+    entries[index].last_used = ++use_counter;
+    return &entries[index].image;
+}
+
+bool Image_Cache::is_compressed(const String& path, const FILETIME& date_modified, UINT frame)
+{
+    return find_compressed_index(path, date_modified, frame) >= 0;
+}
+
+bool Image_Cache::contains(const String& path, const FILETIME& date_modified, UINT frame)
+{
+    return find_index(path, date_modified, frame) >= 0 || find_compressed_index(path, date_modified, frame) >= 0;
+}
+
+Mip_Pyramid* Image_Cache::restore(const String& path, const FILETIME& date_modified, UINT frame)
+{
+    int index = find_compressed_index(path, date_modified, frame);
+    if (index < 0)
+        return nullptr;
+
+    const double start = Windows_Utility::get_time_ms();
+
+    // Room is made before decompressing, so evicted images and the restored one aren't held at once.
+    // Entry is marked as used, so compressing evicted ones doesn't push it out of the compressed tier.
+    const Compressed_Image& compressed = compressed_entries[index].image;
+    const size_t decoded_size = static_cast<size_t>(compressed.width) * compressed.height * sizeof(UINT32) * 4 / 3;
+    compressed_entries[index].last_used = ++use_counter;
+    trim(decoded_size < budget ? budget - decoded_size : 0, -1, true);
+
+    index = find_compressed_index(path, date_modified, frame);
+    if (index < 0)
+    {
+        ++statistics.misses;
+        return nullptr;
+    }
+
+    Image_Buffer pixels;
+    const Orientation orientation = compressed_entries[index].orientation;
+    bool is_decompressed = compressed_entries[index].image.decompress(&pixels);
+    // Corrupted or not, it's not used again, file is decoded instead.
+    evict_compressed(index);
+    if (!is_decompressed)
+    {
+        ++statistics.misses;
+        return nullptr;
+    }
+
+    // Without mip levels image is still shown, it's just slower to scale.
+    Mip_Pyramid image;
+    if (!image.build(&pixels))
+        LOG_ERROR(L"Not enough memory for mip levels of restored %dx%d image.\n", image.base().width, image.base().height);
+    image.orientation = orientation;
+
+    Mip_Pyramid* restored = insert(path, date_modified, &image, frame);
+    if (restored == nullptr)
+    {
+        ++statistics.misses;
+        image.release();
+        return nullptr;
+    }
+
+    ++statistics.compressed_hits;
+    statistics.restore_ms += Windows_Utility::get_time_ms() - start;
+    return restored;
+}
+
+Mip_Pyramid* Image_Cache::insert(const String& path, const FILETIME& date_modified, Mip_Pyramid* image, UINT frame)
+{
+    E_VERIFY_NULL_R(image, nullptr);
+    E_VERIFY_R(!String::is_null_or_empty(path), nullptr);
+
+    // Same file with another modification date is replaced as well, with all its frames.
+    for (int i = entry_count - 1; i >= 0; --i)
+    {
+        const Entry& entry = entries[i];
+        if (String::equals_ignore_case(entry.path, path) &&
+            (entry.frame == frame || CompareFileTime(&entry.date_modified, &date_modified) != 0))
+        {
+            evict(i, false);
+        }
+    }
+
+    for (int i = compressed_count - 1; i >= 0; --i)
+    {
+        const Compressed_Entry& entry = compressed_entries[i];
+        if (String::equals_ignore_case(entry.path, path) &&
+            (entry.frame == frame || CompareFileTime(&entry.date_modified, &date_modified) != 0))
+        {
+            evict_compressed(i);
+        }
+    }
+
+    if (entry_count == max_entries)
+    {
+        int oldest = 0;
+        for (int i = 1; i < entry_count; ++i)
+        {
+            if (entries[i].last_used < entries[oldest].last_used)
+                oldest = i;
+        }
+
+        evict(oldest, true);
+    }
+
+    String path_copy = String::duplicate(path.data, path.count);
+    if (String::is_null(path_copy))
+        return nullptr;
+
+    Entry& entry = entries[entry_count];
+    entry.path = path_copy;
+    entry.path_hash = String::hash_ignore_case(path);
+    entry.date_modified = date_modified;
+    entry.frame = frame;
+    entry.last_used = ++use_counter;
+    entry.image = *image;
+    *image = Mip_Pyramid();
+
+    size_in_bytes += entry.image.size_in_bytes();
+
+    // Trimming moves entries around, this is the new index of the inserted one.
+    int index = trim(budget, entry_count++, true);
+    return &entries[index].image;
+}
+
+void Image_Cache::clear()
+{
+    while (entry_count > 0)
+        evict(entry_count - 1, false);
+
+    clear_compressed();
+}
+
+Mip_Pyramid* Image_Cache::shrink(size_t size, const Mip_Pyramid* keep, bool compress)
+{
+    int keep_index = -1;
+    for (int i = 0; i < entry_count; ++i)
+    {
+        if (&entries[i].image == keep)
+            keep_index = i;
+    }
+
+    keep_index = trim(size, keep_index, compress);
+    return keep_index >= 0 ? &entries[keep_index].image : nullptr;
+}
+
+void Image_Cache::clear_compressed()
+{
+    while (compressed_count > 0)
+        evict_compressed(compressed_count - 1);
+}
+
+int Image_Cache::find_index(const String& path, const FILETIME& date_modified, UINT frame)
+{
+    if (String::is_null_or_empty(path))
+        return -1;
+
+    const unsigned int path_hash = String::hash_ignore_case(path);
+    for (int i = 0; i < entry_count; ++i)
+    {
+        const Entry& entry = entries[i];
+        if (entry.path_hash == path_hash && entry.frame == frame && CompareFileTime(&entry.date_modified, &date_modified) == 0 &&
+            String::equals_ignore_case(entry.path, path))
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+int Image_Cache::find_compressed_index(const String& path, const FILETIME& date_modified, UINT frame)
+{
+    if (String::is_null_or_empty(path))
+        return -1;
+
+    const unsigned int path_hash = String::hash_ignore_case(path);
+    for (int i = 0; i < compressed_count; ++i)
+    {
+        const Compressed_Entry& entry = compressed_entries[i];
+        if (entry.path_hash == path_hash && entry.frame == frame && CompareFileTime(&entry.date_modified, &date_modified) == 0 &&
+            String::equals_ignore_case(entry.path, path))
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+void Image_Cache::evict(int index, bool compress)
+{
+    E_VERIFY(index >= 0 && index < entry_count);
+
+    Entry& entry = entries[index];
+    size_in_bytes -= entry.image.size_in_bytes();
+
+    // Only level 0 is compressed, mip levels are built again when it's restored. Photos compress to
+    // about half, images that wouldn't fit the budget even at a third are not worth the time.
+    Compressed_Image compressed;
+    if (compress && !entry.image.is_empty() && entry.image.base().size_in_bytes() / 3 <= compressed_budget)
+    {
+        const double start = Windows_Utility::get_time_ms();
+        if (compressed.compress(entry.image.base()))
+        {
+            ++statistics.compressed_count;
+            statistics.compress_ms += Windows_Utility::get_time_ms() - start;
+        }
+
+        // Noise doesn't compress, it would only take space.
+        const size_t size = compressed.size_in_bytes();
+        if (size > compressed_budget || size >= entry.image.base().size_in_bytes())
+            compressed.release();
+    }
+
+    const Orientation orientation = entry.image.orientation;
+    entry.image.release();
+
+    if (!compressed.is_empty())
+    {
+        trim_compressed(compressed_budget - compressed.size_in_bytes());
+        if (compressed_count == max_compressed_entries)
+        {
+            int oldest = 0;
+            for (int i = 1; i < compressed_count; ++i)
+            {
+                if (compressed_entries[i].last_used < compressed_entries[oldest].last_used)
+                    oldest = i;
+            }
+
+            evict_compressed(oldest);
+        }
+
+        // Path is moved to the compressed entry.
+        Compressed_Entry& compressed_entry = compressed_entries[compressed_count++];
+        compressed_entry.path = entry.path;
+        compressed_entry.path_hash = entry.path_hash;
+        compressed_entry.date_modified = entry.date_modified;
+        compressed_entry.frame = entry.frame;
+        compressed_entry.last_used = entry.last_used;
+        compressed_entry.orientation = orientation;
+        compressed_entry.image = compressed;
+        compressed_size_in_bytes += compressed.size_in_bytes();
+    }
+    else
+    {
+        g_standard_allocator->deallocate(entry.path.data);
+    }
+
+    // Order doesn't matter, last entry takes the free slot.
+    if (index != entry_count - 1)
+    {
+        entry = entries[entry_count - 1];
+        entries[entry_count - 1].image = Mip_Pyramid();
+    }
+
+    --entry_count;
+}
+
+void Image_Cache::evict_compressed(int index)
+{
+    E_VERIFY(index >= 0 && index < compressed_count);
+
+    Compressed_Entry& entry = compressed_entries[index];
+    compressed_size_in_bytes -= entry.image.size_in_bytes();
+    entry.image.release();
+    g_standard_allocator->deallocate(entry.path.data);
+
+    if (index != compressed_count - 1)
+    {
+        entry = compressed_entries[compressed_count - 1];
+        compressed_entries[compressed_count - 1].image = Compressed_Image();
+    }
+
+    --compressed_count;
+}
+
+int Image_Cache::trim(size_t size, int keep, bool compress)
+{
+    while (size_in_bytes > size)
+    {
+        int oldest = -1;
+        for (int i = 0; i < entry_count; ++i)
+        {
+            if (i != keep && (oldest < 0 || entries[i].last_used < entries[oldest].last_used))
+                oldest = i;
+        }
+
+        if (oldest < 0)
+            break;
+
+        // Evicting moves last entry into the freed slot.
+        if (keep == entry_count - 1)
+            keep = oldest;
+        evict(oldest, compress);
+    }
+
+    return keep;
+}
+
+void Image_Cache::trim_compressed(size_t size)
+{
+    while (compressed_size_in_bytes > size && compressed_count > 0)
+    {
+        int oldest = 0;
+        for (int i = 1; i < compressed_count; ++i)
+        {
+            if (compressed_entries[i].last_used < compressed_entries[oldest].last_used)
+                oldest = i;
+        }
+
+        evict_compressed(oldest);
+    }
+}
@@ -0,0 +1,106 @@
+#pragma once
+#include <Windows.h>
+
+#include "string.hpp"
+#include "mip_pyramid.hpp"
+#include "compressed_image.hpp"
+
+// Recently viewed images, decoded and with their mip levels, so going back to one doesn't decode it again.
+// Entries are identified by path, modification date and decoder frame and evicted least recently used first once
+// 'budget' bytes are used. Not thread safe, used from the window thread only.
+//
+// Evicted images go to a second tier, compressed without their mip levels, until 'compressed_budget'
+// is used. Restoring one from there is several times faster than decoding the file again.
+struct Image_Cache
+{
+    static const int max_entries = 16;
+    static const int max_compressed_entries = 64;
+
+    struct Statistics
+    {
+        int hits;
+        int compressed_hits;
+        int misses;
+        int compressed_count;
+        double compress_ms;
+        double restore_ms;
+    };
+
+    void set_budget(size_t budget);
+    inline size_t get_budget() const { return budget; }
+    inline size_t get_size_in_bytes() const { return size_in_bytes; }
+    void set_compressed_budget(size_t budget);
+    inline size_t get_compressed_size_in_bytes() const { return compressed_size_in_bytes; }
+    inline const Statistics& get_statistics() const { return statistics; }
+    // Writes hit rates of both tiers and average times to debug output.
+    void report_statistics() const;
+
+    // Returns cached image or null. It stays valid until next call to 'insert', 'restore', 'set_budget',
+    // 'shrink' or 'clear'.
+    Mip_Pyramid* find(const String& path, const FILETIME& date_modified, UINT frame = 0);
+    // True if image is in the compressed tier, 'restore' will return it.
+    bool is_compressed(const String& path, const FILETIME& date_modified, UINT frame = 0);
+    // True if image is in either tier, not counted as a lookup.
+    bool contains(const String& path, const FILETIME& date_modified, UINT frame = 0);
+    // Decompresses image from the compressed tier, builds its mip levels and moves it to the first tier.
+    // Entries of the first tier are evicted and move like with 'insert'. Returns null if image is not
+    // there or there's not enough memory.
+    Mip_Pyramid* restore(const String& path, const FILETIME& date_modified, UINT frame = 0);
+    // Takes ownership of 'image' and returns pointer to the stored one. Other entries are evicted to stay
+    // within budget, the inserted one is kept even if it alone is over it. Returns null if 'path' can't be copied.
+    Mip_Pyramid* insert(const String& path, const FILETIME& date_modified, Mip_Pyramid* image, UINT frame = 0);
+    // Clears both tiers.
+    void clear();
+    // Evicts least recently used entries, except 'keep', until cache uses at most 'size' bytes. Returns
+    // new address of 'keep', entries move when others are evicted. 'keep' can be null. Evicted images
+    // are compressed if 'compress' is true, which needs memory, so it's not done when memory is low.
+    Mip_Pyramid* shrink(size_t size, const Mip_Pyramid* keep, bool compress);
+    void clear_compressed();
+
+private:
+    struct Entry
+    {
+        String path;
+        unsigned int path_hash;
+        FILETIME date_modified;
+        UINT frame;
+        UINT64 last_used;
+        Mip_Pyramid image;
+    };
+
+    struct Compressed_Entry
+    {
+        String path;
+        unsigned int path_hash;
+        FILETIME date_modified;
+        UINT frame;
+        UINT64 last_used;
+        Orientation orientation;
+        Compressed_Image image;
+    };
+
+    Entry entries[max_entries];
+    int entry_count = 0;
+    UINT64 use_counter = 0;
+    size_t size_in_bytes = 0;
+    size_t budget = (sizeof(void*) == 8 ? 1024 : 256) * 1024 * 1024;
+
+    Compressed_Entry compressed_entries[max_compressed_entries];
+    int compressed_count = 0;
+    size_t compressed_size_in_bytes = 0;
+    size_t compressed_budget = (sizeof(void*) == 8 ? 256 : 64) * 1024 * 1024;
+
+    Statistics statistics = {};
+
+    int find_index(const String& path, const FILETIME& date_modified, UINT frame);
+    int find_compressed_index(const String& path, const FILETIME& date_modified, UINT frame);
+    // Moves pixels of the entry to the compressed tier if 'compress' is true and they fit its budget.
+    void evict(int index, bool compress);
+    void evict_compressed(int index);
+    // Evicts least recently used entries, except 'keep', until cache uses at most 'size' bytes.
+    // Returns new index of 'keep'.
+    int trim(size_t size, int keep, bool compress);
+    void trim_compressed(size_t size);
+};
+
+extern Image_Cache* g_image_cache;
@@ -0,0 +1,190 @@
+#include <string.h>
+#include <wchar.h>
+
+#include "image_format.hpp"
+#include "error.hpp"
+
+
+static const Image_Format_Info format_infos[] =
+{
+    { Image_Format::Unknown, L"Unknown", nullptr },
+    { Image_Format::Bmp,     L"BMP",     &GUID_ContainerFormatBmp },
+    { Image_Format::Gif,     L"GIF",     &GUID_ContainerFormatGif },
+    { Image_Format::Ico,     L"ICO",     &GUID_ContainerFormatIco },
+    { Image_Format::Jpeg,    L"JPEG",    &GUID_ContainerFormatJpeg },
+    { Image_Format::Png,     L"PNG",     &GUID_ContainerFormatPng },
+    { Image_Format::Tiff,    L"TIFF",    &GUID_ContainerFormatTiff },
+    { Image_Format::Wmp,     L"WMP",     &GUID_ContainerFormatWmp },
+    { Image_Format::Dds,     L"DDS",     &GUID_ContainerFormatDds },
+};
+
+static_assert(ARRAYSIZE(format_infos) == (int)Image_Format::NUM_FORMATS, "Fix format_infos table.");
+
+struct Extension_Entry
+{
+    const char* extension;
+    Image_Format format;
+};
+
+// Extensions are at most 4 ASCII characters, so each one packs into 32-bit key.
+static const Extension_Entry extension_entries[] =
+{
+    { "bmp",  Image_Format::Bmp },
+    { "dib",  Image_Format::Bmp },
+    { "gif",  Image_Format::Gif },
+    { "ico",  Image_Format::Ico },
+    { "jpg",  Image_Format::Jpeg },
+    { "jpeg", Image_Format::Jpeg },
+    { "jpe",  Image_Format::Jpeg },
+    { "jfif", Image_Format::Jpeg },
+    { "png",  Image_Format::Png },
+    { "tif",  Image_Format::Tiff },
+    { "tiff", Image_Format::Tiff },
+    { "wdp",  Image_Format::Wmp },
+    { "jxr",  Image_Format::Wmp },
+    { "hdp",  Image_Format::Wmp },
+    { "dds",  Image_Format::Dds },
+};
+
+struct Signature_Entry
+{
+    unsigned char bytes[8];
+    int count;
+    Image_Format format;
+};
+
+static const Signature_Entry signature_entries[] =
+{
+    { { 0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A }, 8, Image_Format::Png },
+    { { 0xFF, 0xD8, 0xFF },                             3, Image_Format::Jpeg },
+    { { 'G', 'I', 'F', '8' },                           4, Image_Format::Gif },
+    { { 'B', 'M' },                                     2, Image_Format::Bmp },
+    { { 'I', 'I', 0x2A, 0x00 },                         4, Image_Format::Tiff },
+    { { 'M', 'M', 0x00, 0x2A },                         4, Image_Format::Tiff },
+    { { 'I', 'I', 0xBC },                               3, Image_Format::Wmp },
+    { { 'D', 'D', 'S', ' ' },                           4, Image_Format::Dds },
+    { { 0x00, 0x00, 0x01, 0x00 },                       4, Image_Format::Ico },
+};
+
+// Perfect hash: multiplier is picked so every key in 'extension_entries' lands in its own slot.
+// If you add extension and hit E_VERIFY in 'build_extension_table', pick another multiplier.
+static const unsigned int extension_hash_multiplier = 0x9E377AD9u;
+static const int extension_hash_bits = 5;
+static const int extension_table_size = 1 << extension_hash_bits;
+
+struct Extension_Table
+{
+    unsigned int keys[extension_table_size];
+    Image_Format formats[extension_table_size];
+    bool is_built;
+};
+
+static Extension_Table extension_table;
+
+static inline unsigned int extension_hash(unsigned int key)
+{
+    return (key * extension_hash_multiplier) >> (32 - extension_hash_bits);
+}
+
+static inline unsigned int fold_extension_char(unsigned int c)
+{
+    return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+static void build_extension_table()
+{
+    memset(&extension_table, 0, sizeof(extension_table));
+
+    for (int i = 0; i < ARRAYSIZE(extension_entries); ++i)
+    {
+        const Extension_Entry& entry = extension_entries[i];
+
+        unsigned int key = 0;
+        for (int j = 0; entry.extension[j] != '\0'; ++j)
+            key |= (unsigned int)(unsigned char)entry.extension[j] << (8 * j);
+
+        unsigned int slot = extension_hash(key);
+        E_VERIFY(extension_table.keys[slot] == 0); // Collision, change multiplier.
+
+        extension_table.keys[slot] = key;
+        extension_table.formats[slot] = entry.format;
+    }
+
+    extension_table.is_built = true;
+}
+
+const Image_Format_Info* Image_Format_Registry::get_info(Image_Format format)
+{
+    E_VERIFY_R(format >= Image_Format::Unknown && format < Image_Format::NUM_FORMATS, &format_infos[0]);
+
+    return &format_infos[(int)format];
+}
+
+Image_Format Image_Format_Registry::from_extension(const wchar_t* extension, int extension_count)
+{
+    E_VERIFY_NULL_R(extension, Image_Format::Unknown);
+
+    if (extension_count <= 0 || extension_count > 4)
+        return Image_Format::Unknown;
+
+    if (!extension_table.is_built)
+        build_extension_table();
+
+    unsigned int key = 0;
+    for (int i = 0; i < extension_count; ++i)
+    {
+        unsigned int c = extension[i];
+        if (c == 0 || c >= 0x80)
+            return Image_Format::Unknown;
+
+        key |= fold_extension_char(c) << (8 * i);
+    }
+
+    unsigned int slot = extension_hash(key);
+    if (extension_table.keys[slot] != key)
+        return Image_Format::Unknown;
+
+    return extension_table.formats[slot];
+}
+
+Image_Format Image_Format_Registry::from_file_name(const wchar_t* file_name)
+{
+    E_VERIFY_NULL_R(file_name, Image_Format::Unknown);
+
+    return from_file_name(String::reference_to_const_wchar_t(file_name));
+}
+
+Image_Format Image_Format_Registry::from_file_name(const String& file_name)
+{
+    if (String::is_null_or_empty(file_name))
+        return Image_Format::Unknown;
+
+    // Only last 5 characters can hold ".ext", so don't scan the whole name.
+    int min_index = file_name.count > 5 ? file_name.count - 5 : 0;
+    for (int i = file_name.count - 1; i >= min_index; --i)
+    {
+        if (file_name.data[i] == L'.')
+            return from_extension(&file_name.data[i + 1], file_name.count - i - 1);
+    }
+
+    return Image_Format::Unknown;
+}
+
+Image_Format Image_Format_Registry::sniff(const void* header, int header_size)
+{
+    E_VERIFY_NULL_R(header, Image_Format::Unknown);
+
+    const unsigned char* bytes = static_cast<const unsigned char*>(header);
+
+    for (int i = 0; i < ARRAYSIZE(signature_entries); ++i)
+    {
+        const Signature_Entry& entry = signature_entries[i];
+        if (header_size < entry.count)
+            continue;
+
+        if (memcmp(bytes, entry.bytes, entry.count) == 0)
+            return entry.format;
+    }
+
+    return Image_Format::Unknown;
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include <Windows.h>
+#include <wincodec.h>
+
+#include "string.hpp"
+
+
+// Don't change enum values! Used as index in format info table.
+enum class Image_Format
+{
+    Unknown = 0,
+    Bmp,
+    Gif,
+    Ico,
+    Jpeg,
+    Png,
+    Tiff,
+    Wmp,
+    Dds,
+    NUM_FORMATS
+};
+
+struct Image_Format_Info
+{
+    Image_Format format;
+    const wchar_t* name;
+    // WIC container format, used to create decoder directly instead of probing every installed codec.
+    const GUID* container_format;
+};
+
+struct Image_Format_Registry
+{
+    // Amount of bytes from the start of the file that 'sniff' needs to see to detect any known format.
+    static const int signature_probe_size = 16;
+
+    static const Image_Format_Info* get_info(Image_Format format);
+
+    // Extension must be without leading dot. Case insensitive, one hash table probe.
+    static Image_Format from_extension(const wchar_t* extension, int extension_count);
+    static Image_Format from_file_name(const wchar_t* file_name);
+    static Image_Format from_file_name(const String& file_name);
+
+    // Detects format by magic bytes. Returns Image_Format::Unknown if signature is not recognized.
+    static Image_Format sniff(const void* header, int header_size);
+};
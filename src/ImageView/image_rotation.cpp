@@ -0,0 +1,353 @@
+#include <Windows.h>
+#include <string.h>
+
+#include "image_rotation.hpp"
+#include "cpu_features.hpp"
+#include "error.hpp"
+
+#if CPU_X86
+    #include <intrin.h>
+    #include <immintrin.h>
+#endif
+
+// Transposes 8x8 pixels: 8 rows are read from 'source' every 'source_step' bytes, and pixel i of row k is
+// written to row i at 'destination' every 'destination_step' bytes. Negative steps mirror the block.
+typedef void (*Transpose_Block_Func)(const BYTE* source, ptrdiff_t source_step, BYTE* destination, ptrdiff_t destination_step);
+// Writes 'width' pixels of 'source' to 'destination' in reverse order.
+typedef void (*Reverse_Row_Func)(const UINT32* source, UINT32* destination, int width);
+
+static const int block_size = 8;
+
+// Pixel (x, y) of a transposing orientation comes from source pixel (y, x), with the source mirrored
+// first as flagged. Others mirror without transposing.
+struct Orientation_Transform
+{
+    bool transpose;
+    bool mirror_x;
+    bool mirror_y;
+};
+
+static const Orientation_Transform transforms[9] = {
+    { false, false, false },
+    { false, false, false }, // Normal
+    { false, true,  false }, // Mirror_Horizontal
+    { false, true,  true  }, // Rotate_180
+    { false, false, true  }, // Mirror_Vertical
+    { true,  false, false }, // Transpose
+    { true,  false, true  }, // Rotate_90
+    { true,  true,  true  }, // Transverse
+    { true,  true,  false }, // Rotate_270
+};
+
+// Row 'first' is applied first, column 'second' after it.
+static const BYTE combined_orientations[8][8] = {
+    { 1, 2, 3, 4, 5, 6, 7, 8 },
+    { 2, 1, 4, 3, 8, 7, 6, 5 },
+    { 3, 4, 1, 2, 7, 8, 5, 6 },
+    { 4, 3, 2, 1, 6, 5, 8, 7 },
+    { 5, 6, 7, 8, 1, 2, 3, 4 },
+    { 6, 5, 8, 7, 4, 3, 2, 1 },
+    { 7, 8, 5, 6, 3, 4, 1, 2 },
+    { 8, 7, 6, 5, 2, 1, 4, 3 },
+};
+
+
+#pragma region Scalar
+static void transpose_block_scalar(const BYTE* source, ptrdiff_t source_step, BYTE* destination, ptrdiff_t destination_step)
+{
+    for (int i = 0; i < block_size; ++i)
+    {
+        UINT32* row = reinterpret_cast<UINT32*>(destination + i * destination_step);
+        for (int k = 0; k < block_size; ++k)
+            row[k] = reinterpret_cast<const UINT32*>(source + k * source_step)[i];
+    }
+}
+
+static void reverse_row_scalar(const UINT32* source, UINT32* destination, int width)
+{
+    for (int x = 0; x < width; ++x)
+        destination[x] = source[width - 1 - x];
+}
+#pragma endregion
+
+
+#if CPU_X86
+#pragma region SSE2
+static inline void transpose_4x4_sse2(__m128i& r0, __m128i& r1, __m128i& r2, __m128i& r3)
+{
+    const __m128i t0 = _mm_unpacklo_epi32(r0, r1);
+    const __m128i t1 = _mm_unpacklo_epi32(r2, r3);
+    const __m128i t2 = _mm_unpackhi_epi32(r0, r1);
+    const __m128i t3 = _mm_unpackhi_epi32(r2, r3);
+
+    r0 = _mm_unpacklo_epi64(t0, t1);
+    r1 = _mm_unpackhi_epi64(t0, t1);
+    r2 = _mm_unpacklo_epi64(t2, t3);
+    r3 = _mm_unpackhi_epi64(t2, t3);
+}
+
+// Block is four 4x4 quarters, each transposed in place, the top right and bottom left ones swap places.
+static void transpose_block_sse2(const BYTE* source, ptrdiff_t source_step, BYTE* destination, ptrdiff_t destination_step)
+{
+    __m128i left[8];
+    __m128i right[8];
+    for (int k = 0; k < block_size; ++k)
+    {
+        const __m128i* row = reinterpret_cast<const __m128i*>(source + k * source_step);
+        left[k] = _mm_loadu_si128(row);
+        right[k] = _mm_loadu_si128(row + 1);
+    }
+
+    transpose_4x4_sse2(left[0], left[1], left[2], left[3]);
+    transpose_4x4_sse2(left[4], left[5], left[6], left[7]);
+    transpose_4x4_sse2(right[0], right[1], right[2], right[3]);
+    transpose_4x4_sse2(right[4], right[5], right[6], right[7]);
+
+    for (int i = 0; i < 4; ++i)
+    {
+        __m128i* top = reinterpret_cast<__m128i*>(destination + i * destination_step);
+        __m128i* bottom = reinterpret_cast<__m128i*>(destination + (i + 4) * destination_step);
+        _mm_storeu_si128(top, left[i]);
+        _mm_storeu_si128(top + 1, left[i + 4]);
+        _mm_storeu_si128(bottom, right[i]);
+        _mm_storeu_si128(bottom + 1, right[i + 4]);
+    }
+}
+
+static void reverse_row_sse2(const UINT32* source, UINT32* destination, int width)
+{
+    int x = 0;
+    for (; x + 4 <= width; x += 4)
+    {
+        const __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + width - 4 - x));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + x), _mm_shuffle_epi32(pixels, _MM_SHUFFLE(0, 1, 2, 3)));
+    }
+
+    reverse_row_scalar(source, destination + x, width - x);
+}
+#pragma endregion
+
+#pragma region AVX2
+// Each 128-bit lane transposes like SSE2, then lanes of rows 0 to 3 and 4 to 7 are paired up.
+static void transpose_block_avx2(const BYTE* source, ptrdiff_t source_step, BYTE* destination, ptrdiff_t destination_step)
+{
+    __m256i r[8];
+    for (int k = 0; k < block_size; ++k)
+        r[k] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + k * source_step));
+
+    __m256i t[8];
+    for (int k = 0; k < block_size; k += 4)
+    {
+        const __m256i t0 = _mm256_unpacklo_epi32(r[k], r[k + 1]);
+        const __m256i t1 = _mm256_unpackhi_epi32(r[k], r[k + 1]);
+        const __m256i t2 = _mm256_unpacklo_epi32(r[k + 2], r[k + 3]);
+        const __m256i t3 = _mm256_unpackhi_epi32(r[k + 2], r[k + 3]);
+
+        t[k] = _mm256_unpacklo_epi64(t0, t2);
+        t[k + 1] = _mm256_unpackhi_epi64(t0, t2);
+        t[k + 2] = _mm256_unpacklo_epi64(t1, t3);
+        t[k + 3] = _mm256_unpackhi_epi64(t1, t3);
+    }
+
+    for (int i = 0; i < 4; ++i)
+    {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(destination + i * destination_step), _mm256_permute2x128_si256(t[i], t[i + 4], 0x20));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(destination + (i + 4) * destination_step), _mm256_permute2x128_si256(t[i], t[i + 4], 0x31));
+    }
+}
+
+static void reverse_row_avx2(const UINT32* source, UINT32* destination, int width)
+{
+    const __m256i reverse = _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+
+    int x = 0;
+    for (; x + 8 <= width; x += 8)
+    {
+        const __m256i pixels = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + width - 8 - x));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(destination + x), _mm256_permutevar8x32_epi32(pixels, reverse));
+    }
+
+    reverse_row_sse2(source, destination + x, width - x);
+}
+#pragma endregion
+#endif
+
+struct Rotation_Kernels
+{
+    Transpose_Block_Func transpose_block;
+    Reverse_Row_Func reverse_row;
+
+    inline void set(Transpose_Block_Func transpose_block_func, Reverse_Row_Func reverse_row_func) {
+        transpose_block = transpose_block_func;
+        reverse_row = reverse_row_func;
+    }
+};
+
+static Rotation_Kernels select_kernels(const Cpu_Features& features)
+{
+    Rotation_Kernels k;
+    k.set(transpose_block_scalar, reverse_row_scalar);
+
+#if CPU_X86
+    if (features.has_avx2)
+        k.set(transpose_block_avx2, reverse_row_avx2);
+    else if (features.has_sse2)
+        k.set(transpose_block_sse2, reverse_row_sse2);
+#endif
+
+    return k;
+}
+
+static const Rotation_Kernels& get_kernels()
+{
+    static const Rotation_Kernels kernels = select_kernels(g_cpu_features);
+    return kernels;
+}
+
+struct Transform_Job
+{
+    const Image_Buffer* source;
+    const Image_Buffer* destination;
+    Orientation_Transform transform;
+    const Rotation_Kernels* kernels;
+};
+
+// Pixels of destination rectangle from 'x0', 'y0' to 'x1', 'y1' one by one, for the edges that are
+// not a whole block.
+static void transpose_pixels(const Transform_Job& job, int x0, int y0, int x1, int y1)
+{
+    const Image_Buffer& source = *job.source;
+    for (int y = y0; y < y1; ++y)
+    {
+        UINT32* row = job.destination->row(y);
+        const int source_x = job.transform.mirror_x ? source.width - 1 - y : y;
+        for (int x = x0; x < x1; ++x)
+        {
+            const int source_y = job.transform.mirror_y ? source.height - 1 - x : x;
+            row[x] = source.row(source_y)[source_x];
+        }
+    }
+}
+
+// Destination block at 'x', 'y' is source rows from 'x' and columns from 'y', stepped backwards along
+// a mirrored axis.
+static void transpose_block(const Transform_Job& job, int x, int y)
+{
+    const Image_Buffer& source = *job.source;
+    const Image_Buffer& destination = *job.destination;
+
+    const int source_x = job.transform.mirror_x ? source.width - block_size - y : y;
+    const int source_y = job.transform.mirror_y ? source.height - 1 - x : x;
+    const ptrdiff_t source_step = job.transform.mirror_y ? -static_cast<ptrdiff_t>(source.stride) : source.stride;
+
+    const int destination_y = job.transform.mirror_x ? y + block_size - 1 : y;
+    const ptrdiff_t destination_step = job.transform.mirror_x ? -static_cast<ptrdiff_t>(destination.stride) : destination.stride;
+
+    job.kernels->transpose_block(reinterpret_cast<const BYTE*>(source.row(source_y) + source_x), source_step,
+        reinterpret_cast<BYTE*>(destination.row(destination_y) + x), destination_step);
+}
+
+// Band is a row of tiles of the destination.
+static void transpose_band_job(void* context, int band)
+{
+    const Transform_Job& job = *(const Transform_Job*)context;
+    const Image_Buffer& destination = *job.destination;
+
+    const int first_y = band * Image_Rotation::tile_size;
+    const int end_y = min(first_y + Image_Rotation::tile_size, destination.height);
+    const int blocks_end_y = first_y + (end_y - first_y) / block_size * block_size;
+
+    for (int tile_x = 0; tile_x < destination.width; tile_x += Image_Rotation::tile_size)
+    {
+        const int end_x = min(tile_x + Image_Rotation::tile_size, destination.width);
+        const int blocks_end_x = tile_x + (end_x - tile_x) / block_size * block_size;
+
+        for (int y = first_y; y < blocks_end_y; y += block_size)
+        {
+            for (int x = tile_x; x < blocks_end_x; x += block_size)
+                transpose_block(job, x, y);
+        }
+
+        transpose_pixels(job, blocks_end_x, first_y, end_x, blocks_end_y);
+        transpose_pixels(job, tile_x, blocks_end_y, end_x, end_y);
+    }
+}
+
+static void mirror_band_job(void* context, int band)
+{
+    const Transform_Job& job = *(const Transform_Job*)context;
+    const Image_Buffer& source = *job.source;
+    const Image_Buffer& destination = *job.destination;
+
+    const int first_y = band * Image_Rotation::tile_size;
+    const int end_y = min(first_y + Image_Rotation::tile_size, destination.height);
+    for (int y = first_y; y < end_y; ++y)
+    {
+        const UINT32* row = source.row(job.transform.mirror_y ? source.height - 1 - y : y);
+        if (job.transform.mirror_x)
+            job.kernels->reverse_row(row, destination.row(y), destination.width);
+        else
+            memcpy(destination.row(y), row, static_cast<size_t>(destination.width) * sizeof(UINT32));
+    }
+}
+
+Orientation Image_Rotation::from_exif(int value)
+{
+    return value >= 1 && value <= 8 ? static_cast<Orientation>(value) : Orientation::Normal;
+}
+
+bool Image_Rotation::swaps_size(Orientation orientation)
+{
+    return transforms[static_cast<int>(from_exif(static_cast<int>(orientation)))].transpose;
+}
+
+Orientation Image_Rotation::combine(Orientation first, Orientation second)
+{
+    const int a = static_cast<int>(from_exif(static_cast<int>(first)));
+    const int b = static_cast<int>(from_exif(static_cast<int>(second)));
+
+    return static_cast<Orientation>(combined_orientations[a - 1][b - 1]);
+}
+
+static bool transform_with_kernels(const Image_Buffer& source, Orientation orientation, const Rotation_Kernels& kernels,
+    Image_Buffer* destination, Job_Pool* pool)
+{
+    E_VERIFY_R(!source.is_empty(), false);
+    E_VERIFY_NULL_R(destination, false);
+
+    Transform_Job job;
+    job.source = &source;
+    job.destination = destination;
+    job.transform = transforms[static_cast<int>(Image_Rotation::from_exif(static_cast<int>(orientation)))];
+    job.kernels = &kernels;
+
+    const int width = job.transform.transpose ? source.height : source.width;
+    const int height = job.transform.transpose ? source.width : source.height;
+    if (!destination->allocate(width, height))
+        return false;
+
+    const Job_Func func = job.transform.transpose ? transpose_band_job : mirror_band_job;
+    const int band_count = (height + Image_Rotation::tile_size - 1) / Image_Rotation::tile_size;
+    if (pool != nullptr && band_count > 1)
+    {
+        pool->parallel_for(band_count, func, &job);
+    }
+    else
+    {
+        for (int i = 0; i < band_count; ++i)
+            func(&job, i);
+    }
+
+    return true;
+}
+
+bool Image_Rotation::transform(const Image_Buffer& source, Orientation orientation, Image_Buffer* destination, Job_Pool* pool)
+{
+    return transform_with_kernels(source, orientation, get_kernels(), destination, pool);
+}
+
+bool Image_Rotation::transform(const Image_Buffer& source, Orientation orientation, const Cpu_Features& features, Image_Buffer* destination,
+    Job_Pool* pool)
+{
+    return transform_with_kernels(source, orientation, select_kernels(features), destination, pool);
+}
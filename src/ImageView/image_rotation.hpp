@@ -0,0 +1,46 @@
+#pragma once
+#include <Windows.h>
+
+#include "image_buffer.hpp"
+#include "job_pool.hpp"
+
+struct Cpu_Features;
+
+// Orientations with values of the EXIF orientation tag. Each one is the transform that turns pixels as
+// they're stored into pixels as they're shown, e.g. Rotate_90 turns the stored image clockwise.
+enum class Orientation : int
+{
+    Normal = 1,
+    Mirror_Horizontal = 2,
+    Rotate_180 = 3,
+    Mirror_Vertical = 4,
+    Transpose = 5,
+    Rotate_90 = 6,
+    Transverse = 7,
+    Rotate_270 = 8,
+};
+
+// Turns and mirrors images by an orientation. Orientations that turn by 90 degrees write the image in
+// tiles of 'tile_size' pixels, so the source columns a tile reads and the rows it writes both stay in
+// cache, and transpose 8x8 pixel blocks within a tile in registers. Others copy rows, reversing them
+// when mirrored. Rows of tiles are split between threads of the job pool. Kernels are selected once at
+// runtime using g_cpu_features.
+struct Image_Rotation
+{
+    static const int tile_size = 64;
+
+    // Orientation from the value of an EXIF orientation tag, Normal for values out of range.
+    static Orientation from_exif(int value);
+    // True if 'orientation' swaps width and height.
+    static bool swaps_size(Orientation orientation);
+    // Orientation that is the same as applying 'first' and then 'second'.
+    static Orientation combine(Orientation first, Orientation second);
+
+    // Allocates 'destination' and writes 'source' transformed by 'orientation' to it. Returns false if
+    // there's not enough memory.
+    static bool transform(const Image_Buffer& source, Orientation orientation, Image_Buffer* destination, Job_Pool* pool = g_job_pool);
+    // Same with kernels selected for 'features', which must be a subset of g_cpu_features. Lets tests
+    // compare SIMD kernels with scalar ones.
+    static bool transform(const Image_Buffer& source, Orientation orientation, const Cpu_Features& features, Image_Buffer* destination,
+        Job_Pool* pool = g_job_pool);
+};
@@ -0,0 +1,211 @@
+#include <Windows.h>
+#include <string.h>
+
+#include "job_pool.hpp"
+#include "error.hpp"
+
+
+Job_Pool  g_job_pool_obj;
+Job_Pool* g_job_pool = &g_job_pool_obj;
+
+
+bool Job_Pool::initialize(int thread_count)
+{
+    E_VERIFY_R(this->thread_count == 0, false); // Already initialized.
+    E_VERIFY_R(thread_count >= 0, false);
+
+    if (thread_count > max_threads)
+        thread_count = max_threads;
+
+    is_shutting_down = false;
+    for (int i = 0; i < thread_count; ++i)
+    {
+        HANDLE thread = CreateThread(nullptr, 0, worker_proc, this, 0, nullptr);
+        if (thread == nullptr)
+        {
+            LOG_LAST_WIN32_ERROR(L"Unable to create worker thread.\n");
+            break;
+        }
+
+        threads[this->thread_count++] = thread;
+    }
+
+    return this->thread_count == thread_count;
+}
+
+void Job_Pool::shutdown()
+{
+    AcquireSRWLockExclusive(&lock);
+    is_shutting_down = true;
+    ReleaseSRWLockExclusive(&lock);
+    WakeAllConditionVariable(&job_available);
+
+    WaitForMultipleObjects(thread_count, threads, TRUE, INFINITE);
+    for (int i = 0; i < thread_count; ++i)
+        CloseHandle(threads[i]);
+
+    thread_count = 0;
+    queue_count = 0;
+}
+
+bool Job_Pool::submit(Job_Func func, void* context, int index, Job_Group* group)
+{
+    E_VERIFY_NULL_R(func, false);
+    if (thread_count == 0)
+        return false;
+
+    AcquireSRWLockExclusive(&lock);
+    if (queue_count == queue_capacity || is_shutting_down)
+    {
+        ReleaseSRWLockExclusive(&lock);
+        return false;
+    }
+
+    if (group != nullptr)
+        InterlockedIncrement(&group->pending);
+
+    Job& job = queue[queue_count++];
+    job.func = func;
+    job.context = context;
+    job.index = index;
+    job.group = group;
+
+    ReleaseSRWLockExclusive(&lock);
+    WakeConditionVariable(&job_available);
+
+    return true;
+}
+
+void Job_Pool::wait(Job_Group* group)
+{
+    E_VERIFY_NULL(group);
+
+    AcquireSRWLockExclusive(&lock);
+    while (!group->is_done())
+    {
+        Job job;
+        if (take_job(group, &job))
+        {
+            ReleaseSRWLockExclusive(&lock);
+            run_job(job);
+            AcquireSRWLockExclusive(&lock);
+        }
+        else
+        {
+            SleepConditionVariableSRW(&job_finished, &lock, INFINITE, 0);
+        }
+    }
+    ReleaseSRWLockExclusive(&lock);
+}
+
+struct Parallel_For_Context
+{
+    Job_Func func;
+    void* context;
+    int count;
+    volatile LONG next_index;
+};
+
+// Indices are taken one by one, so threads that got cheap indices continue with the rest.
+static void parallel_for_job(void* context, int)
+{
+    Parallel_For_Context* pf = (Parallel_For_Context*)context;
+
+    for (;;)
+    {
+        int index = static_cast<int>(InterlockedIncrement(&pf->next_index)) - 1;
+        if (index >= pf->count)
+            break;
+
+        pf->func(pf->context, index);
+    }
+}
+
+void Job_Pool::parallel_for(int count, Job_Func func, void* context)
+{
+    E_VERIFY_NULL(func);
+    if (count <= 0)
+        return;
+
+    Parallel_For_Context pf;
+    pf.func = func;
+    pf.context = context;
+    pf.count = count;
+    pf.next_index = 0;
+
+    Job_Group group;
+    int helper_count = min(thread_count, count - 1);
+    for (int i = 0; i < helper_count; ++i)
+        if (!submit(parallel_for_job, &pf, 0, &group))
+            break;
+
+    parallel_for_job(&pf, 0);
+    wait(&group);
+}
+
+bool Job_Pool::take_job(Job_Group* group, Job* job)
+{
+    for (int i = 0; i < queue_count; ++i)
+    {
+        if (group != nullptr && queue[i].group != group)
+            continue;
+
+        *job = queue[i];
+        // Keep order, jobs are started in the order they were submitted.
+        memmove(&queue[i], &queue[i + 1], sizeof(Job) * (queue_count - i - 1));
+        --queue_count;
+
+        return true;
+    }
+
+    return false;
+}
+
+void Job_Pool::run_job(const Job& job)
+{
+    job.func(job.context, job.index);
+
+    if (job.group != nullptr && InterlockedDecrement(&job.group->pending) == 0)
+    {
+        // Waiting thread checks the counter under the lock, take it so wake up is not missed.
+        AcquireSRWLockExclusive(&lock);
+        ReleaseSRWLockExclusive(&lock);
+        WakeAllConditionVariable(&job_finished);
+    }
+}
+
+DWORD __stdcall Job_Pool::worker_proc(void* param)
+{
+    Job_Pool* pool = (Job_Pool*)param;
+
+    // Once per worker, jobs decode with WIC. Failure leaves jobs that need COM failing on their own.
+    HRESULT com_hr = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+    if (FAILED(com_hr))
+        LOG_HRESULT_ERROR(com_hr, L"Unable to initialize COM on worker thread.\n");
+
+    AcquireSRWLockExclusive(&pool->lock);
+    for (;;)
+    {
+        Job job;
+        if (pool->take_job(nullptr, &job))
+        {
+            ReleaseSRWLockExclusive(&pool->lock);
+            pool->run_job(job);
+            AcquireSRWLockExclusive(&pool->lock);
+        }
+        else if (pool->is_shutting_down)
+        {
+            break;
+        }
+        else
+        {
+            SleepConditionVariableSRW(&pool->job_available, &pool->lock, INFINITE, 0);
+        }
+    }
+    ReleaseSRWLockExclusive(&pool->lock);
+
+    if (SUCCEEDED(com_hr))
+        CoUninitialize();
+
+    return 0;
+}
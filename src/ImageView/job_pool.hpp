@@ -0,0 +1,62 @@
+#pragma once
+#include <Windows.h>
+
+typedef void (*Job_Func)(void* context, int index);
+
+// Counts unfinished jobs submitted with this group.
+struct Job_Group
+{
+    volatile LONG pending = 0;
+
+    inline bool is_done() const { return pending == 0; }
+};
+
+// Fixed set of worker threads that run queued jobs. Threads that wait for a group run queued jobs of
+// that group themselves, so waiting from inside of a job doesn't deadlock.
+// Workers are in the multithreaded COM apartment, jobs that run on a waiting thread use its apartment.
+struct Job_Pool
+{
+    static const int max_threads = 64;
+    static const int queue_capacity = 1024;
+
+    // 'thread_count' can be zero, all jobs are run by the thread that waits for them then.
+    bool initialize(int thread_count);
+    void shutdown();
+
+    // Queues func(context, index). Returns false if queue is full, caller should run the job itself then.
+    bool submit(Job_Func func, void* context, int index, Job_Group* group);
+    // Returns when all jobs of 'group' are finished.
+    void wait(Job_Group* group);
+
+    // Runs func(context, i) for every i in [0, count) on workers and calling thread, returns when all are done.
+    void parallel_for(int count, Job_Func func, void* context);
+
+    inline int get_thread_count() const { return thread_count; }
+private:
+    struct Job
+    {
+        Job_Func func;
+        void* context;
+        int index;
+        Job_Group* group;
+    };
+
+    SRWLOCK lock = SRWLOCK_INIT;
+    CONDITION_VARIABLE job_available = CONDITION_VARIABLE_INIT;
+    CONDITION_VARIABLE job_finished = CONDITION_VARIABLE_INIT;
+
+    Job queue[queue_capacity];
+    int queue_count = 0;
+
+    HANDLE threads[max_threads];
+    int thread_count = 0;
+    bool is_shutting_down = false;
+
+    // Must be called with 'lock' held. 'group' is null to take any job.
+    bool take_job(Job_Group* group, Job* job);
+    void run_job(const Job& job);
+
+    static DWORD __stdcall worker_proc(void* param);
+};
+
+extern Job_Pool* g_job_pool;
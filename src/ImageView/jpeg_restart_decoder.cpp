@@ -0,0 +1,449 @@
+#include <Windows.h>
+#include <wincodec.h>
+#include <string.h>
+
+#include "jpeg_restart_decoder.hpp"
+#include "file_system_utility.hpp"
+#include "pixel_conversion.hpp"
+#include "allocator.hpp"
+#include "com_utility.hpp"
+#include "defer.hpp"
+#include "error.hpp"
+
+static const BYTE marker_sof0 = 0xC0;
+static const BYTE marker_sof1 = 0xC1;
+static const BYTE marker_dht = 0xC4;
+static const BYTE marker_rst0 = 0xD0;
+static const BYTE marker_rst7 = 0xD7;
+static const BYTE marker_soi = 0xD8;
+static const BYTE marker_eoi = 0xD9;
+static const BYTE marker_sos = 0xDA;
+static const BYTE marker_dri = 0xDD;
+static const BYTE marker_app0 = 0xE0;
+static const BYTE marker_app14 = 0xEE;
+static const BYTE marker_com = 0xFE;
+
+// Segments kept in the headers of every band, files with more are decoded serially.
+static const int max_header_segments = 64;
+
+
+// Where the scan of the file and its rows of MCUs are.
+struct Jpeg_Layout
+{
+    int width;
+    int height;
+    int mcu_width;
+    int mcu_height;
+    int mcus_x;
+    int mcus_y;
+    int restart_interval;
+    // Headers of the file without metadata, ending with SOS. Height in SOF is changed for every band.
+    BYTE* header;
+    size_t header_size;
+    size_t sof_height_offset;
+    size_t scan_end;
+    // Offset of entropy coded data of every row of MCUs that starts with a restart interval, 0 for
+    // others. 'mcus_y' + 1 entries, the last one is unused.
+    size_t* row_starts;
+};
+
+struct Band_Job
+{
+    IWICImagingFactory* wic;
+    const BYTE* data;
+    const Jpeg_Layout* layout;
+    const Image_Buffer* image;
+    Chroma_Upsampling upsampling;
+    // Rows of MCUs that start a band, the last entry is 'mcus_y'.
+    int split_rows[Jpeg_Restart_Decoder::max_bands + 1];
+    // Rows of MCUs between two restart intervals that start a row.
+    int restart_rows;
+    volatile LONG result;
+};
+
+
+static inline int read_u16(const BYTE* data)
+{
+    return data[0] << 8 | data[1];
+}
+
+static int greatest_common_divisor(int a, int b)
+{
+    while (b != 0)
+    {
+        const int remainder = a % b;
+        a = b;
+        b = remainder;
+    }
+
+    return a;
+}
+
+// Reads segments up to the first scan and copies the ones that decoding needs to 'layout->header'. Returns
+// S_FALSE if the image is not baseline with a single interleaved scan and restart intervals.
+static HRESULT parse_header(const BYTE* data, size_t size, Jpeg_Layout* layout, size_t* scan_start)
+{
+    if (size < 4 || data[0] != 0xFF || data[1] != marker_soi)
+        return S_FALSE;
+
+    size_t segment_offsets[max_header_segments];
+    size_t segment_sizes[max_header_segments];
+    int segment_count = 0;
+    int sof_segment = -1;
+    int component_count = 0;
+    size_t position = 2;
+
+    for (;;)
+    {
+        // Markers can be preceded by any number of fill bytes.
+        if (position >= size || data[position] != 0xFF)
+            return S_FALSE;
+        while (position < size && data[position] == 0xFF)
+            ++position;
+        if (position + 3 > size)
+            return S_FALSE;
+
+        const size_t segment_start = position - 1;
+        const BYTE marker = data[position];
+        if (marker == marker_soi || marker == marker_eoi || (marker >= marker_rst0 && marker <= marker_rst7) || marker == 0x00 || marker == 0x01)
+            return S_FALSE;
+
+        const size_t length = static_cast<size_t>(read_u16(data + position + 1));
+        if (length < 2 || position + 1 + length > size)
+            return S_FALSE;
+        const BYTE* payload = data + position + 3;
+        const size_t payload_size = length - 2;
+
+        if (marker == marker_sof0 || marker == marker_sof1)
+        {
+            if (payload_size < 6 || sof_segment >= 0)
+                return S_FALSE;
+
+            layout->height = read_u16(payload + 1);
+            layout->width = read_u16(payload + 3);
+            component_count = payload[5];
+            if (payload[0] != 8 || layout->height == 0 || layout->width == 0 || component_count == 0 || component_count > 4 ||
+                payload_size < 6 + 3 * static_cast<size_t>(component_count))
+            {
+                return S_FALSE;
+            }
+
+            // Scan of a single component has MCUs of one block, whatever its sampling factors are.
+            int max_h = 1;
+            int max_v = 1;
+            for (int i = 0; i < component_count && component_count > 1; ++i)
+            {
+                const int h = payload[6 + 3 * i + 1] >> 4;
+                const int v = payload[6 + 3 * i + 1] & 0x0F;
+                if (h < 1 || h > 4 || v < 1 || v > 4)
+                    return S_FALSE;
+                max_h = max(max_h, h);
+                max_v = max(max_v, v);
+            }
+
+            layout->mcu_width = 8 * max_h;
+            layout->mcu_height = 8 * max_v;
+            sof_segment = segment_count;
+        }
+        else if (marker >= 0xC2 && marker <= 0xCF && marker != marker_dht)
+        {
+            // Progressive, lossless and arithmetic coded images.
+            return S_FALSE;
+        }
+        else if (marker == marker_dri)
+        {
+            if (payload_size < 2)
+                return S_FALSE;
+            layout->restart_interval = read_u16(payload);
+        }
+        else if (marker == marker_sos)
+        {
+            if (sof_segment < 0 || payload_size < 1 || payload[0] != component_count)
+                return S_FALSE;
+        }
+
+        // Metadata is left out, except for JFIF and Adobe segments that say how colors are transformed.
+        const bool is_metadata = (marker > marker_app0 && marker <= 0xEF && marker != marker_app14) || marker == marker_com;
+        if (!is_metadata)
+        {
+            if (segment_count == max_header_segments)
+                return S_FALSE;
+
+            segment_offsets[segment_count] = segment_start;
+            segment_sizes[segment_count] = length + 2;
+            ++segment_count;
+        }
+
+        position += 1 + length;
+        if (marker == marker_sos)
+            break;
+    }
+
+    if (layout->restart_interval == 0)
+        return S_FALSE;
+
+    size_t header_size = 2;
+    for (int i = 0; i < segment_count; ++i)
+        header_size += segment_sizes[i];
+
+    layout->header = (BYTE*)g_standard_allocator->allocate(header_size);
+    if (layout->header == nullptr)
+        return E_OUTOFMEMORY;
+
+    // Fill bytes are not copied, every segment starts with its own 0xFF.
+    BYTE* out = layout->header;
+    *out++ = 0xFF;
+    *out++ = marker_soi;
+    for (int i = 0; i < segment_count; ++i)
+    {
+        if (i == sof_segment)
+            layout->sof_height_offset = (out - layout->header) + 5;
+
+        memcpy(out, data + segment_offsets[i], segment_sizes[i]);
+        out += segment_sizes[i];
+    }
+
+    layout->header_size = header_size;
+    layout->mcus_x = (layout->width + layout->mcu_width - 1) / layout->mcu_width;
+    layout->mcus_y = (layout->height + layout->mcu_height - 1) / layout->mcu_height;
+    *scan_start = position;
+
+    return S_OK;
+}
+
+// Finds restart markers in the scan and where the rows of MCUs they start are. Returns false if the
+// scan is not followed by EOI, or there are not as many markers as restart intervals.
+static bool find_row_starts(const BYTE* data, size_t size, size_t scan_start, Jpeg_Layout* layout)
+{
+    layout->row_starts = (size_t*)g_standard_allocator->allocate(sizeof(size_t) * (layout->mcus_y + 1));
+    if (layout->row_starts == nullptr)
+        return false;
+
+    memset(layout->row_starts, 0, sizeof(size_t) * (layout->mcus_y + 1));
+    layout->row_starts[0] = scan_start;
+
+    const UINT64 mcu_count = static_cast<UINT64>(layout->mcus_x) * layout->mcus_y;
+    const UINT64 interval_count = (mcu_count + layout->restart_interval - 1) / layout->restart_interval;
+    UINT64 restart_count = 0;
+
+    const BYTE* end = data + size;
+    const BYTE* p = data + scan_start;
+    for (;;)
+    {
+        p = (const BYTE*)memchr(p, 0xFF, end - p);
+        if (p == nullptr || p + 1 >= end)
+            return false;
+
+        const BYTE marker = p[1];
+        if (marker == 0x00)
+        {
+            // Stuffed zero after 0xFF data byte.
+            p += 2;
+        }
+        else if (marker == 0xFF)
+        {
+            // Fill byte before a marker.
+            p += 1;
+        }
+        else if (marker >= marker_rst0 && marker <= marker_rst7)
+        {
+            ++restart_count;
+            const UINT64 mcu = restart_count * layout->restart_interval;
+            if (mcu % layout->mcus_x == 0 && mcu / layout->mcus_x < static_cast<UINT64>(layout->mcus_y))
+                layout->row_starts[mcu / layout->mcus_x] = (p + 2) - data;
+            p += 2;
+        }
+        else
+        {
+            // Anything else ends the scan. Another scan or DNL would need more than cutting the data.
+            if (marker != marker_eoi)
+                return false;
+
+            layout->scan_end = p - data;
+            break;
+        }
+    }
+
+    // Some encoders put a marker after the last interval too.
+    return restart_count + 1 == interval_count || restart_count == interval_count;
+}
+
+// Builds JPEG of rows of MCUs [first_row, end_row) to 'stream'. Returns its size, or 0 if there's not enough memory.
+static size_t build_band_stream(const BYTE* data, const Jpeg_Layout& layout, int first_row, int end_row, BYTE** stream)
+{
+    const size_t data_begin = layout.row_starts[first_row];
+    // Restart marker in front of the next row is left out, there's EOI instead.
+    const size_t data_end = end_row < layout.mcus_y ? layout.row_starts[end_row] - 2 : layout.scan_end;
+    const size_t size = layout.header_size + (data_end - data_begin) + 2;
+
+    BYTE* out = (BYTE*)g_standard_allocator->allocate(size);
+    if (out == nullptr)
+        return 0;
+
+    const int height = min(end_row * layout.mcu_height, layout.height) - first_row * layout.mcu_height;
+    memcpy(out, layout.header, layout.header_size);
+    out[layout.sof_height_offset] = static_cast<BYTE>(height >> 8);
+    out[layout.sof_height_offset + 1] = static_cast<BYTE>(height);
+
+    BYTE* scan = out + layout.header_size;
+    BYTE* scan_end = scan + (data_end - data_begin);
+    memcpy(scan, data + data_begin, data_end - data_begin);
+    scan_end[0] = 0xFF;
+    scan_end[1] = marker_eoi;
+
+    // Decoders expect restart markers to count from RST0 again.
+    int restart = 0;
+    for (BYTE* p = scan; p + 1 < scan_end; )
+    {
+        p = (BYTE*)memchr(p, 0xFF, scan_end - p);
+        if (p == nullptr || p + 1 >= scan_end)
+            break;
+
+        if (p[1] >= marker_rst0 && p[1] <= marker_rst7)
+        {
+            p[1] = static_cast<BYTE>(marker_rst0 + (restart++ & 7));
+            p += 2;
+        }
+        else
+        {
+            p += p[1] == 0x00 ? 2 : 1;
+        }
+    }
+
+    *stream = out;
+    return size;
+}
+
+static HRESULT decode_band(const Band_Job& job, int band)
+{
+    const Jpeg_Layout& layout = *job.layout;
+    const int own_first = job.split_rows[band];
+    const int own_end = job.split_rows[band + 1];
+    const int first_row = band > 0 ? own_first - job.restart_rows : own_first;
+    const int end_row = own_end < layout.mcus_y ? min(own_end + job.restart_rows, layout.mcus_y) : own_end;
+
+    BYTE* stream_data = nullptr;
+    const size_t stream_size = build_band_stream(job.data, layout, first_row, end_row, &stream_data);
+    if (stream_size == 0)
+        return E_OUTOFMEMORY;
+    defer(g_standard_allocator->deallocate(stream_data));
+
+    HRESULT hr;
+    IWICStream* stream = nullptr;
+    hr = job.wic->CreateStream(&stream);
+    if (FAILED(hr))
+        return hr;
+    defer(stream->Release());
+
+    hr = stream->InitializeFromMemory(stream_data, static_cast<DWORD>(stream_size));
+    if (FAILED(hr))
+        return hr;
+
+    IWICBitmapDecoder* decoder = nullptr;
+    hr = job.wic->CreateDecoder(GUID_ContainerFormatJpeg, nullptr, &decoder);
+    if (FAILED(hr))
+        return hr;
+    defer(decoder->Release());
+
+    hr = decoder->Initialize(stream, WICDecodeMetadataCacheOnDemand);
+    if (FAILED(hr))
+        return hr;
+
+    IWICBitmapFrameDecode* frame = nullptr;
+    hr = decoder->GetFrame(0, &frame);
+    if (FAILED(hr))
+        return hr;
+    defer(frame->Release());
+
+    const int top = first_row * layout.mcu_height;
+    const int own_top = own_first * layout.mcu_height;
+    const int own_bottom = min(own_end * layout.mcu_height, layout.height);
+    const WICRect rect = { 0, own_top - top, layout.width, own_bottom - own_top };
+
+    return Pixel_Conversion::copy_pixels(job.wic, frame, rect, job.image->pixels + static_cast<size_t>(own_top) * job.image->stride,
+        job.image->stride, job.upsampling);
+}
+
+static void decode_band_job(void* context, int band)
+{
+    Band_Job* job = (Band_Job*)context;
+    if (job->result != S_OK)
+        return;
+
+    HRESULT hr = decode_band(*job, band);
+    if (FAILED(hr))
+        InterlockedCompareExchange(&job->result, hr, S_OK);
+}
+
+HRESULT Jpeg_Restart_Decoder::decode(IWICImagingFactory* wic, const String& path, const Image_Buffer& image, Chroma_Upsampling upsampling,
+    Job_Pool* pool)
+{
+    E_VERIFY_NULL_R(wic, E_INVALIDARG);
+    E_VERIFY_R(!image.is_empty(), E_INVALIDARG);
+
+    const int thread_count = pool != nullptr ? pool->get_thread_count() + 1 : 1;
+    if (thread_count < 2 || static_cast<UINT64>(image.width) * image.height < min_pixels)
+        return S_FALSE;
+
+    Mapped_File file;
+    HRESULT hr = file.open(path);
+    if (FAILED(hr))
+        return hr;
+    defer(file.close());
+
+    if (file.mapping == 0)
+        return S_FALSE;
+
+    const char* view = nullptr;
+    hr = file.map_view(0, static_cast<size_t>(file.size), &view);
+    if (FAILED(hr))
+        return hr;
+    defer(file.unmap_view(view));
+
+    const BYTE* data = reinterpret_cast<const BYTE*>(view);
+    const size_t size = static_cast<size_t>(file.size);
+
+    Jpeg_Layout layout = {};
+    defer(g_standard_allocator->deallocate(layout.header));
+    defer(g_standard_allocator->deallocate(layout.row_starts));
+
+    size_t scan_start = 0;
+    hr = parse_header(data, size, &layout, &scan_start);
+    if (hr != S_OK)
+        return hr;
+
+    if (layout.width != image.width || layout.height != image.height)
+        return S_FALSE;
+
+    if (!find_row_starts(data, size, scan_start, &layout))
+        return layout.row_starts == nullptr ? E_OUTOFMEMORY : S_FALSE;
+
+    Band_Job job;
+    job.wic = wic;
+    job.data = data;
+    job.layout = &layout;
+    job.image = &image;
+    job.upsampling = upsampling;
+    job.result = S_OK;
+
+    // Rows of MCUs start with a restart interval every 'restart_rows' rows, bands are cut only there.
+    job.restart_rows = layout.restart_interval / greatest_common_divisor(layout.restart_interval, layout.mcus_x);
+
+    const int target_count = min(min(thread_count * bands_per_thread, max_bands), layout.mcus_y / job.restart_rows);
+    int band_count = 0;
+    job.split_rows[0] = 0;
+    for (int i = 1; i < target_count; ++i)
+    {
+        const int row = layout.mcus_y * i / target_count / job.restart_rows * job.restart_rows;
+        if (row > job.split_rows[band_count] && row < layout.mcus_y)
+            job.split_rows[++band_count] = row;
+    }
+    job.split_rows[++band_count] = layout.mcus_y;
+
+    if (band_count < 2)
+        return S_FALSE;
+
+    pool->parallel_for(band_count, decode_band_job, &job);
+
+    return job.result;
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include <Windows.h>
+#include <wincodec.h>
+
+#include "image_buffer.hpp"
+#include "job_pool.hpp"
+#include "string.hpp"
+#include "ycbcr_conversion.hpp"
+
+// Decodes baseline JPEGs with restart markers on all threads of the job pool. The entropy coded data
+// is split at restart markers that start a row of MCUs, every band of rows is copied behind the
+// headers of the file as a JPEG of its own and decoded by a separate WIC decoder straight into the
+// image through Pixel_Conversion. Bands are decoded with one restart step of rows around them, so
+// chroma upsampling at their edges sees the same rows as when the image is decoded whole.
+struct Jpeg_Restart_Decoder
+{
+    // Smaller images are decoded serially, setting up the bands costs more than it saves.
+    static const UINT64 min_pixels = 4 * 1024 * 1024;
+    // More bands than threads even out bands that decode slower.
+    static const int bands_per_thread = 2;
+    static const int max_bands = 2 * Job_Pool::max_threads + 2;
+
+    // Decodes JPEG file at 'path' to 'image', which must be allocated to the size of the image. Returns
+    // S_FALSE if the file has no restart markers at row starts, is progressive, or can't be split for
+    // another reason, it should be decoded serially then.
+    static HRESULT decode(IWICImagingFactory* wic, const String& path, const Image_Buffer& image, Chroma_Upsampling upsampling,
+        Job_Pool* pool = g_job_pool);
+};
@@ -0,0 +1,1140 @@
+#include <Windows.h>
+#include <wincodec.h>
+#include <limits.h>
+#include <string.h>
+
+#include "jpeg_transform.hpp"
+#include "exif_reader.hpp"
+#include "file_system_utility.hpp"
+#include "string_builder.hpp"
+#include "allocator.hpp"
+#include "defer.hpp"
+#include "error.hpp"
+
+static const BYTE marker_sof0 = 0xC0;
+static const BYTE marker_sof1 = 0xC1;
+static const BYTE marker_dht = 0xC4;
+static const BYTE marker_rst0 = 0xD0;
+static const BYTE marker_rst7 = 0xD7;
+static const BYTE marker_soi = 0xD8;
+static const BYTE marker_eoi = 0xD9;
+static const BYTE marker_sos = 0xDA;
+static const BYTE marker_dqt = 0xDB;
+static const BYTE marker_dri = 0xDD;
+static const BYTE marker_app0 = 0xE0;
+static const BYTE marker_app1 = 0xE1;
+static const BYTE marker_app2 = 0xE2;
+static const BYTE marker_app15 = 0xEF;
+static const BYTE marker_com = 0xFE;
+
+static const BYTE mpf_signature[] = { 'M', 'P', 'F', 0 };
+
+// Segments copied to the new file, files with more are not transformed.
+static const int max_kept_segments = 64;
+static const int max_components = 4;
+// Blocks of all components in an MCU, limit of the JPEG specification.
+static const int max_mcu_blocks = 10;
+// Huffman codes are at most 16 bits, code lengths of optimal tables are limited to that.
+static const int max_code_length = 16;
+static const int lookup_bits = 9;
+
+// Position of coefficients in zigzag order, in natural order (row by row of the 8x8 block).
+static const BYTE zigzag_to_natural[64] = {
+     0,  1,  8, 16,  9,  2,  3, 10,
+    17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34,
+    27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36,
+    29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46,
+    53, 60, 61, 54, 47, 55, 62, 63,
+};
+
+
+struct Huffman_Decode_Table
+{
+    bool is_defined;
+    // Largest code of every length, -1 if there are none, and what's added to a code of that length
+    // to get index of its value.
+    INT32 max_codes[max_code_length + 2];
+    INT32 value_offsets[max_code_length + 1];
+    BYTE values[256];
+    // Codes up to 'lookup_bits' long by their first bits: length in the high byte and value in the low
+    // one, 0 for longer codes.
+    UINT16 lookup[1 << lookup_bits];
+};
+
+struct Huffman_Encode_Table
+{
+    UINT16 codes[256];
+    BYTE lengths[256];
+    // Table as it's written to DHT, count of codes of every length and values in order of their codes.
+    BYTE counts[max_code_length + 1];
+    BYTE values[256];
+    int value_count;
+};
+
+struct Component
+{
+    int id;
+    int h;
+    int v;
+    int quantization_table;
+    int dc_table;
+    int ac_table;
+    // Blocks of the decoded component, including padding to whole MCUs.
+    int blocks_x;
+    int blocks_y;
+    // 64 coefficients of every block in natural order.
+    INT16* coefficients;
+};
+
+struct Jpeg_Frame
+{
+    BYTE sof_marker;
+    int width;
+    int height;
+    int component_count;
+    Component components[max_components];
+    int max_h;
+    int max_v;
+    int mcus_x;
+    int mcus_y;
+    int restart_interval;
+    Huffman_Decode_Table dc_tables[4];
+    Huffman_Decode_Table ac_tables[4];
+    // APPn, COM and DQT segments copied to the new file, from their marker on.
+    size_t kept_offsets[max_kept_segments];
+    size_t kept_sizes[max_kept_segments];
+    int kept_count;
+    size_t scan_start;
+};
+
+// Where a block of the new image comes from and how its coefficients are changed.
+struct Block_Transform
+{
+    bool transpose;
+    bool mirror_x;
+    bool mirror_y;
+    // Blocks of every component in the trimmed source along mirrored axes.
+    int source_blocks_x[max_components];
+    int source_blocks_y[max_components];
+    // Sampling factors, MCUs and size of the new image.
+    int h[max_components];
+    int v[max_components];
+    int mcus_x;
+    int mcus_y;
+    int width;
+    int height;
+    // MCUs between restart markers of the new scan.
+    int restart_interval;
+};
+
+
+static inline int read_u16(const BYTE* data)
+{
+    return data[0] << 8 | data[1];
+}
+
+// Reads entropy coded data. Stuffed zero bytes are skipped, at a marker it stops and feeds zero bits.
+struct Bit_Reader
+{
+    const BYTE* data;
+    size_t size;
+    size_t position;
+    UINT64 buffer;
+    int bit_count;
+
+    void initialize(const BYTE* scan_data, size_t scan_size)
+    {
+        data = scan_data;
+        size = scan_size;
+        position = 0;
+        buffer = 0;
+        bit_count = 0;
+    }
+
+    void fill()
+    {
+        while (bit_count <= 56)
+        {
+            BYTE next = 0;
+            if (position < size && data[position] != 0xFF)
+            {
+                next = data[position++];
+            }
+            else if (position + 1 < size && data[position] == 0xFF && data[position + 1] == 0x00)
+            {
+                next = 0xFF;
+                position += 2;
+            }
+
+            buffer = buffer << 8 | next;
+            bit_count += 8;
+        }
+    }
+
+    inline UINT32 peek(int count)
+    {
+        if (bit_count < count)
+            fill();
+        return static_cast<UINT32>(buffer >> (bit_count - count)) & ((1u << count) - 1);
+    }
+
+    inline void skip(int count) { bit_count -= count; }
+
+    inline UINT32 get(int count)
+    {
+        const UINT32 bits = peek(count);
+        skip(count);
+        return bits;
+    }
+
+    // Drops bits up to the next byte and reads the restart marker at it. Returns false if there's none.
+    bool restart()
+    {
+        buffer = 0;
+        bit_count = 0;
+        while (position + 1 < size && data[position] == 0xFF && data[position + 1] == 0xFF)
+            ++position;
+        if (position + 1 >= size || data[position] != 0xFF || data[position + 1] < marker_rst0 || data[position + 1] > marker_rst7)
+            return false;
+
+        position += 2;
+        return true;
+    }
+};
+
+// Returns decoded value, or -1 if the bits are not a code of 'table'.
+static inline int decode_huffman(Bit_Reader* reader, const Huffman_Decode_Table& table)
+{
+    const UINT32 entry = table.lookup[reader->peek(lookup_bits)];
+    if (entry != 0)
+    {
+        reader->skip(entry >> 8);
+        return entry & 0xFF;
+    }
+
+    for (int length = lookup_bits + 1; length <= max_code_length; ++length)
+    {
+        const INT32 code = static_cast<INT32>(reader->peek(length));
+        if (code <= table.max_codes[length])
+        {
+            reader->skip(length);
+            return table.values[table.value_offsets[length] + code];
+        }
+    }
+
+    return -1;
+}
+
+static inline int extend(UINT32 bits, int category)
+{
+    return bits < (1u << (category - 1)) ? static_cast<int>(bits) - (1 << category) + 1 : static_cast<int>(bits);
+}
+
+// Builds table of a DHT, 'counts' has count of codes of lengths 1 to 16. Returns false if it has more
+// codes than fit the lengths.
+static bool build_decode_table(const BYTE* counts, const BYTE* values, int value_count, Huffman_Decode_Table* table)
+{
+    memset(table, 0, sizeof(*table));
+    memcpy(table->values, values, value_count);
+
+    int code = 0;
+    int index = 0;
+    for (int length = 1; length <= max_code_length; ++length)
+    {
+        table->value_offsets[length] = index - code;
+        for (int i = 0; i < counts[length - 1]; ++i)
+        {
+            if (length <= lookup_bits)
+            {
+                const int shift = lookup_bits - length;
+                for (int fill = 0; fill < (1 << shift); ++fill)
+                    table->lookup[(code << shift) + fill] = static_cast<UINT16>(length << 8 | values[index]);
+            }
+
+            ++code;
+            ++index;
+        }
+
+        if (code > (1 << length))
+            return false;
+
+        table->max_codes[length] = counts[length - 1] != 0 ? code - 1 : -1;
+        code <<= 1;
+    }
+
+    table->max_codes[max_code_length + 1] = INT_MAX;
+    table->is_defined = true;
+    return true;
+}
+
+static HRESULT parse_dht(const BYTE* payload, size_t size, Jpeg_Frame* frame)
+{
+    size_t position = 0;
+    while (position < size)
+    {
+        if (size - position < 17)
+            return WINCODEC_ERR_BADHEADER;
+
+        const int table_class = payload[position] >> 4;
+        const int id = payload[position] & 0x0F;
+        const BYTE* counts = payload + position + 1;
+        int value_count = 0;
+        for (int i = 0; i < max_code_length; ++i)
+            value_count += counts[i];
+
+        if (table_class > 1 || id > 3 || value_count > 256 || size - position - 17 < static_cast<size_t>(value_count))
+            return WINCODEC_ERR_BADHEADER;
+
+        Huffman_Decode_Table* table = table_class == 0 ? &frame->dc_tables[id] : &frame->ac_tables[id];
+        if (!build_decode_table(counts, payload + position + 17, value_count, table))
+            return WINCODEC_ERR_BADHEADER;
+
+        position += 17 + value_count;
+    }
+
+    return S_OK;
+}
+
+static HRESULT parse_sof(BYTE marker, const BYTE* payload, size_t size, Jpeg_Frame* frame)
+{
+    if (frame->component_count != 0 || size < 6)
+        return WINCODEC_ERR_BADHEADER;
+
+    frame->sof_marker = marker;
+    frame->height = read_u16(payload + 1);
+    frame->width = read_u16(payload + 3);
+    frame->component_count = payload[5];
+    if (payload[0] != 8 || frame->height == 0 || frame->width == 0)
+        return WINCODEC_ERR_UNSUPPORTEDOPERATION;
+    if (frame->component_count == 0 || frame->component_count > max_components || size < 6 + 3 * static_cast<size_t>(frame->component_count))
+        return WINCODEC_ERR_BADHEADER;
+
+    frame->max_h = 1;
+    frame->max_v = 1;
+    for (int i = 0; i < frame->component_count; ++i)
+    {
+        Component& component = frame->components[i];
+        component.id = payload[6 + 3 * i];
+        component.h = payload[6 + 3 * i + 1] >> 4;
+        component.v = payload[6 + 3 * i + 1] & 0x0F;
+        component.quantization_table = payload[6 + 3 * i + 2];
+        if (component.h < 1 || component.h > 4 || component.v < 1 || component.v > 4)
+            return WINCODEC_ERR_BADHEADER;
+
+        frame->max_h = max(frame->max_h, component.h);
+        frame->max_v = max(frame->max_v, component.v);
+    }
+
+    // Scan of a single component has MCUs of one block, whatever its sampling factors are.
+    if (frame->component_count == 1)
+    {
+        frame->components[0].h = 1;
+        frame->components[0].v = 1;
+        frame->max_h = 1;
+        frame->max_v = 1;
+    }
+
+    frame->mcus_x = (frame->width + 8 * frame->max_h - 1) / (8 * frame->max_h);
+    frame->mcus_y = (frame->height + 8 * frame->max_v - 1) / (8 * frame->max_v);
+
+    int mcu_blocks = 0;
+    for (int i = 0; i < frame->component_count; ++i)
+    {
+        Component& component = frame->components[i];
+        component.blocks_x = frame->mcus_x * component.h;
+        component.blocks_y = frame->mcus_y * component.v;
+        mcu_blocks += component.h * component.v;
+    }
+
+    return mcu_blocks <= max_mcu_blocks ? S_OK : WINCODEC_ERR_BADHEADER;
+}
+
+// Only a scan of all components is supported, files with a scan per component are rare outside of
+// progressive ones.
+static HRESULT parse_sos(const BYTE* payload, size_t size, Jpeg_Frame* frame)
+{
+    if (frame->component_count == 0 || size < 1)
+        return WINCODEC_ERR_BADHEADER;
+
+    const int count = payload[0];
+    if (count != frame->component_count)
+        return WINCODEC_ERR_UNSUPPORTEDOPERATION;
+    if (size < 4 + 2 * static_cast<size_t>(count))
+        return WINCODEC_ERR_BADHEADER;
+
+    for (int i = 0; i < count; ++i)
+    {
+        Component& component = frame->components[i];
+        if (payload[1 + 2 * i] != component.id)
+            return WINCODEC_ERR_UNSUPPORTEDOPERATION;
+
+        component.dc_table = payload[2 + 2 * i] >> 4;
+        component.ac_table = payload[2 + 2 * i] & 0x0F;
+        if (component.dc_table > 3 || component.ac_table > 3 || !frame->dc_tables[component.dc_table].is_defined ||
+            !frame->ac_tables[component.ac_table].is_defined)
+        {
+            return WINCODEC_ERR_BADHEADER;
+        }
+    }
+
+    // Spectral selection and successive approximation of a sequential scan.
+    const BYTE* selection = payload + 1 + 2 * count;
+    if (selection[0] != 0 || selection[1] != 63 || selection[2] != 0)
+        return WINCODEC_ERR_UNSUPPORTEDOPERATION;
+
+    return S_OK;
+}
+
+static HRESULT parse_header(const BYTE* data, size_t size, Jpeg_Frame* frame)
+{
+    if (size < 4 || data[0] != 0xFF || data[1] != marker_soi)
+        return WINCODEC_ERR_BADHEADER;
+
+    size_t position = 2;
+    for (;;)
+    {
+        // Markers can be preceded by any number of fill bytes.
+        if (position >= size || data[position] != 0xFF)
+            return WINCODEC_ERR_BADHEADER;
+        while (position < size && data[position] == 0xFF)
+            ++position;
+        if (position + 3 > size)
+            return WINCODEC_ERR_BADHEADER;
+
+        const size_t segment_start = position - 1;
+        const BYTE marker = data[position];
+        const size_t length = static_cast<size_t>(read_u16(data + position + 1));
+        if (length < 2 || position + 1 + length > size)
+            return WINCODEC_ERR_BADHEADER;
+
+        const BYTE* payload = data + position + 3;
+        const size_t payload_size = length - 2;
+        position += 1 + length;
+
+        HRESULT hr = S_OK;
+        if (marker == marker_sof0 || marker == marker_sof1)
+        {
+            hr = parse_sof(marker, payload, payload_size, frame);
+        }
+        else if (marker >= 0xC2 && marker <= 0xCF && marker != marker_dht && marker != 0xC8 && marker != 0xCC)
+        {
+            // Progressive, lossless, hierarchical and arithmetic coded frames.
+            return WINCODEC_ERR_UNSUPPORTEDOPERATION;
+        }
+        else if (marker == 0xCC)
+        {
+            // Arithmetic coding conditioning.
+            return WINCODEC_ERR_UNSUPPORTEDOPERATION;
+        }
+        else if (marker == marker_dht)
+        {
+            hr = parse_dht(payload, payload_size, frame);
+        }
+        else if (marker == marker_dri)
+        {
+            if (payload_size < 2)
+                return WINCODEC_ERR_BADHEADER;
+            frame->restart_interval = read_u16(payload);
+        }
+        else if (marker == marker_sos)
+        {
+            hr = parse_sos(payload, payload_size, frame);
+            frame->scan_start = position;
+            return hr;
+        }
+        else if (marker == marker_dqt || marker == marker_com || (marker >= marker_app0 && marker <= marker_app15))
+        {
+            // MPF points at previews after the image by offsets, they'd be wrong in the new file.
+            const bool is_mpf = marker == marker_app2 && payload_size >= sizeof(mpf_signature) &&
+                memcmp(payload, mpf_signature, sizeof(mpf_signature)) == 0;
+            if (!is_mpf)
+            {
+                if (frame->kept_count == max_kept_segments)
+                    return WINCODEC_ERR_UNSUPPORTEDOPERATION;
+
+                frame->kept_offsets[frame->kept_count] = segment_start;
+                frame->kept_sizes[frame->kept_count] = position - segment_start;
+                ++frame->kept_count;
+            }
+        }
+        else if (marker == marker_soi || marker == marker_eoi || (marker >= marker_rst0 && marker <= marker_rst7))
+        {
+            return WINCODEC_ERR_BADHEADER;
+        }
+
+        if (FAILED(hr))
+            return hr;
+    }
+}
+
+static inline INT16* block_at(const Component& component, int x, int y)
+{
+    return component.coefficients + (static_cast<size_t>(y) * component.blocks_x + x) * 64;
+}
+
+static HRESULT decode_scan(const BYTE* data, size_t size, Jpeg_Frame* frame)
+{
+    Bit_Reader reader;
+    reader.initialize(data + frame->scan_start, size - frame->scan_start);
+
+    int predictions[max_components] = {};
+    int restarts_left = frame->restart_interval;
+
+    for (int mcu_y = 0; mcu_y < frame->mcus_y; ++mcu_y)
+    {
+        for (int mcu_x = 0; mcu_x < frame->mcus_x; ++mcu_x)
+        {
+            if (frame->restart_interval != 0)
+            {
+                if (restarts_left == 0)
+                {
+                    if (!reader.restart())
+                        return WINCODEC_ERR_BADIMAGE;
+
+                    memset(predictions, 0, sizeof(predictions));
+                    restarts_left = frame->restart_interval;
+                }
+
+                --restarts_left;
+            }
+
+            for (int c = 0; c < frame->component_count; ++c)
+            {
+                const Component& component = frame->components[c];
+                const Huffman_Decode_Table& dc_table = frame->dc_tables[component.dc_table];
+                const Huffman_Decode_Table& ac_table = frame->ac_tables[component.ac_table];
+
+                for (int v = 0; v < component.v; ++v)
+                {
+                    for (int h = 0; h < component.h; ++h)
+                    {
+                        INT16* block = block_at(component, mcu_x * component.h + h, mcu_y * component.v + v);
+
+                        const int category = decode_huffman(&reader, dc_table);
+                        if (category < 0 || category > 16)
+                            return WINCODEC_ERR_BADIMAGE;
+                        if (category != 0)
+                            predictions[c] += extend(reader.get(category), category);
+                        block[0] = static_cast<INT16>(predictions[c]);
+
+                        for (int k = 1; k < 64;)
+                        {
+                            const int symbol = decode_huffman(&reader, ac_table);
+                            if (symbol < 0)
+                                return WINCODEC_ERR_BADIMAGE;
+
+                            const int run = symbol >> 4;
+                            const int size_bits = symbol & 0x0F;
+                            if (size_bits == 0)
+                            {
+                                // End of block, or a run of 16 zeros.
+                                if (run != 15)
+                                    break;
+                                k += 16;
+                                continue;
+                            }
+
+                            k += run;
+                            if (k > 63)
+                                return WINCODEC_ERR_BADIMAGE;
+                            block[zigzag_to_natural[k]] = static_cast<INT16>(extend(reader.get(size_bits), size_bits));
+                            ++k;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    return S_OK;
+}
+
+// Generates code lengths of an optimal Huffman table for symbol 'frequencies' limited to 16 bits, the
+// procedure of section K.2 of the JPEG specification. One code point is reserved, so no code is all ones.
+// Returns false if the optimal table has a code longer than 32 bits, which isn't shortened then.
+static bool build_encode_table(const UINT32* symbol_frequencies, Huffman_Encode_Table* table)
+{
+    INT64 frequencies[257];
+    int code_sizes[257];
+    int others[257];
+    for (int i = 0; i < 256; ++i)
+        frequencies[i] = symbol_frequencies[i];
+    frequencies[256] = 1;
+    memset(code_sizes, 0, sizeof(code_sizes));
+    for (int i = 0; i < 257; ++i)
+        others[i] = -1;
+
+    for (;;)
+    {
+        // Two least frequent symbols, ties go to the larger value.
+        int c1 = -1;
+        int c2 = -1;
+        for (int i = 0; i < 257; ++i)
+        {
+            if (frequencies[i] != 0 && (c1 < 0 || frequencies[i] <= frequencies[c1]))
+                c1 = i;
+        }
+        for (int i = 0; i < 257; ++i)
+        {
+            if (frequencies[i] != 0 && i != c1 && (c2 < 0 || frequencies[i] <= frequencies[c2]))
+                c2 = i;
+        }
+        if (c2 < 0)
+            break;
+
+        frequencies[c1] += frequencies[c2];
+        frequencies[c2] = 0;
+
+        ++code_sizes[c1];
+        while (others[c1] >= 0)
+        {
+            c1 = others[c1];
+            ++code_sizes[c1];
+        }
+        others[c1] = c2;
+
+        ++code_sizes[c2];
+        while (others[c2] >= 0)
+        {
+            c2 = others[c2];
+            ++code_sizes[c2];
+        }
+    }
+
+    int counts[33] = {};
+    for (int i = 0; i < 257; ++i)
+    {
+        if (code_sizes[i] > 32)
+            return false;
+        if (code_sizes[i] != 0)
+            ++counts[code_sizes[i]];
+    }
+
+    // Codes longer than 16 bits are shortened by taking a prefix from a shorter one.
+    for (int length = 32; length > max_code_length; --length)
+    {
+        while (counts[length] > 0)
+        {
+            int j = length - 2;
+            while (counts[j] == 0)
+                --j;
+
+            counts[length] -= 2;
+            counts[length - 1] += 1;
+            counts[j + 1] += 2;
+            counts[j] -= 1;
+        }
+    }
+
+    // Reserved code point is the longest code.
+    int longest = max_code_length;
+    while (longest > 0 && counts[longest] == 0)
+        --longest;
+    if (longest > 0)
+        --counts[longest];
+
+    table->value_count = 0;
+    for (int length = 1; length <= 32; ++length)
+    {
+        for (int symbol = 0; symbol < 256; ++symbol)
+        {
+            if (code_sizes[symbol] == length)
+                table->values[table->value_count++] = static_cast<BYTE>(symbol);
+        }
+    }
+
+    memset(table->lengths, 0, sizeof(table->lengths));
+    table->counts[0] = 0;
+    int code = 0;
+    int index = 0;
+    for (int length = 1; length <= max_code_length; ++length)
+    {
+        table->counts[length] = static_cast<BYTE>(counts[length]);
+        for (int i = 0; i < counts[length]; ++i)
+        {
+            const BYTE symbol = table->values[index++];
+            table->codes[symbol] = static_cast<UINT16>(code++);
+            table->lengths[symbol] = static_cast<BYTE>(length);
+        }
+
+        code <<= 1;
+    }
+
+    return true;
+}
+
+// Growing buffer of the new file.
+struct Jpeg_Writer
+{
+    BYTE* data;
+    size_t size;
+    size_t capacity;
+    bool has_failed;
+    // Bits not written yet, 'bit_count' of them at the bottom.
+    UINT64 bits;
+    int bit_count;
+
+    bool reserve(size_t count)
+    {
+        if (size + count <= capacity)
+            return true;
+        if (has_failed)
+            return false;
+
+        const size_t new_capacity = max(capacity * 2, size + count);
+        BYTE* new_data = (BYTE*)g_standard_allocator->reallocate(data, new_capacity);
+        if (new_data == nullptr)
+        {
+            has_failed = true;
+            return false;
+        }
+
+        data = new_data;
+        capacity = new_capacity;
+        return true;
+    }
+
+    void write(const void* bytes, size_t count)
+    {
+        if (reserve(count))
+        {
+            memcpy(data + size, bytes, count);
+            size += count;
+        }
+    }
+
+    void write_byte(BYTE value) { write(&value, 1); }
+
+    void write_u16(int value)
+    {
+        write_byte(static_cast<BYTE>(value >> 8));
+        write_byte(static_cast<BYTE>(value));
+    }
+
+    void write_marker(BYTE marker, int payload_size)
+    {
+        write_byte(0xFF);
+        write_byte(marker);
+        write_u16(payload_size + 2);
+    }
+
+    // Entropy coded bits, 0xFF is followed by a stuffed zero byte.
+    inline void put_bits(UINT32 value, int count)
+    {
+        bits = bits << count | (value & ((1u << count) - 1));
+        bit_count += count;
+        while (bit_count >= 8)
+        {
+            bit_count -= 8;
+            const BYTE byte = static_cast<BYTE>(bits >> bit_count);
+            write_byte(byte);
+            if (byte == 0xFF)
+                write_byte(0);
+        }
+    }
+
+    // Pads the last byte with ones.
+    void flush_bits()
+    {
+        if (bit_count > 0)
+            put_bits(0x7F, 8 - bit_count);
+        bits = 0;
+        bit_count = 0;
+    }
+};
+
+// Coefficients of the new image's block at 'x', 'y' of component 'c', from the source block it comes from.
+static void transform_block(const Jpeg_Frame& frame, const Block_Transform& transform, int c, int x, int y, INT16* block)
+{
+    const Component& component = frame.components[c];
+    const int source_x = transform.transpose ? y : x;
+    const int source_y = transform.transpose ? x : y;
+    const INT16* source = block_at(component,
+        transform.mirror_x ? transform.source_blocks_x[c] - 1 - source_x : source_x,
+        transform.mirror_y ? transform.source_blocks_y[c] - 1 - source_y : source_y);
+
+    // Mirroring a block flips signs of its odd horizontal or vertical frequencies.
+    for (int v = 0; v < 8; ++v)
+    {
+        for (int u = 0; u < 8; ++u)
+        {
+            const bool negate = (transform.mirror_x && (u & 1) != 0) != (transform.mirror_y && (v & 1) != 0);
+            const INT16 value = source[v * 8 + u];
+            block[transform.transpose ? u * 8 + v : v * 8 + u] = negate ? static_cast<INT16>(-value) : value;
+        }
+    }
+}
+
+static inline int magnitude_category(int value)
+{
+    unsigned int magnitude = static_cast<unsigned int>(value < 0 ? -value : value);
+    int category = 0;
+    while (magnitude != 0)
+    {
+        ++category;
+        magnitude >>= 1;
+    }
+
+    return category;
+}
+
+// Counts symbols of 'block' when 'writer' is null, writes them otherwise.
+static void encode_block(const INT16* block, int* prediction, const Huffman_Encode_Table* dc_table, const Huffman_Encode_Table* ac_table,
+    UINT32* dc_frequencies, UINT32* ac_frequencies, Jpeg_Writer* writer)
+{
+    const int difference = block[0] - *prediction;
+    *prediction = block[0];
+
+    const int dc_category = magnitude_category(difference);
+    if (writer == nullptr)
+    {
+        ++dc_frequencies[dc_category];
+    }
+    else
+    {
+        writer->put_bits(dc_table->codes[dc_category], dc_table->lengths[dc_category]);
+        if (dc_category != 0)
+            writer->put_bits(static_cast<UINT32>(difference < 0 ? difference - 1 : difference), dc_category);
+    }
+
+    int run = 0;
+    for (int k = 1; k < 64; ++k)
+    {
+        const int value = block[zigzag_to_natural[k]];
+        if (value == 0)
+        {
+            ++run;
+            continue;
+        }
+
+        for (; run > 15; run -= 16)
+        {
+            if (writer == nullptr)
+                ++ac_frequencies[0xF0];
+            else
+                writer->put_bits(ac_table->codes[0xF0], ac_table->lengths[0xF0]);
+        }
+
+        const int category = magnitude_category(value);
+        const int symbol = run << 4 | min(category, 15);
+        if (writer == nullptr)
+        {
+            ++ac_frequencies[symbol];
+        }
+        else
+        {
+            writer->put_bits(ac_table->codes[symbol], ac_table->lengths[symbol]);
+            writer->put_bits(static_cast<UINT32>(value < 0 ? value - 1 : value), min(category, 15));
+        }
+
+        run = 0;
+    }
+
+    // End of block.
+    if (run > 0)
+    {
+        if (writer == nullptr)
+            ++ac_frequencies[0x00];
+        else
+            writer->put_bits(ac_table->codes[0x00], ac_table->lengths[0x00]);
+    }
+}
+
+// Goes through blocks of the new image in MCU order, with a restart marker every 'restart_interval' MCUs.
+// Counts symbols of luma (table 0) and chroma (table 1) when 'writer' is null, writes them otherwise.
+static void encode_scan(const Jpeg_Frame& frame, const Block_Transform& transform, const Huffman_Encode_Table* dc_tables,
+    const Huffman_Encode_Table* ac_tables, UINT32 (*dc_frequencies)[256], UINT32 (*ac_frequencies)[256], Jpeg_Writer* writer)
+{
+    INT16 block[64];
+    int predictions[max_components] = {};
+    int mcu_index = 0;
+    for (int mcu_y = 0; mcu_y < transform.mcus_y; ++mcu_y)
+    {
+        for (int mcu_x = 0; mcu_x < transform.mcus_x; ++mcu_x, ++mcu_index)
+        {
+            if (mcu_index > 0 && mcu_index % transform.restart_interval == 0)
+            {
+                if (writer != nullptr)
+                {
+                    writer->flush_bits();
+                    writer->write_byte(0xFF);
+                    writer->write_byte(static_cast<BYTE>(marker_rst0 + (mcu_index / transform.restart_interval - 1) % 8));
+                }
+                memset(predictions, 0, sizeof(predictions));
+            }
+
+            for (int c = 0; c < frame.component_count; ++c)
+            {
+                const int table = c == 0 ? 0 : 1;
+                for (int v = 0; v < transform.v[c]; ++v)
+                {
+                    for (int h = 0; h < transform.h[c]; ++h)
+                    {
+                        transform_block(frame, transform, c, mcu_x * transform.h[c] + h, mcu_y * transform.v[c] + v, block);
+                        encode_block(block, &predictions[c], &dc_tables[table], &ac_tables[table], dc_frequencies[table],
+                            ac_frequencies[table], writer);
+                    }
+                }
+            }
+        }
+    }
+
+    if (writer != nullptr)
+        writer->flush_bits();
+}
+
+// Coefficients of transposed blocks are quantized by transposed tables. 'data' is DQT after its length.
+static void transpose_quantization_tables(BYTE* data, size_t size)
+{
+    size_t position = 0;
+    while (position < size)
+    {
+        const int value_size = (data[position] >> 4) != 0 ? 2 : 1;
+        BYTE* values = data + position + 1;
+        if (size - position - 1 < 64 * static_cast<size_t>(value_size))
+            return;
+
+        BYTE natural[64 * 2];
+        for (int k = 0; k < 64; ++k)
+        {
+            const int index = zigzag_to_natural[k];
+            memcpy(natural + (index % 8 * 8 + index / 8) * value_size, values + k * value_size, value_size);
+        }
+        for (int k = 0; k < 64; ++k)
+            memcpy(values + k * value_size, natural + zigzag_to_natural[k] * value_size, value_size);
+
+        position += 1 + 64 * value_size;
+    }
+}
+
+static void write_dht(Jpeg_Writer* writer, int table_class, int id, const Huffman_Encode_Table& table)
+{
+    writer->write_marker(marker_dht, 1 + max_code_length + table.value_count);
+    writer->write_byte(static_cast<BYTE>(table_class << 4 | id));
+    writer->write(table.counts + 1, max_code_length);
+    writer->write(table.values, table.value_count);
+}
+
+// Geometry of the new image. Mirrored axes are trimmed to whole MCUs if 'trim' is true. Returns
+// WINCODEC_ERR_IMAGESIZEOUTOFRANGE if they would be trimmed otherwise, and WINCODEC_ERR_UNSUPPORTEDOPERATION
+// if not even one MCU is left.
+static HRESULT make_block_transform(const Jpeg_Frame& frame, Orientation orientation, bool trim, Block_Transform* transform)
+{
+    const bool is_transposed = Image_Rotation::swaps_size(orientation);
+    const Orientation mirror_only = is_transposed ? Image_Rotation::combine(orientation, Orientation::Transpose) : orientation;
+    transform->transpose = is_transposed;
+    transform->mirror_x = mirror_only == Orientation::Mirror_Horizontal || mirror_only == Orientation::Rotate_180;
+    transform->mirror_y = mirror_only == Orientation::Mirror_Vertical || mirror_only == Orientation::Rotate_180;
+
+    const int mcu_width = 8 * frame.max_h;
+    const int mcu_height = 8 * frame.max_v;
+    const int width = transform->mirror_x ? frame.width / mcu_width * mcu_width : frame.width;
+    const int height = transform->mirror_y ? frame.height / mcu_height * mcu_height : frame.height;
+    if (!trim && (width != frame.width || height != frame.height))
+        return WINCODEC_ERR_IMAGESIZEOUTOFRANGE;
+    if (width == 0 || height == 0)
+        return WINCODEC_ERR_UNSUPPORTEDOPERATION;
+
+    for (int c = 0; c < frame.component_count; ++c)
+    {
+        const Component& component = frame.components[c];
+        transform->source_blocks_x[c] = width / mcu_width * component.h;
+        transform->source_blocks_y[c] = height / mcu_height * component.v;
+        transform->h[c] = is_transposed ? component.v : component.h;
+        transform->v[c] = is_transposed ? component.h : component.v;
+    }
+
+    transform->width = is_transposed ? height : width;
+    transform->height = is_transposed ? width : height;
+    const int max_h = is_transposed ? frame.max_v : frame.max_h;
+    const int max_v = is_transposed ? frame.max_h : frame.max_v;
+    transform->mcus_x = (transform->width + 8 * max_h - 1) / (8 * max_h);
+    transform->mcus_y = (transform->height + 8 * max_v - 1) / (8 * max_v);
+
+    return S_OK;
+}
+
+static HRESULT write_file(const BYTE* data, const Jpeg_Frame& frame, const Block_Transform& transform, Jpeg_Writer* writer)
+{
+    writer->write_byte(0xFF);
+    writer->write_byte(marker_soi);
+
+    for (int i = 0; i < frame.kept_count; ++i)
+    {
+        const size_t start = writer->size;
+        writer->write(data + frame.kept_offsets[i], frame.kept_sizes[i]);
+        if (writer->has_failed)
+            continue;
+
+        if (writer->data[start + 1] == marker_app1)
+            Exif_Reader::reset_orientation(writer->data + start + 4, static_cast<UINT32>(frame.kept_sizes[i] - 4));
+        else if (writer->data[start + 1] == marker_dqt && transform.transpose)
+            transpose_quantization_tables(writer->data + start + 4, frame.kept_sizes[i] - 4);
+    }
+
+    writer->write_marker(frame.sof_marker, 6 + 3 * frame.component_count);
+    writer->write_byte(8);
+    writer->write_u16(transform.height);
+    writer->write_u16(transform.width);
+    writer->write_byte(static_cast<BYTE>(frame.component_count));
+    for (int c = 0; c < frame.component_count; ++c)
+    {
+        writer->write_byte(static_cast<BYTE>(frame.components[c].id));
+        writer->write_byte(static_cast<BYTE>(transform.h[c] << 4 | transform.v[c]));
+        writer->write_byte(static_cast<BYTE>(frame.components[c].quantization_table));
+    }
+
+    // Symbols are counted first, tables made for them, and the scan coded with those.
+    UINT32 dc_frequencies[2][256] = {};
+    UINT32 ac_frequencies[2][256] = {};
+    encode_scan(frame, transform, nullptr, nullptr, dc_frequencies, ac_frequencies, nullptr);
+
+    const int table_count = frame.component_count > 1 ? 2 : 1;
+    Huffman_Encode_Table* dc_tables = (Huffman_Encode_Table*)g_standard_allocator->allocate(sizeof(Huffman_Encode_Table) * 4);
+    if (dc_tables == nullptr)
+        return E_OUTOFMEMORY;
+    defer(g_standard_allocator->deallocate(dc_tables));
+    Huffman_Encode_Table* ac_tables = dc_tables + 2;
+
+    for (int i = 0; i < table_count; ++i)
+    {
+        if (!build_encode_table(dc_frequencies[i], &dc_tables[i]) || !build_encode_table(ac_frequencies[i], &ac_tables[i]))
+            return WINCODEC_ERR_VALUEOUTOFRANGE;
+        write_dht(writer, 0, i, dc_tables[i]);
+        write_dht(writer, 1, i, ac_tables[i]);
+    }
+
+    writer->write_marker(marker_dri, 2);
+    writer->write_u16(static_cast<UINT16>(transform.restart_interval));
+
+    writer->write_marker(marker_sos, 4 + 2 * frame.component_count);
+    writer->write_byte(static_cast<BYTE>(frame.component_count));
+    for (int c = 0; c < frame.component_count; ++c)
+    {
+        const int table = c == 0 ? 0 : 1;
+        writer->write_byte(static_cast<BYTE>(frame.components[c].id));
+        writer->write_byte(static_cast<BYTE>(table << 4 | table));
+    }
+    writer->write_byte(0);
+    writer->write_byte(63);
+    writer->write_byte(0);
+
+    encode_scan(frame, transform, dc_tables, ac_tables, nullptr, nullptr, writer);
+
+    writer->write_byte(0xFF);
+    writer->write_byte(marker_eoi);
+
+    return writer->has_failed ? E_OUTOFMEMORY : S_OK;
+}
+
+HRESULT Jpeg_Transform::transform(const BYTE* data, size_t size, Orientation orientation, bool trim, BYTE** output, size_t* output_size,
+    int restart_interval)
+{
+    E_VERIFY_NULL_R(data, E_INVALIDARG);
+    E_VERIFY_NULL_R(output, E_INVALIDARG);
+    E_VERIFY_NULL_R(output_size, E_INVALIDARG);
+    E_VERIFY_R(restart_interval >= 0 && restart_interval <= 0xFFFF, E_INVALIDARG);
+
+    *output = nullptr;
+    *output_size = 0;
+
+    // Decode tables are large, the frame doesn't go on the stack.
+    Jpeg_Frame* frame = (Jpeg_Frame*)g_standard_allocator->allocate(sizeof(Jpeg_Frame));
+    if (frame == nullptr)
+        return E_OUTOFMEMORY;
+    memset(frame, 0, sizeof(*frame));
+    defer(
+        for (int c = 0; c < frame->component_count; ++c)
+            g_standard_allocator->deallocate(frame->components[c].coefficients);
+        g_standard_allocator->deallocate(frame);
+    );
+
+    HRESULT hr = parse_header(data, size, frame);
+    if (FAILED(hr))
+        return hr;
+
+    Block_Transform block_transform;
+    hr = make_block_transform(*frame, orientation, trim, &block_transform);
+    if (FAILED(hr))
+        return hr;
+    block_transform.restart_interval = restart_interval > 0 ? restart_interval : block_transform.mcus_x;
+
+    for (int c = 0; c < frame->component_count; ++c)
+    {
+        Component& component = frame->components[c];
+        const size_t coefficient_count = static_cast<size_t>(component.blocks_x) * component.blocks_y * 64;
+        component.coefficients = (INT16*)g_standard_allocator->allocate(coefficient_count * sizeof(INT16));
+        if (component.coefficients == nullptr)
+            return E_OUTOFMEMORY;
+        memset(component.coefficients, 0, coefficient_count * sizeof(INT16));
+    }
+
+    hr = decode_scan(data, size, frame);
+    if (FAILED(hr))
+        return hr;
+
+    // New file is about as large as the old one.
+    Jpeg_Writer writer = {};
+    if (!writer.reserve(size + 64 * 1024))
+        return E_OUTOFMEMORY;
+
+    hr = write_file(data, *frame, block_transform, &writer);
+    if (FAILED(hr))
+    {
+        g_standard_allocator->deallocate(writer.data);
+        return hr;
+    }
+
+    *output = writer.data;
+    *output_size = writer.size;
+    return S_OK;
+}
+
+HRESULT Jpeg_Transform::transform_file(const String& path, Orientation orientation, bool trim, int restart_interval)
+{
+    E_VERIFY_R(!String::is_null_or_empty(path), E_INVALIDARG);
+
+    void* data = nullptr;
+    UINT64 size = 0;
+    HRESULT hr = File_System_Utility::read_file_contents(path, &data, &size);
+    if (FAILED(hr))
+        return hr;
+    defer(g_standard_allocator->deallocate(data));
+
+    BYTE* output = nullptr;
+    size_t output_size = 0;
+    hr = transform((const BYTE*)data, static_cast<size_t>(size), orientation, trim, &output, &output_size, restart_interval);
+    if (FAILED(hr))
+        return hr;
+    defer(g_standard_allocator->deallocate(output));
+
+    // New file is written next to the old one, which it replaces with its attributes and creation time.
+    String_Builder temporary_path;
+    temporary_path.begin();
+    temporary_path.append_string(path);
+    temporary_path.append_string(L".tmp");
+    if (!temporary_path.end())
+        return E_OUTOFMEMORY;
+    defer(g_standard_allocator->deallocate(temporary_path.buffer));
+
+    HANDLE file = CreateFileW(temporary_path.buffer, GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return HRESULT_FROM_WIN32(GetLastError());
+
+    DWORD written = 0;
+    const BOOL is_written = output_size <= MAXDWORD && WriteFile(file, output, static_cast<DWORD>(output_size), &written, nullptr) &&
+        written == output_size;
+    hr = is_written ? S_OK : HRESULT_FROM_WIN32(GetLastError());
+    CloseHandle(file);
+
+    if (SUCCEEDED(hr) && !ReplaceFileW(path.data, temporary_path.buffer, nullptr, REPLACEFILE_IGNORE_MERGE_ERRORS, nullptr, nullptr))
+        hr = HRESULT_FROM_WIN32(GetLastError());
+
+    if (FAILED(hr))
+        DeleteFileW(temporary_path.buffer);
+
+    return hr;
+}
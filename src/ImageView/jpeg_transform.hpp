@@ -0,0 +1,28 @@
+#pragma once
+#include <Windows.h>
+
+#include "image_rotation.hpp"
+#include "string.hpp"
+
+// Turns and mirrors baseline JPEGs without decoding their pixels, so saving a rotation loses nothing.
+// Entropy coded data is decoded to DCT coefficients, every block is moved to where the orientation puts
+// it, transposed and has the signs of its odd frequencies flipped along mirrored axes, then coded again
+// with Huffman tables made for the new data. Blocks at the right and bottom edge that only partly hold
+// the image can't move to the other side, so columns or rows that don't fill a whole MCU have to be
+// dropped from a mirrored axis, like jpegtran -trim does. That's done only when it's asked for.
+//
+// Other segments are kept. EXIF and XMP orientation are set to 1, the EXIF thumbnail is unlinked and MPF
+// previews are dropped, they would show the old orientation. The new file has a restart marker every
+// 'restart_interval' MCUs, at the start of every row of MCUs by default, so Jpeg_Restart_Decoder decodes
+// it in bands.
+struct Jpeg_Transform
+{
+    // Transforms JPEG in 'data' by 'orientation' into 'output' allocated with g_standard_allocator.
+    // Returns WINCODEC_ERR_UNSUPPORTEDOPERATION for progressive, arithmetic coded and lossless files, and
+    // WINCODEC_ERR_IMAGESIZEOUTOFRANGE if edges would be dropped and 'trim' is false, before anything is decoded.
+    // 'restart_interval' is the number of MCUs between restart markers, 0 for a row of MCUs.
+    static HRESULT transform(const BYTE* data, size_t size, Orientation orientation, bool trim, BYTE** output, size_t* output_size,
+        int restart_interval = 0);
+    // Transforms JPEG file at 'path', it's replaced only once the new file is fully written.
+    static HRESULT transform_file(const String& path, Orientation orientation, bool trim, int restart_interval = 0);
+};
@@ -1,7 +1,16 @@
+#include <limits.h>
+
 #include "line_reader.hpp"
+#include "string_simd.hpp"
+#include "utf8.hpp"
 #include "error.hpp"
 
 
+static inline bool has_utf8_bom(const char* source, UINT64 source_count)
+{
+    return source_count >= 3 && source[0] == '\xEF' && source[1] == '\xBB' && source[2] == '\xBF';
+}
+
 void Line_Reader::set_string_builder(String_Builder* sb)
 {
     this->line = sb;
@@ -12,44 +21,192 @@ void Line_Reader::set_source(const char* source, int source_count)
     this->source = source;
     this->source_count = source_count;
     this->index  = 0;
+
+    // Skip UTF-8 byte order mark.
+    if (source != nullptr && has_utf8_bom(source, source_count))
+        this->index = 3;
 }
 
 bool Line_Reader::next_line()
+{
+    E_VERIFY_NULL_R(line, false);
+
+    int line_start, line_count;
+    if (!find_line(&line_start, &line_count))
+        return false;
+
+    return set_line(line_start, line_count);
+}
+
+bool Line_Reader::next_line_view(Utf8_String* line_view)
+{
+    E_VERIFY_NULL_R(line_view, false);
+
+    int line_start, line_count;
+    if (!find_line(&line_start, &line_count))
+        return false;
+
+    *line_view = Utf8_String{ const_cast<char*>(&source[line_start]), line_count };
+    return true;
+}
+
+bool Line_Reader::find_line(int* line_start, int* line_count)
 {
     E_VERIFY_NULL_R(source, false);
     E_VERIFY_R(source_count >= 0, false);
-    E_VERIFY_NULL_R(line, false);
     E_VERIFY_R(index >= 0, false);
 
     if (index >= source_count)
         return false;
 
-    for (int i = index; i < source_count; ++i)
-    {
-        char c = source[i];
-        if (c == '\r' && i + 1 < source_count && source[i + 1] == '\n')
-            return set_line(i, 2);
-        else if (c == '\n')
-            return set_line(i, 1);
-        else
-            continue;
-    }
+    int remaining = source_count - index;
+    int found = static_cast<int>(String_Simd::find_byte(&source[index], remaining, '\n'));
+
+    int count = found;
+    if (found < remaining && found > 0 && source[index + found - 1] == '\r')
+        --count;
 
-    return set_line(source_count, 0);
+    *line_start = index;
+    *line_count = count;
+    index += found < remaining ? found + 1 : found;
+
+    return true;
 }
 
-bool Line_Reader::set_line(int i, int skip)
+bool Line_Reader::set_line(int line_start, int line_count)
 {
-    int base_index = index;
-    int line_count = i - base_index;
-    index = i + skip;
-
+    // UTF-8 never produces more UTF-16 code units than it has bytes.
     if (!line->reserve(line_count + 1))
         return false;
 
-    for (int j = 0; j < line_count; ++j)
-        line->buffer[j] = static_cast<wchar_t>(source[base_index + j]);
-    line->buffer[line_count] = L'\0';
-    
+    int written = Utf8::to_utf16(&source[line_start], line_count, line->buffer, line_count);
+    if (written < 0)
+    {
+        for (int j = 0; j < line_count; ++j)
+            line->buffer[j] = static_cast<wchar_t>(static_cast<unsigned char>(source[line_start + j]));
+        written = line_count;
+    }
+
+    line->buffer[written] = L'\0';
+    line->count = written;
+
     return true;
 }
+
+HRESULT File_Line_Reader::open(const String& file_path, size_t window_size)
+{
+    E_VERIFY_R(window_size > 0, E_INVALIDARG);
+
+    close();
+
+    HRESULT hr = file.open(file_path);
+    if (FAILED(hr))
+        return hr;
+
+    // Window must be aligned to allocation granularity, otherwise mapped views overlap poorly.
+    size_t granularity = static_cast<size_t>(file.allocation_granularity);
+    this->window_size = window_size < granularity ? granularity : window_size - (window_size % granularity);
+
+    if (file.size == 0)
+        return S_OK;
+
+    hr = remap(0);
+    if (FAILED(hr))
+    {
+        close();
+        return hr;
+    }
+
+    if (has_utf8_bom(view, view_count))
+        view_index = 3;
+
+    return S_OK;
+}
+
+void File_Line_Reader::close()
+{
+    file.unmap_view(view);
+    file.close();
+
+    view = nullptr;
+    view_offset = 0;
+    view_count = 0;
+    view_index = 0;
+    error = S_OK;
+}
+
+bool File_Line_Reader::next_line(Utf8_String* line)
+{
+    E_VERIFY_NULL_R(line, false);
+
+    while (view != nullptr)
+    {
+        bool view_reaches_file_end = view_offset + view_count == file.size;
+        size_t remaining = view_count - view_index;
+
+        if (remaining == 0 && view_reaches_file_end)
+            return false;
+
+        const char* line_start = view + view_index;
+        size_t found = String_Simd::find_byte(line_start, remaining, '\n');
+
+        if (found < remaining || view_reaches_file_end)
+        {
+            size_t count = found;
+            if (found < remaining && found > 0 && line_start[found - 1] == '\r')
+                --count;
+
+            if (count > INT_MAX)
+            {
+                error = HRESULT_FROM_WIN32(ERROR_FILE_TOO_LARGE);
+                return false;
+            }
+
+            *line = Utf8_String{ const_cast<char*>(line_start), static_cast<int>(count) };
+            view_index += found < remaining ? found + 1 : found;
+            return true;
+        }
+
+        // Line crosses window end. Move window so line starts near its beginning. If it already does,
+        // the line is longer than the window, which grows to fit it and stays that size.
+        if (view_index < file.allocation_granularity)
+        {
+            if (window_size > SIZE_MAX / 2)
+            {
+                error = HRESULT_FROM_WIN32(ERROR_FILE_TOO_LARGE);
+                return false;
+            }
+
+            window_size *= 2;
+        }
+
+        HRESULT hr = remap(view_offset + view_index);
+        if (FAILED(hr))
+        {
+            error = hr;
+            return false;
+        }
+    }
+
+    return false;
+}
+
+HRESULT File_Line_Reader::remap(UINT64 position)
+{
+    UINT64 aligned_offset = position - (position % file.allocation_granularity);
+    UINT64 bytes_left = file.size - aligned_offset;
+    size_t count = bytes_left < window_size ? static_cast<size_t>(bytes_left) : window_size;
+
+    file.unmap_view(view);
+    view = nullptr;
+
+    HRESULT hr = file.map_view(aligned_offset, count, &view);
+    if (FAILED(hr))
+        return hr;
+
+    view_offset = aligned_offset;
+    view_count = count;
+    view_index = static_cast<size_t>(position - aligned_offset);
+
+    return S_OK;
+}
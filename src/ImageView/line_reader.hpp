@@ -2,9 +2,11 @@
 #include "allocator.hpp"
 #include "string.hpp"
 #include "string_builder.hpp"
+#include "utf8_string.hpp"
+#include "file_system_utility.hpp"
 
 
-// @TODO: support UTF-8
+// Reads UTF-8 lines. Lines that are not valid UTF-8 are widened byte by byte (Latin-1).
 struct Line_Reader
 {
     const char* source = nullptr;
@@ -15,7 +17,35 @@ struct Line_Reader
     void set_string_builder(String_Builder* sb);
     void set_source(const char* source, int source_count);
     
+    // Decodes next line into string builder.
     bool next_line();
+    // Returns next line as reference into 'source', nothing is copied or decoded.
+    bool next_line_view(Utf8_String* line_view);
 private:
-    bool set_line(int i, int skip);
-};
\ No newline at end of file
+    bool find_line(int* line_start, int* line_count);
+    bool set_line(int line_start, int line_count);
+};
+
+// Streams lines of a file through mapped views, one window at a time. Returned lines reference
+// mapped memory directly: they are read-only and valid until next call to 'next_line'.
+// File size is not limited, window grows when a single line doesn't fit into it.
+struct File_Line_Reader
+{
+    static const size_t default_window_size = 64 * 1024 * 1024;
+
+    Mapped_File file;
+    size_t window_size = default_window_size;
+    HRESULT error = S_OK;
+
+    HRESULT open(const String& file_path, size_t window_size = default_window_size);
+    void close();
+
+    bool next_line(Utf8_String* line);
+private:
+    const char* view = nullptr;
+    UINT64 view_offset = 0;
+    size_t view_count = 0;
+    size_t view_index = 0;
+
+    HRESULT remap(UINT64 position);
+};
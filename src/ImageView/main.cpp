@@ -8,6 +8,10 @@
 #include "windows_utility.hpp"
 #include "line_reader.hpp"
 #include "pool_allocator.hpp"
+#include "cpu_features.hpp"
+#include "job_pool.hpp"
+#include "memory_governor.hpp"
+#include "error.hpp"
 
 #pragma comment(lib, "Comctl32.lib")
 
@@ -28,6 +32,14 @@ int __stdcall wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPWSTR lpCm
         return -1;
     }
 
+    // Calling thread runs jobs as well. Without workers everything just runs on it, so failure is not fatal.
+    if (!g_job_pool->initialize(g_cpu_features.logical_processor_count - 1))
+        LOG_ERROR(L"Unable to start all worker threads.\n");
+
+    // Without low memory notification caches just don't shrink under pressure.
+    if (!g_memory_governor->initialize())
+        LOG_ERROR(L"Unable to initialize memory governor.\n");
+
     HRESULT hr;
     hr = CoInitializeEx(0, COINIT_APARTMENTTHREADED | COINIT_SPEED_OVER_MEMORY);
     if (FAILED(hr))
@@ -95,6 +107,8 @@ int __stdcall wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPWSTR lpCm
 
     view.shutdown();
     Graphics_Utility::shutdown();
+    g_job_pool->shutdown();
+    g_memory_governor->shutdown();
 
     return return_code;
 }
@@ -0,0 +1,92 @@
+#include "memory_governor.hpp"
+#include "image_cache.hpp"
+#include "error.hpp"
+
+
+Memory_Governor  g_memory_governor_obj;
+Memory_Governor* g_memory_governor = &g_memory_governor_obj;
+
+
+bool Memory_Governor::initialize()
+{
+    // Default cache budget is lowered on machines with little memory, 'image_cache_size' setting still overrides it.
+    MEMORYSTATUSEX status = {};
+    status.dwLength = sizeof(status);
+    if (GlobalMemoryStatusEx(&status))
+    {
+        UINT64 share = status.ullTotalPhys / cache_share_of_physical;
+        if (share < g_image_cache->get_budget())
+            g_image_cache->set_budget(static_cast<size_t>(share));
+    }
+
+    low_memory_notification = CreateMemoryResourceNotification(LowMemoryResourceNotification);
+    if (low_memory_notification == nullptr)
+    {
+        LOG_LAST_WIN32_ERROR(L"Unable to create low memory notification.\n");
+        return false;
+    }
+
+    return true;
+}
+
+void Memory_Governor::shutdown()
+{
+    if (low_memory_notification != nullptr)
+    {
+        CloseHandle(low_memory_notification);
+        low_memory_notification = nullptr;
+    }
+}
+
+bool Memory_Governor::request_image_memory(UINT64 bytes)
+{
+    const size_t budget = g_image_cache->get_budget();
+    if (bytes > budget)
+        return false;
+
+    // Cached images can be evicted, so they count as available. Rest is left to other processes.
+    const bool is_low = is_memory_low();
+    UINT64 available = get_available_memory() + g_image_cache->get_size_in_bytes() + g_image_cache->get_compressed_size_in_bytes();
+    if (is_low)
+        available /= 2;
+
+    if (bytes > available / image_share_of_available)
+        return false;
+
+    // Compressing evicted images takes memory too, it's not done when there's little left.
+    g_image_cache->shrink(budget - static_cast<size_t>(bytes), nullptr, !is_low);
+    return true;
+}
+
+size_t Memory_Governor::get_tile_budget(size_t requested) const
+{
+    UINT64 available = get_available_memory() / image_share_of_available;
+    if (is_memory_low())
+        available /= 2;
+
+    return available < requested ? static_cast<size_t>(available) : requested;
+}
+
+bool Memory_Governor::is_memory_low() const
+{
+    if (low_memory_notification == nullptr)
+        return false;
+
+    BOOL is_low = FALSE;
+    if (!QueryMemoryResourceNotification(low_memory_notification, &is_low))
+        return false;
+
+    return is_low != FALSE;
+}
+
+UINT64 Memory_Governor::get_available_memory()
+{
+    MEMORYSTATUSEX status = {};
+    status.dwLength = sizeof(status);
+    // Unknown amount doesn't limit anything, it's halved so adding cache size can't overflow.
+    if (!GlobalMemoryStatusEx(&status))
+        return static_cast<UINT64>(-1) / 2;
+
+    // 32-bit process runs out of address space before physical memory.
+    return min(status.ullAvailPhys, status.ullAvailVirtual);
+}
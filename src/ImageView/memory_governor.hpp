@@ -0,0 +1,33 @@
+#pragma once
+#include <Windows.h>
+
+// Decides which images are decoded whole and how much memory caches may keep, so several large images
+// can't pile up. Images it refuses are opened as a Tiled_Image instead, which keeps only the tiles that
+// are drawn. Used from the window thread only.
+struct Memory_Governor
+{
+    // Share of physical memory the image cache uses by default, and the share of currently available
+    // memory a single decoded image may take.
+    static const int cache_share_of_physical = 4;
+    static const int image_share_of_available = 2;
+
+    bool initialize();
+    void shutdown();
+
+    // Asks for 'bytes' to decode an image with its mip levels. Returns false if image should be opened in
+    // tiles instead. When it returns true, image cache has already made room, so it stays within its budget
+    // while the image is decoded.
+    bool request_image_memory(UINT64 bytes);
+    // Tile cache size for a tiled image, 'requested' or less when memory is scarce.
+    size_t get_tile_budget(size_t requested) const;
+
+    // True while the system reports low physical memory, caches should give memory back then.
+    bool is_memory_low() const;
+
+private:
+    HANDLE low_memory_notification = nullptr;
+
+    static UINT64 get_available_memory();
+};
+
+extern Memory_Governor* g_memory_governor;
@@ -0,0 +1,723 @@
+#include <Windows.h>
+#include <string.h>
+
+#include "metadata_index.hpp"
+#include "thumbnail_store.hpp"
+#include "image_format.hpp"
+#include "defer.hpp"
+#include "error.hpp"
+
+
+static const UINT32 cache_magic = 0x444D5649; // "IVMD"
+static const UINT32 cache_version = 1;
+
+// Records are read from the cache file this many at a time.
+static const int cache_read_records = 1024;
+
+// Reading is bound by the disk, more threads only make a hard disk seek more.
+static const int max_workers = 4;
+
+// Work done by a job before it queues the next one, so scale and thumbnail jobs get threads in between.
+static const int files_per_job = 16;
+static const int cache_records_per_job = 16 * cache_read_records;
+
+struct Cache_Header
+{
+    UINT32 magic;
+    UINT32 version;
+    UINT32 record_size;
+    UINT32 reserved;
+};
+
+
+// Only JPEG and TIFF files have metadata that's read, others get an empty entry.
+static bool read_metadata(const String& folder, const File_Info& file, Photo_Metadata* metadata)
+{
+    const Image_Format format = Image_Format_Registry::from_file_name(file.path);
+    if (format != Image_Format::Jpeg && format != Image_Format::Tiff)
+        return false;
+
+    // Workers can't use the temporary allocator.
+    const String parts[] = { folder, file.path };
+    String path = String::join(L'/', parts, ARRAYSIZE(parts), g_standard_allocator);
+    if (String::is_null(path))
+        return false;
+    defer(g_standard_allocator->deallocate(path.data));
+
+    HANDLE handle = CreateFileW(path.data, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (handle == INVALID_HANDLE_VALUE)
+        return false;
+    defer(CloseHandle(handle));
+
+    Exif_Info info;
+    return Exif_Reader::read(handle, &info, metadata) == S_OK;
+}
+
+HRESULT Metadata_Index::open_cache(const String& file_path)
+{
+    E_VERIFY_R(!String::is_null_or_empty(file_path), E_INVALIDARG);
+    E_VERIFY_R(cache_file == INVALID_HANDLE_VALUE, E_UNEXPECTED); // Call 'close_cache' first!
+
+    // Another instance can't write to it at the same time.
+    cache_file = CreateFileW(file_path.data, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_ALWAYS,
+        FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (cache_file == INVALID_HANDLE_VALUE)
+        return HRESULT_FROM_WIN32(GetLastError());
+
+    UINT64 file_size = 0;
+    if (!GetFileSizeEx(cache_file, (LARGE_INTEGER*)&file_size))
+    {
+        HRESULT hr = HRESULT_FROM_WIN32(GetLastError());
+        close_cache();
+        return hr;
+    }
+
+    // File of another version or with damaged header is started again.
+    Cache_Header header = {};
+    DWORD read_size = 0;
+    const bool is_valid = ReadFile(cache_file, &header, sizeof(header), &read_size, nullptr) && read_size == sizeof(header) &&
+        header.magic == cache_magic && header.version == cache_version && header.record_size == sizeof(Cache_Record);
+    if (!is_valid)
+    {
+        clear_cache();
+        return S_OK;
+    }
+
+    // Record cut short by a crash is dropped, new ones are appended after the last whole one.
+    const UINT64 record_count = min((file_size - sizeof(header)) / sizeof(Cache_Record), static_cast<UINT64>(max_cached_records));
+    LARGE_INTEGER end;
+    end.QuadPart = static_cast<LONGLONG>(sizeof(header) + record_count * sizeof(Cache_Record));
+    if (!SetFilePointerEx(cache_file, end, nullptr, FILE_BEGIN) || !SetEndOfFile(cache_file))
+    {
+        HRESULT hr = HRESULT_FROM_WIN32(GetLastError());
+        close_cache();
+        return hr;
+    }
+
+    cache_file_records = static_cast<int>(record_count);
+    cache_loaded_records = 0;
+    cache_load_result = S_OK;
+
+    return S_OK;
+}
+
+void Metadata_Index::close_cache()
+{
+    cancel();
+
+    if (cache_file != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(cache_file);
+        cache_file = INVALID_HANDLE_VALUE;
+    }
+
+    g_standard_allocator->deallocate(cache_records);
+    g_standard_allocator->deallocate(cache_table);
+    cache_records = nullptr;
+    cache_table = nullptr;
+    cache_count = 0;
+    cache_capacity = 0;
+    cache_table_mask = 0;
+    cache_file_records = 0;
+    cache_loaded_records = 0;
+}
+
+bool Metadata_Index::reset(const String& folder, const Sequence<File_Info>& files)
+{
+    cancel();
+
+    g_standard_allocator->deallocate(columns.block);
+    columns = Columns();
+    file_count = 0;
+
+    if (files.is_empty())
+        return true;
+
+    if (!allocate_columns(files.count, &columns))
+        return false;
+
+    file_count = files.count;
+
+    for (int i = 0; i < file_count; ++i)
+    {
+        const File_Info& file = files.data[i];
+
+        Temporary_Allocator_Guard g;
+        const String parts[] = { folder, file.path };
+        String path = String::join(L'/', parts, ARRAYSIZE(parts), g_temporary_allocator);
+        if (String::is_null(path))
+            continue;
+
+        // Same key as the thumbnail, a changed file is read again.
+        const UINT64 key = Thumbnail_Store::make_key(Thumbnail_Store::hash_path(path), file.file_size, file.date_modified);
+        columns.keys[i] = key;
+
+        // Until the cache is loaded, the run that loads it fills the entries.
+        const int record = is_cache_loaded() ? find_cached(key) : -1;
+        if (record >= 0)
+        {
+            set_entry(i, cache_records[record]);
+            columns.states[i] = State_Cached;
+        }
+    }
+
+    return true;
+}
+
+void Metadata_Index::release()
+{
+    cancel();
+
+    g_standard_allocator->deallocate(columns.block);
+    columns = Columns();
+    file_count = 0;
+
+    g_standard_allocator->deallocate(names);
+    names = nullptr;
+    name_count = 0;
+}
+
+void Metadata_Index::start(HWND hwnd, UINT message, const String& folder, const Sequence<File_Info>& files, int first_index)
+{
+    E_VERIFY(files.count == file_count);
+
+    if (run.is_running || file_count == 0)
+        return;
+
+    bool has_unread = false;
+    for (int i = 0; i < file_count && !has_unread; ++i)
+        has_unread = columns.states[i] == State_Unread;
+
+    if (!has_unread)
+        return;
+
+    run.index = this;
+    run.hwnd = hwnd;
+    run.message = message;
+    run.folder = &folder;
+    run.files = files.data;
+    run.first_index = min(max(first_index, 0), file_count - 1);
+    run.next = 0;
+    run.is_cancelled = 0;
+    run.is_running = true;
+
+    // Without worker threads files are read right away. Cache that's not loaded yet is loaded by one worker,
+    // which starts the others when it's done.
+    const int thread_count = g_job_pool->get_thread_count();
+    run.worker_count = max(min(thread_count, max_workers), 1);
+    const int worker_count = is_cache_loaded() ? run.worker_count : 1;
+    run.workers = worker_count;
+    for (int i = 0; i < worker_count; ++i)
+    {
+        if (thread_count == 0 || !g_job_pool->submit(run_reader, &run, i, &run.group))
+            run_reader(&run, i);
+    }
+}
+
+bool Metadata_Index::finish()
+{
+    // Message of a cancelled run can come while the next one is running.
+    if (!run.is_running || run.workers != 0)
+        return false;
+
+    end_run();
+    return true;
+}
+
+void Metadata_Index::cancel()
+{
+    if (!run.is_running)
+        return;
+
+    // Files being read are finished, what was read so far is kept. Cache loading continues with the next run.
+    InterlockedExchange(&run.is_cancelled, 1);
+    end_run();
+}
+
+void Metadata_Index::end_run()
+{
+    g_job_pool->wait(&run.group);
+    run.is_running = false;
+
+    if (FAILED(cache_load_result))
+    {
+        LOG_HRESULT_ERROR(cache_load_result, L"Unable to load metadata cache.\n");
+        cache_load_result = S_OK;
+        close_cache();
+    }
+
+    store_read_entries();
+}
+
+bool Metadata_Index::permute(const int* order)
+{
+    E_VERIFY_NULL_R(order, false);
+    E_VERIFY_R(!run.is_running, false);
+
+    if (file_count == 0)
+        return true;
+
+    Columns permuted;
+    if (!allocate_columns(file_count, &permuted))
+        return false;
+
+    for (int i = 0; i < file_count; ++i)
+    {
+        const int from = order[i];
+        permuted.keys[i] = columns.keys[from];
+        permuted.dates_taken[i] = columns.dates_taken[from];
+        permuted.states[i] = columns.states[from];
+        permuted.exposure_times[i] = columns.exposure_times[from];
+        permuted.f_numbers[i] = columns.f_numbers[from];
+        permuted.focal_lengths[i] = columns.focal_lengths[from];
+        permuted.latitudes[i] = columns.latitudes[from];
+        permuted.longitudes[i] = columns.longitudes[from];
+        permuted.cameras[i] = columns.cameras[from];
+        permuted.lenses[i] = columns.lenses[from];
+        permuted.isos[i] = columns.isos[from];
+        permuted.ratings[i] = columns.ratings[from];
+        permuted.flags[i] = columns.flags[from];
+    }
+
+    g_standard_allocator->deallocate(columns.block);
+    columns = permuted;
+
+    return true;
+}
+
+bool Metadata_Index::get(int index, Photo_Metadata* metadata) const
+{
+    E_VERIFY_NULL_R(metadata, false);
+
+    *metadata = Photo_Metadata();
+    if (!is_read(index))
+        return false;
+
+    metadata->date_taken = columns.dates_taken[index];
+    strncpy_s(metadata->camera, get_name(columns.cameras[index]), _TRUNCATE);
+    strncpy_s(metadata->lens, get_name(columns.lenses[index]), _TRUNCATE);
+    metadata->exposure_time = columns.exposure_times[index];
+    metadata->f_number = columns.f_numbers[index];
+    metadata->focal_length = columns.focal_lengths[index];
+    metadata->iso = columns.isos[index];
+    metadata->has_location = (columns.flags[index] & Flag_Has_Location) != 0;
+    metadata->latitude = columns.latitudes[index];
+    metadata->longitude = columns.longitudes[index];
+    metadata->rating = columns.ratings[index];
+
+    return true;
+}
+
+UINT16 Metadata_Index::get_camera(int index) const
+{
+    return is_read(index) ? columns.cameras[index] : 0;
+}
+
+UINT16 Metadata_Index::get_lens(int index) const
+{
+    return is_read(index) ? columns.lenses[index] : 0;
+}
+
+bool Metadata_Index::matches(int index, const Metadata_Filter& filter) const
+{
+    if (filter.is_empty())
+        return true;
+
+    // Files that are not read yet are shown when they're read and match.
+    if (!is_read(index))
+        return false;
+
+    if (filter.camera != 0 && columns.cameras[index] != filter.camera)
+        return false;
+    if (filter.lens != 0 && columns.lenses[index] != filter.lens)
+        return false;
+    if (filter.taken_to != 0 && (columns.dates_taken[index] < filter.taken_from || columns.dates_taken[index] >= filter.taken_to))
+        return false;
+    if (filter.requires_location && (columns.flags[index] & Flag_Has_Location) == 0)
+        return false;
+
+    return true;
+}
+
+bool Metadata_Index::allocate_columns(int count, Columns* columns)
+{
+    const size_t n = static_cast<size_t>(count);
+    const size_t size = n * (2 * sizeof(UINT64) + sizeof(LONG) + 5 * sizeof(float) + 3 * sizeof(UINT16) + sizeof(signed char) + sizeof(BYTE));
+
+    BYTE* block = (BYTE*)g_standard_allocator->allocate(size);
+    if (block == nullptr)
+        return false;
+
+    memset(block, 0, size);
+    columns->block = block;
+
+    columns->keys = reinterpret_cast<UINT64*>(block);
+    columns->dates_taken = columns->keys + n;
+    columns->states = reinterpret_cast<volatile LONG*>(columns->dates_taken + n);
+    columns->exposure_times = reinterpret_cast<float*>(const_cast<LONG*>(columns->states + n));
+    columns->f_numbers = columns->exposure_times + n;
+    columns->focal_lengths = columns->f_numbers + n;
+    columns->latitudes = columns->focal_lengths + n;
+    columns->longitudes = columns->latitudes + n;
+    columns->cameras = reinterpret_cast<UINT16*>(columns->longitudes + n);
+    columns->lenses = columns->cameras + n;
+    columns->isos = columns->lenses + n;
+    columns->ratings = reinterpret_cast<signed char*>(columns->isos + n);
+    columns->flags = reinterpret_cast<BYTE*>(columns->ratings + n);
+
+    return true;
+}
+
+UINT16 Metadata_Index::intern(const char* name)
+{
+    if (name[0] == 0)
+        return 0;
+
+    AcquireSRWLockExclusive(&name_lock);
+    defer(ReleaseSRWLockExclusive(&name_lock));
+
+    if (names == nullptr)
+    {
+        names = (char(*)[name_capacity])g_standard_allocator->allocate(sizeof(names[0]) * max_names);
+        if (names == nullptr)
+            return 0;
+    }
+
+    // A folder has a few cameras and lenses, they're found in a few comparisons.
+    for (int i = 0; i < name_count; ++i)
+    {
+        if (strncmp(names[i], name, name_capacity - 1) == 0)
+            return static_cast<UINT16>(i + 1);
+    }
+
+    if (name_count == max_names)
+        return 0;
+
+    strncpy_s(names[name_count], name, _TRUNCATE);
+    return static_cast<UINT16>(++name_count);
+}
+
+const char* Metadata_Index::get_name(UINT16 id) const
+{
+    return id != 0 && id <= max_names && names != nullptr ? names[id - 1] : "";
+}
+
+void Metadata_Index::set_entry(int index, const Photo_Metadata& metadata)
+{
+    columns.dates_taken[index] = metadata.date_taken;
+    columns.exposure_times[index] = metadata.exposure_time;
+    columns.f_numbers[index] = metadata.f_number;
+    columns.focal_lengths[index] = metadata.focal_length;
+    columns.latitudes[index] = metadata.latitude;
+    columns.longitudes[index] = metadata.longitude;
+    columns.cameras[index] = intern(metadata.camera);
+    columns.lenses[index] = intern(metadata.lens);
+    columns.isos[index] = static_cast<UINT16>(min(max(metadata.iso, 0), 0xFFFF));
+    columns.ratings[index] = static_cast<signed char>(metadata.rating);
+    columns.flags[index] = metadata.has_location ? Flag_Has_Location : 0;
+}
+
+void Metadata_Index::set_entry(int index, const Cache_Record& record)
+{
+    columns.dates_taken[index] = record.date_taken;
+    columns.exposure_times[index] = record.exposure_time;
+    columns.f_numbers[index] = record.f_number;
+    columns.focal_lengths[index] = record.focal_length;
+    columns.latitudes[index] = record.latitude;
+    columns.longitudes[index] = record.longitude;
+    columns.cameras[index] = intern(record.camera);
+    columns.lenses[index] = intern(record.lens);
+    columns.isos[index] = record.iso;
+    columns.ratings[index] = record.rating;
+    columns.flags[index] = record.flags;
+}
+
+int Metadata_Index::find_cached(UINT64 key) const
+{
+    if (cache_count == 0)
+        return -1;
+
+    // Keys are hashes already.
+    for (int slot = static_cast<int>(key & cache_table_mask); cache_table[slot] != 0; slot = (slot + 1) & cache_table_mask)
+    {
+        if (cache_records[cache_table[slot] - 1].key == key)
+            return cache_table[slot] - 1;
+    }
+
+    return -1;
+}
+
+bool Metadata_Index::add_to_cache(const Cache_Record& record)
+{
+    const int existing = find_cached(record.key);
+    if (existing >= 0)
+    {
+        cache_records[existing] = record;
+        return true;
+    }
+
+    if (cache_count == cache_capacity)
+    {
+        const int capacity = max(cache_capacity * 2, cache_read_records);
+        Cache_Record* records = (Cache_Record*)g_standard_allocator->reallocate(cache_records, sizeof(Cache_Record) * capacity);
+        if (records == nullptr)
+            return false;
+
+        cache_records = records;
+        cache_capacity = capacity;
+    }
+
+    // Table is kept at most half full.
+    if ((cache_count + 1) * 2 > cache_table_mask + 1)
+    {
+        const int table_size = max((cache_table_mask + 1) * 2, cache_read_records * 2);
+        int* table = (int*)g_standard_allocator->allocate(sizeof(int) * table_size);
+        if (table == nullptr)
+            return false;
+
+        memset(table, 0, sizeof(int) * table_size);
+        for (int i = 0; i < cache_count; ++i)
+        {
+            int slot = static_cast<int>(cache_records[i].key & (table_size - 1));
+            while (table[slot] != 0)
+                slot = (slot + 1) & (table_size - 1);
+            table[slot] = i + 1;
+        }
+
+        g_standard_allocator->deallocate(cache_table);
+        cache_table = table;
+        cache_table_mask = table_size - 1;
+    }
+
+    int slot = static_cast<int>(record.key & cache_table_mask);
+    while (cache_table[slot] != 0)
+        slot = (slot + 1) & cache_table_mask;
+
+    cache_records[cache_count] = record;
+    cache_table[slot] = ++cache_count;
+
+    return true;
+}
+
+void Metadata_Index::clear_cache()
+{
+    cache_count = 0;
+    if (cache_table != nullptr)
+        memset(cache_table, 0, sizeof(int) * (cache_table_mask + 1));
+
+    if (cache_file == INVALID_HANDLE_VALUE)
+        return;
+
+    const Cache_Header header = { cache_magic, cache_version, sizeof(Cache_Record), 0 };
+    LARGE_INTEGER start = {};
+    DWORD written = 0;
+    if (!SetFilePointerEx(cache_file, start, nullptr, FILE_BEGIN) || !WriteFile(cache_file, &header, sizeof(header), &written, nullptr) ||
+        !SetEndOfFile(cache_file))
+    {
+        LOG_LAST_WIN32_ERROR(L"Unable to clear metadata cache.\n");
+        CloseHandle(cache_file);
+        cache_file = INVALID_HANDLE_VALUE;
+    }
+}
+
+void Metadata_Index::store_read_entries()
+{
+    // Records are appended once the cache is loaded, until then entries stay read.
+    if (cache_file != INVALID_HANDLE_VALUE && !is_cache_loaded())
+        return;
+
+    Temporary_Allocator_Guard g;
+    Cache_Record* records = cache_file != INVALID_HANDLE_VALUE
+        ? (Cache_Record*)g_temporary_allocator->allocate(sizeof(Cache_Record) * cache_read_records)
+        : nullptr;
+
+    int count = 0;
+    for (int i = 0; i < file_count; ++i)
+    {
+        if (columns.states[i] != State_Read)
+            continue;
+
+        columns.states[i] = State_Cached;
+        if (records == nullptr)
+            continue;
+
+        Cache_Record& record = records[count++];
+        memset(&record, 0, sizeof(record));
+        record.key = columns.keys[i];
+        record.date_taken = columns.dates_taken[i];
+        record.exposure_time = columns.exposure_times[i];
+        record.f_number = columns.f_numbers[i];
+        record.focal_length = columns.focal_lengths[i];
+        record.latitude = columns.latitudes[i];
+        record.longitude = columns.longitudes[i];
+        record.iso = columns.isos[i];
+        record.rating = columns.ratings[i];
+        record.flags = columns.flags[i];
+        strncpy_s(record.camera, get_name(columns.cameras[i]), _TRUNCATE);
+        strncpy_s(record.lens, get_name(columns.lenses[i]), _TRUNCATE);
+
+        if (count == cache_read_records)
+        {
+            append_to_cache(records, count);
+            count = 0;
+        }
+    }
+
+    if (count > 0)
+        append_to_cache(records, count);
+}
+
+void Metadata_Index::append_to_cache(const Cache_Record* records, int count)
+{
+    // Full cache is started again, these records are the first ones.
+    if (cache_count + count > max_cached_records)
+        clear_cache();
+
+    if (cache_file == INVALID_HANDLE_VALUE)
+        return;
+
+    for (int i = 0; i < count; ++i)
+    {
+        if (!add_to_cache(records[i]))
+            break;
+    }
+
+    // Written at the end of the file, wherever loading left the file pointer.
+    OVERLAPPED end = {};
+    end.Offset = 0xFFFFFFFF;
+    end.OffsetHigh = 0xFFFFFFFF;
+    DWORD written = 0;
+    if (!WriteFile(cache_file, records, count * sizeof(Cache_Record), &written, &end))
+        LOG_LAST_WIN32_ERROR(L"Unable to write metadata cache.\n");
+}
+
+bool Metadata_Index::load_cache_records(int count)
+{
+    Cache_Record* records = (Cache_Record*)g_standard_allocator->allocate(sizeof(Cache_Record) * cache_read_records);
+    if (records == nullptr)
+    {
+        cache_load_result = E_OUTOFMEMORY;
+        return false;
+    }
+    defer(g_standard_allocator->deallocate(records));
+
+    // Later records of the same file replace earlier ones.
+    const int end = min(cache_loaded_records + count, cache_file_records);
+    while (cache_loaded_records < end)
+    {
+        const int read_count = min(end - cache_loaded_records, cache_read_records);
+        const UINT64 offset = sizeof(Cache_Header) + static_cast<UINT64>(cache_loaded_records) * sizeof(Cache_Record);
+        OVERLAPPED position = {};
+        position.Offset = static_cast<DWORD>(offset);
+        position.OffsetHigh = static_cast<DWORD>(offset >> 32);
+        DWORD read_size = 0;
+        if (!ReadFile(cache_file, records, read_count * sizeof(Cache_Record), &read_size, &position) ||
+            read_size != read_count * sizeof(Cache_Record))
+        {
+            const HRESULT hr = HRESULT_FROM_WIN32(GetLastError());
+            cache_load_result = FAILED(hr) ? hr : E_FAIL;
+            return false;
+        }
+
+        for (int i = 0; i < read_count; ++i)
+        {
+            records[i].camera[name_capacity - 1] = 0;
+            records[i].lens[name_capacity - 1] = 0;
+            if (!add_to_cache(records[i]))
+            {
+                cache_load_result = E_OUTOFMEMORY;
+                return false;
+            }
+        }
+
+        cache_loaded_records += read_count;
+    }
+
+    return true;
+}
+
+void Metadata_Index::fill_from_cache()
+{
+    for (int i = 0; i < file_count; ++i)
+    {
+        if (columns.states[i] != State_Unread)
+            continue;
+
+        const int record = find_cached(columns.keys[i]);
+        if (record < 0)
+            continue;
+
+        // Entry is complete before it's marked, like entries read by workers.
+        set_entry(i, cache_records[record]);
+        InterlockedExchange(&columns.states[i], State_Cached);
+    }
+}
+
+bool Metadata_Index::read_files(Run* run, int count)
+{
+    const int file_count = run->index->file_count;
+    for (int n = 0; n < count && !run->is_cancelled; ++n)
+    {
+        const LONG claimed = InterlockedIncrement(&run->next) - 1;
+        if (claimed >= file_count)
+            return false;
+
+        // Current file and the ones after it are read first, they're the ones looked at next.
+        const int i = (run->first_index + claimed) % file_count;
+        if (run->index->columns.states[i] != State_Unread)
+            continue;
+
+        Photo_Metadata metadata;
+        if (read_metadata(*run->folder, run->files[i], &metadata))
+            run->index->set_entry(i, metadata);
+
+        // Entry is complete before it's marked as read, the window thread reads it only then.
+        InterlockedExchange(&run->index->columns.states[i], State_Read);
+    }
+
+    return !run->is_cancelled;
+}
+
+void Metadata_Index::run_reader(void* context, int worker)
+{
+    Run* run = static_cast<Run*>(context);
+    Metadata_Index* index = run->index;
+
+    // Each job does a batch and queues the next one. When the pool can't take it, the batches are done here.
+    for (;;)
+    {
+        bool has_more = !run->is_cancelled;
+        if (has_more && !index->is_cache_loaded())
+        {
+            // Cache that fails to load is closed by the window thread when the run ends, records loaded so far are used.
+            if (!index->load_cache_records(cache_records_per_job))
+                index->cache_file_records = index->cache_loaded_records;
+
+            if (index->is_cache_loaded())
+            {
+                index->fill_from_cache();
+
+                // Count is raised first, so a started worker that's done at once doesn't end the run.
+                for (int i = 1; i < run->worker_count; ++i)
+                {
+                    InterlockedIncrement(&run->workers);
+                    if (!g_job_pool->submit(run_reader, run, i, &run->group))
+                        InterlockedDecrement(&run->workers);
+                }
+            }
+        }
+        else if (has_more)
+        {
+            has_more = read_files(run, files_per_job);
+        }
+
+        if (!has_more)
+            break;
+        if (g_job_pool->submit(run_reader, run, worker, &run->group))
+            return;
+    }
+
+    if (InterlockedDecrement(&run->workers) == 0)
+        PostMessageW(run->hwnd, run->message, 0, 0);
+}
@@ -0,0 +1,178 @@
+#pragma once
+#include <Windows.h>
+
+#include "file_system_utility.hpp"
+#include "exif_reader.hpp"
+#include "job_pool.hpp"
+
+// Files shown by a filter. Zero or false matches any file, the rest must all match.
+struct Metadata_Filter
+{
+    UINT16 camera = 0;
+    UINT16 lens = 0;
+    // Date taken in [taken_from, taken_to).
+    UINT64 taken_from = 0;
+    UINT64 taken_to = 0;
+    bool requires_location = false;
+
+    inline bool is_empty() const { return camera == 0 && lens == 0 && taken_to == 0 && !requires_location; }
+};
+
+// Photo metadata of files of the current folder, one column per field indexed like the files. Columns
+// are filled from the cache file, which the first run loads on the job pool before it reads files that
+// are not there. Reading runs in short jobs, so it doesn't keep threads from other jobs: only the first
+// segments of JPEG and TIFF files are parsed, pixels are never decoded. Camera and lens are interned
+// to ids, so comparing them doesn't touch strings.
+//
+// Cache file has a header followed by fixed size records keyed like thumbnails (path, size and
+// modification date) and is only appended to. Records are written once a run finishes, a record cut
+// short by a crash is ignored. When it's full it's started again, reading metadata is cheap.
+//
+// Used from the window thread, workers only write entries of the files they claim.
+struct Metadata_Index
+{
+    static const int max_names = 4096;
+    static const int name_capacity = sizeof(Photo_Metadata::camera);
+    static const int max_cached_records = 256 * 1024;
+
+    // Records are loaded by the next run, see 'start'.
+    HRESULT open_cache(const String& file_path);
+    // Cancels reading and stores what was read.
+    void close_cache();
+
+    // Cancels reading and sets up empty columns for 'files' of 'folder', those found in the cache are filled.
+    bool reset(const String& folder, const Sequence<File_Info>& files);
+    void release();
+
+    // Reads files that are not read yet on the job pool, starting with 'first_index' and the ones after it.
+    // 'message' is posted to 'hwnd' when it's done, 'finish' must be called then. 'folder' and 'files'
+    // must not change until it's finished or cancelled.
+    void start(HWND hwnd, UINT message, const String& folder, const Sequence<File_Info>& files, int first_index);
+    // Waits for the run and appends what it read to the cache. Returns false if no run was finished.
+    bool finish();
+    // Stops reading and waits for files that are being read.
+    void cancel();
+    inline bool is_running() const { return run.is_running; }
+
+    // Reorders columns, entry at 'i' is the one that was at 'order[i]'. Reading must not be running.
+    bool permute(const int* order);
+
+    inline bool is_read(int index) const { return index >= 0 && index < file_count && columns.states[index] != State_Unread; }
+    // Zero if it's not known.
+    inline UINT64 get_date_taken(int index) const { return is_read(index) ? columns.dates_taken[index] : 0; }
+    // Fills 'metadata' with what is known about file at 'index', returns false if it's not read yet.
+    bool get(int index, Photo_Metadata* metadata) const;
+    UINT16 get_camera(int index) const;
+    UINT16 get_lens(int index) const;
+    bool matches(int index, const Metadata_Filter& filter) const;
+
+private:
+    enum Entry_State : LONG
+    {
+        State_Unread = 0,
+        // Read by a run, not in the cache yet.
+        State_Read = 1,
+        State_Cached = 2,
+    };
+
+    enum Entry_Flags : BYTE
+    {
+        Flag_Has_Location = 1,
+    };
+
+    // Columns share one allocation, largest values first.
+    struct Columns
+    {
+        void* block = nullptr;
+        UINT64* keys = nullptr;
+        UINT64* dates_taken = nullptr;
+        volatile LONG* states = nullptr;
+        float* exposure_times = nullptr;
+        float* f_numbers = nullptr;
+        float* focal_lengths = nullptr;
+        float* latitudes = nullptr;
+        float* longitudes = nullptr;
+        UINT16* cameras = nullptr;
+        UINT16* lenses = nullptr;
+        UINT16* isos = nullptr;
+        signed char* ratings = nullptr;
+        BYTE* flags = nullptr;
+    };
+
+    struct Cache_Record
+    {
+        UINT64 key;
+        UINT64 date_taken;
+        float exposure_time;
+        float f_number;
+        float focal_length;
+        float latitude;
+        float longitude;
+        UINT16 iso;
+        signed char rating;
+        BYTE flags;
+        char camera[name_capacity];
+        char lens[name_capacity];
+    };
+
+    struct Run
+    {
+        Job_Group group;
+        Metadata_Index* index = nullptr;
+        HWND hwnd = 0;
+        UINT message = 0;
+        const String* folder = nullptr;
+        const File_Info* files = nullptr;
+        int first_index = 0;
+        int worker_count = 0;
+        // Files are claimed by counting up, workers that run out post the message when they're the last one.
+        volatile LONG next = 0;
+        volatile LONG workers = 0;
+        volatile LONG is_cancelled = 0;
+        bool is_running = false;
+    };
+
+    Columns columns;
+    int file_count = 0;
+    Run run;
+
+    // Interned names, id is index + 1. Capacity is fixed, so names are added by workers while others are read.
+    char (*names)[name_capacity] = nullptr;
+    int name_count = 0;
+    SRWLOCK name_lock = SRWLOCK_INIT;
+
+    HANDLE cache_file = INVALID_HANDLE_VALUE;
+    Cache_Record* cache_records = nullptr;
+    int cache_count = 0;
+    int cache_capacity = 0;
+    // Open addressing table of record indices + 1, zero is an empty slot.
+    int* cache_table = nullptr;
+    int cache_table_mask = 0;
+    // Records in the file and how many of them are loaded, only a run touches them until they're equal.
+    int cache_file_records = 0;
+    int cache_loaded_records = 0;
+    HRESULT cache_load_result = S_OK;
+
+    static bool allocate_columns(int count, Columns* columns);
+    UINT16 intern(const char* name);
+    const char* get_name(UINT16 id) const;
+    void set_entry(int index, const Photo_Metadata& metadata);
+    void set_entry(int index, const Cache_Record& record);
+
+    int find_cached(UINT64 key) const;
+    bool add_to_cache(const Cache_Record& record);
+    void clear_cache();
+    // Appends entries read by the last run to the cache and its file.
+    void store_read_entries();
+    void append_to_cache(const Cache_Record* records, int count);
+    inline bool is_cache_loaded() const { return cache_loaded_records == cache_file_records; }
+    // Loads next 'count' records, false on failure with 'cache_load_result' set.
+    bool load_cache_records(int count);
+    // Fills entries not read yet from the cache.
+    void fill_from_cache();
+
+    void end_run();
+    // Reads up to 'count' claimed files, false when there are no more or the run is cancelled.
+    static bool read_files(Run* run, int count);
+    static void run_reader(void* context, int worker);
+};
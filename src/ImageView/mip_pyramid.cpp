@@ -0,0 +1,256 @@
+#include <Windows.h>
+
+#include "mip_pyramid.hpp"
+#include "cpu_features.hpp"
+#include "error.hpp"
+
+#if CPU_X86
+    #include <intrin.h>
+    #include <immintrin.h>
+#elif CPU_ARM
+    #include <arm_neon.h>
+#endif
+
+// Averages 2x2 blocks of 'row0' and 'row1' into 'destination_width' pixels. 'source_width' is at least
+// 2 * destination_width - 1, last column is repeated if the block needs it.
+typedef void (*Downsample_Row_Func)(const UINT32* row0, const UINT32* row1, UINT32* destination, int destination_width, int source_width);
+
+
+#pragma region Scalar
+static void downsample_row_scalar(const UINT32* row0, const UINT32* row1, UINT32* destination, int destination_width, int source_width)
+{
+    for (int x = 0; x < destination_width; ++x)
+    {
+        const int x0 = 2 * x;
+        const int x1 = min(x0 + 1, source_width - 1);
+        const UINT32 p[4] = { row0[x0], row0[x1], row1[x0], row1[x1] };
+
+        UINT32 result = 0;
+        for (int shift = 0; shift < 32; shift += 8)
+        {
+            UINT32 sum = 2;
+            for (int i = 0; i < 4; ++i)
+                sum += (p[i] >> shift) & 0xFF;
+
+            result |= (sum >> 2) << shift;
+        }
+
+        destination[x] = result;
+    }
+}
+#pragma endregion
+
+
+#if CPU_X86
+#pragma region SSE2
+// Sums 4 pixels of two rows into 16-bit channels of 2 pixels, one for each horizontal pair.
+static inline __m128i sum_2x2_sse2(__m128i a, __m128i b)
+{
+    const __m128i zero = _mm_setzero_si128();
+
+    __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+    __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+
+    return _mm_add_epi16(_mm_unpacklo_epi64(lo, hi), _mm_unpackhi_epi64(lo, hi));
+}
+
+static void downsample_row_sse2(const UINT32* row0, const UINT32* row1, UINT32* destination, int destination_width, int source_width)
+{
+    const __m128i two = _mm_set1_epi16(2);
+
+    int x = 0;
+    for (; x + 4 <= destination_width && 2 * x + 8 <= source_width; x += 4)
+    {
+        __m128i s0 = sum_2x2_sse2(_mm_loadu_si128((const __m128i*)(row0 + 2 * x)), _mm_loadu_si128((const __m128i*)(row1 + 2 * x)));
+        __m128i s1 = sum_2x2_sse2(_mm_loadu_si128((const __m128i*)(row0 + 2 * x + 4)), _mm_loadu_si128((const __m128i*)(row1 + 2 * x + 4)));
+
+        s0 = _mm_srli_epi16(_mm_add_epi16(s0, two), 2);
+        s1 = _mm_srli_epi16(_mm_add_epi16(s1, two), 2);
+        _mm_storeu_si128((__m128i*)(destination + x), _mm_packus_epi16(s0, s1));
+    }
+
+    downsample_row_scalar(row0 + 2 * x, row1 + 2 * x, destination + x, destination_width - x, source_width - 2 * x);
+}
+#pragma endregion
+
+#pragma region AVX2
+static inline __m256i sum_2x2_avx2(__m256i a, __m256i b)
+{
+    const __m256i zero = _mm256_setzero_si256();
+
+    __m256i lo = _mm256_add_epi16(_mm256_unpacklo_epi8(a, zero), _mm256_unpacklo_epi8(b, zero));
+    __m256i hi = _mm256_add_epi16(_mm256_unpackhi_epi8(a, zero), _mm256_unpackhi_epi8(b, zero));
+
+    return _mm256_add_epi16(_mm256_unpacklo_epi64(lo, hi), _mm256_unpackhi_epi64(lo, hi));
+}
+
+static void downsample_row_avx2(const UINT32* row0, const UINT32* row1, UINT32* destination, int destination_width, int source_width)
+{
+    const __m256i two = _mm256_set1_epi16(2);
+
+    int x = 0;
+    for (; x + 8 <= destination_width && 2 * x + 16 <= source_width; x += 8)
+    {
+        __m256i s0 = sum_2x2_avx2(_mm256_loadu_si256((const __m256i*)(row0 + 2 * x)), _mm256_loadu_si256((const __m256i*)(row1 + 2 * x)));
+        __m256i s1 = sum_2x2_avx2(_mm256_loadu_si256((const __m256i*)(row0 + 2 * x + 8)), _mm256_loadu_si256((const __m256i*)(row1 + 2 * x + 8)));
+
+        s0 = _mm256_srli_epi16(_mm256_add_epi16(s0, two), 2);
+        s1 = _mm256_srli_epi16(_mm256_add_epi16(s1, two), 2);
+
+        // Packing works in 128-bit lanes, pixels come out as 0 1 4 5 2 3 6 7.
+        __m256i packed = _mm256_packus_epi16(s0, s1);
+        _mm256_storeu_si256((__m256i*)(destination + x), _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0)));
+    }
+
+    downsample_row_scalar(row0 + 2 * x, row1 + 2 * x, destination + x, destination_width - x, source_width - 2 * x);
+    _mm256_zeroupper();
+}
+#pragma endregion
+#endif
+
+#if CPU_ARM
+#pragma region NEON
+static void downsample_row_neon(const UINT32* row0, const UINT32* row1, UINT32* destination, int destination_width, int source_width)
+{
+    int x = 0;
+    for (; x + 8 <= destination_width && 2 * x + 16 <= source_width; x += 8)
+    {
+        uint8x16x4_t a = vld4q_u8((const uint8_t*)(row0 + 2 * x));
+        uint8x16x4_t b = vld4q_u8((const uint8_t*)(row1 + 2 * x));
+
+        uint8x8x4_t result;
+        for (int c = 0; c < 4; ++c)
+            result.val[c] = vrshrn_n_u16(vpadalq_u8(vpaddlq_u8(a.val[c]), b.val[c]), 2);
+
+        vst4_u8((uint8_t*)(destination + x), result);
+    }
+
+    downsample_row_scalar(row0 + 2 * x, row1 + 2 * x, destination + x, destination_width - x, source_width - 2 * x);
+}
+#pragma endregion
+#endif
+
+static Downsample_Row_Func select_downsample_row()
+{
+#if CPU_X86
+    if (g_cpu_features.has_avx2)
+        return downsample_row_avx2;
+    if (g_cpu_features.has_sse2)
+        return downsample_row_sse2;
+#elif CPU_ARM
+    if (g_cpu_features.has_neon)
+        return downsample_row_neon;
+#endif
+
+    return downsample_row_scalar;
+}
+
+static Downsample_Row_Func get_downsample_row()
+{
+    static const Downsample_Row_Func func = select_downsample_row();
+    return func;
+}
+
+struct Downsample_Job
+{
+    const Image_Buffer* source;
+    const Image_Buffer* destination;
+    int band_height;
+};
+
+static void downsample_band(void* context, int band)
+{
+    Downsample_Job* job = (Downsample_Job*)context;
+    const Downsample_Row_Func downsample_row = get_downsample_row();
+    const Image_Buffer& source = *job->source;
+    const Image_Buffer& destination = *job->destination;
+
+    const int y_end = min((band + 1) * job->band_height, destination.height);
+    for (int y = band * job->band_height; y < y_end; ++y)
+    {
+        const UINT32* row0 = source.row(2 * y);
+        const UINT32* row1 = source.row(min(2 * y + 1, source.height - 1));
+        downsample_row(row0, row1, destination.row(y), destination.width, source.width);
+    }
+}
+
+bool Mip_Pyramid::build(Image_Buffer* base, Job_Pool* pool)
+{
+    E_VERIFY_NULL_R(base, false);
+    E_VERIFY_R(!base->is_empty(), false);
+
+    release();
+    levels[0] = *base;
+    level_count = 1;
+    *base = Image_Buffer();
+
+    // Bands are large enough that small levels run on the calling thread only.
+    const int min_band_height = 32;
+    const int band_count_per_level = pool != nullptr ? 4 * (pool->get_thread_count() + 1) : 1;
+
+    while (level_count < max_levels)
+    {
+        const Image_Buffer& source = levels[level_count - 1];
+        if (source.width == 1 && source.height == 1)
+            break;
+
+        Image_Buffer& destination = levels[level_count];
+        if (!destination.allocate(max(source.width / 2, 1), max(source.height / 2, 1)))
+        {
+            for (int i = 1; i < level_count; ++i)
+                levels[i].release();
+            level_count = 1;
+
+            return false;
+        }
+
+        Downsample_Job job;
+        job.source = &source;
+        job.destination = &destination;
+        job.band_height = max((destination.height + band_count_per_level - 1) / band_count_per_level, min_band_height);
+
+        const int band_count = (destination.height + job.band_height - 1) / job.band_height;
+        if (pool != nullptr)
+        {
+            pool->parallel_for(band_count, downsample_band, &job);
+        }
+        else
+        {
+            for (int i = 0; i < band_count; ++i)
+                downsample_band(&job, i);
+        }
+
+        ++level_count;
+    }
+
+    return true;
+}
+
+void Mip_Pyramid::release()
+{
+    for (int i = 0; i < level_count; ++i)
+        levels[i].release();
+
+    level_count = 0;
+    orientation = Orientation::Normal;
+}
+
+const Image_Buffer& Mip_Pyramid::level_for_size(int width, int height) const
+{
+    for (int i = level_count - 1; i > 0; --i)
+    {
+        if (levels[i].width >= width && levels[i].height >= height)
+            return levels[i];
+    }
+
+    return levels[0];
+}
+
+size_t Mip_Pyramid::size_in_bytes() const
+{
+    size_t size = 0;
+    for (int i = 0; i < level_count; ++i)
+        size += levels[i].size_in_bytes();
+
+    return size;
+}
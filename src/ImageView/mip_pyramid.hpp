@@ -0,0 +1,29 @@
+#pragma once
+#include "image_buffer.hpp"
+#include "image_rotation.hpp"
+#include "job_pool.hpp"
+
+// Image and its successively halved copies, down to 1x1. Level 0 is the full size image, every next
+// one is averaged from 2x2 pixels of the previous level, which adds about a third to memory usage.
+struct Mip_Pyramid
+{
+    static const int max_levels = 32;
+
+    Image_Buffer levels[max_levels];
+    int level_count = 0;
+    // How pixels were turned from the way they're stored in the file.
+    Orientation orientation = Orientation::Normal;
+
+    // Takes ownership of 'base' as level 0 and builds the rest, rows of every level are split between
+    // threads of 'pool'. On failure only level 0 is kept. Returns false if there's not enough memory.
+    bool build(Image_Buffer* base, Job_Pool* pool = g_job_pool);
+    void release();
+
+    inline bool is_empty() const { return level_count == 0; }
+    inline const Image_Buffer& base() const { return levels[0]; }
+
+    // Smallest level that's at least 'width' x 'height', downscaling from it looks the same as from
+    // full size, but touches far less pixels. Level 0 when image is upscaled.
+    const Image_Buffer& level_for_size(int width, int height) const;
+    size_t size_in_bytes() const;
+};
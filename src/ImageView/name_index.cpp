@@ -0,0 +1,464 @@
+#include <Windows.h>
+#include <string.h>
+
+#include "name_index.hpp"
+#include "string_simd.hpp"
+#include "defer.hpp"
+#include "error.hpp"
+
+
+// Build checks whether it's cancelled every this many files.
+static const int cancel_check_files = 4096;
+
+static inline int trigram_bucket(wchar_t a, wchar_t b, wchar_t c)
+{
+    UINT32 hash = static_cast<UINT32>(a) * 0x9E3779B1u;
+    hash = (hash ^ static_cast<UINT32>(b)) * 0x85EBCA77u;
+    hash = (hash ^ static_cast<UINT32>(c)) * 0xC2B2AE3Du;
+    return static_cast<int>(hash >> (32 - Name_Index::bucket_bits));
+}
+
+// Returns true if 'name' contains 'query', neither is case folded.
+static bool contains_ignore_case(const String& name, const wchar_t* query, int query_length)
+{
+    const int last = name.count - query_length;
+    for (int i = 0; i <= last; ++i)
+    {
+        if (String_Simd::fold_char(name.data[i]) == query[0] && String_Simd::equal_ignore_case(name.data + i, query, query_length))
+            return true;
+    }
+
+    return false;
+}
+
+// Returns true if folded 'name' of 'name_length' contains folded 'query'.
+static bool contains(const wchar_t* name, int name_length, const wchar_t* query, int query_length)
+{
+    const int last = name_length - query_length;
+    for (int i = 0; i <= last; ++i)
+    {
+        if (name[i] == query[0] && memcmp(name + i + 1, query + 1, sizeof(wchar_t) * (query_length - 1)) == 0)
+            return true;
+    }
+
+    return false;
+}
+
+// Moves '*cursor' in ascending 'list' to the first entry that is not less than 'value' and returns true if
+// it's 'value'. Steps double until they pass it, so walking a long list for a short one skips most of it.
+static bool advance_to(const int* list, int count, int* cursor, int value)
+{
+    int first = *cursor;
+    if (first >= count)
+        return false;
+
+    if (list[first] < value)
+    {
+        int step = 1;
+        while (first + step < count && list[first + step] < value)
+            step *= 2;
+
+        int last = min(first + step, count);
+        first += step / 2 + 1;
+        while (first < last)
+        {
+            const int middle = first + (last - first) / 2;
+            if (list[middle] < value)
+                first = middle + 1;
+            else
+                last = middle;
+        }
+    }
+
+    *cursor = first;
+    return first < count && list[first] == value;
+}
+
+// Copies names of 'files' folded and ending with a zero back to back, 'name_offsets' has one more entry for the end.
+static bool fold_names(const File_Info* files, int file_count, wchar_t** names, int** name_offsets)
+{
+    int* offsets = (int*)g_standard_allocator->allocate(sizeof(int) * (file_count + 1));
+    if (offsets == nullptr)
+        return false;
+
+    offsets[0] = 0;
+    for (int i = 0; i < file_count; ++i)
+        offsets[i + 1] = offsets[i] + files[i].path.count + 1;
+
+    wchar_t* folded = (wchar_t*)g_standard_allocator->allocate(sizeof(wchar_t) * offsets[file_count]);
+    if (folded == nullptr)
+    {
+        g_standard_allocator->deallocate(offsets);
+        return false;
+    }
+
+    for (int i = 0; i < file_count; ++i)
+    {
+        const String& name = files[i].path;
+        wchar_t* destination = folded + offsets[i];
+        for (int k = 0; k < name.count; ++k)
+            destination[k] = String_Simd::fold_char(name.data[k]);
+        destination[name.count] = L'\0';
+    }
+
+    *names = folded;
+    *name_offsets = offsets;
+    return true;
+}
+
+// Counts files of each bucket, then lists them at offsets from the counts. Files are visited in order,
+// so the lists are ascending and a trigram that repeats in a name is listed once.
+static bool build_postings(const wchar_t* names, const int* name_offsets, int file_count, const volatile LONG* is_cancelled,
+    int** offsets, int** postings)
+{
+    int* last_files = (int*)g_standard_allocator->allocate(sizeof(int) * Name_Index::bucket_count);
+    int* positions = (int*)g_standard_allocator->allocate(sizeof(int) * Name_Index::bucket_count);
+    int* bucket_offsets = (int*)g_standard_allocator->allocate(sizeof(int) * (Name_Index::bucket_count + 1));
+    int* bucket_postings = nullptr;
+    defer(g_standard_allocator->deallocate(last_files));
+    defer(g_standard_allocator->deallocate(positions));
+    if (last_files == nullptr || positions == nullptr || bucket_offsets == nullptr)
+    {
+        g_standard_allocator->deallocate(bucket_offsets);
+        return false;
+    }
+
+    memset(bucket_offsets, 0, sizeof(int) * (Name_Index::bucket_count + 1));
+
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        memset(last_files, 0xFF, sizeof(int) * Name_Index::bucket_count);
+
+        for (int i = 0; i < file_count; ++i)
+        {
+            if (i % cancel_check_files == 0 && *is_cancelled)
+            {
+                g_standard_allocator->deallocate(bucket_offsets);
+                g_standard_allocator->deallocate(bucket_postings);
+                return false;
+            }
+
+            const wchar_t* name = names + name_offsets[i];
+            const int name_length = name_offsets[i + 1] - name_offsets[i] - 1;
+            for (int k = 2; k < name_length; ++k)
+            {
+                const int bucket = trigram_bucket(name[k - 2], name[k - 1], name[k]);
+                if (last_files[bucket] == i)
+                    continue;
+
+                last_files[bucket] = i;
+                if (pass == 0)
+                    ++bucket_offsets[bucket + 1];
+                else
+                    bucket_postings[positions[bucket]++] = i;
+            }
+        }
+
+        if (pass == 0)
+        {
+            for (int bucket = 0; bucket < Name_Index::bucket_count; ++bucket)
+                bucket_offsets[bucket + 1] += bucket_offsets[bucket];
+
+            memcpy(positions, bucket_offsets, sizeof(int) * Name_Index::bucket_count);
+
+            bucket_postings = (int*)g_standard_allocator->allocate(sizeof(int) * max(bucket_offsets[Name_Index::bucket_count], 1));
+            if (bucket_postings == nullptr)
+            {
+                g_standard_allocator->deallocate(bucket_offsets);
+                return false;
+            }
+        }
+    }
+
+    *offsets = bucket_offsets;
+    *postings = bucket_postings;
+    return true;
+}
+
+void Name_Index::start(HWND hwnd, UINT message, const Sequence<File_Info>& files)
+{
+    cancel();
+    release_postings();
+
+    if (files.is_empty())
+        return;
+
+    build.index = this;
+    build.hwnd = hwnd;
+    build.message = message;
+    build.files = files.data;
+    build.file_count = files.count;
+    build.is_done = 0;
+    build.is_cancelled = 0;
+    build.is_succeeded = false;
+    build.is_running = true;
+
+    // Without worker threads it's built right away.
+    if (g_job_pool->get_thread_count() == 0 || !g_job_pool->submit(run_build, &build, 0, &build.group))
+        run_build(&build, 0);
+}
+
+bool Name_Index::finish()
+{
+    // Message of a cancelled build can come while the next one is running.
+    if (!build.is_running || !build.is_done)
+        return false;
+
+    g_job_pool->wait(&build.group);
+    build.is_running = false;
+
+    if (build.is_succeeded)
+        indexed_count = build.file_count;
+    else
+        LOG_ERROR(L"Unable to build name index of %d files.\n", build.file_count);
+
+    return true;
+}
+
+void Name_Index::cancel()
+{
+    if (!build.is_running)
+        return;
+
+    InterlockedExchange(&build.is_cancelled, 1);
+    g_job_pool->wait(&build.group);
+    build.is_running = false;
+
+    // Lists may be complete, but they're of files that are about to change.
+    release_postings();
+}
+
+void Name_Index::release()
+{
+    cancel();
+    release_postings();
+}
+
+bool Name_Index::find(const Sequence<File_Info>& files, const String& query, const int* candidates, int candidate_count,
+    Sequence<int>* matches) const
+{
+    E_VERIFY_NULL_R(matches, false);
+    E_VERIFY_R(query.count > 0 && query.count <= max_query_length, false);
+
+    wchar_t folded[max_query_length];
+    for (int i = 0; i < query.count; ++i)
+        folded[i] = String_Simd::fold_char(query.data[i]);
+
+    const bool is_indexed = is_built() && indexed_count == files.count;
+
+    // Candidates are a list like those of trigrams, the shortest one is walked and the others are looked up.
+    const int* lists[max_query_length + 1];
+    int list_counts[max_query_length + 1];
+    int cursors[max_query_length + 1];
+    int list_count = 0;
+    if (candidates != nullptr)
+    {
+        lists[0] = candidates;
+        list_counts[0] = candidate_count;
+        cursors[0] = 0;
+        list_count = 1;
+    }
+
+    if (is_indexed)
+    {
+        for (int i = 0; i + 2 < query.count; ++i)
+        {
+            const int bucket = trigram_bucket(folded[i], folded[i + 1], folded[i + 2]);
+            lists[list_count] = postings + offsets[bucket];
+            list_counts[list_count] = offsets[bucket + 1] - offsets[bucket];
+            cursors[list_count] = 0;
+            ++list_count;
+        }
+    }
+
+    int walked_list = -1;
+    for (int j = 0; j < list_count; ++j)
+    {
+        if (walked_list < 0 || list_counts[j] < list_counts[walked_list])
+            walked_list = j;
+    }
+
+    const int* walked = walked_list >= 0 ? lists[walked_list] : nullptr;
+    const int walked_count = walked_list >= 0 ? list_counts[walked_list] : files.count;
+    if (walked_count == 0)
+        return true;
+
+    // Matches are never more than the walked files. Candidates in 'matches' have room after its end, so
+    // they're not reallocated, and candidates narrowed in place are each written at or before the match.
+    if (!matches->reserve(matches->count + walked_count))
+        return false;
+
+    if (is_indexed && walked == nullptr)
+    {
+        search_names(folded, query.count, matches);
+        return true;
+    }
+
+    int count = matches->count;
+    for (int i = 0; i < walked_count; ++i)
+    {
+        const int index = walked != nullptr ? walked[i] : i;
+        if (index >= files.count)
+            break;
+
+        bool is_match = true;
+        for (int j = 0; j < list_count && is_match; ++j)
+        {
+            if (j != walked_list)
+                is_match = advance_to(lists[j], list_counts[j], &cursors[j], index);
+        }
+
+        if (!is_match)
+            continue;
+
+        if (is_indexed)
+            is_match = contains(names + name_offsets[index], name_offsets[index + 1] - name_offsets[index] - 1, folded, query.count);
+        else
+            is_match = contains_ignore_case(files.data[index].path, folded, query.count);
+
+        if (is_match)
+            matches->data[count++] = index;
+    }
+
+    matches->count = count;
+    return true;
+}
+
+void Name_Index::search_names(const wchar_t* query, int query_length, Sequence<int>* matches) const
+{
+    // Files are found by position of the first code unit, both only go forward.
+    const int end = name_offsets[indexed_count];
+    int position = 0;
+    int file = 0;
+    while (position < end)
+    {
+        const int found = String_Simd::find_char(names + position, end - position, query[0]);
+        if (found < 0)
+            break;
+
+        position += found;
+        while (name_offsets[file + 1] <= position)
+            ++file;
+
+        // Query has no zeros, so it can't match past the end of the name.
+        const int name_end = name_offsets[file + 1] - 1;
+        if (position + query_length <= name_end && memcmp(names + position + 1, query + 1, sizeof(wchar_t) * (query_length - 1)) == 0)
+        {
+            matches->data[matches->count++] = file;
+            position = name_offsets[file + 1];
+        }
+        else
+        {
+            ++position;
+        }
+    }
+}
+
+void Name_Index::release_postings()
+{
+    g_standard_allocator->deallocate(offsets);
+    g_standard_allocator->deallocate(postings);
+    g_standard_allocator->deallocate(names);
+    g_standard_allocator->deallocate(name_offsets);
+    offsets = nullptr;
+    postings = nullptr;
+    names = nullptr;
+    name_offsets = nullptr;
+    indexed_count = 0;
+}
+
+void Name_Index::run_build(void* context, int)
+{
+    Build* build = static_cast<Build*>(context);
+    Name_Index* index = build->index;
+
+    build->is_succeeded = fold_names(build->files, build->file_count, &index->names, &index->name_offsets) &&
+        build_postings(index->names, index->name_offsets, build->file_count, &build->is_cancelled, &index->offsets, &index->postings);
+
+    if (!build->is_cancelled)
+    {
+        InterlockedExchange(&build->is_done, 1);
+        PostMessageW(build->hwnd, build->message, 0, 0);
+    }
+}
+
+bool Name_Matches::find(const Name_Index& index, const Sequence<File_Info>& files, const String& query)
+{
+    E_VERIFY_R(query.count > 0 && query.count <= Name_Index::max_query_length, false);
+
+    // Matches of prefixes that differ are dropped, the stack ends with the longest kept ones left.
+    int length = 0;
+    while (length < query_length && length < query.count && text[length] == query.data[length])
+        ++length;
+
+    int kept = length - 1;
+    while (kept >= 0 && counts[kept] < 0)
+        --kept;
+    stack.count = kept >= 0 ? firsts[kept] + counts[kept] : 0;
+
+    if (kept == query.count - 1)
+    {
+        query_length = query.count;
+        return true;
+    }
+
+    // Candidates are narrowed in place when keeping them would take too much, prefixes that share them
+    // are found again if they're needed.
+    const int candidate_count = kept >= 0 ? counts[kept] : files.count;
+    const bool is_in_place = kept >= 0 && stack.count + candidate_count > max_kept_files * files.count;
+    if (is_in_place)
+    {
+        stack.count = firsts[kept];
+        for (int i = 0; i <= kept; ++i)
+        {
+            if (counts[i] >= 0 && firsts[i] >= stack.count)
+                counts[i] = -1;
+        }
+    }
+    else if (candidate_count > 0 && !stack.reserve(stack.count + candidate_count))
+    {
+        clear();
+        return false;
+    }
+
+    const int first = stack.count;
+    const int* candidates = kept >= 0 ? stack.data + firsts[kept] : nullptr;
+    if (!index.find(files, query, candidates, candidate_count, &stack))
+    {
+        clear();
+        return false;
+    }
+
+    for (int i = length; i < query.count - 1; ++i)
+        counts[i] = -1;
+    memcpy(text + length, query.data + length, sizeof(wchar_t) * (query.count - length));
+    query_length = query.count;
+
+    // Same number of matches are the same files as the candidates.
+    const int last = query.count - 1;
+    if (!is_in_place && kept >= 0 && stack.count - first == candidate_count)
+    {
+        stack.count = first;
+        firsts[last] = firsts[kept];
+    }
+    else
+    {
+        firsts[last] = first;
+    }
+    counts[last] = stack.count - firsts[last];
+
+    return true;
+}
+
+void Name_Matches::clear()
+{
+    stack.count = 0;
+    query_length = 0;
+}
+
+void Name_Matches::release()
+{
+    g_standard_allocator->deallocate(stack.data);
+    stack = Sequence<int>();
+    query_length = 0;
+}
@@ -0,0 +1,100 @@
+#pragma once
+#include <Windows.h>
+
+#include "file_system_utility.hpp"
+#include "sequence.hpp"
+#include "job_pool.hpp"
+
+// Trigram index over names of files of the current folder, so typing a filter doesn't check a million
+// names on every key. Every three consecutive code units of a case folded name are hashed to a bucket,
+// each bucket lists indices of files with such trigram in ascending order. A query walks the shortest
+// of the lists of its trigrams and the matches it narrows, looks its files up in the others and checks
+// the names of those left, so hash collisions are never matched.
+//
+// Folded names are kept back to back in one buffer. Queries shorter than a trigram search the whole
+// buffer for their first code unit instead, which is vectorized.
+//
+// Built on the job pool, queries fold and check every name until it's done. Used from the window thread.
+struct Name_Index
+{
+    static const int bucket_bits = 16;
+    static const int bucket_count = 1 << bucket_bits;
+    static const int max_query_length = 64;
+
+    // Builds index of 'files' on the job pool, a previous one is cancelled. 'message' is posted to 'hwnd'
+    // when it's done, 'finish' must be called then. 'files' must not change until it's finished or cancelled.
+    void start(HWND hwnd, UINT message, const Sequence<File_Info>& files);
+    // Makes the built index used by queries. Returns false if no build was finished.
+    bool finish();
+    // Stops building and waits for it, queries keep checking names.
+    void cancel();
+    void release();
+    inline bool is_running() const { return build.is_running; }
+    inline bool is_built() const { return indexed_count > 0; }
+
+    // Appends ascending indices of 'files' whose names contain 'query' to 'matches', ignoring case. Only
+    // ascending 'candidates' are checked if they're given, matches of a query that this one starts with
+    // narrow it down. 'candidates' can be in 'matches', which must have room for as many after its end then.
+    bool find(const Sequence<File_Info>& files, const String& query, const int* candidates, int candidate_count,
+        Sequence<int>* matches) const;
+
+private:
+    struct Build
+    {
+        Job_Group group;
+        Name_Index* index = nullptr;
+        HWND hwnd = 0;
+        UINT message = 0;
+        const File_Info* files = nullptr;
+        int file_count = 0;
+        // Set by the job before it posts the message, message of a cancelled build is ignored.
+        volatile LONG is_done = 0;
+        volatile LONG is_cancelled = 0;
+        bool is_succeeded = false;
+        bool is_running = false;
+    };
+
+    Build build;
+
+    // Files of bucket 'b' are postings[offsets[b]] up to postings[offsets[b + 1]].
+    int* offsets = nullptr;
+    int* postings = nullptr;
+    // Folded name of file 'i' starts at names[name_offsets[i]] and ends with a zero.
+    wchar_t* names = nullptr;
+    int* name_offsets = nullptr;
+    // Zero until 'finish', the arrays are written by the build before.
+    int indexed_count = 0;
+
+    // Adds files whose folded names contain 'query' to 'matches', which must have room for all files.
+    void search_names(const wchar_t* query, int query_length, Sequence<int>* matches) const;
+    void release_postings();
+    static void run_build(void* context, int);
+};
+
+// Matches of each prefix of a filter as it's typed, so Backspace goes back to the ones before without a
+// search. Matches of a prefix are found among those of the shorter one and kept after them in one buffer,
+// prefixes with as many matches share them. When it would hold more than 'max_kept_files' times the files,
+// the last matches are narrowed in place and found again from a shorter prefix if they're needed.
+struct Name_Matches
+{
+    static const int max_kept_files = 2;
+
+    // Finds matches of 'query' among those of the longest prefix it shares with the previous queries.
+    bool find(const Name_Index& index, const Sequence<File_Info>& files, const String& query);
+    // Forgets matches of all prefixes, e.g. after files change.
+    void clear();
+    void release();
+
+    // Ascending indices of files matching the last query.
+    inline const int* get_data() const { return query_length > 0 ? stack.data + firsts[query_length - 1] : nullptr; }
+    inline int get_count() const { return query_length > 0 ? counts[query_length - 1] : 0; }
+
+private:
+    Sequence<int> stack;
+    // Matches of prefix of length 'i + 1' are 'counts[i]' from stack.data[firsts[i]], count is -1 when
+    // they were narrowed. The stack ends with the last kept ones.
+    int firsts[Name_Index::max_query_length];
+    int counts[Name_Index::max_query_length];
+    wchar_t text[Name_Index::max_query_length];
+    int query_length = 0;
+};
@@ -0,0 +1,862 @@
+#include <Windows.h>
+#include <string.h>
+
+#include "pixel_conversion.hpp"
+#include "cpu_features.hpp"
+#include "com_utility.hpp"
+#include "allocator.hpp"
+#include "defer.hpp"
+#include "error.hpp"
+
+#if CPU_X86
+    #include <intrin.h>
+    #include <immintrin.h>
+#elif CPU_ARM
+    #include <arm_neon.h>
+#endif
+
+// Rows are read from the source into temporary buffer of about this size.
+static const UINT strip_buffer_size = 256 * 1024;
+
+typedef void (*Convert_Row_Func)(const BYTE* source, UINT32* destination, int width, const UINT32* palette);
+
+
+// Same as round(value / 257), maps 0..65535 to 0..255.
+static inline UINT32 narrow_16_to_8(UINT32 value)
+{
+    return (value * 255 + 32895) >> 16;
+}
+
+// Same as round(color * alpha / 255).
+static inline UINT32 premultiply_channel(UINT32 color, UINT32 alpha)
+{
+    UINT32 t = color * alpha + 128;
+    return (t + (t >> 8)) >> 8;
+}
+
+static inline UINT32 premultiply_pixel(UINT32 pixel)
+{
+    UINT32 a = pixel >> 24;
+    if (a == 0xFF)
+        return pixel;
+
+    UINT32 r = premultiply_channel((pixel >> 16) & 0xFF, a);
+    UINT32 g = premultiply_channel((pixel >> 8)  & 0xFF, a);
+    UINT32 b = premultiply_channel(pixel & 0xFF, a);
+
+    return (a << 24) | (r << 16) | (g << 8) | b;
+}
+
+#pragma region Scalar
+template<int Bytes_Per_Channel>
+static inline UINT32 load_channel(const BYTE* pixel, int index);
+
+template<>
+inline UINT32 load_channel<1>(const BYTE* pixel, int index)
+{
+    return pixel[index];
+}
+
+template<>
+inline UINT32 load_channel<2>(const BYTE* pixel, int index)
+{
+    return narrow_16_to_8(pixel[index * 2] | (pixel[index * 2 + 1] << 8));
+}
+
+// R, G, B and A are indices of channels in the source pixel, A is -1 if there's no alpha channel.
+template<int Bytes_Per_Channel, int Channels, int R, int G, int B, int A, bool Premultiply>
+static void convert_row_scalar(const BYTE* source, UINT32* destination, int width, const UINT32* palette)
+{
+    const int bytes_per_pixel = Bytes_Per_Channel * Channels;
+
+    for (int i = 0; i < width; ++i, source += bytes_per_pixel)
+    {
+        UINT32 r = load_channel<Bytes_Per_Channel>(source, R);
+        UINT32 g = load_channel<Bytes_Per_Channel>(source, G);
+        UINT32 b = load_channel<Bytes_Per_Channel>(source, B);
+        UINT32 a = A >= 0 ? load_channel<Bytes_Per_Channel>(source, A) : 0xFF;
+
+        UINT32 pixel = (a << 24) | (r << 16) | (g << 8) | b;
+        destination[i] = Premultiply ? premultiply_pixel(pixel) : pixel;
+    }
+}
+
+static void copy_row_scalar(const BYTE* source, UINT32* destination, int width, const UINT32* palette)
+{
+    memcpy(destination, source, sizeof(UINT32) * width);
+}
+
+// Indices are packed starting from the most significant bit.
+template<int Bits>
+static void convert_indexed_row_scalar(const BYTE* source, UINT32* destination, int width, const UINT32* palette)
+{
+    const int indices_per_byte = 8 / Bits;
+    const int index_mask = (1 << Bits) - 1;
+
+    for (int i = 0; i < width; ++i)
+    {
+        int shift = 8 - Bits - (i % indices_per_byte) * Bits;
+        destination[i] = palette[(source[i / indices_per_byte] >> shift) & index_mask];
+    }
+}
+
+#define convert_prgba32_scalar convert_row_scalar<1, 4, 0, 1, 2, 3, false>
+#define convert_bgra32_scalar  convert_row_scalar<1, 4, 2, 1, 0, 3, true>
+#define convert_rgba32_scalar  convert_row_scalar<1, 4, 0, 1, 2, 3, true>
+#define convert_bgr32_scalar   convert_row_scalar<1, 4, 2, 1, 0, -1, false>
+#define convert_rgb32_scalar   convert_row_scalar<1, 4, 0, 1, 2, -1, false>
+#define convert_bgr24_scalar   convert_row_scalar<1, 3, 2, 1, 0, -1, false>
+#define convert_rgb24_scalar   convert_row_scalar<1, 3, 0, 1, 2, -1, false>
+#define convert_gray8_scalar   convert_row_scalar<1, 1, 0, 0, 0, -1, false>
+#define convert_gray16_scalar  convert_row_scalar<2, 1, 0, 0, 0, -1, false>
+#define convert_bgr48_scalar   convert_row_scalar<2, 3, 2, 1, 0, -1, false>
+#define convert_rgb48_scalar   convert_row_scalar<2, 3, 0, 1, 2, -1, false>
+#define convert_bgra64_scalar  convert_row_scalar<2, 4, 2, 1, 0, 3, true>
+#define convert_rgba64_scalar  convert_row_scalar<2, 4, 0, 1, 2, 3, true>
+#pragma endregion
+
+#if CPU_X86
+#pragma region SSSE3
+// Shuffles that move channels of 4 source pixels to BGRA order, -1 zeroes the byte.
+#define SHUFFLE_BGRA_TO_BGRA  _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15)
+#define SHUFFLE_RGBA_TO_BGRA  _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15)
+#define SHUFFLE_BGRX_TO_BGRA  _mm_setr_epi8(0, 1, 2, -1, 4, 5, 6, -1, 8, 9, 10, -1, 12, 13, 14, -1)
+#define SHUFFLE_RGBX_TO_BGRA  _mm_setr_epi8(2, 1, 0, -1, 6, 5, 4, -1, 10, 9, 8, -1, 14, 13, 12, -1)
+#define SHUFFLE_BGR_TO_BGRA   _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1)
+#define SHUFFLE_RGB_TO_BGRA   _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1)
+
+static inline __m128i premultiply_ssse3(__m128i pixels)
+{
+    const __m128i alpha_mask = _mm_set1_epi32(0xFF000000);
+
+    // Most pixels are opaque even in images with alpha channel.
+    __m128i opaque = _mm_cmpeq_epi32(_mm_or_si128(pixels, _mm_set1_epi32(0x00FFFFFF)), _mm_set1_epi32(-1));
+    if (_mm_movemask_epi8(opaque) == 0xFFFF)
+        return pixels;
+
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i bias = _mm_set1_epi16(128);
+    // Alpha of each pixel widened to 16 bits and repeated for B, G and R, alpha itself is multiplied by zero.
+    const __m128i alpha_lo_shuffle = _mm_setr_epi8(3, -1, 3, -1, 3, -1, -1, -1, 7, -1, 7, -1, 7, -1, -1, -1);
+    const __m128i alpha_hi_shuffle = _mm_setr_epi8(11, -1, 11, -1, 11, -1, -1, -1, 15, -1, 15, -1, 15, -1, -1, -1);
+
+    __m128i lo = _mm_mullo_epi16(_mm_unpacklo_epi8(pixels, zero), _mm_shuffle_epi8(pixels, alpha_lo_shuffle));
+    __m128i hi = _mm_mullo_epi16(_mm_unpackhi_epi8(pixels, zero), _mm_shuffle_epi8(pixels, alpha_hi_shuffle));
+
+    lo = _mm_add_epi16(lo, bias);
+    hi = _mm_add_epi16(hi, bias);
+    lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+    hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+
+    return _mm_or_si128(_mm_packus_epi16(lo, hi), _mm_and_si128(pixels, alpha_mask));
+}
+
+// Converts 8 16-bit values to 8-bit values that are still stored as 16-bit.
+static inline __m128i narrow_16_to_8_sse2(__m128i values)
+{
+    const __m128i multiplier = _mm_set1_epi16(255);
+
+    // (value * 255 + 32895) >> 16, carry out of the low half is added separately.
+    __m128i lo = _mm_mullo_epi16(values, multiplier);
+    __m128i hi = _mm_mulhi_epu16(values, multiplier);
+    __m128i no_carry = _mm_cmpeq_epi16(_mm_subs_epu16(lo, _mm_set1_epi16(32640)), _mm_setzero_si128());
+
+    return _mm_add_epi16(_mm_add_epi16(hi, _mm_set1_epi16(1)), no_carry);
+}
+
+// Returns amount of pixels converted, the rest must be converted by scalar kernel.
+template<int Bytes_Per_Pixel, bool Premultiply>
+static inline int shuffle_row_ssse3(const BYTE* source, UINT32* destination, int width, __m128i shuffle, __m128i alpha)
+{
+    // Each iteration loads 16 bytes, which is more than 4 pixels for 24-bit layouts.
+    const int pixels_loaded = (16 + Bytes_Per_Pixel - 1) / Bytes_Per_Pixel;
+
+    int i = 0;
+    for (; i + pixels_loaded <= width; i += 4)
+    {
+        __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i * Bytes_Per_Pixel));
+        pixels = _mm_or_si128(_mm_shuffle_epi8(pixels, shuffle), alpha);
+        if (Premultiply)
+            pixels = premultiply_ssse3(pixels);
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + i), pixels);
+    }
+
+    return i;
+}
+
+// Same as 'shuffle_row_ssse3', but source channels are 16-bit.
+template<int Channels, bool Premultiply>
+static inline int shuffle_row_16_ssse3(const BYTE* source, UINT32* destination, int width, __m128i shuffle, __m128i alpha)
+{
+    const __m128i zero = _mm_setzero_si128();
+
+    int i = 0;
+    for (; i + 4 <= width; i += 4)
+    {
+        const BYTE* p = source + i * Channels * 2;
+        __m128i first = narrow_16_to_8_sse2(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+        // 4 pixels with 3 channels are 24 bytes, don't read past them.
+        __m128i second = Channels == 4
+            ? _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 16))
+            : _mm_loadl_epi64(reinterpret_cast<const __m128i*>(p + 16));
+        second = narrow_16_to_8_sse2(second);
+
+        __m128i pixels = _mm_or_si128(_mm_shuffle_epi8(_mm_packus_epi16(first, second), shuffle), alpha);
+        if (Premultiply)
+            pixels = premultiply_ssse3(pixels);
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + i), pixels);
+    }
+
+    return i;
+}
+
+// Expands 16 gray values to 16 opaque pixels.
+static inline void store_gray_sse2(UINT32* destination, __m128i gray)
+{
+    const __m128i alpha = _mm_set1_epi32(0xFF000000);
+
+    __m128i lo = _mm_unpacklo_epi8(gray, gray);
+    __m128i hi = _mm_unpackhi_epi8(gray, gray);
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + 0),  _mm_or_si128(_mm_unpacklo_epi16(lo, lo), alpha));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + 4),  _mm_or_si128(_mm_unpackhi_epi16(lo, lo), alpha));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + 8),  _mm_or_si128(_mm_unpacklo_epi16(hi, hi), alpha));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + 12), _mm_or_si128(_mm_unpackhi_epi16(hi, hi), alpha));
+}
+
+static void convert_prgba32_ssse3(const BYTE* source, UINT32* destination, int width, const UINT32* palette)
+{
+    int i = shuffle_row_ssse3<4, false>(source, destination, width, SHUFFLE_RGBA_TO_BGRA, _mm_setzero_si128());
+    convert_prgba32_scalar(source + i * 4, destination + i, width - i, palette);
+}
+
+static void convert_bgra32_ssse3(const BYTE* source, UINT32* destination, int width, const UINT32* palette)
+{
+    int i = shuffle_row_ssse3<4, true>(source, destination, width, SHUFFLE_BGRA_TO_BGRA, _mm_setzero_si128());
+    convert_bgra32_scalar(source + i * 4, destination + i, width - i, palette);
+}
+
+static void convert_rgba32_ssse3(const BYTE* source, UINT32* destination, int width, const UINT32* palette)
+{
+    int i = shuffle_row_ssse3<4, true>(source, destination, width, SHUFFLE_RGBA_TO_BGRA, _mm_setzero_si128());
+    convert_rgba32_scalar(source + i * 4, destination + i, width - i, palette);
+}
+
+static void convert_bgr32_ssse3(const BYTE* source, UINT32* destination, int width, const UINT32* palette)
+{
+    int i = shuffle_row_ssse3<4, false>(source, destination, width, SHUFFLE_BGRX_TO_BGRA, _mm_set1_epi32(0xFF000000));
+    convert_bgr32_scalar(source + i * 4, destination + i, width - i, palette);
+}
+
+static void convert_rgb32_ssse3(const BYTE* source, UINT32* destination, int width, const UINT32* palette)
+{
+    int i = shuffle_row_ssse3<4, false>(source, destination, width, SHUFFLE_RGBX_TO_BGRA, _mm_set1_epi32(0xFF000000));
+    convert_rgb32_scalar(source + i * 4, destination + i, width - i, palette);
+}
+
+static void convert_bgr24_ssse3(const BYTE* source, UINT32* destination, int width, const UINT32* palette)
+{
+    int i = shuffle_row_ssse3<3, false>(source, destination, width, SHUFFLE_BGR_TO_BGRA, _mm_set1_epi32(0xFF000000));
+    convert_bgr24_scalar(source + i * 3, destination + i, width - i, palette);
+}
+
+static void convert_rgb24_ssse3(const BYTE* source, UINT32* destination, int width, const UINT32* palette)
+{
+    int i = shuffle_row_ssse3<3, false>(source, destination, width, SHUFFLE_RGB_TO_BGRA, _mm_set1_epi32(0xFF000000));
+    convert_rgb24_scalar(source + i * 3, destination + i, width - i, palette);
+}
+
+static void convert_bgr48_ssse3(const BYTE* source, UINT32* destination, int width, const UINT32* palette)
+{
+    int i = shuffle_row_16_ssse3<3, false>(source, destination, width, SHUFFLE_BGR_TO_BGRA, _mm_set1_epi32(0xFF000000));
+    convert_bgr48_scalar(source + i * 6, destination + i, width - i, palette);
+}
+
+static void convert_rgb48_ssse3(const BYTE* source, UINT32* destination, int width, const UINT32* palette)
+{
+    int i = shuffle_row_16_ssse3<3, false>(source, destination, width, SHUFFLE_RGB_TO_BGRA, _mm_set1_epi32(0xFF000000));
+    convert_rgb48_scalar(source + i * 6, destination + i, width - i, palette);
+}
+
+static void convert_bgra64_ssse3(const BYTE* source, UINT32* destination, int width, const UINT32* palette)
+{
+    int i = shuffle_row_16_ssse3<4, true>(source, destination, width, SHUFFLE_BGRA_TO_BGRA, _mm_setzero_si128());
+    convert_bgra64_scalar(source + i * 8, destination + i, width - i, palette);
+}
+
+static void convert_rgba64_ssse3(const BYTE* source, UINT32* destination, int width, const UINT32* palette)
+{
+    int i = shuffle_row_16_ssse3<4, true>(source, destination, width, SHUFFLE_RGBA_TO_BGRA, _mm_setzero_si128());
+    convert_rgba64_scalar(source + i * 8, destination + i, width - i, palette);
+}
+
+static void convert_gray8_ssse3(const BYTE* source, UINT32* destination, int width, const UINT32* palette)
+{
+    int i = 0;
+    for (; i + 16 <= width; i += 16)
+        store_gray_sse2(destination + i, _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i)));
+
+    convert_gray8_scalar(source + i, destination + i, width - i, palette);
+}
+
+static void convert_gray16_ssse3(const BYTE* source, UINT32* destination, int width, const UINT32* palette)
+{
+    int i = 0;
+    for (; i + 16 <= width; i += 16)
+    {
+        __m128i first  = narrow_16_to_8_sse2(_mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i * 2)));
+        __m128i second = narrow_16_to_8_sse2(_mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i * 2 + 16)));
+        store_gray_sse2(destination + i, _mm_packus_epi16(first, second));
+    }
+
+    convert_gray16_scalar(source + i * 2, destination + i, width - i, palette);
+}
+#pragma endregion
+
+#pragma region AVX2
+static inline __m256i premultiply_avx2(__m256i pixels)
+{
+    const __m256i alpha_mask = _mm256_set1_epi32(0xFF000000);
+
+    __m256i opaque = _mm256_cmpeq_epi32(_mm256_or_si256(pixels, _mm256_set1_epi32(0x00FFFFFF)), _mm256_set1_epi32(-1));
+    if (_mm256_movemask_epi8(opaque) == -1)
+        return pixels;
+
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i bias = _mm256_set1_epi16(128);
+    const __m256i alpha_lo_shuffle = _mm256_setr_epi8(
+        3, -1, 3, -1, 3, -1, -1, -1, 7, -1, 7, -1, 7, -1, -1, -1,
+        3, -1, 3, -1, 3, -1, -1, -1, 7, -1, 7, -1, 7, -1, -1, -1);
+    const __m256i alpha_hi_shuffle = _mm256_setr_epi8(
+        11, -1, 11, -1, 11, -1, -1, -1, 15, -1, 15, -1, 15, -1, -1, -1,
+        11, -1, 11, -1, 11, -1, -1, -1, 15, -1, 15, -1, 15, -1, -1, -1);
+
+    // Unpack and pack work within 128-bit lanes, so pixel order is preserved.
+    __m256i lo = _mm256_mullo_epi16(_mm256_unpacklo_epi8(pixels, zero), _mm256_shuffle_epi8(pixels, alpha_lo_shuffle));
+    __m256i hi = _mm256_mullo_epi16(_mm256_unpackhi_epi8(pixels, zero), _mm256_shuffle_epi8(pixels, alpha_hi_shuffle));
+
+    lo = _mm256_add_epi16(lo, bias);
+    hi = _mm256_add_epi16(hi, bias);
+    lo = _mm256_srli_epi16(_mm256_add_epi16(lo, _mm256_srli_epi16(lo, 8)), 8);
+    hi = _mm256_srli_epi16(_mm256_add_epi16(hi, _mm256_srli_epi16(hi, 8)), 8);
+
+    return _mm256_or_si256(_mm256_packus_epi16(lo, hi), _mm256_and_si256(pixels, alpha_mask));
+}
+
+// Same as 'shuffle_row_ssse3', 'shuffle' is applied to 4 pixels in each 128-bit lane.
+template<int Bytes_Per_Pixel, bool Premultiply>
+static inline int shuffle_row_avx2(const BYTE* source, UINT32* destination, int width, __m128i shuffle, __m128i alpha)
+{
+    // Second lane loads 16 bytes starting from 5th pixel.
+    const int pixels_loaded = (4 * Bytes_Per_Pixel + 16 + Bytes_Per_Pixel - 1) / Bytes_Per_Pixel;
+
+    const __m256i shuffle_x2 = _mm256_broadcastsi128_si256(shuffle);
+    const __m256i alpha_x2   = _mm256_broadcastsi128_si256(alpha);
+
+    int i = 0;
+    for (; i + pixels_loaded <= width; i += 8)
+    {
+        const BYTE* p = source + i * Bytes_Per_Pixel;
+        __m256i pixels = _mm256_inserti128_si256(
+            _mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p))),
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 4 * Bytes_Per_Pixel)), 1);
+
+        pixels = _mm256_or_si256(_mm256_shuffle_epi8(pixels, shuffle_x2), alpha_x2);
+        if (Premultiply)
+            pixels = premultiply_avx2(pixels);
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(destination + i), pixels);
+    }
+
+    _mm256_zeroupper();
+    return i;
+}
+
+static void convert_prgba32_avx2(const BYTE* source, UINT32* destination, int width, const UINT32* palette)
+{
+    int i = shuffle_row_avx2<4, false>(source, destination, width, SHUFFLE_RGBA_TO_BGRA, _mm_setzero_si128());
+    convert_prgba32_scalar(source + i * 4, destination + i, width - i, palette);
+}
+
+static void convert_bgra32_avx2(const BYTE* source, UINT32* destination, int width, const UINT32* palette)
+{
+    int i = shuffle_row_avx2<4, true>(source, destination, width, SHUFFLE_BGRA_TO_BGRA, _mm_setzero_si128());
+    convert_bgra32_scalar(source + i * 4, destination + i, width - i, palette);
+}
+
+static void convert_rgba32_avx2(const BYTE* source, UINT32* destination, int width, const UINT32* palette)
+{
+    int i = shuffle_row_avx2<4, true>(source, destination, width, SHUFFLE_RGBA_TO_BGRA, _mm_setzero_si128());
+    convert_rgba32_scalar(source + i * 4, destination + i, width - i, palette);
+}
+
+static void convert_bgr32_avx2(const BYTE* source, UINT32* destination, int width, const UINT32* palette)
+{
+    int i = shuffle_row_avx2<4, false>(source, destination, width, SHUFFLE_BGRX_TO_BGRA, _mm_set1_epi32(0xFF000000));
+    convert_bgr32_scalar(source + i * 4, destination + i, width - i, palette);
+}
+
+static void convert_rgb32_avx2(const BYTE* source, UINT32* destination, int width, const UINT32* palette)
+{
+    int i = shuffle_row_avx2<4, false>(source, destination, width, SHUFFLE_RGBX_TO_BGRA, _mm_set1_epi32(0xFF000000));
+    convert_rgb32_scalar(source + i * 4, destination + i, width - i, palette);
+}
+
+static void convert_bgr24_avx2(const BYTE* source, UINT32* destination, int width, const UINT32* palette)
+{
+    int i = shuffle_row_avx2<3, false>(source, destination, width, SHUFFLE_BGR_TO_BGRA, _mm_set1_epi32(0xFF000000));
+    convert_bgr24_scalar(source + i * 3, destination + i, width - i, palette);
+}
+
+static void convert_rgb24_avx2(const BYTE* source, UINT32* destination, int width, const UINT32* palette)
+{
+    int i = shuffle_row_avx2<3, false>(source, destination, width, SHUFFLE_RGB_TO_BGRA, _mm_set1_epi32(0xFF000000));
+    convert_rgb24_scalar(source + i * 3, destination + i, width - i, palette);
+}
+
+static void convert_gray8_avx2(const BYTE* source, UINT32* destination, int width, const UINT32* palette)
+{
+    const __m256i shuffle = _mm256_setr_epi8(
+        0, 0, 0, -1, 1, 1, 1, -1, 2, 2, 2, -1, 3, 3, 3, -1,
+        4, 4, 4, -1, 5, 5, 5, -1, 6, 6, 6, -1, 7, 7, 7, -1);
+    const __m256i alpha = _mm256_set1_epi32(0xFF000000);
+
+    int i = 0;
+    for (; i + 8 <= width; i += 8)
+    {
+        __m256i gray = _mm256_broadcastsi128_si256(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(source + i)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(destination + i), _mm256_or_si256(_mm256_shuffle_epi8(gray, shuffle), alpha));
+    }
+
+    _mm256_zeroupper();
+    convert_gray8_scalar(source + i, destination + i, width - i, palette);
+}
+
+static void convert_indexed8_avx2(const BYTE* source, UINT32* destination, int width, const UINT32* palette)
+{
+    int i = 0;
+    for (; i + 8 <= width; i += 8)
+    {
+        __m256i indices = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(source + i)));
+        __m256i pixels = _mm256_i32gather_epi32(reinterpret_cast<const int*>(palette), indices, 4);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(destination + i), pixels);
+    }
+
+    _mm256_zeroupper();
+    convert_indexed_row_scalar<8>(source + i, destination + i, width - i, palette);
+}
+#pragma endregion
+#endif
+
+#if CPU_ARM
+#pragma region NEON
+// Same as round(color * alpha / 255) for 8 channels.
+static inline uint8x8_t premultiply_neon(uint8x8_t color, uint8x8_t alpha)
+{
+    uint16x8_t t = vmull_u8(color, alpha);
+    return vraddhn_u16(t, vrshrq_n_u16(t, 8));
+}
+
+static inline uint8x16_t premultiply_neon(uint8x16_t color, uint8x16_t alpha)
+{
+    return vcombine_u8(
+        premultiply_neon(vget_low_u8(color),  vget_low_u8(alpha)),
+        premultiply_neon(vget_high_u8(color), vget_high_u8(alpha)));
+}
+
+// R, G, B and A are indices of channels in the source pixel, A is -1 if there's no alpha channel.
+template<int Channels, int R, int G, int B, int A, bool Premultiply>
+static inline int convert_row_neon(const BYTE* source, UINT32* destination, int width)
+{
+    int i = 0;
+    for (; i + 16 <= width; i += 16)
+    {
+        uint8x16_t channels[4];
+        if (Channels == 4)
+        {
+            uint8x16x4_t loaded = vld4q_u8(source + i * 4);
+            channels[0] = loaded.val[0]; channels[1] = loaded.val[1];
+            channels[2] = loaded.val[2]; channels[3] = loaded.val[3];
+        }
+        else
+        {
+            uint8x16x3_t loaded = vld3q_u8(source + i * 3);
+            channels[0] = loaded.val[0]; channels[1] = loaded.val[1];
+            channels[2] = loaded.val[2]; channels[3] = vdupq_n_u8(0xFF);
+        }
+
+        uint8x16x4_t pixels;
+        pixels.val[0] = channels[B];
+        pixels.val[1] = channels[G];
+        pixels.val[2] = channels[R];
+        pixels.val[3] = A >= 0 ? channels[A >= 0 ? A : 3] : vdupq_n_u8(0xFF);
+
+        if (Premultiply)
+        {
+            pixels.val[0] = premultiply_neon(pixels.val[0], pixels.val[3]);
+            pixels.val[1] = premultiply_neon(pixels.val[1], pixels.val[3]);
+            pixels.val[2] = premultiply_neon(pixels.val[2], pixels.val[3]);
+        }
+
+        vst4q_u8(reinterpret_cast<uint8_t*>(destination + i), pixels);
+    }
+
+    return i;
+}
+
+static void convert_prgba32_neon(const BYTE* source, UINT32* destination, int width, const UINT32* palette)
+{
+    int i = convert_row_neon<4, 0, 1, 2, 3, false>(source, destination, width);
+    convert_prgba32_scalar(source + i * 4, destination + i, width - i, palette);
+}
+
+static void convert_bgra32_neon(const BYTE* source, UINT32* destination, int width, const UINT32* palette)
+{
+    int i = convert_row_neon<4, 2, 1, 0, 3, true>(source, destination, width);
+    convert_bgra32_scalar(source + i * 4, destination + i, width - i, palette);
+}
+
+static void convert_rgba32_neon(const BYTE* source, UINT32* destination, int width, const UINT32* palette)
+{
+    int i = convert_row_neon<4, 0, 1, 2, 3, true>(source, destination, width);
+    convert_rgba32_scalar(source + i * 4, destination + i, width - i, palette);
+}
+
+static void convert_bgr32_neon(const BYTE* source, UINT32* destination, int width, const UINT32* palette)
+{
+    int i = convert_row_neon<4, 2, 1, 0, -1, false>(source, destination, width);
+    convert_bgr32_scalar(source + i * 4, destination + i, width - i, palette);
+}
+
+static void convert_rgb32_neon(const BYTE* source, UINT32* destination, int width, const UINT32* palette)
+{
+    int i = convert_row_neon<4, 0, 1, 2, -1, false>(source, destination, width);
+    convert_rgb32_scalar(source + i * 4, destination + i, width - i, palette);
+}
+
+static void convert_bgr24_neon(const BYTE* source, UINT32* destination, int width, const UINT32* palette)
+{
+    int i = convert_row_neon<3, 2, 1, 0, -1, false>(source, destination, width);
+    convert_bgr24_scalar(source + i * 3, destination + i, width - i, palette);
+}
+
+static void convert_rgb24_neon(const BYTE* source, UINT32* destination, int width, const UINT32* palette)
+{
+    int i = convert_row_neon<3, 0, 1, 2, -1, false>(source, destination, width);
+    convert_rgb24_scalar(source + i * 3, destination + i, width - i, palette);
+}
+
+static void convert_gray8_neon(const BYTE* source, UINT32* destination, int width, const UINT32* palette)
+{
+    int i = 0;
+    for (; i + 16 <= width; i += 16)
+    {
+        uint8x16_t gray = vld1q_u8(source + i);
+
+        uint8x16x4_t pixels;
+        pixels.val[0] = gray;
+        pixels.val[1] = gray;
+        pixels.val[2] = gray;
+        pixels.val[3] = vdupq_n_u8(0xFF);
+
+        vst4q_u8(reinterpret_cast<uint8_t*>(destination + i), pixels);
+    }
+
+    convert_gray8_scalar(source + i, destination + i, width - i, palette);
+}
+#pragma endregion
+#endif
+
+struct Pixel_Kernels
+{
+    Convert_Row_Func convert_row[static_cast<int>(Pixel_Layout::NUM_LAYOUTS)];
+
+    inline void set(Pixel_Layout layout, Convert_Row_Func func) {
+        convert_row[static_cast<int>(layout)] = func;
+    }
+};
+
+static Pixel_Kernels select_kernels()
+{
+    Pixel_Kernels k;
+    k.set(Pixel_Layout::Unknown,  nullptr);
+    k.set(Pixel_Layout::Pbgra32,  copy_row_scalar);
+    k.set(Pixel_Layout::Prgba32,  convert_prgba32_scalar);
+    k.set(Pixel_Layout::Bgra32,   convert_bgra32_scalar);
+    k.set(Pixel_Layout::Rgba32,   convert_rgba32_scalar);
+    k.set(Pixel_Layout::Bgr32,    convert_bgr32_scalar);
+    k.set(Pixel_Layout::Rgb32,    convert_rgb32_scalar);
+    k.set(Pixel_Layout::Bgr24,    convert_bgr24_scalar);
+    k.set(Pixel_Layout::Rgb24,    convert_rgb24_scalar);
+    k.set(Pixel_Layout::Gray8,    convert_gray8_scalar);
+    k.set(Pixel_Layout::Gray16,   convert_gray16_scalar);
+    k.set(Pixel_Layout::Bgr48,    convert_bgr48_scalar);
+    k.set(Pixel_Layout::Rgb48,    convert_rgb48_scalar);
+    k.set(Pixel_Layout::Bgra64,   convert_bgra64_scalar);
+    k.set(Pixel_Layout::Rgba64,   convert_rgba64_scalar);
+    k.set(Pixel_Layout::Indexed1, convert_indexed_row_scalar<1>);
+    k.set(Pixel_Layout::Indexed2, convert_indexed_row_scalar<2>);
+    k.set(Pixel_Layout::Indexed4, convert_indexed_row_scalar<4>);
+    k.set(Pixel_Layout::Indexed8, convert_indexed_row_scalar<8>);
+
+#if CPU_X86
+    if (g_cpu_features.has_ssse3)
+    {
+        k.set(Pixel_Layout::Prgba32, convert_prgba32_ssse3);
+        k.set(Pixel_Layout::Bgra32,  convert_bgra32_ssse3);
+        k.set(Pixel_Layout::Rgba32,  convert_rgba32_ssse3);
+        k.set(Pixel_Layout::Bgr32,   convert_bgr32_ssse3);
+        k.set(Pixel_Layout::Rgb32,   convert_rgb32_ssse3);
+        k.set(Pixel_Layout::Bgr24,   convert_bgr24_ssse3);
+        k.set(Pixel_Layout::Rgb24,   convert_rgb24_ssse3);
+        k.set(Pixel_Layout::Gray8,   convert_gray8_ssse3);
+        k.set(Pixel_Layout::Gray16,  convert_gray16_ssse3);
+        k.set(Pixel_Layout::Bgr48,   convert_bgr48_ssse3);
+        k.set(Pixel_Layout::Rgb48,   convert_rgb48_ssse3);
+        k.set(Pixel_Layout::Bgra64,  convert_bgra64_ssse3);
+        k.set(Pixel_Layout::Rgba64,  convert_rgba64_ssse3);
+    }
+
+    // 16-bit layouts are bound by loads and narrowing, 128-bit kernels are kept for them.
+    if (g_cpu_features.has_avx2)
+    {
+        k.set(Pixel_Layout::Prgba32,  convert_prgba32_avx2);
+        k.set(Pixel_Layout::Bgra32,   convert_bgra32_avx2);
+        k.set(Pixel_Layout::Rgba32,   convert_rgba32_avx2);
+        k.set(Pixel_Layout::Bgr32,    convert_bgr32_avx2);
+        k.set(Pixel_Layout::Rgb32,    convert_rgb32_avx2);
+        k.set(Pixel_Layout::Bgr24,    convert_bgr24_avx2);
+        k.set(Pixel_Layout::Rgb24,    convert_rgb24_avx2);
+        k.set(Pixel_Layout::Gray8,    convert_gray8_avx2);
+        k.set(Pixel_Layout::Indexed8, convert_indexed8_avx2);
+    }
+#elif CPU_ARM
+    if (g_cpu_features.has_neon)
+    {
+        k.set(Pixel_Layout::Prgba32, convert_prgba32_neon);
+        k.set(Pixel_Layout::Bgra32,  convert_bgra32_neon);
+        k.set(Pixel_Layout::Rgba32,  convert_rgba32_neon);
+        k.set(Pixel_Layout::Bgr32,   convert_bgr32_neon);
+        k.set(Pixel_Layout::Rgb32,   convert_rgb32_neon);
+        k.set(Pixel_Layout::Bgr24,   convert_bgr24_neon);
+        k.set(Pixel_Layout::Rgb24,   convert_rgb24_neon);
+        k.set(Pixel_Layout::Gray8,   convert_gray8_neon);
+    }
+#endif
+
+    return k;
+}
+
+static const Pixel_Kernels& get_kernels()
+{
+    static const Pixel_Kernels kernels = select_kernels();
+    return kernels;
+}
+
+Pixel_Layout Pixel_Conversion::layout_from_wic_format(const WICPixelFormatGUID& format)
+{
+    struct Format_Layout
+    {
+        const WICPixelFormatGUID* format;
+        Pixel_Layout layout;
+    };
+
+    static const Format_Layout format_layouts[] =
+    {
+        { &GUID_WICPixelFormat32bppPBGRA,   Pixel_Layout::Pbgra32 },
+        { &GUID_WICPixelFormat32bppPRGBA,   Pixel_Layout::Prgba32 },
+        { &GUID_WICPixelFormat32bppBGRA,    Pixel_Layout::Bgra32 },
+        { &GUID_WICPixelFormat32bppRGBA,    Pixel_Layout::Rgba32 },
+        { &GUID_WICPixelFormat32bppBGR,     Pixel_Layout::Bgr32 },
+        { &GUID_WICPixelFormat32bppRGB,     Pixel_Layout::Rgb32 },
+        { &GUID_WICPixelFormat24bppBGR,     Pixel_Layout::Bgr24 },
+        { &GUID_WICPixelFormat24bppRGB,     Pixel_Layout::Rgb24 },
+        { &GUID_WICPixelFormat8bppGray,     Pixel_Layout::Gray8 },
+        { &GUID_WICPixelFormat16bppGray,    Pixel_Layout::Gray16 },
+        { &GUID_WICPixelFormat48bppBGR,     Pixel_Layout::Bgr48 },
+        { &GUID_WICPixelFormat48bppRGB,     Pixel_Layout::Rgb48 },
+        { &GUID_WICPixelFormat64bppBGRA,    Pixel_Layout::Bgra64 },
+        { &GUID_WICPixelFormat64bppRGBA,    Pixel_Layout::Rgba64 },
+        { &GUID_WICPixelFormat1bppIndexed,  Pixel_Layout::Indexed1 },
+        { &GUID_WICPixelFormat2bppIndexed,  Pixel_Layout::Indexed2 },
+        { &GUID_WICPixelFormat4bppIndexed,  Pixel_Layout::Indexed4 },
+        { &GUID_WICPixelFormat8bppIndexed,  Pixel_Layout::Indexed8 },
+    };
+
+    for (int i = 0; i < ARRAYSIZE(format_layouts); ++i)
+        if (format == *format_layouts[i].format)
+            return format_layouts[i].layout;
+
+    return Pixel_Layout::Unknown;
+}
+
+int Pixel_Conversion::bits_per_pixel(Pixel_Layout layout)
+{
+    switch (layout)
+    {
+        case Pixel_Layout::Pbgra32:
+        case Pixel_Layout::Prgba32:
+        case Pixel_Layout::Bgra32:
+        case Pixel_Layout::Rgba32:
+        case Pixel_Layout::Bgr32:
+        case Pixel_Layout::Rgb32:
+            return 32;
+        case Pixel_Layout::Bgr24:
+        case Pixel_Layout::Rgb24:
+            return 24;
+        case Pixel_Layout::Gray8:
+        case Pixel_Layout::Indexed8:
+            return 8;
+        case Pixel_Layout::Gray16:
+            return 16;
+        case Pixel_Layout::Bgr48:
+        case Pixel_Layout::Rgb48:
+            return 48;
+        case Pixel_Layout::Bgra64:
+        case Pixel_Layout::Rgba64:
+            return 64;
+        case Pixel_Layout::Indexed1:
+            return 1;
+        case Pixel_Layout::Indexed2:
+            return 2;
+        case Pixel_Layout::Indexed4:
+            return 4;
+    }
+
+    return 0;
+}
+
+void Pixel_Conversion::convert_row(Pixel_Layout layout, const BYTE* source, UINT32* destination, int width, const UINT32* palette)
+{
+    E_VERIFY(layout > Pixel_Layout::Unknown && layout < Pixel_Layout::NUM_LAYOUTS);
+    E_VERIFY_NULL(source);
+    E_VERIFY_NULL(destination);
+    if (width <= 0)
+        return;
+
+    get_kernels().convert_row[static_cast<int>(layout)](source, destination, width, palette);
+}
+
+void Pixel_Conversion::premultiply_palette(UINT32* colors, int count)
+{
+    E_VERIFY_NULL(colors);
+
+    // WICColor is 0xAARRGGBB, which is already BGRA in memory.
+    for (int i = 0; i < count; ++i)
+        colors[i] = premultiply_pixel(colors[i]);
+}
+
+HRESULT Pixel_Conversion::copy_pixels(IWICImagingFactory* wic, IWICBitmapSource* source, const WICRect& rect, BYTE* destination, UINT stride,
+    Chroma_Upsampling upsampling)
+{
+    E_VERIFY_NULL_R(wic, E_INVALIDARG);
+    E_VERIFY_NULL_R(source, E_INVALIDARG);
+    E_VERIFY_NULL_R(destination, E_INVALIDARG);
+    E_VERIFY_R(rect.Width > 0 && rect.Height > 0, E_INVALIDARG);
+    E_VERIFY_R(stride >= sizeof(UINT32) * rect.Width, E_INVALIDARG);
+
+    HRESULT hr;
+    WICPixelFormatGUID format;
+    hr = source->GetPixelFormat(&format);
+    if (FAILED(hr))
+        return hr;
+
+    Pixel_Layout layout = layout_from_wic_format(format);
+
+    // JPEG decoder outputs 24bppBGR, skip its own upsampling and color conversion if planes are available.
+    if (layout == Pixel_Layout::Bgr24)
+    {
+        hr = Ycbcr_Conversion::copy_pixels(source, rect, destination, stride, upsampling);
+        if (hr != WINCODEC_ERR_UNSUPPORTEDOPERATION)
+            return hr;
+    }
+
+    IWICFormatConverter* converter = nullptr;
+    defer(safe_release(converter));
+
+    // Formats without own kernel are converted by WIC directly to destination.
+    if (layout == Pixel_Layout::Unknown)
+    {
+        hr = wic->CreateFormatConverter(&converter);
+        if (FAILED(hr))
+            return hr;
+
+        hr = converter->Initialize(source, GUID_WICPixelFormat32bppPBGRA, WICBitmapDitherTypeNone, nullptr, 0.0f, WICBitmapPaletteTypeMedianCut);
+        if (FAILED(hr))
+            return hr;
+
+        source = converter;
+        layout = Pixel_Layout::Pbgra32;
+    }
+
+    // Full rows are copied in strips so a single copy never needs a buffer larger than 4 GB.
+    const UINT max_strip_rows = static_cast<UINT>(max(1ull, (1ull << 31) / stride));
+    if (layout == Pixel_Layout::Pbgra32)
+    {
+        for (INT y = 0; y < rect.Height; )
+        {
+            UINT rows = min(static_cast<UINT>(rect.Height - y), max_strip_rows);
+            WICRect strip = { rect.X, rect.Y + y, rect.Width, static_cast<INT>(rows) };
+
+            hr = source->CopyPixels(&strip, stride, stride * rows, destination + static_cast<size_t>(y) * stride);
+            if (FAILED(hr))
+                return hr;
+
+            y += rows;
+        }
+
+        return S_OK;
+    }
+
+    UINT32 palette[palette_size] = {};
+    if (layout >= Pixel_Layout::Indexed1 && layout <= Pixel_Layout::Indexed8)
+    {
+        IWICPalette* wic_palette = nullptr;
+        hr = wic->CreatePalette(&wic_palette);
+        if (FAILED(hr))
+            return hr;
+        defer(wic_palette->Release());
+
+        hr = source->CopyPalette(wic_palette);
+        if (FAILED(hr))
+            return hr;
+
+        UINT color_count = 0;
+        hr = wic_palette->GetColors(palette_size, palette, &color_count);
+        if (FAILED(hr))
+            return hr;
+
+        premultiply_palette(palette, static_cast<int>(color_count));
+    }
+
+    const UINT source_stride = ((static_cast<UINT64>(rect.Width) * bits_per_pixel(layout) + 7) / 8 + 3) & ~3u;
+    const UINT strip_rows = max(1u, strip_buffer_size / source_stride);
+
+    BYTE* strip_buffer = (BYTE*)g_standard_allocator->allocate(static_cast<size_t>(source_stride) * strip_rows);
+    if (strip_buffer == nullptr)
+        return E_OUTOFMEMORY;
+    defer(g_standard_allocator->deallocate(strip_buffer));
+
+    const Convert_Row_Func convert = get_kernels().convert_row[static_cast<int>(layout)];
+    for (INT y = 0; y < rect.Height; )
+    {
+        UINT rows = min(static_cast<UINT>(rect.Height - y), strip_rows);
+        WICRect strip = { rect.X, rect.Y + y, rect.Width, static_cast<INT>(rows) };
+
+        hr = source->CopyPixels(&strip, source_stride, source_stride * rows, strip_buffer);
+        if (FAILED(hr))
+            return hr;
+
+        for (UINT row = 0; row < rows; ++row)
+        {
+            BYTE* destination_row = destination + static_cast<size_t>(y + row) * stride;
+            convert(strip_buffer + row * source_stride, reinterpret_cast<UINT32*>(destination_row), rect.Width, palette);
+        }
+
+        y += rows;
+    }
+
+    return S_OK;
+}
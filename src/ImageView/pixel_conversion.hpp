@@ -0,0 +1,54 @@
+#pragma once
+#include <wincodec.h>
+
+#include "ycbcr_conversion.hpp"
+
+// Source pixel layouts with own conversion kernels. Everything is converted to 32bppPBGRA,
+// which is what Direct2D bitmaps use.
+enum class Pixel_Layout
+{
+    Unknown,   // Goes through IWICFormatConverter.
+    Pbgra32,
+    Prgba32,
+    Bgra32,
+    Rgba32,
+    Bgr32,     // 4th byte is ignored.
+    Rgb32,     // 4th byte is ignored.
+    Bgr24,
+    Rgb24,
+    Gray8,
+    Gray16,
+    Bgr48,
+    Rgb48,
+    Bgra64,
+    Rgba64,
+    Indexed1,
+    Indexed2,
+    Indexed4,
+    Indexed8,
+
+    NUM_LAYOUTS
+};
+
+// Converts rows of pixels to 32bppPBGRA. Kernels are specialized per layout at compile time and
+// implementation (scalar, SSSE3, AVX2 or NEON) is selected once at runtime using g_cpu_features.
+struct Pixel_Conversion
+{
+    // Size of the palette expected by 'convert_row' for indexed layouts.
+    static const int palette_size = 256;
+
+    static Pixel_Layout layout_from_wic_format(const WICPixelFormatGUID& format);
+    static int bits_per_pixel(Pixel_Layout layout);
+
+    // Converts 'width' pixels from 'source' to 'destination'. 'palette' must hold 'palette_size' PBGRA colors
+    // for indexed layouts (see 'premultiply_palette') and is ignored otherwise.
+    static void convert_row(Pixel_Layout layout, const BYTE* source, UINT32* destination, int width, const UINT32* palette);
+    // Converts WIC palette colors (0xAARRGGBB) to PBGRA in place.
+    static void premultiply_palette(UINT32* colors, int count);
+
+    // Copies 'rect' of 'source' as 32bppPBGRA to 'destination'. Rows are read from 'source' in strips,
+    // so only a small temporary buffer is used no matter how large 'rect' is. JPEG frames are read as
+    // YCbCr planes when possible and converted with 'upsampling' (see Ycbcr_Conversion).
+    static HRESULT copy_pixels(IWICImagingFactory* wic, IWICBitmapSource* source, const WICRect& rect, BYTE* destination, UINT stride,
+        Chroma_Upsampling upsampling = Chroma_Upsampling::Fancy);
+};
@@ -0,0 +1,671 @@
+#include <Windows.h>
+#include <math.h>
+#include <string.h>
+
+#include "resampler.hpp"
+#include "cpu_features.hpp"
+#include "allocator.hpp"
+#include "defer.hpp"
+#include "error.hpp"
+
+#if CPU_X86
+    #include <intrin.h>
+    #include <immintrin.h>
+#elif CPU_ARM
+    #include <arm_neon.h>
+#endif
+
+// Contributions of source pixels to destination pixels along one axis.
+struct Filter_Weights
+{
+    int* first;      // First contributing source pixel, per destination pixel.
+    int* count;      // Number of contributing source pixels, per destination pixel.
+    float* weights;  // 'max_taps' normalized weights per destination pixel.
+    int max_taps;
+    void* block;
+};
+
+// Rows hold 4 floats per pixel, in the same order as PBGRA bytes.
+typedef void (*Load_Row_Func)(const UINT32* source, float* destination, int width);
+typedef void (*Resample_Row_Func)(const float* source, float* destination, const Filter_Weights& weights, int destination_width);
+typedef void (*Accumulate_Row_Func)(float* accumulator, const float* row, float weight, int float_count);
+typedef void (*Store_Row_Func)(const float* accumulator, UINT32* destination, int width);
+
+// Linear light tables. 'from_linear' is indexed by linear value scaled to [0, linear_table_size).
+static const int linear_table_size = 4096;
+
+struct Gamma_Tables
+{
+    float to_linear[256];
+    BYTE from_linear[linear_table_size];
+};
+
+
+#pragma region Filters
+static const float pi = 3.14159265358979f;
+
+static float box_filter(float x)
+{
+    return (x >= -0.5f && x < 0.5f) ? 1.0f : 0.0f;
+}
+
+// Keys cubic with a = -0.5.
+static float bicubic_filter(float x)
+{
+    const float a = -0.5f;
+
+    x = fabsf(x);
+    if (x < 1.0f)
+        return ((a + 2.0f) * x - (a + 3.0f)) * x * x + 1.0f;
+    if (x < 2.0f)
+        return ((a * x - 5.0f * a) * x + 8.0f * a) * x - 4.0f * a;
+
+    return 0.0f;
+}
+
+static inline float sinc(float x)
+{
+    if (x == 0.0f)
+        return 1.0f;
+
+    x *= pi;
+    return sinf(x) / x;
+}
+
+static float lanczos3_filter(float x)
+{
+    if (x <= -3.0f || x >= 3.0f)
+        return 0.0f;
+
+    return sinc(x) * sinc(x / 3.0f);
+}
+
+struct Filter_Info
+{
+    float (*func)(float x);
+    float support;
+};
+
+static Filter_Info get_filter_info(Resample_Filter filter)
+{
+    Filter_Info info;
+    switch (filter)
+    {
+        case Resample_Filter::Box:      info.func = box_filter;      info.support = 0.5f; break;
+        case Resample_Filter::Bicubic:  info.func = bicubic_filter;  info.support = 2.0f; break;
+        default:                        info.func = lanczos3_filter; info.support = 3.0f; break;
+    }
+
+    return info;
+}
+
+static bool compute_weights(int source_size, int destination_size, const Filter_Info& filter, Filter_Weights* w)
+{
+    const float scale = static_cast<float>(destination_size) / source_size;
+    // When downscaling the filter is stretched, so every source pixel contributes to some destination pixel.
+    const float filter_scale = scale < 1.0f ? 1.0f / scale : 1.0f;
+    const float support = filter.support * filter_scale;
+
+    w->max_taps = static_cast<int>(ceilf(support * 2.0f)) + 3;
+    w->block = g_standard_allocator->allocate(sizeof(int) * 2 * destination_size + sizeof(float) * w->max_taps * destination_size);
+    if (w->block == nullptr)
+        return false;
+
+    w->first = (int*)w->block;
+    w->count = w->first + destination_size;
+    w->weights = (float*)(w->count + destination_size);
+
+    for (int i = 0; i < destination_size; ++i)
+    {
+        const float center = (i + 0.5f) / scale;
+        const int left = max(static_cast<int>(floorf(center - support)), 0);
+        const int right = min(static_cast<int>(ceilf(center + support)), source_size - 1);
+
+        float* weights = w->weights + i * w->max_taps;
+        int first = 0;
+        int count = 0;
+        for (int j = left; j <= right; ++j)
+        {
+            float weight = filter.func((j + 0.5f - center) / filter_scale);
+            if (count == 0)
+            {
+                if (weight == 0.0f)
+                    continue;
+                first = j;
+            }
+
+            weights[count++] = weight;
+        }
+
+        while (count > 0 && weights[count - 1] == 0.0f)
+            --count;
+
+        float sum = 0.0f;
+        for (int k = 0; k < count; ++k)
+            sum += weights[k];
+
+        if (count == 0 || sum == 0.0f)
+        {
+            // Nothing in range, take the nearest pixel.
+            first = min(static_cast<int>(center), source_size - 1);
+            count = 1;
+            weights[0] = 1.0f;
+            sum = 1.0f;
+        }
+
+        for (int k = 0; k < count; ++k)
+            weights[k] /= sum;
+
+        w->first[i] = first;
+        w->count[i] = count;
+    }
+
+    return true;
+}
+
+static inline float srgb_to_linear(float c)
+{
+    return c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+}
+
+static inline float linear_to_srgb(float c)
+{
+    return c <= 0.0031308f ? c * 12.92f : 1.055f * powf(c, 1.0f / 2.4f) - 0.055f;
+}
+
+static Gamma_Tables make_gamma_tables()
+{
+    Gamma_Tables tables;
+    for (int i = 0; i < 256; ++i)
+        tables.to_linear[i] = 255.0f * srgb_to_linear(i / 255.0f);
+    for (int i = 0; i < linear_table_size; ++i)
+        tables.from_linear[i] = static_cast<BYTE>(255.0f * linear_to_srgb(static_cast<float>(i) / (linear_table_size - 1)) + 0.5f);
+
+    return tables;
+}
+
+static const Gamma_Tables& get_gamma_tables()
+{
+    static const Gamma_Tables tables = make_gamma_tables();
+    return tables;
+}
+#pragma endregion
+
+
+#pragma region Scalar
+static inline float clamp_float(float value, float low, float high)
+{
+    return value < low ? low : (value > high ? high : value);
+}
+
+static void load_row_scalar(const UINT32* source, float* destination, int width)
+{
+    for (int x = 0; x < width; ++x)
+    {
+        UINT32 pixel = source[x];
+        destination[4 * x + 0] = static_cast<float>(pixel & 0xFF);
+        destination[4 * x + 1] = static_cast<float>((pixel >> 8) & 0xFF);
+        destination[4 * x + 2] = static_cast<float>((pixel >> 16) & 0xFF);
+        destination[4 * x + 3] = static_cast<float>(pixel >> 24);
+    }
+}
+
+static void resample_row_scalar(const float* source, float* destination, const Filter_Weights& w, int destination_width)
+{
+    for (int x = 0; x < destination_width; ++x)
+    {
+        const float* s = source + 4 * w.first[x];
+        const float* weights = w.weights + x * w.max_taps;
+
+        float b = 0.0f, g = 0.0f, r = 0.0f, a = 0.0f;
+        for (int k = 0; k < w.count[x]; ++k)
+        {
+            b += s[4 * k + 0] * weights[k];
+            g += s[4 * k + 1] * weights[k];
+            r += s[4 * k + 2] * weights[k];
+            a += s[4 * k + 3] * weights[k];
+        }
+
+        destination[4 * x + 0] = b;
+        destination[4 * x + 1] = g;
+        destination[4 * x + 2] = r;
+        destination[4 * x + 3] = a;
+    }
+}
+
+static void accumulate_row_scalar(float* accumulator, const float* row, float weight, int float_count)
+{
+    for (int i = 0; i < float_count; ++i)
+        accumulator[i] += row[i] * weight;
+}
+
+// Color is clamped to alpha, negative lobes of the filters can make it larger otherwise.
+static void store_row_scalar(const float* accumulator, UINT32* destination, int width)
+{
+    for (int x = 0; x < width; ++x)
+    {
+        const float* p = accumulator + 4 * x;
+        float a = clamp_float(p[3], 0.0f, 255.0f);
+
+        UINT32 b = static_cast<UINT32>(clamp_float(p[0], 0.0f, a) + 0.5f);
+        UINT32 g = static_cast<UINT32>(clamp_float(p[1], 0.0f, a) + 0.5f);
+        UINT32 r = static_cast<UINT32>(clamp_float(p[2], 0.0f, a) + 0.5f);
+        destination[x] = (static_cast<UINT32>(a + 0.5f) << 24) | (r << 16) | (g << 8) | b;
+    }
+}
+
+// Linear light goes through tables, these are used by every implementation.
+static void load_row_linear(const UINT32* source, float* destination, int width)
+{
+    const float* to_linear = get_gamma_tables().to_linear;
+    for (int x = 0; x < width; ++x)
+    {
+        UINT32 pixel = source[x];
+        destination[4 * x + 0] = to_linear[pixel & 0xFF];
+        destination[4 * x + 1] = to_linear[(pixel >> 8) & 0xFF];
+        destination[4 * x + 2] = to_linear[(pixel >> 16) & 0xFF];
+        destination[4 * x + 3] = static_cast<float>(pixel >> 24);
+    }
+}
+
+static void store_row_linear(const float* accumulator, UINT32* destination, int width)
+{
+    const BYTE* from_linear = get_gamma_tables().from_linear;
+    const float to_index = static_cast<float>(linear_table_size - 1) / 255.0f;
+
+    for (int x = 0; x < width; ++x)
+    {
+        const float* p = accumulator + 4 * x;
+        float a = clamp_float(p[3], 0.0f, 255.0f);
+        UINT32 alpha = static_cast<UINT32>(a + 0.5f);
+
+        UINT32 c[3];
+        for (int i = 0; i < 3; ++i)
+        {
+            UINT32 value = from_linear[static_cast<int>(clamp_float(p[i], 0.0f, 255.0f) * to_index + 0.5f)];
+            c[i] = min(value, alpha);
+        }
+
+        destination[x] = (alpha << 24) | (c[2] << 16) | (c[1] << 8) | c[0];
+    }
+}
+#pragma endregion
+
+
+#if CPU_X86
+#pragma region SSE2
+static void load_row_sse2(const UINT32* source, float* destination, int width)
+{
+    const __m128i zero = _mm_setzero_si128();
+
+    int x = 0;
+    for (; x + 4 <= width; x += 4)
+    {
+        __m128i pixels = _mm_loadu_si128((const __m128i*)(source + x));
+        __m128i lo = _mm_unpacklo_epi8(pixels, zero);
+        __m128i hi = _mm_unpackhi_epi8(pixels, zero);
+
+        _mm_storeu_ps(destination + 4 * x + 0, _mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)));
+        _mm_storeu_ps(destination + 4 * x + 4, _mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)));
+        _mm_storeu_ps(destination + 4 * x + 8, _mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)));
+        _mm_storeu_ps(destination + 4 * x + 12, _mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero)));
+    }
+
+    load_row_scalar(source + x, destination + 4 * x, width - x);
+}
+
+static void resample_row_sse2(const float* source, float* destination, const Filter_Weights& w, int destination_width)
+{
+    for (int x = 0; x < destination_width; ++x)
+    {
+        const float* s = source + 4 * w.first[x];
+        const float* weights = w.weights + x * w.max_taps;
+
+        __m128 sum = _mm_setzero_ps();
+        for (int k = 0; k < w.count[x]; ++k)
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(s + 4 * k), _mm_set1_ps(weights[k])));
+
+        _mm_storeu_ps(destination + 4 * x, sum);
+    }
+}
+
+static void accumulate_row_sse2(float* accumulator, const float* row, float weight, int float_count)
+{
+    const __m128 w = _mm_set1_ps(weight);
+
+    int i = 0;
+    for (; i + 8 <= float_count; i += 8)
+    {
+        __m128 a0 = _mm_add_ps(_mm_loadu_ps(accumulator + i), _mm_mul_ps(_mm_loadu_ps(row + i), w));
+        __m128 a1 = _mm_add_ps(_mm_loadu_ps(accumulator + i + 4), _mm_mul_ps(_mm_loadu_ps(row + i + 4), w));
+        _mm_storeu_ps(accumulator + i, a0);
+        _mm_storeu_ps(accumulator + i + 4, a1);
+    }
+
+    accumulate_row_scalar(accumulator + i, row + i, weight, float_count - i);
+}
+
+// Clamps one pixel to [0, alpha] and alpha to [0, 255], adds 0.5 and truncates like the scalar version.
+static inline __m128i clamp_pixel_sse2(__m128 p)
+{
+    const __m128 max_alpha = _mm_set1_ps(255.0f);
+    const __m128 half = _mm_set1_ps(0.5f);
+
+    p = _mm_max_ps(p, _mm_setzero_ps());
+    __m128 alpha = _mm_min_ps(_mm_shuffle_ps(p, p, _MM_SHUFFLE(3, 3, 3, 3)), max_alpha);
+    p = _mm_min_ps(p, alpha);
+
+    return _mm_cvttps_epi32(_mm_add_ps(p, half));
+}
+
+static void store_row_sse2(const float* accumulator, UINT32* destination, int width)
+{
+    int x = 0;
+    for (; x + 4 <= width; x += 4)
+    {
+        const float* p = accumulator + 4 * x;
+        __m128i p0 = clamp_pixel_sse2(_mm_loadu_ps(p + 0));
+        __m128i p1 = clamp_pixel_sse2(_mm_loadu_ps(p + 4));
+        __m128i p2 = clamp_pixel_sse2(_mm_loadu_ps(p + 8));
+        __m128i p3 = clamp_pixel_sse2(_mm_loadu_ps(p + 12));
+
+        __m128i packed = _mm_packus_epi16(_mm_packs_epi32(p0, p1), _mm_packs_epi32(p2, p3));
+        _mm_storeu_si128((__m128i*)(destination + x), packed);
+    }
+
+    store_row_scalar(accumulator + 4 * x, destination + x, width - x);
+}
+#pragma endregion
+
+#pragma region AVX2
+static void load_row_avx2(const UINT32* source, float* destination, int width)
+{
+    int x = 0;
+    for (; x + 2 <= width; x += 2)
+    {
+        __m128i pixels = _mm_loadl_epi64((const __m128i*)(source + x));
+        _mm256_storeu_ps(destination + 4 * x, _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(pixels)));
+    }
+
+    load_row_scalar(source + x, destination + 4 * x, width - x);
+    _mm256_zeroupper();
+}
+
+// Two taps are processed at once, one in each 128-bit lane.
+static void resample_row_avx2(const float* source, float* destination, const Filter_Weights& w, int destination_width)
+{
+    for (int x = 0; x < destination_width; ++x)
+    {
+        const float* s = source + 4 * w.first[x];
+        const float* weights = w.weights + x * w.max_taps;
+        const int count = w.count[x];
+
+        __m256 sum2 = _mm256_setzero_ps();
+        int k = 0;
+        for (; k + 2 <= count; k += 2)
+        {
+            __m256 weight = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_set1_ps(weights[k])), _mm_set1_ps(weights[k + 1]), 1);
+            sum2 = _mm256_add_ps(sum2, _mm256_mul_ps(_mm256_loadu_ps(s + 4 * k), weight));
+        }
+
+        __m128 sum = _mm_add_ps(_mm256_castps256_ps128(sum2), _mm256_extractf128_ps(sum2, 1));
+        if (k < count)
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(s + 4 * k), _mm_set1_ps(weights[k])));
+
+        _mm_storeu_ps(destination + 4 * x, sum);
+    }
+
+    _mm256_zeroupper();
+}
+
+static void accumulate_row_avx2(float* accumulator, const float* row, float weight, int float_count)
+{
+    const __m256 w = _mm256_set1_ps(weight);
+
+    int i = 0;
+    for (; i + 16 <= float_count; i += 16)
+    {
+        __m256 a0 = _mm256_add_ps(_mm256_loadu_ps(accumulator + i), _mm256_mul_ps(_mm256_loadu_ps(row + i), w));
+        __m256 a1 = _mm256_add_ps(_mm256_loadu_ps(accumulator + i + 8), _mm256_mul_ps(_mm256_loadu_ps(row + i + 8), w));
+        _mm256_storeu_ps(accumulator + i, a0);
+        _mm256_storeu_ps(accumulator + i + 8, a1);
+    }
+
+    accumulate_row_scalar(accumulator + i, row + i, weight, float_count - i);
+    _mm256_zeroupper();
+}
+#pragma endregion
+#endif
+
+#if CPU_ARM
+#pragma region NEON
+static void load_row_neon(const UINT32* source, float* destination, int width)
+{
+    int x = 0;
+    for (; x + 4 <= width; x += 4)
+    {
+        uint8x16_t pixels = vld1q_u8((const uint8_t*)(source + x));
+        uint16x8_t lo = vmovl_u8(vget_low_u8(pixels));
+        uint16x8_t hi = vmovl_u8(vget_high_u8(pixels));
+
+        vst1q_f32(destination + 4 * x + 0, vcvtq_f32_u32(vmovl_u16(vget_low_u16(lo))));
+        vst1q_f32(destination + 4 * x + 4, vcvtq_f32_u32(vmovl_u16(vget_high_u16(lo))));
+        vst1q_f32(destination + 4 * x + 8, vcvtq_f32_u32(vmovl_u16(vget_low_u16(hi))));
+        vst1q_f32(destination + 4 * x + 12, vcvtq_f32_u32(vmovl_u16(vget_high_u16(hi))));
+    }
+
+    load_row_scalar(source + x, destination + 4 * x, width - x);
+}
+
+static void resample_row_neon(const float* source, float* destination, const Filter_Weights& w, int destination_width)
+{
+    for (int x = 0; x < destination_width; ++x)
+    {
+        const float* s = source + 4 * w.first[x];
+        const float* weights = w.weights + x * w.max_taps;
+
+        float32x4_t sum = vdupq_n_f32(0.0f);
+        for (int k = 0; k < w.count[x]; ++k)
+            sum = vmlaq_n_f32(sum, vld1q_f32(s + 4 * k), weights[k]);
+
+        vst1q_f32(destination + 4 * x, sum);
+    }
+}
+
+static void accumulate_row_neon(float* accumulator, const float* row, float weight, int float_count)
+{
+    int i = 0;
+    for (; i + 8 <= float_count; i += 8)
+    {
+        vst1q_f32(accumulator + i, vmlaq_n_f32(vld1q_f32(accumulator + i), vld1q_f32(row + i), weight));
+        vst1q_f32(accumulator + i + 4, vmlaq_n_f32(vld1q_f32(accumulator + i + 4), vld1q_f32(row + i + 4), weight));
+    }
+
+    accumulate_row_scalar(accumulator + i, row + i, weight, float_count - i);
+}
+
+static inline uint16x4_t clamp_pixel_neon(float32x4_t p)
+{
+    p = vmaxq_f32(p, vdupq_n_f32(0.0f));
+    float32x4_t alpha = vminq_f32(vdupq_n_f32(vgetq_lane_f32(p, 3)), vdupq_n_f32(255.0f));
+    p = vminq_f32(p, alpha);
+
+    return vmovn_u32(vcvtq_u32_f32(vaddq_f32(p, vdupq_n_f32(0.5f))));
+}
+
+static void store_row_neon(const float* accumulator, UINT32* destination, int width)
+{
+    int x = 0;
+    for (; x + 2 <= width; x += 2)
+    {
+        const float* p = accumulator + 4 * x;
+        uint16x8_t pixels = vcombine_u16(clamp_pixel_neon(vld1q_f32(p)), clamp_pixel_neon(vld1q_f32(p + 4)));
+        vst1_u8((uint8_t*)(destination + x), vmovn_u16(pixels));
+    }
+
+    store_row_scalar(accumulator + 4 * x, destination + x, width - x);
+}
+#pragma endregion
+#endif
+
+struct Resampler_Kernels
+{
+    Load_Row_Func load_row;
+    Resample_Row_Func resample_row;
+    Accumulate_Row_Func accumulate_row;
+    Store_Row_Func store_row;
+};
+
+static Resampler_Kernels select_kernels()
+{
+    Resampler_Kernels k;
+    k.load_row = load_row_scalar;
+    k.resample_row = resample_row_scalar;
+    k.accumulate_row = accumulate_row_scalar;
+    k.store_row = store_row_scalar;
+
+#if CPU_X86
+    if (g_cpu_features.has_sse2)
+    {
+        k.load_row = load_row_sse2;
+        k.resample_row = resample_row_sse2;
+        k.accumulate_row = accumulate_row_sse2;
+        k.store_row = store_row_sse2;
+    }
+    if (g_cpu_features.has_avx2)
+    {
+        k.load_row = load_row_avx2;
+        k.resample_row = resample_row_avx2;
+        k.accumulate_row = accumulate_row_avx2;
+    }
+#elif CPU_ARM
+    if (g_cpu_features.has_neon)
+    {
+        k.load_row = load_row_neon;
+        k.resample_row = resample_row_neon;
+        k.accumulate_row = accumulate_row_neon;
+        k.store_row = store_row_neon;
+    }
+#endif
+
+    return k;
+}
+
+static const Resampler_Kernels& get_kernels()
+{
+    static const Resampler_Kernels kernels = select_kernels();
+    return kernels;
+}
+
+struct Resample_Job
+{
+    const Image_Buffer* source;
+    const Image_Buffer* destination;
+    Filter_Weights horizontal;
+    Filter_Weights vertical;
+    Load_Row_Func load_row;
+    Store_Row_Func store_row;
+    int band_height;
+    volatile LONG failed;
+};
+
+// Resamples one band of destination rows. Source rows the band needs are resampled horizontally first,
+// then every destination row is a weighted sum of them.
+static void resample_band(void* context, int band)
+{
+    Resample_Job* job = (Resample_Job*)context;
+    const Resampler_Kernels& kernels = get_kernels();
+    const Filter_Weights& vertical = job->vertical;
+
+    const int source_width = job->source->width;
+    const int destination_width = job->destination->width;
+    const int y_begin = band * job->band_height;
+    const int y_end = min(y_begin + job->band_height, job->destination->height);
+
+    // Zero weights are trimmed, so 'first' doesn't have to grow with every row.
+    int source_begin = vertical.first[y_begin];
+    int source_end = source_begin;
+    for (int y = y_begin; y < y_end; ++y)
+    {
+        source_begin = min(source_begin, vertical.first[y]);
+        source_end = max(source_end, vertical.first[y] + vertical.count[y]);
+    }
+
+    const size_t row_floats = 4 * static_cast<size_t>(destination_width);
+    const size_t source_row_floats = 4 * static_cast<size_t>(source_width);
+    const size_t band_floats = row_floats * (source_end - source_begin);
+
+    float* source_row = (float*)g_standard_allocator->allocate(sizeof(float) * (source_row_floats + band_floats + row_floats));
+    if (source_row == nullptr)
+    {
+        InterlockedExchange(&job->failed, 1);
+        return;
+    }
+    defer(g_standard_allocator->deallocate(source_row));
+
+    float* band_rows = source_row + source_row_floats;
+    float* accumulator = band_rows + band_floats;
+
+    for (int y = source_begin; y < source_end; ++y)
+    {
+        job->load_row(job->source->row(y), source_row, source_width);
+        kernels.resample_row(source_row, band_rows + row_floats * (y - source_begin), job->horizontal, destination_width);
+    }
+
+    for (int y = y_begin; y < y_end; ++y)
+    {
+        const float* weights = vertical.weights + y * vertical.max_taps;
+
+        memset(accumulator, 0, sizeof(float) * row_floats);
+        for (int k = 0; k < vertical.count[y]; ++k)
+        {
+            const float* row = band_rows + row_floats * (vertical.first[y] + k - source_begin);
+            kernels.accumulate_row(accumulator, row, weights[k], static_cast<int>(row_floats));
+        }
+
+        job->store_row(accumulator, job->destination->row(y), destination_width);
+    }
+}
+
+bool Resampler::resample(const Image_Buffer& source, const Image_Buffer& destination, Resample_Filter filter, bool linear_light, Job_Pool* pool)
+{
+    E_VERIFY_R(!source.is_empty() && !destination.is_empty(), false);
+
+    const Filter_Info info = get_filter_info(filter);
+
+    Resample_Job job;
+    job.source = &source;
+    job.destination = &destination;
+    job.failed = 0;
+
+    if (!compute_weights(source.width, destination.width, info, &job.horizontal))
+        return false;
+    defer(g_standard_allocator->deallocate(job.horizontal.block));
+
+    if (!compute_weights(source.height, destination.height, info, &job.vertical))
+        return false;
+    defer(g_standard_allocator->deallocate(job.vertical.block));
+
+    const Resampler_Kernels& kernels = get_kernels();
+    job.load_row = linear_light ? load_row_linear : kernels.load_row;
+    job.store_row = linear_light ? store_row_linear : kernels.store_row;
+
+    // A few bands per thread, so threads that finish early take over the rest. Bands share the source rows
+    // at their edges, more bands means more of them are resampled horizontally twice.
+    const int thread_count = pool != nullptr ? pool->get_thread_count() + 1 : 1;
+    const int band_count = min(destination.height, 4 * thread_count);
+    job.band_height = (destination.height + band_count - 1) / band_count;
+
+    const int job_count = (destination.height + job.band_height - 1) / job.band_height;
+    if (pool != nullptr)
+    {
+        pool->parallel_for(job_count, resample_band, &job);
+    }
+    else
+    {
+        for (int i = 0; i < job_count; ++i)
+            resample_band(&job, i);
+    }
+
+    return job.failed == 0;
+}
@@ -0,0 +1,22 @@
+#pragma once
+#include "image_buffer.hpp"
+#include "job_pool.hpp"
+
+enum class Resample_Filter
+{
+    None,     // Image is not resampled, Direct2D interpolates it when drawing.
+    Box,
+    Bicubic,  // Catmull-Rom.
+    Lanczos3,
+};
+
+// Separable resampler for 32bppPBGRA images. Filter weights are computed once per axis, pixels are
+// filtered in floating point, horizontally and then vertically, by scalar, SSE2, AVX2 or NEON kernels.
+struct Resampler
+{
+    // Resamples 'source' to the size of 'destination', which must be allocated. Destination rows are split into
+    // bands that run in parallel on 'pool'. With 'linear_light' color channels are filtered in linear light
+    // instead of sRGB. Returns false if there's not enough memory.
+    static bool resample(const Image_Buffer& source, const Image_Buffer& destination, Resample_Filter filter, bool linear_light,
+        Job_Pool* pool = g_job_pool);
+};
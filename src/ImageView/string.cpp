@@ -1,4 +1,5 @@
 #include "string.hpp"
+#include "string_simd.hpp"
 #include "error.hpp"
 #include <wchar.h>
 
@@ -18,11 +19,7 @@ int String::index_of(wchar_t c) const
     if (is_null_or_empty(*this))
         return -1;
 
-    for (int i = 0; i < count; ++i)
-        if (data[i] == c)
-            return i;
-
-    return -1;
+    return String_Simd::find_char(data, count, c);
 }
 
 int String::last_index_of(wchar_t c) const
@@ -30,11 +27,7 @@ int String::last_index_of(wchar_t c) const
     if (is_null_or_empty(*this))
         return -1;
 
-    for (int i = count - 1; i >= 0; --i)
-        if (data[i] == c)
-            return i;
-
-    return -1;
+    return String_Simd::find_last_char(data, count, c);
 }
 
 bool String::starts_with(wchar_t c) const
@@ -62,11 +55,19 @@ bool String::ends_with(const wchar_t* cstring) const
     if (count < cstring_length)
         return false;
 
-    for (int i = count - cstring_length; i < count; ++i)
-        if (data[i] != *cstring++)
-            return false;
+    return String_Simd::equal(&data[count - cstring_length], cstring, cstring_length);
+}
+
+bool String::ends_with_ignore_case(const wchar_t* cstring) const
+{
+    if (is_null_or_empty(*this) || cstring == nullptr)
+        return false;
 
-    return true;
+    int cstring_length = (int)wcslen(cstring);
+    if (count < cstring_length)
+        return false;
+
+    return String_Simd::equal_ignore_case(&data[count - cstring_length], cstring, cstring_length);
 }
 
 size_t String::calc_size() const
@@ -101,8 +102,36 @@ bool String::equals(const String& a, const String& b)
         return true;
     if (a.count != b.count)
         return false;
+    if (a.count <= 0)
+        return true;
+    if (a.data == nullptr || b.data == nullptr)
+        return false;
+
+    return String_Simd::equal(a.data, b.data, a.count);
+}
+
+bool String::equals_ignore_case(const String& a, const String& b)
+{
+    if (a.data == nullptr && b.data == nullptr)
+        return true;
+    if (a.count != b.count)
+        return false;
+    if (a.count <= 0)
+        return true;
+    if (a.data == nullptr || b.data == nullptr)
+        return false;
+
+    return String_Simd::equal_ignore_case(a.data, b.data, a.count);
+}
 
-    return 0 == wcsncmp(a.data, b.data, a.count);
+unsigned int String::hash(const String& string)
+{
+    return String_Simd::hash(string.data, string.count);
+}
+
+unsigned int String::hash_ignore_case(const String& string)
+{
+    return String_Simd::hash_ignore_case(string.data, string.count);
 }
 
 String String::substring(int start, int length, IAllocator* allocator) const
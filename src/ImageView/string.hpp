@@ -23,6 +23,7 @@ struct String
     bool starts_with(wchar_t c) const;
     bool ends_with(wchar_t c) const;
     bool ends_with(const wchar_t* cstring) const;
+    bool ends_with_ignore_case(const wchar_t* cstring) const;
     
     size_t calc_size() const;
     size_t calc_size_no_zero_terminator() const;
@@ -34,6 +35,11 @@ struct String
     static bool is_null_or_empty(const String& string);
     static bool is_null(const String& string);
     static bool equals(const String& a, const String& b);
+    static bool equals_ignore_case(const String& a, const String& b);
+
+    // Strings that are equal (ignoring case for 'hash_ignore_case') have equal hashes.
+    static unsigned int hash(const String& string);
+    static unsigned int hash_ignore_case(const String& string);
 
     static String allocate_string_of_length(int length, IAllocator* allocator = g_standard_allocator);
     static String duplicate(const wchar_t* string, int string_length, IAllocator* allocator = g_standard_allocator);
@@ -1,15 +1,82 @@
 #include <string.h>
 #include <wchar.h>
+#include <stdio.h>
 
 #include "string_builder.hpp"
 #include "error.hpp"
 
 
+static const char digit_pairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+// Enough for 20 digits of unsigned 64-bit value and a sign.
+static const int max_integer_chars = 21;
+// Fixed notation is used for values below 1e18, larger ones are printed with exponent.
+static const double max_fixed_value = 1e18;
+// 2^53, integers above it are not all representable in double.
+static const double max_exact_scaled_value = 9007199254740992.0;
+static const int max_fixed_precision = 9;
+
+static const unsigned __int64 powers_of_10[max_fixed_precision + 1] =
+{
+    1ull, 10ull, 100ull, 1000ull, 10000ull, 100000ull, 1000000ull, 10000000ull, 100000000ull, 1000000000ull
+};
+
+// Writes digits of 'value' backwards ending at 'end'. Returns pointer to the first digit.
+static wchar_t* write_digits_backwards(wchar_t* end, unsigned __int64 value, int min_digits = 1)
+{
+    wchar_t* p = end;
+
+    while (value >= 100)
+    {
+        const char* pair = &digit_pairs[(value % 100) * 2];
+        value /= 100;
+
+        *--p = static_cast<wchar_t>(pair[1]);
+        *--p = static_cast<wchar_t>(pair[0]);
+    }
+
+    if (value >= 10)
+    {
+        const char* pair = &digit_pairs[value * 2];
+        *--p = static_cast<wchar_t>(pair[1]);
+        *--p = static_cast<wchar_t>(pair[0]);
+    }
+    else
+    {
+        *--p = static_cast<wchar_t>(L'0' + value);
+    }
+
+    while (end - p < min_digits)
+        *--p = L'0';
+
+    return p;
+}
+
 String_Builder::String_Builder(IAllocator * allocator)
 {
     this->allocator = allocator;
 }
 
+String_Builder::String_Builder(wchar_t* buffer, int capacity)
+{
+    E_VERIFY_NULL(buffer);
+    E_VERIFY(capacity > 0);
+
+    this->buffer = buffer;
+    this->capacity = capacity;
+    this->allocator = nullptr;
+}
+
 void String_Builder::clear()
 {
     E_VERIFY(is_begin_called == false); // Call 'end' first!
@@ -39,12 +106,12 @@ bool String_Builder::append_char(wchar_t c)
 
 bool String_Builder::append_string(const String& string)
 {
-    if (!ensure_capacity(string.count)) {
+    if (String::is_null_or_empty(string))
+        return true;
+    if (!ensure_capacity(count + string.count)) {
         is_valid = false;
         return false;
     }
-    if (String::is_null_or_empty(string))
-        return true;
 
     wmemcpy(&buffer[count], string.data, string.count);
     count += string.count;
@@ -73,6 +140,20 @@ bool String_Builder::append_format(const wchar_t* format, ...)
 
 bool String_Builder::append_format(const wchar_t * format, va_list args)
 {
+    // Try to format into space that's left first, most strings fit and are formatted only once.
+    if (capacity - count > 1)
+    {
+        va_list args_copy;
+        va_copy(args_copy, args);
+        int num_written = _vsnwprintf_s(&buffer[count], capacity - count, _TRUNCATE, format, args_copy);
+        va_end(args_copy);
+
+        if (num_written >= 0) {
+            count += num_written;
+            return true;
+        }
+    }
+
     int num_chars_required = _vscwprintf(format, args);
     if (num_chars_required == -1) {
         is_valid = false;
@@ -98,6 +179,183 @@ bool String_Builder::append_format(const wchar_t * format, va_list args)
     return true;
 }
 
+bool String_Builder::append_value(int value)
+{
+    return append_value(static_cast<__int64>(value));
+}
+
+bool String_Builder::append_value(unsigned int value)
+{
+    return append_unsigned(value, false);
+}
+
+bool String_Builder::append_value(long value)
+{
+    return append_value(static_cast<__int64>(value));
+}
+
+bool String_Builder::append_value(unsigned long value)
+{
+    return append_unsigned(value, false);
+}
+
+bool String_Builder::append_value(__int64 value)
+{
+    if (value < 0)
+        return append_unsigned(0ull - static_cast<unsigned __int64>(value), true);
+
+    return append_unsigned(static_cast<unsigned __int64>(value), false);
+}
+
+bool String_Builder::append_value(unsigned __int64 value)
+{
+    return append_unsigned(value, false);
+}
+
+bool String_Builder::append_value(double value)
+{
+    return append_value(Format_Fixed{ value, 2 });
+}
+
+bool String_Builder::append_value(wchar_t value)
+{
+    return append_char(value);
+}
+
+bool String_Builder::append_value(const wchar_t* value)
+{
+    return append_string(value);
+}
+
+bool String_Builder::append_value(const String& value)
+{
+    return append_string(value);
+}
+
+bool String_Builder::append_value(const Format_Hex& value)
+{
+    static const wchar_t hex_digits[] = L"0123456789abcdef";
+
+    int min_digits = value.min_digits < 0 ? 0 : (value.min_digits > 16 ? 16 : value.min_digits);
+    if (!ensure_capacity(count + 18)) {
+        is_valid = false;
+        return false;
+    }
+
+    wchar_t digits[16];
+    wchar_t* end = digits + ARRAYSIZE(digits);
+    wchar_t* p = end;
+
+    unsigned __int64 v = value.value;
+    do
+    {
+        *--p = hex_digits[v & 0xF];
+        v >>= 4;
+    } while (v != 0);
+
+    while (end - p < min_digits)
+        *--p = L'0';
+
+    if (value.prefix)
+    {
+        buffer[count++] = L'0';
+        buffer[count++] = L'x';
+    }
+
+    int num_digits = static_cast<int>(end - p);
+    wmemcpy(&buffer[count], p, num_digits);
+    count += num_digits;
+
+    return true;
+}
+
+bool String_Builder::append_value(const Format_Fixed& value)
+{
+    int precision = value.precision < 0 ? 0 : (value.precision > max_fixed_precision ? max_fixed_precision : value.precision);
+    double v = value.value;
+
+    if (v != v)
+        return append_string(L"nan");
+
+    bool negative = v < 0.0;
+    if (negative)
+        v = -v;
+
+    if (v >= max_fixed_value)
+    {
+        if (v > 1.7976931348623157e308)
+            return append_string(negative ? L"-inf" : L"inf");
+
+        // Rare, not worth own implementation.
+        return append_format(L"%.*e", precision, negative ? -v : v);
+    }
+
+    // Scaled value must be an exact integer in double too, e.g. 1e12 with 9 digits after decimal point
+    // isn't and would overflow 64 bits. Those are still printed in fixed notation, by printf.
+    unsigned __int64 scale = powers_of_10[precision];
+    if (v >= max_exact_scaled_value / scale)
+        return append_format(L"%.*f", precision, negative ? -v : v);
+
+    unsigned __int64 scaled = static_cast<unsigned __int64>(v * scale + 0.5);
+    unsigned __int64 integer_part = scaled / scale;
+    unsigned __int64 fraction_part = scaled % scale;
+
+    if (!ensure_capacity(count + max_integer_chars + 1 + precision)) {
+        is_valid = false;
+        return false;
+    }
+
+    if (negative && scaled != 0)
+        buffer[count++] = L'-';
+
+    wchar_t digits[max_integer_chars];
+    wchar_t* end = digits + ARRAYSIZE(digits);
+    wchar_t* p = write_digits_backwards(end, integer_part);
+
+    int num_digits = static_cast<int>(end - p);
+    wmemcpy(&buffer[count], p, num_digits);
+    count += num_digits;
+
+    if (precision > 0)
+    {
+        buffer[count++] = L'.';
+
+        p = write_digits_backwards(end, fraction_part, precision);
+        wmemcpy(&buffer[count], p, precision);
+        count += precision;
+    }
+
+    return true;
+}
+
+bool String_Builder::append_unsigned(unsigned __int64 value, bool negative)
+{
+    if (!ensure_capacity(count + max_integer_chars)) {
+        is_valid = false;
+        return false;
+    }
+
+    if (negative)
+        buffer[count++] = L'-';
+
+    // Small values are the common case (sizes, indices), skip the scratch buffer.
+    if (value < 10)
+    {
+        buffer[count++] = static_cast<wchar_t>(L'0' + value);
+        return true;
+    }
+
+    wchar_t digits[max_integer_chars];
+    wchar_t* end = digits + ARRAYSIZE(digits);
+    wchar_t* p = write_digits_backwards(end, value);
+
+    int num_digits = static_cast<int>(end - p);
+    wmemcpy(&buffer[count], p, num_digits);
+    count += num_digits;
+
+    return true;
+}
+
 bool String_Builder::end(bool append_terminating_null)
 {
     E_VERIFY_R(is_begin_called == true, false); // Call 'begin' first!
@@ -114,6 +372,8 @@ bool String_Builder::reserve(int required_capacity)
     E_VERIFY_R(required_capacity >= 0, false);
     if (capacity >= required_capacity)
         return true;
+    if (allocator == nullptr)
+        return false; // Fixed buffer.
 
     wchar_t* new_buffer = (wchar_t*)allocator->reallocate(buffer, sizeof(wchar_t) * required_capacity);
     if (new_buffer == nullptr)
@@ -132,10 +392,12 @@ bool String_Builder::ensure_capacity(int required_capacity)
         return true;
     if (capacity >= required_capacity)
         return true;
+    if (allocator == nullptr)
+        return false; // Fixed buffer.
 
     int new_cap = find_capacity(required_capacity);
     if (buffer == nullptr) {
-        buffer = (wchar_t*)allocator->allocate(new_cap);
+        buffer = (wchar_t*)allocator->allocate(sizeof(wchar_t) * new_cap);
         if (buffer == nullptr)
             return false;
 
@@ -145,10 +407,11 @@ bool String_Builder::ensure_capacity(int required_capacity)
     }
     else
     {
-        buffer = (wchar_t*)allocator->reallocate(buffer, new_cap);
-        if (buffer == nullptr)
+        wchar_t* new_buffer = (wchar_t*)allocator->reallocate(buffer, sizeof(wchar_t) * new_cap);
+        if (new_buffer == nullptr)
             return false;
-    
+
+        buffer = new_buffer;
         capacity = new_cap;
         return true;
     }
@@ -5,6 +5,28 @@
 #include "string.hpp"
 
 
+// Formats value as hexadecimal number for String_Builder::append, e.g. format_hex(hr, 8) is the same as "%#010x".
+struct Format_Hex
+{
+    unsigned __int64 value;
+    int min_digits;
+    bool prefix;
+};
+
+// Formats value with fixed amount of digits after decimal point for String_Builder::append.
+struct Format_Fixed
+{
+    double value;
+    int precision;
+};
+
+inline Format_Hex format_hex(unsigned __int64 value, int min_digits = 0, bool prefix = true) {
+    return Format_Hex{ value, min_digits, prefix };
+}
+inline Format_Fixed format_fixed(double value, int precision = 2) {
+    return Format_Fixed{ value, precision };
+}
+
 struct String_Builder
 {
     wchar_t* buffer = nullptr;
@@ -15,6 +37,8 @@ struct String_Builder
     bool is_begin_called = false;
 
     String_Builder(IAllocator* allocator = g_standard_allocator);
+    // Builder that writes into 'buffer' and never allocates. Appending more than 'capacity' fails.
+    String_Builder(wchar_t* buffer, int capacity);
 
     void clear();
 
@@ -26,8 +50,37 @@ struct String_Builder
     bool append_format(const wchar_t* format, va_list args);
     bool end(bool append_terminating_null = true);
 
+    // Typed formatting: arguments are appended one after another, e.g. append(width, L'x', height).
+    // Each argument is converted directly into the buffer, format is resolved at compile time by overloads.
+    template<typename T, typename... Rest>
+    bool append(const T& value, const Rest&... rest);
+    bool append() { return is_valid; }
+
+    bool append_value(int value);
+    bool append_value(unsigned int value);
+    bool append_value(long value);
+    bool append_value(unsigned long value);
+    bool append_value(__int64 value);
+    bool append_value(unsigned __int64 value);
+    bool append_value(double value);
+    bool append_value(wchar_t value);
+    bool append_value(const wchar_t* value);
+    bool append_value(const String& value);
+    bool append_value(const Format_Hex& value);
+    bool append_value(const Format_Fixed& value);
+
     bool reserve(int required_capacity);
 private:
+    bool append_unsigned(unsigned __int64 value, bool negative);
     bool ensure_capacity(int required_capacity);
     inline int find_capacity(int cap) { return cap <= 5 ? 10 : cap * 2; }
 };
+
+template<typename T, typename... Rest>
+inline bool String_Builder::append(const T& value, const Rest&... rest)
+{
+    if (!append_value(value))
+        return false;
+
+    return append(rest...);
+}
@@ -0,0 +1,648 @@
+#include <Windows.h>
+#include <string.h>
+
+#include "string_simd.hpp"
+#include "cpu_features.hpp"
+
+#if CPU_X86
+    #include <intrin.h>
+    #include <immintrin.h>
+#elif CPU_ARM
+    #include <arm_neon.h>
+#endif
+
+static_assert(sizeof(wchar_t) == 2, "Kernels expect UTF-16 code units.");
+
+static const unsigned __int64 hash_multiplier = 0x517CC1B727220A95ull;
+
+
+static inline unsigned __int64 hash_mix(unsigned __int64 h, unsigned __int64 word)
+{
+    return (((h << 5) | (h >> 59)) ^ word) * hash_multiplier;
+}
+
+static inline unsigned int hash_finish(unsigned __int64 h, int count)
+{
+    h = hash_mix(h, static_cast<unsigned __int64>(count));
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDull;
+    h ^= h >> 33;
+
+    return static_cast<unsigned int>(h);
+}
+
+static inline unsigned __int64 load_word(const wchar_t* data)
+{
+    unsigned __int64 word;
+    memcpy(&word, data, sizeof(word));
+    return word;
+}
+
+wchar_t String_Simd::fold_char(wchar_t c)
+{
+    if (c < 0x80)
+        return (c >= L'A' && c <= L'Z') ? static_cast<wchar_t>(c + (L'a' - L'A')) : c;
+
+    // When high-order word is zero, CharLowerW converts single character passed as pointer.
+    return static_cast<wchar_t>(reinterpret_cast<UINT_PTR>(CharLowerW(reinterpret_cast<LPWSTR>(static_cast<UINT_PTR>(c)))));
+}
+
+// Folds 4 code units and packs them exactly like 'load_word' does, so every implementation hashes the same words.
+static inline unsigned __int64 load_folded_word_scalar(const wchar_t* data)
+{
+    wchar_t folded[4];
+    for (int i = 0; i < 4; ++i)
+        folded[i] = String_Simd::fold_char(data[i]);
+
+    return load_word(folded);
+}
+
+#pragma region Scalar
+static int find_char_scalar(const wchar_t* data, int count, wchar_t c)
+{
+    for (int i = 0; i < count; ++i)
+        if (data[i] == c)
+            return i;
+
+    return -1;
+}
+
+static int find_last_char_scalar(const wchar_t* data, int count, wchar_t c)
+{
+    for (int i = count - 1; i >= 0; --i)
+        if (data[i] == c)
+            return i;
+
+    return -1;
+}
+
+static bool equal_scalar(const wchar_t* a, const wchar_t* b, int count)
+{
+    return memcmp(a, b, sizeof(wchar_t) * count) == 0;
+}
+
+static bool equal_ignore_case_scalar(const wchar_t* a, const wchar_t* b, int count)
+{
+    for (int i = 0; i < count; ++i)
+    {
+        if (a[i] == b[i])
+            continue;
+        if (String_Simd::fold_char(a[i]) != String_Simd::fold_char(b[i]))
+            return false;
+    }
+
+    return true;
+}
+
+static size_t find_byte_scalar(const char* data, size_t count, char c)
+{
+    const void* found = memchr(data, c, count);
+    return found == nullptr ? count : static_cast<size_t>(static_cast<const char*>(found) - data);
+}
+
+static unsigned __int64 hash_folded_words_scalar(unsigned __int64 h, const wchar_t* data, int word_count)
+{
+    for (int i = 0; i < word_count; ++i)
+        h = hash_mix(h, load_folded_word_scalar(data + i * 4));
+
+    return h;
+}
+#pragma endregion
+
+#if CPU_X86
+#pragma region SSE2
+static inline int lowest_set_bit(unsigned int mask)
+{
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return static_cast<int>(index);
+}
+
+static inline int highest_set_bit(unsigned int mask)
+{
+    unsigned long index;
+    _BitScanReverse(&index, mask);
+    return static_cast<int>(index);
+}
+
+static inline __m128i fold_ascii_sse2(__m128i v)
+{
+    __m128i is_upper = _mm_and_si128(
+        _mm_cmpgt_epi16(v, _mm_set1_epi16(L'A' - 1)),
+        _mm_cmplt_epi16(v, _mm_set1_epi16(L'Z' + 1)));
+
+    return _mm_add_epi16(v, _mm_and_si128(is_upper, _mm_set1_epi16(0x20)));
+}
+
+static inline bool is_ascii_sse2(__m128i v)
+{
+    __m128i high_bits = _mm_and_si128(v, _mm_set1_epi16(static_cast<short>(0xFF80)));
+    return _mm_movemask_epi8(_mm_cmpeq_epi16(high_bits, _mm_setzero_si128())) == 0xFFFF;
+}
+
+static int find_char_sse2(const wchar_t* data, int count, wchar_t c)
+{
+    const __m128i needle = _mm_set1_epi16(static_cast<short>(c));
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi16(chunk, needle));
+        if (mask != 0)
+            return i + lowest_set_bit(mask) / 2;
+    }
+
+    int tail = find_char_scalar(data + i, count - i, c);
+    return tail == -1 ? -1 : i + tail;
+}
+
+static int find_last_char_sse2(const wchar_t* data, int count, wchar_t c)
+{
+    const __m128i needle = _mm_set1_epi16(static_cast<short>(c));
+
+    int end = count;
+    for (; end >= 8; end -= 8)
+    {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + end - 8));
+        unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi16(chunk, needle));
+        if (mask != 0)
+            return end - 8 + highest_set_bit(mask) / 2;
+    }
+
+    return find_last_char_scalar(data, end, c);
+}
+
+static size_t find_byte_sse2(const char* data, size_t count, char c)
+{
+    const __m128i needle = _mm_set1_epi8(c);
+
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle));
+        if (mask != 0)
+            return i + lowest_set_bit(mask);
+    }
+
+    return i + find_byte_scalar(data + i, count - i, c);
+}
+
+static bool equal_sse2(const wchar_t* a, const wchar_t* b, int count)
+{
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi16(va, vb)) != 0xFFFF)
+            return false;
+    }
+
+    return equal_scalar(a + i, b + i, count - i);
+}
+
+static bool equal_ignore_case_sse2(const wchar_t* a, const wchar_t* b, int count)
+{
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i va = fold_ascii_sse2(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)));
+        __m128i vb = fold_ascii_sse2(_mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i)));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi16(va, vb)) == 0xFFFF)
+            continue;
+
+        // Mismatch can still be non-ASCII letters in different case.
+        if (!equal_ignore_case_scalar(a + i, b + i, 8))
+            return false;
+    }
+
+    return equal_ignore_case_scalar(a + i, b + i, count - i);
+}
+
+static unsigned __int64 hash_folded_words_sse2(unsigned __int64 h, const wchar_t* data, int word_count)
+{
+    int i = 0;
+    for (; i + 2 <= word_count; i += 2)
+    {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i * 4));
+        if (!is_ascii_sse2(chunk))
+        {
+            h = hash_folded_words_scalar(h, data + i * 4, 2);
+            continue;
+        }
+
+        unsigned __int64 words[2];
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(words), fold_ascii_sse2(chunk));
+
+        h = hash_mix(h, words[0]);
+        h = hash_mix(h, words[1]);
+    }
+
+    return hash_folded_words_scalar(h, data + i * 4, word_count - i);
+}
+#pragma endregion
+
+#pragma region AVX2
+static inline __m256i fold_ascii_avx2(__m256i v)
+{
+    __m256i is_upper = _mm256_and_si256(
+        _mm256_cmpgt_epi16(v, _mm256_set1_epi16(L'A' - 1)),
+        _mm256_cmpgt_epi16(_mm256_set1_epi16(L'Z' + 1), v));
+
+    return _mm256_add_epi16(v, _mm256_and_si256(is_upper, _mm256_set1_epi16(0x20)));
+}
+
+static int find_char_avx2(const wchar_t* data, int count, wchar_t c)
+{
+    const __m256i needle = _mm256_set1_epi16(static_cast<short>(c));
+
+    int i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        unsigned int mask = static_cast<unsigned int>(_mm256_movemask_epi8(_mm256_cmpeq_epi16(chunk, needle)));
+        if (mask != 0)
+        {
+            _mm256_zeroupper();
+            return i + lowest_set_bit(mask) / 2;
+        }
+    }
+
+    _mm256_zeroupper();
+    int tail = find_char_sse2(data + i, count - i, c);
+    return tail == -1 ? -1 : i + tail;
+}
+
+static int find_last_char_avx2(const wchar_t* data, int count, wchar_t c)
+{
+    const __m256i needle = _mm256_set1_epi16(static_cast<short>(c));
+
+    int end = count;
+    for (; end >= 16; end -= 16)
+    {
+        __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + end - 16));
+        unsigned int mask = static_cast<unsigned int>(_mm256_movemask_epi8(_mm256_cmpeq_epi16(chunk, needle)));
+        if (mask != 0)
+        {
+            _mm256_zeroupper();
+            return end - 16 + highest_set_bit(mask) / 2;
+        }
+    }
+
+    _mm256_zeroupper();
+    return find_last_char_sse2(data, end, c);
+}
+
+static size_t find_byte_avx2(const char* data, size_t count, char c)
+{
+    const __m256i needle = _mm256_set1_epi8(c);
+
+    size_t i = 0;
+    for (; i + 64 <= count; i += 64)
+    {
+        __m256i lo = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i)), needle);
+        __m256i hi = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + 32)), needle);
+        if (_mm256_testz_si256(_mm256_or_si256(lo, hi), _mm256_or_si256(lo, hi)))
+            continue;
+
+        unsigned int lo_mask = static_cast<unsigned int>(_mm256_movemask_epi8(lo));
+        unsigned int hi_mask = static_cast<unsigned int>(_mm256_movemask_epi8(hi));
+        _mm256_zeroupper();
+
+        return lo_mask != 0 ? i + lowest_set_bit(lo_mask) : i + 32 + lowest_set_bit(hi_mask);
+    }
+
+    _mm256_zeroupper();
+    return i + find_byte_sse2(data + i, count - i, c);
+}
+
+static bool equal_avx2(const wchar_t* a, const wchar_t* b, int count)
+{
+    int i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+        __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi16(va, vb)) != -1)
+        {
+            _mm256_zeroupper();
+            return false;
+        }
+    }
+
+    _mm256_zeroupper();
+    return equal_sse2(a + i, b + i, count - i);
+}
+
+static bool equal_ignore_case_avx2(const wchar_t* a, const wchar_t* b, int count)
+{
+    int i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        __m256i va = fold_ascii_avx2(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i)));
+        __m256i vb = fold_ascii_avx2(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i)));
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi16(va, vb)) == -1)
+            continue;
+
+        if (!equal_ignore_case_scalar(a + i, b + i, 16))
+        {
+            _mm256_zeroupper();
+            return false;
+        }
+    }
+
+    _mm256_zeroupper();
+    return equal_ignore_case_sse2(a + i, b + i, count - i);
+}
+#pragma endregion
+#endif // CPU_X86
+
+#if CPU_ARM
+#pragma region NEON
+static inline uint16x8_t fold_ascii_neon(uint16x8_t v)
+{
+    uint16x8_t is_upper = vcleq_u16(vsubq_u16(v, vdupq_n_u16(L'A')), vdupq_n_u16(L'Z' - L'A'));
+    return vaddq_u16(v, vandq_u16(is_upper, vdupq_n_u16(0x20)));
+}
+
+// Narrows 16-bit comparison result to 4 bits per lane, so result fits into 64-bit scalar.
+static inline unsigned __int64 neon_mask(uint16x8_t cmp)
+{
+    uint8x8_t narrowed = vshrn_n_u16(cmp, 4);
+    return vget_lane_u64(vreinterpret_u64_u8(narrowed), 0);
+}
+
+static int find_char_neon(const wchar_t* data, int count, wchar_t c)
+{
+    const uint16x8_t needle = vdupq_n_u16(static_cast<unsigned short>(c));
+    const unsigned short* units = reinterpret_cast<const unsigned short*>(data);
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        unsigned __int64 mask = neon_mask(vceqq_u16(vld1q_u16(units + i), needle));
+        if (mask != 0)
+        {
+            for (int lane = 0; lane < 8; ++lane)
+                if (data[i + lane] == c)
+                    return i + lane;
+        }
+    }
+
+    int tail = find_char_scalar(data + i, count - i, c);
+    return tail == -1 ? -1 : i + tail;
+}
+
+static int find_last_char_neon(const wchar_t* data, int count, wchar_t c)
+{
+    const uint16x8_t needle = vdupq_n_u16(static_cast<unsigned short>(c));
+    const unsigned short* units = reinterpret_cast<const unsigned short*>(data);
+
+    int end = count;
+    for (; end >= 8; end -= 8)
+    {
+        unsigned __int64 mask = neon_mask(vceqq_u16(vld1q_u16(units + end - 8), needle));
+        if (mask != 0)
+        {
+            for (int lane = 7; lane >= 0; --lane)
+                if (data[end - 8 + lane] == c)
+                    return end - 8 + lane;
+        }
+    }
+
+    return find_last_char_scalar(data, end, c);
+}
+
+static size_t find_byte_neon(const char* data, size_t count, char c)
+{
+    const uint8x16_t needle = vdupq_n_u8(static_cast<unsigned char>(c));
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        uint8x16_t cmp = vceqq_u8(vld1q_u8(bytes + i), needle);
+        uint8x8_t narrowed = vshrn_n_u16(vreinterpretq_u16_u8(cmp), 4);
+        unsigned __int64 mask = vget_lane_u64(vreinterpret_u64_u8(narrowed), 0);
+        if (mask != 0)
+        {
+            // _BitScanForward64 doesn't exist on ARM32, halves are scanned.
+            const unsigned long low = static_cast<unsigned long>(mask);
+            unsigned long bit;
+            if (low != 0)
+            {
+                _BitScanForward(&bit, low);
+                return i + bit / 4;
+            }
+            _BitScanForward(&bit, static_cast<unsigned long>(mask >> 32));
+            return i + 8 + bit / 4;
+        }
+    }
+
+    return i + find_byte_scalar(data + i, count - i, c);
+}
+
+static bool equal_neon(const wchar_t* a, const wchar_t* b, int count)
+{
+    const unsigned short* ua = reinterpret_cast<const unsigned short*>(a);
+    const unsigned short* ub = reinterpret_cast<const unsigned short*>(b);
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        if (neon_mask(vceqq_u16(vld1q_u16(ua + i), vld1q_u16(ub + i))) != ~0ull)
+            return false;
+    }
+
+    return equal_scalar(a + i, b + i, count - i);
+}
+
+static bool equal_ignore_case_neon(const wchar_t* a, const wchar_t* b, int count)
+{
+    const unsigned short* ua = reinterpret_cast<const unsigned short*>(a);
+    const unsigned short* ub = reinterpret_cast<const unsigned short*>(b);
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        uint16x8_t va = fold_ascii_neon(vld1q_u16(ua + i));
+        uint16x8_t vb = fold_ascii_neon(vld1q_u16(ub + i));
+        if (neon_mask(vceqq_u16(va, vb)) == ~0ull)
+            continue;
+
+        if (!equal_ignore_case_scalar(a + i, b + i, 8))
+            return false;
+    }
+
+    return equal_ignore_case_scalar(a + i, b + i, count - i);
+}
+
+static unsigned __int64 hash_folded_words_neon(unsigned __int64 h, const wchar_t* data, int word_count)
+{
+    const unsigned short* units = reinterpret_cast<const unsigned short*>(data);
+
+    int i = 0;
+    for (; i + 2 <= word_count; i += 2)
+    {
+        uint16x8_t chunk = vld1q_u16(units + i * 4);
+        if (neon_mask(vcgeq_u16(chunk, vdupq_n_u16(0x80))) != 0)
+        {
+            h = hash_folded_words_scalar(h, data + i * 4, 2);
+            continue;
+        }
+
+        uint64x2_t words = vreinterpretq_u64_u16(fold_ascii_neon(chunk));
+        h = hash_mix(h, vgetq_lane_u64(words, 0));
+        h = hash_mix(h, vgetq_lane_u64(words, 1));
+    }
+
+    return hash_folded_words_scalar(h, data + i * 4, word_count - i);
+}
+#pragma endregion
+#endif // CPU_ARM
+
+struct String_Kernels
+{
+    int  (*find_char)(const wchar_t* data, int count, wchar_t c);
+    int  (*find_last_char)(const wchar_t* data, int count, wchar_t c);
+    bool (*equal)(const wchar_t* a, const wchar_t* b, int count);
+    bool (*equal_ignore_case)(const wchar_t* a, const wchar_t* b, int count);
+    unsigned __int64 (*hash_folded_words)(unsigned __int64 h, const wchar_t* data, int word_count);
+    size_t (*find_byte)(const char* data, size_t count, char c);
+};
+
+static String_Kernels select_kernels()
+{
+    String_Kernels k;
+    k.find_char         = find_char_scalar;
+    k.find_last_char    = find_last_char_scalar;
+    k.equal             = equal_scalar;
+    k.equal_ignore_case = equal_ignore_case_scalar;
+    k.hash_folded_words = hash_folded_words_scalar;
+    k.find_byte         = find_byte_scalar;
+
+#if CPU_X86
+    if (g_cpu_features.has_sse2)
+    {
+        k.find_char         = find_char_sse2;
+        k.find_last_char    = find_last_char_sse2;
+        k.equal             = equal_sse2;
+        k.equal_ignore_case = equal_ignore_case_sse2;
+        k.hash_folded_words = hash_folded_words_sse2;
+        k.find_byte         = find_byte_sse2;
+    }
+
+    // Hashing is bound by serial mixing, 128-bit folding is enough there.
+    if (g_cpu_features.has_avx2)
+    {
+        k.find_char         = find_char_avx2;
+        k.find_last_char    = find_last_char_avx2;
+        k.equal             = equal_avx2;
+        k.equal_ignore_case = equal_ignore_case_avx2;
+        k.find_byte         = find_byte_avx2;
+    }
+#elif CPU_ARM
+    if (g_cpu_features.has_neon)
+    {
+        k.find_char         = find_char_neon;
+        k.find_last_char    = find_last_char_neon;
+        k.equal             = equal_neon;
+        k.equal_ignore_case = equal_ignore_case_neon;
+        k.hash_folded_words = hash_folded_words_neon;
+        k.find_byte         = find_byte_neon;
+    }
+#endif
+
+    return k;
+}
+
+static const String_Kernels& get_kernels()
+{
+    static const String_Kernels kernels = select_kernels();
+    return kernels;
+}
+
+int String_Simd::find_char(const wchar_t* data, int count, wchar_t c)
+{
+    if (data == nullptr || count <= 0)
+        return -1;
+
+    return get_kernels().find_char(data, count, c);
+}
+
+int String_Simd::find_last_char(const wchar_t* data, int count, wchar_t c)
+{
+    if (data == nullptr || count <= 0)
+        return -1;
+
+    return get_kernels().find_last_char(data, count, c);
+}
+
+bool String_Simd::equal(const wchar_t* a, const wchar_t* b, int count)
+{
+    if (count <= 0 || a == b)
+        return true;
+
+    return get_kernels().equal(a, b, count);
+}
+
+bool String_Simd::equal_ignore_case(const wchar_t* a, const wchar_t* b, int count)
+{
+    if (count <= 0 || a == b)
+        return true;
+
+    return get_kernels().equal_ignore_case(a, b, count);
+}
+
+size_t String_Simd::find_byte(const char* data, size_t count, char c)
+{
+    if (data == nullptr || count == 0)
+        return 0;
+
+    return get_kernels().find_byte(data, count, c);
+}
+
+unsigned int String_Simd::hash(const wchar_t* data, int count)
+{
+    unsigned __int64 h = 0;
+    if (data == nullptr || count <= 0)
+        return hash_finish(h, 0);
+
+    int word_count = count / 4;
+    for (int i = 0; i < word_count; ++i)
+        h = hash_mix(h, load_word(data + i * 4));
+
+    int tail_count = count - word_count * 4;
+    if (tail_count > 0)
+    {
+        wchar_t tail[4] = { 0 };
+        memcpy(tail, data + word_count * 4, sizeof(wchar_t) * tail_count);
+        h = hash_mix(h, load_word(tail));
+    }
+
+    return hash_finish(h, count);
+}
+
+unsigned int String_Simd::hash_ignore_case(const wchar_t* data, int count)
+{
+    unsigned __int64 h = 0;
+    if (data == nullptr || count <= 0)
+        return hash_finish(h, 0);
+
+    int word_count = count / 4;
+    h = get_kernels().hash_folded_words(h, data, word_count);
+
+    int tail_count = count - word_count * 4;
+    if (tail_count > 0)
+    {
+        wchar_t tail[4] = { 0 };
+        for (int i = 0; i < tail_count; ++i)
+            tail[i] = fold_char(data[word_count * 4 + i]);
+
+        h = hash_mix(h, load_word(tail));
+    }
+
+    return hash_finish(h, count);
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+// Vectorized primitives over UTF-16 code units used by String. Implementation (scalar, SSE2, AVX2 or NEON)
+// is selected once at runtime using g_cpu_features.
+struct String_Simd
+{
+    // Returns index of first/last occurrence of 'c' or -1.
+    static int find_char(const wchar_t* data, int count, wchar_t c);
+    static int find_last_char(const wchar_t* data, int count, wchar_t c);
+
+    // Byte search for 8-bit text (memchr). Returns 'count' if 'c' is not found.
+    static size_t find_byte(const char* data, size_t count, char c);
+
+    static bool equal(const wchar_t* a, const wchar_t* b, int count);
+    // Case folding matches 'fold_char': ASCII in vector registers, everything else through CharLowerW.
+    static bool equal_ignore_case(const wchar_t* a, const wchar_t* b, int count);
+
+    // Strings that are equal (ignoring case for 'hash_ignore_case') always produce the same hash,
+    // no matter which implementation is selected.
+    static unsigned int hash(const wchar_t* data, int count);
+    static unsigned int hash_ignore_case(const wchar_t* data, int count);
+
+    static wchar_t fold_char(wchar_t c);
+};
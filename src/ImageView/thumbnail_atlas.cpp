@@ -0,0 +1,229 @@
+#include <Windows.h>
+#include <d2d1.h>
+#include <string.h>
+
+#include "thumbnail_atlas.hpp"
+#include "com_utility.hpp"
+#include "error.hpp"
+
+static const int failed_cell = -1;
+
+
+bool Thumbnail_Atlas::reset(int file_count)
+{
+    E_VERIFY_R(file_count >= 0, false);
+
+    // Bitmaps are kept, cells are just overwritten.
+    g_standard_allocator->deallocate(file_cells);
+    file_cells = nullptr;
+    this->file_count = 0;
+    cell_count = 0;
+    clear_requests();
+
+    if (file_count == 0)
+        return true;
+
+    file_cells = (int*)g_standard_allocator->allocate(sizeof(int) * file_count);
+    if (file_cells == nullptr)
+        return false;
+
+    memset(file_cells, 0, sizeof(int) * file_count);
+    this->file_count = file_count;
+
+    return true;
+}
+
+bool Thumbnail_Atlas::permute(const int* order)
+{
+    E_VERIFY_NULL_R(order, false);
+
+    clear_requests();
+    if (file_count == 0)
+        return true;
+
+    int* permuted = (int*)g_standard_allocator->allocate(sizeof(int) * file_count);
+    if (permuted == nullptr)
+        return false;
+
+    for (int i = 0; i < file_count; ++i)
+    {
+        permuted[i] = file_cells[order[i]];
+        if (permuted[i] > 0)
+            cells[permuted[i] - 1].file_index = i;
+    }
+
+    g_standard_allocator->deallocate(file_cells);
+    file_cells = permuted;
+
+    return true;
+}
+
+void Thumbnail_Atlas::release()
+{
+    release_bitmaps();
+    g_standard_allocator->deallocate(file_cells);
+    file_cells = nullptr;
+    file_count = 0;
+    clear_requests();
+}
+
+void Thumbnail_Atlas::release_bitmaps()
+{
+    for (int i = 0; i < page_count; ++i)
+        safe_release(pages[i]);
+    page_count = 0;
+
+    for (int i = 0; i < cell_count; ++i)
+    {
+        if (cells[i].file_index >= 0)
+            file_cells[cells[i].file_index] = 0;
+    }
+    cell_count = 0;
+}
+
+int Thumbnail_Atlas::find(int file_index)
+{
+    if (file_index < 0 || file_index >= file_count || file_cells[file_index] <= 0)
+        return -1;
+
+    const int cell = file_cells[file_index] - 1;
+    cells[cell].last_drawn = frame;
+
+    return cell;
+}
+
+int Thumbnail_Atlas::insert(ID2D1RenderTarget* target, int file_index, const Image_Buffer& thumbnail)
+{
+    E_VERIFY_NULL_R(target, -1);
+    E_VERIFY_R(file_index >= 0 && file_index < file_count, -1);
+    E_VERIFY_R(thumbnail.width > 0 && thumbnail.width <= cell_size && thumbnail.height > 0 && thumbnail.height <= cell_size, -1);
+
+    int cell = file_cells[file_index] > 0 ? file_cells[file_index] - 1 : allocate_cell(target);
+    if (cell < 0)
+        return -1;
+
+    const UINT32 x = static_cast<UINT32>(cell % cells_per_page % cells_per_row * cell_size);
+    const UINT32 y = static_cast<UINT32>(cell % cells_per_page / cells_per_row * cell_size);
+    const D2D1_RECT_U rect = D2D1::RectU(x, y, x + static_cast<UINT32>(thumbnail.width), y + static_cast<UINT32>(thumbnail.height));
+    HRESULT hr = pages[get_page(cell)]->CopyFromMemory(&rect, thumbnail.pixels, thumbnail.stride);
+    if (FAILED(hr))
+    {
+        LOG_HRESULT_ERROR(hr, L"Unable to copy thumbnail to atlas.\n");
+        return -1;
+    }
+
+    Cell& entry = cells[cell];
+    if (entry.file_index >= 0 && entry.file_index != file_index)
+        file_cells[entry.file_index] = 0;
+
+    entry.file_index = file_index;
+    entry.last_drawn = frame;
+    entry.width = thumbnail.width;
+    entry.height = thumbnail.height;
+    file_cells[file_index] = cell + 1;
+
+    return cell;
+}
+
+void Thumbnail_Atlas::mark_failed(int file_index)
+{
+    E_VERIFY(file_index >= 0 && file_index < file_count);
+
+    if (file_cells[file_index] > 0)
+        cells[file_cells[file_index] - 1].file_index = -1;
+
+    file_cells[file_index] = failed_cell;
+}
+
+bool Thumbnail_Atlas::is_failed(int file_index) const
+{
+    return file_index >= 0 && file_index < file_count && file_cells[file_index] == failed_cell;
+}
+
+ID2D1Bitmap* Thumbnail_Atlas::get_bitmap(int cell) const
+{
+    E_VERIFY_R(cell >= 0 && cell < cell_count, nullptr);
+
+    return pages[get_page(cell)];
+}
+
+D2D1_RECT_F Thumbnail_Atlas::get_source_rect(int cell) const
+{
+    E_VERIFY_R(cell >= 0 && cell < cell_count, D2D1::RectF());
+
+    const float x = static_cast<float>(cell % cells_per_page % cells_per_row * cell_size);
+    const float y = static_cast<float>(cell % cells_per_page / cells_per_row * cell_size);
+
+    return D2D1::RectF(x, y, x + cells[cell].width, y + cells[cell].height);
+}
+
+bool Thumbnail_Atlas::request(int file_index)
+{
+    if (file_index < 0 || file_index >= file_count || file_cells[file_index] != 0)
+        return true;
+
+    if (request_count == max_requests)
+        return false;
+
+    requests[request_count++] = file_index;
+    return true;
+}
+
+bool Thumbnail_Atlas::is_requested(int file_index) const
+{
+    for (int i = 0; i < request_count; ++i)
+    {
+        if (requests[i] == file_index)
+            return true;
+    }
+
+    return false;
+}
+
+int Thumbnail_Atlas::pop_request()
+{
+    while (next_request < request_count)
+    {
+        const int file_index = requests[next_request++];
+        if (file_index < file_count && file_cells[file_index] == 0)
+            return file_index;
+    }
+
+    clear_requests();
+    return -1;
+}
+
+int Thumbnail_Atlas::allocate_cell(ID2D1RenderTarget* target)
+{
+    if (cell_count < page_count * cells_per_page)
+    {
+        cells[cell_count].file_index = -1;
+        return cell_count++;
+    }
+
+    if (page_count < max_pages)
+    {
+        const D2D1_BITMAP_PROPERTIES properties =
+            D2D1::BitmapProperties(D2D1::PixelFormat(DXGI_FORMAT_B8G8R8A8_UNORM, D2D1_ALPHA_MODE_PREMULTIPLIED));
+
+        HRESULT hr = target->CreateBitmap(D2D1::SizeU(page_size, page_size), properties, &pages[page_count]);
+        if (SUCCEEDED(hr))
+        {
+            ++page_count;
+            cells[cell_count].file_index = -1;
+            return cell_count++;
+        }
+
+        LOG_HRESULT_ERROR(hr, L"Unable to create thumbnail atlas page %d.\n", page_count);
+    }
+
+    // All cells are taken, least recently drawn one is reused. A cell drawn in this frame is still on screen.
+    int oldest = -1;
+    for (int i = 0; i < cell_count; ++i)
+    {
+        if (cells[i].last_drawn != frame && (oldest < 0 || cells[i].last_drawn < cells[oldest].last_drawn))
+            oldest = i;
+    }
+
+    return oldest;
+}
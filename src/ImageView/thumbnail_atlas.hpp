@@ -0,0 +1,84 @@
+#pragma once
+#include <Windows.h>
+#include <d2d1.h>
+
+#include "image_buffer.hpp"
+#include "thumbnail_store.hpp"
+
+// Thumbnails of files in the current folder, packed in cells of a few large bitmaps. A screen full of
+// thumbnails is drawn from a handful of bitmaps, so Direct2D batches the draws instead of switching
+// textures for each one. Cells are identified by file index, the least recently drawn one is reused
+// when all are taken, but never for a thumbnail drawn in the current frame.
+//
+// Also queues files whose thumbnails are loaded later, see 'request'.
+struct Thumbnail_Atlas
+{
+    static const int cell_size = Thumbnail_Store::thumbnail_size;
+    static const int page_size = 2048;
+    static const int cells_per_row = page_size / cell_size;
+    static const int cells_per_page = cells_per_row * cells_per_row;
+    static const int max_pages = 4;
+    static const int max_cells = max_pages * cells_per_page;
+    static const int max_requests = 1024;
+
+    // Forgets all thumbnails and failures, there are 'file_count' files now.
+    bool reset(int file_count);
+    // Files were reordered, file at 'i' is the one that was at 'order[i]'. Thumbnails are kept, requests are cleared.
+    bool permute(const int* order);
+    void release();
+    // Bitmaps belong to the render target, they must be released when it is. Thumbnails are loaded again.
+    void release_bitmaps();
+
+    // Cells drawn in a frame are not reused until the next one.
+    inline void begin_frame() { ++frame; }
+    // Returns cell with thumbnail of file at 'file_index' and marks it as drawn in this frame, or -1.
+    int find(int file_index);
+    // Copies 'thumbnail' to a cell and returns it, or -1 if bitmap can't be created or all cells are
+    // drawn in this frame.
+    int insert(ID2D1RenderTarget* target, int file_index, const Image_Buffer& thumbnail);
+    // Thumbnail of the file couldn't be loaded, it's not requested again until 'reset'.
+    void mark_failed(int file_index);
+    bool is_failed(int file_index) const;
+
+    ID2D1Bitmap* get_bitmap(int cell) const;
+    // Area of the bitmap taken by the thumbnail, it's smaller than the cell if thumbnail is not square.
+    D2D1_RECT_F get_source_rect(int cell) const;
+    inline int get_page(int cell) const { return cell / cells_per_page; }
+    inline int get_page_count() const { return page_count; }
+
+    // Queue of files whose thumbnails are loaded later, most needed first. It's rebuilt on every paint,
+    // so files scrolled out of view are not loaded anymore. Files that are in the atlas or failed are not queued.
+    inline void clear_requests() { request_count = 0; next_request = 0; }
+    bool request(int file_index);
+    inline bool has_requests() const { return request_count > next_request; }
+    // True if file was requested since the queue was last cleared, popped or not.
+    bool is_requested(int file_index) const;
+    // Returns next queued file that still needs its thumbnail, or -1 if queue is empty.
+    int pop_request();
+
+private:
+    struct Cell
+    {
+        int file_index;
+        UINT32 last_drawn;
+        int width;
+        int height;
+    };
+
+    ID2D1Bitmap* pages[max_pages] = {};
+    int page_count = 0;
+
+    Cell cells[max_cells];
+    int cell_count = 0;
+    UINT32 frame = 1;
+
+    // Cell index + 1 for each file, zero if it's not in the atlas and -1 if it failed.
+    int* file_cells = nullptr;
+    int file_count = 0;
+
+    int requests[max_requests];
+    int request_count = 0;
+    int next_request = 0;
+
+    int allocate_cell(ID2D1RenderTarget* target);
+};
@@ -0,0 +1,280 @@
+#include <Windows.h>
+#include <limits.h>
+
+#include "thumbnail_loader.hpp"
+#include "thumbnail_store.hpp"
+#include "dds_image.hpp"
+#include "exif_reader.hpp"
+#include "image_format.hpp"
+#include "image_rotation.hpp"
+#include "pixel_conversion.hpp"
+#include "resampler.hpp"
+#include "com_utility.hpp"
+#include "defer.hpp"
+#include "error.hpp"
+
+// Scaled decode factors tried, largest first. JPEG codec supports all of them.
+static const UINT transform_factors[] = { 8, 4, 2 };
+
+
+// Decodes 'frame' scaled by the codec to the smallest size that is not smaller than the thumbnail.
+// Returns S_FALSE if the codec can't decode scaled to such size.
+static HRESULT decode_scaled(IWICBitmapSource* frame, UINT width, UINT height, int thumbnail_width, int thumbnail_height,
+    Image_Buffer* pixels)
+{
+    IWICBitmapSourceTransform* transform = nullptr;
+    if (FAILED(frame->QueryInterface(IID_PPV_ARGS(&transform))))
+        return S_FALSE;
+    defer(safe_release(transform));
+
+    // Only formats with own conversion kernel, transform output is converted row by row.
+    WICPixelFormatGUID format = GUID_WICPixelFormat32bppPBGRA;
+    if (FAILED(transform->GetClosestPixelFormat(&format)))
+        return S_FALSE;
+
+    const Pixel_Layout layout = Pixel_Conversion::layout_from_wic_format(format);
+    if (layout == Pixel_Layout::Unknown || layout >= Pixel_Layout::Indexed1)
+        return S_FALSE;
+
+    UINT scaled_width = 0;
+    UINT scaled_height = 0;
+    for (UINT factor : transform_factors)
+    {
+        scaled_width = (width + factor - 1) / factor;
+        scaled_height = (height + factor - 1) / factor;
+        if (FAILED(transform->GetClosestSize(&scaled_width, &scaled_height)))
+            return S_FALSE;
+
+        if (scaled_width < width && scaled_width >= static_cast<UINT>(thumbnail_width) && scaled_height >= static_cast<UINT>(thumbnail_height))
+            break;
+
+        scaled_width = 0;
+    }
+
+    if (scaled_width == 0)
+        return S_FALSE;
+
+    const UINT source_stride = (static_cast<UINT>(Pixel_Conversion::bits_per_pixel(layout)) * scaled_width + 31) / 32 * 4;
+    const UINT buffer_size = source_stride * scaled_height;
+
+    BYTE* buffer = (BYTE*)g_standard_allocator->allocate(buffer_size);
+    if (buffer == nullptr)
+        return E_OUTOFMEMORY;
+    defer(g_standard_allocator->deallocate(buffer));
+
+    WICRect rect = { 0, 0, static_cast<INT>(scaled_width), static_cast<INT>(scaled_height) };
+    HRESULT hr = transform->CopyPixels(&rect, scaled_width, scaled_height, &format, WICBitmapTransformRotate0, source_stride,
+        buffer_size, buffer);
+    if (FAILED(hr))
+        return hr;
+
+    if (!pixels->allocate(rect.Width, rect.Height))
+        return E_OUTOFMEMORY;
+
+    for (int y = 0; y < rect.Height; ++y)
+        Pixel_Conversion::convert_row(layout, buffer + static_cast<size_t>(y) * source_stride, pixels->row(y), rect.Width, nullptr);
+
+    return S_OK;
+}
+
+// Decodes 'frame' of 'width' x 'height' pixels to a thumbnail of the given size.
+static HRESULT decode_thumbnail(IWICImagingFactory* wic, IWICBitmapSource* frame, UINT width, UINT height, int thumbnail_width,
+    int thumbnail_height, Image_Buffer* thumbnail)
+{
+    Image_Buffer scaled;
+    HRESULT hr = decode_scaled(frame, width, height, thumbnail_width, thumbnail_height, &scaled);
+    if (FAILED(hr))
+        return hr;
+    defer(scaled.release());
+
+    if (!thumbnail->allocate(thumbnail_width, thumbnail_height))
+        return E_OUTOFMEMORY;
+
+    if (hr == S_OK)
+    {
+        if (!Resampler::resample(scaled, *thumbnail, Resample_Filter::Bicubic, false))
+        {
+            thumbnail->release();
+            return E_OUTOFMEMORY;
+        }
+
+        return S_OK;
+    }
+
+    // Scaler reads the frame as it's asked for scaled rows, copy reads those in strips.
+    IWICBitmapSource* source = frame;
+    IWICBitmapScaler* scaler = nullptr;
+    defer(safe_release(scaler));
+    if (thumbnail_width != static_cast<int>(width) || thumbnail_height != static_cast<int>(height))
+    {
+        hr = wic->CreateBitmapScaler(&scaler);
+        if (SUCCEEDED(hr))
+            hr = scaler->Initialize(frame, static_cast<UINT>(thumbnail_width), static_cast<UINT>(thumbnail_height), WICBitmapInterpolationModeFant);
+        if (FAILED(hr))
+        {
+            thumbnail->release();
+            return hr;
+        }
+
+        source = scaler;
+    }
+
+    const WICRect rect = { 0, 0, thumbnail_width, thumbnail_height };
+    hr = Pixel_Conversion::copy_pixels(wic, source, rect, thumbnail->pixels, thumbnail->stride);
+    if (FAILED(hr))
+        thumbnail->release();
+
+    return hr;
+}
+
+// Decodes thumbnail from a JPEG embedded in the file. Returns S_FALSE if there's none that's large enough
+// and has the same aspect ratio as the image.
+static HRESULT load_embedded(IWICImagingFactory* wic, const String& path, Image_Buffer* thumbnail)
+{
+    HANDLE file = CreateFileW(path.data, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return HRESULT_FROM_WIN32(GetLastError());
+    defer(CloseHandle(file));
+
+    Exif_Info info;
+    HRESULT hr = Exif_Reader::read(file, &info);
+    if (hr != S_OK || info.width <= 0 || info.height <= 0)
+        return FAILED(hr) ? hr : S_FALSE;
+
+    int thumbnail_width;
+    int thumbnail_height;
+    Thumbnail_Store::get_thumbnail_size(info.width, info.height, &thumbnail_width, &thumbnail_height);
+
+    // EXIF thumbnail is tried first, larger preview is slower to decode.
+    const Embedded_Image images[] = { Embedded_Image::Thumbnail, Embedded_Image::Preview };
+    for (int i = 0; i < ARRAYSIZE(images); ++i)
+    {
+        IWICBitmapFrameDecode* frame = nullptr;
+        UINT width = 0;
+        UINT height = 0;
+        if (Exif_Reader::open_embedded_frame(wic, file, info, images[i], static_cast<UINT>(info.width), static_cast<UINT>(info.height),
+            &frame, &width, &height) != S_OK)
+        {
+            continue;
+        }
+        defer(safe_release(frame));
+
+        if (width < static_cast<UINT>(thumbnail_width) || height < static_cast<UINT>(thumbnail_height))
+            continue;
+
+        if (SUCCEEDED(decode_thumbnail(wic, frame, width, height, thumbnail_width, thumbnail_height, thumbnail)))
+            return S_OK;
+    }
+
+    return S_FALSE;
+}
+
+// Decodes thumbnail from the smallest mip level of a block compressed DDS texture that is not smaller than
+// the thumbnail. Returns S_FALSE if the texture is in another format, WIC decodes it then.
+static HRESULT load_dds(const String& path, Image_Buffer* thumbnail)
+{
+    Dds_Image dds;
+    HRESULT hr = dds.open(path);
+    if (hr == WINCODEC_ERR_UNSUPPORTEDPIXELFORMAT)
+        return S_FALSE;
+    if (FAILED(hr))
+        return hr;
+    defer(dds.close());
+
+    int thumbnail_width;
+    int thumbnail_height;
+    Thumbnail_Store::get_thumbnail_size(dds.widths[0], dds.heights[0], &thumbnail_width, &thumbnail_height);
+
+    const int level = dds.choose_level(thumbnail_width, thumbnail_height);
+    Image_Buffer pixels;
+    if (!pixels.allocate(dds.widths[level], dds.heights[level]))
+        return E_OUTOFMEMORY;
+    defer(pixels.release());
+
+    const WICRect rect = { 0, 0, pixels.width, pixels.height };
+    hr = dds.copy_pixels(level, rect, pixels.pixels, pixels.stride);
+    if (FAILED(hr))
+        return hr;
+
+    if (!thumbnail->allocate(thumbnail_width, thumbnail_height))
+        return E_OUTOFMEMORY;
+
+    if (!Resampler::resample(pixels, *thumbnail, Resample_Filter::Bicubic, false))
+    {
+        thumbnail->release();
+        return E_OUTOFMEMORY;
+    }
+
+    return S_OK;
+}
+
+// Loads thumbnail of the image at 'path' the way pixels are stored in the file.
+static HRESULT load_stored(IWICImagingFactory* wic, const String& path, Image_Buffer* thumbnail)
+{
+    // Camera JPEGs carry a thumbnail, it's decoded instead of the image.
+    if (Image_Format_Registry::from_file_name(path) == Image_Format::Jpeg && load_embedded(wic, path, thumbnail) == S_OK)
+        return S_OK;
+
+    // Block compressed textures are read from their own mip levels.
+    if (Image_Format_Registry::from_file_name(path) == Image_Format::Dds)
+    {
+        HRESULT hr = load_dds(path, thumbnail);
+        if (hr != S_FALSE)
+            return hr;
+    }
+
+    IWICBitmapDecoder* decoder = nullptr;
+    HRESULT hr = wic->CreateDecoderFromFilename(path.data, nullptr, GENERIC_READ, WICDecodeMetadataCacheOnDemand, &decoder);
+    if (FAILED(hr))
+        return hr;
+    defer(safe_release(decoder));
+
+    IWICBitmapFrameDecode* frame = nullptr;
+    hr = decoder->GetFrame(0, &frame);
+    if (FAILED(hr))
+        return hr;
+    defer(safe_release(frame));
+
+    UINT width = 0;
+    UINT height = 0;
+    hr = frame->GetSize(&width, &height);
+    if (FAILED(hr))
+        return hr;
+    if (width == 0 || height == 0 || width > INT_MAX || height > INT_MAX)
+        return WINCODEC_ERR_IMAGESIZEOUTOFRANGE;
+
+    int thumbnail_width;
+    int thumbnail_height;
+    Thumbnail_Store::get_thumbnail_size(static_cast<int>(width), static_cast<int>(height), &thumbnail_width, &thumbnail_height);
+
+    return decode_thumbnail(wic, frame, width, height, thumbnail_width, thumbnail_height, thumbnail);
+}
+
+HRESULT Thumbnail_Loader::load(IWICImagingFactory* wic, const String& path, Image_Buffer* thumbnail)
+{
+    E_VERIFY_NULL_R(wic, E_INVALIDARG);
+    E_VERIFY_R(!String::is_null_or_empty(path), E_INVALIDARG);
+    E_VERIFY_NULL_R(thumbnail, E_INVALIDARG);
+
+    HRESULT hr = load_stored(wic, path, thumbnail);
+    if (FAILED(hr) || Image_Format_Registry::from_file_name(path) != Image_Format::Jpeg)
+        return hr;
+
+    // Photos taken sideways are stored as the sensor saw them, the thumbnail is turned upright. It's
+    // small, so it's turned on the calling thread.
+    const Orientation orientation = Image_Rotation::from_exif(Exif_Reader::read_orientation(path));
+    if (orientation == Orientation::Normal)
+        return hr;
+
+    Image_Buffer oriented;
+    if (!Image_Rotation::transform(*thumbnail, orientation, &oriented, nullptr))
+    {
+        thumbnail->release();
+        return E_OUTOFMEMORY;
+    }
+
+    thumbnail->release();
+    *thumbnail = oriented;
+    return hr;
+}
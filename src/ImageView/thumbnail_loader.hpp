@@ -0,0 +1,17 @@
+#pragma once
+#include <wincodec.h>
+
+#include "string.hpp"
+#include "image_buffer.hpp"
+
+// Decodes thumbnails of image files, sized by Thumbnail_Store::get_thumbnail_size. Thumbnail or preview
+// embedded in a camera JPEG is used when it has the aspect ratio of the image. Codecs that can decode
+// scaled (IWICBitmapSourceTransform, e.g. JPEG at 1/8) decode just above the thumbnail size, which is
+// then resampled. Other images are scaled by WIC while they're read, so full size pixels are never held.
+//
+// Uses WIC, so it must be called from a thread with COM initialized.
+struct Thumbnail_Loader
+{
+    // Allocates 'thumbnail' and decodes first frame of the image at 'path' into it.
+    static HRESULT load(IWICImagingFactory* wic, const String& path, Image_Buffer* thumbnail);
+};
@@ -0,0 +1,688 @@
+#include <Windows.h>
+#include <string.h>
+#include <wchar.h>
+
+#include "thumbnail_store.hpp"
+#include "defer.hpp"
+#include "error.hpp"
+
+
+Thumbnail_Store  g_thumbnail_store_obj;
+Thumbnail_Store* g_thumbnail_store = &g_thumbnail_store_obj;
+
+
+static const UINT32 file_magic = 0x48545649; // "IVTH"
+// Version 2 stores JPEG thumbnails turned by EXIF orientation.
+static const UINT32 file_version = 2;
+
+// Index starts on its own page after the header, records after the index. Views of records start at
+// multiples of 64 KB, the allocation granularity of Windows.
+static const UINT64 index_offset = 4096;
+static const UINT64 view_alignment = 64 * 1024;
+static const UINT64 record_size = Thumbnail_Store::thumbnail_size * Thumbnail_Store::thumbnail_size * sizeof(UINT32);
+
+// Compaction is not worth it for fewer superseded records.
+static const int min_dead_records_for_compaction = 1024;
+
+
+static inline UINT64 get_data_offset()
+{
+    const UINT64 index_end = index_offset + sizeof(UINT64) * 3 * Thumbnail_Store::max_records;
+    return (index_end + view_alignment - 1) / view_alignment * view_alignment;
+}
+
+static inline UINT64 get_record_offset(int record)
+{
+    return get_data_offset() + record_size * record;
+}
+
+static inline UINT32 hash_value(UINT64 value)
+{
+    return static_cast<UINT32>((value * 0x9E3779B97F4A7C15ull) >> 32);
+}
+
+UINT64 Thumbnail_Store::hash_path(const String& path)
+{
+    // 64-bit FNV-1a, paths of a large folder can't collide in practice like with 32-bit String::hash.
+    // File systems ignore case, so does the hash, folding ASCII letters is enough for paths that
+    // come from enumerating the same folder.
+    UINT64 hash = 0xCBF29CE484222325ull;
+    for (int i = 0; i < path.count; ++i)
+    {
+        wchar_t c = path.data[i];
+        if (c >= L'a' && c <= L'z')
+            c -= L'a' - L'A';
+
+        hash = (hash ^ static_cast<UINT16>(c)) * 0x100000001B3ull;
+    }
+
+    return hash;
+}
+
+UINT64 Thumbnail_Store::make_key(UINT64 path_hash, UINT64 file_size, const FILETIME& date_modified)
+{
+    const UINT64 date = (static_cast<UINT64>(date_modified.dwHighDateTime) << 32) | date_modified.dwLowDateTime;
+
+    UINT64 key = path_hash ^ (file_size * 0x9E3779B97F4A7C15ull);
+    key = (key ^ (key >> 33)) * 0xFF51AFD7ED558CCDull;
+    key ^= date;
+    key = (key ^ (key >> 33)) * 0xC4CEB9FE1A85EC53ull;
+    key ^= key >> 33;
+
+    return key;
+}
+
+void Thumbnail_Store::get_thumbnail_size(int width, int height, int* thumbnail_width, int* thumbnail_height)
+{
+    E_VERIFY_NULL(thumbnail_width);
+    E_VERIFY_NULL(thumbnail_height);
+
+    if (width <= thumbnail_size && height <= thumbnail_size)
+    {
+        *thumbnail_width = max(width, 1);
+        *thumbnail_height = max(height, 1);
+    }
+    else if (width >= height)
+    {
+        *thumbnail_width = thumbnail_size;
+        *thumbnail_height = max(static_cast<int>((static_cast<INT64>(height) * thumbnail_size + width / 2) / width), 1);
+    }
+    else
+    {
+        *thumbnail_width = max(static_cast<int>((static_cast<INT64>(width) * thumbnail_size + height / 2) / height), 1);
+        *thumbnail_height = thumbnail_size;
+    }
+}
+
+HRESULT Thumbnail_Store::open(const String& file_path)
+{
+    static_assert(sizeof(Index_Entry) == sizeof(UINT64) * 3, "Index entry size is part of the file format.");
+    static_assert(sizeof(File_Header) <= index_offset, "Header must fit before the index.");
+
+    E_VERIFY_R(!String::is_null_or_empty(file_path), E_INVALIDARG);
+    E_VERIFY_R(file == INVALID_HANDLE_VALUE, E_UNEXPECTED); // Call 'close' first!
+
+    path = String::duplicate(file_path.data, file_path.count);
+    if (String::is_null(path))
+        return E_OUTOFMEMORY;
+
+    // Another instance can't write to it at the same time, compaction reads it through its own handle.
+    file = CreateFileW(path.data, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        HRESULT hr = HRESULT_FROM_WIN32(GetLastError());
+        close();
+        return hr;
+    }
+
+    // File of another version or with damaged header is started again.
+    File_Header existing = {};
+    DWORD read_size = 0;
+    bool is_valid = ReadFile(file, &existing, sizeof(existing), &read_size, nullptr) && read_size == sizeof(existing) &&
+        existing.magic == file_magic && existing.version == file_version && existing.thumbnail_size == thumbnail_size &&
+        existing.max_records == max_records && existing.record_count <= max_records;
+
+    if (is_valid && !GetFileSizeEx(file, (LARGE_INTEGER*)&file_size))
+    {
+        HRESULT hr = HRESULT_FROM_WIN32(GetLastError());
+        close();
+        return hr;
+    }
+
+    HRESULT hr = is_valid ? S_OK : create_header();
+    if (SUCCEEDED(hr))
+        hr = grow_file(0);
+
+    if (FAILED(hr))
+    {
+        close();
+        return hr;
+    }
+
+    const UINT64 data_offset = get_data_offset();
+    void* view = MapViewOfFile(mapping, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, static_cast<size_t>(data_offset));
+    if (view == nullptr)
+    {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+        close();
+        return hr;
+    }
+
+    header = static_cast<File_Header*>(view);
+    index = reinterpret_cast<Index_Entry*>(static_cast<BYTE*>(view) + index_offset);
+
+    // Records past the end of the file were committed to a file that was truncated later, they're dropped.
+    const UINT64 records_in_file = (file_size - data_offset) / record_size;
+    record_count = static_cast<int>(min(static_cast<UINT64>(header->record_count), records_in_file));
+    if (static_cast<UINT32>(record_count) != header->record_count)
+    {
+        // Count is lowered in the file too, records added later must not look committed before they are.
+        header->record_count = static_cast<UINT32>(record_count);
+        if (!FlushViewOfFile(header, sizeof(File_Header)))
+        {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+            close();
+            return hr;
+        }
+    }
+
+    // Segments are mapped whole, compacted file ends after its last record.
+    hr = grow_file((record_count + segment_records - 1) / segment_records);
+    if (FAILED(hr))
+    {
+        close();
+        return hr;
+    }
+
+    if (!build_tables(record_count))
+    {
+        close();
+        return E_OUTOFMEMORY;
+    }
+
+    return S_OK;
+}
+
+void Thumbnail_Store::close()
+{
+    if (compaction != nullptr)
+    {
+        g_job_pool->wait(&compaction->group);
+        DeleteFileW(compaction->target_path.data);
+        release_compaction();
+    }
+
+    if (header != nullptr)
+    {
+        HRESULT hr = commit();
+        if (FAILED(hr))
+            LOG_HRESULT_ERROR(hr, L"Unable to commit thumbnails.\n");
+    }
+
+    for (int i = 0; i < max_segments; ++i)
+        unmap_segment(i);
+
+    if (header != nullptr)
+    {
+        UnmapViewOfFile(header);
+        header = nullptr;
+        index = nullptr;
+    }
+
+    if (mapping != 0)
+    {
+        CloseHandle(mapping);
+        mapping = 0;
+    }
+
+    if (file != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(file);
+        file = INVALID_HANDLE_VALUE;
+    }
+
+    g_standard_allocator->deallocate(key_table);
+    g_standard_allocator->deallocate(path_table);
+    key_table = nullptr;
+    path_table = nullptr;
+    table_mask = 0;
+
+    g_standard_allocator->deallocate(path.data);
+    path = String();
+    file_size = 0;
+    record_count = 0;
+    dead_count = 0;
+    next_segment_to_unmap = 0;
+}
+
+bool Thumbnail_Store::find(UINT64 key, Image_Buffer* thumbnail)
+{
+    E_VERIFY_NULL_R(thumbnail, false);
+
+    if (record_count == 0)
+        return false;
+
+    const int slot = find_slot(key_table, key, false);
+    if (key_table[slot] == 0)
+        return false;
+
+    const int record = key_table[slot] - 1;
+    if (!is_live(record))
+        return false;
+
+    BYTE* pixels = map_record(record);
+    if (pixels == nullptr)
+        return false;
+
+    const Index_Entry& entry = index[record];
+    thumbnail->pixels = pixels;
+    thumbnail->width = entry.width;
+    thumbnail->height = entry.height;
+    thumbnail->stride = entry.width * sizeof(UINT32);
+    thumbnail->allocator = nullptr;
+
+    return true;
+}
+
+HRESULT Thumbnail_Store::insert(UINT64 key, UINT64 path_hash, const Image_Buffer& thumbnail)
+{
+    E_VERIFY_R(is_open(), E_UNEXPECTED);
+    E_VERIFY_R(!thumbnail.is_empty(), E_INVALIDARG);
+    E_VERIFY_R(thumbnail.width <= thumbnail_size && thumbnail.height <= thumbnail_size, E_INVALIDARG);
+
+    if (record_count == max_records)
+        return HRESULT_FROM_WIN32(ERROR_DATABASE_FULL);
+
+    if (2 * (record_count + 1) > table_mask + 1 && !build_tables(2 * record_count))
+        return E_OUTOFMEMORY;
+
+    const int record = record_count;
+    HRESULT hr = grow_file(record / segment_records + 1);
+    if (FAILED(hr))
+        return hr;
+
+    BYTE* pixels = map_record(record);
+    if (pixels == nullptr)
+        return HRESULT_FROM_WIN32(GetLastError());
+
+    // Rows are packed, the rest of the record is left as it is.
+    const size_t row_size = thumbnail.width * sizeof(UINT32);
+    for (int y = 0; y < thumbnail.height; ++y)
+        memcpy(pixels + row_size * y, thumbnail.row(y), row_size);
+
+    Index_Entry& entry = index[record];
+    entry.key = key;
+    entry.path_hash = path_hash;
+    entry.width = static_cast<UINT16>(thumbnail.width);
+    entry.height = static_cast<UINT16>(thumbnail.height);
+    entry.reserved = 0;
+
+    dirty_segments[record / segment_records] = true;
+    ++record_count;
+    add_to_tables(record);
+
+    return S_OK;
+}
+
+HRESULT Thumbnail_Store::commit()
+{
+    E_VERIFY_R(is_open(), E_UNEXPECTED);
+
+    const int committed_count = static_cast<int>(header->record_count);
+    E_VERIFY_R(record_count >= committed_count, E_UNEXPECTED);
+    if (record_count == committed_count)
+        return S_OK;
+
+    // Records and index entries reach the disk before the count that makes them visible.
+    for (int i = 0; i < max_segments; ++i)
+    {
+        if (dirty_segments[i] && segments[i] != nullptr && !FlushViewOfFile(segments[i], 0))
+            return HRESULT_FROM_WIN32(GetLastError());
+
+        dirty_segments[i] = false;
+    }
+
+    const size_t index_size = sizeof(Index_Entry) * (record_count - committed_count);
+    if (!FlushViewOfFile(&index[committed_count], index_size))
+        return HRESULT_FROM_WIN32(GetLastError());
+
+    if (!FlushFileBuffers(file))
+        return HRESULT_FROM_WIN32(GetLastError());
+
+    header->record_count = static_cast<UINT32>(record_count);
+    if (!FlushViewOfFile(header, sizeof(File_Header)))
+        return HRESULT_FROM_WIN32(GetLastError());
+
+    return S_OK;
+}
+
+bool Thumbnail_Store::needs_compaction() const
+{
+    if (!is_open() || compaction != nullptr || dead_count == 0)
+        return false;
+
+    // Full file is compacted for any superseded records, nothing can be added otherwise.
+    if (record_count > max_records - segment_records)
+        return true;
+
+    return dead_count >= min_dead_records_for_compaction && dead_count >= record_count - dead_count;
+}
+
+HRESULT Thumbnail_Store::start_compaction()
+{
+    E_VERIFY_R(is_open(), E_UNEXPECTED);
+    E_VERIFY_R(compaction == nullptr, E_UNEXPECTED);
+
+    // Compaction reads the file through its own handle, it sees only what's committed.
+    HRESULT hr = commit();
+    if (FAILED(hr))
+        return hr;
+
+    compaction = (Compaction*)g_standard_allocator->allocate(sizeof(Compaction));
+    if (compaction == nullptr)
+        return E_OUTOFMEMORY;
+
+    memset(compaction, 0, sizeof(Compaction));
+    const int live_count = record_count - dead_count;
+    compaction->source_path = String::duplicate(path.data, path.count);
+    compaction->target_path = String::allocate_string_of_length(path.count + 4);
+    compaction->records = (int*)g_standard_allocator->allocate(sizeof(int) * max(live_count, 1));
+    compaction->entries = (Index_Entry*)g_standard_allocator->allocate(sizeof(Index_Entry) * max(live_count, 1));
+    if (String::is_null(compaction->source_path) || String::is_null(compaction->target_path) ||
+        compaction->records == nullptr || compaction->entries == nullptr)
+    {
+        release_compaction();
+        return E_OUTOFMEMORY;
+    }
+
+    wmemcpy(compaction->target_path.data, path.data, path.count);
+    wmemcpy(compaction->target_path.data + path.count, L".new", 5);
+
+    for (int i = 0; i < record_count; ++i)
+    {
+        if (is_live(i))
+        {
+            compaction->records[compaction->count] = i;
+            compaction->entries[compaction->count] = index[i];
+            ++compaction->count;
+        }
+    }
+
+    compaction->snapshot_count = record_count;
+    compaction->result = E_PENDING;
+
+    if (!g_job_pool->submit(run_compaction, compaction, 0, &compaction->group))
+        run_compaction(compaction, 0);
+
+    return S_OK;
+}
+
+HRESULT Thumbnail_Store::finish_compaction()
+{
+    E_VERIFY_R(compaction != nullptr, E_UNEXPECTED);
+
+    g_job_pool->wait(&compaction->group);
+    defer(release_compaction());
+
+    HRESULT hr = compaction->result;
+    if (FAILED(hr))
+    {
+        DeleteFileW(compaction->target_path.data);
+        return hr;
+    }
+
+    // Thumbnails inserted while compaction ran are appended to the new file before it replaces this one.
+    Thumbnail_Store compacted;
+    hr = compacted.open(compaction->target_path);
+    for (int i = compaction->snapshot_count; SUCCEEDED(hr) && i < record_count; ++i)
+    {
+        Image_Buffer thumbnail;
+        if (is_live(i) && find(index[i].key, &thumbnail))
+            hr = compacted.insert(index[i].key, index[i].path_hash, thumbnail);
+    }
+
+    compacted.close();
+    if (FAILED(hr))
+    {
+        DeleteFileW(compaction->target_path.data);
+        return hr;
+    }
+
+    String file_path = String::duplicate(path.data, path.count);
+    if (String::is_null(file_path))
+        return E_OUTOFMEMORY;
+    defer(g_standard_allocator->deallocate(file_path.data));
+
+    // Compaction is done, so closing doesn't wait for it or delete the new file.
+    Compaction* finished = compaction;
+    compaction = nullptr;
+    close();
+    compaction = finished;
+
+    if (!MoveFileExW(compaction->target_path.data, file_path.data, MOVEFILE_REPLACE_EXISTING))
+    {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+        DeleteFileW(compaction->target_path.data);
+        open(file_path);
+        return hr;
+    }
+
+    return open(file_path);
+}
+
+HRESULT Thumbnail_Store::create_header()
+{
+    // Truncated first, so old records and index entries don't stay in the file.
+    LARGE_INTEGER start = {};
+    if (!SetFilePointerEx(file, start, nullptr, FILE_BEGIN) || !SetEndOfFile(file))
+        return HRESULT_FROM_WIN32(GetLastError());
+
+    File_Header new_header = {};
+    new_header.magic = file_magic;
+    new_header.version = file_version;
+    new_header.thumbnail_size = thumbnail_size;
+    new_header.max_records = max_records;
+    new_header.record_count = 0;
+
+    DWORD written = 0;
+    if (!WriteFile(file, &new_header, sizeof(new_header), &written, nullptr) || written != sizeof(new_header))
+        return HRESULT_FROM_WIN32(GetLastError());
+
+    file_size = sizeof(new_header);
+    return S_OK;
+}
+
+bool Thumbnail_Store::build_tables(int capacity)
+{
+    // Tables are kept at most half full, so probe sequences stay short.
+    int table_size = 1024;
+    while (table_size < 2 * capacity)
+        table_size *= 2;
+
+    int* new_key_table = (int*)g_standard_allocator->allocate(sizeof(int) * table_size);
+    int* new_path_table = (int*)g_standard_allocator->allocate(sizeof(int) * table_size);
+    if (new_key_table == nullptr || new_path_table == nullptr)
+    {
+        g_standard_allocator->deallocate(new_key_table);
+        g_standard_allocator->deallocate(new_path_table);
+        return false;
+    }
+
+    g_standard_allocator->deallocate(key_table);
+    g_standard_allocator->deallocate(path_table);
+    key_table = new_key_table;
+    path_table = new_path_table;
+
+    memset(key_table, 0, sizeof(int) * table_size);
+    memset(path_table, 0, sizeof(int) * table_size);
+    table_mask = table_size - 1;
+    dead_count = 0;
+
+    // Index holds everything the tables do. Later records replace earlier ones with the same key or path.
+    for (int i = 0; i < record_count; ++i)
+        add_to_tables(i);
+
+    return true;
+}
+
+int Thumbnail_Store::find_slot(const int* table, UINT64 value, bool by_path) const
+{
+    int slot = static_cast<int>(hash_value(value)) & table_mask;
+    while (table[slot] != 0)
+    {
+        const Index_Entry& entry = index[table[slot] - 1];
+        if ((by_path ? entry.path_hash : entry.key) == value)
+            break;
+
+        slot = (slot + 1) & table_mask;
+    }
+
+    return slot;
+}
+
+void Thumbnail_Store::add_to_tables(int record)
+{
+    const Index_Entry& entry = index[record];
+    key_table[find_slot(key_table, entry.key, false)] = record + 1;
+
+    const int path_slot = find_slot(path_table, entry.path_hash, true);
+    if (path_table[path_slot] != 0)
+        ++dead_count;
+    path_table[path_slot] = record + 1;
+}
+
+inline bool Thumbnail_Store::is_live(int record) const
+{
+    return path_table[find_slot(path_table, index[record].path_hash, true)] == record + 1;
+}
+
+BYTE* Thumbnail_Store::map_record(int record)
+{
+    const int segment = record / segment_records;
+    if (segments[segment] == nullptr)
+    {
+        if (mapped_segment_count == max_mapped_segments)
+        {
+            // Round robin is good enough, thumbnails are copied out right after they're found.
+            while (segments[next_segment_to_unmap] == nullptr)
+                next_segment_to_unmap = (next_segment_to_unmap + 1) % max_segments;
+
+            unmap_segment(next_segment_to_unmap);
+        }
+
+        const UINT64 offset = get_record_offset(segment * segment_records);
+        void* view = MapViewOfFile(mapping, FILE_MAP_READ | FILE_MAP_WRITE, static_cast<DWORD>(offset >> 32),
+            static_cast<DWORD>(offset & 0xFFFFFFFF), static_cast<size_t>(record_size * segment_records));
+        if (view == nullptr)
+        {
+            LOG_LAST_WIN32_ERROR(L"Unable to map thumbnails %d to %d.\n", segment * segment_records, (segment + 1) * segment_records - 1);
+            return nullptr;
+        }
+
+        segments[segment] = static_cast<BYTE*>(view);
+        ++mapped_segment_count;
+    }
+
+    return segments[segment] + record_size * (record % segment_records);
+}
+
+HRESULT Thumbnail_Store::grow_file(int segment_count)
+{
+    // Mapping extends the file to its size. Views of the old mapping stay valid after it's closed.
+    const UINT64 size = max(get_record_offset(segment_count * segment_records), file_size);
+    if (mapping != 0 && size == file_size)
+        return S_OK;
+
+    HANDLE new_mapping = CreateFileMappingW(file, nullptr, PAGE_READWRITE, static_cast<DWORD>(size >> 32),
+        static_cast<DWORD>(size & 0xFFFFFFFF), nullptr);
+    if (new_mapping == 0)
+        return HRESULT_FROM_WIN32(GetLastError());
+
+    if (mapping != 0)
+        CloseHandle(mapping);
+
+    mapping = new_mapping;
+    file_size = size;
+    return S_OK;
+}
+
+void Thumbnail_Store::unmap_segment(int segment)
+{
+    if (segments[segment] == nullptr)
+        return;
+
+    // Unmapped pages are written by the system later, they're flushed now so 'commit' doesn't miss them.
+    if (dirty_segments[segment])
+        FlushViewOfFile(segments[segment], 0);
+
+    UnmapViewOfFile(segments[segment]);
+    segments[segment] = nullptr;
+    --mapped_segment_count;
+}
+
+void Thumbnail_Store::run_compaction(void* context, int)
+{
+    Compaction* compaction = (Compaction*)context;
+
+    HANDLE source = CreateFileW(compaction->source_path.data, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+        OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, nullptr);
+    if (source == INVALID_HANDLE_VALUE)
+    {
+        compaction->result = HRESULT_FROM_WIN32(GetLastError());
+        return;
+    }
+    defer(CloseHandle(source));
+
+    HANDLE target = CreateFileW(compaction->target_path.data, GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+        FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (target == INVALID_HANDLE_VALUE)
+    {
+        compaction->result = HRESULT_FROM_WIN32(GetLastError());
+        return;
+    }
+    defer(CloseHandle(target));
+
+    // Header and index are written as one block, records one by one after it.
+    const size_t data_offset = static_cast<size_t>(get_data_offset());
+    BYTE* buffer = (BYTE*)g_standard_allocator->allocate(data_offset);
+    if (buffer == nullptr)
+    {
+        compaction->result = E_OUTOFMEMORY;
+        return;
+    }
+    defer(g_standard_allocator->deallocate(buffer));
+
+    memset(buffer, 0, data_offset);
+    File_Header* new_header = reinterpret_cast<File_Header*>(buffer);
+    new_header->magic = file_magic;
+    new_header->version = file_version;
+    new_header->thumbnail_size = thumbnail_size;
+    new_header->max_records = max_records;
+    new_header->record_count = static_cast<UINT32>(compaction->count);
+    memcpy(buffer + index_offset, compaction->entries, sizeof(Index_Entry) * compaction->count);
+
+    DWORD written = 0;
+    if (!WriteFile(target, buffer, static_cast<DWORD>(data_offset), &written, nullptr))
+    {
+        compaction->result = HRESULT_FROM_WIN32(GetLastError());
+        return;
+    }
+
+    for (int i = 0; i < compaction->count; ++i)
+    {
+        LARGE_INTEGER offset;
+        offset.QuadPart = static_cast<LONGLONG>(get_record_offset(compaction->records[i]));
+
+        DWORD read_size = 0;
+        if (!SetFilePointerEx(source, offset, nullptr, FILE_BEGIN) ||
+            !ReadFile(source, buffer, static_cast<DWORD>(record_size), &read_size, nullptr) || read_size != record_size ||
+            !WriteFile(target, buffer, static_cast<DWORD>(record_size), &written, nullptr))
+        {
+            // Short read sets no error, file was truncated by someone else.
+            const DWORD error = GetLastError();
+            compaction->result = error != ERROR_SUCCESS ? HRESULT_FROM_WIN32(error) : HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+            return;
+        }
+    }
+
+    if (!FlushFileBuffers(target))
+    {
+        compaction->result = HRESULT_FROM_WIN32(GetLastError());
+        return;
+    }
+
+    compaction->result = S_OK;
+}
+
+void Thumbnail_Store::release_compaction()
+{
+    if (compaction == nullptr)
+        return;
+
+    g_standard_allocator->deallocate(compaction->source_path.data);
+    g_standard_allocator->deallocate(compaction->target_path.data);
+    g_standard_allocator->deallocate(compaction->records);
+    g_standard_allocator->deallocate(compaction->entries);
+    g_standard_allocator->deallocate(compaction);
+    compaction = nullptr;
+}
@@ -0,0 +1,129 @@
+#pragma once
+#include <Windows.h>
+
+#include "string.hpp"
+#include "image_buffer.hpp"
+#include "job_pool.hpp"
+
+// Thumbnails kept on disk between runs, in one memory mapped file. Thumbnails are identified by a key
+// hashed from path, size and modification date of the image file, so a changed file gets a new one.
+//
+// File starts with a header and an index of fixed size entries, followed by fixed size records of
+// thumbnail pixels. Both are only appended to: a record and its index entry are written past the
+// committed count, and 'commit' flushes them before it advances the count in the header. After a crash
+// uncommitted records are just not there. Records superseded by newer thumbnails of the same path are
+// dropped by compaction, which copies live ones to a new file on a job pool thread and replaces the old one.
+//
+// Not thread safe, used from the window thread only.
+struct Thumbnail_Store
+{
+    // Longer side of a thumbnail.
+    static const int thumbnail_size = 128;
+    static const int max_records = 256 * 1024;
+
+    HRESULT open(const String& file_path);
+    // Commits appended thumbnails and waits for compaction.
+    void close();
+    inline bool is_open() const { return header != nullptr; }
+
+    static UINT64 hash_path(const String& path);
+    static UINT64 make_key(UINT64 path_hash, UINT64 file_size, const FILETIME& date_modified);
+    // Size of thumbnail of a 'width' x 'height' image, fits 'thumbnail_size' and keeps aspect ratio.
+    static void get_thumbnail_size(int width, int height, int* thumbnail_width, int* thumbnail_height);
+
+    // Sets 'thumbnail' to pixels in the mapped file, it doesn't own them. They stay valid until next call
+    // to 'find', 'insert', 'finish_compaction' or 'close'. Returns false if there is no thumbnail for 'key'.
+    bool find(UINT64 key, Image_Buffer* thumbnail);
+    // Appends thumbnail, which must fit 'thumbnail_size'. It replaces earlier thumbnails of the same path.
+    HRESULT insert(UINT64 key, UINT64 path_hash, const Image_Buffer& thumbnail);
+    // Makes appended thumbnails survive a crash. Flushes the file, so it's called once for many inserts.
+    HRESULT commit();
+    inline bool has_uncommitted() const { return header != nullptr && record_count != header->record_count; }
+
+    // True when superseded records take more space than live ones.
+    bool needs_compaction() const;
+    HRESULT start_compaction();
+    inline bool is_compacting() const { return compaction != nullptr; }
+    inline bool is_compaction_done() const { return compaction == nullptr || compaction->group.is_done(); }
+    // Replaces the file with the compacted one, thumbnails inserted since 'start_compaction' are copied to it.
+    HRESULT finish_compaction();
+
+private:
+    static const int segment_records = 64;
+    static const int max_segments = max_records / segment_records;
+    // Address space is scarce in 32-bit process, only a few segments stay mapped there.
+    static const int max_mapped_segments = sizeof(void*) == 8 ? max_segments : 64;
+
+    struct File_Header
+    {
+        UINT32 magic;
+        UINT32 version;
+        UINT32 thumbnail_size;
+        UINT32 max_records;
+        // Records and index entries past this count are not committed.
+        UINT32 record_count;
+    };
+
+    struct Index_Entry
+    {
+        UINT64 key;
+        UINT64 path_hash;
+        UINT16 width;
+        UINT16 height;
+        UINT32 reserved;
+    };
+
+    struct Compaction
+    {
+        Job_Group group;
+        String source_path;
+        String target_path;
+        // Live records of the old file in the order they're written to the new one.
+        int* records;
+        Index_Entry* entries;
+        int count;
+        // Records appended after this one are copied by 'finish_compaction'.
+        int snapshot_count;
+        HRESULT result;
+    };
+
+    String path;
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = 0;
+    UINT64 file_size = 0;
+
+    // Header and index are mapped as one view, records in views of 'segment_records' each.
+    File_Header* header = nullptr;
+    Index_Entry* index = nullptr;
+    BYTE* segments[max_segments] = {};
+    bool dirty_segments[max_segments] = {};
+    int mapped_segment_count = 0;
+    int next_segment_to_unmap = 0;
+
+    int record_count = 0;
+    int dead_count = 0;
+
+    // Open addressing tables of record indices + 1, zero is an empty slot. One is keyed by thumbnail key,
+    // the other by path hash. Record is live if the path table points to it.
+    int* key_table = nullptr;
+    int* path_table = nullptr;
+    int table_mask = 0;
+
+    Compaction* compaction = nullptr;
+
+    HRESULT create_header();
+    // Allocates tables for at least 'capacity' records and adds all records to them.
+    bool build_tables(int capacity);
+    int find_slot(const int* table, UINT64 value, bool by_path) const;
+    void add_to_tables(int record);
+    inline bool is_live(int record) const;
+
+    BYTE* map_record(int record);
+    HRESULT grow_file(int segment_count);
+    void unmap_segment(int segment);
+
+    static void run_compaction(void* context, int);
+    void release_compaction();
+};
+
+extern Thumbnail_Store* g_thumbnail_store;
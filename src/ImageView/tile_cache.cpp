@@ -0,0 +1,202 @@
+#include <Windows.h>
+#include <d2d1.h>
+#include <string.h>
+
+#include "tile_cache.hpp"
+#include "com_utility.hpp"
+#include "error.hpp"
+
+
+static inline UINT64 make_tile_key(int level, int x, int y)
+{
+    return (static_cast<UINT64>(level) << 48) | (static_cast<UINT64>(y) << 24) | static_cast<UINT64>(x);
+}
+
+static inline UINT32 hash_tile_key(UINT64 key)
+{
+    return static_cast<UINT32>((key * 0x9E3779B97F4A7C15ull) >> 32);
+}
+
+bool Tile_Cache::initialize(int max_tiles)
+{
+    E_VERIFY_R(max_tiles > 0, false);
+    E_VERIFY_R(entries == nullptr, false); // Already initialized.
+
+    // Table is kept at most half full, so probe sequences stay short.
+    int table_size = 16;
+    while (table_size < 2 * max_tiles)
+        table_size *= 2;
+
+    entries = (Entry*)g_standard_allocator->allocate(sizeof(Entry) * max_tiles);
+    table = (int*)g_standard_allocator->allocate(sizeof(int) * table_size);
+    if (entries == nullptr || table == nullptr)
+    {
+        release();
+        return false;
+    }
+
+    memset(table, 0, sizeof(int) * table_size);
+    table_mask = table_size - 1;
+    capacity = max_tiles;
+    count = 0;
+    newest = -1;
+    oldest = -1;
+
+    return true;
+}
+
+void Tile_Cache::release()
+{
+    for (int i = 0; i < count; ++i)
+    {
+        entries[i].tile.pixels.release();
+        safe_release(entries[i].tile.bitmap);
+    }
+
+    g_standard_allocator->deallocate(entries);
+    g_standard_allocator->deallocate(table);
+    entries = nullptr;
+    table = nullptr;
+    table_mask = 0;
+    capacity = 0;
+    count = 0;
+    newest = -1;
+    oldest = -1;
+}
+
+Tile* Tile_Cache::find(int level, int x, int y)
+{
+    if (count == 0)
+        return nullptr;
+
+    int slot = find_slot(make_tile_key(level, x, y));
+    if (table[slot] == 0)
+        return nullptr;
+
+    int index = table[slot] - 1;
+    if (index != newest)
+    {
+        unlink(index);
+        link_as_newest(index);
+    }
+
+    return &entries[index].tile;
+}
+
+Tile* Tile_Cache::insert(int level, int x, int y)
+{
+    E_VERIFY_NULL_R(entries, nullptr);
+
+    const UINT64 key = make_tile_key(level, x, y);
+    E_VERIFY_R(table[find_slot(key)] == 0, nullptr);
+
+    if (count == capacity)
+        remove_at(oldest);
+
+    int index = count++;
+    Entry& entry = entries[index];
+    entry.key = key;
+    entry.tile.pixels = Image_Buffer();
+    entry.tile.bitmap = nullptr;
+    link_as_newest(index);
+
+    table[find_slot(key)] = index + 1;
+
+    return &entry.tile;
+}
+
+void Tile_Cache::shrink(int max_count)
+{
+    while (count > max(max_count, 0))
+        remove_at(oldest);
+}
+
+void Tile_Cache::release_bitmaps()
+{
+    for (int i = 0; i < count; ++i)
+        safe_release(entries[i].tile.bitmap);
+}
+
+int Tile_Cache::find_slot(UINT64 key) const
+{
+    int slot = static_cast<int>(hash_tile_key(key)) & table_mask;
+    while (table[slot] != 0 && entries[table[slot] - 1].key != key)
+        slot = (slot + 1) & table_mask;
+
+    return slot;
+}
+
+void Tile_Cache::unlink(int index)
+{
+    Entry& entry = entries[index];
+    if (entry.newer >= 0)
+        entries[entry.newer].older = entry.older;
+    else
+        newest = entry.older;
+
+    if (entry.older >= 0)
+        entries[entry.older].newer = entry.newer;
+    else
+        oldest = entry.newer;
+}
+
+void Tile_Cache::link_as_newest(int index)
+{
+    Entry& entry = entries[index];
+    entry.newer = -1;
+    entry.older = newest;
+
+    if (newest >= 0)
+        entries[newest].newer = index;
+    newest = index;
+
+    if (oldest < 0)
+        oldest = index;
+}
+
+void Tile_Cache::remove_at(int index)
+{
+    E_VERIFY(index >= 0 && index < count);
+
+    // Remove from table, following entries of the probe sequence are shifted back to fill the hole.
+    int slot = find_slot(entries[index].key);
+    table[slot] = 0;
+    for (int next = (slot + 1) & table_mask; table[next] != 0; next = (next + 1) & table_mask)
+    {
+        int home = static_cast<int>(hash_tile_key(entries[table[next] - 1].key)) & table_mask;
+        // Entry can move to the hole if its home slot is not between the hole and its current slot.
+        bool can_move = slot <= next ? (home <= slot || home > next) : (home <= slot && home > next);
+        if (can_move)
+        {
+            table[slot] = table[next];
+            table[next] = 0;
+            slot = next;
+        }
+    }
+
+    unlink(index);
+    entries[index].tile.pixels.release();
+    safe_release(entries[index].tile.bitmap);
+
+    // Last entry takes the free slot, so entries stay contiguous.
+    int last = count - 1;
+    if (index != last)
+    {
+        entries[index] = entries[last];
+        Entry& moved = entries[index];
+
+        if (moved.newer >= 0)
+            entries[moved.newer].older = index;
+        else
+            newest = index;
+
+        if (moved.older >= 0)
+            entries[moved.older].newer = index;
+        else
+            oldest = index;
+
+        table[find_slot(moved.key)] = index + 1;
+    }
+
+    --count;
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include <Windows.h>
+
+#include "image_buffer.hpp"
+
+struct ID2D1Bitmap;
+
+struct Tile
+{
+    Image_Buffer pixels;
+    // Created by the window when the tile is drawn the first time, released with the tile.
+    ID2D1Bitmap* bitmap;
+};
+
+// Decoded tiles of one image, identified by mip level and position. Holds at most 'max_tiles' tiles and
+// evicts the least recently used one to make space for a new one. Returned tiles are valid until next 'insert'.
+struct Tile_Cache
+{
+    bool initialize(int max_tiles);
+    void release();
+
+    // Returns cached tile and marks it as most recently used, or null.
+    Tile* find(int level, int x, int y);
+    // Returns an empty tile for the key, evicting the least recently used one if cache is full. 'pixels'
+    // are filled by the caller. Key must not be in the cache.
+    Tile* insert(int level, int x, int y);
+
+    // Evicts least recently used tiles until at most 'max_count' are left.
+    void shrink(int max_count);
+    // Bitmaps belong to the render target, they must be released when it is.
+    void release_bitmaps();
+
+    inline int get_count() const { return count; }
+    inline int get_max_tiles() const { return capacity; }
+
+private:
+    struct Entry
+    {
+        UINT64 key;
+        Tile tile;
+        // LRU list, -1 terminated.
+        int newer;
+        int older;
+    };
+
+    Entry* entries = nullptr;
+    int capacity = 0;
+    int count = 0;
+    int newest = -1;
+    int oldest = -1;
+
+    // Open addressing table of entry indices + 1, zero is an empty slot.
+    int* table = nullptr;
+    int table_mask = 0;
+
+    int find_slot(UINT64 key) const;
+    void unlink(int index);
+    void link_as_newest(int index);
+    void remove_at(int index);
+};
@@ -0,0 +1,602 @@
+#include <Windows.h>
+#include <limits.h>
+#include <string.h>
+
+#include "tiled_image.hpp"
+#include "pixel_conversion.hpp"
+#include "com_utility.hpp"
+#include "defer.hpp"
+#include "error.hpp"
+
+// Size of strips the full size frame is read in when a coarser level is averaged from it, it's
+// also how much is read at most per 'decode_next_request'.
+static const size_t reduce_strip_bytes = 4 * 1024 * 1024;
+
+
+static inline int scaled_size(int size, int level)
+{
+    return max((size + (1 << level) - 1) >> level, 1);
+}
+
+// Level sizes of different sources can be rounded differently.
+static inline bool is_level_size(int size, int full_size, int level)
+{
+    int expected = scaled_size(full_size, level);
+    return size >= expected - 1 && size <= expected + 1;
+}
+
+bool Tiled_Image::initialize(IWICImagingFactory* wic, IWICBitmapDecoder* decoder, IWICBitmapFrameDecode* frame, size_t cache_budget,
+    Chroma_Upsampling upsampling)
+{
+    E_VERIFY_NULL_R(wic, false);
+    E_VERIFY_NULL_R(frame, false);
+    E_VERIFY_R(level_count == 0, false); // Already initialized.
+
+    UINT frame_width = 0;
+    UINT frame_height = 0;
+    HRESULT hr = frame->GetSize(&frame_width, &frame_height);
+    if (FAILED(hr) || frame_width == 0 || frame_height == 0 || frame_width > INT_MAX || frame_height > INT_MAX)
+        return false;
+
+    this->wic = wic;
+    this->upsampling = upsampling;
+    if (!initialize_levels(static_cast<int>(frame_width), static_cast<int>(frame_height), cache_budget))
+        return false;
+
+    Level_Source full_size = {};
+    full_size.frame = frame;
+    full_size.width = width;
+    full_size.height = height;
+    frame->AddRef();
+    add_source(full_size);
+
+    if (decoder != nullptr)
+        add_pyramid_frames(decoder);
+    add_transform_levels(frame);
+
+    return true;
+}
+
+bool Tiled_Image::initialize(const Dds_Image* dds, size_t cache_budget)
+{
+    E_VERIFY_NULL_R(dds, false);
+    E_VERIFY_R(dds->is_open(), false);
+    E_VERIFY_R(level_count == 0, false); // Already initialized.
+
+    if (!initialize_levels(dds->widths[0], dds->heights[0], cache_budget))
+        return false;
+
+    // Mip levels of the texture are rounded down, levels of tiles up, it's within what sources may differ.
+    for (int level = 0; level < dds->level_count && level < level_count; ++level)
+    {
+        Level_Source source = {};
+        source.dds = dds;
+        source.dds_level = level;
+        source.source_level = level;
+        source.width = dds->widths[level];
+        source.height = dds->heights[level];
+        add_source(source);
+    }
+
+    return true;
+}
+
+bool Tiled_Image::initialize_levels(int image_width, int image_height, size_t cache_budget)
+{
+    width = image_width;
+    height = image_height;
+
+    // Coarsest level fits into a single tile.
+    level_count = 1;
+    while (level_count < max_levels && (scaled_size(width, level_count - 1) > tile_size || scaled_size(height, level_count - 1) > tile_size))
+        ++level_count;
+
+    const int tile_bytes = tile_size * tile_size * sizeof(UINT32);
+    if (!cache.initialize(max(static_cast<int>(min(cache_budget / tile_bytes, (size_t)INT_MAX)), 16)))
+    {
+        release();
+        return false;
+    }
+
+    return true;
+}
+
+void Tiled_Image::release()
+{
+    cancel_reduction(&reduction);
+    cache.release();
+
+    for (int i = 0; i < source_count; ++i)
+    {
+        safe_release(sources[i].frame);
+        safe_release(sources[i].transform);
+    }
+
+    source_count = 0;
+    level_count = 0;
+    width = 0;
+    height = 0;
+    request_count = 0;
+    next_request = 0;
+    wic = nullptr;
+}
+
+void Tiled_Image::get_level_size(int level, int* level_width, int* level_height) const
+{
+    *level_width = scaled_size(width, level);
+    *level_height = scaled_size(height, level);
+}
+
+void Tiled_Image::get_tile_count(int level, int* x_count, int* y_count) const
+{
+    *x_count = (scaled_size(width, level) + tile_size - 1) / tile_size;
+    *y_count = (scaled_size(height, level) + tile_size - 1) / tile_size;
+}
+
+int Tiled_Image::level_for_scale(float scale) const
+{
+    int level = 0;
+    while (level + 1 < level_count && scale <= 1.0f / (1 << (level + 1)))
+        ++level;
+
+    return level;
+}
+
+Tile* Tiled_Image::find_tile(int level, int x, int y)
+{
+    return cache.find(level, x, y);
+}
+
+Tile* Tiled_Image::get_tile(int level, int x, int y)
+{
+    Tile* tile = cache.find(level, x, y);
+    if (tile != nullptr)
+        return tile;
+
+    Image_Buffer pixels;
+    HRESULT hr = decode_tile(level, x, y, &pixels);
+    if (FAILED(hr))
+    {
+        LOG_HRESULT_ERROR(hr, L"Unable to decode tile %d,%d of level %d.\n", x, y, level);
+        return nullptr;
+    }
+
+    return insert_tile(level, x, y, &pixels);
+}
+
+Tile* Tiled_Image::insert_tile(int level, int x, int y, Image_Buffer* pixels)
+{
+    Tile* tile = cache.insert(level, x, y);
+    if (tile == nullptr)
+    {
+        pixels->release();
+        return nullptr;
+    }
+
+    tile->pixels = *pixels;
+    *pixels = Image_Buffer();
+    return tile;
+}
+
+void Tiled_Image::clear_requests()
+{
+    request_count = 0;
+    next_request = 0;
+}
+
+bool Tiled_Image::request_tile(int level, int x, int y)
+{
+    if (request_count == max_requests)
+        return false;
+
+    if (cache.find(level, x, y) != nullptr)
+        return true;
+
+    for (int i = next_request; i < request_count; ++i)
+    {
+        if (requests[i].level == level && requests[i].x == x && requests[i].y == y)
+            return true;
+    }
+
+    Tile_Request& request = requests[request_count++];
+    request.level = level;
+    request.x = x;
+    request.y = y;
+
+    return true;
+}
+
+bool Tiled_Image::is_requested(int level, int x, int y) const
+{
+    for (int i = next_request; i < request_count; ++i)
+    {
+        if (requests[i].level == level && requests[i].x == x && requests[i].y == y)
+            return true;
+    }
+
+    return false;
+}
+
+void Tiled_Image::remove_request(int level, int x, int y)
+{
+    for (int i = next_request; i < request_count; ++i)
+    {
+        if (requests[i].level == level && requests[i].x == x && requests[i].y == y)
+            requests[i].level = -1;
+    }
+}
+
+bool Tiled_Image::decode_next_request()
+{
+    // Tile that's partly averaged is finished first, unless it scrolled out of view meanwhile.
+    if (reduction.is_active() && !is_requested(reduction.level, reduction.x, reduction.y))
+        cancel_reduction(&reduction);
+
+    if (reduction.is_active())
+    {
+        bool is_done = false;
+        HRESULT hr = reduce_next_strip(&reduction, &is_done);
+        if (FAILED(hr))
+            LOG_HRESULT_ERROR(hr, L"Unable to decode tile %d,%d of level %d.\n", reduction.x, reduction.y, reduction.level);
+        else if (is_done)
+            insert_tile(reduction.level, reduction.x, reduction.y, &reduction.pixels);
+
+        // Tile is not decoded again until it's requested again, even if it failed.
+        if (FAILED(hr) || is_done)
+        {
+            remove_request(reduction.level, reduction.x, reduction.y);
+            cancel_reduction(&reduction);
+        }
+
+        return true;
+    }
+
+    while (next_request < request_count)
+    {
+        const Tile_Request& request = requests[next_request];
+        if (request.level < 0 || cache.find(request.level, request.x, request.y) != nullptr)
+        {
+            ++next_request;
+            continue;
+        }
+
+        Image_Buffer pixels;
+        HRESULT hr = decode_tile_or_start_reduction(request.level, request.x, request.y, &pixels, &reduction);
+        if (hr == S_FALSE)
+            return true; // Request stays first in the queue until the tile is averaged.
+
+        ++next_request;
+        if (SUCCEEDED(hr))
+            insert_tile(request.level, request.x, request.y, &pixels);
+        else
+            LOG_HRESULT_ERROR(hr, L"Unable to decode tile %d,%d of level %d.\n", request.x, request.y, request.level);
+
+        return true;
+    }
+
+    clear_requests();
+    return false;
+}
+
+void Tiled_Image::release_bitmaps()
+{
+    cache.release_bitmaps();
+}
+
+void Tiled_Image::shrink_cache(int max_tiles)
+{
+    cache.shrink(max_tiles);
+}
+
+void Tiled_Image::add_pyramid_frames(IWICBitmapDecoder* decoder)
+{
+    UINT frame_count = 0;
+    if (FAILED(decoder->GetFrameCount(&frame_count)))
+        return;
+
+    // Pyramidal TIFFs store reduced resolution copies of the image as next frames.
+    for (UINT i = 1; i < frame_count && source_count < max_levels; ++i)
+    {
+        IWICBitmapFrameDecode* frame = nullptr;
+        if (FAILED(decoder->GetFrame(i, &frame)))
+            continue;
+
+        UINT frame_width = 0;
+        UINT frame_height = 0;
+        if (SUCCEEDED(frame->GetSize(&frame_width, &frame_height)))
+        {
+            for (int level = 1; level < level_count; ++level)
+            {
+                if (!is_level_size(static_cast<int>(frame_width), width, level) || !is_level_size(static_cast<int>(frame_height), height, level))
+                    continue;
+
+                Level_Source source = {};
+                source.frame = frame;
+                source.source_level = level;
+                source.width = static_cast<int>(frame_width);
+                source.height = static_cast<int>(frame_height);
+                if (add_source(source))
+                    frame = nullptr;
+                break;
+            }
+        }
+
+        safe_release(frame);
+    }
+}
+
+void Tiled_Image::add_transform_levels(IWICBitmapSource* frame)
+{
+    IWICBitmapSourceTransform* transform = nullptr;
+    if (FAILED(frame->QueryInterface(IID_PPV_ARGS(&transform))))
+        return;
+    defer(safe_release(transform));
+
+    // Only formats with own conversion kernel, transform output is converted row by row.
+    WICPixelFormatGUID format = GUID_WICPixelFormat32bppPBGRA;
+    if (FAILED(transform->GetClosestPixelFormat(&format)))
+        return;
+
+    Pixel_Layout layout = Pixel_Conversion::layout_from_wic_format(format);
+    if (layout == Pixel_Layout::Unknown || layout >= Pixel_Layout::Indexed1)
+        return;
+
+    for (int level = 1; level < level_count && source_count < max_levels; ++level)
+    {
+        UINT level_width = static_cast<UINT>(scaled_size(width, level));
+        UINT level_height = static_cast<UINT>(scaled_size(height, level));
+        if (FAILED(transform->GetClosestSize(&level_width, &level_height)))
+            return;
+
+        // Codecs scale by a few fixed factors only, e.g. 1/2, 1/4 and 1/8 for JPEG.
+        if (!is_level_size(static_cast<int>(level_width), width, level) || !is_level_size(static_cast<int>(level_height), height, level))
+            continue;
+
+        Level_Source source = {};
+        source.transform = transform;
+        source.transform_format = format;
+        source.source_level = level;
+        source.width = static_cast<int>(level_width);
+        source.height = static_cast<int>(level_height);
+        transform->AddRef();
+        if (!add_source(source))
+            transform->Release();
+    }
+}
+
+bool Tiled_Image::add_source(const Level_Source& source)
+{
+    if (source_count == max_levels)
+        return false;
+
+    // A frame that's already there for this level is better than a transform.
+    for (int i = 0; i < source_count; ++i)
+    {
+        if (sources[i].source_level == source.source_level)
+            return false;
+    }
+
+    sources[source_count++] = source;
+    return true;
+}
+
+const Tiled_Image::Level_Source& Tiled_Image::source_for_level(int level) const
+{
+    // Coarsest source that's not coarser than 'level', there's always the full size frame.
+    int best = 0;
+    for (int i = 1; i < source_count; ++i)
+    {
+        if (sources[i].source_level <= level && sources[i].source_level > sources[best].source_level)
+            best = i;
+    }
+
+    return sources[best];
+}
+
+HRESULT Tiled_Image::decode_tile(int level, int x, int y, Image_Buffer* pixels)
+{
+    Reduction local_reduction;
+    HRESULT hr = decode_tile_or_start_reduction(level, x, y, pixels, &local_reduction);
+    if (hr != S_FALSE)
+        return hr;
+
+    bool is_done = false;
+    while (!is_done)
+    {
+        hr = reduce_next_strip(&local_reduction, &is_done);
+        if (FAILED(hr))
+            return hr;
+    }
+
+    *pixels = local_reduction.pixels;
+    local_reduction.pixels = Image_Buffer();
+    cancel_reduction(&local_reduction);
+
+    return S_OK;
+}
+
+HRESULT Tiled_Image::decode_tile_or_start_reduction(int level, int x, int y, Image_Buffer* pixels, Reduction* reduction)
+{
+    E_VERIFY_R(level >= 0 && level < level_count, E_INVALIDARG);
+
+    int level_width, level_height;
+    get_level_size(level, &level_width, &level_height);
+
+    const int tile_x = x * tile_size;
+    const int tile_y = y * tile_size;
+    E_VERIFY_R(tile_x < level_width && tile_y < level_height, E_INVALIDARG);
+
+    const int tile_width = min(tile_size, level_width - tile_x);
+    const int tile_height = min(tile_size, level_height - tile_y);
+
+    const Level_Source& source = source_for_level(level);
+    const int factor = 1 << (level - source.source_level);
+
+    // Source can be a pixel smaller than the level it stands for, its last row and column are repeated.
+    WICRect rect;
+    rect.X = min(tile_x * factor, source.width - 1);
+    rect.Y = min(tile_y * factor, source.height - 1);
+    rect.Width = min(tile_width * factor, source.width - rect.X);
+    rect.Height = min(tile_height * factor, source.height - rect.Y);
+
+    if (factor > 1)
+    {
+        // Strips don't depend on the factor, sums of a block carry over to the next strip.
+        const UINT strip_stride = sizeof(UINT32) * static_cast<UINT>(rect.Width);
+        const int strip_rows = max(1, min(static_cast<int>(reduce_strip_bytes / strip_stride), rect.Height));
+
+        reduction->strip = (BYTE*)g_standard_allocator->allocate(static_cast<size_t>(strip_stride) * strip_rows);
+        reduction->sums = (UINT32*)g_standard_allocator->allocate(sizeof(UINT32) * 4 * tile_width);
+        if (reduction->strip == nullptr || reduction->sums == nullptr || !reduction->pixels.allocate(tile_width, tile_height))
+        {
+            cancel_reduction(reduction);
+            return E_OUTOFMEMORY;
+        }
+
+        reduction->level = level;
+        reduction->x = x;
+        reduction->y = y;
+        reduction->source = &source;
+        reduction->rect = rect;
+        reduction->factor = factor;
+        reduction->used_width = (rect.Width + factor - 1) / factor;
+        reduction->next_strip_y = 0;
+        reduction->destination_row = 0;
+        reduction->summed_rows = 0;
+        reduction->strip_rows = strip_rows;
+        reduction->strip_stride = strip_stride;
+        memset(reduction->sums, 0, sizeof(UINT32) * 4 * tile_width);
+
+        return S_FALSE;
+    }
+
+    if (!pixels->allocate(tile_width, tile_height))
+        return E_OUTOFMEMORY;
+
+    HRESULT hr = copy_source_pixels(source, rect, pixels->pixels, pixels->stride);
+    if (FAILED(hr))
+    {
+        pixels->release();
+        return hr;
+    }
+
+    for (int row = 0; row < tile_height; ++row)
+    {
+        UINT32* destination = pixels->row(row);
+        if (row >= rect.Height)
+            memcpy(destination, pixels->row(rect.Height - 1), sizeof(UINT32) * tile_width);
+
+        for (int column = rect.Width; column < tile_width; ++column)
+            destination[column] = destination[rect.Width - 1];
+    }
+
+    return S_OK;
+}
+
+HRESULT Tiled_Image::reduce_next_strip(Reduction* reduction, bool* is_done)
+{
+    E_VERIFY_R(reduction->is_active(), E_UNEXPECTED);
+    *is_done = false;
+
+    Image_Buffer& pixels = reduction->pixels;
+    const WICRect& rect = reduction->rect;
+    const int factor = reduction->factor;
+    const int tile_width = pixels.width;
+    UINT32* sums = reduction->sums;
+
+    const int strip_y = reduction->next_strip_y;
+    WICRect strip_rect = { rect.X, rect.Y + strip_y, rect.Width, min(reduction->strip_rows, rect.Height - strip_y) };
+    HRESULT hr = copy_source_pixels(*reduction->source, strip_rect, reduction->strip, reduction->strip_stride);
+    if (FAILED(hr))
+    {
+        cancel_reduction(reduction);
+        return hr;
+    }
+
+    for (int row = 0; row < strip_rect.Height; ++row)
+    {
+        const UINT32* source_row = (const UINT32*)(reduction->strip + static_cast<size_t>(row) * reduction->strip_stride);
+        for (int column = 0; column < rect.Width; ++column)
+        {
+            UINT32 pixel = source_row[column];
+            UINT32* sum = sums + 4 * (column / factor);
+            sum[0] += pixel & 0xFF;
+            sum[1] += (pixel >> 8) & 0xFF;
+            sum[2] += (pixel >> 16) & 0xFF;
+            sum[3] += pixel >> 24;
+        }
+
+        ++reduction->summed_rows;
+        const bool is_last_row = strip_y + row == rect.Height - 1;
+        if (reduction->summed_rows < factor && !is_last_row)
+            continue;
+
+        UINT32* destination = pixels.row(reduction->destination_row++);
+        for (int column = 0; column < reduction->used_width; ++column)
+        {
+            const UINT32 count = static_cast<UINT32>(reduction->summed_rows * min(factor, rect.Width - column * factor));
+            const UINT32* sum = sums + 4 * column;
+            destination[column] = ((sum[0] + count / 2) / count) |
+                (((sum[1] + count / 2) / count) << 8) |
+                (((sum[2] + count / 2) / count) << 16) |
+                (((sum[3] + count / 2) / count) << 24);
+        }
+        for (int column = reduction->used_width; column < tile_width; ++column)
+            destination[column] = destination[reduction->used_width - 1];
+
+        memset(sums, 0, sizeof(UINT32) * 4 * tile_width);
+        reduction->summed_rows = 0;
+    }
+
+    reduction->next_strip_y += strip_rect.Height;
+    if (reduction->next_strip_y < rect.Height)
+        return S_OK;
+
+    for (int row = reduction->destination_row; row < pixels.height; ++row)
+        memcpy(pixels.row(row), pixels.row(row - 1), sizeof(UINT32) * tile_width);
+
+    *is_done = true;
+    return S_OK;
+}
+
+void Tiled_Image::cancel_reduction(Reduction* reduction)
+{
+    g_standard_allocator->deallocate(reduction->strip);
+    g_standard_allocator->deallocate(reduction->sums);
+    reduction->strip = nullptr;
+    reduction->sums = nullptr;
+    reduction->pixels.release();
+}
+
+HRESULT Tiled_Image::copy_source_pixels(const Level_Source& source, const WICRect& rect, BYTE* destination, UINT stride)
+{
+    if (source.frame != nullptr)
+        return Pixel_Conversion::copy_pixels(wic, source.frame, rect, destination, stride, upsampling);
+
+    if (source.dds != nullptr)
+        return source.dds->copy_pixels(source.dds_level, rect, destination, stride);
+
+    // Transform decodes to its own format, it's converted to PBGRA row by row afterwards.
+    const Pixel_Layout layout = Pixel_Conversion::layout_from_wic_format(source.transform_format);
+    const UINT source_stride = (static_cast<UINT>(Pixel_Conversion::bits_per_pixel(layout) * rect.Width + 31) / 32) * 4;
+    const UINT buffer_size = source_stride * static_cast<UINT>(rect.Height);
+
+    BYTE* buffer = (BYTE*)g_standard_allocator->allocate(buffer_size);
+    if (buffer == nullptr)
+        return E_OUTOFMEMORY;
+    defer(g_standard_allocator->deallocate(buffer));
+
+    WICPixelFormatGUID format = source.transform_format;
+    HRESULT hr = source.transform->CopyPixels(&rect, static_cast<UINT>(source.width), static_cast<UINT>(source.height), &format,
+        WICBitmapTransformRotate0, source_stride, buffer_size, buffer);
+    if (FAILED(hr))
+        return hr;
+
+    for (int y = 0; y < rect.Height; ++y)
+    {
+        Pixel_Conversion::convert_row(layout, buffer + static_cast<size_t>(y) * source_stride,
+            (UINT32*)(destination + static_cast<size_t>(y) * stride), rect.Width, nullptr);
+    }
+
+    return S_OK;
+}
@@ -0,0 +1,135 @@
+#pragma once
+#include <wincodec.h>
+
+#include "dds_image.hpp"
+#include "tile_cache.hpp"
+#include "ycbcr_conversion.hpp"
+
+// Image that is too large to decode at once. It's split into tiles of 'tile_size' pixels at every mip
+// level, only tiles that are drawn get decoded and they're kept in a Tile_Cache.
+//
+// Level L is the image scaled by 1 / 2^L. Its tiles are read from the cheapest source for that level:
+// a reduced resolution frame (pyramidal TIFF), scaled decode of the codec (IWICBitmapSourceTransform,
+// e.g. JPEG), mip level of a DDS texture or the full size frame averaged down while it's read in strips.
+struct Tiled_Image
+{
+    static const int tile_size = 256;
+    static const int max_levels = 24;
+    // Tiles waiting to be decoded, see 'request_tile'.
+    static const int max_requests = 512;
+
+    bool initialize(IWICImagingFactory* wic, IWICBitmapDecoder* decoder, IWICBitmapFrameDecode* frame, size_t cache_budget,
+        Chroma_Upsampling upsampling);
+    // Tiles are decoded from mip levels of 'dds', which must stay open until 'release'.
+    bool initialize(const Dds_Image* dds, size_t cache_budget);
+    void release();
+
+    inline bool is_empty() const { return level_count == 0; }
+    inline int get_width() const { return width; }
+    inline int get_height() const { return height; }
+    inline int get_level_count() const { return level_count; }
+    void get_level_size(int level, int* level_width, int* level_height) const;
+    void get_tile_count(int level, int* x_count, int* y_count) const;
+    // Finest level that is not larger than image drawn at 'scale'.
+    int level_for_scale(float scale) const;
+
+    // Returns cached tile, doesn't decode it.
+    Tile* find_tile(int level, int x, int y);
+    // Returns cached tile or decodes it, null if decoding failed.
+    Tile* get_tile(int level, int x, int y);
+
+    // Queue of tiles to decode later. It's cleared whenever the visible area changes, so only tiles
+    // that are still needed are decoded. Tiles already cached are not queued.
+    void clear_requests();
+    bool request_tile(int level, int x, int y);
+    inline bool has_requests() const { return request_count > next_request; }
+    // Decodes next queued tile, or one strip of it if it's averaged from a much larger area of its
+    // source, so a call never reads more than a strip. Returns false if queue is empty.
+    bool decode_next_request();
+
+    void release_bitmaps();
+    // Frees least recently used tiles until at most 'max_tiles' are left, missing ones are decoded again when drawn.
+    void shrink_cache(int max_tiles);
+    inline int get_cached_tile_count() const { return cache.get_count(); }
+
+private:
+    struct Level_Source
+    {
+        // Frame of the image at 'source_level' of the pyramid, or null if 'transform' or 'dds' is used.
+        IWICBitmapSource* frame;
+        IWICBitmapSourceTransform* transform;
+        const Dds_Image* dds;
+        int dds_level;
+        // Pixel format 'transform' decodes to.
+        WICPixelFormatGUID transform_format;
+        int source_level;
+        int width;
+        int height;
+    };
+
+    struct Tile_Request
+    {
+        int level;
+        int x;
+        int y;
+    };
+
+    // Tile of a coarser level than its source. Blocks of 'factor' x 'factor' source pixels are averaged
+    // while the source is read in strips, one strip per 'reduce_next_strip'.
+    struct Reduction
+    {
+        int level = 0;
+        int x = 0;
+        int y = 0;
+        const Level_Source* source = nullptr;
+        Image_Buffer pixels;
+        WICRect rect = {};
+        int factor = 0;
+        int used_width = 0;
+        int next_strip_y = 0;
+        int destination_row = 0;
+        int summed_rows = 0;
+        int strip_rows = 0;
+        UINT strip_stride = 0;
+        BYTE* strip = nullptr;
+        UINT32* sums = nullptr;
+
+        inline bool is_active() const { return !pixels.is_empty(); }
+    };
+
+    IWICImagingFactory* wic = nullptr;
+    Chroma_Upsampling upsampling = Chroma_Upsampling::Fancy;
+    int width = 0;
+    int height = 0;
+    int level_count = 0;
+
+    Level_Source sources[max_levels];
+    int source_count = 0;
+
+    Tile_Cache cache;
+
+    Tile_Request requests[max_requests];
+    int request_count = 0;
+    int next_request = 0;
+
+    // Tile 'decode_next_request' works on over several calls.
+    Reduction reduction;
+
+    bool initialize_levels(int image_width, int image_height, size_t cache_budget);
+    void add_pyramid_frames(IWICBitmapDecoder* decoder);
+    void add_transform_levels(IWICBitmapSource* frame);
+    bool add_source(const Level_Source& source);
+    const Level_Source& source_for_level(int level) const;
+
+    bool is_requested(int level, int x, int y) const;
+    // Marks requests for the tile as done, 'level' of removed requests is -1.
+    void remove_request(int level, int x, int y);
+    Tile* insert_tile(int level, int x, int y, Image_Buffer* pixels);
+
+    HRESULT decode_tile(int level, int x, int y, Image_Buffer* pixels);
+    // Returns S_FALSE if the tile has to be averaged from its source, 'reduction' is started then.
+    HRESULT decode_tile_or_start_reduction(int level, int x, int y, Image_Buffer* pixels, Reduction* reduction);
+    HRESULT reduce_next_strip(Reduction* reduction, bool* is_done);
+    void cancel_reduction(Reduction* reduction);
+    HRESULT copy_source_pixels(const Level_Source& source, const WICRect& rect, BYTE* destination, UINT stride);
+};
@@ -0,0 +1,501 @@
+#include <Windows.h>
+#include <string.h>
+
+#include "utf8.hpp"
+#include "cpu_features.hpp"
+#include "error.hpp"
+
+#if CPU_X86
+    #include <intrin.h>
+    #include <immintrin.h>
+#elif CPU_ARM
+    #include <arm_neon.h>
+#endif
+
+static_assert(sizeof(wchar_t) == 2, "Transcoder expects UTF-16 code units.");
+
+
+// Returns code point at '*index' and moves '*index' past it. Returns -1 on malformed sequence.
+static int decode_code_point(const unsigned char* s, int count, int* index)
+{
+    int i = *index;
+    unsigned int c = s[i];
+
+    if (c < 0x80)
+    {
+        *index = i + 1;
+        return static_cast<int>(c);
+    }
+
+    int length;
+    unsigned int code_point;
+    unsigned int min_code_point;
+
+    if ((c & 0xE0) == 0xC0)
+    {
+        length = 2;
+        code_point = c & 0x1F;
+        min_code_point = 0x80;
+    }
+    else if ((c & 0xF0) == 0xE0)
+    {
+        length = 3;
+        code_point = c & 0x0F;
+        min_code_point = 0x800;
+    }
+    else if ((c & 0xF8) == 0xF0)
+    {
+        length = 4;
+        code_point = c & 0x07;
+        min_code_point = 0x10000;
+    }
+    else
+    {
+        return -1;
+    }
+
+    if (i + length > count)
+        return -1;
+
+    for (int j = 1; j < length; ++j)
+    {
+        unsigned int continuation = s[i + j];
+        if ((continuation & 0xC0) != 0x80)
+            return -1;
+
+        code_point = (code_point << 6) | (continuation & 0x3F);
+    }
+
+    if (code_point < min_code_point || code_point > 0x10FFFF)
+        return -1; // Overlong form or out of Unicode range.
+    if (code_point >= 0xD800 && code_point <= 0xDFFF)
+        return -1; // Surrogates are not allowed in UTF-8.
+
+    *index = i + length;
+    return static_cast<int>(code_point);
+}
+
+// Returns code point at '*index' and moves '*index' past it. Returns -1 on lone surrogate.
+static int decode_utf16_code_point(const wchar_t* s, int count, int* index)
+{
+    int i = *index;
+    unsigned int c = s[i];
+
+    if (c < 0xD800 || c > 0xDFFF)
+    {
+        *index = i + 1;
+        return static_cast<int>(c);
+    }
+
+    if (c > 0xDBFF || i + 1 >= count)
+        return -1;
+
+    unsigned int low = s[i + 1];
+    if (low < 0xDC00 || low > 0xDFFF)
+        return -1;
+
+    *index = i + 2;
+    return static_cast<int>(0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00));
+}
+
+static inline int utf8_sequence_length(int code_point)
+{
+    if (code_point < 0x80)    return 1;
+    if (code_point < 0x800)   return 2;
+    if (code_point < 0x10000) return 3;
+    return 4;
+}
+
+#pragma region Scalar
+static int ascii_prefix_scalar(const unsigned char* data, int count)
+{
+    int i = 0;
+    while (i < count && data[i] < 0x80)
+        ++i;
+
+    return i;
+}
+
+static int widen_ascii_scalar(const unsigned char* source, int count, wchar_t* destination)
+{
+    int i = 0;
+    for (; i < count && source[i] < 0x80; ++i)
+        destination[i] = static_cast<wchar_t>(source[i]);
+
+    return i;
+}
+
+static int narrow_ascii_scalar(const wchar_t* source, int count, unsigned char* destination)
+{
+    int i = 0;
+    for (; i < count && source[i] < 0x80; ++i)
+        destination[i] = static_cast<unsigned char>(source[i]);
+
+    return i;
+}
+#pragma endregion
+
+#if CPU_X86
+#pragma region SSE2
+static int ascii_prefix_sse2(const unsigned char* data, int count)
+{
+    int i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        if (_mm_movemask_epi8(chunk) != 0)
+            break;
+    }
+
+    return i + ascii_prefix_scalar(data + i, count - i);
+}
+
+static int widen_ascii_sse2(const unsigned char* source, int count, wchar_t* destination)
+{
+    const __m128i zero = _mm_setzero_si128();
+
+    int i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i));
+        if (_mm_movemask_epi8(chunk) != 0)
+            break;
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + i),     _mm_unpacklo_epi8(chunk, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + i + 8), _mm_unpackhi_epi8(chunk, zero));
+    }
+
+    return i + widen_ascii_scalar(source + i, count - i, destination + i);
+}
+
+static int narrow_ascii_sse2(const wchar_t* source, int count, unsigned char* destination)
+{
+    const __m128i non_ascii_bits = _mm_set1_epi16(static_cast<short>(0xFF80));
+    const __m128i zero = _mm_setzero_si128();
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i));
+        __m128i high = _mm_and_si128(chunk, non_ascii_bits);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi16(high, zero)) != 0xFFFF)
+            break;
+
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(destination + i), _mm_packus_epi16(chunk, chunk));
+    }
+
+    return i + narrow_ascii_scalar(source + i, count - i, destination + i);
+}
+#pragma endregion
+
+#pragma region AVX2
+static int ascii_prefix_avx2(const unsigned char* data, int count)
+{
+    int i = 0;
+    for (; i + 32 <= count; i += 32)
+    {
+        __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        if (_mm256_movemask_epi8(chunk) != 0)
+            break;
+    }
+
+    _mm256_zeroupper();
+    return i + ascii_prefix_sse2(data + i, count - i);
+}
+
+static int widen_ascii_avx2(const unsigned char* source, int count, wchar_t* destination)
+{
+    int i = 0;
+    for (; i + 32 <= count; i += 32)
+    {
+        __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + i));
+        if (_mm256_movemask_epi8(chunk) != 0)
+            break;
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(destination + i),
+            _mm256_cvtepu8_epi16(_mm256_castsi256_si128(chunk)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(destination + i + 16),
+            _mm256_cvtepu8_epi16(_mm256_extracti128_si256(chunk, 1)));
+    }
+
+    _mm256_zeroupper();
+    return i + widen_ascii_sse2(source + i, count - i, destination + i);
+}
+#pragma endregion
+#endif // CPU_X86
+
+#if CPU_ARM
+#pragma region NEON
+static int ascii_prefix_neon(const unsigned char* data, int count)
+{
+    int i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        uint8x16_t chunk = vld1q_u8(data + i);
+        uint8x8_t folded = vorr_u8(vget_low_u8(chunk), vget_high_u8(chunk));
+        if ((vget_lane_u64(vreinterpret_u64_u8(folded), 0) & 0x8080808080808080ull) != 0)
+            break;
+    }
+
+    return i + ascii_prefix_scalar(data + i, count - i);
+}
+
+static int widen_ascii_neon(const unsigned char* source, int count, wchar_t* destination)
+{
+    unsigned short* units = reinterpret_cast<unsigned short*>(destination);
+
+    int i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        uint8x16_t chunk = vld1q_u8(source + i);
+        uint8x8_t folded = vorr_u8(vget_low_u8(chunk), vget_high_u8(chunk));
+        if ((vget_lane_u64(vreinterpret_u64_u8(folded), 0) & 0x8080808080808080ull) != 0)
+            break;
+
+        vst1q_u16(units + i,     vmovl_u8(vget_low_u8(chunk)));
+        vst1q_u16(units + i + 8, vmovl_u8(vget_high_u8(chunk)));
+    }
+
+    return i + widen_ascii_scalar(source + i, count - i, destination + i);
+}
+
+static int narrow_ascii_neon(const wchar_t* source, int count, unsigned char* destination)
+{
+    const unsigned short* units = reinterpret_cast<const unsigned short*>(source);
+    const uint16x8_t non_ascii_bits = vdupq_n_u16(0xFF80);
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        // Whole lanes are tested, shifting and narrowing would lose the top bits of U+8000 and above.
+        uint16x8_t chunk = vld1q_u16(units + i);
+        uint8x8_t non_ascii = vmovn_u16(vtstq_u16(chunk, non_ascii_bits));
+        if (vget_lane_u64(vreinterpret_u64_u8(non_ascii), 0) != 0)
+            break;
+
+        vst1_u8(destination + i, vmovn_u16(chunk));
+    }
+
+    return i + narrow_ascii_scalar(source + i, count - i, destination + i);
+}
+#pragma endregion
+#endif // CPU_ARM
+
+struct Utf8_Kernels
+{
+    int (*ascii_prefix)(const unsigned char* data, int count);
+    int (*widen_ascii)(const unsigned char* source, int count, wchar_t* destination);
+    int (*narrow_ascii)(const wchar_t* source, int count, unsigned char* destination);
+};
+
+static Utf8_Kernels select_kernels()
+{
+    Utf8_Kernels k;
+    k.ascii_prefix = ascii_prefix_scalar;
+    k.widen_ascii  = widen_ascii_scalar;
+    k.narrow_ascii = narrow_ascii_scalar;
+
+#if CPU_X86
+    if (g_cpu_features.has_sse2)
+    {
+        k.ascii_prefix = ascii_prefix_sse2;
+        k.widen_ascii  = widen_ascii_sse2;
+        k.narrow_ascii = narrow_ascii_sse2;
+    }
+
+    if (g_cpu_features.has_avx2)
+    {
+        k.ascii_prefix = ascii_prefix_avx2;
+        k.widen_ascii  = widen_ascii_avx2;
+    }
+#elif CPU_ARM
+    if (g_cpu_features.has_neon)
+    {
+        k.ascii_prefix = ascii_prefix_neon;
+        k.widen_ascii  = widen_ascii_neon;
+        k.narrow_ascii = narrow_ascii_neon;
+    }
+#endif
+
+    return k;
+}
+
+static const Utf8_Kernels& get_kernels()
+{
+    static const Utf8_Kernels kernels = select_kernels();
+    return kernels;
+}
+
+int Utf8::ascii_prefix_length(const char* data, int count)
+{
+    if (data == nullptr || count <= 0)
+        return 0;
+
+    return get_kernels().ascii_prefix(reinterpret_cast<const unsigned char*>(data), count);
+}
+
+bool Utf8::validate(const char* data, int count)
+{
+    return utf16_length(data, count) != -1;
+}
+
+int Utf8::utf16_length(const char* data, int count)
+{
+    E_VERIFY_R(count >= 0, -1);
+    if (count == 0)
+        return 0;
+    E_VERIFY_NULL_R(data, -1);
+
+    const unsigned char* s = reinterpret_cast<const unsigned char*>(data);
+    const Utf8_Kernels& k = get_kernels();
+
+    int length = 0;
+    int i = 0;
+    while (i < count)
+    {
+        int ascii_count = k.ascii_prefix(s + i, count - i);
+        i += ascii_count;
+        length += ascii_count;
+
+        while (i < count && s[i] >= 0x80)
+        {
+            int code_point = decode_code_point(s, count, &i);
+            if (code_point == -1)
+                return -1;
+
+            length += code_point >= 0x10000 ? 2 : 1;
+        }
+    }
+
+    return length;
+}
+
+int Utf8::utf8_length(const wchar_t* data, int count)
+{
+    E_VERIFY_R(count >= 0, -1);
+    if (count == 0)
+        return 0;
+    E_VERIFY_NULL_R(data, -1);
+
+    int length = 0;
+    int i = 0;
+    while (i < count)
+    {
+        int code_point = decode_utf16_code_point(data, count, &i);
+        if (code_point == -1)
+            return -1;
+
+        length += utf8_sequence_length(code_point);
+    }
+
+    return length;
+}
+
+int Utf8::to_utf16(const char* source, int source_count, wchar_t* destination, int destination_capacity)
+{
+    E_VERIFY_R(source_count >= 0, -1);
+    E_VERIFY_R(destination_capacity >= 0, -1);
+    if (source_count == 0)
+        return 0;
+    E_VERIFY_NULL_R(source, -1);
+    E_VERIFY_NULL_R(destination, -1);
+
+    const unsigned char* s = reinterpret_cast<const unsigned char*>(source);
+    const Utf8_Kernels& k = get_kernels();
+
+    int i = 0;
+    int o = 0;
+    while (i < source_count)
+    {
+        int ascii_limit = min(source_count - i, destination_capacity - o);
+        int ascii_count = k.widen_ascii(s + i, ascii_limit, destination + o);
+        i += ascii_count;
+        o += ascii_count;
+
+        if (i < source_count && s[i] < 0x80)
+            return -1; // Stopped because destination is full.
+
+        while (i < source_count && s[i] >= 0x80)
+        {
+            int code_point = decode_code_point(s, source_count, &i);
+            if (code_point == -1)
+                return -1;
+
+            if (code_point >= 0x10000)
+            {
+                if (o + 2 > destination_capacity)
+                    return -1;
+
+                code_point -= 0x10000;
+                destination[o++] = static_cast<wchar_t>(0xD800 + (code_point >> 10));
+                destination[o++] = static_cast<wchar_t>(0xDC00 + (code_point & 0x3FF));
+            }
+            else
+            {
+                if (o + 1 > destination_capacity)
+                    return -1;
+
+                destination[o++] = static_cast<wchar_t>(code_point);
+            }
+        }
+    }
+
+    return o;
+}
+
+int Utf8::to_utf8(const wchar_t* source, int source_count, char* destination, int destination_capacity)
+{
+    E_VERIFY_R(source_count >= 0, -1);
+    E_VERIFY_R(destination_capacity >= 0, -1);
+    if (source_count == 0)
+        return 0;
+    E_VERIFY_NULL_R(source, -1);
+    E_VERIFY_NULL_R(destination, -1);
+
+    unsigned char* d = reinterpret_cast<unsigned char*>(destination);
+    const Utf8_Kernels& k = get_kernels();
+
+    int i = 0;
+    int o = 0;
+    while (i < source_count)
+    {
+        int ascii_limit = min(source_count - i, destination_capacity - o);
+        int ascii_count = k.narrow_ascii(source + i, ascii_limit, d + o);
+        i += ascii_count;
+        o += ascii_count;
+
+        if (i < source_count && source[i] < 0x80)
+            return -1; // Stopped because destination is full.
+
+        while (i < source_count && source[i] >= 0x80)
+        {
+            int code_point = decode_utf16_code_point(source, source_count, &i);
+            if (code_point == -1)
+                return -1;
+
+            int length = utf8_sequence_length(code_point);
+            if (o + length > destination_capacity)
+                return -1;
+
+            switch (length)
+            {
+                case 2:
+                    d[o++] = static_cast<unsigned char>(0xC0 | (code_point >> 6));
+                    break;
+                case 3:
+                    d[o++] = static_cast<unsigned char>(0xE0 | (code_point >> 12));
+                    d[o++] = static_cast<unsigned char>(0x80 | ((code_point >> 6) & 0x3F));
+                    break;
+                case 4:
+                    d[o++] = static_cast<unsigned char>(0xF0 | (code_point >> 18));
+                    d[o++] = static_cast<unsigned char>(0x80 | ((code_point >> 12) & 0x3F));
+                    d[o++] = static_cast<unsigned char>(0x80 | ((code_point >> 6) & 0x3F));
+                    break;
+            }
+
+            d[o++] = static_cast<unsigned char>(0x80 | (code_point & 0x3F));
+        }
+    }
+
+    return o;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+// UTF-8 <-> UTF-16 transcoder. Runs of ASCII are converted 16 or 32 bytes at a time,
+// everything else goes through scalar decoder that rejects overlong forms, lone surrogates
+// and code points above U+10FFFF.
+struct Utf8
+{
+    // Returns true if 'data' is well-formed UTF-8.
+    static bool validate(const char* data, int count);
+
+    // Returns amount of UTF-16 code units required to hold 'data' or -1 if 'data' is not valid UTF-8.
+    static int utf16_length(const char* data, int count);
+    // Returns amount of bytes required to hold 'data' in UTF-8 or -1 if 'data' has lone surrogates.
+    static int utf8_length(const wchar_t* data, int count);
+
+    // Return amount of code units written (without terminating null, none is written) or -1 on invalid
+    // input or insufficient 'destination_capacity'.
+    static int to_utf16(const char* source, int source_count, wchar_t* destination, int destination_capacity);
+    static int to_utf8(const wchar_t* source, int source_count, char* destination, int destination_capacity);
+
+    // Returns length of ASCII prefix of 'data'.
+    static int ascii_prefix_length(const char* data, int count);
+};
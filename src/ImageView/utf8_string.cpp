@@ -0,0 +1,176 @@
+#include <string.h>
+
+#include "utf8_string.hpp"
+#include "utf8.hpp"
+#include "error.hpp"
+
+const Utf8_String Utf8_String::null;
+
+
+Utf8_String::Utf8_String()
+{}
+
+Utf8_String::Utf8_String(char* data, int count)
+    : data(data),
+      count(count)
+{}
+
+int Utf8_String::index_of(char c) const
+{
+    if (is_null_or_empty(*this))
+        return -1;
+
+    const char* found = static_cast<const char*>(memchr(data, c, count));
+    return found == nullptr ? -1 : static_cast<int>(found - data);
+}
+
+bool Utf8_String::starts_with(char c) const
+{
+    if (is_null_or_empty(*this))
+        return false;
+
+    return data[0] == c;
+}
+
+size_t Utf8_String::calc_size() const
+{
+    if (is_null_or_empty(*this))
+        return 0;
+
+    return count + 1;
+}
+
+size_t Utf8_String::calc_size_no_zero_terminator() const
+{
+    if (is_null_or_empty(*this))
+        return 0;
+
+    return count;
+}
+
+Utf8_String Utf8_String::ref_substring(int start, int length) const
+{
+    E_VERIFY_R(start >= 0, Utf8_String::null);
+    E_VERIFY_R(length >= -1, Utf8_String::null);
+
+    if (start >= count)
+        return Utf8_String::null;
+    if (length < 0 || start + length > count)
+        length = count - start;
+
+    return Utf8_String{ data + start, length };
+}
+
+Utf8_String Utf8_String::ref_trim() const
+{
+    if (is_null_or_empty(*this))
+        return *this;
+
+    int first = 0;
+    while (first < count && (data[first] == ' ' || data[first] == '\t'))
+        ++first;
+
+    int last = count - 1;
+    while (last >= first && (data[last] == ' ' || data[last] == '\t'))
+        --last;
+
+    return Utf8_String{ data + first, last - first + 1 };
+}
+
+String Utf8_String::to_string(IAllocator* allocator) const
+{
+    E_VERIFY_NULL_R(allocator, String::null);
+
+    int length = Utf8::utf16_length(data, count);
+    if (length < 0)
+        return String::null;
+
+    String result = String::allocate_string_of_length(length, allocator);
+    if (String::is_null(result))
+        return String::null;
+
+    if (Utf8::to_utf16(data, count, result.data, length) != length)
+    {
+        allocator->deallocate(result.data);
+        return String::null;
+    }
+
+    result.data[length] = L'\0';
+    return result;
+}
+
+bool Utf8_String::is_null_or_empty(const Utf8_String& string)
+{
+    return string.data == nullptr || string.count <= 0;
+}
+
+bool Utf8_String::is_null(const Utf8_String& string)
+{
+    return string.data == nullptr;
+}
+
+bool Utf8_String::equals(const Utf8_String& a, const Utf8_String& b)
+{
+    if (a.count != b.count)
+        return false;
+    if (a.count <= 0)
+        return true;
+    if (a.data == nullptr || b.data == nullptr)
+        return false;
+
+    return memcmp(a.data, b.data, a.count) == 0;
+}
+
+Utf8_String Utf8_String::allocate_string_of_length(int length, IAllocator* allocator)
+{
+    E_VERIFY_R(length >= 0, Utf8_String::null);
+    E_VERIFY_NULL_R(allocator, Utf8_String::null);
+
+    char* data = (char*)allocator->allocate(length + 1);
+    if (data == nullptr)
+        return Utf8_String::null;
+
+    return Utf8_String(data, length);
+}
+
+Utf8_String Utf8_String::duplicate(const char* string, int string_length, IAllocator* allocator)
+{
+    E_VERIFY_NULL_R(string, Utf8_String::null);
+    E_VERIFY_R(string_length >= 0, Utf8_String::null);
+    E_VERIFY_NULL_R(allocator, Utf8_String::null);
+
+    Utf8_String new_string = allocate_string_of_length(string_length, allocator);
+    if (is_null(new_string))
+        return Utf8_String::null;
+
+    memcpy(new_string.data, string, string_length);
+    new_string.data[string_length] = '\0';
+    return new_string;
+}
+
+Utf8_String Utf8_String::from_string(const String& string, IAllocator* allocator)
+{
+    E_VERIFY_NULL_R(allocator, Utf8_String::null);
+
+    int length = Utf8::utf8_length(string.data, string.count);
+    if (length < 0)
+        return Utf8_String::null;
+
+    Utf8_String result = allocate_string_of_length(length, allocator);
+    if (is_null(result))
+        return Utf8_String::null;
+
+    if (Utf8::to_utf8(string.data, string.count, result.data, length) != length)
+    {
+        allocator->deallocate(result.data);
+        return Utf8_String::null;
+    }
+
+    result.data[length] = '\0';
+    return result;
+}
+
+Utf8_String Utf8_String::reference_to_const_char(const char* string)
+{
+    return Utf8_String((char*)string, string == nullptr ? 0 : (int)strlen(string));
+}
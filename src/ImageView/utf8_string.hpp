@@ -0,0 +1,49 @@
+#pragma once
+#include "allocator.hpp"
+#include "string.hpp"
+
+// Represents zero-terminated UTF-8 string. Counterpart of String for data that comes in UTF-8
+// (text files, persisted caches), so it doesn't have to be widened until it's displayed.
+struct Utf8_String
+{
+    char* data = nullptr;
+    // Refers to amount of bytes in the string, not string length!
+    int count = 0;
+
+    Utf8_String();
+    Utf8_String(char* data, int count);
+
+    inline char operator[](size_t i) {
+        return data[i];
+    }
+    inline const char& operator[](size_t i) const {
+        return data[i];
+    }
+
+    int index_of(char c) const;
+    bool starts_with(char c) const;
+
+    size_t calc_size() const;
+    size_t calc_size_no_zero_terminator() const;
+
+    // Just reference, not a copy.
+    Utf8_String ref_substring(int start, int length = -1) const;
+    Utf8_String ref_trim() const;
+
+    // Converts to UTF-16. Returns String::null if string is not valid UTF-8 or allocation failed.
+    String to_string(IAllocator* allocator = g_standard_allocator) const;
+
+    static bool is_null_or_empty(const Utf8_String& string);
+    static bool is_null(const Utf8_String& string);
+    static bool equals(const Utf8_String& a, const Utf8_String& b);
+
+    static Utf8_String allocate_string_of_length(int length, IAllocator* allocator = g_standard_allocator);
+    static Utf8_String duplicate(const char* string, int string_length, IAllocator* allocator = g_standard_allocator);
+    // Converts from UTF-16. Returns Utf8_String::null if string has lone surrogates or allocation failed.
+    static Utf8_String from_string(const String& string, IAllocator* allocator = g_standard_allocator);
+
+    // Just reference, not duplicate of string or something.
+    static Utf8_String reference_to_const_char(const char* string);
+
+    static const Utf8_String null;
+};
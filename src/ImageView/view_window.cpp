@@ -1,6 +1,7 @@
 ﻿#include <Windows.h>
 #include <windowsx.h>
 #include <shlwapi.h>
+#include <Shlobj.h>
 #include <stdlib.h>
 #include <wchar.h>
 #include <math.h>
@@ -8,6 +9,16 @@
 #include "string_builder.hpp"
 #include "view_window.hpp"
 #include "line_reader.hpp"
+#include "image_format.hpp"
+#include "pixel_conversion.hpp"
+#include "jpeg_restart_decoder.hpp"
+#include "windows_utility.hpp"
+#include "memory_governor.hpp"
+#include "thumbnail_store.hpp"
+#include "thumbnail_loader.hpp"
+#include "exif_reader.hpp"
+#include "jpeg_transform.hpp"
+#include "utf8.hpp"
 #include "defer.hpp"
 #include "error.hpp"
 
@@ -21,10 +32,80 @@ HRESULT adjust_window_rect(int* width, int* height, DWORD window_flags, DWORD wi
 static const DWORD windowed_display_mode_flags = WS_BORDER | WS_CLIPSIBLINGS | WS_OVERLAPPEDWINDOW;
 static const DWORD fullscreen_display_mode_flags = WS_POPUP;
 
+static const wchar_t* settings_file_name = L"settings.txt";
+// Thumbnail store lives in a folder of this name in local application data.
+static const wchar_t* app_data_folder_name = L"ImageView";
+static const wchar_t* thumbnail_store_file_name = L"thumbnails.bin";
+static const wchar_t* metadata_cache_file_name = L"metadata.bin";
+
+// Scaled image is resampled again when the display size hasn't changed for this long.
+static const UINT_PTR scale_timer_id = 1;
+static const UINT scale_timer_delay_ms = 150;
+
+// Low memory is checked this often, caches give memory back while it lasts.
+static const UINT_PTR memory_timer_id = 2;
+static const UINT memory_timer_interval_ms = 1000;
+// Tiles of the current tiled image that are kept under low memory, about a screen full.
+static const int min_tiles_under_low_memory = 64;
+
+// Stored thumbnails are committed this often, superseded ones are compacted away then as well.
+static const UINT_PTR thumbnail_timer_id = 3;
+static const UINT thumbnail_timer_interval_ms = 5000;
+
+// Next frame of the current animation is presented on this timer, or checked for this often while it's composed.
+static const UINT_PTR animation_timer_id = 4;
+static const UINT animation_poll_ms = 10;
+
+// Requested tiles are decoded for this long before input and painting are handled again.
+static const LONGLONG tile_decode_slice_ms = 8;
+
+// Cell of the thumbnail grid is a thumbnail with a margin around it. One wheel notch scrolls a few rows.
+static const int grid_cell_margin = 8;
+static const int grid_cell_size = Thumbnail_Store::thumbnail_size + 2 * grid_cell_margin;
+static const int grid_wheel_rows = 3;
+// Visible thumbnails read from the thumbnail store while painting, the rest are read between paints, as many
+// at a time. Each is a 64 KB read from a mapped file, which can come from disk, and a bitmap upload.
+static const int max_stored_thumbnails_per_paint = 16;
+
+// "Same day" filter matches dates taken in the same calendar day, in FILETIME ticks.
+static const UINT64 ticks_per_day = 24ull * 60 * 60 * 10 * 1000 * 1000;
+
+// Images with more pixels take long enough to decode that their embedded preview is shown first.
+static const UINT64 embedded_preview_min_pixels = 8 * 1000 * 1000;
+
+// Zoom range of the mouse wheel and zoom step of one wheel notch.
+static const float min_zoom = 0.01f;
+static const float max_zoom = 32.0f;
+static const float wheel_zoom_step = 1.25f;
+
+
+static D2D1_BITMAP_PROPERTIES pbgra_bitmap_properties()
+{
+    return D2D1::BitmapProperties(D2D1::PixelFormat(DXGI_FORMAT_B8G8R8A8_UNORM, D2D1_ALPHA_MODE_PREMULTIPLIED));
+}
+
 
 enum class View_Window_Message : UINT
 {
     Show_After_Entered_Event_Loop = WM_USER + 1,
+    // Posted by a scale job when it's done.
+    Scale_Job_Finished = WM_USER + 2,
+    // Posted when drawing requested tiles of the current tiled image.
+    Decode_Tiles = WM_USER + 3,
+    // Posted when drawing requested thumbnails of the thumbnail grid.
+    Decode_Thumbnails = WM_USER + 4,
+    // Posted when metadata of all current files is read.
+    Metadata_Read = WM_USER + 5,
+    // Posted when name index of current files is built.
+    Name_Index_Built = WM_USER + 6,
+    // Posted when the current page is drawn and the next one can be decoded.
+    Prefetch_Page = WM_USER + 7,
+    // Posted by a thumbnail job when it's done, WPARAM is its slot.
+    Thumbnail_Job_Finished = WM_USER + 8,
+    // Posted by the page job when it's done.
+    Page_Job_Finished = WM_USER + 9,
+    // Posted by the rotation job when the file is saved.
+    Rotation_Job_Finished = WM_USER + 10,
 };
 
 enum class View_Menu_Item : int
@@ -35,6 +116,13 @@ enum class View_Menu_Item : int
     Change_Display_Mode = 3,
     Copy_Filename_To_Clipboard = 4,
     Show_Image_Info = 5,
+    Show_Thumbnail_Grid = 6,
+    Filter_Same_Day = 7,
+    Filter_Same_Camera = 8,
+    Filter_With_Location = 9,
+    Rotate_Clockwise = 10,
+    Rotate_Counterclockwise = 11,
+    Save_Rotation = 12,
 };
 //
 //enum class View_Hotkey : int
@@ -55,7 +143,16 @@ enum class View_Shortcut : WORD
     View_Last,
     View_Show_File_In_Explorer,
     Fast_Quit,
-    Change_Display_Mode
+    Change_Display_Mode,
+    Toggle_Thumbnail_Grid,
+    Grid_Up,
+    Grid_Down,
+    Page_Up,
+    Page_Down,
+    Filter_By_Name,
+    Rotate_Clockwise,
+    Rotate_Counterclockwise,
+    Save_Rotation,
 };
 
 bool View_Window::initialize(const View_Window_Init_Params& params, String command_line)
@@ -88,7 +185,7 @@ bool View_Window::initialize(const View_Window_Init_Params& params, String comma
     {
         WNDCLASSEX wc = { 0 };
         wc.cbSize = sizeof(wc);
-        wc.style = CS_HREDRAW | CS_VREDRAW;
+        wc.style = CS_HREDRAW | CS_VREDRAW | CS_DBLCLKS;
         wc.lpfnWndProc = wndproc_proxy;
         wc.hInstance = hInstance;
         wc.hIcon = LoadIconW(0, IDI_APPLICATION);
@@ -194,8 +291,17 @@ bool View_Window::initialize(const View_Window_Init_Params& params, String comma
         view_menu,
         MF_STRING | (show_image_info ? MF_CHECKED : MF_UNCHECKED), 
         (UINT_PTR)View_Menu_Item::Show_Image_Info, L"Show image info");
+    AppendMenuW(view_menu, MF_STRING | MF_UNCHECKED, (UINT_PTR)View_Menu_Item::Show_Thumbnail_Grid, L"Show thumbnails");
     AppendMenuW(view_menu, MF_STRING, (UINT_PTR)View_Menu_Item::Copy_Filename_To_Clipboard, L"Copy filename to clipboard");
     AppendMenuW(view_menu, MF_SEPARATOR, (UINT_PTR)View_Menu_Item::None, nullptr);
+    AppendMenuW(view_menu, MF_STRING, (UINT_PTR)View_Menu_Item::Rotate_Clockwise, L"Rotate clockwise\tR");
+    AppendMenuW(view_menu, MF_STRING, (UINT_PTR)View_Menu_Item::Rotate_Counterclockwise, L"Rotate counterclockwise\tShift+R");
+    AppendMenuW(view_menu, MF_STRING, (UINT_PTR)View_Menu_Item::Save_Rotation, L"Save rotation\tCtrl+S");
+    AppendMenuW(view_menu, MF_SEPARATOR, (UINT_PTR)View_Menu_Item::None, nullptr);
+    AppendMenuW(view_menu, MF_STRING | MF_UNCHECKED, (UINT_PTR)View_Menu_Item::Filter_Same_Day, L"Only photos taken the same day");
+    AppendMenuW(view_menu, MF_STRING | MF_UNCHECKED, (UINT_PTR)View_Menu_Item::Filter_Same_Camera, L"Only photos from the same camera");
+    AppendMenuW(view_menu, MF_STRING | MF_UNCHECKED, (UINT_PTR)View_Menu_Item::Filter_With_Location, L"Only photos with location");
+    AppendMenuW(view_menu, MF_SEPARATOR, (UINT_PTR)View_Menu_Item::None, nullptr);
     AppendMenuW(view_menu, MF_STRING, (UINT_PTR)View_Menu_Item::Quit_App, L"Quit");
 
     UpdateWindow(hwnd);
@@ -217,9 +323,19 @@ bool View_Window::initialize(const View_Window_Init_Params& params, String comma
     wchar_t** args;
     args = CommandLineToArgvW(command_line.data, &num_args);
 
-    // Set default scaling
-    // @TODO: read from settings.
-    set_scaling_mode(Scaling_Mode::Fit_To_Window, 1.0f);
+    // Set scaling from settings
+    settings_scaling_mode = scaling_mode;
+    settings_scaling = scaling;
+    set_scaling_mode(scaling_mode, scaling);
+
+    if (!SetTimer(hwnd, memory_timer_id, memory_timer_interval_ms, nullptr))
+        LOG_LAST_WIN32_ERROR(L"Unable to start low memory timer.\n");
+
+    open_thumbnail_store();
+    if (g_thumbnail_store->is_open() && !SetTimer(hwnd, thumbnail_timer_id, thumbnail_timer_interval_ms, nullptr))
+        LOG_LAST_WIN32_ERROR(L"Unable to start thumbnail store timer.\n");
+
+    open_metadata_cache();
 
     // Initialize keyboard accelerator
     {
@@ -231,6 +347,15 @@ bool View_Window::initialize(const View_Window_Init_Params& params, String comma
             { FVIRTKEY, VK_RETURN, (WORD)View_Shortcut::View_Show_File_In_Explorer },
             { FVIRTKEY, VK_ESCAPE, (WORD)View_Shortcut::Fast_Quit },
             { FVIRTKEY, VK_F11, (WORD)View_Shortcut::Change_Display_Mode },
+            { FVIRTKEY, 'G', (WORD)View_Shortcut::Toggle_Thumbnail_Grid },
+            { FVIRTKEY, VK_UP, (WORD)View_Shortcut::Grid_Up },
+            { FVIRTKEY, VK_DOWN, (WORD)View_Shortcut::Grid_Down },
+            { FVIRTKEY, VK_PRIOR, (WORD)View_Shortcut::Page_Up },
+            { FVIRTKEY, VK_NEXT, (WORD)View_Shortcut::Page_Down },
+            { FVIRTKEY | FCONTROL, 'F', (WORD)View_Shortcut::Filter_By_Name },
+            { FVIRTKEY, 'R', (WORD)View_Shortcut::Rotate_Clockwise },
+            { FVIRTKEY | FSHIFT, 'R', (WORD)View_Shortcut::Rotate_Counterclockwise },
+            { FVIRTKEY | FCONTROL, 'S', (WORD)View_Shortcut::Save_Rotation },
         };
 
         kb_accel = CreateAcceleratorTableW(accels, ARRAYSIZE(accels));
@@ -255,13 +380,31 @@ bool View_Window::initialize(const View_Window_Init_Params& params, String comma
 
 bool View_Window::shutdown()
 {
+    // Thumbnail and page jobs use the WIC factory.
+    cancel_thumbnail_jobs();
+    cancel_page_job();
+    cancel_rotation_job();
     safe_release(wic);
     safe_release(d2d1);
     safe_release(dwrite);
+    KillTimer(hwnd, memory_timer_id);
+    KillTimer(hwnd, thumbnail_timer_id);
+    cancel_scale_job();
     safe_release(current_image_direct2d);
+    safe_release(scaled_image_direct2d);
     safe_release(decoder);
+    current_image_levels = nullptr;
+    current_tiled_image.release();
+    current_dds.close();
+    g_image_cache->clear();
+    g_thumbnail_store->close();
+    metadata_index.close_cache();
+    metadata_index.release();
+    name_index.release();
+    name_matches.release();
 
     discard_graphics_resources();
+    thumbnail_atlas.release();
 
     if (kb_accel != 0)
     {
@@ -277,49 +420,243 @@ bool View_Window::shutdown()
 
 void View_Window::load_and_apply_settings()
 {
-    //HRESULT hr;
-    //char* data  = nullptr;
-    //UINT64 size = 0;
+    HRESULT hr;
+    Temporary_Allocator_Guard g;
+
+    // Settings file lives next to the executable.
+    const int module_path_capacity = MAX_PATH;
+    wchar_t* module_path = (wchar_t*)g_temporary_allocator->allocate(sizeof(wchar_t) * module_path_capacity);
+    if (module_path == nullptr)
+        return;
+
+    DWORD module_path_count = GetModuleFileNameW(0, module_path, module_path_capacity);
+    if (module_path_count == 0 || module_path_count >= module_path_capacity)
+    {
+        LOG_LAST_WIN32_ERROR(L"Unable to get executable path");
+        return;
+    }
+
+    String folder_path;
+    hr = File_System_Utility::extract_folder_path(String{ module_path, (int)module_path_count }, &folder_path, g_temporary_allocator);
+    if (FAILED(hr))
+        return;
+
+    const String settings_path_parts[] = { folder_path, String::reference_to_const_wchar_t(settings_file_name) };
+    String settings_path = String::join(L'\\', settings_path_parts, ARRAYSIZE(settings_path_parts), g_temporary_allocator);
+    if (String::is_null(settings_path))
+        return;
+
+    File_Line_Reader reader;
+    hr = reader.open(settings_path);
+    if (hr == HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND))
+        return; // No settings file, use defaults.
+
+    if (FAILED(hr))
+    {
+        LOG_HRESULT_ERROR(hr, L"Cannot load settings");
+        return;
+    }
+    defer(reader.close());
+
+    int line_number = 0;
+    Utf8_String line;
+    while (reader.next_line(&line))
+    {
+        ++line_number;
+
+        line = line.ref_trim();
+        if (Utf8_String::is_null_or_empty(line))
+            continue;
+        if (line.starts_with(';'))
+            continue;
+
+        int separator_index = line.index_of('=');
+        Utf8_String key   = separator_index == -1 ? Utf8_String::null : line.ref_substring(0, separator_index).ref_trim();
+        Utf8_String value = separator_index == -1 ? Utf8_String::null : line.ref_substring(separator_index + 1).ref_trim();
+
+        if (Utf8_String::is_null_or_empty(key) || Utf8_String::is_null_or_empty(value) || !apply_setting(key, value))
+            LOG_ERROR(L"Invalid setting at line %d of settings file", line_number);
+    }
+
+    if (FAILED(reader.error))
+        LOG_HRESULT_ERROR(reader.error, L"Unable to read settings file");
+}
+
+static bool setting_equals(const Utf8_String& string, const char* literal)
+{
+    return Utf8_String::equals(string, Utf8_String::reference_to_const_char(literal));
+}
+
+// Parses size in megabytes, e.g. "512", to bytes.
+static bool parse_megabytes(const Utf8_String& value, size_t* bytes)
+{
+    // Value is not zero-terminated, copy it before parsing.
+    char number[32];
+    if (value.count >= ARRAYSIZE(number))
+        return false;
+
+    memcpy(number, value.data, value.count);
+    number[value.count] = '\0';
+
+    char* number_end = nullptr;
+    unsigned long megabytes = strtoul(number, &number_end, 10);
+    if (number_end == number || *number_end != '\0' || megabytes > static_cast<size_t>(-1) / (1024 * 1024))
+        return false;
+
+    *bytes = static_cast<size_t>(megabytes) * 1024 * 1024;
+    return true;
+}
+
+bool View_Window::apply_setting(const Utf8_String& key, const Utf8_String& value)
+{
+    if (setting_equals(key, "show_image_info"))
+    {
+        if (setting_equals(value, "true"))
+            show_image_info = true;
+        else if (setting_equals(value, "false"))
+            show_image_info = false;
+        else
+            return false;
+
+        return true;
+    }
+
+    if (setting_equals(key, "scaling"))
+    {
+        if (setting_equals(value, "fit"))
+        {
+            scaling_mode = Scaling_Mode::Fit_To_Window;
+            scaling = 1.0f;
+            return true;
+        }
+
+        if (setting_equals(value, "none"))
+        {
+            scaling_mode = Scaling_Mode::No_Scaling;
+            scaling = 1.0f;
+            return true;
+        }
+
+        // Percentage, e.g. "150%". Value is not zero-terminated, copy it before parsing.
+        char number[32];
+        if (value.count >= ARRAYSIZE(number))
+            return false;
+
+        memcpy(number, value.data, value.count);
+        number[value.count] = '\0';
+
+        char* number_end = nullptr;
+        double percentage = strtod(number, &number_end);
+        if (number_end == number || percentage <= 0.0)
+            return false;
+        if (*number_end != '\0' && !(number_end[0] == '%' && number_end[1] == '\0'))
+            return false;
+
+        scaling_mode = Scaling_Mode::Percentage;
+        scaling = static_cast<float>(percentage / 100.0);
+        return true;
+    }
+
+    if (setting_equals(key, "sort"))
+    {
+        if (setting_equals(value, "name"))
+            sort_mode = Sort_Mode::Name;
+        else if (setting_equals(value, "date_created"))
+            sort_mode = Sort_Mode::Date_Created;
+        else if (setting_equals(value, "date_accessed"))
+            sort_mode = Sort_Mode::Date_Accessed;
+        else if (setting_equals(value, "date_modified"))
+            sort_mode = Sort_Mode::Date_Modified;
+        else if (setting_equals(value, "date_taken"))
+            sort_mode = Sort_Mode::Date_Taken;
+        else
+            return false;
+
+        return true;
+    }
+
+    if (setting_equals(key, "chroma_upsampling"))
+    {
+        if (setting_equals(value, "fancy"))
+            chroma_upsampling = Chroma_Upsampling::Fancy;
+        else if (setting_equals(value, "nearest"))
+            chroma_upsampling = Chroma_Upsampling::Nearest;
+        else
+            return false;
+
+        return true;
+    }
+
+    if (setting_equals(key, "resample_filter"))
+    {
+        if (setting_equals(value, "lanczos3"))
+            resample_filter = Resample_Filter::Lanczos3;
+        else if (setting_equals(value, "bicubic"))
+            resample_filter = Resample_Filter::Bicubic;
+        else if (setting_equals(value, "box"))
+            resample_filter = Resample_Filter::Box;
+        else if (setting_equals(value, "none"))
+            resample_filter = Resample_Filter::None;
+        else
+            return false;
+
+        return true;
+    }
+
+    if (setting_equals(key, "resample_linear_light"))
+    {
+        if (setting_equals(value, "true"))
+            resample_in_linear_light = true;
+        else if (setting_equals(value, "false"))
+            resample_in_linear_light = false;
+        else
+            return false;
 
-    //Temporary_Allocator_Guard g;
-    //hr = File_System_Utility::read_file_contents(String::reference_to_const_wchar_t(L"D:/sette.txt"), (void**)&data, &size, g_temporary_allocator);
+        return true;
+    }
+
+    if (setting_equals(key, "image_cache_size"))
+    {
+        size_t budget;
+        if (!parse_megabytes(value, &budget))
+            return false;
+
+        g_image_cache->set_budget(budget);
+        return true;
+    }
 
-    //if (FAILED(hr))
-    //{
-    //    LOG_HRESULT_ERROR(hr, L"Cannot load settings");
-    //    return;
-    //}
+    if (setting_equals(key, "compressed_cache_size"))
+    {
+        size_t budget;
+        if (!parse_megabytes(value, &budget))
+            return false;
 
-    //if (size == 0)
-    //{
-    //    LOG_ERROR(L"Cannot load settings because settings file is empty.");
-    //    return;
-    //}
+        g_image_cache->set_compressed_budget(budget);
+        return true;
+    }
 
-    //if (size > static_cast<UINT64>(INT_MAX))
-    //{
-    //    LOG_ERROR(L"Cannot load settings because file is too big.");
-    //    return;
-    //}
+    if (setting_equals(key, "tile_cache_size"))
+    {
+        // Applies to images opened afterwards.
+        if (!parse_megabytes(value, &tile_cache_budget))
+            return false;
 
-    //String_Builder sb{ g_temporary_allocator };
-    //String base_line;
-    //base_line.data = sb.buffer;
+        return true;
+    }
 
-    //Line_Reader reader;
-    //reader.set_source(data, static_cast<int>(size));
-    //reader.set_string_builder(&sb);
+    if (setting_equals(key, "sort_order"))
+    {
+        if (setting_equals(value, "ascending"))
+            sort_order = Sort_Order::Ascending;
+        else if (setting_equals(value, "descending"))
+            sort_order = Sort_Order::Descending;
+        else
+            return false;
 
-    //while (reader.next_line())
-    //{
-    //    base_line.count = sb.count;
-    //    if (base_line.count == 0)
-    //        continue;
-    //    if (base_line.starts_with(L';'))
-    //        continue;
+        return true;
+    }
 
-    //    String line = base_line.ref_trim();
-    //}
+    return false;
 }
 
 String View_Window::get_file_info_absolute_path(const String& folder, const File_Info* file_info, IAllocator* allocator)
@@ -330,27 +667,35 @@ String View_Window::get_file_info_absolute_path(const String& folder, const File
     return String::join(L'/', strings, num, allocator);
 }
 
+// 'userdata' is optional file name that must be accepted even if its extension is not
+// an image one. It's the file user asked to open, decoder will sniff its real format.
+// Names that differ only in case are the same file on Windows, like in 'find_file_info_by_path'.
 static bool image_filter(const WIN32_FIND_DATA& data, void* userdata)
 {
-    static const wchar_t* image_extensions[] = { L".jpg", L".png", L".gif", L".bmp", nullptr };
-
     bool is_file = data.dwFileAttributes != INVALID_FILE_ATTRIBUTES && (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) == 0;
     if (!is_file)
         return false;
 
-    String file_name = String::reference_to_const_wchar_t(data.cFileName);
+    if (Image_Format_Registry::from_file_name(data.cFileName) != Image_Format::Unknown)
+        return true;
 
-    int i = 0;
-    const wchar_t* ext = nullptr;
-    while (ext = image_extensions[i++])
-    {
-        if (file_name.ends_with(ext))
-            return true;
-    }
+    const String* requested_file_name = static_cast<const String*>(userdata);
+    if (requested_file_name != nullptr)
+        return String::equals_ignore_case(*requested_file_name, String::reference_to_const_wchar_t(data.cFileName));
 
     return false;
 }
 
+static void set_menu_item_checked(HMENU menu, View_Menu_Item item, bool checked)
+{
+    MENUITEMINFOW info = { 0 };
+    info.cbSize = sizeof(info);
+    info.fMask = MIIM_STATE;
+    info.fState = checked ? MFS_CHECKED : MFS_UNCHECKED;
+    if (!SetMenuItemInfoW(menu, (UINT)item, false, &info))
+        LOG_LAST_WIN32_ERROR(L"Cannot change state of menu item %d to %d", (int)item, (int)checked);
+}
+
 void View_Window::load_path(const String& file_path)
 {
     HRESULT hr = 0;
@@ -362,25 +707,42 @@ void View_Window::load_path(const String& file_path)
         return;
     }
 
-    Sequence<File_Info> files;
-    hr = File_System_Utility::get_folder_files(&files, folder_path, image_filter, nullptr);
-    if (FAILED(hr)) {
+    Temporary_Allocator_Guard g;
+    String file_name;
+    if (!File_System_Utility::extract_file_name_from_path(file_path, &file_name, g_temporary_allocator)) {
         error_box(hr);
         return;
     }
 
-    Temporary_Allocator_Guard g;
-    String file_name;
-    if (!File_System_Utility::extract_file_name_from_path(file_path, &file_name, g_temporary_allocator)) {
+    Sequence<File_Info> files;
+    hr = File_System_Utility::get_folder_files(&files, folder_path, image_filter, &file_name);
+    if (FAILED(hr)) {
         error_box(hr);
         return;
     }
 
+    // Workers read files of the folder that's being replaced.
+    metadata_index.cancel();
+    name_index.release();
+    name_matches.clear();
+
     current_folder = folder_path;
     current_files = files;
     current_file_index = -1;
-    
-    hr = sort_current_images(Sort_Mode::Date_Created, Sort_Order::Descending);
+
+    // Filters take their values from files of the folder, they don't carry over to another one.
+    metadata_filter = Metadata_Filter();
+    set_menu_item_checked(view_menu, View_Menu_Item::Filter_Same_Day, false);
+    set_menu_item_checked(view_menu, View_Menu_Item::Filter_Same_Camera, false);
+    set_menu_item_checked(view_menu, View_Menu_Item::Filter_With_Location, false);
+    name_filter_length = 0;
+    is_typing_name_filter = false;
+    if (!metadata_index.reset(current_folder, current_files))
+        LOG_ERROR(L"Unable to reset metadata index for %d files.\n", current_files.count);
+
+    // Sort reorders thumbnails too, so the atlas is reset for the new files first.
+    reset_thumbnail_grid();
+    hr = sort_current_images(sort_mode, sort_order);
     if (FAILED(hr)) {
         current_file_index = 0;
         error_box(hr);
@@ -398,51 +760,135 @@ void View_Window::load_path(const String& file_path)
         current_file_index = index;
     }
 
+    // Opened file is shown, not the grid.
+    set_grid_mode(false);
     view_file_index(index);
+
+    // Files around the opened one are read first. Cached ones are already filled by 'reset', or by the run
+    // when it loads the cache.
+    start_metadata_extraction();
+    name_index.start(hwnd, (UINT)View_Window_Message::Name_Index_Built, current_files);
+}
+
+// Returns position of the first of ascending 'indices' that is not less than 'index', 'count' if there's none.
+static int lower_bound(const int* indices, int count, int index)
+{
+    int first = 0;
+    while (count > 0)
+    {
+        const int step = count / 2;
+        if (indices[first + step] < index)
+        {
+            first += step + 1;
+            count -= step + 1;
+        }
+        else
+        {
+            count = step;
+        }
+    }
+
+    return first;
 }
 
+// Only shown files are visited. Current file may be filtered out, the shown ones around it are visited then.
 void View_Window::view_prev()
 {
-    if (current_files.count == 1)
-        return;
-    if (current_file_index < 0 || current_files.is_empty())
+    if (current_file_index < 0 || shown_files.is_empty())
         return;
 
-    int index = current_file_index - 1;
-    if (index >= 0)
-        view_file_index(index);
-    else
-        view_file_index(current_files.count + index);
+    int position = lower_bound(shown_files.data, shown_files.count, current_file_index) - 1;
+    if (position < 0)
+        position = shown_files.count - 1;
+
+    if (shown_files.data[position] != current_file_index)
+        view_file_index(shown_files.data[position]);
 }
 
 void View_Window::view_next()
 {
-    if (current_files.count == 1)
+    if (current_file_index < 0 || shown_files.is_empty())
         return;
-    if (current_file_index < 0 || current_files.is_empty())
-        return;
-    
-    int index = current_file_index + 1;
-    if (index < current_files.count)
-        view_file_index(index);
-    else
-        view_file_index(current_files.count - index);
+
+    int position = lower_bound(shown_files.data, shown_files.count, current_file_index);
+    if (position < shown_files.count && shown_files.data[position] == current_file_index)
+        ++position;
+    if (position >= shown_files.count)
+        position = 0;
+
+    if (shown_files.data[position] != current_file_index)
+        view_file_index(shown_files.data[position]);
 }
 
 void View_Window::view_first()
 {
-    if (current_files.is_empty())
+    if (shown_files.is_empty())
         return;
 
-    view_file_index(0);
+    view_file_index(shown_files.data[0]);
 }
 
 void View_Window::view_last()
 {
-    if (current_files.is_empty())
+    if (shown_files.is_empty())
         return;
 
-    view_file_index(current_files.count - 1);
+    view_file_index(shown_files.data[shown_files.count - 1]);
+}
+
+// Creates decoder of file at 'file_path' for the format its signature says. Called on job pool threads too,
+// the WIC factory is free threaded.
+static HRESULT create_decoder_from_file_path(IWICImagingFactory* wic, const String& file_path, IWICBitmapDecoder** decoder)
+{
+    E_VERIFY_NULL_R(wic, E_INVALIDARG);
+    E_VERIFY_R(!String::is_null_or_empty(file_path), E_INVALIDARG);
+    E_VERIFY_NULL_R(decoder, E_INVALIDARG);
+
+    HRESULT hr;
+    IStream* stream = nullptr;
+    hr = SHCreateStreamOnFileEx(file_path.data, STGM_READ, FILE_ATTRIBUTE_NORMAL, false, nullptr, &stream);
+    if (FAILED(hr))
+        return hr;
+    defer (safe_release(stream));
+
+    // Pick decoder by file signature, not by extension, so misnamed files still open and WIC
+    // doesn't have to probe every installed codec.
+    unsigned char header[Image_Format_Registry::signature_probe_size];
+    ULONG header_size = 0;
+    hr = stream->Read(header, sizeof(header), &header_size);
+    if (FAILED(hr))
+        return hr;
+
+    LARGE_INTEGER stream_start = { 0 };
+    hr = stream->Seek(stream_start, STREAM_SEEK_SET, nullptr);
+    if (FAILED(hr))
+        return hr;
+
+    Image_Format format = Image_Format_Registry::sniff(header, static_cast<int>(header_size));
+    const Image_Format_Info* format_info = Image_Format_Registry::get_info(format);
+
+    if (format_info->container_format != nullptr)
+    {
+        IWICBitmapDecoder* sniffed_decoder = nullptr;
+        hr = wic->CreateDecoder(*format_info->container_format, nullptr, &sniffed_decoder);
+        if (SUCCEEDED(hr))
+        {
+            hr = sniffed_decoder->Initialize(stream, WICDecodeMetadataCacheOnDemand);
+            if (SUCCEEDED(hr))
+            {
+                *decoder = sniffed_decoder;
+                return S_OK;
+            }
+
+            safe_release(sniffed_decoder);
+            hr = stream->Seek(stream_start, STREAM_SEEK_SET, nullptr);
+            if (FAILED(hr))
+                return hr;
+        }
+    }
+
+    hr = wic->CreateDecoderFromStream(stream, nullptr, WICDecodeMetadataCacheOnDemand, decoder);
+    return hr;
 }
 
 void View_Window::view_file_index(int index)
@@ -459,12 +905,68 @@ void View_Window::view_file_index(int index)
     if (String::is_null(full_path))
         __debugbreak();
 
-    IWICBitmapDecoder* decoder = nullptr;
-    HRESULT hr;
+    // Pages are listed before the cache is looked at, which frame of the first page is shown depends on
+    // the display size. Frame headers are read from the decoder, it's kept to decode the other pages.
+    // Pages of the current file stay current until the new one is shown.
+    IWICBitmapDecoder* file_decoder = nullptr;
+    opened_frames.clear();
+    const Image_Format format = Image_Format_Registry::from_file_name(full_path.data);
+    if (Frame_Index::is_listed(format) && SUCCEEDED(create_decoder_from_file_path(wic, full_path, &file_decoder)))
+    {
+        HRESULT hr = opened_frames.scan(file_decoder, format);
+        if (FAILED(hr))
+            LOG_HRESULT_ERROR(hr, L"Unable to list frames of \"%s\".\n", full_path.data);
+    }
+
+    const UINT frame = choose_page_frame(opened_frames, 0);
+
+    if (format == Image_Format::Dds && set_current_dds_image(full_path))
+    {
+        current_frames.swap(&opened_frames);
+        current_page = 0;
+        current_file_index = index;
+        current_frame = 0;
+        update_view_title();
+        return;
+    }
 
-    do
+    Mip_Pyramid* cached = g_image_cache->find(full_path, file->date_modified, frame);
+    if (cached == nullptr && g_image_cache->is_compressed(full_path, file->date_modified, frame))
     {
-        hr = create_decoder_from_file_path(full_path, &decoder);
+        // Scale job has to be stopped before cache moves entries to make space.
+        if (!release_current_image())
+        {
+            safe_release(file_decoder);
+            return;
+        }
+
+        cached = g_image_cache->restore(full_path, file->date_modified, frame);
+    }
+
+    if (cached != nullptr)
+    {
+        if (set_current_image(cached)) {
+            decoder = file_decoder;
+            current_frames.swap(&opened_frames);
+            current_page = 0;
+            current_file_index = index;
+            current_frame = frame;
+            is_prefetch_page_requested = true;
+            update_view_title();
+            store_thumbnail(full_path, *file);
+            start_animation(full_path);
+        } else {
+            safe_release(file_decoder);
+        }
+
+        g_image_cache->report_statistics();
+        return;
+    }
+
+    HRESULT hr = S_OK;
+    while (file_decoder == nullptr)
+    {
+        hr = create_decoder_from_file_path(wic, full_path, &file_decoder);
         if (SUCCEEDED(hr))
         {
             break;
@@ -491,39 +993,302 @@ void View_Window::view_file_index(int index)
             else
                 break;
         }
-    } while (1);
+    }
 
-    if (FAILED(hr) || decoder == nullptr)
+    if (FAILED(hr) || file_decoder == nullptr)
         return;
 
-    if (set_current_image(decoder)) {
+    if (set_current_image(file_decoder, full_path, file->date_modified, frame)) {
+        current_frames.swap(&opened_frames);
+        current_page = 0;
         current_file_index = index;
+        current_frame = frame;
+        is_prefetch_page_requested = true;
         update_view_title();
+        store_thumbnail(full_path, *file);
+        start_animation(full_path);
     }
+
+    g_image_cache->report_statistics();
 }
 
-void View_Window::update_view_title()
+void View_Window::view_page(int page)
 {
-    File_Info* current = get_current_file_info();
-    if (current == nullptr)
+    File_Info* file = get_current_file_info();
+    if (file == nullptr || page < 0 || page >= current_frames.get_page_count() || page == current_page)
         return;
 
-    const wchar_t* path = current->path.data;
-
-    String_Builder title{ g_temporary_allocator };
     Temporary_Allocator_Guard g;
+    String full_path = get_file_info_absolute_path(current_folder, file, g_temporary_allocator);
+    if (String::is_null(full_path))
+        return;
 
-    title.begin();
-    title.append_format(L"(%i/%i) %s", current_file_index + 1, current_files.count, path);
-    if (!title.end())
-        LOG_ERROR(L"Unable to update title.\n");
-    else 
-        SetWindowTextW(hwnd, title.buffer);
-}
+    const UINT frame = choose_page_frame(current_frames, page);
 
-bool View_Window::set_current_image(IWICBitmapDecoder* bitmap_decoder)
-{
+    // Decoder is taken from the current image, so releasing it doesn't release the decoder.
+    IWICBitmapDecoder* file_decoder = decoder;
+    decoder = nullptr;
+
+    Mip_Pyramid* cached = g_image_cache->find(full_path, file->date_modified, frame);
+    if (cached == nullptr && g_image_cache->is_compressed(full_path, file->date_modified, frame))
+    {
+        // Scale job has to be stopped before cache moves entries to make space.
+        if (!release_current_image())
+        {
+            safe_release(file_decoder);
+            return;
+        }
+
+        cached = g_image_cache->restore(full_path, file->date_modified, frame);
+    }
+
+    bool is_shown = false;
+    if (cached != nullptr)
+    {
+        is_shown = set_current_image(cached);
+        decoder = file_decoder;
+    }
+    else
+    {
+        // Image of the current page came from the cache, pages are decoded by a new decoder.
+        if (file_decoder == nullptr)
+        {
+            HRESULT hr = create_decoder_from_file_path(wic, full_path, &file_decoder);
+            if (FAILED(hr))
+            {
+                LOG_HRESULT_ERROR(hr, L"Unable to open \"%s\".\n", full_path.data);
+                return;
+            }
+        }
+
+        is_shown = set_current_image(file_decoder, full_path, file->date_modified, frame);
+    }
+
+    if (is_shown)
+    {
+        current_page = page;
+        current_frame = frame;
+        is_prefetch_page_requested = true;
+        update_view_title();
+    }
+
+    g_image_cache->report_statistics();
+}
+
+UINT View_Window::choose_page_frame(const Frame_Index& frames, int page) const
+{
+    // Windows grow up to the work area to fit their image.
+    if (display_mode == Display_Mode::Fullscreen)
+        return frames.choose_frame(page, desktop_width, desktop_height);
+
+    return frames.choose_frame(page, desktop_work_width, desktop_work_height);
+}
+
+// Decodes frame of 'job' with its mip levels into its result. Returns S_FALSE if it's left to be decoded
+// when it's viewed.
+static HRESULT decode_page(Page_Job* job)
+{
+    // Decoder of the window is used by it, the job opens the file again.
+    IWICBitmapDecoder* decoder = nullptr;
+    HRESULT hr = create_decoder_from_file_path(job->wic, job->path, &decoder);
+    if (FAILED(hr))
+        return hr;
+    defer(decoder->Release());
+
+    IWICBitmapFrameDecode* frame = nullptr;
+    hr = decoder->GetFrame(job->frame, &frame);
+    if (FAILED(hr))
+        return hr;
+    defer(frame->Release());
+
+    UINT width = 0;
+    UINT height = 0;
+    hr = frame->GetSize(&width, &height);
+    if (FAILED(hr))
+        return hr;
+
+    const UINT64 decoded_size = static_cast<UINT64>(width) * height * sizeof(UINT32) * 4 / 3;
+    if (width == 0 || height == 0 || width > job->max_size || height > job->max_size || decoded_size > job->max_decoded_size)
+        return S_FALSE;
+
+    Image_Buffer pixels;
+    if (!pixels.allocate(static_cast<int>(width), static_cast<int>(height)))
+        return E_OUTOFMEMORY;
+    defer(pixels.release());
+
+    const WICRect rect = { 0, 0, static_cast<INT>(width), static_cast<INT>(height) };
+    hr = Pixel_Conversion::copy_pixels(job->wic, frame, rect, pixels.pixels, pixels.stride, job->chroma_upsampling);
+    if (FAILED(hr))
+        return hr;
+
+    // Without mip levels the page is still shown, it's just slower to scale.
+    job->result.build(&pixels);
+    return S_OK;
+}
+
+static void run_page_job(void* context, int)
+{
+    Page_Job* job = (Page_Job*)context;
+
+    // WIC factory is free threaded, workers are in the multithreaded apartment.
+    job->hr = job->is_cancelled ? E_ABORT : decode_page(job);
+    PostMessageW(job->hwnd, (UINT)View_Window_Message::Page_Job_Finished, 0, 0);
+}
+
+void View_Window::prefetch_next_page()
+{
+    // Page decoded while the scale job was running goes into the cache first, one page is decoded at a time.
+    if (page_job.is_finished && !insert_prefetched_page())
+    {
+        is_prefetch_page_requested = true;
+        return;
+    }
+    if (page_job.is_running)
+        return;
+
+    const int page = current_page + 1;
+    File_Info* file = get_current_file_info();
+    if (file == nullptr || current_image_levels == nullptr || page >= current_frames.get_page_count())
+        return;
+
+    const UINT frame = choose_page_frame(current_frames, page);
+    String full_path = get_file_info_absolute_path(current_folder, file, g_standard_allocator);
+    if (String::is_null(full_path))
+        return;
+
+    const size_t cache_size = g_image_cache->get_size_in_bytes();
+    const size_t budget = g_image_cache->get_budget();
+    if (g_image_cache->contains(full_path, file->date_modified, frame) || cache_size >= budget)
+    {
+        g_standard_allocator->deallocate(full_path.data);
+        return;
+    }
+
+    page_job.hwnd = hwnd;
+    page_job.wic = wic;
+    page_job.chroma_upsampling = chroma_upsampling;
+    page_job.path = full_path;
+    page_job.date_modified = file->date_modified;
+    page_job.frame = frame;
+    page_job.max_size = hwnd_target->GetMaximumBitmapSize();
+    page_job.max_decoded_size = budget - cache_size;
+    page_job.is_cancelled = 0;
+    page_job.hr = S_OK;
+    page_job.is_running = true;
+
+    if (!g_job_pool->submit(run_page_job, &page_job, 0, &page_job.group))
+        run_page_job(&page_job, 0);
+}
+
+void View_Window::finish_page_job()
+{
+    if (!page_job.is_running)
+        return; // Cancelled, message is from a job that's already handled.
+
+    // Message is posted just before the job returns.
+    g_job_pool->wait(&page_job.group);
+    page_job.is_running = false;
+
+    if (page_job.hr != S_OK)
+    {
+        if (FAILED(page_job.hr) && page_job.hr != E_ABORT)
+            LOG_HRESULT_ERROR(page_job.hr, L"Unable to decode frame %u of \"%s\" ahead.\n", page_job.frame, page_job.path.data);
+
+        g_standard_allocator->deallocate(page_job.path.data);
+        page_job.path = String();
+        return;
+    }
+
+    // Current image must not move in the cache while it's resampled, it's tried again after the next draw.
+    page_job.is_finished = true;
+    if (!insert_prefetched_page())
+        is_prefetch_page_requested = true;
+}
+
+bool View_Window::insert_prefetched_page()
+{
+    if (is_scale_job_running)
+        return false;
+
+    page_job.is_finished = false;
+    Mip_Pyramid image = page_job.result;
+    page_job.result = Mip_Pyramid();
+    const String path = page_job.path;
+    page_job.path = String();
+    defer(g_standard_allocator->deallocate(path.data));
+
+    // Cache may have filled up, or the page was viewed, while it was decoded.
+    if (g_image_cache->contains(path, page_job.date_modified, page_job.frame) ||
+        g_image_cache->get_size_in_bytes() + image.size_in_bytes() > g_image_cache->get_budget() ||
+        g_image_cache->insert(path, page_job.date_modified, &image, page_job.frame) == nullptr)
+    {
+        image.release();
+        return true;
+    }
+
+    // Entries move when one is evicted to make room.
+    File_Info* file = get_current_file_info();
+    if (current_image_levels != nullptr && file != nullptr)
+    {
+        Temporary_Allocator_Guard g;
+        String full_path = get_file_info_absolute_path(current_folder, file, g_temporary_allocator);
+        current_image_levels = String::is_null(full_path) ? nullptr : g_image_cache->find(full_path, file->date_modified, current_frame);
+        if (current_image_levels == nullptr)
+            InvalidateRect(hwnd, nullptr, true);
+    }
+
+    return true;
+}
+
+void View_Window::cancel_page_job()
+{
+    if (page_job.is_running)
+    {
+        InterlockedExchange(&page_job.is_cancelled, 1);
+        g_job_pool->wait(&page_job.group);
+        page_job.is_running = false;
+    }
+    else if (!page_job.is_finished)
+    {
+        return;
+    }
+
+    page_job.is_finished = false;
+    page_job.result.release();
+    g_standard_allocator->deallocate(page_job.path.data);
+    page_job.path = String();
+}
+
+void View_Window::update_view_title()
+{
+    File_Info* current = get_current_file_info();
+    if (current == nullptr)
+        return;
+
+    const wchar_t* path = current->path.data;
+
+    String_Builder title{ g_temporary_allocator };
+    Temporary_Allocator_Guard g;
+
+    // Position among shown files while a filter is set, the current file may be filtered out.
+    const int position = find_shown_position(current_file_index);
+    title.begin();
+    if (position < 0)
+        title.append(L"(-/", shown_files.count, L") ", path);
+    else
+        title.append(L"(", position + 1, L'/', shown_files.count, L") ", path);
+    if (current_frames.get_page_count() > 1)
+        title.append(L"  [page ", current_page + 1, L'/', current_frames.get_page_count(), L"]");
+    if (!title.end())
+        LOG_ERROR(L"Unable to update title.\n");
+    else 
+        SetWindowTextW(hwnd, title.buffer);
+}
+
+bool View_Window::set_current_image(IWICBitmapDecoder* bitmap_decoder, const String& path, const FILETIME& date_modified, UINT frame)
+{
     E_VERIFY_NULL_R(bitmap_decoder, false);
+    // Scale job has to be stopped before cache evicts anything to make space.
     if (!release_current_image())
         return false;
 
@@ -531,49 +1296,215 @@ bool View_Window::set_current_image(IWICBitmapDecoder* bitmap_decoder)
     decoder = bitmap_decoder;
 
     IWICBitmapFrameDecode* bitmap_frame = nullptr;
-    hr = bitmap_decoder->GetFrame(0, &bitmap_frame);
+    hr = bitmap_decoder->GetFrame(frame, &bitmap_frame);
+    if (FAILED(hr)) {
+        LOG_HRESULT_ERROR(hr, L"Unable to get bitmap frame.\n");
+        return false;
+    }
+    defer(bitmap_frame->Release());
 
-    WICPixelFormatGUID pixel_format;
-    hr = bitmap_frame->GetPixelFormat(&pixel_format);
+    UINT width = 0;
+    UINT height = 0;
+    hr = bitmap_frame->GetSize(&width, &height);
     if (FAILED(hr)) {
-        LOG_HRESULT_ERROR(hr, L"Unable to get pixel format of bitmap frame.\n");
+        LOG_HRESULT_ERROR(hr, L"Unable to get size of bitmap frame.\n");
         return false;
     }
 
-    IWICFormatConverter* converter = nullptr;
-    IWICBitmapSource* actual_source = bitmap_frame;
-    if (pixel_format != GUID_WICPixelFormat32bppPBGRA)
-    {
-        hr = wic->CreateFormatConverter(&converter);
-        if (FAILED(hr)) {
-            LOG_HRESULT_ERROR(hr, L"Unable to create format converter.\n");
+    if (width == 0 || height == 0) {
+        LOG_ERROR(L"Bitmap frame size %ux%u is not supported.\n", width, height);
+        return false;
+    }
+
+    // Format is the one the file was decoded as, its extension may be another, see 'create_decoder_from_file_path'.
+    GUID container_format = {};
+    const bool is_jpeg = SUCCEEDED(bitmap_decoder->GetContainerFormat(&container_format)) &&
+        IsEqualGUID(container_format, GUID_ContainerFormatJpeg);
+
+    // Photos taken sideways are turned upright as they're decoded, the cache keeps them turned.
+    Orientation orientation = Orientation::Normal;
+    if (is_jpeg)
+        orientation = Image_Rotation::from_exif(Exif_Reader::read_orientation(path));
+    const UINT shown_width = Image_Rotation::swaps_size(orientation) ? height : width;
+    const UINT shown_height = Image_Rotation::swaps_size(orientation) ? width : height;
+
+    // Images larger than a Direct2D bitmap, or than memory governor allows with their mip levels, are
+    // decoded in tiles as they're drawn instead. They're not cached, tiles are kept while the image is viewed.
+    const UINT32 max_size = hwnd_target->GetMaximumBitmapSize();
+    const UINT64 decoded_size = static_cast<UINT64>(width) * height * sizeof(UINT32) * 4 / 3;
+    if (width > max_size || height > max_size || !g_memory_governor->request_image_memory(decoded_size)) {
+        const size_t tile_budget = g_memory_governor->get_tile_budget(tile_cache_budget);
+        if (!current_tiled_image.initialize(wic, bitmap_decoder, bitmap_frame, tile_budget, chroma_upsampling)) {
+            LOG_ERROR(L"Unable to open %ux%u bitmap frame in tiles.\n", width, height);
             return false;
         }
 
-        converter->Initialize(bitmap_frame, GUID_WICPixelFormat32bppPBGRA, WICBitmapDitherTypeNone, nullptr, 0.0f, WICBitmapPaletteTypeMedianCut);
-        actual_source = converter;
+        current_tiled_orientation = orientation;
+        load_embedded_preview(path, width, height, orientation);
+
+        current_image_size = D2D1::SizeF(static_cast<float>(shown_width), static_cast<float>(shown_height));
+        set_desired_client_size(static_cast<int>(shown_width), static_cast<int>(shown_height));
+        reset_view();
+        InvalidateRect(hwnd, nullptr, true);
+
+        return true;
+    }
+
+    // Window thread is busy decoding, preview is drawn right away instead of waiting for the next paint.
+    if (static_cast<UINT64>(width) * height >= embedded_preview_min_pixels)
+    {
+        load_embedded_preview(path, width, height, orientation);
+        if (preview_image_direct2d != nullptr)
+        {
+            current_image_size = D2D1::SizeF(static_cast<float>(shown_width), static_cast<float>(shown_height));
+            set_desired_client_size(static_cast<int>(shown_width), static_cast<int>(shown_height));
+            reset_view();
+            draw_window();
+        }
+    }
+
+    size_t working_set_before = 0;
+    size_t peak_before = 0;
+    Windows_Utility::get_working_set(&working_set_before, &peak_before);
+    const double decode_start = Windows_Utility::get_time_ms();
+
+    Mip_Pyramid image;
+    if (!decode_frame(bitmap_frame, path, is_jpeg, width, height, orientation, &image))
+        return false;
+
+    Mip_Pyramid* cached = g_image_cache->insert(path, date_modified, &image, frame);
+    if (cached == nullptr) {
+        image.release();
+        return false;
+    }
+
+    // Process peak only grows, it's reported as this image's peak when the image raised it.
+    const double decode_ms = Windows_Utility::get_time_ms() - decode_start;
+    size_t working_set = 0;
+    size_t peak = 0;
+    if (Windows_Utility::get_working_set(&working_set, &peak)) {
+        debug(L"Decoded %ux%u image in %.1f ms, %zu KB with mip levels. Working set %zu KB before, %zu KB after, peak %zu KB%s.\n",
+            width, height, decode_ms, cached->size_in_bytes() / 1024, working_set_before / 1024, working_set / 1024, peak / 1024,
+            peak > peak_before ? L" (raised by this image)" : L"");
+    }
+
+    show_current_image(cached);
+
+    return true;
+}
+
+bool View_Window::decode_frame(IWICBitmapFrameDecode* frame, const String& path, bool is_jpeg, UINT width, UINT height,
+    Orientation orientation, Mip_Pyramid* image)
+{
+    E_VERIFY_NULL_R(frame, false);
+    E_VERIFY_NULL_R(image, false);
+
+    // Pixels are converted to PBGRA by own kernels, formats without one go through WIC converter. Both
+    // convert a few rows at a time straight into 'pixels', nothing else image sized is allocated.
+    Image_Buffer pixels;
+    if (!pixels.allocate(static_cast<int>(width), static_cast<int>(height))) {
+        LOG_ERROR(L"Not enough memory to decode %ux%u bitmap frame.\n", width, height);
+        return false;
+    }
+    defer(pixels.release());
+
+    // Large JPEGs with restart markers are decoded in bands on all threads, anything else serially.
+    HRESULT hr = S_FALSE;
+    if (is_jpeg) {
+        hr = Jpeg_Restart_Decoder::decode(wic, path, pixels, chroma_upsampling);
+        if (FAILED(hr))
+            LOG_HRESULT_ERROR(hr, L"Unable to decode \"%s\" in bands, decoding it serially.\n", path.data);
     }
 
-    hr = hwnd_target->CreateBitmapFromWicBitmap(actual_source, &current_image_direct2d);
+    if (hr != S_OK) {
+        WICRect rect = { 0, 0, static_cast<INT>(width), static_cast<INT>(height) };
+        hr = Pixel_Conversion::copy_pixels(wic, frame, rect, pixels.pixels, pixels.stride, chroma_upsampling);
+    }
     if (FAILED(hr)) {
-        LOG_HRESULT_ERROR(hr, L"Unable to create Direct2D bitmap from WIC bitmap.\n");
+        LOG_HRESULT_ERROR(hr, L"Unable to copy pixels of bitmap frame.\n");
         return false;
     }
 
-    if (converter != nullptr)
-        converter->Release();
+    // Turning needs a second copy of the pixels for a moment, without memory for it image is shown as stored.
+    if (orientation != Orientation::Normal) {
+        Image_Buffer oriented;
+        if (Image_Rotation::transform(pixels, orientation, &oriented)) {
+            pixels.release();
+            pixels = oriented;
+        } else {
+            LOG_ERROR(L"Not enough memory to turn %ux%u bitmap frame.\n", width, height);
+            orientation = Orientation::Normal;
+        }
+    }
+
+    // Without mip levels image is still shown, it's just slower to scale.
+    if (!image->build(&pixels))
+        LOG_ERROR(L"Not enough memory for mip levels of %ux%u bitmap frame.\n", width, height);
+    image->orientation = orientation;
+
+    return true;
+}
+
+bool View_Window::set_current_image(Mip_Pyramid* image)
+{
+    E_VERIFY_NULL_R(image, false);
+    if (!release_current_image())
+        return false;
+
+    show_current_image(image);
+
+    return true;
+}
+
+bool View_Window::set_current_dds_image(const String& path)
+{
+    if (!release_current_image())
+        return false;
 
-    D2D1_SIZE_F image_size = current_image_direct2d->GetSize();
-    current_image_size = image_size;
+    HRESULT hr = current_dds.open(path);
+    if (FAILED(hr)) {
+        if (hr != WINCODEC_ERR_UNSUPPORTEDPIXELFORMAT)
+            LOG_HRESULT_ERROR(hr, L"Unable to open DDS texture \"%s\".\n", path.data);
+        return false;
+    }
 
-    set_desired_client_size((int)image_size.width, (int)image_size.height);
+    // Texture has its mip levels already and blocks decode faster than the image could be averaged
+    // down, so it's never decoded whole or cached. Tiles of the level it's drawn at are decoded, the
+    // coarsest one right away so there's something to draw before the others are.
+    const size_t tile_budget = g_memory_governor->get_tile_budget(tile_cache_budget);
+    if (!current_tiled_image.initialize(&current_dds, tile_budget)) {
+        LOG_ERROR(L"Unable to open %dx%d DDS texture in tiles.\n", current_dds.widths[0], current_dds.heights[0]);
+        current_dds.close();
+        return false;
+    }
+    current_tiled_image.get_tile(current_tiled_image.get_level_count() - 1, 0, 0);
 
+    const int width = current_dds.widths[0];
+    const int height = current_dds.heights[0];
+    current_image_size = D2D1::SizeF(static_cast<float>(width), static_cast<float>(height));
+    set_desired_client_size(width, height);
+    reset_view();
     InvalidateRect(hwnd, nullptr, true);
-    bitmap_frame->Release();
 
     return true;
 }
 
+void View_Window::show_current_image(Mip_Pyramid* image)
+{
+    E_VERIFY(!image->is_empty());
+    current_image_levels = image;
+    safe_release(preview_image_direct2d);
+
+    // Direct2D bitmaps are created when drawing, at full or display size.
+    const Image_Buffer& base = image->base();
+    current_image_size = D2D1::SizeF(static_cast<float>(base.width), static_cast<float>(base.height));
+
+    set_desired_client_size(base.width, base.height);
+    reset_view();
+
+    InvalidateRect(hwnd, nullptr, true);
+}
+
 bool View_Window::get_client_area(int* width, int* height)
 {
     E_VERIFY_NULL_R(width, false);
@@ -591,337 +1522,1907 @@ bool View_Window::get_client_area(int* width, int* height)
 
 bool View_Window::release_current_image()
 {
+    stop_animation();
+    cancel_scale_job();
     safe_release(current_image_direct2d);
+    safe_release(scaled_image_direct2d);
+    safe_release(preview_image_direct2d);
     safe_release(decoder);
+    current_image_levels = nullptr;
+    current_tiled_image.release();
+    current_tiled_orientation = Orientation::Normal;
+    current_dds.close();
 
     return true;
 }
 
-bool View_Window::handle_open_file_action()
+void View_Window::start_animation(const String& path)
 {
-    HRESULT hr = 0;
-    IFileOpenDialog* dialog = nullptr;
-    IShellItemArray* items = nullptr;
-    IShellItem* item = nullptr;
-    defer (
-        safe_release(item);
-        safe_release(items);
-        safe_release(dialog);
-    );
+    // Tiled images are not animated, their decoder is used by tiles.
+    if (Image_Format_Registry::from_file_name(path.data) != Image_Format::Gif || !current_tiled_image.is_empty())
+        return;
 
-    // Create open file dialog
-    hr = CoCreateInstance(CLSID_FileOpenDialog, nullptr, CLSCTX_INPROC_SERVER, IID_PPV_ARGS(&dialog));
-    if (dialog == nullptr)
-        return false;
+    // Image that came from the cache needs a decoder for the other frames.
+    if (decoder == nullptr)
+    {
+        HRESULT hr = create_decoder_from_file_path(wic, path, &decoder);
+        if (FAILED(hr))
+        {
+            LOG_HRESULT_ERROR(hr, L"Unable to open \"%s\".\n", path.data);
+            return;
+        }
+    }
+
+    if (!animation.open(wic, decoder))
+        return;
+
+    // Frames are placed on the canvas of the GIF, the first frame may be smaller.
+    const D2D1_SIZE_F canvas_size = D2D1::SizeF(static_cast<float>(animation.get_width()), static_cast<float>(animation.get_height()));
+    if (canvas_size.width != current_image_size.width || canvas_size.height != current_image_size.height)
+    {
+        current_image_size = canvas_size;
+        reset_view();
+    }
+
+    animation.start();
+    animation_due_ms = Windows_Utility::get_time_ms();
+    SetTimer(hwnd, animation_timer_id, animation_poll_ms, nullptr);
+}
+
+void View_Window::stop_animation()
+{
+    KillTimer(hwnd, animation_timer_id);
+    animation.close();
+    safe_release(animation_direct2d);
+}
+
+void View_Window::present_animation_frame()
+{
+    KillTimer(hwnd, animation_timer_id);
+
+    // Animation is paused under the grid, it's started again when the grid is left.
+    if (!animation.is_open() || is_grid_mode)
+        return;
+
+    // Frame that is composed late is presented late rather than skipped, frames are composed in order.
+    const Animation::Composed_Frame* frame = animation.peek();
+    if (frame == nullptr)
+    {
+        if (!animation.has_failed())
+            SetTimer(hwnd, animation_timer_id, animation_poll_ms, nullptr);
+        return;
+    }
+
+    // Frames follow each other, only what changed since the presented one is copied to the bitmap.
+    const Image_Buffer& pixels = frame->pixels;
+    const RECT& dirty = frame->dirty;
+    HRESULT hr = S_OK;
+    if (animation_direct2d == nullptr)
+    {
+        hr = hwnd_target->CreateBitmap(D2D1::SizeU(pixels.width, pixels.height), pixels.pixels, pixels.stride,
+            pbgra_bitmap_properties(), &animation_direct2d);
+    }
+    else if (dirty.right > dirty.left && dirty.bottom > dirty.top)
+    {
+        const D2D1_RECT_U rect = D2D1::RectU(dirty.left, dirty.top, dirty.right, dirty.bottom);
+        hr = animation_direct2d->CopyFromMemory(&rect, pixels.pixels + static_cast<size_t>(dirty.top) * pixels.stride + dirty.left * sizeof(UINT32),
+            pixels.stride);
+    }
+
+    const UINT delay_ms = frame->delay_ms;
+    animation.pop();
+
+    if (FAILED(hr))
+    {
+        // Bitmap is created again from the next frame.
+        LOG_HRESULT_ERROR(hr, L"Unable to present animation frame.\n");
+        safe_release(animation_direct2d);
+    }
+
+    InvalidateRect(hwnd, nullptr, FALSE);
+
+    // Clock starts again when it's more than a frame behind, e.g. after the window was busy.
+    const double now = Windows_Utility::get_time_ms();
+    animation_due_ms += delay_ms;
+    if (animation_due_ms < now - delay_ms)
+        animation_due_ms = now;
+
+    SetTimer(hwnd, animation_timer_id, static_cast<UINT>(max(animation_due_ms - now, 0.0)), nullptr);
+}
+
+void View_Window::load_embedded_preview(const String& path, UINT width, UINT height, Orientation orientation)
+{
+    safe_release(preview_image_direct2d);
+    if (Image_Format_Registry::from_file_name(path) != Image_Format::Jpeg)
+        return;
+
+    HANDLE file = CreateFileW(path.data, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return;
+    defer(CloseHandle(file));
+
+    Exif_Info info;
+    if (Exif_Reader::read(file, &info) != S_OK)
+        return;
+
+    // Larger preview is tried first, small EXIF thumbnail is still better than an empty window.
+    const Embedded_Image images[] = { Embedded_Image::Preview, Embedded_Image::Thumbnail };
+    for (int i = 0; i < ARRAYSIZE(images); ++i)
+    {
+        IWICBitmapFrameDecode* frame = nullptr;
+        UINT preview_width = 0;
+        UINT preview_height = 0;
+        if (Exif_Reader::open_embedded_frame(wic, file, info, images[i], width, height, &frame, &preview_width, &preview_height) != S_OK)
+            continue;
+        defer(safe_release(frame));
+
+        if (preview_width > width)
+            continue;
+
+        Image_Buffer pixels;
+        if (!pixels.allocate(static_cast<int>(preview_width), static_cast<int>(preview_height)))
+            return;
+        defer(pixels.release());
+
+        WICRect rect = { 0, 0, static_cast<INT>(preview_width), static_cast<INT>(preview_height) };
+        if (FAILED(Pixel_Conversion::copy_pixels(wic, frame, rect, pixels.pixels, pixels.stride, chroma_upsampling)))
+            continue;
+
+        if (orientation != Orientation::Normal) {
+            Image_Buffer oriented;
+            if (!Image_Rotation::transform(pixels, orientation, &oriented))
+                return;
+            pixels.release();
+            pixels = oriented;
+        }
+
+        HRESULT hr = hwnd_target->CreateBitmap(D2D1::SizeU(pixels.width, pixels.height), pixels.pixels, pixels.stride,
+            pbgra_bitmap_properties(), &preview_image_direct2d);
+        if (FAILED(hr))
+            LOG_HRESULT_ERROR(hr, L"Unable to create Direct2D bitmap of embedded preview.\n");
+
+        return;
+    }
+}
+
+void View_Window::rotate_current_image(Orientation turn)
+{
+    // Tiles and DDS textures are decoded from the file as it's stored, animations frame by frame.
+    File_Info* file = get_current_file_info();
+    if (file == nullptr || current_image_levels == nullptr || !current_tiled_image.is_empty() || animation.is_open())
+        return;
+
+    Temporary_Allocator_Guard g;
+    String full_path = get_file_info_absolute_path(current_folder, file, g_temporary_allocator);
+    if (String::is_null(full_path))
+        return;
+
+    // Turned image replaces the cached one, which the scale job must not be reading anymore.
+    cancel_scale_job();
+    safe_release(current_image_direct2d);
+    safe_release(scaled_image_direct2d);
+
+    const Image_Buffer& base = current_image_levels->base();
+    Image_Buffer pixels;
+    if (!Image_Rotation::transform(base, turn, &pixels)) {
+        LOG_ERROR(L"Not enough memory to turn %dx%d image.\n", base.width, base.height);
+        InvalidateRect(hwnd, nullptr, true);
+        return;
+    }
+
+    Mip_Pyramid image;
+    if (!image.build(&pixels))
+        LOG_ERROR(L"Not enough memory for mip levels of %dx%d image.\n", image.base().width, image.base().height);
+    image.orientation = Image_Rotation::combine(current_image_levels->orientation, turn);
+
+    // Old image is evicted by the insert, 'current_image_levels' points to it until then.
+    current_image_levels = g_image_cache->insert(full_path, file->date_modified, &image, current_frame);
+    if (current_image_levels == nullptr) {
+        image.release();
+        InvalidateRect(hwnd, nullptr, true);
+        return;
+    }
+
+    show_current_image(current_image_levels);
+}
+
+static void run_rotation_job(void* context, int)
+{
+    Rotation_Job* job = (Rotation_Job*)context;
+
+    job->hr = Jpeg_Transform::transform_file(job->path, job->orientation, job->trim);
+    PostMessageW(job->hwnd, (UINT)View_Window_Message::Rotation_Job_Finished, 0, 0);
+}
+
+void View_Window::save_rotation()
+{
+    // One file is saved at a time.
+    File_Info* file = get_current_file_info();
+    if (file == nullptr || current_image_levels == nullptr || rotation_job.is_running)
+        return;
+
+    String full_path = get_file_info_absolute_path(current_folder, file, g_standard_allocator);
+    if (String::is_null(full_path))
+        return;
+
+    // Nothing to save when pixels are shown as they're stored and EXIF doesn't turn them either.
+    const Orientation orientation = current_image_levels->orientation;
+    if (Image_Format_Registry::from_file_name(full_path) != Image_Format::Jpeg ||
+        (orientation == Orientation::Normal && Exif_Reader::read_orientation(full_path) == 1))
+    {
+        g_standard_allocator->deallocate(full_path.data);
+        return;
+    }
+
+    // Decoder keeps the file open, it couldn't be replaced.
+    cancel_page_job();
+    if (!release_current_image())
+    {
+        g_standard_allocator->deallocate(full_path.data);
+        return;
+    }
+    InvalidateRect(hwnd, nullptr, true);
+
+    rotation_job.hwnd = hwnd;
+    rotation_job.path = full_path;
+    rotation_job.orientation = orientation;
+    rotation_job.trim = false;
+    rotation_job.hr = S_OK;
+    rotation_job.is_running = true;
+
+    if (!g_job_pool->submit(run_rotation_job, &rotation_job, 0, &rotation_job.group))
+        run_rotation_job(&rotation_job, 0);
+}
+
+void View_Window::finish_rotation_job()
+{
+    if (!rotation_job.is_running)
+        return; // Cancelled, message is from a job that's already handled.
+
+    // Message is posted just before the job returns.
+    g_job_pool->wait(&rotation_job.group);
+    rotation_job.is_running = false;
+
+    // Mirroring moves blocks to the other side of the image, partial ones at its right or bottom edge can't
+    // be moved without loss. They're dropped only if the user agrees, otherwise the file is left as it is.
+    const HRESULT hr = rotation_job.hr;
+    if (hr == WINCODEC_ERR_IMAGESIZEOUTOFRANGE && !rotation_job.trim)
+    {
+        int result = IDNO;
+        HRESULT dialog_hr = TaskDialog(hwnd, 0, L"Save rotation", L"Edges of the image would be cut off",
+            L"Its width or height is not a multiple of the 8 or 16 pixel blocks it's stored in. Up to 15 columns or "
+            L"rows at the edge can't be turned without loss and would be dropped from the file. Save rotation anyway?",
+            TDCBF_YES_BUTTON | TDCBF_NO_BUTTON, TD_WARNING_ICON, &result);
+        if (SUCCEEDED(dialog_hr) && result == IDYES)
+        {
+            rotation_job.trim = true;
+            rotation_job.hr = S_OK;
+            rotation_job.is_running = true;
+
+            if (!g_job_pool->submit(run_rotation_job, &rotation_job, 0, &rotation_job.group))
+                run_rotation_job(&rotation_job, 0);
+            return;
+        }
+    }
+
+    const String path = rotation_job.path;
+    rotation_job.path = String();
+    defer(g_standard_allocator->deallocate(path.data));
+
+    if (hr == WINCODEC_ERR_UNSUPPORTEDOPERATION) {
+        error_box(L"Only baseline JPEGs can be rotated without loss, the file is not changed.");
+    } else if (FAILED(hr) && hr != WINCODEC_ERR_IMAGESIZEOUTOFRANGE) {
+        LOG_HRESULT_ERROR(hr, L"Unable to save rotation of \"%s\".\n", path.data);
+        error_box(hr);
+    }
+
+    // Folder may have changed while it was saved, its files are listed with their new dates then.
+    const int folder_length = current_folder.count;
+    if (path.count <= folder_length + 1 || path.data[folder_length] != L'/' ||
+        !String::equals_ignore_case(String(path.data, folder_length), current_folder))
+        return;
+
+    const int index = find_file_info_by_path(String(path.data + folder_length + 1, path.count - folder_length - 1));
+    if (index < 0)
+        return;
+
+    // Saved file is another cache entry with its new modification date, it's decoded again if it's viewed.
+    File_Info* file = &current_files.data[index];
+    WIN32_FILE_ATTRIBUTE_DATA attributes;
+    if (SUCCEEDED(hr) && GetFileAttributesExW(path.data, GetFileExInfoStandard, &attributes)) {
+        file->date_modified = attributes.ftLastWriteTime;
+        file->file_size = (static_cast<unsigned __int64>(attributes.nFileSizeHigh) << 32) | attributes.nFileSizeLow;
+    }
+
+    if (index == current_file_index)
+        view_file_index(current_file_index);
+}
+
+void View_Window::cancel_rotation_job()
+{
+    if (!rotation_job.is_running)
+        return;
+
+    g_job_pool->wait(&rotation_job.group);
+    rotation_job.is_running = false;
+    g_standard_allocator->deallocate(rotation_job.path.data);
+    rotation_job.path = String();
+}
+
+bool View_Window::handle_open_file_action()
+{
+    HRESULT hr = 0;
+    IFileOpenDialog* dialog = nullptr;
+    IShellItemArray* items = nullptr;
+    IShellItem* item = nullptr;
+    defer (
+        safe_release(item);
+        safe_release(items);
+        safe_release(dialog);
+    );
+
+    // Create open file dialog
+    hr = CoCreateInstance(CLSID_FileOpenDialog, nullptr, CLSCTX_INPROC_SERVER, IID_PPV_ARGS(&dialog));
+    if (dialog == nullptr)
+        return false;
+
+    hr = dialog->SetOptions(FOS_ALLOWMULTISELECT | FOS_PATHMUSTEXIST | FOS_FILEMUSTEXIST);
+    hr = dialog->Show(hwnd);
+    hr = dialog->GetResults(&items);
+
+    if (items == nullptr)
+        return false;
+
+    hr = items->GetItemAt(0, &item);
+    if (item == nullptr)
+        return false;
+
+    wchar_t* path = nullptr;
+    hr = item->GetDisplayName(SIGDN_FILESYSPATH, &path);
+
+    load_path(String::reference_to_const_wchar_t(path));
+    CoTaskMemFree(path);
+
+    return true;
+}
+
+void View_Window::handle_show_image_info_action()
+{
+    show_image_info = !show_image_info;
+
+    MENUITEMINFOW info = { 0 };
+    info.cbSize = sizeof(info);
+    info.fMask = MIIM_STATE;
+    info.fState = show_image_info ? MFS_CHECKED : MFS_UNCHECKED;
+    
+    BOOL result = SetMenuItemInfoW(view_menu, (UINT)View_Menu_Item::Show_Image_Info, false, &info);
+
+    if (!result)
+        LOG_LAST_WIN32_ERROR(L"Cannot change 'Show image info' menu item state to %d", (int)show_image_info);
+
+    InvalidateRect(hwnd, nullptr, false);
+}
+
+void View_Window::handle_change_display_mode_action()
+{
+    HRESULT hr;
+
+    switch (display_mode)
+    {
+        case Display_Mode::Windowed:
+        {
+            hr = set_display_mode(Display_Mode::Fullscreen);
+            if (SUCCEEDED(hr))
+            {
+                BOOL result = ModifyMenuW(
+                    view_menu,
+                    (UINT_PTR)View_Menu_Item::Change_Display_Mode,
+                    MF_BYCOMMAND | MF_STRING,
+                    (UINT_PTR)View_Menu_Item::Change_Display_Mode,
+                    L"Exit fullscreen");
+
+                if (!result)
+                    LOG_LAST_WIN32_ERROR(L"Unable to modify view menu");
+            }
+            break;
+        }
+
+        case Display_Mode::Fullscreen:
+        {
+            hr = set_display_mode(Display_Mode::Windowed);
+            if (SUCCEEDED(hr))
+            {
+                BOOL result = ModifyMenuW(
+                    view_menu,
+                    (UINT_PTR)View_Menu_Item::Change_Display_Mode,
+                    MF_BYCOMMAND | MF_STRING,
+                    (UINT_PTR)View_Menu_Item::Change_Display_Mode,
+                    L"Enter fullscreen");
+
+                if (!result)
+                    LOG_LAST_WIN32_ERROR(L"Unable to modify view menu");
+
+                File_Info* current = get_current_file_info();
+
+                if (current != nullptr)
+                {
+                    D2D1_SIZE_F image_size = current_image_size;
+                    set_desired_client_size(
+                        static_cast<int>(image_size.width),
+                        static_cast<int>(image_size.height)
+                    );
+                }
+            }
+            break;
+        }
+
+        default:
+        {
+            LOG_ERROR(L"Unknown display mode %d", static_cast<int>(display_mode));
+            return;
+        }
+    }
+
+    if (FAILED(hr))
+        LOG_HRESULT_ERROR(hr, L"Unable to change display mode to %d", static_cast<int>(display_mode));
+}
+
+void View_Window::handle_copy_filename_to_clipboard_menu_item()
+{
+    File_Info* current = get_current_file_info();
+    if (current == nullptr)
+    {
+        MessageBoxW(hwnd, L"No image is loaded.", L"Error", MB_OK | MB_ICONINFORMATION);
+        return;
+    }
+
+    const String& filename = current->path;
+    if (String::is_null_or_empty(filename))
+    {
+        MessageBoxW(hwnd, L"Filename is invalid.", L"Error", MB_OK | MB_ICONERROR);
+        return;
+    }
+
+    BOOL result;
+    result = OpenClipboard(hwnd);
+    if (!result)
+    {
+        LOG_LAST_WIN32_ERROR(L"Cannot open clipboard");
+        MessageBoxW(hwnd, L"Cannot open clipboard", L"Error", MB_OK | MB_ICONERROR);
+        return;
+    }
+    EmptyClipboard();
+    
+    defer (CloseClipboard());
+
+    HGLOBAL clip_store = GlobalAlloc(GMEM_MOVEABLE, sizeof(wchar_t) * (filename.count + 1));
+    if (clip_store == nullptr)
+    {
+        LOG_LAST_WIN32_ERROR(L"Cannot allocate enough memory to save a string");
+        return;
+    }
+
+    wchar_t* clip_data = (wchar_t*)GlobalLock(clip_store);
+    if (clip_data == nullptr)
+    {
+        LOG_LAST_WIN32_ERROR(L"Unable to lock global memory");
+        return;
+    }
+    defer (GlobalUnlock(clip_store));
+    
+    wmemcpy(clip_data, filename.data, filename.count);
+    clip_data[filename.count] = L'\0';
+
+    result = GlobalUnlock(clip_store);
+    DWORD last_error = GetLastError();
+    if (last_error != NO_ERROR)
+    {
+        LOG_WIN32_ERROR(last_error, L"Unable to unlock global memory");
+        return;
+    }
+
+    if (0 == SetClipboardData(CF_UNICODETEXT, clip_store))
+    {
+        LOG_LAST_WIN32_ERROR(L"Unable to set clipboard data");
+        return;
+    }
+}
+
+int View_Window::find_file_info_by_path(const String& path)
+{
+    if (String::is_null_or_empty(path))
+        return -1;
+
+    for (int i = 0; i < current_files.count; ++i)
+    {
+        const File_Info& file_info = current_files.data[i];
+
+        // File system is case insensitive, path from command line may differ in case.
+        if (String::equals_ignore_case(path, file_info.path))
+            return i;
+    }
+
+    return -1;
+}
+
+void View_Window::handle_filter_action(int menu_item)
+{
+    // Value is taken from the file selected in the grid, or the viewed one.
+    const int index = is_grid_mode ? get_grid_selected_file() : current_file_index;
+    if (!current_files.is_valid_index(index))
+        return;
+
+    bool checked = false;
+    switch ((View_Menu_Item)menu_item)
+    {
+        case View_Menu_Item::Filter_Same_Day:
+        {
+            if (metadata_filter.taken_to == 0)
+            {
+                // Date taken is camera's local time, so days are split at its midnight.
+                const UINT64 date_taken = metadata_index.get_date_taken(index);
+                if (date_taken == 0)
+                    return;
+
+                metadata_filter.taken_from = date_taken - date_taken % ticks_per_day;
+                metadata_filter.taken_to = metadata_filter.taken_from + ticks_per_day;
+                checked = true;
+            }
+            else
+            {
+                metadata_filter.taken_from = 0;
+                metadata_filter.taken_to = 0;
+            }
+            break;
+        }
+        case View_Menu_Item::Filter_Same_Camera:
+        {
+            if (metadata_filter.camera == 0)
+            {
+                metadata_filter.camera = metadata_index.get_camera(index);
+                if (metadata_filter.camera == 0)
+                    return;
+
+                checked = true;
+            }
+            else
+            {
+                metadata_filter.camera = 0;
+            }
+            break;
+        }
+        case View_Menu_Item::Filter_With_Location:
+        {
+            metadata_filter.requires_location = !metadata_filter.requires_location;
+            checked = metadata_filter.requires_location;
+            break;
+        }
+        default:
+        {
+            return;
+        }
+    }
+
+    set_menu_item_checked(view_menu, (View_Menu_Item)menu_item, checked);
+    update_shown_files(index);
+
+    // Viewed file that's filtered out is replaced by the shown one after it.
+    if (!is_grid_mode && find_shown_position(current_file_index) < 0 && !shown_files.is_empty())
+    {
+        const int position = lower_bound(shown_files.data, shown_files.count, current_file_index);
+        view_file_index(shown_files.data[position < shown_files.count ? position : 0]);
+    }
+
+    update_view_title();
+    InvalidateRect(hwnd, nullptr, FALSE);
+}
+
+void View_Window::update_shown_files(int selected_index)
+{
+    // Only files whose names match are looked at while there's a name filter.
+    const bool has_name_filter = name_filter_length > 0;
+    const int count = has_name_filter ? name_matches.get_count() : current_files.count;
+    const int* matches = name_matches.get_data();
+
+    shown_files.count = 0;
+    for (int i = 0; i < count; ++i)
+    {
+        const int index = has_name_filter ? matches[i] : i;
+        if (metadata_index.matches(index, metadata_filter) && !shown_files.push_back(index))
+        {
+            LOG_ERROR(L"Unable to filter %d files.\n", current_files.count);
+            break;
+        }
+    }
+
+    grid_selected_index = min(lower_bound(shown_files.data, shown_files.count, selected_index), max(shown_files.count - 1, 0));
+    if (is_grid_mode)
+        select_grid_file(grid_selected_index);
+}
+
+int View_Window::find_shown_position(int index) const
+{
+    const int position = lower_bound(shown_files.data, shown_files.count, index);
+    return position < shown_files.count && shown_files.data[position] == index ? position : -1;
+}
+
+void View_Window::start_name_filter()
+{
+    // Matching files are shown in the grid as the filter is typed.
+    set_grid_mode(true);
+    if (!is_grid_mode)
+        return;
+
+    is_typing_name_filter = true;
+    InvalidateRect(hwnd, nullptr, FALSE);
+}
+
+void View_Window::handle_name_filter_char(wchar_t c)
+{
+    switch (c)
+    {
+        case L'\b':
+        {
+            if (name_filter_length == 0)
+                return;
+
+            // Matches of the shorter filter are kept.
+            --name_filter_length;
+            update_name_matches();
+            break;
+        }
+        case L'\x1b':
+        {
+            is_typing_name_filter = false;
+            name_filter_length = 0;
+            break;
+        }
+        case L'\r':
+        {
+            is_typing_name_filter = false;
+            open_grid_selection();
+            break;
+        }
+        default:
+        {
+            // Control characters, e.g. from Ctrl with a letter, are not typed.
+            if (c < L' ' || name_filter_length == Name_Index::max_query_length)
+                return;
+
+            // Matches of the shorter filter are narrowed, the new one is a part of the same names.
+            name_filter[name_filter_length++] = c;
+            update_name_matches();
+            break;
+        }
+    }
+
+    const int selected_index = get_grid_selected_file();
+    update_shown_files(max(selected_index, 0));
+    update_view_title();
+    InvalidateRect(hwnd, nullptr, FALSE);
+}
+
+void View_Window::update_name_matches()
+{
+    if (name_filter_length == 0)
+        return;
+
+    const String query(name_filter, name_filter_length);
+    if (!name_matches.find(name_index, current_files, query))
+        LOG_ERROR(L"Unable to filter %d files by name.\n", current_files.count);
+}
+
+void View_Window::finish_name_indexing()
+{
+    // Matches are the same, only the next ones are found faster.
+    name_index.finish();
+}
+
+void View_Window::start_metadata_extraction()
+{
+    metadata_index.start(hwnd, (UINT)View_Window_Message::Metadata_Read, current_folder, current_files, max(current_file_index, 0));
+}
+
+void View_Window::finish_metadata_extraction()
+{
+    if (!metadata_index.finish())
+        return;
+
+    // Files without metadata were sorted by date modified until now. Filters show files that were just read.
+    if (sort_mode == Sort_Mode::Date_Taken)
+    {
+        HRESULT hr = sort_current_images(sort_mode, sort_order);
+        if (FAILED(hr))
+            LOG_HRESULT_ERROR(hr, L"Unable to sort files by date taken.\n");
+    }
+    else if (!metadata_filter.is_empty())
+    {
+        const int selected_index = get_grid_selected_file();
+        update_shown_files(selected_index >= 0 ? selected_index : max(current_file_index, 0));
+    }
+
+    update_view_title();
+    InvalidateRect(hwnd, nullptr, FALSE);
+}
+
+HRESULT View_Window::set_scaling_mode(Scaling_Mode mode, float scaling)
+{
+    if (mode == Scaling_Mode::No_Scaling)
+    {
+        this->scaling_mode = mode;
+        this->scaling = 1.0f;
+
+        InvalidateRect(hwnd, nullptr, false);
+
+        return S_OK;
+    }
+
+    if (mode == Scaling_Mode::Percentage)
+    {
+        E_VERIFY_R(scaling > 0.0f, E_INVALIDARG);
+
+        this->scaling_mode = mode;
+        this->scaling = scaling;
+
+        InvalidateRect(hwnd, nullptr, false);
+
+        return S_OK;
+    }
+
+    if (mode == Scaling_Mode::Fit_To_Window)
+    {
+        this->scaling_mode = mode;
+        this->scaling = 1.0f;
+
+        InvalidateRect(hwnd, nullptr, false);
+
+        return S_OK;
+    }
+
+    // Unknown mode.
+    E_VERIFY_R(false, E_UNEXPECTED);
+}
+
+HRESULT View_Window::set_display_mode(Display_Mode mode)
+{
+    if (this->display_mode == mode)
+        return S_OK;
+
+    if (mode == Display_Mode::Fullscreen)
+    {
+        SetWindowLongPtrW(hwnd, GWL_STYLE, static_cast<LONG>(fullscreen_display_mode_flags));
+        SetWindowPos(hwnd, nullptr, 0, 0, desktop_width, desktop_height, SWP_FRAMECHANGED);
+        ShowWindow(hwnd, SW_SHOW);
+    
+        this->display_mode = mode;
+    
+        return S_OK;
+    }
+    else if (mode == Display_Mode::Windowed)
+    {
+        SetWindowLongPtrW(hwnd, GWL_STYLE, static_cast<LONG>(windowed_display_mode_flags));
+
+        // @TODO: use 'set_desired_size'
+        SetWindowPos(hwnd, nullptr, 0, 0, desktop_work_width, desktop_work_height, SWP_FRAMECHANGED);
+        ShowWindow(hwnd, SW_SHOW);
+
+        this->display_mode = mode;
+
+        return S_OK;
+    }
+
+    LOG_ERROR(L"Unknown display mode %d", static_cast<int>(mode));
+    return E_INVALIDARG;
+}
+
+D2D1_RECT_F View_Window::get_current_image_rect(int client_width, int client_height)
+{
+    D2D1_SIZE_F image_size = current_image_size;
+
+    if (scaling_mode == Scaling_Mode::Fit_To_Window)
+    {
+        fit_to_window:
+        if (image_size.width > client_width)
+        {
+            float aspect = client_width / image_size.width;
+
+            image_size.width  *= aspect;
+            image_size.height *= aspect;
+        }
+
+        if (image_size.height > client_height)
+        {
+            float aspect = client_height / image_size.height;
+
+            image_size.width  *= aspect;
+            image_size.height *= aspect;
+        }
+    }
+    else if (scaling_mode == Scaling_Mode::Percentage)
+    {
+        image_size.width *= scaling;
+        image_size.height *= scaling;
+    }
+    else if (scaling_mode == Scaling_Mode::No_Scaling)
+    {
+        // Don't do anything.
+    }
+    else
+    {
+        LOG_ERROR(L"Unknown scaling mode %d.", scaling_mode);
+        set_scaling_mode(Scaling_Mode::Fit_To_Window, 1.0f);
+        goto fit_to_window;
+    }
+
+    float img_hw = (int)image_size.width  / 2.0f;
+    float img_hh = (int)image_size.height / 2.0f;
+    float cli_hw = client_width  / 2.0f;
+    float cli_hh = client_height / 2.0f;
+
+    // Image can be moved only while it's larger than the client area, and only until its edge is reached.
+    // Offset is clamped here, so it follows changes of window size and scaling.
+    float max_offset_x = max(img_hw - cli_hw, 0.0f);
+    float max_offset_y = max(img_hh - cli_hh, 0.0f);
+    view_offset.x = min(max(view_offset.x, -max_offset_x), max_offset_x);
+    view_offset.y = min(max(view_offset.y, -max_offset_y), max_offset_y);
+
+    // Whole pixel offset keeps scaled image aligned to pixels, so it stays sharp.
+    float offset_x = floorf(view_offset.x + 0.5f);
+    float offset_y = floorf(view_offset.y + 0.5f);
+
+    return D2D1::RectF(
+        ceilf(cli_hw - img_hw) + offset_x,
+        ceilf(cli_hh - img_hh) + offset_y,
+        ceilf(cli_hw + img_hw) + offset_x,
+        ceilf(cli_hh + img_hh) + offset_y
+    );
+}
+
+void View_Window::reset_view()
+{
+    view_offset = D2D1::Point2F(0.0f, 0.0f);
+    pan_direction_x = 0;
+    pan_direction_y = 0;
+    set_scaling_mode(settings_scaling_mode, settings_scaling);
+}
+
+void View_Window::zoom_at(float zoom, int x, int y)
+{
+    if (current_image_levels == nullptr && current_tiled_image.is_empty())
+        return;
+
+    int client_width, client_height;
+    if (!get_client_area(&client_width, &client_height))
+        return;
+
+    D2D1_RECT_F rect = get_current_image_rect(client_width, client_height);
+    float current_zoom = (rect.right - rect.left) / current_image_size.width;
+    if (current_zoom <= 0.0f)
+        return;
+
+    zoom = min(max(zoom, min_zoom), max_zoom);
+
+    // Image point under the cursor stays under it.
+    float image_x = (x - rect.left) / current_zoom;
+    float image_y = (y - rect.top) / current_zoom;
+    view_offset.x = x - image_x * zoom + current_image_size.width * zoom / 2.0f - client_width / 2.0f;
+    view_offset.y = y - image_y * zoom + current_image_size.height * zoom / 2.0f - client_height / 2.0f;
+
+    set_scaling_mode(Scaling_Mode::Percentage, zoom);
+}
+
+void View_Window::pan_by(int dx, int dy)
+{
+    if (dx == 0 && dy == 0)
+        return;
+
+    view_offset.x += dx;
+    view_offset.y += dy;
+    if (dx != 0)
+        pan_direction_x = dx < 0 ? -1 : 1;
+    if (dy != 0)
+        pan_direction_y = dy < 0 ? -1 : 1;
+
+    // Only cached bitmaps are drawn while panning, tiles that come into view are decoded between paints.
+    InvalidateRect(hwnd, nullptr, FALSE);
+}
+
+HRESULT View_Window::draw_current_image()
+{
+    int client_width, client_height;
+    get_client_area(&client_width, &client_height);
+
+    D2D1_RECT_F dest_rect = get_current_image_rect(client_width, client_height);
+
+    // Embedded preview stands in for the image until it's decoded, and for its tiles that aren't.
+    if (preview_image_direct2d != nullptr)
+        hwnd_target->DrawBitmap(preview_image_direct2d, dest_rect);
+
+    if (!current_tiled_image.is_empty())
+    {
+        HRESULT hr = draw_tiled_image(dest_rect, client_width, client_height);
+
+        if (show_image_info)
+            draw_current_image_info();
+
+        return hr;
+    }
+
+    // Composed frames of an animation change too often to be resampled, Direct2D scales them.
+    if (animation_direct2d != nullptr)
+    {
+        hwnd_target->DrawBitmap(animation_direct2d, dest_rect);
+
+        if (show_image_info)
+            draw_current_image_info();
+
+        return S_OK;
+    }
+
+    if (current_image_levels == nullptr)
+        return S_OK;
+
+    // Scaled image is resampled once per display size in a job and drawn 1:1, instead of being
+    // filtered by Direct2D on every paint. Until it's ready, previous one or the full size bitmap
+    // is stretched, so painting never waits for resampling. Image zoomed in far beyond the
+    // window would need a huge scaled copy, it's stretched from the full size bitmap instead.
+    ID2D1Bitmap* bitmap = nullptr;
+    UINT dest_width = static_cast<UINT>(dest_rect.right - dest_rect.left);
+    UINT dest_height = static_cast<UINT>(dest_rect.bottom - dest_rect.top);
+    UINT64 dest_area = static_cast<UINT64>(dest_width) * dest_height;
+    UINT64 max_scaled_area = max(static_cast<UINT64>(current_image_size.width * current_image_size.height),
+        static_cast<UINT64>(client_width) * client_height);
+    if (resample_filter != Resample_Filter::None && dest_area <= max_scaled_area &&
+        (dest_width != (UINT)current_image_size.width || dest_height != (UINT)current_image_size.height))
+    {
+        request_scaled_image(dest_width, dest_height);
+
+        if (scaled_image_direct2d != nullptr)
+        {
+            bitmap = scaled_image_direct2d;
+            // Full size bitmap is not needed while image is scaled.
+            safe_release(current_image_direct2d);
+        }
+    }
+
+    if (bitmap == nullptr)
+    {
+        HRESULT hr = create_current_image_bitmap();
+        if (FAILED(hr))
+            return hr;
+
+        bitmap = current_image_direct2d;
+        safe_release(scaled_image_direct2d);
+    }
+
+    hwnd_target->DrawBitmap(bitmap, dest_rect);
+    
+    if (show_image_info)
+        draw_current_image_info();
+
+    return S_OK;
+}
+
+HRESULT View_Window::create_current_image_bitmap()
+{
+    if (current_image_direct2d != nullptr)
+        return S_OK;
+
+    E_VERIFY_NULL_R(current_image_levels, E_UNEXPECTED);
+
+    const Image_Buffer& pixels = current_image_levels->base();
+    HRESULT hr = hwnd_target->CreateBitmap(D2D1::SizeU(pixels.width, pixels.height), pixels.pixels, pixels.stride,
+        pbgra_bitmap_properties(), &current_image_direct2d);
+    if (FAILED(hr))
+        LOG_HRESULT_ERROR(hr, L"Unable to create Direct2D bitmap.\n");
+
+    return hr;
+}
+
+void View_Window::request_scaled_image(UINT width, UINT height)
+{
+    // Image was just shown or its scaled bitmap released, full size bitmap is stretched until the
+    // job is done. Job that is already running starts the next one itself if size doesn't match.
+    if (scaled_image_direct2d == nullptr)
+    {
+        requested_scale_width = width;
+        requested_scale_height = height;
+        start_scale_job();
+        return;
+    }
+
+    if (width == requested_scale_width && height == requested_scale_height)
+        return;
+
+    requested_scale_width = width;
+    requested_scale_height = height;
+
+    D2D1_SIZE_U size = scaled_image_direct2d->GetPixelSize();
+    if (size.width == width && size.height == height)
+        return;
+
+    // Restarts the timer, job starts once size stops changing.
+    if (!SetTimer(hwnd, scale_timer_id, scale_timer_delay_ms, nullptr))
+        start_scale_job();
+}
+
+static void run_scale_job(void* context, int)
+{
+    Scale_Job* job = (Scale_Job*)context;
+
+    job->succeeded = Resampler::resample(*job->source, job->result, job->filter, job->linear_light);
+    PostMessageW(job->hwnd, (UINT)View_Window_Message::Scale_Job_Finished, 0, 0);
+}
+
+void View_Window::start_scale_job()
+{
+    // Running job starts the next one when it's finished.
+    if (is_scale_job_running || current_image_levels == nullptr)
+        return;
+
+    const UINT width = requested_scale_width;
+    const UINT height = requested_scale_height;
+    if (scaled_image_direct2d != nullptr)
+    {
+        D2D1_SIZE_U size = scaled_image_direct2d->GetPixelSize();
+        if (size.width == width && size.height == height)
+            return;
+    }
+
+    const UINT32 max_size = hwnd_target->GetMaximumBitmapSize();
+    if (width == 0 || height == 0 || width > max_size || height > max_size)
+        return;
+
+    if (!scale_job.result.allocate(static_cast<int>(width), static_cast<int>(height)))
+    {
+        LOG_ERROR(L"Not enough memory to scale image to %ux%u.\n", width, height);
+        return;
+    }
+
+    scale_job.hwnd = hwnd;
+    scale_job.source = &current_image_levels->level_for_size(static_cast<int>(width), static_cast<int>(height));
+    scale_job.filter = resample_filter;
+    scale_job.linear_light = resample_in_linear_light;
+    scale_job.succeeded = false;
+    is_scale_job_running = true;
+
+    if (!g_job_pool->submit(run_scale_job, &scale_job, 0, &scale_job.group))
+        run_scale_job(&scale_job, 0);
+}
+
+void View_Window::finish_scale_job()
+{
+    if (!is_scale_job_running)
+        return; // Cancelled, message is from a job that's already handled.
+
+    g_job_pool->wait(&scale_job.group);
+    is_scale_job_running = false;
+
+    const int scaled_width = scale_job.result.width;
+    const int scaled_height = scale_job.result.height;
+
+    if (scale_job.succeeded && hwnd_target != nullptr)
+    {
+        const Image_Buffer& scaled = scale_job.result;
+
+        ID2D1Bitmap* bitmap = nullptr;
+        HRESULT hr = hwnd_target->CreateBitmap(D2D1::SizeU(scaled.width, scaled.height), scaled.pixels, scaled.stride,
+            pbgra_bitmap_properties(), &bitmap);
+        if (SUCCEEDED(hr))
+        {
+            safe_release(scaled_image_direct2d);
+            scaled_image_direct2d = bitmap;
+            InvalidateRect(hwnd, nullptr, FALSE);
+        }
+        else
+        {
+            LOG_HRESULT_ERROR(hr, L"Unable to create scaled Direct2D bitmap.\n");
+        }
+    }
+
+    // Released before the next job is started, it allocates a new result.
+    scale_job.result.release();
+
+    // Size could have changed while the job was running.
+    if (scaled_width != static_cast<int>(requested_scale_width) || scaled_height != static_cast<int>(requested_scale_height))
+        start_scale_job();
+}
+
+void View_Window::cancel_scale_job()
+{
+    KillTimer(hwnd, scale_timer_id);
+    requested_scale_width = 0;
+    requested_scale_height = 0;
+
+    if (!is_scale_job_running)
+        return;
+
+    // Job reads current image pixels, it has to finish before they are released.
+    g_job_pool->wait(&scale_job.group);
+    is_scale_job_running = false;
+    scale_job.result.release();
+}
+
+// Matrix that turns a 'width' x 'height' image at the origin by 'orientation', the turned image is at
+// the origin too. Rows of the matrix are where x and y axes of the stored image point when it's shown.
+static D2D1::Matrix3x2F orientation_matrix(Orientation orientation, float width, float height)
+{
+    switch (orientation)
+    {
+        case Orientation::Mirror_Horizontal: return D2D1::Matrix3x2F(-1.0f, 0.0f, 0.0f, 1.0f, width, 0.0f);
+        case Orientation::Rotate_180:        return D2D1::Matrix3x2F(-1.0f, 0.0f, 0.0f, -1.0f, width, height);
+        case Orientation::Mirror_Vertical:   return D2D1::Matrix3x2F(1.0f, 0.0f, 0.0f, -1.0f, 0.0f, height);
+        case Orientation::Transpose:         return D2D1::Matrix3x2F(0.0f, 1.0f, 1.0f, 0.0f, 0.0f, 0.0f);
+        case Orientation::Rotate_90:         return D2D1::Matrix3x2F(0.0f, 1.0f, -1.0f, 0.0f, height, 0.0f);
+        case Orientation::Transverse:        return D2D1::Matrix3x2F(0.0f, -1.0f, -1.0f, 0.0f, height, width);
+        case Orientation::Rotate_270:        return D2D1::Matrix3x2F(0.0f, -1.0f, 1.0f, 0.0f, 0.0f, width);
+        default:                             return D2D1::Matrix3x2F::Identity();
+    }
+}
+
+HRESULT View_Window::draw_tiled_image(const D2D1_RECT_F& dest_rect, int client_width, int client_height)
+{
+    Tiled_Image& image = current_tiled_image;
+
+    const float dest_width = dest_rect.right - dest_rect.left;
+    const float dest_height = dest_rect.bottom - dest_rect.top;
+    if (dest_width <= 0.0f || dest_height <= 0.0f)
+        return S_OK;
+
+    // Turned image is drawn as it's stored at the origin and the render target transform turns it into
+    // 'dest_rect'. It's moved by whole pixels, so tile edges stay on pixels and tiles meet without seams.
+    const Orientation orientation = current_tiled_orientation;
+    D2D1_RECT_F stored_rect = dest_rect;
+    D2D1::Matrix3x2F transform = D2D1::Matrix3x2F::Identity();
+    if (orientation != Orientation::Normal)
+    {
+        const bool swaps = Image_Rotation::swaps_size(orientation);
+        stored_rect = D2D1::RectF(0.0f, 0.0f, floorf((swaps ? dest_height : dest_width) + 0.5f),
+            floorf((swaps ? dest_width : dest_height) + 0.5f));
+        transform = orientation_matrix(orientation, stored_rect.right, stored_rect.bottom) *
+            D2D1::Matrix3x2F::Translation(floorf(dest_rect.left + 0.5f), floorf(dest_rect.top + 0.5f));
+    }
+
+    // Client area and pan direction as they're seen from the stored image.
+    D2D1::Matrix3x2F inverse = transform;
+    inverse.Invert();
+    const D2D1_POINT_2F corner0 = inverse.TransformPoint(D2D1::Point2F(0.0f, 0.0f));
+    const D2D1_POINT_2F corner1 = inverse.TransformPoint(D2D1::Point2F(static_cast<float>(client_width), static_cast<float>(client_height)));
+    const D2D1_POINT_2F pan = inverse.TransformPoint(D2D1::Point2F(static_cast<float>(pan_direction_x), static_cast<float>(pan_direction_y)));
+    const int pan_x = static_cast<int>(floorf(pan.x - corner0.x + 0.5f));
+    const int pan_y = static_cast<int>(floorf(pan.y - corner0.y + 0.5f));
+
+    const float stored_width = stored_rect.right - stored_rect.left;
+    const float stored_height = stored_rect.bottom - stored_rect.top;
+    const int level = image.level_for_scale(max(stored_width / image.get_width(), stored_height / image.get_height()));
+
+    int x_count, y_count;
+    image.get_tile_count(level, &x_count, &y_count);
+
+    // Tiles that intersect the client area.
+    const float tile_width = stored_width * (Tiled_Image::tile_size << level) / image.get_width();
+    const float tile_height = stored_height * (Tiled_Image::tile_size << level) / image.get_height();
+    const int first_x = max(static_cast<int>(floorf((min(corner0.x, corner1.x) - stored_rect.left) / tile_width)), 0);
+    const int first_y = max(static_cast<int>(floorf((min(corner0.y, corner1.y) - stored_rect.top) / tile_height)), 0);
+    const int end_x = min(static_cast<int>(ceilf((max(corner0.x, corner1.x) - stored_rect.left) / tile_width)), x_count);
+    const int end_y = min(static_cast<int>(ceilf((max(corner0.y, corner1.y) - stored_rect.top) / tile_height)), y_count);
+
+    // Requests are rebuilt on every paint, so tiles that scrolled out of view are not decoded anymore.
+    image.clear_requests();
+
+    D2D1::Matrix3x2F old_transform;
+    hwnd_target->GetTransform(&old_transform);
+    hwnd_target->SetTransform(transform * old_transform);
+    defer(hwnd_target->SetTransform(old_transform));
+
+    for (int y = first_y; y < end_y; ++y)
+    {
+        for (int x = first_x; x < end_x; ++x)
+        {
+            bool is_exact = false;
+            HRESULT hr = draw_tile(level, x, y, stored_rect, &is_exact);
+            if (FAILED(hr))
+                return hr;
+
+            if (!is_exact)
+                image.request_tile(level, x, y);
+        }
+    }
+
+    // Coarser level covers missing tiles after a zoom, tiles around the view are ready when it's panned.
+    if (level + 1 < image.get_level_count())
+    {
+        for (int y = first_y / 2; y < (end_y + 1) / 2; ++y)
+        {
+            for (int x = first_x / 2; x < (end_x + 1) / 2; ++x)
+                image.request_tile(level + 1, x, y);
+        }
+    }
+
+    for (int y = max(first_y - 1, 0); y < min(end_y + 1, y_count); ++y)
+    {
+        for (int x = max(first_x - 1, 0); x < min(end_x + 1, x_count); ++x)
+        {
+            if (x < first_x || x >= end_x || y < first_y || y >= end_y)
+                image.request_tile(level, x, y);
+        }
+    }
+
+    // One more column and row in the direction the view is panned. Image moving left uncovers its right side.
+    if (pan_x != 0)
+    {
+        const int x = pan_x < 0 ? end_x + 1 : first_x - 2;
+        for (int y = max(first_y - 1, 0); x >= 0 && x < x_count && y < min(end_y + 1, y_count); ++y)
+            image.request_tile(level, x, y);
+    }
+
+    if (pan_y != 0)
+    {
+        const int y = pan_y < 0 ? end_y + 1 : first_y - 2;
+        for (int x = max(first_x - 1, 0); y >= 0 && y < y_count && x < min(end_x + 1, x_count); ++x)
+            image.request_tile(level, x, y);
+    }
+
+    if (image.has_requests() && !is_decode_tiles_posted)
+        is_decode_tiles_posted = PostMessageW(hwnd, (UINT)View_Window_Message::Decode_Tiles, 0, 0) != FALSE;
+
+    return S_OK;
+}
+
+HRESULT View_Window::draw_tile(int level, int x, int y, const D2D1_RECT_F& dest_rect, bool* is_exact)
+{
+    Tiled_Image& image = current_tiled_image;
+    *is_exact = false;
+
+    // Tile area in full size image pixels, tiles at right and bottom edge are cut by the image.
+    const int tile_image_size = Tiled_Image::tile_size << level;
+    const int left = x * tile_image_size;
+    const int top = y * tile_image_size;
+    const int right = min(left + tile_image_size, image.get_width());
+    const int bottom = min(top + tile_image_size, image.get_height());
+
+    // Edges are rounded to whole pixels, so neighbouring tiles meet without seams.
+    const float scale_x = (dest_rect.right - dest_rect.left) / image.get_width();
+    const float scale_y = (dest_rect.bottom - dest_rect.top) / image.get_height();
+    const D2D1_RECT_F destination = D2D1::RectF(
+        floorf(dest_rect.left + left * scale_x + 0.5f),
+        floorf(dest_rect.top + top * scale_y + 0.5f),
+        floorf(dest_rect.left + right * scale_x + 0.5f),
+        floorf(dest_rect.top + bottom * scale_y + 0.5f)
+    );
+
+    // Until the tile is decoded, the same area of a coarser one is drawn.
+    for (int source_level = level; source_level < image.get_level_count(); ++source_level)
+    {
+        const int shift = source_level - level;
+        Tile* tile = image.find_tile(source_level, x >> shift, y >> shift);
+        if (tile == nullptr)
+            continue;
+
+        if (tile->bitmap == nullptr)
+        {
+            const Image_Buffer& pixels = tile->pixels;
+            HRESULT hr = hwnd_target->CreateBitmap(D2D1::SizeU(pixels.width, pixels.height), pixels.pixels, pixels.stride,
+                pbgra_bitmap_properties(), &tile->bitmap);
+            if (FAILED(hr))
+            {
+                LOG_HRESULT_ERROR(hr, L"Unable to create Direct2D bitmap of a tile.\n");
+                return hr;
+            }
+        }
+
+        const int source_tile_size = Tiled_Image::tile_size << source_level;
+        const int source_left = (x >> shift) * source_tile_size;
+        const int source_top = (y >> shift) * source_tile_size;
+        const float to_source = 1.0f / (1 << source_level);
+        const D2D1_RECT_F source = D2D1::RectF(
+            (left - source_left) * to_source,
+            (top - source_top) * to_source,
+            (right - source_left) * to_source,
+            (bottom - source_top) * to_source
+        );
+
+        hwnd_target->DrawBitmap(tile->bitmap, destination, 1.0f, D2D1_BITMAP_INTERPOLATION_MODE_LINEAR, source);
+        *is_exact = source_level == level;
+        break;
+    }
+
+    return S_OK;
+}
+
+// Returns path of 'file_name' in the application's local data folder, which is created if it doesn't exist.
+// Files there are per user and not roamed, executable's folder may not be writable.
+static String get_app_data_path(const wchar_t* file_name, IAllocator* allocator)
+{
+    wchar_t* local_app_data = nullptr;
+    HRESULT hr = SHGetKnownFolderPath(FOLDERID_LocalAppData, 0, nullptr, &local_app_data);
+    if (FAILED(hr)) {
+        LOG_HRESULT_ERROR(hr, L"Unable to get local application data folder.\n");
+        return String();
+    }
+    defer(CoTaskMemFree(local_app_data));
+
+    const String folder_parts[] = { String::reference_to_const_wchar_t(local_app_data), String::reference_to_const_wchar_t(app_data_folder_name) };
+    String folder_path = String::join(L'\\', folder_parts, ARRAYSIZE(folder_parts), allocator);
+    if (String::is_null(folder_path))
+        return String();
+
+    if (!CreateDirectoryW(folder_path.data, nullptr) && GetLastError() != ERROR_ALREADY_EXISTS) {
+        LOG_LAST_WIN32_ERROR(L"Unable to create folder \"%s\".\n", folder_path.data);
+        return String();
+    }
+
+    const String path_parts[] = { folder_path, String::reference_to_const_wchar_t(file_name) };
+    return String::join(L'\\', path_parts, ARRAYSIZE(path_parts), allocator);
+}
+
+void View_Window::open_thumbnail_store()
+{
+    Temporary_Allocator_Guard g;
+    String path = get_app_data_path(thumbnail_store_file_name, g_temporary_allocator);
+    if (String::is_null(path))
+        return;
+
+    // Another instance that has it open keeps it, this one works without stored thumbnails.
+    HRESULT hr = g_thumbnail_store->open(path);
+    if (FAILED(hr) && hr != HRESULT_FROM_WIN32(ERROR_SHARING_VIOLATION))
+        LOG_HRESULT_ERROR(hr, L"Unable to open thumbnail store \"%s\".\n", path.data);
+}
+
+void View_Window::open_metadata_cache()
+{
+    Temporary_Allocator_Guard g;
+    String path = get_app_data_path(metadata_cache_file_name, g_temporary_allocator);
+    if (String::is_null(path))
+        return;
+
+    // Like the thumbnail store, metadata of files is read every time without it.
+    HRESULT hr = metadata_index.open_cache(path);
+    if (FAILED(hr) && hr != HRESULT_FROM_WIN32(ERROR_SHARING_VIOLATION))
+        LOG_HRESULT_ERROR(hr, L"Unable to open metadata cache \"%s\".\n", path.data);
+}
+
+void View_Window::store_thumbnail(const String& path, const File_Info& file)
+{
+    // Only decoded images have mip levels to make it from cheaply, tiled ones get theirs elsewhere.
+    if (!g_thumbnail_store->is_open() || current_image_levels == nullptr)
+        return;
+
+    const UINT64 path_hash = Thumbnail_Store::hash_path(path);
+    const UINT64 key = Thumbnail_Store::make_key(path_hash, file.file_size, file.date_modified);
+    Image_Buffer existing;
+    if (g_thumbnail_store->find(key, &existing))
+        return;
+
+    const Image_Buffer& base = current_image_levels->base();
+    int width;
+    int height;
+    Thumbnail_Store::get_thumbnail_size(base.width, base.height, &width, &height);
+
+    Image_Buffer thumbnail;
+    if (!thumbnail.allocate(width, height))
+        return;
+    defer(thumbnail.release());
+
+    const Image_Buffer& source = current_image_levels->level_for_size(width, height);
+    if (!Resampler::resample(source, thumbnail, Resample_Filter::Bicubic, false))
+        return;
+
+    HRESULT hr = g_thumbnail_store->insert(key, path_hash, thumbnail);
+    if (FAILED(hr) && hr != HRESULT_FROM_WIN32(ERROR_DATABASE_FULL))
+        LOG_HRESULT_ERROR(hr, L"Unable to store thumbnail of \"%s\".\n", path.data);
+}
+
+void View_Window::maintain_thumbnail_store()
+{
+    HRESULT hr;
+    if (g_thumbnail_store->is_compacting())
+    {
+        if (!g_thumbnail_store->is_compaction_done())
+            return;
+
+        hr = g_thumbnail_store->finish_compaction();
+        if (FAILED(hr))
+            LOG_HRESULT_ERROR(hr, L"Unable to compact thumbnail store.\n");
+        return;
+    }
+
+    if (!g_thumbnail_store->is_open())
+        return;
+
+    hr = g_thumbnail_store->commit();
+    if (FAILED(hr)) {
+        LOG_HRESULT_ERROR(hr, L"Unable to commit thumbnails.\n");
+        return;
+    }
+
+    if (g_thumbnail_store->needs_compaction()) {
+        hr = g_thumbnail_store->start_compaction();
+        if (FAILED(hr))
+            LOG_HRESULT_ERROR(hr, L"Unable to start compaction of thumbnail store.\n");
+    }
+}
+
+void View_Window::handle_toggle_grid_action()
+{
+    if (is_grid_mode)
+        open_grid_selection();
+    else
+        set_grid_mode(true);
+}
+
+static int get_max_grid_scroll(int file_count, int columns, int client_height)
+{
+    const int rows = (file_count + columns - 1) / columns;
+    return max(rows * grid_cell_size - client_height, 0);
+}
+
+// Requests thumbnails of 'shown_files' in rows from 'first_row' up to 'end_row', rows out of the grid are skipped.
+static void request_grid_rows(Thumbnail_Atlas* atlas, int first_row, int end_row, int columns, const Sequence<int>& shown_files)
+{
+    const int first_position = max(first_row, 0) * columns;
+    const int end_position = min(end_row * columns, shown_files.count);
+    for (int i = first_position; i < end_position; ++i)
+        atlas->request(shown_files.data[i]);
+}
+
+void View_Window::set_grid_mode(bool enabled)
+{
+    if (enabled == is_grid_mode)
+        return;
+    if (enabled && shown_files.is_empty())
+        return;
+
+    is_grid_mode = enabled;
+    set_menu_item_checked(view_menu, View_Menu_Item::Show_Thumbnail_Grid, is_grid_mode);
+
+    if (is_grid_mode)
+    {
+        select_grid_file(lower_bound(shown_files.data, shown_files.count, max(current_file_index, 0)));
+    }
+    else
+    {
+        thumbnail_atlas.clear_requests();
+        // Name filter is typed into the grid, it stays set when the grid is left.
+        is_typing_name_filter = false;
+
+        if (animation.is_open())
+        {
+            animation_due_ms = Windows_Utility::get_time_ms();
+            SetTimer(hwnd, animation_timer_id, animation_poll_ms, nullptr);
+        }
+    }
+
+    InvalidateRect(hwnd, nullptr, FALSE);
+}
+
+void View_Window::reset_thumbnail_grid()
+{
+    // Thumbnails in the atlas are identified by file index, which is different for new files.
+    if (!thumbnail_atlas.reset(current_files.count))
+        LOG_ERROR(L"Unable to reset thumbnail atlas for %d files.\n", current_files.count);
+    ++thumbnail_generation;
+
+    grid_scroll_y = 0;
+    grid_scroll_direction = 0;
+    update_shown_files(max(current_file_index, 0));
+}
+
+int View_Window::get_grid_columns(int client_width) const
+{
+    return max(client_width / grid_cell_size, 1);
+}
 
-    hr = dialog->SetOptions(FOS_ALLOWMULTISELECT | FOS_PATHMUSTEXIST | FOS_FILEMUSTEXIST);
-    hr = dialog->Show(hwnd);
-    hr = dialog->GetResults(&items);
+int View_Window::get_grid_file_at(int x, int y)
+{
+    int client_width, client_height;
+    if (!get_client_area(&client_width, &client_height))
+        return -1;
 
-    if (items == nullptr)
-        return false;
+    const int columns = get_grid_columns(client_width);
+    const int left = max((client_width - columns * grid_cell_size) / 2, 0);
+    if (x < left || x >= left + columns * grid_cell_size || y < 0)
+        return -1;
 
-    hr = items->GetItemAt(0, &item);
-    if (item == nullptr)
-        return false;
+    const int position = (y + grid_scroll_y) / grid_cell_size * columns + (x - left) / grid_cell_size;
+    return shown_files.is_valid_index(position) ? position : -1;
+}
 
-    wchar_t* path = nullptr;
-    hr = item->GetDisplayName(SIGDN_FILESYSPATH, &path);
+void View_Window::scroll_grid_by(int dy)
+{
+    int client_width, client_height;
+    if (!get_client_area(&client_width, &client_height))
+        return;
 
-    load_path(String::reference_to_const_wchar_t(path));
-    CoTaskMemFree(path);
+    const int max_scroll = get_max_grid_scroll(shown_files.count, get_grid_columns(client_width), client_height);
+    const int scroll = min(max(grid_scroll_y + dy, 0), max_scroll);
+    if (scroll == grid_scroll_y)
+        return;
 
-    return true;
+    grid_scroll_direction = scroll < grid_scroll_y ? -1 : 1;
+    grid_scroll_y = scroll;
+
+    // Only thumbnails already in the atlas or the store are drawn while scrolling, others are decoded between paints.
+    InvalidateRect(hwnd, nullptr, FALSE);
 }
 
-void View_Window::handle_show_image_info_action()
+void View_Window::select_grid_file(int position)
 {
-    show_image_info = !show_image_info;
+    if (shown_files.is_empty())
+        return;
 
-    MENUITEMINFOW info = { 0 };
-    info.cbSize = sizeof(info);
-    info.fMask = MIIM_STATE;
-    info.fState = show_image_info ? MFS_CHECKED : MFS_UNCHECKED;
-    
-    BOOL result = SetMenuItemInfoW(view_menu, (UINT)View_Menu_Item::Show_Image_Info, false, &info);
+    int client_width, client_height;
+    if (!get_client_area(&client_width, &client_height))
+        return;
 
-    if (!result)
-        LOG_LAST_WIN32_ERROR(L"Cannot change 'Show image info' menu item state to %d", (int)show_image_info);
+    grid_selected_index = min(max(position, 0), shown_files.count - 1);
 
-    InvalidateRect(hwnd, nullptr, false);
+    const int top = grid_selected_index / get_grid_columns(client_width) * grid_cell_size;
+    if (top < grid_scroll_y)
+        scroll_grid_by(top - grid_scroll_y);
+    else if (top + grid_cell_size > grid_scroll_y + client_height)
+        scroll_grid_by(top + grid_cell_size - client_height - grid_scroll_y);
+
+    InvalidateRect(hwnd, nullptr, FALSE);
 }
 
-void View_Window::handle_change_display_mode_action()
+int View_Window::get_grid_selected_file() const
 {
-    HRESULT hr;
+    return shown_files.is_valid_index(grid_selected_index) ? shown_files.data[grid_selected_index] : -1;
+}
 
-    switch (display_mode)
-    {
-        case Display_Mode::Windowed:
-        {
-            hr = set_display_mode(Display_Mode::Fullscreen);
-            if (SUCCEEDED(hr))
-            {
-                BOOL result = ModifyMenuW(
-                    view_menu,
-                    (UINT_PTR)View_Menu_Item::Change_Display_Mode,
-                    MF_BYCOMMAND | MF_STRING,
-                    (UINT_PTR)View_Menu_Item::Change_Display_Mode,
-                    L"Exit fullscreen");
+void View_Window::open_grid_selection()
+{
+    const int index = get_grid_selected_file();
+    set_grid_mode(false);
 
-                if (!result)
-                    LOG_LAST_WIN32_ERROR(L"Unable to modify view menu");
-            }
-            break;
-        }
+    if (index != current_file_index && current_files.is_valid_index(index))
+        view_file_index(index);
+}
 
-        case Display_Mode::Fullscreen:
-        {
-            hr = set_display_mode(Display_Mode::Windowed);
-            if (SUCCEEDED(hr))
-            {
-                BOOL result = ModifyMenuW(
-                    view_menu,
-                    (UINT_PTR)View_Menu_Item::Change_Display_Mode,
-                    MF_BYCOMMAND | MF_STRING,
-                    (UINT_PTR)View_Menu_Item::Change_Display_Mode,
-                    L"Enter fullscreen");
+HRESULT View_Window::draw_thumbnail_grid()
+{
+    int client_width, client_height;
+    if (!get_client_area(&client_width, &client_height))
+        return S_OK;
 
-                if (!result)
-                    LOG_LAST_WIN32_ERROR(L"Unable to modify view menu");
+    // Cells are positions in 'shown_files', the atlas is indexed by file.
+    const int file_count = shown_files.count;
+    const int columns = get_grid_columns(client_width);
+    const int rows = (file_count + columns - 1) / columns;
+    const int left = max((client_width - columns * grid_cell_size) / 2, 0);
+    grid_scroll_y = min(max(grid_scroll_y, 0), get_max_grid_scroll(file_count, columns, client_height));
+
+    // Only visible rows are looked at, so the grid is as fast with a hundred thousand files as with ten.
+    const int first_row = grid_scroll_y / grid_cell_size;
+    const int end_row = min((grid_scroll_y + client_height + grid_cell_size - 1) / grid_cell_size, rows);
+    const int first_index = first_row * columns;
+    const int end_index = min(end_row * columns, file_count);
+    if (end_index <= first_index)
+        return S_OK;
 
-                File_Info* current = get_current_file_info();
+    Temporary_Allocator_Guard g;
+    int* visible_cells = (int*)g_temporary_allocator->allocate(sizeof(int) * (end_index - first_index));
+    if (visible_cells == nullptr)
+        return E_OUTOFMEMORY;
 
-                if (current != nullptr)
-                {
-                    D2D1_SIZE_F image_size = current_image_direct2d->GetSize();
-                    set_desired_client_size(
-                        static_cast<int>(image_size.width),
-                        static_cast<int>(image_size.height)
-                    );
-                }
-            }
-            break;
-        }
+    thumbnail_atlas.begin_frame();
+    // Requests are rebuilt on every paint, so thumbnails that scrolled out of view are not loaded anymore.
+    thumbnail_atlas.clear_requests();
 
-        default:
+    int stored_count = 0;
+    for (int i = first_index; i < end_index; ++i)
+    {
+        const int index = shown_files.data[i];
+        int cell = thumbnail_atlas.find(index);
+        if (cell < 0 && !thumbnail_atlas.is_failed(index) && stored_count < max_stored_thumbnails_per_paint)
         {
-            LOG_ERROR(L"Unknown display mode %d", static_cast<int>(display_mode));
-            return;
+            ++stored_count;
+            load_stored_thumbnail(index, &cell);
         }
-    }
 
-    if (FAILED(hr))
-        LOG_HRESULT_ERROR(hr, L"Unable to change display mode to %d", static_cast<int>(display_mode));
-}
+        if (cell < 0)
+            thumbnail_atlas.request(index);
 
-void View_Window::handle_copy_filename_to_clipboard_menu_item()
-{
-    File_Info* current = get_current_file_info();
-    if (current == nullptr)
-    {
-        MessageBoxW(hwnd, L"No image is loaded.", L"Error", MB_OK | MB_ICONINFORMATION);
-        return;
+        visible_cells[i - first_index] = cell;
     }
 
-    const String& filename = current->path;
-    if (String::is_null_or_empty(filename))
+    const float thumbnail_size = static_cast<float>(Thumbnail_Store::thumbnail_size);
+    for (int i = first_index; i < end_index; ++i)
     {
-        MessageBoxW(hwnd, L"Filename is invalid.", L"Error", MB_OK | MB_ICONERROR);
-        return;
-    }
+        if (visible_cells[i - first_index] >= 0)
+            continue;
 
-    BOOL result;
-    result = OpenClipboard(hwnd);
-    if (!result)
-    {
-        LOG_LAST_WIN32_ERROR(L"Cannot open clipboard");
-        MessageBoxW(hwnd, L"Cannot open clipboard", L"Error", MB_OK | MB_ICONERROR);
-        return;
+        const float x = static_cast<float>(left + i % columns * grid_cell_size + grid_cell_margin);
+        const float y = static_cast<float>(i / columns * grid_cell_size - grid_scroll_y + grid_cell_margin);
+        hwnd_target->FillRectangle(D2D1::RectF(x, y, x + thumbnail_size, y + thumbnail_size), grid_cell_brush);
     }
-    EmptyClipboard();
-    
-    defer (CloseClipboard());
 
-    HGLOBAL clip_store = GlobalAlloc(GMEM_MOVEABLE, sizeof(wchar_t) * (filename.count + 1));
-    if (clip_store == nullptr)
+    // Thumbnails are drawn page by page of the atlas, Direct2D batches consecutive draws from one bitmap.
+    for (int page = 0; page < thumbnail_atlas.get_page_count(); ++page)
     {
-        LOG_LAST_WIN32_ERROR(L"Cannot allocate enough memory to save a string");
-        return;
+        for (int i = first_index; i < end_index; ++i)
+        {
+            const int cell = visible_cells[i - first_index];
+            if (cell < 0 || thumbnail_atlas.get_page(cell) != page)
+                continue;
+
+            // Centered in the cell at whole pixels, so it's drawn 1:1.
+            const D2D1_RECT_F source_rect = thumbnail_atlas.get_source_rect(cell);
+            const int width = static_cast<int>(source_rect.right - source_rect.left);
+            const int height = static_cast<int>(source_rect.bottom - source_rect.top);
+            const float x = static_cast<float>(left + i % columns * grid_cell_size + grid_cell_margin + (Thumbnail_Store::thumbnail_size - width) / 2);
+            const float y = static_cast<float>(i / columns * grid_cell_size - grid_scroll_y + grid_cell_margin + (Thumbnail_Store::thumbnail_size - height) / 2);
+
+            hwnd_target->DrawBitmap(thumbnail_atlas.get_bitmap(cell), D2D1::RectF(x, y, x + width, y + height), 1.0f,
+                D2D1_BITMAP_INTERPOLATION_MODE_NEAREST_NEIGHBOR, source_rect);
+        }
     }
 
-    wchar_t* clip_data = (wchar_t*)GlobalLock(clip_store);
-    if (clip_data == nullptr)
+    if (grid_selected_index >= first_index && grid_selected_index < end_index)
     {
-        LOG_LAST_WIN32_ERROR(L"Unable to lock global memory");
-        return;
+        const float x = static_cast<float>(left + grid_selected_index % columns * grid_cell_size);
+        const float y = static_cast<float>(grid_selected_index / columns * grid_cell_size - grid_scroll_y);
+        const float inset = grid_cell_margin / 2.0f;
+        hwnd_target->DrawRectangle(D2D1::RectF(x + inset, y + inset, x + grid_cell_size - inset, y + grid_cell_size - inset),
+            image_info_text_brush, 2.0f);
     }
-    defer (GlobalUnlock(clip_store));
-    
-    wmemcpy(clip_data, filename.data, filename.count);
-    clip_data[filename.count] = L'\0';
 
-    result = GlobalUnlock(clip_store);
-    DWORD last_error = GetLastError();
-    if (last_error != NO_ERROR)
+    // Rows ahead in the scroll direction are loaded next, nearest first, then a row behind. Visible and
+    // prefetched thumbnails fit the atlas together, so prefetching doesn't evict what's on screen.
+    const int visible_rows = end_row - first_row;
+    const int prefetch_rows = min(visible_rows, max(Thumbnail_Atlas::max_cells / 2 / columns - visible_rows, 0));
+    for (int r = 0; r < prefetch_rows; ++r)
     {
-        LOG_WIN32_ERROR(last_error, L"Unable to unlock global memory");
-        return;
+        const int row = grid_scroll_direction < 0 ? first_row - 1 - r : end_row + r;
+        request_grid_rows(&thumbnail_atlas, row, row + 1, columns, shown_files);
     }
 
-    if (0 == SetClipboardData(CF_UNICODETEXT, clip_store))
+    const int behind_row = grid_scroll_direction < 0 ? end_row : first_row - 1;
+    request_grid_rows(&thumbnail_atlas, behind_row, behind_row + 1, columns, shown_files);
+
+    // Jobs queued for files that scrolled far enough away are skipped, the pool gets to the visible ones sooner.
+    for (int i = 0; i < Thumbnail_Job::max_running; ++i)
     {
-        LOG_LAST_WIN32_ERROR(L"Unable to set clipboard data");
-        return;
+        Thumbnail_Job& job = thumbnail_jobs[i];
+        if (job.is_running && !thumbnail_atlas.is_requested(job.file_index))
+            InterlockedExchange(&job.is_cancelled, 1);
     }
+
+    if (thumbnail_atlas.has_requests() && !is_decode_thumbnails_posted)
+        is_decode_thumbnails_posted = PostMessageW(hwnd, (UINT)View_Window_Message::Decode_Thumbnails, 0, 0) != FALSE;
+
+    return S_OK;
 }
 
-int View_Window::find_file_info_by_path(const String& path)
+bool View_Window::load_stored_thumbnail(int index, int* cell)
 {
-    if (String::is_null_or_empty(path))
-        return -1;
+    E_VERIFY_R(current_files.is_valid_index(index), false);
+    *cell = -1;
 
-    for (int i = 0; i < current_files.count; ++i)
-    {
-        const File_Info& file_info = current_files.data[i];
+    const File_Info* file = &current_files.data[index];
 
-        if (String::equals(path, file_info.path))
-            return i;
-    }
+    Temporary_Allocator_Guard g;
+    String path = get_file_info_absolute_path(current_folder, file, g_temporary_allocator);
+    if (String::is_null(path))
+        return false;
 
-    return -1;
+    const UINT64 key = Thumbnail_Store::make_key(Thumbnail_Store::hash_path(path), file->file_size, file->date_modified);
+
+    Image_Buffer thumbnail;
+    if (!g_thumbnail_store->find(key, &thumbnail))
+        return false;
+
+    *cell = thumbnail_atlas.insert(hwnd_target, index, thumbnail);
+    return true;
 }
 
-HRESULT View_Window::set_scaling_mode(Scaling_Mode mode, float scaling)
+void View_Window::decode_requested_thumbnails()
 {
-    if (mode == Scaling_Mode::No_Scaling)
-    {
-        this->scaling_mode = mode;
-        this->scaling = 1.0f;
-
-        InvalidateRect(hwnd, nullptr, false);
+    is_decode_thumbnails_posted = false;
 
-        return S_OK;
+    if (!is_grid_mode || hwnd_target == nullptr)
+    {
+        thumbnail_atlas.clear_requests();
+        return;
     }
 
-    if (mode == Scaling_Mode::Percentage)
+    // Requests are popped most needed first, so visible thumbnails get the jobs before prefetched rows do.
+    // With all jobs running, a finished one pops the next request.
+    const int job_count = min(Thumbnail_Job::max_running, max(g_job_pool->get_thread_count(), 1));
+    bool loaded = false;
+    int stored_count = 0;
+    for (;;)
     {
-        E_VERIFY_R(scaling > 0.0f, E_INVALIDARG);
+        Thumbnail_Job* job = nullptr;
+        for (int i = 0; i < job_count && job == nullptr; ++i)
+        {
+            if (!thumbnail_jobs[i].is_running)
+                job = &thumbnail_jobs[i];
+        }
 
-        this->scaling_mode = mode;
-        this->scaling = scaling;
+        if (job == nullptr)
+            break;
 
-        InvalidateRect(hwnd, nullptr, false);
+        // Rest of the stored thumbnails are read after input and painting are handled.
+        if (stored_count == max_stored_thumbnails_per_paint)
+        {
+            is_decode_thumbnails_posted = PostMessageW(hwnd, (UINT)View_Window_Message::Decode_Thumbnails, 0, 0) != FALSE;
+            break;
+        }
 
-        return S_OK;
-    }
+        const int index = thumbnail_atlas.pop_request();
+        if (index < 0)
+            break;
 
-    if (mode == Scaling_Mode::Fit_To_Window)
-    {
-        this->scaling_mode = mode;
-        this->scaling = 1.0f;
+        bool is_decoding = false;
+        for (int i = 0; i < Thumbnail_Job::max_running; ++i)
+            is_decoding |= thumbnail_jobs[i].is_running && thumbnail_jobs[i].file_index == index;
+        if (is_decoding || thumbnail_atlas.is_failed(index))
+            continue;
 
-        InvalidateRect(hwnd, nullptr, false);
+        ++stored_count;
+        int cell = -1;
+        if (load_stored_thumbnail(index, &cell))
+        {
+            if (cell < 0)
+            {
+                // Atlas is full of visible thumbnails.
+                thumbnail_atlas.clear_requests();
+                break;
+            }
 
-        return S_OK;
+            loaded = true;
+            continue;
+        }
+
+        if (!start_thumbnail_job(job, index))
+            thumbnail_atlas.mark_failed(index);
     }
 
-    // Unknown mode.
-    E_VERIFY_R(false, E_UNEXPECTED);
+    if (loaded)
+        InvalidateRect(hwnd, nullptr, FALSE);
 }
 
-HRESULT View_Window::set_display_mode(Display_Mode mode)
+static void run_thumbnail_job(void* context, int)
 {
-    if (this->display_mode == mode)
-        return S_OK;
+    Thumbnail_Job* job = (Thumbnail_Job*)context;
 
-    if (mode == Display_Mode::Fullscreen)
-    {
-        SetWindowLongPtrW(hwnd, GWL_STYLE, static_cast<LONG>(fullscreen_display_mode_flags));
-        SetWindowPos(hwnd, nullptr, 0, 0, desktop_width, desktop_height, SWP_FRAMECHANGED);
-        ShowWindow(hwnd, SW_SHOW);
-    
-        this->display_mode = mode;
-    
-        return S_OK;
-    }
-    else if (mode == Display_Mode::Windowed)
-    {
-        SetWindowLongPtrW(hwnd, GWL_STYLE, static_cast<LONG>(windowed_display_mode_flags));
+    // WIC factory is free threaded, workers are in the multithreaded apartment.
+    job->hr = job->is_cancelled ? E_ABORT : Thumbnail_Loader::load(job->wic, job->path, &job->result);
+    PostMessageW(job->hwnd, (UINT)View_Window_Message::Thumbnail_Job_Finished, job->slot, 0);
+}
 
-        // @TODO: use 'set_desired_size'
-        SetWindowPos(hwnd, nullptr, 0, 0, desktop_work_width, desktop_work_height, SWP_FRAMECHANGED);
-        ShowWindow(hwnd, SW_SHOW);
+bool View_Window::start_thumbnail_job(Thumbnail_Job* job, int index)
+{
+    E_VERIFY_R(current_files.is_valid_index(index), false);
+    E_VERIFY_R(!job->is_running, false);
 
-        this->display_mode = mode;
+    job->path = get_file_info_absolute_path(current_folder, &current_files.data[index], g_standard_allocator);
+    if (String::is_null(job->path))
+        return false;
 
-        return S_OK;
-    }
+    job->hwnd = hwnd;
+    job->wic = wic;
+    job->slot = static_cast<WPARAM>(job - thumbnail_jobs);
+    job->file_index = index;
+    job->generation = thumbnail_generation;
+    job->is_cancelled = 0;
+    job->hr = S_OK;
+    job->is_running = true;
 
-    LOG_ERROR(L"Unknown display mode %d", static_cast<int>(mode));
-    return E_INVALIDARG;
+    if (!g_job_pool->submit(run_thumbnail_job, job, 0, &job->group))
+        run_thumbnail_job(job, 0);
+
+    return true;
 }
 
-HRESULT View_Window::draw_current_image()
+void View_Window::finish_thumbnail_job(WPARAM slot)
 {
-    int client_width, client_height;
-    get_client_area(&client_width, &client_height);
+    E_VERIFY(slot < Thumbnail_Job::max_running);
 
-    D2D1_SIZE_F image_size = current_image_size;
+    Thumbnail_Job& job = thumbnail_jobs[slot];
+    if (!job.is_running)
+        return; // Cancelled, message is from a job that's already handled.
 
-    if (scaling_mode == Scaling_Mode::Fit_To_Window)
+    // Message is posted just before the job returns.
+    g_job_pool->wait(&job.group);
+    job.is_running = false;
+    defer(job.result.release());
+    defer(g_standard_allocator->deallocate(job.path.data));
+
+    // Skipped jobs are requested again by the next paint if their files are still needed.
+    if (job.hr == E_ABORT || job.generation != thumbnail_generation || !current_files.is_valid_index(job.file_index))
     {
-        fit_to_window:
-        if (image_size.width > client_width)
-        {
-            float aspect = client_width / image_size.width;
+        InvalidateRect(hwnd, nullptr, FALSE);
+        return;
+    }
+
+    if (FAILED(job.hr))
+    {
+        thumbnail_atlas.mark_failed(job.file_index);
+        decode_requested_thumbnails();
+        return;
+    }
+
+    const File_Info* file = &current_files.data[job.file_index];
+    const UINT64 path_hash = Thumbnail_Store::hash_path(job.path);
+    if (g_thumbnail_store->is_open())
+    {
+        HRESULT hr = g_thumbnail_store->insert(Thumbnail_Store::make_key(path_hash, file->file_size, file->date_modified), path_hash, job.result);
+        if (FAILED(hr) && hr != HRESULT_FROM_WIN32(ERROR_DATABASE_FULL))
+            LOG_HRESULT_ERROR(hr, L"Unable to store thumbnail of \"%s\".\n", job.path.data);
+    }
 
-            image_size.width  *= aspect;
-            image_size.height *= aspect;
-        }
+    if (hwnd_target != nullptr && thumbnail_atlas.insert(hwnd_target, job.file_index, job.result) >= 0)
+        InvalidateRect(hwnd, nullptr, FALSE);
 
-        if (image_size.height > client_height)
-        {
-            float aspect = client_height / image_size.height;
+    decode_requested_thumbnails();
+}
 
-            image_size.width  *= aspect;
-            image_size.height *= aspect;
-        }
-    }
-    else if (scaling_mode == Scaling_Mode::Percentage)
+void View_Window::cancel_thumbnail_jobs()
+{
+    for (int i = 0; i < Thumbnail_Job::max_running; ++i)
     {
-        image_size.width *= scaling;
-        image_size.height *= scaling;
+        Thumbnail_Job& job = thumbnail_jobs[i];
+        if (!job.is_running)
+            continue;
+
+        InterlockedExchange(&job.is_cancelled, 1);
+        g_job_pool->wait(&job.group);
+        job.is_running = false;
+        job.result.release();
+        g_standard_allocator->deallocate(job.path.data);
     }
-    else if (scaling_mode == Scaling_Mode::No_Scaling)
+}
+
+void View_Window::handle_low_memory()
+{
+    // Only the current image stays cached.
+    const size_t current_size = current_image_levels != nullptr ? current_image_levels->size_in_bytes() : 0;
+    if (g_image_cache->get_size_in_bytes() > current_size)
     {
-        // Don't do anything.
+        // Scale job reads pixels of the current entry, which moves when others are evicted.
+        cancel_scale_job();
+        current_image_levels = g_image_cache->shrink(current_size, current_image_levels, false);
+        InvalidateRect(hwnd, nullptr, FALSE);
     }
-    else
+
+    g_image_cache->clear_compressed();
+
+    // Halved on every check while memory stays low, visible tiles are decoded again if they're evicted.
+    const int tile_count = current_tiled_image.get_cached_tile_count();
+    if (tile_count > min_tiles_under_low_memory)
     {
-        LOG_ERROR(L"Unknown scaling mode %d.", scaling_mode);
-        set_scaling_mode(Scaling_Mode::Fit_To_Window, 1.0f);
-        goto fit_to_window;
+        current_tiled_image.shrink_cache(max(tile_count / 2, min_tiles_under_low_memory));
+        InvalidateRect(hwnd, nullptr, FALSE);
     }
+}
 
-    float img_hw = (int)image_size.width  / 2.0f;
-    float img_hh = (int)image_size.height / 2.0f;
-    float cli_hw = client_width  / 2.0f;
-    float cli_hh = client_height / 2.0f;
+void View_Window::decode_requested_tiles()
+{
+    is_decode_tiles_posted = false;
 
-    D2D1_RECT_F dest_rect = D2D1::RectF(
-        ceilf(cli_hw - img_hw),
-        ceilf(cli_hh - img_hh),
-        ceilf(cli_hw + img_hw),
-        ceilf(cli_hh + img_hh)
-    );
+    // Tiles are decoded on the window thread, WIC frames can't be used from more threads at once.
+    // After each slice the window is repainted, which requests the tiles that are still missing.
+    LARGE_INTEGER frequency, start, now;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&start);
+    const LONGLONG slice_ticks = frequency.QuadPart * tile_decode_slice_ms / 1000;
 
-    hwnd_target->DrawBitmap(current_image_direct2d, dest_rect);
-    
-    if (show_image_info)
-        draw_current_image_info();
+    bool decoded = false;
+    while (current_tiled_image.decode_next_request())
+    {
+        decoded = true;
 
-    return S_OK;
+        QueryPerformanceCounter(&now);
+        if (now.QuadPart - start.QuadPart >= slice_ticks)
+            break;
+    }
+
+    if (decoded)
+        InvalidateRect(hwnd, nullptr, FALSE);
 }
 
 HRESULT View_Window::draw_placeholder()
@@ -963,6 +3464,41 @@ int sort_by_date_modified_desc(const File_Info* a, const File_Info* b) {
     return -1 * CompareFileTime(&a->date_modified, &b->date_modified);
 }
 
+// Files and metadata of the sort in progress, sort runs on the window thread only.
+static const File_Info* sort_files = nullptr;
+static const Metadata_Index* sort_metadata = nullptr;
+static int(*sort_file_func)(const File_Info* a, const File_Info* b) = nullptr;
+
+// Files without date taken are compared by date modified, so photos and other images interleave sensibly.
+static UINT64 get_sort_date_taken(const File_Info* file)
+{
+    const UINT64 date_taken = sort_metadata->get_date_taken(static_cast<int>(file - sort_files));
+    if (date_taken != 0)
+        return date_taken;
+
+    return (static_cast<UINT64>(file->date_modified.dwHighDateTime) << 32) | file->date_modified.dwLowDateTime;
+}
+int sort_by_date_taken_asc(const File_Info* a, const File_Info* b) {
+    const UINT64 date_a = get_sort_date_taken(a);
+    const UINT64 date_b = get_sort_date_taken(b);
+    return date_a < date_b ? -1 : (date_a > date_b ? 1 : 0);
+}
+int sort_by_date_taken_desc(const File_Info* a, const File_Info* b) {
+    return -1 * sort_by_date_taken_asc(a, b);
+}
+
+// Sorts indices of files, ties keep their order.
+static int __cdecl sort_indices(const void* a, const void* b)
+{
+    const int index_a = *(const int*)a;
+    const int index_b = *(const int*)b;
+    const int result = sort_file_func(&sort_files[index_a], &sort_files[index_b]);
+    if (result != 0)
+        return result;
+
+    return index_a < index_b ? -1 : (index_a > index_b ? 1 : 0);
+}
+
 // These functions MUST be in order as in Sort_Mode enum.
 // Ascending first, descending second.
 static QSort_Func sort_funcs[]
@@ -971,60 +3507,103 @@ static QSort_Func sort_funcs[]
     (QSort_Func)sort_by_date_created_asc,
     (QSort_Func)sort_by_date_accessed_asc,
     (QSort_Func)sort_by_date_modified_asc,
+    (QSort_Func)sort_by_date_taken_asc,
 
     (QSort_Func)sort_by_name_desc,
     (QSort_Func)sort_by_date_created_desc,
     (QSort_Func)sort_by_date_accessed_desc,
     (QSort_Func)sort_by_date_modified_desc,
+    (QSort_Func)sort_by_date_taken_desc,
 };
 #pragma endregion
 
 HRESULT View_Window::sort_current_images(Sort_Mode mode, Sort_Order order)
 {
-    E_VERIFY_R(mode >= Sort_Mode::Name || mode <= Sort_Mode::Date_Modified, E_INVALIDARG);
-    E_VERIFY_R(order >= Sort_Order::Ascending || order <= Sort_Order::Descending, E_INVALIDARG);
+    E_VERIFY_R(mode >= Sort_Mode::Name && mode < Sort_Mode::NUM_MODES, E_INVALIDARG);
+    E_VERIFY_R(order >= Sort_Order::Ascending && order <= Sort_Order::Descending, E_INVALIDARG);
+
+    sort_mode = mode;
+    sort_order = order;
 
     if (current_files.data == nullptr || current_files.count <= 1)
         return S_OK;
 
-    File_Info* current = get_current_file_info();
     QSort_Func sort_func = sort_funcs[((int)order * (int)Sort_Mode::NUM_MODES) + (int)mode];
+    if (sort_func == nullptr)
+        return S_OK;
 
-    if (sort_func != nullptr)
-        qsort(current_files.data, current_files.count, sizeof(current_files.data[0]), sort_func);
+    // Indices are sorted, the order is then applied to files, their metadata and thumbnails alike.
+    const int count = current_files.count;
+    int* order_indices = (int*)g_standard_allocator->allocate(sizeof(int) * count);
+    File_Info* sorted_files = (File_Info*)g_standard_allocator->allocate(sizeof(File_Info) * count);
+    int* new_indices = (int*)g_standard_allocator->allocate(sizeof(int) * count);
+    defer(g_standard_allocator->deallocate(order_indices));
+    defer(g_standard_allocator->deallocate(sorted_files));
+    defer(g_standard_allocator->deallocate(new_indices));
+    if (order_indices == nullptr || sorted_files == nullptr || new_indices == nullptr)
+        return E_OUTOFMEMORY;
 
-    if (current != nullptr)
+    // Workers write entries by index, reading continues in the new order. Name index lists files by
+    // index, it's built again.
+    const bool was_reading = metadata_index.is_running();
+    metadata_index.cancel();
+    const bool was_indexed = name_index.is_running() || name_index.is_built();
+    name_index.cancel();
+
+    for (int i = 0; i < count; ++i)
+        order_indices[i] = i;
+
+    sort_files = current_files.data;
+    sort_metadata = &metadata_index;
+    sort_file_func = (int(*)(const File_Info*, const File_Info*))sort_func;
+    qsort(order_indices, count, sizeof(order_indices[0]), sort_indices);
+    sort_files = nullptr;
+    sort_metadata = nullptr;
+    sort_file_func = nullptr;
+
+    for (int i = 0; i < count; ++i)
     {
-        for (int i = 0; i < current_files.count; ++i)
-        {
-            if (&current_files.data[i] == current)
-            {
-                current_file_index = i;
-                break;
-            }
-        }
+        sorted_files[i] = current_files.data[order_indices[i]];
+        new_indices[order_indices[i]] = i;
     }
 
-    //sort_mode = mode;
-    //sort_order = order;
+    memcpy(current_files.data, sorted_files, sizeof(File_Info) * count);
+
+    if (!metadata_index.permute(order_indices))
+    {
+        LOG_ERROR(L"Unable to reorder metadata of %d files.\n", count);
+        metadata_index.reset(current_folder, current_files);
+    }
+
+    if (!thumbnail_atlas.permute(order_indices) && !thumbnail_atlas.reset(count))
+        LOG_ERROR(L"Unable to reorder thumbnails of %d files.\n", count);
+    ++thumbnail_generation;
+
+    const int selected_index = get_grid_selected_file();
+    if (current_files.is_valid_index(current_file_index))
+        current_file_index = new_indices[current_file_index];
+
+    if (was_indexed)
+        name_index.start(hwnd, (UINT)View_Window_Message::Name_Index_Built, current_files);
+
+    // Matches are indices of files in the old order.
+    name_matches.clear();
+    update_name_matches();
+    update_shown_files(selected_index >= 0 ? new_indices[selected_index] : max(current_file_index, 0));
+
+    if (was_reading)
+        start_metadata_extraction();
 
     return S_OK;
 }
 
-HRESULT View_Window::create_decoder_from_file_path(const String& file_path, IWICBitmapDecoder** decoder)
+static bool is_name_filter_key(WPARAM key)
 {
-    E_VERIFY_R(!String::is_null_or_empty(file_path), E_INVALIDARG);
-    E_VERIFY_NULL_R(decoder, E_INVALIDARG);
-
-    HRESULT hr;
-    IStream* stream = nullptr;
-    hr = SHCreateStreamOnFileEx(file_path.data, STGM_READ, FILE_ATTRIBUTE_NORMAL, false, nullptr, &stream);
-    if (FAILED(hr))
-        return hr;
-    defer (safe_release(stream));
+    if (GetKeyState(VK_CONTROL) < 0 || GetKeyState(VK_MENU) < 0)
+        return false;
 
-    hr = wic->CreateDecoderFromStream(stream, nullptr, WICDecodeMetadataCacheOnDemand, decoder);
-    return hr;
+    return key == VK_RETURN || key == VK_ESCAPE || key == VK_BACK || key == VK_SPACE ||
+        (key >= '0' && key <= '9') || (key >= 'A' && key <= 'Z');
 }
 
 int View_Window::enter_message_loop()
@@ -1041,7 +3620,9 @@ int View_Window::enter_message_loop()
             continue;
         }
 
-        if (!TranslateAcceleratorW(hwnd, kb_accel, &msg))
+        // Keys that type the name filter are not shortcuts while it's typed.
+        const bool is_typed = is_typing_name_filter && msg.message == WM_KEYDOWN && is_name_filter_key(msg.wParam);
+        if (is_typed || !TranslateAcceleratorW(hwnd, kb_accel, &msg))
         {
             TranslateMessage(&msg);
             DispatchMessageW(&msg);
@@ -1120,6 +3701,23 @@ LRESULT View_Window::wndproc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
                 case View_Menu_Item::Show_Image_Info:
                     handle_show_image_info_action();
                     break;
+                case View_Menu_Item::Show_Thumbnail_Grid:
+                    handle_toggle_grid_action();
+                    break;
+                case View_Menu_Item::Filter_Same_Day:
+                case View_Menu_Item::Filter_Same_Camera:
+                case View_Menu_Item::Filter_With_Location:
+                    handle_filter_action((int)result);
+                    break;
+                case View_Menu_Item::Rotate_Clockwise:
+                    rotate_current_image(Orientation::Rotate_90);
+                    break;
+                case View_Menu_Item::Rotate_Counterclockwise:
+                    rotate_current_image(Orientation::Rotate_270);
+                    break;
+                case View_Menu_Item::Save_Rotation:
+                    save_rotation();
+                    break;
                 default:
                    E_DEBUGBREAK(); // Unknown item
             }
@@ -1136,6 +3734,177 @@ LRESULT View_Window::wndproc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
             ShowWindow(hwnd, SW_SHOWNORMAL);
             return 0;
         }
+        case (UINT)View_Window_Message::Scale_Job_Finished:
+        {
+            finish_scale_job();
+            return 0;
+        }
+        case (UINT)View_Window_Message::Decode_Tiles:
+        {
+            decode_requested_tiles();
+            return 0;
+        }
+        case (UINT)View_Window_Message::Decode_Thumbnails:
+        {
+            decode_requested_thumbnails();
+            return 0;
+        }
+        case (UINT)View_Window_Message::Thumbnail_Job_Finished:
+        {
+            finish_thumbnail_job(wParam);
+            return 0;
+        }
+        case (UINT)View_Window_Message::Metadata_Read:
+        {
+            finish_metadata_extraction();
+            return 0;
+        }
+        case (UINT)View_Window_Message::Name_Index_Built:
+        {
+            finish_name_indexing();
+            return 0;
+        }
+        case (UINT)View_Window_Message::Prefetch_Page:
+        {
+            prefetch_next_page();
+            return 0;
+        }
+        case (UINT)View_Window_Message::Page_Job_Finished:
+        {
+            finish_page_job();
+            return 0;
+        }
+        case (UINT)View_Window_Message::Rotation_Job_Finished:
+        {
+            finish_rotation_job();
+            return 0;
+        }
+        case WM_CHAR:
+        {
+            if (!is_typing_name_filter)
+                break;
+
+            handle_name_filter_char(static_cast<wchar_t>(wParam));
+            return 0;
+        }
+        case WM_TIMER:
+        {
+            if (wParam == scale_timer_id)
+            {
+                KillTimer(hwnd, scale_timer_id);
+                start_scale_job();
+                return 0;
+            }
+
+            if (wParam == memory_timer_id)
+            {
+                if (g_memory_governor->is_memory_low())
+                    handle_low_memory();
+                return 0;
+            }
+
+            if (wParam == thumbnail_timer_id)
+            {
+                maintain_thumbnail_store();
+                return 0;
+            }
+
+            if (wParam == animation_timer_id)
+            {
+                present_animation_frame();
+                return 0;
+            }
+
+            break;
+        }
+        case WM_MOUSEWHEEL:
+        {
+            if (is_grid_mode)
+            {
+                // Fractional deltas of precise touchpads scroll by pixels.
+                scroll_grid_by(-GET_WHEEL_DELTA_WPARAM(wParam) * grid_wheel_rows * grid_cell_size / WHEEL_DELTA);
+                return 0;
+            }
+
+            if (current_image_levels == nullptr && current_tiled_image.is_empty())
+                break;
+
+            // Position is in screen coordinates.
+            POINT point = { GET_X_LPARAM(lParam), GET_Y_LPARAM(lParam) };
+            if (!ScreenToClient(hwnd, &point))
+                return 0;
+
+            int client_width, client_height;
+            if (!get_client_area(&client_width, &client_height))
+                return 0;
+
+            D2D1_RECT_F rect = get_current_image_rect(client_width, client_height);
+            float zoom = (rect.right - rect.left) / current_image_size.width;
+            float notches = GET_WHEEL_DELTA_WPARAM(wParam) / static_cast<float>(WHEEL_DELTA);
+            zoom_at(zoom * powf(wheel_zoom_step, notches), point.x, point.y);
+            return 0;
+        }
+        case WM_LBUTTONDBLCLK:
+        {
+            if (is_grid_mode)
+            {
+                if (get_grid_file_at(GET_X_LPARAM(lParam), GET_Y_LPARAM(lParam)) >= 0)
+                    open_grid_selection();
+                return 0;
+            }
+
+            // Toggles between 100% at the cursor and fit to window.
+            if (scaling_mode == Scaling_Mode::Percentage && scaling == 1.0f)
+            {
+                view_offset = D2D1::Point2F(0.0f, 0.0f);
+                set_scaling_mode(Scaling_Mode::Fit_To_Window, 1.0f);
+            }
+            else
+            {
+                zoom_at(1.0f, GET_X_LPARAM(lParam), GET_Y_LPARAM(lParam));
+            }
+
+            return 0;
+        }
+        case WM_LBUTTONDOWN:
+        {
+            if (is_grid_mode)
+            {
+                int position = get_grid_file_at(GET_X_LPARAM(lParam), GET_Y_LPARAM(lParam));
+                if (position >= 0)
+                    select_grid_file(position);
+                return 0;
+            }
+
+            is_panning = true;
+            pan_last_point.x = GET_X_LPARAM(lParam);
+            pan_last_point.y = GET_Y_LPARAM(lParam);
+            SetCapture(hwnd);
+            return 0;
+        }
+        case WM_MOUSEMOVE:
+        {
+            if (!is_panning)
+                break;
+
+            int x = GET_X_LPARAM(lParam);
+            int y = GET_Y_LPARAM(lParam);
+            pan_by(x - pan_last_point.x, y - pan_last_point.y);
+            pan_last_point.x = x;
+            pan_last_point.y = y;
+            return 0;
+        }
+        case WM_LBUTTONUP:
+        {
+            if (is_panning)
+                ReleaseCapture();
+            return 0;
+        }
+        case WM_CAPTURECHANGED:
+        {
+            is_panning = false;
+            return 0;
+        }
         case WM_COMMAND:
         {
             bool is_accelerator = HIWORD(wParam) == 1;
@@ -1143,6 +3912,59 @@ LRESULT View_Window::wndproc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
                 return 0;
 
             View_Shortcut key = (View_Shortcut)LOWORD(wParam);
+            if (is_grid_mode)
+            {
+                int client_width, client_height;
+                if (!get_client_area(&client_width, &client_height))
+                    return 0;
+
+                const int columns = get_grid_columns(client_width);
+                const int page = max(client_height / grid_cell_size, 1) * columns;
+
+                switch (key)
+                {
+                    case View_Shortcut::View_Prev:
+                        select_grid_file(grid_selected_index - 1);
+                        break;
+                    case View_Shortcut::View_Next:
+                        select_grid_file(grid_selected_index + 1);
+                        break;
+                    case View_Shortcut::View_First:
+                        select_grid_file(0);
+                        break;
+                    case View_Shortcut::View_Last:
+                        select_grid_file(shown_files.count - 1);
+                        break;
+                    case View_Shortcut::Grid_Up:
+                        select_grid_file(grid_selected_index - columns);
+                        break;
+                    case View_Shortcut::Grid_Down:
+                        select_grid_file(grid_selected_index + columns);
+                        break;
+                    case View_Shortcut::Page_Up:
+                        select_grid_file(grid_selected_index - page);
+                        break;
+                    case View_Shortcut::Page_Down:
+                        select_grid_file(grid_selected_index + page);
+                        break;
+                    case View_Shortcut::View_Show_File_In_Explorer:
+                    case View_Shortcut::Toggle_Thumbnail_Grid:
+                        open_grid_selection();
+                        break;
+                    case View_Shortcut::Fast_Quit:
+                        set_grid_mode(false);
+                        break;
+                    case View_Shortcut::Change_Display_Mode:
+                        handle_change_display_mode_action();
+                        break;
+                    case View_Shortcut::Filter_By_Name:
+                        start_name_filter();
+                        break;
+                }
+
+                return 0;
+            }
+
             switch (key)
             {
                 case View_Shortcut::View_Prev:
@@ -1157,6 +3979,12 @@ LRESULT View_Window::wndproc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
                 case View_Shortcut::View_Last:
                     view_last();
                     break;
+                case View_Shortcut::Page_Up:
+                    view_page(current_page - 1);
+                    break;
+                case View_Shortcut::Page_Down:
+                    view_page(current_page + 1);
+                    break;
                 case View_Shortcut::View_Show_File_In_Explorer:
                 {
                     File_Info* current = get_current_file_info();
@@ -1179,6 +4007,31 @@ LRESULT View_Window::wndproc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
                     handle_change_display_mode_action();
                     break;
                 }
+                case View_Shortcut::Toggle_Thumbnail_Grid:
+                {
+                    handle_toggle_grid_action();
+                    break;
+                }
+                case View_Shortcut::Filter_By_Name:
+                {
+                    start_name_filter();
+                    break;
+                }
+                case View_Shortcut::Rotate_Clockwise:
+                {
+                    rotate_current_image(Orientation::Rotate_90);
+                    break;
+                }
+                case View_Shortcut::Rotate_Counterclockwise:
+                {
+                    rotate_current_image(Orientation::Rotate_270);
+                    break;
+                }
+                case View_Shortcut::Save_Rotation:
+                {
+                    save_rotation();
+                    break;
+                }
             }
 
             return 0;
@@ -1188,15 +4041,64 @@ LRESULT View_Window::wndproc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
     return DefWindowProcW(hwnd, msg, wParam, lParam);
 }
 
+// Appends what's known about the photo, e.g. "  Canon EOS R5  1/250 s  f/2.8  ISO 400  50 mm  2024-05-01 12:34".
+static void append_photo_metadata(String_Builder* sb, const Photo_Metadata& metadata)
+{
+    const char* names[] = { metadata.camera, metadata.lens };
+    for (const char* name : names)
+    {
+        wchar_t name_utf16[Metadata_Index::name_capacity + 1];
+        const int count = Utf8::to_utf16(name, static_cast<int>(strlen(name)), name_utf16, Metadata_Index::name_capacity);
+        if (count <= 0)
+            continue;
+
+        name_utf16[count] = L'\0';
+        sb->append(L"  ", static_cast<const wchar_t*>(name_utf16));
+    }
+
+    if (metadata.exposure_time > 0.0f && metadata.exposure_time < 0.5f)
+        sb->append(L"  1/", static_cast<int>(1.0f / metadata.exposure_time + 0.5f), L" s");
+    else if (metadata.exposure_time > 0.0f)
+        sb->append(L"  ", format_fixed(metadata.exposure_time, 1), L" s");
+    if (metadata.f_number > 0.0f)
+        sb->append(L"  f/", format_fixed(metadata.f_number, 1));
+    if (metadata.iso > 0)
+        sb->append(L"  ISO ", metadata.iso);
+    if (metadata.focal_length > 0.0f)
+        sb->append(L"  ", static_cast<int>(metadata.focal_length + 0.5f), L" mm");
+
+    SYSTEMTIME date;
+    const FILETIME date_taken = { static_cast<DWORD>(metadata.date_taken), static_cast<DWORD>(metadata.date_taken >> 32) };
+    if (metadata.date_taken != 0 && FileTimeToSystemTime(&date_taken, &date))
+        sb->append_format(L"  %04u-%02u-%02u %02u:%02u", date.wYear, date.wMonth, date.wDay, date.wHour, date.wMinute);
+
+    if (metadata.rating < 0)
+    {
+        sb->append(L"  rejected");
+    }
+    else if (metadata.rating > 0)
+    {
+        sb->append(L"  ");
+        for (int i = 0; i < metadata.rating; ++i)
+            sb->append(L'\x2605');
+    }
+}
+
 HRESULT View_Window::draw_current_image_info()
 {
-    Temporary_Allocator_Guard g;
-    String_Builder sb{ g_temporary_allocator };
+    // Called on every frame, so format into stack buffer instead of allocating.
+    wchar_t text[256];
+    String_Builder sb{ text, ARRAYSIZE(text) };
 
-    D2D1_SIZE_F size = current_image_direct2d->GetSize();
+    D2D1_SIZE_F size = current_image_size;
 
     sb.begin();
-    sb.append_format(L"%dx%d", (int)size.width, (int)size.height);
+    sb.append((int)size.width, L'x', (int)size.height);
+
+    Photo_Metadata metadata;
+    if (metadata_index.get(current_file_index, &metadata))
+        append_photo_metadata(&sb, metadata);
+
     if (!sb.end())
         return E_OUTOFMEMORY;
 
@@ -1219,6 +4121,44 @@ HRESULT View_Window::draw_current_image_info()
     return S_OK;
 }
 
+HRESULT View_Window::draw_name_filter()
+{
+    wchar_t text[Name_Index::max_query_length + 32];
+    String_Builder sb{ text, ARRAYSIZE(text) };
+
+    // Cursor is shown while it's typed, count of shown files always.
+    sb.begin();
+    sb.append(L"Name: ");
+    for (int i = 0; i < name_filter_length; ++i)
+        sb.append(name_filter[i]);
+    if (is_typing_name_filter)
+        sb.append(L'_');
+    sb.append(L"  (", shown_files.count, L')');
+    if (!sb.end())
+        return E_OUTOFMEMORY;
+
+    const float shadow_offset = 1.1f;
+    const float margin_left = 4.0f;
+    const float margin_bottom = 4.0f;
+
+    D2D1_RECT_F area = client_area_as_rectf();
+    area.left += margin_left + shadow_offset;
+    area.bottom -= margin_bottom - shadow_offset;
+
+    // Same text format as image info, aligned to the bottom of the window.
+    image_info_text_format->SetParagraphAlignment(DWRITE_PARAGRAPH_ALIGNMENT_FAR);
+    defer(image_info_text_format->SetParagraphAlignment(DWRITE_PARAGRAPH_ALIGNMENT_NEAR));
+
+    hwnd_target->DrawTextW(sb.buffer, sb.count, image_info_text_format, area, image_info_text_shadow_brush);
+
+    area.left -= shadow_offset;
+    area.bottom -= shadow_offset;
+
+    hwnd_target->DrawTextW(sb.buffer, sb.count, image_info_text_format, area, image_info_text_brush);
+
+    return S_OK;
+}
+
 D2D1_RECT_F View_Window::client_area_as_rectf()
 {
     RECT client_area;
@@ -1312,7 +4252,7 @@ void View_Window::error_box(HRESULT hr)
     sb.begin();
     sb.append_string(L"Error: ");
     sb.append_string(hresult_to_string(hr));
-    sb.append_format(L"\n\nHRESULT: %#010x", hr);
+    sb.append(L"\n\nHRESULT: ", format_hex(static_cast<unsigned long>(hr), 8));
     if (!sb.end())
         MessageBoxW(0, L"Got an error, but cannot format it.", L"Error", MB_OK | MB_ICONERROR);
     else
@@ -1354,7 +4294,11 @@ start:
     hwnd_target->BeginDraw();
     hwnd_target->Clear(D2D1::ColorF(0.0f, 0.0f, 0.0f, 0.0f));
 
-    if (current_image_direct2d == nullptr)
+    if (is_grid_mode)
+    {
+        draw_thumbnail_grid();
+    }
+    else if (current_image_levels == nullptr && current_tiled_image.is_empty() && preview_image_direct2d == nullptr)
     {
         draw_placeholder();
     }
@@ -1363,10 +4307,17 @@ start:
         draw_current_image();
     }
 
+    if (is_typing_name_filter || name_filter_length > 0)
+        draw_name_filter();
+
     hr = hwnd_target->EndDraw();
     if (SUCCEEDED(hr))
     {
         ValidateRect(hwnd, nullptr);
+
+        // Posted messages come before paint, so the next page isn't decoded until this one is on screen.
+        if (is_prefetch_page_requested && !is_grid_mode)
+            is_prefetch_page_requested = PostMessageW(hwnd, (UINT)View_Window_Message::Prefetch_Page, 0, 0) == FALSE;
     }
     else
     {
@@ -1450,6 +4401,11 @@ HRESULT View_Window::create_graphics_resources()
     if (FAILED(hr))
         goto fail;
 
+    // Create brush of thumbnail grid cells that are not loaded yet
+    hr = hwnd_target->CreateSolidColorBrush(D2D1::ColorF(1.0f, 1.0f, 1.0f, 0.1f), &grid_cell_brush);
+    if (FAILED(hr))
+        goto fail;
+
     return S_OK;
 
 fail:
@@ -1462,8 +4418,16 @@ void View_Window::discard_graphics_resources()
     safe_release(image_info_text_format);
     safe_release(image_info_text_brush);
     safe_release(image_info_text_shadow_brush);
+    safe_release(grid_cell_brush);
     safe_release(default_text_foreground_brush);
     safe_release(default_text_format);
+    // Bitmaps belong to the render target, they are created again from current image pixels.
+    safe_release(current_image_direct2d);
+    safe_release(scaled_image_direct2d);
+    safe_release(preview_image_direct2d);
+    safe_release(animation_direct2d);
+    current_tiled_image.release_bitmaps();
+    thumbnail_atlas.release_bitmaps();
     safe_release(hwnd_target);
 }
 
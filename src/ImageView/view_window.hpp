@@ -4,7 +4,18 @@
 #include <Shobjidl.h>
 
 #include "file_system_utility.hpp"
+#include "utf8_string.hpp"
 #include "graphics_utility.hpp"
+#include "ycbcr_conversion.hpp"
+#include "resampler.hpp"
+#include "job_pool.hpp"
+#include "image_cache.hpp"
+#include "tiled_image.hpp"
+#include "thumbnail_atlas.hpp"
+#include "metadata_index.hpp"
+#include "name_index.hpp"
+#include "frame_index.hpp"
+#include "animation.hpp"
 #include "view_window_drop_target.hpp"
 
 
@@ -33,6 +44,78 @@ struct Image_Info
     String path;
 };
 
+// Current image being resampled to display size on the job pool.
+struct Scale_Job
+{
+    Job_Group group;
+    HWND hwnd = 0;
+    const Image_Buffer* source = nullptr;
+    Image_Buffer result;
+    Resample_Filter filter = Resample_Filter::Lanczos3;
+    bool linear_light = false;
+    bool succeeded = false;
+};
+
+// Thumbnail of a file of the thumbnail grid being decoded on the job pool.
+struct Thumbnail_Job
+{
+    static const int max_running = 4;
+
+    Job_Group group;
+    HWND hwnd = 0;
+    IWICImagingFactory* wic = nullptr;
+    // Index into the window's jobs, posted back with the message.
+    WPARAM slot = 0;
+    // Absolute path, owned by the job.
+    String path;
+    int file_index = -1;
+    // Files are indexed differently after 'thumbnail_generation' changes, results from before are dropped.
+    UINT generation = 0;
+    // Set when the file is not requested anymore, the job is skipped if it hasn't started yet.
+    volatile LONG is_cancelled = 0;
+    Image_Buffer result;
+    HRESULT hr = S_OK;
+    bool is_running = false;
+};
+
+// Next page of the current file, decoded on the job pool while the current one is looked at.
+struct Page_Job
+{
+    Job_Group group;
+    HWND hwnd = 0;
+    IWICImagingFactory* wic = nullptr;
+    Chroma_Upsampling chroma_upsampling = Chroma_Upsampling::Fancy;
+    // Absolute path, owned by the job.
+    String path;
+    FILETIME date_modified = { 0 };
+    UINT frame = 0;
+    // Frames that would be tiled, or would push other images out of the cache, are decoded when they're viewed.
+    UINT max_size = 0;
+    UINT64 max_decoded_size = 0;
+    volatile LONG is_cancelled = 0;
+    Mip_Pyramid result;
+    // S_FALSE when the frame is left to be decoded when it's viewed.
+    HRESULT hr = S_OK;
+    bool is_running = false;
+    // Result is put into the image cache once the scale job is not using it.
+    bool is_finished = false;
+};
+
+// Rotation of a JPEG being saved on the job pool. It's not cancelled, the file is replaced only once
+// the new one is fully written.
+struct Rotation_Job
+{
+    Job_Group group;
+    HWND hwnd = 0;
+    // Absolute path, owned by the job.
+    String path;
+    Orientation orientation = Orientation::Normal;
+    // Edges that don't fill a whole MCU are dropped only once the user agrees, the job is run again then.
+    bool trim = false;
+    HRESULT hr = S_OK;
+    bool is_running = false;
+};
+
 struct View_Window_Init_Params
 {
     // Forwarded from wWinMain
@@ -61,6 +144,8 @@ enum class Sort_Mode
     Date_Created = 1,
     Date_Accessed = 2,
     Date_Modified = 3,
+    // From photo metadata, files without it are sorted by date modified.
+    Date_Taken = 4,
     NUM_MODES
 };
 
@@ -124,15 +209,98 @@ struct View_Window
     ID2D1SolidColorBrush* image_info_text_shadow_brush = nullptr;
 
     D2D1_SIZE_F current_image_size;
+    // Created from level 0 of 'current_image_levels' when image is drawn unscaled.
     ID2D1Bitmap* current_image_direct2d = nullptr;
+    // Decoded image and its mip levels, owned by g_image_cache. Scaled images are resampled from the nearest level.
+    Mip_Pyramid* current_image_levels = nullptr;
+    // Current image resampled to display size, drawn 1:1. While window is being resized it's
+    // stretched until a new one is resampled in the background.
+    ID2D1Bitmap* scaled_image_direct2d = nullptr;
+    // Preview embedded in the file, drawn while the image is decoded and under tiles that are not decoded yet.
+    ID2D1Bitmap* preview_image_direct2d = nullptr;
+    Scale_Job scale_job;
+    bool is_scale_job_running = false;
+    UINT requested_scale_width = 0;
+    UINT requested_scale_height = 0;
+    // Used instead of 'current_image_levels' when image is too large to decode at once. Visible tiles
+    // are decoded while the window is idle, see 'decode_requested_tiles'.
+    Tiled_Image current_tiled_image;
+    // Tiles are decoded as they're stored and turned by EXIF orientation when they're drawn.
+    Orientation current_tiled_orientation = Orientation::Normal;
+    // Block compressed DDS texture 'current_tiled_image' decodes its tiles from, see 'set_current_dds_image'.
+    Dds_Image current_dds;
+    size_t tile_cache_budget = 256 * 1024 * 1024;
+    bool is_decode_tiles_posted = false;
     IWICBitmapDecoder* decoder = nullptr;
+    // Pages of the current file, 'decoder' is kept while one is viewed to decode the others. The next
+    // page is decoded into the image cache once the current one is drawn, see 'prefetch_next_page'.
+    // Pages of a file being opened are listed in 'opened_frames', they become current once it's shown.
+    Frame_Index current_frames;
+    Frame_Index opened_frames;
+    int current_page = 0;
+    Page_Job page_job;
+    Rotation_Job rotation_job;
+    // Decoder frame of the current page, image cache key of 'current_image_levels'.
+    UINT current_frame = 0;
+    bool is_prefetch_page_requested = false;
+    // Playback of the current image when it's an animated GIF. Its composed frames are drawn instead of
+    // 'current_image_levels' from the first one that is presented.
+    Animation animation;
+    ID2D1Bitmap* animation_direct2d = nullptr;
+    // When the presented frame is due. Delays are counted from it, so late timer messages don't slow the animation down.
+    double animation_due_ms = 0.0;
+    Chroma_Upsampling chroma_upsampling = Chroma_Upsampling::Fancy;
+    Resample_Filter resample_filter = Resample_Filter::Lanczos3;
+    bool resample_in_linear_light = false;
     
-    //Sort_Mode sort_mode = Sort_Mode::Undefined;
-    //Sort_Order sort_order = Sort_Order::Undefined;
+    Sort_Mode sort_mode = Sort_Mode::Date_Created;
+    Sort_Order sort_order = Sort_Order::Descending;
+
+    // Photo metadata of 'current_files', read in the background. Files shown while a filter is set are
+    // in 'shown_files' as indices of 'current_files', in their order. Without a filter all of them are.
+    Metadata_Index metadata_index;
+    Metadata_Filter metadata_filter;
+    Sequence<int> shown_files;
+
+    // Name filter typed after Ctrl+F. Files whose names contain it are in 'name_matches' as ascending
+    // indices of 'current_files', the shown ones are those that pass the metadata filter too. Matches of
+    // shorter filters are kept there, so Backspace doesn't search.
+    Name_Index name_index;
+    wchar_t name_filter[Name_Index::max_query_length];
+    int name_filter_length = 0;
+    bool is_typing_name_filter = false;
+    Name_Matches name_matches;
 
     // Scaling
-    Scaling_Mode scaling_mode = Scaling_Mode::No_Scaling;
+    Scaling_Mode scaling_mode = Scaling_Mode::Fit_To_Window;
     float scaling = 1.0f;
+    // Scaling from settings, every image is shown with it until it's zoomed.
+    Scaling_Mode settings_scaling_mode = Scaling_Mode::Fit_To_Window;
+    float settings_scaling = 1.0f;
+
+    // Viewport, offset of image center from client area center in pixels.
+    D2D1_POINT_2F view_offset = { 0.0f, 0.0f };
+    bool is_panning = false;
+    POINT pan_last_point = { 0, 0 };
+    // Sign of the last pan movement, tiles ahead in this direction are prefetched.
+    int pan_direction_x = 0;
+    int pan_direction_y = 0;
+
+    // Thumbnail grid, shown instead of the current image. Only visible rows are drawn, their thumbnails
+    // are read from the thumbnail store or decoded on the job pool, see 'decode_requested_thumbnails'.
+    bool is_grid_mode = false;
+    Thumbnail_Atlas thumbnail_atlas;
+    Thumbnail_Job thumbnail_jobs[Thumbnail_Job::max_running];
+    // Advanced whenever file indices of the atlas change.
+    UINT thumbnail_generation = 0;
+    // Distance of the top of the grid above the top of the client area in pixels.
+    int grid_scroll_y = 0;
+    // Sign of the last scroll, rows ahead in this direction are loaded before rows behind.
+    int grid_scroll_direction = 0;
+    // Index into 'shown_files'.
+    int grid_selected_index = 0;
+    bool is_decode_thumbnails_posted = false;
+    ID2D1SolidColorBrush* grid_cell_brush = nullptr;
 
     // Display mode
     Display_Mode display_mode = Display_Mode::Windowed;
@@ -150,6 +318,7 @@ struct View_Window
     bool shutdown();
 
     void load_and_apply_settings();
+    bool apply_setting(const Utf8_String& key, const Utf8_String& value);
 
     void load_path(const String& file_path);
     
@@ -158,36 +327,137 @@ struct View_Window
     void view_first();
     void view_last();
     void view_file_index(int index);
+    // Views 'page' of the current file, in the frame that fits the display.
+    void view_page(int page);
+    UINT choose_page_frame(const Frame_Index& frames, int page) const;
+    // Decodes the page after the current one into the image cache on the job pool, if it fits there
+    // without evicting anything.
+    void prefetch_next_page();
+    void finish_page_job();
+    // Puts the decoded page into the image cache, returns false if the scale job is using it.
+    bool insert_prefetched_page();
+    void cancel_page_job();
 
     void update_view_title();
 
     String get_file_info_absolute_path(const String& folder, const File_Info* file_info, IAllocator* allocator);
 
-    bool set_current_image(IWICBitmapDecoder* image);
+    bool set_current_image(IWICBitmapDecoder* image, const String& path, const FILETIME& date_modified, UINT frame);
+    // Decodes 'frame' of 'width' x 'height' pixels of file at 'path' with its mip levels, turned by 'orientation'.
+    // 'is_jpeg' is true if the file was decoded as a JPEG, whatever its extension, it's decoded in bands then.
+    bool decode_frame(IWICBitmapFrameDecode* frame, const String& path, bool is_jpeg, UINT width, UINT height,
+        Orientation orientation, Mip_Pyramid* image);
+    bool set_current_image(Mip_Pyramid* image);
+    // Shows block compressed DDS texture in tiles decoded from its own mip levels. Returns false if it's
+    // in another format, WIC decodes it then.
+    bool set_current_dds_image(const String& path);
+    void show_current_image(Mip_Pyramid* image);
     bool get_client_area(int* width, int* height);
     bool release_current_image();
+    // Plays the current image if it's an animated GIF.
+    void start_animation(const String& path);
+    void stop_animation();
+    // Draws the next composed frame of the animation and sets the timer for the one after it.
+    void present_animation_frame();
+    // Creates 'preview_image_direct2d' from a preview embedded in JPEG, if it has the aspect ratio of the
+    // 'width' x 'height' image as it's stored. Preview is turned by 'orientation' like the image is.
+    void load_embedded_preview(const String& path, UINT width, UINT height, Orientation orientation);
+    // Turns the current image by 'turn' in the image cache, the file is not changed until 'save_rotation'.
+    void rotate_current_image(Orientation turn);
+    // Rewrites the current JPEG the way it's shown, without loss, on the job pool. It's viewed again
+    // once it's saved, see 'finish_rotation_job'.
+    void save_rotation();
+    void finish_rotation_job();
+    // Waits for the file to be written.
+    void cancel_rotation_job();
     
     // Menus
     bool handle_open_file_action();
     void handle_show_image_info_action();
     void handle_change_display_mode_action();
     void handle_copy_filename_to_clipboard_menu_item();
+    void handle_toggle_grid_action();
+    // Toggles a filter of the filter menu items, its value is taken from the current file.
+    void handle_filter_action(int menu_item);
 
     int  find_file_info_by_path(const String& path);
 
+    // Filter
+    // Rebuilds 'shown_files' for the filter and selects 'selected_index', or the shown file after it, in the grid.
+    void update_shown_files(int selected_index);
+    // Position of file at 'index' in 'shown_files', or -1 if it's filtered out.
+    int find_shown_position(int index) const;
+    void start_metadata_extraction();
+    void finish_metadata_extraction();
+
+    // Name filter
+    // Shows the grid and starts typing the name filter.
+    void start_name_filter();
+    // Handles a character typed while the name filter is typed, Escape clears it and Enter opens the selection.
+    void handle_name_filter_char(wchar_t c);
+    // Finds files matching 'name_filter'.
+    void update_name_matches();
+    void finish_name_indexing();
+
     // Scaling
     HRESULT set_scaling_mode(Scaling_Mode mode, float scaling);
 
+    // Viewport
+    D2D1_RECT_F get_current_image_rect(int client_width, int client_height);
+    void reset_view();
+    void zoom_at(float zoom, int x, int y);
+    void pan_by(int dx, int dy);
+
+    // Thumbnail grid
+    void set_grid_mode(bool enabled);
+    void reset_thumbnail_grid();
+    int get_grid_columns(int client_width) const;
+    // Position in 'shown_files' of the cell at client coordinates, or -1.
+    int get_grid_file_at(int x, int y);
+    void scroll_grid_by(int dy);
+    // Selects file at 'position' of 'shown_files' and scrolls the grid so it's visible.
+    void select_grid_file(int position);
+    // Index of the file selected in the grid, or -1.
+    int get_grid_selected_file() const;
+    // Leaves the grid and views the selected file.
+    void open_grid_selection();
+
     // Display mode
     HRESULT set_display_mode(Display_Mode mode);
     
     // Draw states
     HRESULT draw_current_image();
+    HRESULT create_current_image_bitmap();
+    void request_scaled_image(UINT width, UINT height);
+    void start_scale_job();
+    void finish_scale_job();
+    void cancel_scale_job();
+    HRESULT draw_tiled_image(const D2D1_RECT_F& dest_rect, int client_width, int client_height);
+    HRESULT draw_tile(int level, int x, int y, const D2D1_RECT_F& dest_rect, bool* is_exact);
+    void decode_requested_tiles();
+    void handle_low_memory();
+    void open_thumbnail_store();
+    void open_metadata_cache();
+    // Stores thumbnail of the current image, unless it's already stored.
+    void store_thumbnail(const String& path, const File_Info& file);
+    // Commits stored thumbnails and starts or finishes compaction.
+    void maintain_thumbnail_store();
+    HRESULT draw_thumbnail_grid();
+    // Puts thumbnail of file at 'index' from the thumbnail store to the atlas and sets 'cell', which is -1
+    // if the atlas is full. Returns false if the store doesn't have it.
+    bool load_stored_thumbnail(int index, int* cell);
+    // Pops requested thumbnails, reads those in the store and starts jobs for the rest, visible ones first.
+    void decode_requested_thumbnails();
+    bool start_thumbnail_job(Thumbnail_Job* job, int index);
+    // Stores and shows thumbnail of the job posted by its 'slot', then starts more jobs.
+    void finish_thumbnail_job(WPARAM slot);
+    // Waits for all thumbnail jobs and drops their results.
+    void cancel_thumbnail_jobs();
     HRESULT draw_placeholder();
     HRESULT draw_current_image_info();
+    HRESULT draw_name_filter();
 
     HRESULT sort_current_images(Sort_Mode mode, Sort_Order order);
-    HRESULT create_decoder_from_file_path(const String& file_path, IWICBitmapDecoder** decoder);
 
     int enter_message_loop();
     LRESULT __stdcall wndproc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam);
@@ -1,9 +1,13 @@
 #include <wchar.h>
+#include <Windows.h>
+#include <Psapi.h>
 
 #include "windows_utility.hpp"
 #include "error.hpp"
 #include "defer.hpp"
 
+#pragma comment(lib, "Psapi.lib")
+
 HRESULT Windows_Utility::error_to_string(DWORD windows_error, String_Builder& builder)
 {
     E_VERIFY_R(builder.is_begin_called, E_INVALIDARG);
@@ -44,3 +48,28 @@ HRESULT Windows_Utility::error_to_string(DWORD windows_error, String_Builder& bu
 
     return E_FAIL;
 }
+
+bool Windows_Utility::get_working_set(size_t* current, size_t* peak)
+{
+    E_VERIFY_NULL_R(current, false);
+    E_VERIFY_NULL_R(peak, false);
+
+    PROCESS_MEMORY_COUNTERS counters = {};
+    counters.cb = sizeof(counters);
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return false;
+
+    *current = counters.WorkingSetSize;
+    *peak = counters.PeakWorkingSetSize;
+    return true;
+}
+
+double Windows_Utility::get_time_ms()
+{
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+
+    return static_cast<double>(counter.QuadPart) * 1000.0 / static_cast<double>(frequency.QuadPart);
+}
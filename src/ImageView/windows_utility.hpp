@@ -7,4 +7,8 @@
 struct Windows_Utility
 {
     static HRESULT error_to_string(DWORD windows_error, String_Builder& builder);
+    // Current and peak working set of this process in bytes.
+    static bool get_working_set(size_t* current, size_t* peak);
+    // Milliseconds from an arbitrary point, read from the performance counter. Only differences are meaningful.
+    static double get_time_ms();
 };
\ No newline at end of file
@@ -0,0 +1,549 @@
+#include <Windows.h>
+#include <string.h>
+
+#include "ycbcr_conversion.hpp"
+#include "cpu_features.hpp"
+#include "allocator.hpp"
+#include "defer.hpp"
+#include "error.hpp"
+
+#if CPU_X86
+    #include <intrin.h>
+    #include <immintrin.h>
+#elif CPU_ARM
+    #include <arm_neon.h>
+#endif
+
+typedef void (*Convert_Ycbcr_Row_Func)(const Ycbcr_Row& row, int first, int count, UINT32* destination);
+
+// JFIF coefficients divided by 4 in Q15, chroma is multiplied by 4 before multiplication to keep precision.
+// Every implementation computes (a * b + 0x4000) >> 15, which is what pmulhrsw and vqrdmulh do.
+static const int cr_to_r = 11485; // 1.402
+static const int cb_to_g = 2819;  // 0.344136
+static const int cr_to_g = 5850;  // 0.714136
+static const int cb_to_b = 14516; // 1.772
+
+// Luma bytes read from the planar transform at once, chroma planes take up to as much again.
+static const UINT plane_strip_size = 1024 * 1024;
+
+
+#pragma region Scalar
+static inline int mul_q15(int a, int b)
+{
+    return (a * b + 0x4000) >> 15;
+}
+
+static inline UINT32 clamp_to_byte(int value)
+{
+    return value < 0 ? 0 : (value > 255 ? 255 : static_cast<UINT32>(value));
+}
+
+static inline UINT32 ycbcr_to_pbgra(int y, int cb, int cr)
+{
+    int cb4 = (cb - 128) * 4;
+    int cr4 = (cr - 128) * 4;
+
+    UINT32 r = clamp_to_byte(y + mul_q15(cr4, cr_to_r));
+    UINT32 g = clamp_to_byte(y - mul_q15(cb4, cb_to_g) - mul_q15(cr4, cr_to_g));
+    UINT32 b = clamp_to_byte(y + mul_q15(cb4, cb_to_b));
+
+    return 0xFF000000 | (r << 16) | (g << 8) | b;
+}
+
+// Returns chroma value for pixel 'x'.
+template<int Chroma_X, bool Fancy>
+static inline int upsample_scalar(const BYTE* near_row, const BYTE* far_row, int chroma_count, int x)
+{
+    int j = x / Chroma_X;
+    if (!Fancy)
+        return near_row[j];
+
+    // Vertical filter, 3/4 of nearest row and 1/4 of the other one.
+    int sum = 3 * near_row[j] + far_row[j];
+    if (Chroma_X == 1)
+        return (sum + 2) >> 2;
+
+    // Horizontal filter, 3/4 of nearest column and 1/4 of the column on the same side as pixel.
+    int k = (x & 1) ? min(j + 1, chroma_count - 1) : max(j - 1, 0);
+    int neighbour_sum = 3 * near_row[k] + far_row[k];
+
+    return (3 * sum + neighbour_sum + ((x & 1) ? 7 : 8)) >> 4;
+}
+
+template<int Chroma_X, bool Fancy>
+static void convert_ycbcr_row_scalar(const Ycbcr_Row& row, int first, int count, UINT32* destination)
+{
+    for (int i = 0; i < count; ++i)
+    {
+        int x = first + i;
+        int cb = upsample_scalar<Chroma_X, Fancy>(row.cb_near, row.cb_far, row.chroma_count, x);
+        int cr = upsample_scalar<Chroma_X, Fancy>(row.cr_near, row.cr_far, row.chroma_count, x);
+
+        destination[i] = ycbcr_to_pbgra(row.y[x], cb, cr);
+    }
+}
+#pragma endregion
+
+// Range of pixels, where 16 pixel SIMD blocks can be used without reading outside of chroma rows.
+template<int Chroma_X, bool Fancy>
+static inline void get_block_range(const Ycbcr_Row& row, int first, int count, int* block_first, int* block_last)
+{
+    // Fancy horizontal filter reads one chroma sample before and after the block.
+    int begin = (Chroma_X == 2 && Fancy) ? 2 : 0;
+    if (begin < first)
+        begin = first + (first & (Chroma_X - 1));
+
+    int last;
+    if (Chroma_X == 2)
+        last = 2 * (row.chroma_count - (Fancy ? 9 : 8));
+    else
+        last = row.chroma_count - 16;
+
+    // Block starting at 'last' must also end within the output range.
+    if (last > first + count - 16)
+        last = first + count - 16;
+
+    *block_first = begin;
+    *block_last = last;
+}
+
+#if CPU_X86
+#pragma region SSSE3
+// Returns column sums (3 * near + far) of 8 chroma samples starting at 'j'.
+static inline __m128i column_sum_ssse3(const BYTE* near_row, const BYTE* far_row, int j)
+{
+    const __m128i zero = _mm_setzero_si128();
+
+    __m128i n = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(near_row + j)), zero);
+    __m128i f = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(far_row + j)), zero);
+
+    return _mm_add_epi16(_mm_add_epi16(n, _mm_add_epi16(n, n)), f);
+}
+
+// Upsamples chroma of 16 pixels starting at 'x' to 16-bit values, pixels 0-7 go to 'lo' and 8-15 to 'hi'.
+template<int Chroma_X, bool Fancy>
+static inline void upsample_ssse3(const BYTE* near_row, const BYTE* far_row, int x, __m128i* lo, __m128i* hi)
+{
+    const __m128i zero = _mm_setzero_si128();
+
+    if (Chroma_X == 2)
+    {
+        int j = x / 2;
+        if (Fancy)
+        {
+            __m128i sum  = column_sum_ssse3(near_row, far_row, j);
+            __m128i prev = column_sum_ssse3(near_row, far_row, j - 1);
+            __m128i next = column_sum_ssse3(near_row, far_row, j + 1);
+            __m128i sum3 = _mm_add_epi16(sum, _mm_add_epi16(sum, sum));
+
+            __m128i even = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(sum3, prev), _mm_set1_epi16(8)), 4);
+            __m128i odd  = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(sum3, next), _mm_set1_epi16(7)), 4);
+
+            *lo = _mm_unpacklo_epi16(even, odd);
+            *hi = _mm_unpackhi_epi16(even, odd);
+        }
+        else
+        {
+            __m128i c = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(near_row + j)), zero);
+
+            *lo = _mm_unpacklo_epi16(c, c);
+            *hi = _mm_unpackhi_epi16(c, c);
+        }
+    }
+    else
+    {
+        __m128i n = _mm_loadu_si128(reinterpret_cast<const __m128i*>(near_row + x));
+        if (Fancy)
+        {
+            __m128i f = _mm_loadu_si128(reinterpret_cast<const __m128i*>(far_row + x));
+            __m128i n_lo = _mm_unpacklo_epi8(n, zero);
+            __m128i n_hi = _mm_unpackhi_epi8(n, zero);
+            __m128i bias = _mm_set1_epi16(2);
+
+            __m128i sum_lo = _mm_add_epi16(_mm_add_epi16(n_lo, _mm_add_epi16(n_lo, n_lo)), _mm_unpacklo_epi8(f, zero));
+            __m128i sum_hi = _mm_add_epi16(_mm_add_epi16(n_hi, _mm_add_epi16(n_hi, n_hi)), _mm_unpackhi_epi8(f, zero));
+
+            *lo = _mm_srli_epi16(_mm_add_epi16(sum_lo, bias), 2);
+            *hi = _mm_srli_epi16(_mm_add_epi16(sum_hi, bias), 2);
+        }
+        else
+        {
+            *lo = _mm_unpacklo_epi8(n, zero);
+            *hi = _mm_unpackhi_epi8(n, zero);
+        }
+    }
+}
+
+// Converts 8 pixels, result is 16-bit and not clamped yet.
+static inline void ycbcr_to_rgb_ssse3(__m128i y, __m128i cb, __m128i cr, __m128i* r, __m128i* g, __m128i* b)
+{
+    const __m128i bias = _mm_set1_epi16(128);
+
+    cb = _mm_slli_epi16(_mm_sub_epi16(cb, bias), 2);
+    cr = _mm_slli_epi16(_mm_sub_epi16(cr, bias), 2);
+
+    *r = _mm_add_epi16(y, _mm_mulhrs_epi16(cr, _mm_set1_epi16(cr_to_r)));
+    *g = _mm_sub_epi16(_mm_sub_epi16(y, _mm_mulhrs_epi16(cb, _mm_set1_epi16(cb_to_g))), _mm_mulhrs_epi16(cr, _mm_set1_epi16(cr_to_g)));
+    *b = _mm_add_epi16(y, _mm_mulhrs_epi16(cb, _mm_set1_epi16(cb_to_b)));
+}
+
+template<int Chroma_X, bool Fancy>
+static void convert_ycbcr_row_ssse3(const Ycbcr_Row& row, int first, int count, UINT32* destination)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i alpha = _mm_set1_epi8(-1);
+
+    int block_first, block_last;
+    get_block_range<Chroma_X, Fancy>(row, first, count, &block_first, &block_last);
+    if (block_first > block_last)
+    {
+        convert_ycbcr_row_scalar<Chroma_X, Fancy>(row, first, count, destination);
+        return;
+    }
+
+    convert_ycbcr_row_scalar<Chroma_X, Fancy>(row, first, block_first - first, destination);
+
+    int x = block_first;
+    for (; x <= block_last; x += 16)
+    {
+        __m128i cb_lo, cb_hi, cr_lo, cr_hi;
+        upsample_ssse3<Chroma_X, Fancy>(row.cb_near, row.cb_far, x, &cb_lo, &cb_hi);
+        upsample_ssse3<Chroma_X, Fancy>(row.cr_near, row.cr_far, x, &cr_lo, &cr_hi);
+
+        __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row.y + x));
+
+        __m128i r_lo, g_lo, b_lo, r_hi, g_hi, b_hi;
+        ycbcr_to_rgb_ssse3(_mm_unpacklo_epi8(y, zero), cb_lo, cr_lo, &r_lo, &g_lo, &b_lo);
+        ycbcr_to_rgb_ssse3(_mm_unpackhi_epi8(y, zero), cb_hi, cr_hi, &r_hi, &g_hi, &b_hi);
+
+        __m128i r = _mm_packus_epi16(r_lo, r_hi);
+        __m128i g = _mm_packus_epi16(g_lo, g_hi);
+        __m128i b = _mm_packus_epi16(b_lo, b_hi);
+
+        __m128i bg_lo = _mm_unpacklo_epi8(b, g);
+        __m128i bg_hi = _mm_unpackhi_epi8(b, g);
+        __m128i ra_lo = _mm_unpacklo_epi8(r, alpha);
+        __m128i ra_hi = _mm_unpackhi_epi8(r, alpha);
+
+        __m128i* out = reinterpret_cast<__m128i*>(destination + (x - first));
+        _mm_storeu_si128(out + 0, _mm_unpacklo_epi16(bg_lo, ra_lo));
+        _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(bg_lo, ra_lo));
+        _mm_storeu_si128(out + 2, _mm_unpacklo_epi16(bg_hi, ra_hi));
+        _mm_storeu_si128(out + 3, _mm_unpackhi_epi16(bg_hi, ra_hi));
+    }
+
+    convert_ycbcr_row_scalar<Chroma_X, Fancy>(row, x, first + count - x, destination + (x - first));
+}
+#pragma endregion
+#endif
+
+#if CPU_ARM
+#pragma region NEON
+static inline int16x8_t column_sum_neon(const BYTE* near_row, const BYTE* far_row, int j)
+{
+    uint16x8_t n = vmovl_u8(vld1_u8(near_row + j));
+    uint16x8_t f = vmovl_u8(vld1_u8(far_row + j));
+
+    return vreinterpretq_s16_u16(vmlaq_n_u16(f, n, 3));
+}
+
+template<int Chroma_X, bool Fancy>
+static inline void upsample_neon(const BYTE* near_row, const BYTE* far_row, int x, int16x8_t* lo, int16x8_t* hi)
+{
+    if (Chroma_X == 2)
+    {
+        int j = x / 2;
+        if (Fancy)
+        {
+            int16x8_t sum  = column_sum_neon(near_row, far_row, j);
+            int16x8_t prev = column_sum_neon(near_row, far_row, j - 1);
+            int16x8_t next = column_sum_neon(near_row, far_row, j + 1);
+            int16x8_t sum3 = vmulq_n_s16(sum, 3);
+
+            int16x8_t even = vshrq_n_s16(vaddq_s16(vaddq_s16(sum3, prev), vdupq_n_s16(8)), 4);
+            int16x8_t odd  = vshrq_n_s16(vaddq_s16(vaddq_s16(sum3, next), vdupq_n_s16(7)), 4);
+
+            int16x8x2_t zipped = vzipq_s16(even, odd);
+            *lo = zipped.val[0];
+            *hi = zipped.val[1];
+        }
+        else
+        {
+            int16x8_t c = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(near_row + j)));
+
+            int16x8x2_t zipped = vzipq_s16(c, c);
+            *lo = zipped.val[0];
+            *hi = zipped.val[1];
+        }
+    }
+    else
+    {
+        uint8x16_t n = vld1q_u8(near_row + x);
+        if (Fancy)
+        {
+            uint8x16_t f = vld1q_u8(far_row + x);
+            uint16x8_t sum_lo = vmlaq_n_u16(vmovl_u8(vget_low_u8(f)),  vmovl_u8(vget_low_u8(n)),  3);
+            uint16x8_t sum_hi = vmlaq_n_u16(vmovl_u8(vget_high_u8(f)), vmovl_u8(vget_high_u8(n)), 3);
+
+            *lo = vreinterpretq_s16_u16(vshrq_n_u16(vaddq_u16(sum_lo, vdupq_n_u16(2)), 2));
+            *hi = vreinterpretq_s16_u16(vshrq_n_u16(vaddq_u16(sum_hi, vdupq_n_u16(2)), 2));
+        }
+        else
+        {
+            *lo = vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(n)));
+            *hi = vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(n)));
+        }
+    }
+}
+
+// Converts 8 pixels to clamped 8-bit channels.
+static inline void ycbcr_to_rgb_neon(int16x8_t y, int16x8_t cb, int16x8_t cr, uint8x8_t* r, uint8x8_t* g, uint8x8_t* b)
+{
+    cb = vshlq_n_s16(vsubq_s16(cb, vdupq_n_s16(128)), 2);
+    cr = vshlq_n_s16(vsubq_s16(cr, vdupq_n_s16(128)), 2);
+
+    *r = vqmovun_s16(vaddq_s16(y, vqrdmulhq_n_s16(cr, cr_to_r)));
+    *g = vqmovun_s16(vsubq_s16(vsubq_s16(y, vqrdmulhq_n_s16(cb, cb_to_g)), vqrdmulhq_n_s16(cr, cr_to_g)));
+    *b = vqmovun_s16(vaddq_s16(y, vqrdmulhq_n_s16(cb, cb_to_b)));
+}
+
+template<int Chroma_X, bool Fancy>
+static void convert_ycbcr_row_neon(const Ycbcr_Row& row, int first, int count, UINT32* destination)
+{
+    int block_first, block_last;
+    get_block_range<Chroma_X, Fancy>(row, first, count, &block_first, &block_last);
+    if (block_first > block_last)
+    {
+        convert_ycbcr_row_scalar<Chroma_X, Fancy>(row, first, count, destination);
+        return;
+    }
+
+    convert_ycbcr_row_scalar<Chroma_X, Fancy>(row, first, block_first - first, destination);
+
+    int x = block_first;
+    for (; x <= block_last; x += 16)
+    {
+        int16x8_t cb_lo, cb_hi, cr_lo, cr_hi;
+        upsample_neon<Chroma_X, Fancy>(row.cb_near, row.cb_far, x, &cb_lo, &cb_hi);
+        upsample_neon<Chroma_X, Fancy>(row.cr_near, row.cr_far, x, &cr_lo, &cr_hi);
+
+        uint8x16_t y = vld1q_u8(row.y + x);
+
+        uint8x8_t r_lo, g_lo, b_lo, r_hi, g_hi, b_hi;
+        ycbcr_to_rgb_neon(vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(y))),  cb_lo, cr_lo, &r_lo, &g_lo, &b_lo);
+        ycbcr_to_rgb_neon(vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(y))), cb_hi, cr_hi, &r_hi, &g_hi, &b_hi);
+
+        uint8x16x4_t pixels;
+        pixels.val[0] = vcombine_u8(b_lo, b_hi);
+        pixels.val[1] = vcombine_u8(g_lo, g_hi);
+        pixels.val[2] = vcombine_u8(r_lo, r_hi);
+        pixels.val[3] = vdupq_n_u8(0xFF);
+
+        vst4q_u8(reinterpret_cast<uint8_t*>(destination + (x - first)), pixels);
+    }
+
+    convert_ycbcr_row_scalar<Chroma_X, Fancy>(row, x, first + count - x, destination + (x - first));
+}
+#pragma endregion
+#endif
+
+struct Ycbcr_Kernels
+{
+    // Indexed by [chroma_x - 1][fancy].
+    Convert_Ycbcr_Row_Func convert_row[2][2];
+};
+
+static Ycbcr_Kernels select_kernels()
+{
+    Ycbcr_Kernels k;
+    k.convert_row[0][0] = convert_ycbcr_row_scalar<1, false>;
+    k.convert_row[0][1] = convert_ycbcr_row_scalar<1, true>;
+    k.convert_row[1][0] = convert_ycbcr_row_scalar<2, false>;
+    k.convert_row[1][1] = convert_ycbcr_row_scalar<2, true>;
+
+#if CPU_X86
+    if (g_cpu_features.has_ssse3)
+    {
+        k.convert_row[0][0] = convert_ycbcr_row_ssse3<1, false>;
+        k.convert_row[0][1] = convert_ycbcr_row_ssse3<1, true>;
+        k.convert_row[1][0] = convert_ycbcr_row_ssse3<2, false>;
+        k.convert_row[1][1] = convert_ycbcr_row_ssse3<2, true>;
+    }
+#elif CPU_ARM
+    if (g_cpu_features.has_neon)
+    {
+        k.convert_row[0][0] = convert_ycbcr_row_neon<1, false>;
+        k.convert_row[0][1] = convert_ycbcr_row_neon<1, true>;
+        k.convert_row[1][0] = convert_ycbcr_row_neon<2, false>;
+        k.convert_row[1][1] = convert_ycbcr_row_neon<2, true>;
+    }
+#endif
+
+    return k;
+}
+
+static const Ycbcr_Kernels& get_kernels()
+{
+    static const Ycbcr_Kernels kernels = select_kernels();
+    return kernels;
+}
+
+void Ycbcr_Conversion::convert_row(const Ycbcr_Row& row, int chroma_x, Chroma_Upsampling upsampling, int first, int count, UINT32* destination)
+{
+    E_VERIFY(chroma_x == 1 || chroma_x == 2);
+    E_VERIFY_NULL(destination);
+    if (count <= 0)
+        return;
+
+    // Without subsampling both filters give the same result.
+    bool fancy = upsampling == Chroma_Upsampling::Fancy;
+    if (chroma_x == 1 && row.cb_near == row.cb_far)
+        fancy = false;
+
+    get_kernels().convert_row[chroma_x - 1][fancy ? 1 : 0](row, first, count, destination);
+}
+
+// Returns subsampling factor (1 or 2) of chroma plane, 0 if it's not supported.
+static int get_chroma_factor(UINT luma_size, UINT chroma_size)
+{
+    if (chroma_size == luma_size)
+        return 1;
+    if (chroma_size == (luma_size + 1) / 2)
+        return 2;
+
+    return 0;
+}
+
+HRESULT Ycbcr_Conversion::copy_pixels(IWICBitmapSource* source, const WICRect& rect, BYTE* destination, UINT stride, Chroma_Upsampling upsampling)
+{
+    E_VERIFY_NULL_R(source, E_INVALIDARG);
+    E_VERIFY_NULL_R(destination, E_INVALIDARG);
+    E_VERIFY_R(rect.Width > 0 && rect.Height > 0, E_INVALIDARG);
+
+    HRESULT hr;
+    IWICPlanarBitmapSourceTransform* planar = nullptr;
+    hr = source->QueryInterface(IID_PPV_ARGS(&planar));
+    if (FAILED(hr))
+        return WINCODEC_ERR_UNSUPPORTEDOPERATION;
+    defer(planar->Release());
+
+    UINT width = 0;
+    UINT height = 0;
+    hr = source->GetSize(&width, &height);
+    if (FAILED(hr))
+        return hr;
+
+    const WICPixelFormatGUID plane_formats[3] = { GUID_WICPixelFormat8bppY, GUID_WICPixelFormat8bppCb, GUID_WICPixelFormat8bppCr };
+    WICBitmapPlaneDescription plane_descs[3];
+    UINT transform_width = width;
+    UINT transform_height = height;
+    BOOL is_supported = FALSE;
+
+    hr = planar->DoesSupportTransform(&transform_width, &transform_height, WICBitmapTransformRotate0, WICPlanarOptionsDefault,
+        plane_formats, plane_descs, ARRAYSIZE(plane_formats), &is_supported);
+    if (FAILED(hr) || !is_supported || transform_width != width || transform_height != height)
+        return WINCODEC_ERR_UNSUPPORTEDOPERATION;
+
+    const int chroma_x = get_chroma_factor(width, plane_descs[1].Width);
+    const int chroma_y = get_chroma_factor(height, plane_descs[1].Height);
+    if (chroma_x == 0 || chroma_y == 0 || plane_descs[2].Width != plane_descs[1].Width || plane_descs[2].Height != plane_descs[1].Height)
+        return WINCODEC_ERR_UNSUPPORTEDOPERATION;
+
+    // Read one more chroma sample around 'rect', so filter at its edges sees the same neighbours as
+    // when whole image is converted. Source rectangle must start at chroma sample boundary.
+    const int chroma_width = static_cast<int>(plane_descs[1].Width);
+    const int chroma_height = static_cast<int>(plane_descs[1].Height);
+    const int cx0 = max(rect.X / chroma_x - 1, 0);
+    const int cy0 = max(rect.Y / chroma_y - 1, 0);
+    const int cx1 = min((rect.X + rect.Width - 1) / chroma_x + 1, chroma_width - 1);
+    const int cy1 = min((rect.Y + rect.Height - 1) / chroma_y + 1, chroma_height - 1);
+
+    WICRect source_rect;
+    source_rect.X = cx0 * chroma_x;
+    source_rect.Y = cy0 * chroma_y;
+    source_rect.Width  = min((cx1 + 1) * chroma_x, static_cast<int>(width))  - source_rect.X;
+    source_rect.Height = min((cy1 + 1) * chroma_y, static_cast<int>(height)) - source_rect.Y;
+
+    // Planes are read in strips of whole chroma rows, every row once and top to bottom, so decoder goes
+    // through the image once and buffers stay the same size for any image. Slot 0 of each plane buffer
+    // keeps the row above the strip: last chroma row of previous strip, and its last luma row if the
+    // chroma row below it wasn't read yet.
+    const UINT y_stride = static_cast<UINT>(source_rect.Width);
+    const UINT c_stride = static_cast<UINT>(cx1 - cx0 + 1);
+    const int strip_rows = max(chroma_y, static_cast<int>(plane_strip_size / y_stride) / chroma_y * chroma_y);
+    const int strip_chroma_rows = strip_rows / chroma_y;
+    const size_t y_size = static_cast<size_t>(y_stride) * (strip_rows + 1);
+    const size_t c_size = static_cast<size_t>(c_stride) * (strip_chroma_rows + 1);
+
+    BYTE* plane_buffer = (BYTE*)g_standard_allocator->allocate(y_size + 2 * c_size);
+    if (plane_buffer == nullptr)
+        return E_OUTOFMEMORY;
+    defer(g_standard_allocator->deallocate(plane_buffer));
+
+    BYTE* y_buffer = plane_buffer;
+    BYTE* cb_buffer = plane_buffer + y_size;
+    BYTE* cr_buffer = plane_buffer + y_size + c_size;
+
+    const bool fancy_vertical = upsampling == Chroma_Upsampling::Fancy && chroma_y == 2;
+    const int first = rect.X - source_rect.X;
+    const int rect_end = rect.Y + rect.Height;
+    const int source_end = source_rect.Y + source_rect.Height;
+    int next_row = rect.Y;
+
+    for (int strip_y = source_rect.Y; strip_y < source_end; strip_y += strip_rows)
+    {
+        WICRect strip = { source_rect.X, strip_y, source_rect.Width, min(strip_rows, source_end - strip_y) };
+        const int chroma_begin = strip_y / chroma_y;
+        const int chroma_end = (strip_y + strip.Height + chroma_y - 1) / chroma_y;
+
+        WICBitmapPlane planes[3];
+        planes[0].Format = GUID_WICPixelFormat8bppY;
+        planes[0].pbBuffer = y_buffer + y_stride;
+        planes[0].cbStride = y_stride;
+        planes[0].cbBufferSize = y_stride * static_cast<UINT>(strip.Height);
+        planes[1].Format = GUID_WICPixelFormat8bppCb;
+        planes[1].pbBuffer = cb_buffer + c_stride;
+        planes[1].cbStride = c_stride;
+        planes[1].cbBufferSize = c_stride * static_cast<UINT>(chroma_end - chroma_begin);
+        planes[2].Format = GUID_WICPixelFormat8bppCr;
+        planes[2].pbBuffer = cr_buffer + c_stride;
+        planes[2].cbStride = c_stride;
+        planes[2].cbBufferSize = c_stride * static_cast<UINT>(chroma_end - chroma_begin);
+
+        hr = planar->CopyPixels(&strip, width, height, WICBitmapTransformRotate0, WICPlanarOptionsDefault, planes, ARRAYSIZE(planes));
+        if (FAILED(hr))
+            return hr;
+
+        for (; next_row < rect_end && next_row < strip_y + strip.Height; ++next_row)
+        {
+            int near_row = next_row / chroma_y;
+            int far_row = near_row;
+            if (fancy_vertical)
+                far_row = (next_row & 1) ? min(near_row + 1, chroma_height - 1) : max(near_row - 1, 0);
+
+            // Chroma row below is in the next strip, row is converted after it's read.
+            if (far_row >= chroma_end)
+                break;
+
+            // Row index relative to the strip + 1, the row above the strip is in slot 0.
+            Ycbcr_Row row;
+            row.y = y_buffer + static_cast<size_t>(next_row - strip_y + 1) * y_stride;
+            row.cb_near = cb_buffer + static_cast<size_t>(near_row - chroma_begin + 1) * c_stride;
+            row.cb_far  = cb_buffer + static_cast<size_t>(far_row - chroma_begin + 1) * c_stride;
+            row.cr_near = cr_buffer + static_cast<size_t>(near_row - chroma_begin + 1) * c_stride;
+            row.cr_far  = cr_buffer + static_cast<size_t>(far_row - chroma_begin + 1) * c_stride;
+            row.chroma_count = static_cast<int>(c_stride);
+
+            convert_row(row, chroma_x, upsampling, first, rect.Width, reinterpret_cast<UINT32*>(destination + static_cast<size_t>(next_row - rect.Y) * stride));
+        }
+
+        // Only the last row of a strip can wait for the next one.
+        const size_t last_chroma = static_cast<size_t>(chroma_end - chroma_begin) * c_stride;
+        memcpy(cb_buffer, cb_buffer + last_chroma, c_stride);
+        memcpy(cr_buffer, cr_buffer + last_chroma, c_stride);
+        if (next_row < rect_end && next_row < strip_y + strip.Height)
+            memcpy(y_buffer, y_buffer + static_cast<size_t>(strip.Height) * y_stride, y_stride);
+    }
+
+    return S_OK;
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include <wincodec.h>
+
+enum class Chroma_Upsampling
+{
+    Nearest, // Each chroma sample is repeated.
+    Fancy,   // Triangle filter between neighbouring chroma samples, same as libjpeg's "fancy upsampling".
+};
+
+// One output row of planar YCbCr image. 'near' chroma rows are closest to the output row, 'far' rows are
+// the next closest ones (same as 'near' if chroma is not subsampled vertically).
+struct Ycbcr_Row
+{
+    const BYTE* y;
+    const BYTE* cb_near;
+    const BYTE* cb_far;
+    const BYTE* cr_near;
+    const BYTE* cr_far;
+    // Amount of chroma samples in each chroma row.
+    int chroma_count;
+};
+
+// Converts planar full range YCbCr (JFIF) to PBGRA. Chroma upsampling, color conversion and
+// interleaving are done in a single pass that writes destination row directly.
+struct Ycbcr_Conversion
+{
+    // Writes pixels [first, first + count) of 'row' to 'destination'. 'chroma_x' is horizontal
+    // subsampling factor, 1 or 2. Chroma sample 0 corresponds to pixel 0.
+    static void convert_row(const Ycbcr_Row& row, int chroma_x, Chroma_Upsampling upsampling, int first, int count, UINT32* destination);
+
+    // Copies 'rect' of 'source' as PBGRA using YCbCr planes provided by WIC planar transform (JPEG decoder on
+    // Windows 8.1 and newer). Returns WINCODEC_ERR_UNSUPPORTEDOPERATION if planes are not available.
+    static HRESULT copy_pixels(IWICBitmapSource* source, const WICRect& rect, BYTE* destination, UINT stride, Chroma_Upsampling upsampling);
+};
@@ -0,0 +1,165 @@
+#include <Windows.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "test.hpp"
+#include "bcn_decoder.hpp"
+#include "cpu_features.hpp"
+
+struct Known_Block
+{
+    Bcn_Format format;
+    // BC1 blocks are 8 bytes, the rest is zero.
+    BYTE block[16];
+    // 32bppPBGRA, row after row.
+    UINT32 pixels[16];
+};
+
+// Blocks written field by field, decoded pixels checked against another decoder. BC6H is shown as sRGB.
+static const Known_Block known_blocks[] = {
+    // BC1, first color (blue) not greater than the second (red): 3 colors and transparent black.
+    { Bcn_Format::Bc1,
+      { 0x1F, 0x00, 0x00, 0xF8, 0xE4, 0x1B, 0xF0, 0x5A },
+      { 0xFF0000FF, 0xFFFF0000, 0xFF7F007F, 0x00000000,
+        0x00000000, 0xFF7F007F, 0xFFFF0000, 0xFF0000FF,
+        0xFF0000FF, 0xFF0000FF, 0x00000000, 0x00000000,
+        0xFF7F007F, 0xFF7F007F, 0xFFFF0000, 0xFFFF0000 } },
+    // BC7 mode 0, partition 13 of 3 subsets, 4-bit endpoints with a p-bit each, 3-bit indices.
+    { Bcn_Format::Bc7,
+      { 0xFB, 0x01, 0x7E, 0x18, 0x1E, 0xFE, 0x10, 0xE0, 0x61, 0xA9, 0x8C, 0x57, 0x99, 0xC3, 0xAB, 0x98 },
+      { 0xFFDB2A07, 0xFF92926C, 0xFFCE8C4A, 0xFF5D7A97,
+        0xFF48B402, 0xFF0808FF, 0xFF737E88, 0xFFB88859,
+        0xFFDB2A07, 0xFF92926C, 0xFFCE8C4A, 0xFF5D7A97,
+        0xFF48B402, 0xFF0808FF, 0xFF737E88, 0xFF5D7A97 } },
+    // Mode 1, partition 34 of 2 subsets, 6-bit endpoints with a p-bit per subset, 3-bit indices.
+    { Bcn_Format::Bc7,
+      { 0x8A, 0x3F, 0x40, 0x15, 0x00, 0xFA, 0x17, 0xCA, 0x0F, 0xC8, 0x79, 0xC6, 0xA3, 0x3A, 0xE3, 0xA1 },
+      { 0xFFB82F66, 0xFF1414C9, 0xFF6D5FA5, 0xFF48DC1C,
+        0xFF1C35AD, 0xFF944684, 0xFF50FD00, 0xFF4976C3,
+        0xFFB82F66, 0xFF1414C9, 0xFF6D5FA5, 0xFF48DC1C,
+        0xFF1C35AD, 0xFF944684, 0xFF50FD00, 0xFF4976C3 } },
+    // Mode 2, partition 22 of 3 subsets, 5-bit endpoints, 2-bit indices.
+    { Bcn_Format::Bc7,
+      { 0xB4, 0x3E, 0x00, 0x5F, 0x65, 0xF0, 0xC1, 0xA7, 0x03, 0x80, 0xFF, 0x4B, 0x94, 0x93, 0xC9, 0xC9 },
+      { 0xFFFF0000, 0xFFAB5400, 0xFF54AB00, 0xFF00FF00,
+        0xFFFF0000, 0xFFAB5400, 0xFF0000FF, 0xFFFFFFFF,
+        0xFFFF0000, 0xFF5454FF, 0xFFA5466C, 0xFFCE188C,
+        0xFFFF0000, 0xFF5454FF, 0xFFA5466C, 0xFF7B7749 } },
+    // Mode 3, partition 17 of 2 subsets, 7-bit endpoints with a p-bit each, 2-bit indices.
+    { Bcn_Format::Bc7,
+      { 0x18, 0xFD, 0x01, 0x64, 0x05, 0x10, 0x04, 0xC0, 0x03, 0xFE, 0x32, 0x6D, 0xCA, 0xC6, 0xC6, 0xC6 },
+      { 0xFFFF8101, 0xFF8D4F7F, 0xFFC80064, 0xFF15F1B5,
+        0xFF5455AB, 0xFFAB6C54, 0xFFFF8101, 0xFF15F1B5,
+        0xFF5455AB, 0xFFAB6C54, 0xFFFF8101, 0xFF0040FE,
+        0xFF5455AB, 0xFFAB6C54, 0xFFFF8101, 0xFF0040FE } },
+    // Mode 4, alpha swapped with green, index selection bit set: 3-bit indices are for color.
+    { Bcn_Format::Bc7,
+      { 0xD0, 0x1F, 0x28, 0x0A, 0xFE, 0x8F, 0x74, 0x72, 0x72, 0x72, 0x98, 0xC3, 0xAB, 0x98, 0xC3, 0xAB },
+      { 0x52523B00, 0x75433032, 0x99161383, 0x5E515E0D,
+        0x82375D4B, 0xA50044A5, 0x694B0D1E, 0x8E288E66,
+        0x52523B00, 0x75433032, 0x99161383, 0x5E515E0D,
+        0x82375D4B, 0xA50044A5, 0x694B0D1E, 0x8E288E66 } },
+    // Mode 5, alpha swapped with red, 7-bit color and 8-bit alpha.
+    { Bcn_Format::Bc7,
+      { 0x60, 0x7F, 0x00, 0xE0, 0x0F, 0x54, 0xFC, 0x7B, 0x98, 0x9C, 0x9C, 0x9C, 0xB2, 0xB1, 0xB1, 0xB1 },
+      { 0xFFB50081, 0x00000000, 0xFF1E0081, 0xAB46383E,
+        0x543C3812, 0x00000000, 0xFF1E0081, 0xAB46383E,
+        0x543C3812, 0x00000000, 0xFF1E0081, 0xAB46383E,
+        0x543C3812, 0x00000000, 0xFF1E0081, 0xAB46383E } },
+    // Mode 6, 7-bit RGBA with a p-bit each, 4-bit indices, alpha premultiplied.
+    { Bcn_Format::Bc7,
+      { 0x40, 0xFC, 0x00, 0xA5, 0x3D, 0xFC, 0xFF, 0x94, 0xA6, 0x81, 0x6F, 0x4D, 0x2B, 0x09, 0xE7, 0xC5 },
+      { 0xD3A05435, 0x6F24404D, 0xF2D6531C, 0x8D404A4F,
+        0x28011C28, 0xA860504A, 0x460B2E3C, 0xC68B533D,
+        0x611A3B49, 0xE1B8542B, 0x7F32464E, 0xFFF1510F,
+        0x9A4F4D4D, 0x35042432, 0xB8765243, 0x54123544 } },
+    // Mode 7, partition 40 of 2 subsets, 5-bit RGBA with a p-bit each.
+    { Bcn_Format::Bc7,
+      { 0x80, 0xE8, 0x07, 0xE0, 0x83, 0x0F, 0x3E, 0x00, 0x1F, 0xFC, 0x02, 0x41, 0xA7, 0x93, 0x93, 0x93 },
+      { 0xB87B3D02, 0x86020286, 0x5B1F1F3E, 0x2F202010,
+        0x28002700, 0xFFFF0404, 0x5B1F1F3E, 0x2F202010,
+        0x04040400, 0x86020286, 0xB87B3D02, 0x6F254A00,
+        0x04040400, 0x86020286, 0x5B1F1F3E, 0x6F254A00 } },
+    // BC6H mode 0x03, one subset of 10-bit unsigned endpoints, values up to 1.0.
+    { Bcn_Format::Bc6h,
+      { 0x03, 0x00, 0x7D, 0xDE, 0x03, 0x0F, 0x05, 0x96, 0x50, 0xFA, 0x94, 0x3E, 0xD8, 0x72, 0x1C, 0xB6 },
+      { 0xFF0012FF, 0xFF03058D, 0xFF2E0148, 0xFFE40023,
+        0xFF0106A1, 0xFF1E0156, 0xFFAB002A, 0xFF0108B3,
+        0xFF130260, 0xFF780030, 0xFF000BC9, 0xFF0C036D,
+        0xFF590139, 0xFF000FE9, 0xFF06037C, 0xFF410140 } },
+    // Signed BC6H mode 0x00, 2 subsets of differences from the first endpoint, negative values are black.
+    { Bcn_Format::Bc6h_Signed,
+      { 0x08, 0x19, 0xFB, 0xCD, 0x81, 0xF9, 0x81, 0xFB, 0x8F, 0xBD, 0xC5, 0xAB, 0x98, 0xC3, 0xAB, 0x98 },
+      { 0xFF6300B6, 0xFF5800AC, 0xFF4C00A0, 0xFF6000B3,
+        0xFF5500A8, 0xFF6900BA, 0xFF5C00AF, 0xFF5100A4,
+        0xFF7600BB, 0xFF6A00D1, 0xFF5F00E5, 0xFF7200C2,
+        0xFF6500D8, 0xFF7A00B7, 0xFF6E00CA, 0xFF7200C2 } },
+};
+
+static const Bcn_Format formats[] = {
+    Bcn_Format::Bc1, Bcn_Format::Bc2, Bcn_Format::Bc3, Bcn_Format::Bc4, Bcn_Format::Bc4_Signed, Bcn_Format::Bc5,
+    Bcn_Format::Bc5_Signed, Bcn_Format::Bc6h, Bcn_Format::Bc6h_Signed, Bcn_Format::Bc7,
+};
+
+static const wchar_t* format_names[] = {
+    L"Unknown", L"BC1", L"BC2", L"BC3", L"BC4", L"BC4 signed", L"BC5", L"BC5 signed", L"BC6H", L"BC6H signed", L"BC7",
+};
+
+static void test_known_blocks(const Cpu_Features& features, const wchar_t* kernels)
+{
+    for (int i = 0; i < ARRAYSIZE(known_blocks); ++i)
+    {
+        const Known_Block& known = known_blocks[i];
+        UINT32 pixels[16] = {};
+        Bcn_Decoder::decode_row(known.format, features, known.block, 1, pixels, Bcn_Decoder::block_size * sizeof(UINT32));
+
+        const bool same = memcmp(pixels, known.pixels, sizeof(pixels)) == 0;
+        CHECK(same);
+        if (!same)
+            wprintf(L"Known %s block %d decoded by %s kernels differs.\n", format_names[static_cast<int>(known.format)], i, kernels);
+    }
+}
+
+// A row of random blocks covers every BC7 mode and the reserved one, reserved BC6H modes, and both
+// BC1 color modes.
+static void test_simd_matches_scalar(const Cpu_Features& simd_features)
+{
+    const int block_count = 256;
+    const UINT stride = block_count * Bcn_Decoder::block_size * sizeof(UINT32);
+    static BYTE blocks[16 * block_count];
+    static UINT32 scalar[Bcn_Decoder::block_size * block_count * Bcn_Decoder::block_size];
+    static UINT32 simd[Bcn_Decoder::block_size * block_count * Bcn_Decoder::block_size];
+
+    UINT32 state = 12345;
+    for (int i = 0; i < ARRAYSIZE(blocks); ++i)
+    {
+        state = state * 1664525u + 1013904223u;
+        blocks[i] = static_cast<BYTE>(state >> 24);
+    }
+
+    const Cpu_Features scalar_features = Cpu_Features();
+    for (int i = 0; i < ARRAYSIZE(formats); ++i)
+    {
+        Bcn_Decoder::decode_row(formats[i], scalar_features, blocks, block_count, scalar, stride);
+        Bcn_Decoder::decode_row(formats[i], simd_features, blocks, block_count, simd, stride);
+
+        const bool same = memcmp(scalar, simd, sizeof(scalar)) == 0;
+        CHECK(same);
+        if (!same)
+            wprintf(L"%s blocks decoded by SIMD kernels differ from scalar ones.\n", format_names[static_cast<int>(formats[i])]);
+    }
+}
+
+void run_bcn_decoder_tests()
+{
+    test_known_blocks(Cpu_Features(), L"scalar");
+
+    if (g_cpu_features.has_ssse3)
+    {
+        Cpu_Features ssse3_features;
+        ssse3_features.has_sse2 = true;
+        ssse3_features.has_ssse3 = true;
+        test_known_blocks(ssse3_features, L"SSSE3");
+        test_simd_matches_scalar(ssse3_features);
+    }
+}
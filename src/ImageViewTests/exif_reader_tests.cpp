@@ -0,0 +1,136 @@
+#include <Windows.h>
+#include <string.h>
+
+#include "test.hpp"
+#include "exif_reader.hpp"
+#include "allocator.hpp"
+
+// Little endian TIFF whose IFDs and values are written after the pixels, the way editors append them.
+// IFD0 is past the probe, EXIF IFD megabytes after it, so they're in different windows.
+static const UINT32 ifd0_offset = 300 * 1000;
+static const UINT32 exif_ifd_offset = 2 * 1000 * 1000;
+static const UINT32 file_size = exif_ifd_offset + 1024;
+
+static void put16(BYTE* p, UINT16 value)
+{
+    p[0] = static_cast<BYTE>(value);
+    p[1] = static_cast<BYTE>(value >> 8);
+}
+
+static void put32(BYTE* p, UINT32 value)
+{
+    put16(p, static_cast<UINT16>(value));
+    put16(p + 2, static_cast<UINT16>(value >> 16));
+}
+
+// Writes IFD entry 'index' of IFD at 'ifd'. ASCII values longer than 4 bytes are written at 'value_offset'.
+static void put_entry(BYTE* data, UINT32 ifd, int index, UINT16 tag, UINT16 type, UINT32 count, UINT32 value)
+{
+    BYTE* entry = data + ifd + 2 + index * 12;
+    put16(entry, tag);
+    put16(entry + 2, type);
+    put32(entry + 4, count);
+    put32(entry + 8, value);
+}
+
+static void put_ascii(BYTE* data, UINT32 ifd, int index, UINT16 tag, const char* text, UINT32 value_offset)
+{
+    const UINT32 count = static_cast<UINT32>(strlen(text)) + 1;
+    memcpy(data + value_offset, text, count);
+    put_entry(data, ifd, index, tag, 2, count, value_offset);
+}
+
+static bool write_file(const wchar_t* path, const BYTE* data, DWORD size)
+{
+    HANDLE file = CreateFileW(path, GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+
+    DWORD written = 0;
+    const BOOL ok = WriteFile(file, data, size, &written, nullptr);
+    CloseHandle(file);
+
+    return ok && written == size;
+}
+
+// Tags past the first 'probe_size' bytes of a TIFF file are read from where they are.
+static void test_tiff_tags_past_probe()
+{
+    BYTE* data = static_cast<BYTE*>(g_standard_allocator->allocate(file_size));
+    CHECK(data != nullptr);
+    if (data == nullptr)
+        return;
+
+    memset(data, 0, file_size);
+    data[0] = 'I';
+    data[1] = 'I';
+    put16(data + 2, 42);
+    put32(data + 4, ifd0_offset);
+
+    // Make, model and EXIF IFD, values after the entries.
+    put16(data + ifd0_offset, 3);
+    put_ascii(data, ifd0_offset, 0, 0x010F, "Canon", ifd0_offset + 100);
+    put_ascii(data, ifd0_offset, 1, 0x0110, "EOS R5", ifd0_offset + 120);
+    put_entry(data, ifd0_offset, 2, 0x8769, 4, 1, exif_ifd_offset);
+
+    // Date taken and ISO.
+    put16(data + exif_ifd_offset, 2);
+    put_ascii(data, exif_ifd_offset, 0, 0x9003, "2021:06:15 10:20:30", exif_ifd_offset + 100);
+    put_entry(data, exif_ifd_offset, 1, 0x8827, 3, 1, 800);
+
+    wchar_t path[MAX_PATH + 1];
+    const DWORD path_length = GetTempPathW(MAX_PATH - 32, path);
+    CHECK(path_length > 0);
+    wcscpy_s(path + path_length, MAX_PATH + 1 - path_length, L"ImageViewTests_exif.tif");
+
+    const bool written = write_file(path, data, file_size);
+    CHECK(written);
+    if (written)
+    {
+        HANDLE file = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        CHECK(file != INVALID_HANDLE_VALUE);
+        if (file != INVALID_HANDLE_VALUE)
+        {
+            Exif_Info info;
+            Photo_Metadata metadata;
+            CHECK(Exif_Reader::read(file, &info, &metadata) == S_OK);
+            CHECK(strcmp(metadata.camera, "Canon EOS R5") == 0);
+            CHECK(metadata.iso == 800);
+            CHECK(metadata.date_taken != 0);
+
+            CloseHandle(file);
+        }
+
+        DeleteFileW(path);
+    }
+
+    g_standard_allocator->deallocate(data);
+}
+
+// Orientation is reset in both APP1 segments a turned JPEG keeps, in place.
+static void test_reset_orientation()
+{
+    // EXIF segment of a big endian TIFF whose IFD0 has orientation 6 and links IFD1.
+    BYTE exif[6 + 8 + 2 + 12 + 4] = { 'E', 'x', 'i', 'f', 0, 0, 'M', 'M', 0, 42, 0, 0, 0, 8, 0, 1, 0x01, 0x12, 0, 3, 0, 0, 0, 1, 0, 6 };
+    exif[sizeof(exif) - 1] = 40;
+    CHECK(Exif_Reader::reset_orientation(exif, sizeof(exif)));
+    CHECK(exif[6 + 8 + 2 + 8] == 0 && exif[6 + 8 + 2 + 9] == 1);
+    CHECK(exif[sizeof(exif) - 1] == 0);
+
+    char xmp[] = "http://ns.adobe.com/xap/1.0/\0<rdf:Description tiff:Orientation=\"8\"/>"
+        "<rdf:Description><tiff:Orientation> 16</tiff:Orientation></rdf:Description>";
+    const char expected[] = "<rdf:Description tiff:Orientation=\"1\"/>"
+        "<rdf:Description><tiff:Orientation> 1 </tiff:Orientation></rdf:Description>";
+    const UINT32 signature_size = static_cast<UINT32>(strlen(xmp)) + 1;
+    CHECK(Exif_Reader::reset_orientation(reinterpret_cast<BYTE*>(xmp), sizeof(xmp) - 1));
+    CHECK(strcmp(xmp + signature_size, expected) == 0);
+
+    BYTE other[] = { 'J', 'F', 'I', 'F', 0 };
+    CHECK(!Exif_Reader::reset_orientation(other, sizeof(other)));
+}
+
+void run_exif_reader_tests()
+{
+    test_tiff_tags_past_probe();
+    test_reset_orientation();
+}
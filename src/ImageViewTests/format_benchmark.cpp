@@ -0,0 +1,90 @@
+#include <Windows.h>
+#include <stdio.h>
+
+#include "test.hpp"
+#include "string_builder.hpp"
+
+static const int line_count = 100 * 1000;
+
+// Values of the image info line that is formatted on every frame.
+struct Format_Context
+{
+    wchar_t text[256];
+    volatile int sink = 0;
+};
+
+static int get_width(int i) { return 640 + i % 7000; }
+static int get_height(int i) { return 480 + i % 5000; }
+static double get_f_number(int i) { return 1.4 + (i % 20) * 0.7; }
+static int get_iso(int i) { return 100 << (i % 7); }
+
+static void bench_append_format(void* context)
+{
+    Format_Context* c = static_cast<Format_Context*>(context);
+    String_Builder sb{ c->text, ARRAYSIZE(c->text) };
+    int sum = 0;
+    for (int i = 0; i < line_count; ++i)
+    {
+        sb.begin();
+        sb.append_format(L"%dx%d  f/%.1f  ISO %d  %d mm", get_width(i), get_height(i), get_f_number(i), get_iso(i), 10 + i % 590);
+        sb.end();
+        sum += sb.count;
+    }
+    c->sink = sum;
+}
+
+static void bench_append(void* context)
+{
+    Format_Context* c = static_cast<Format_Context*>(context);
+    String_Builder sb{ c->text, ARRAYSIZE(c->text) };
+    int sum = 0;
+    for (int i = 0; i < line_count; ++i)
+    {
+        sb.begin();
+        sb.append(get_width(i), L'x', get_height(i), L"  f/", format_fixed(get_f_number(i), 1), L"  ISO ", get_iso(i), L"  ", 10 + i % 590, L" mm");
+        sb.end();
+        sum += sb.count;
+    }
+    c->sink = sum;
+}
+
+static void bench_append_format_hex(void* context)
+{
+    Format_Context* c = static_cast<Format_Context*>(context);
+    String_Builder sb{ c->text, ARRAYSIZE(c->text) };
+    int sum = 0;
+    for (int i = 0; i < line_count; ++i)
+    {
+        sb.begin();
+        sb.append_format(L"Error %#010x at line %d", 0x80070000u + i, i);
+        sb.end();
+        sum += sb.count;
+    }
+    c->sink = sum;
+}
+
+static void bench_append_hex(void* context)
+{
+    Format_Context* c = static_cast<Format_Context*>(context);
+    String_Builder sb{ c->text, ARRAYSIZE(c->text) };
+    int sum = 0;
+    for (int i = 0; i < line_count; ++i)
+    {
+        sb.begin();
+        sb.append(L"Error ", format_hex(0x80070000u + i, 8), L" at line ", i);
+        sb.end();
+        sum += sb.count;
+    }
+    c->sink = sum;
+}
+
+void run_format_benchmark()
+{
+    Format_Context context;
+
+    wprintf(L"String_Builder, %d lines into a stack buffer:\n", line_count);
+    report_benchmark(L"image info line, append_format", measure_ms(bench_append_format, &context));
+    report_benchmark(L"image info line, append", measure_ms(bench_append, &context));
+    report_benchmark(L"error line, append_format", measure_ms(bench_append_format_hex, &context));
+    report_benchmark(L"error line, append", measure_ms(bench_append_hex, &context));
+}
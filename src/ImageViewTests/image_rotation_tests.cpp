@@ -0,0 +1,140 @@
+#include <Windows.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "test.hpp"
+#include "image_rotation.hpp"
+#include "cpu_features.hpp"
+#include "defer.hpp"
+
+struct Image_Size
+{
+    int width;
+    int height;
+};
+
+// A single pixel, sizes below a block, sizes with partial blocks and tiles on both sides, and one
+// with more than one band of tiles.
+static const Image_Size sizes[] = {
+    { 1, 1 },
+    { 7, 13 },
+    { 33, 9 },
+    { 257, 129 },
+};
+
+// Position where stored pixel 'x', 'y' of a 'width' x 'height' image is shown.
+static void get_shown_position(Orientation orientation, int width, int height, int x, int y, int* shown_x, int* shown_y)
+{
+    switch (orientation)
+    {
+    case Orientation::Normal:            *shown_x = x;              *shown_y = y;              break;
+    case Orientation::Mirror_Horizontal: *shown_x = width - 1 - x;  *shown_y = y;              break;
+    case Orientation::Rotate_180:        *shown_x = width - 1 - x;  *shown_y = height - 1 - y; break;
+    case Orientation::Mirror_Vertical:   *shown_x = x;              *shown_y = height - 1 - y; break;
+    case Orientation::Transpose:         *shown_x = y;              *shown_y = x;              break;
+    case Orientation::Rotate_90:         *shown_x = height - 1 - y; *shown_y = x;              break;
+    case Orientation::Transverse:        *shown_x = height - 1 - y; *shown_y = width - 1 - x;  break;
+    case Orientation::Rotate_270:        *shown_x = y;              *shown_y = width - 1 - x;  break;
+    }
+}
+
+// Every pixel is its own position, so a pixel written from the wrong place shows which one it was.
+static void fill_pixels(Image_Buffer* image)
+{
+    for (int y = 0; y < image->height; ++y)
+    {
+        UINT32* row = image->row(y);
+        for (int x = 0; x < image->width; ++x)
+            row[x] = static_cast<UINT32>(y) << 16 | static_cast<UINT32>(x);
+    }
+}
+
+static int count_misplaced_pixels(const Image_Buffer& source, Orientation orientation, const Image_Buffer& destination)
+{
+    const bool swaps_size = Image_Rotation::swaps_size(orientation);
+    if (destination.width != (swaps_size ? source.height : source.width) ||
+        destination.height != (swaps_size ? source.width : source.height))
+        return source.width * source.height;
+
+    int count = 0;
+    for (int y = 0; y < source.height; ++y)
+    {
+        for (int x = 0; x < source.width; ++x)
+        {
+            int shown_x, shown_y;
+            get_shown_position(orientation, source.width, source.height, x, y, &shown_x, &shown_y);
+            if (destination.row(shown_y)[shown_x] != source.row(y)[x])
+                ++count;
+        }
+    }
+
+    return count;
+}
+
+static bool equals(const Image_Buffer& a, const Image_Buffer& b)
+{
+    if (a.width != b.width || a.height != b.height)
+        return false;
+
+    for (int y = 0; y < a.height; ++y)
+    {
+        if (memcmp(a.row(y), b.row(y), static_cast<size_t>(a.width) * sizeof(UINT32)) != 0)
+            return false;
+    }
+
+    return true;
+}
+
+// Scalar kernels put every pixel where the orientation shows it, and each SIMD kernel set the machine
+// has writes the same pixels as scalar ones.
+static void test_size(const Image_Size& size, const Cpu_Features* simd_features, int simd_count)
+{
+    Image_Buffer source;
+    Image_Buffer scalar;
+    Image_Buffer simd;
+    defer(source.release());
+    defer(scalar.release());
+    defer(simd.release());
+    CHECK(source.allocate(size.width, size.height));
+    if (source.is_empty())
+        return;
+    fill_pixels(&source);
+
+    const Cpu_Features scalar_features = Cpu_Features();
+    for (int i = 1; i <= 8; ++i)
+    {
+        const Orientation orientation = static_cast<Orientation>(i);
+        CHECK(Image_Rotation::transform(source, orientation, scalar_features, &scalar));
+        const int misplaced = count_misplaced_pixels(source, orientation, scalar);
+        CHECK(misplaced == 0);
+        if (misplaced != 0)
+            wprintf(L"%dx%d, orientation %d: %d pixels misplaced by scalar kernels.\n", size.width, size.height, i, misplaced);
+
+        for (int k = 0; k < simd_count; ++k)
+        {
+            CHECK(Image_Rotation::transform(source, orientation, simd_features[k], &simd));
+            const bool same = equals(scalar, simd);
+            CHECK(same);
+            if (!same)
+                wprintf(L"%dx%d, orientation %d: SIMD kernels (SSE2 %d, AVX2 %d) differ from scalar ones.\n", size.width, size.height, i,
+                    simd_features[k].has_sse2, simd_features[k].has_avx2);
+        }
+    }
+}
+
+void run_image_rotation_tests()
+{
+    // Kernel sets are picked by the best instruction set, so each one is selected with features up to it.
+    Cpu_Features simd_features[2];
+    int simd_count = 0;
+    if (g_cpu_features.has_sse2)
+        simd_features[simd_count++].has_sse2 = true;
+    if (g_cpu_features.has_avx2)
+    {
+        simd_features[simd_count] = g_cpu_features;
+        ++simd_count;
+    }
+
+    for (int i = 0; i < ARRAYSIZE(sizes); ++i)
+        test_size(sizes[i], simd_features, simd_count);
+}
@@ -0,0 +1,160 @@
+#include <Windows.h>
+#include <wincodec.h>
+#include <stdio.h>
+
+#include "test.hpp"
+#include "jpeg_restart_decoder.hpp"
+#include "jpeg_transform.hpp"
+#include "pixel_conversion.hpp"
+#include "com_utility.hpp"
+#include "defer.hpp"
+#include "allocator.hpp"
+
+// 24 megapixels, what a camera takes.
+static const int image_width = 6000;
+static const int image_height = 4000;
+
+struct Jpeg_Context
+{
+    IWICImagingFactory* wic = nullptr;
+    String path;
+    Image_Buffer image;
+    HRESULT hr = S_OK;
+};
+
+// Gradient with noise, so the entropy coded data is about as long as a photo's.
+static void fill_pixels(BYTE* pixels, UINT stride)
+{
+    UINT32 state = 12345;
+    for (int y = 0; y < image_height; ++y)
+    {
+        BYTE* row = pixels + static_cast<size_t>(y) * stride;
+        for (int x = 0; x < image_width; ++x)
+        {
+            state = state * 1664525u + 1013904223u;
+            const int noise = static_cast<int>(state >> 28);
+            row[3 * x + 0] = static_cast<BYTE>((x * 255 / image_width + noise) & 0xFF);
+            row[3 * x + 1] = static_cast<BYTE>((y * 255 / image_height + noise) & 0xFF);
+            row[3 * x + 2] = static_cast<BYTE>(((x + y) / 32 + noise) & 0xFF);
+        }
+    }
+}
+
+// Writes a baseline JPEG with WIC, which never writes restart markers.
+static HRESULT write_jpeg(IWICImagingFactory* wic, const String& path)
+{
+    const UINT stride = image_width * 3;
+    const UINT size = stride * image_height;
+    BYTE* pixels = static_cast<BYTE*>(g_standard_allocator->allocate(size));
+    if (pixels == nullptr)
+        return E_OUTOFMEMORY;
+    defer(g_standard_allocator->deallocate(pixels));
+    fill_pixels(pixels, stride);
+
+    IWICStream* stream = nullptr;
+    IWICBitmapEncoder* encoder = nullptr;
+    IWICBitmapFrameEncode* frame = nullptr;
+    IPropertyBag2* properties = nullptr;
+    defer(safe_release(properties));
+    defer(safe_release(frame));
+    defer(safe_release(encoder));
+    defer(safe_release(stream));
+
+    WICPixelFormatGUID format = GUID_WICPixelFormat24bppBGR;
+    HRESULT hr = wic->CreateStream(&stream);
+    if (SUCCEEDED(hr))
+        hr = stream->InitializeFromFilename(path.data, GENERIC_WRITE);
+    if (SUCCEEDED(hr))
+        hr = wic->CreateEncoder(GUID_ContainerFormatJpeg, nullptr, &encoder);
+    if (SUCCEEDED(hr))
+        hr = encoder->Initialize(stream, WICBitmapEncoderNoCache);
+    if (SUCCEEDED(hr))
+        hr = encoder->CreateNewFrame(&frame, &properties);
+    if (SUCCEEDED(hr))
+        hr = frame->Initialize(properties);
+    if (SUCCEEDED(hr))
+        hr = frame->SetSize(image_width, image_height);
+    if (SUCCEEDED(hr))
+        hr = frame->SetPixelFormat(&format);
+    if (SUCCEEDED(hr))
+        hr = IsEqualGUID(format, GUID_WICPixelFormat24bppBGR) ? S_OK : WINCODEC_ERR_UNSUPPORTEDPIXELFORMAT;
+    if (SUCCEEDED(hr))
+        hr = frame->WritePixels(image_height, stride, size, pixels);
+    if (SUCCEEDED(hr))
+        hr = frame->Commit();
+    if (SUCCEEDED(hr))
+        hr = encoder->Commit();
+
+    return hr;
+}
+
+// One WIC decoder for the whole image, how JPEGs without restart markers at row starts are decoded.
+static void bench_serial(void* context)
+{
+    Jpeg_Context* c = static_cast<Jpeg_Context*>(context);
+
+    IWICBitmapDecoder* decoder = nullptr;
+    IWICBitmapFrameDecode* frame = nullptr;
+    c->hr = c->wic->CreateDecoderFromFilename(c->path.data, nullptr, GENERIC_READ, WICDecodeMetadataCacheOnDemand, &decoder);
+    if (SUCCEEDED(c->hr))
+        c->hr = decoder->GetFrame(0, &frame);
+    if (SUCCEEDED(c->hr))
+    {
+        const WICRect rect = { 0, 0, image_width, image_height };
+        c->hr = Pixel_Conversion::copy_pixels(c->wic, frame, rect, c->image.pixels, c->image.stride, Chroma_Upsampling::Fancy);
+    }
+
+    safe_release(frame);
+    safe_release(decoder);
+}
+
+static void bench_bands(void* context)
+{
+    Jpeg_Context* c = static_cast<Jpeg_Context*>(context);
+    c->hr = Jpeg_Restart_Decoder::decode(c->wic, c->path, c->image, Chroma_Upsampling::Fancy);
+}
+
+void run_jpeg_restart_benchmark()
+{
+    Jpeg_Context context;
+    if (FAILED(CoCreateInstance(CLSID_WICImagingFactory, nullptr, CLSCTX_INPROC_SERVER, IID_PPV_ARGS(&context.wic))))
+    {
+        wprintf(L"WIC is not available, JPEG decoding is not measured.\n");
+        return;
+    }
+    defer(safe_release(context.wic));
+
+    wchar_t path[MAX_PATH + 1];
+    const DWORD path_length = GetTempPathW(MAX_PATH - 32, path);
+    if (path_length == 0 || !context.image.allocate(image_width, image_height))
+    {
+        wprintf(L"Unable to set up %dx%d JPEG.\n", image_width, image_height);
+        return;
+    }
+    defer(context.image.release());
+    wcscpy_s(path + path_length, MAX_PATH + 1 - path_length, L"ImageViewTests_restart.jpg");
+    context.path = String::reference_to_const_wchar_t(path);
+
+    // Transform that keeps the orientation writes a restart marker at the start of every row of MCUs.
+    HRESULT hr = write_jpeg(context.wic, context.path);
+    if (SUCCEEDED(hr))
+        hr = Jpeg_Transform::transform_file(context.path, Orientation::Normal, false);
+    if (FAILED(hr))
+    {
+        wprintf(L"Unable to write %dx%d JPEG with restart markers (HRESULT %#010x).\n", image_width, image_height, hr);
+        DeleteFileW(path);
+        return;
+    }
+    defer(DeleteFileW(path));
+
+    const double pixel_bytes = static_cast<double>(image_width) * image_height * sizeof(UINT32);
+    wprintf(L"JPEG with restart markers, %dx%d 4:2:0 to 32bppPBGRA, throughput of PBGRA written:\n", image_width, image_height);
+
+    report_benchmark(L"One WIC decoder", measure_ms(bench_serial, &context), pixel_bytes);
+    CHECK(context.hr == S_OK);
+
+    wchar_t name[64];
+    swprintf(name, ARRAYSIZE(name), L"Jpeg_Restart_Decoder, %d threads", g_job_pool->get_thread_count() + 1);
+    report_benchmark(name, measure_ms(bench_bands, &context), pixel_bytes);
+    CHECK(context.hr == S_OK);
+}
@@ -0,0 +1,203 @@
+#include <Windows.h>
+#include <wincodec.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "test.hpp"
+#include "jpeg_restart_decoder.hpp"
+#include "jpeg_transform.hpp"
+#include "pixel_conversion.hpp"
+#include "com_utility.hpp"
+#include "defer.hpp"
+#include "allocator.hpp"
+
+// Just over 'Jpeg_Restart_Decoder::min_pixels', neither side a multiple of 16, so MCUs at the right and
+// bottom edge are partial.
+static const int image_width = 2050;
+static const int image_height = 2056;
+
+struct Subsampling_Case
+{
+    const wchar_t* name;
+    WICJpegYCrCbSubsamplingOption subsampling;
+    // MCUs between restart markers, 0 for a row of MCUs.
+    int restart_interval;
+};
+
+// 4:2:0 with 86 MCUs per interval on rows of 129 MCUs starts a row every 2 rows, bands are cut only
+// there and overlap by 2 rows.
+static const Subsampling_Case cases[] = {
+    { L"4:4:4", WICJpegYCrCbSubsampling444, 0 },
+    { L"4:2:2", WICJpegYCrCbSubsampling422, 0 },
+    { L"4:2:0", WICJpegYCrCbSubsampling420, 0 },
+    { L"4:2:0, restart interval of 2/3 row", WICJpegYCrCbSubsampling420, 86 },
+};
+
+// Noise on gradients, chroma changes from pixel to pixel, so upsampling at band edges shows in the output.
+static void fill_pixels(BYTE* pixels, UINT stride)
+{
+    UINT32 state = 777;
+    for (int y = 0; y < image_height; ++y)
+    {
+        BYTE* row = pixels + static_cast<size_t>(y) * stride;
+        for (int x = 0; x < image_width; ++x)
+        {
+            state = state * 1664525u + 1013904223u;
+            row[3 * x + 0] = static_cast<BYTE>(x * 255 / image_width ^ (state >> 24));
+            row[3 * x + 1] = static_cast<BYTE>(y * 255 / image_height + (state >> 29));
+            row[3 * x + 2] = static_cast<BYTE>((x + y) / 8 ^ (state >> 16));
+        }
+    }
+}
+
+static HRESULT write_jpeg(IWICImagingFactory* wic, const String& path, WICJpegYCrCbSubsamplingOption subsampling)
+{
+    const UINT stride = image_width * 3;
+    const UINT size = stride * image_height;
+    BYTE* pixels = static_cast<BYTE*>(g_standard_allocator->allocate(size));
+    if (pixels == nullptr)
+        return E_OUTOFMEMORY;
+    defer(g_standard_allocator->deallocate(pixels));
+    fill_pixels(pixels, stride);
+
+    IWICStream* stream = nullptr;
+    IWICBitmapEncoder* encoder = nullptr;
+    IWICBitmapFrameEncode* frame = nullptr;
+    IPropertyBag2* properties = nullptr;
+    defer(safe_release(properties));
+    defer(safe_release(frame));
+    defer(safe_release(encoder));
+    defer(safe_release(stream));
+
+    PROPBAG2 option = {};
+    option.pstrName = const_cast<LPOLESTR>(L"JpegYCrCbSubsampling");
+    VARIANT value;
+    VariantInit(&value);
+    value.vt = VT_UI1;
+    value.bVal = static_cast<BYTE>(subsampling);
+
+    WICPixelFormatGUID format = GUID_WICPixelFormat24bppBGR;
+    HRESULT hr = wic->CreateStream(&stream);
+    if (SUCCEEDED(hr))
+        hr = stream->InitializeFromFilename(path.data, GENERIC_WRITE);
+    if (SUCCEEDED(hr))
+        hr = wic->CreateEncoder(GUID_ContainerFormatJpeg, nullptr, &encoder);
+    if (SUCCEEDED(hr))
+        hr = encoder->Initialize(stream, WICBitmapEncoderNoCache);
+    if (SUCCEEDED(hr))
+        hr = encoder->CreateNewFrame(&frame, &properties);
+    if (SUCCEEDED(hr))
+        hr = properties->Write(1, &option, &value);
+    if (SUCCEEDED(hr))
+        hr = frame->Initialize(properties);
+    if (SUCCEEDED(hr))
+        hr = frame->SetSize(image_width, image_height);
+    if (SUCCEEDED(hr))
+        hr = frame->SetPixelFormat(&format);
+    if (SUCCEEDED(hr))
+        hr = IsEqualGUID(format, GUID_WICPixelFormat24bppBGR) ? S_OK : WINCODEC_ERR_UNSUPPORTEDPIXELFORMAT;
+    if (SUCCEEDED(hr))
+        hr = frame->WritePixels(image_height, stride, size, pixels);
+    if (SUCCEEDED(hr))
+        hr = frame->Commit();
+    if (SUCCEEDED(hr))
+        hr = encoder->Commit();
+
+    return hr;
+}
+
+static HRESULT decode_serially(IWICImagingFactory* wic, const String& path, const Image_Buffer& image)
+{
+    IWICBitmapDecoder* decoder = nullptr;
+    IWICBitmapFrameDecode* frame = nullptr;
+    defer(safe_release(frame));
+    defer(safe_release(decoder));
+
+    HRESULT hr = wic->CreateDecoderFromFilename(path.data, nullptr, GENERIC_READ, WICDecodeMetadataCacheOnDemand, &decoder);
+    if (SUCCEEDED(hr))
+        hr = decoder->GetFrame(0, &frame);
+    if (SUCCEEDED(hr))
+    {
+        const WICRect rect = { 0, 0, image_width, image_height };
+        hr = Pixel_Conversion::copy_pixels(wic, frame, rect, image.pixels, image.stride, Chroma_Upsampling::Fancy);
+    }
+
+    return hr;
+}
+
+static int count_different_rows(const Image_Buffer& a, const Image_Buffer& b)
+{
+    int count = 0;
+    for (int y = 0; y < image_height; ++y)
+    {
+        if (memcmp(a.row(y), b.row(y), image_width * sizeof(UINT32)) != 0)
+            ++count;
+    }
+
+    return count;
+}
+
+// Bands decode to the same pixels as the whole image does, every one of them.
+static void test_case(IWICImagingFactory* wic, const String& path, const Subsampling_Case& c, Image_Buffer* serial, Image_Buffer* bands)
+{
+    HRESULT hr = write_jpeg(wic, path, c.subsampling);
+    if (SUCCEEDED(hr))
+        hr = Jpeg_Transform::transform_file(path, Orientation::Normal, false, c.restart_interval);
+    CHECK(hr == S_OK);
+    if (FAILED(hr))
+    {
+        wprintf(L"Unable to write %s JPEG with restart markers (HRESULT %#010x).\n", c.name, hr);
+        return;
+    }
+
+    memset(serial->pixels, 0, serial->size_in_bytes());
+    memset(bands->pixels, 0xFF, bands->size_in_bytes());
+
+    CHECK(decode_serially(wic, path, *serial) == S_OK);
+    hr = Jpeg_Restart_Decoder::decode(wic, path, *bands, Chroma_Upsampling::Fancy);
+    CHECK(hr == S_OK);
+
+    const int different = count_different_rows(*serial, *bands);
+    CHECK(different == 0);
+    if (hr != S_OK || different != 0)
+        wprintf(L"%s: band decoding returned %#010x, %d rows differ from serial decoding.\n", c.name, hr, different);
+}
+
+void run_jpeg_restart_decoder_tests()
+{
+    IWICImagingFactory* wic = nullptr;
+    if (FAILED(CoCreateInstance(CLSID_WICImagingFactory, nullptr, CLSCTX_INPROC_SERVER, IID_PPV_ARGS(&wic))))
+    {
+        wprintf(L"WIC is not available, band decoding is not tested.\n");
+        return;
+    }
+    defer(safe_release(wic));
+
+    // Band decoding needs a worker thread, it's left to serial decoding otherwise.
+    if (g_job_pool->get_thread_count() == 0)
+    {
+        wprintf(L"No worker threads, band decoding is not tested.\n");
+        return;
+    }
+
+    wchar_t path[MAX_PATH + 1];
+    const DWORD path_length = GetTempPathW(MAX_PATH - 32, path);
+    CHECK(path_length > 0);
+    if (path_length == 0)
+        return;
+    wcscpy_s(path + path_length, MAX_PATH + 1 - path_length, L"ImageViewTests_bands.jpg");
+    defer(DeleteFileW(path));
+
+    Image_Buffer serial;
+    Image_Buffer bands;
+    defer(serial.release());
+    defer(bands.release());
+    if (!serial.allocate(image_width, image_height) || !bands.allocate(image_width, image_height))
+    {
+        wprintf(L"Not enough memory for two %dx%d images.\n", image_width, image_height);
+        return;
+    }
+
+    for (int i = 0; i < ARRAYSIZE(cases); ++i)
+        test_case(wic, String::reference_to_const_wchar_t(path), cases[i], &serial, &bands);
+}
@@ -0,0 +1,105 @@
+#include <Windows.h>
+#include <string.h>
+
+#include "test.hpp"
+#include "line_reader.hpp"
+#include "allocator.hpp"
+
+// Lines from a few bytes to several windows long, so they start and end at every distance from window edges.
+static const int line_count = 200;
+static const int long_line_length = 300 * 1024;
+
+static int get_line_length(int i)
+{
+    if (i % 50 == 0)
+        return long_line_length;
+
+    return (i * 7919) % 70000;
+}
+
+static void fill_line(char* line, int length, int i)
+{
+    for (int j = 0; j < length; ++j)
+        line[j] = static_cast<char>('a' + (i + j) % 26);
+}
+
+static bool write_file(const wchar_t* path, const char* data, DWORD size)
+{
+    HANDLE file = CreateFileW(path, GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+
+    DWORD written = 0;
+    const BOOL ok = WriteFile(file, data, size, &written, nullptr);
+    CloseHandle(file);
+
+    return ok && written == size;
+}
+
+// Lines crossing the window end, including ones longer than the whole window, come back whole. CRLF
+// endings are trimmed and the last line doesn't need a newline.
+static void test_lines_across_windows()
+{
+    size_t size = 0;
+    for (int i = 0; i < line_count; ++i)
+        size += get_line_length(i) + 2;
+
+    char* text = static_cast<char*>(g_standard_allocator->allocate(size));
+    CHECK(text != nullptr);
+    if (text == nullptr)
+        return;
+
+    size_t position = 0;
+    for (int i = 0; i < line_count; ++i)
+    {
+        const int length = get_line_length(i);
+        fill_line(text + position, length, i);
+        position += length;
+
+        if (i + 1 < line_count)
+        {
+            if (i % 3 == 0)
+                text[position++] = '\r';
+            text[position++] = '\n';
+        }
+    }
+
+    wchar_t path[MAX_PATH + 1];
+    const DWORD path_length = GetTempPathW(MAX_PATH - 32, path);
+    CHECK(path_length > 0);
+    wcscpy_s(path + path_length, MAX_PATH + 1 - path_length, L"ImageViewTests_lines.txt");
+
+    const bool written = write_file(path, text, static_cast<DWORD>(position));
+    CHECK(written);
+    if (written)
+    {
+        File_Line_Reader reader;
+        CHECK(SUCCEEDED(reader.open(String::reference_to_const_wchar_t(path), 1)));
+
+        int read = 0;
+        Utf8_String line;
+        position = 0;
+        while (reader.next_line(&line))
+        {
+            const int length = get_line_length(read);
+            CHECK(line.count == length);
+            CHECK(line.count == length && memcmp(line.data, text + position, length) == 0);
+
+            position += length + (read % 3 == 0 ? 2 : 1);
+            ++read;
+        }
+
+        CHECK(reader.error == S_OK);
+        CHECK(read == line_count);
+
+        reader.close();
+        DeleteFileW(path);
+    }
+
+    g_standard_allocator->deallocate(text);
+}
+
+void run_line_reader_tests()
+{
+    test_lines_across_windows();
+}
@@ -0,0 +1,64 @@
+#include <Windows.h>
+#include <stdio.h>
+#include <wchar.h>
+
+#include "test.hpp"
+#include "allocator.hpp"
+#include "cpu_features.hpp"
+#include "job_pool.hpp"
+
+static void run_tests()
+{
+    run_utf8_tests();
+    run_line_reader_tests();
+    run_string_builder_tests();
+    run_memory_governor_tests();
+    run_exif_reader_tests();
+    run_name_index_tests();
+    run_jpeg_restart_decoder_tests();
+    run_image_rotation_tests();
+    run_bcn_decoder_tests();
+}
+
+static void run_benchmarks()
+{
+    run_string_benchmark();
+    run_format_benchmark();
+    run_pixel_conversion_benchmark();
+    run_name_index_benchmark();
+    run_jpeg_restart_benchmark();
+}
+
+// Runs the tests and returns the number of failed checks. With "bench" as the first argument runs the
+// benchmarks instead, they're meant for Release builds.
+int wmain(int argc, wchar_t** argv)
+{
+    if (!g_temporary_allocator->set_size(32 * 1024))
+    {
+        wprintf(L"Unable to initialize temporary allocator.\n");
+        return -1;
+    }
+
+    if (!g_job_pool->initialize(g_cpu_features.logical_processor_count - 1))
+        wprintf(L"Unable to start all worker threads.\n");
+
+    wprintf(L"%d logical processors, SSE2 %d, SSSE3 %d, SSE4.1 %d, AVX2 %d, NEON %d\n", g_cpu_features.logical_processor_count,
+        g_cpu_features.has_sse2, g_cpu_features.has_ssse3, g_cpu_features.has_sse41, g_cpu_features.has_avx2, g_cpu_features.has_neon);
+
+    // Benchmarks compare with WIC, which is what some modules replaced.
+    const HRESULT com_hr = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+
+    if (argc > 1 && wcscmp(argv[1], L"bench") == 0)
+        run_benchmarks();
+    else
+        run_tests();
+
+    g_job_pool->shutdown();
+    if (SUCCEEDED(com_hr))
+        CoUninitialize();
+
+    const int failed = get_failed_check_count();
+    wprintf(failed == 0 ? L"All checks passed.\n" : L"%d checks failed.\n", failed);
+
+    return failed;
+}
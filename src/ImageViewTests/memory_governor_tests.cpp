@@ -0,0 +1,191 @@
+#include <Windows.h>
+#include <stdio.h>
+
+#include "test.hpp"
+#include "memory_governor.hpp"
+#include "image_cache.hpp"
+#include "tile_cache.hpp"
+#include "windows_utility.hpp"
+#include "allocator.hpp"
+
+// Caches are given a fixed share of 'memory_cap' like the governor gives them a share of physical memory,
+// so the test behaves the same on every machine.
+static const size_t memory_cap = 512 * 1024 * 1024;
+static const size_t image_cache_budget = memory_cap / Memory_Governor::cache_share_of_physical;
+static const size_t compressed_budget = memory_cap / 16;
+static const size_t tile_cache_budget = memory_cap / 8;
+static const int tile_size = 256;
+
+// Folder of photos and scans, from ones that are decoded whole to ones far over the cache budget.
+struct Folder_Image
+{
+    int width;
+    int height;
+};
+
+static const Folder_Image folder[] =
+{
+    { 4000, 3000 }, { 6000, 4000 }, { 8000, 6000 }, { 4000, 3000 }, { 24000, 16000 }, { 6000, 4000 },
+    { 3000, 4000 }, { 12000, 9000 }, { 4000, 3000 }, { 60000, 40000 }, { 5000, 3500 }, { 4000, 6000 },
+};
+
+// Gradient with some detail, it compresses about like a photo does.
+static void fill_pixels(Image_Buffer* pixels, int seed)
+{
+    for (int y = 0; y < pixels->height; ++y)
+    {
+        UINT32* row = pixels->row(y);
+        for (int x = 0; x < pixels->width; ++x)
+            row[x] = 0xFF000000u | ((x + seed) & 0xFF) << 16 | ((y + seed) & 0xFF) << 8 | ((x ^ y) & 0x3F);
+    }
+}
+
+static void get_path(int index, wchar_t* path, int size)
+{
+    swprintf(path, size, L"C:\\Scans\\image_%03d.png", index);
+}
+
+// What the window does for an image the governor refuses: tiles of the visible part are decoded while
+// the view pans over it, the cache stays within its budget however far it goes.
+static bool view_in_tiles(const Folder_Image& image, int seed)
+{
+    const size_t tile_bytes = tile_size * tile_size * sizeof(UINT32);
+    const size_t budget = g_memory_governor->get_tile_budget(tile_cache_budget);
+    CHECK(budget <= tile_cache_budget);
+
+    Tile_Cache cache;
+    if (!cache.initialize(max(static_cast<int>(budget / tile_bytes), 16)))
+        return false;
+
+    bool is_allocated = true;
+    const int x_count = (image.width + tile_size - 1) / tile_size;
+    const int y_count = (image.height + tile_size - 1) / tile_size;
+    const int tile_count = min(x_count * y_count, 2 * cache.get_max_tiles());
+    for (int i = 0; i < tile_count && is_allocated; ++i)
+    {
+        Tile* tile = cache.insert(0, i % x_count, i / x_count);
+        is_allocated = tile->pixels.allocate(tile_size, tile_size);
+        if (is_allocated)
+            fill_pixels(&tile->pixels, seed + i);
+    }
+
+    CHECK(cache.get_count() <= cache.get_max_tiles());
+    cache.release();
+
+    return is_allocated;
+}
+
+// Image the governor approves is decoded whole with its mip levels and cached, like the window does.
+static Mip_Pyramid* view_whole(const String& path, const FILETIME& date_modified, const Folder_Image& image, int seed)
+{
+    Image_Buffer pixels;
+    if (!pixels.allocate(image.width, image.height))
+        return nullptr;
+    fill_pixels(&pixels, seed);
+
+    Mip_Pyramid levels;
+    if (!levels.build(&pixels))
+    {
+        levels.release();
+        return nullptr;
+    }
+
+    Mip_Pyramid* cached = g_image_cache->insert(path, date_modified, &levels);
+    if (cached == nullptr)
+        levels.release();
+
+    return cached;
+}
+
+// Going back and forth through a folder of giant images never takes more than the cap: images over
+// the budget are tiled, cached ones are evicted or compressed before the next one is decoded.
+static void test_folder_of_giant_images()
+{
+    g_image_cache->clear();
+    g_image_cache->set_budget(image_cache_budget);
+    g_image_cache->set_compressed_budget(compressed_budget);
+
+    size_t working_set_before = 0;
+    size_t peak_before = 0;
+    const bool has_working_set = Windows_Utility::get_working_set(&working_set_before, &peak_before);
+    const double start = Windows_Utility::get_time_ms();
+
+    const FILETIME date_modified = { 1, 1 };
+    const int image_count = ARRAYSIZE(folder);
+    int whole_count = 0;
+    int tiled_count = 0;
+    int failed_count = 0;
+
+    // Forward, back and forward again, so cached and compressed images are shown as well.
+    for (int step = 0; step < 3 * image_count; ++step)
+    {
+        const int pass = step / image_count;
+        const int index = pass == 1 ? image_count - 1 - step % image_count : step % image_count;
+        const Folder_Image& image = folder[index];
+
+        wchar_t path_text[64];
+        get_path(index, path_text, ARRAYSIZE(path_text));
+        const String path = String::reference_to_const_wchar_t(path_text);
+
+        Mip_Pyramid* shown = g_image_cache->find(path, date_modified);
+        if (shown == nullptr && g_image_cache->is_compressed(path, date_modified))
+            shown = g_image_cache->restore(path, date_modified);
+
+        if (shown == nullptr)
+        {
+            const UINT64 decoded_size = static_cast<UINT64>(image.width) * image.height * sizeof(UINT32) * 4 / 3;
+            if (g_memory_governor->request_image_memory(decoded_size))
+            {
+                shown = view_whole(path, date_modified, image, index);
+                if (shown == nullptr)
+                    ++failed_count;
+            }
+            else
+            {
+                CHECK(decoded_size > image_cache_budget || g_memory_governor->is_memory_low());
+                if (view_in_tiles(image, index))
+                    ++tiled_count;
+                else
+                    ++failed_count;
+            }
+        }
+
+        if (shown != nullptr)
+        {
+            ++whole_count;
+            CHECK(shown->base().width == image.width && shown->base().height == image.height);
+        }
+
+        CHECK(g_image_cache->get_size_in_bytes() <= image_cache_budget);
+        CHECK(g_image_cache->get_compressed_size_in_bytes() <= compressed_budget);
+    }
+
+    CHECK(failed_count == 0);
+    CHECK(whole_count > 0);
+    CHECK(tiled_count > 0);
+
+    // Peak counts the caches, the image being decoded and the allocator's slack, it has to stay under the cap.
+    size_t working_set = 0;
+    size_t peak = 0;
+    if (has_working_set && Windows_Utility::get_working_set(&working_set, &peak))
+    {
+        CHECK(peak <= working_set_before + memory_cap);
+        wprintf(L"Folder of %d giant images viewed 3 times in %.0f ms, %d times whole, %d times in tiles. Peak working set %zu MB, cap %zu MB over %zu MB.\n",
+            image_count, Windows_Utility::get_time_ms() - start, whole_count, tiled_count, peak / (1024 * 1024),
+            memory_cap / (1024 * 1024), working_set_before / (1024 * 1024));
+    }
+
+    g_image_cache->clear();
+}
+
+void run_memory_governor_tests()
+{
+    if (!g_memory_governor->initialize())
+    {
+        wprintf(L"Unable to initialize memory governor.\n");
+        return;
+    }
+
+    test_folder_of_giant_images();
+    g_memory_governor->shutdown();
+}
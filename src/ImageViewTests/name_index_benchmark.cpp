@@ -0,0 +1,172 @@
+#include <Windows.h>
+#include <stdio.h>
+#include <wchar.h>
+
+#include "test.hpp"
+#include "name_index.hpp"
+#include "string_simd.hpp"
+#include "windows_utility.hpp"
+#include "allocator.hpp"
+
+// Folder of a million photos, the size the index is meant for.
+static const int file_count = 1000 * 1000;
+static const int max_name_length = 64;
+
+// Typed one key at a time, then erased with Backspace. Its first trigram is in half of the names.
+static const wchar_t typed_filter[] = L"img_00012";
+// Lengths of it measured on their own: a code unit, a trigram and the whole filter.
+static const int measured_lengths[] = { 1, 3, ARRAYSIZE(typed_filter) - 1 };
+
+struct Name_Context
+{
+    Sequence<File_Info> files;
+    Name_Index index;
+    Name_Matches matches;
+    const wchar_t* query = nullptr;
+    int query_length = 0;
+    int match_count = 0;
+};
+
+static void make_name(int i, wchar_t* buffer, int size)
+{
+    switch (i % 4)
+    {
+        case 0: swprintf(buffer, size, L"IMG_%04d%02d%02d_%06d.JPG", 2010 + i % 12, 1 + i % 12, 1 + i % 28, i); break;
+        case 1: swprintf(buffer, size, L"img_%08d.jpg", i); break;
+        case 2: swprintf(buffer, size, L"DSC%05d.jpg", i % 100000); break;
+        case 3: swprintf(buffer, size, L"Screenshot %04d-%02d-%02d %06d.png", 2015 + i % 8, 1 + i % 12, 1 + i % 28, i); break;
+    }
+}
+
+static wchar_t* make_files(Sequence<File_Info>* files)
+{
+    wchar_t* text = static_cast<wchar_t*>(g_standard_allocator->allocate(sizeof(wchar_t) * file_count * max_name_length));
+    if (text == nullptr || !files->reserve(file_count))
+    {
+        g_standard_allocator->deallocate(text);
+        return nullptr;
+    }
+
+    for (int i = 0; i < file_count; ++i)
+    {
+        wchar_t* name = text + static_cast<size_t>(i) * max_name_length;
+        make_name(i, name, max_name_length);
+        files->data[i] = File_Info();
+        files->data[i].path = String(name, static_cast<int>(wcslen(name)));
+    }
+    files->count = file_count;
+
+    return text;
+}
+
+// Every name checked on every key, what filtering did without the index.
+static void bench_every_name(void* context)
+{
+    Name_Context* c = static_cast<Name_Context*>(context);
+    wchar_t folded[Name_Index::max_query_length];
+    for (int i = 0; i < c->query_length; ++i)
+        folded[i] = String_Simd::fold_char(c->query[i]);
+
+    int count = 0;
+    for (int i = 0; i < c->files.count; ++i)
+    {
+        const String& name = c->files.data[i].path;
+        for (int k = 0; k + c->query_length <= name.count; ++k)
+        {
+            if (String_Simd::equal_ignore_case(name.data + k, folded, c->query_length))
+            {
+                ++count;
+                break;
+            }
+        }
+    }
+
+    c->match_count = count;
+}
+
+// Query found without matches of a shorter one, e.g. after the files are sorted.
+static void bench_index_query(void* context)
+{
+    Name_Context* c = static_cast<Name_Context*>(context);
+    c->matches.clear();
+    c->matches.find(c->index, c->files, String(c->query, c->query_length));
+    c->match_count = c->matches.get_count();
+}
+
+static void bench_typing(void* context)
+{
+    Name_Context* c = static_cast<Name_Context*>(context);
+    c->matches.clear();
+    for (int length = 1; length <= c->query_length; ++length)
+        c->matches.find(c->index, c->files, String(c->query, length));
+    c->match_count = c->matches.get_count();
+}
+
+// Fastest of erasing the whole filter a few times, typing it again isn't measured.
+static double measure_backspace_ms(Name_Context* c)
+{
+    double fastest = 0.0;
+    for (int run = 0; run < 7; ++run)
+    {
+        bench_typing(c);
+
+        const double start = Windows_Utility::get_time_ms();
+        for (int length = c->query_length - 1; length >= 1; --length)
+            c->matches.find(c->index, c->files, String(c->query, length));
+        const double ms = Windows_Utility::get_time_ms() - start;
+
+        if (run == 0 || ms < fastest)
+            fastest = ms;
+    }
+
+    c->match_count = c->matches.get_count();
+    return fastest;
+}
+
+void run_name_index_benchmark()
+{
+    Name_Context context;
+    wchar_t* text = make_files(&context.files);
+    if (text == nullptr)
+    {
+        wprintf(L"Not enough memory for %d file names.\n", file_count);
+        return;
+    }
+
+    const double build_start = Windows_Utility::get_time_ms();
+    context.index.start(nullptr, WM_NULL, context.files);
+    while (!context.index.finish())
+        Sleep(1);
+
+    wprintf(L"Name_Index, %d names, built in %.0f ms:\n", file_count, Windows_Utility::get_time_ms() - build_start);
+
+    const int typed_length = ARRAYSIZE(typed_filter) - 1;
+    wchar_t name[96];
+    for (int i = 0; i < ARRAYSIZE(measured_lengths); ++i)
+    {
+        const int length = measured_lengths[i];
+        context.query = typed_filter;
+        context.query_length = length;
+
+        swprintf(name, ARRAYSIZE(name), L"\"%.*s\", every name checked", length, typed_filter);
+        report_benchmark(name, measure_ms(bench_every_name, &context));
+        const int expected = context.match_count;
+
+        swprintf(name, ARRAYSIZE(name), L"\"%.*s\", index, %d matches", length, typed_filter, expected);
+        report_benchmark(name, measure_ms(bench_index_query, &context));
+        CHECK(context.match_count == expected);
+    }
+
+    context.query = typed_filter;
+    context.query_length = typed_length;
+    swprintf(name, ARRAYSIZE(name), L"Typing \"%s\", all %d keys", typed_filter, typed_length);
+    report_benchmark(name, measure_ms(bench_typing, &context));
+
+    swprintf(name, ARRAYSIZE(name), L"Backspace to \"%.1s\", all %d keys", typed_filter, typed_length - 1);
+    report_benchmark(name, measure_backspace_ms(&context));
+
+    context.matches.release();
+    context.index.release();
+    g_standard_allocator->deallocate(context.files.data);
+    g_standard_allocator->deallocate(text);
+}
@@ -0,0 +1,121 @@
+#include <Windows.h>
+#include <stdio.h>
+#include <wchar.h>
+
+#include "test.hpp"
+#include "name_index.hpp"
+#include "string_simd.hpp"
+#include "allocator.hpp"
+
+static const int file_count = 3000;
+static const int max_name_length = 32;
+
+// Runs of 'x' of every length up to 'max_run' make each 'x' typed drop only a few matches, so keeping
+// those of all the prefixes would pass 'max_kept_files'.
+static const int max_run = 24;
+
+static void make_name(int i, wchar_t* buffer, int size)
+{
+    switch (i % 4)
+    {
+        case 0: swprintf(buffer, size, L"IMG_%04d.JPG", i); break;
+        case 1: swprintf(buffer, size, L"img_%04d_Edit.jpg", i % 1000); break;
+        case 2: swprintf(buffer, size, L"Image %d.png", i); break;
+        case 3: swprintf(buffer, size, L"%.*s %d.tif", 1 + i % max_run, L"XXXXXXXXXXXXXXXXXXXXXXXX", i); break;
+    }
+}
+
+static int count_matches(const Sequence<File_Info>& files, const wchar_t* query, int query_length)
+{
+    int count = 0;
+    for (int i = 0; i < files.count; ++i)
+    {
+        const String& name = files.data[i].path;
+        for (int k = 0; k + query_length <= name.count; ++k)
+        {
+            if (String_Simd::equal_ignore_case(name.data + k, query, query_length))
+            {
+                ++count;
+                break;
+            }
+        }
+    }
+
+    return count;
+}
+
+// Matches are ascending and as many as a check of every name finds.
+static void check_matches(const Name_Matches& matches, const Sequence<File_Info>& files, const wchar_t* query, int query_length)
+{
+    const int* data = matches.get_data();
+    const int count = matches.get_count();
+    for (int i = 1; i < count; ++i)
+        CHECK(data[i - 1] < data[i]);
+
+    wchar_t folded[Name_Index::max_query_length];
+    for (int i = 0; i < query_length; ++i)
+        folded[i] = String_Simd::fold_char(query[i]);
+
+    CHECK(count == count_matches(files, folded, query_length));
+}
+
+// Keys typed and erased with Backspace, '\b', find the same files as a new query of the filter does,
+// with and without the index.
+static void test_typing(const Name_Index& index, const Sequence<File_Info>& files)
+{
+    static const wchar_t* keys = L"img_\b\b\bMAGE 1\b\b\b\b\b\b\bimg_00\b\b\b12_e\b\b\b\b\b\b\b\b\b\b_edit\b\b\b\b\b"
+        L"xxxxxxxxxxxxxxxxxxxx\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\bxxxxxxxxxxxx 1\b\b\b\b\b\b\b\b\b\b\b\b\b\b";
+
+    Name_Matches matches;
+    wchar_t filter[Name_Index::max_query_length];
+    int filter_length = 0;
+    for (const wchar_t* key = keys; *key != 0; ++key)
+    {
+        if (*key == L'\b')
+            filter_length = max(filter_length - 1, 0);
+        else
+            filter[filter_length++] = *key;
+
+        if (filter_length == 0)
+            continue;
+
+        CHECK(matches.find(index, files, String(filter, filter_length)));
+        check_matches(matches, files, filter, filter_length);
+    }
+
+    matches.release();
+}
+
+void run_name_index_tests()
+{
+    wchar_t* text = static_cast<wchar_t*>(g_standard_allocator->allocate(sizeof(wchar_t) * file_count * max_name_length));
+    Sequence<File_Info> files;
+    if (text == nullptr || !files.reserve(file_count))
+    {
+        wprintf(L"Not enough memory for %d file names.\n", file_count);
+        g_standard_allocator->deallocate(text);
+        return;
+    }
+
+    for (int i = 0; i < file_count; ++i)
+    {
+        wchar_t* name = text + i * max_name_length;
+        make_name(i, name, max_name_length);
+        files.data[i] = File_Info();
+        files.data[i].path = String(name, static_cast<int>(wcslen(name)));
+    }
+    files.count = file_count;
+
+    Name_Index index;
+    test_typing(index, files);
+
+    index.start(nullptr, WM_NULL, files);
+    while (!index.finish())
+        Sleep(1);
+    CHECK(index.is_built());
+    test_typing(index, files);
+
+    index.release();
+    g_standard_allocator->deallocate(files.data);
+    g_standard_allocator->deallocate(text);
+}
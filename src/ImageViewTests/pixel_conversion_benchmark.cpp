@@ -0,0 +1,171 @@
+#include <Windows.h>
+#include <wincodec.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "test.hpp"
+#include "pixel_conversion.hpp"
+#include "com_utility.hpp"
+#include "allocator.hpp"
+
+// 16 MB of PBGRA output, larger than caches like a photo is.
+static const int image_width = 4096;
+static const int image_height = 1024;
+
+struct Layout_Format
+{
+    Pixel_Layout layout;
+    const WICPixelFormatGUID* format;
+    const wchar_t* name;
+};
+
+static const Layout_Format layout_formats[] =
+{
+    { Pixel_Layout::Pbgra32,  &GUID_WICPixelFormat32bppPBGRA,  L"32bppPBGRA" },
+    { Pixel_Layout::Prgba32,  &GUID_WICPixelFormat32bppPRGBA,  L"32bppPRGBA" },
+    { Pixel_Layout::Bgra32,   &GUID_WICPixelFormat32bppBGRA,   L"32bppBGRA" },
+    { Pixel_Layout::Rgba32,   &GUID_WICPixelFormat32bppRGBA,   L"32bppRGBA" },
+    { Pixel_Layout::Bgr32,    &GUID_WICPixelFormat32bppBGR,    L"32bppBGR" },
+    { Pixel_Layout::Rgb32,    &GUID_WICPixelFormat32bppRGB,    L"32bppRGB" },
+    { Pixel_Layout::Bgr24,    &GUID_WICPixelFormat24bppBGR,    L"24bppBGR" },
+    { Pixel_Layout::Rgb24,    &GUID_WICPixelFormat24bppRGB,    L"24bppRGB" },
+    { Pixel_Layout::Gray8,    &GUID_WICPixelFormat8bppGray,    L"8bppGray" },
+    { Pixel_Layout::Gray16,   &GUID_WICPixelFormat16bppGray,   L"16bppGray" },
+    { Pixel_Layout::Bgr48,    &GUID_WICPixelFormat48bppBGR,    L"48bppBGR" },
+    { Pixel_Layout::Rgb48,    &GUID_WICPixelFormat48bppRGB,    L"48bppRGB" },
+    { Pixel_Layout::Bgra64,   &GUID_WICPixelFormat64bppBGRA,   L"64bppBGRA" },
+    { Pixel_Layout::Rgba64,   &GUID_WICPixelFormat64bppRGBA,   L"64bppRGBA" },
+    { Pixel_Layout::Indexed1, &GUID_WICPixelFormat1bppIndexed, L"1bppIndexed" },
+    { Pixel_Layout::Indexed2, &GUID_WICPixelFormat2bppIndexed, L"2bppIndexed" },
+    { Pixel_Layout::Indexed4, &GUID_WICPixelFormat4bppIndexed, L"4bppIndexed" },
+    { Pixel_Layout::Indexed8, &GUID_WICPixelFormat8bppIndexed, L"8bppIndexed" },
+};
+
+struct Conversion_Context
+{
+    Pixel_Layout layout = Pixel_Layout::Unknown;
+    const BYTE* source = nullptr;
+    UINT source_stride = 0;
+    UINT32* destination = nullptr;
+    UINT32 palette[Pixel_Conversion::palette_size];
+    // Same pixels for IWICFormatConverter, which did the conversion before own kernels.
+    IWICFormatConverter* converter = nullptr;
+};
+
+static void bench_convert_row(void* context)
+{
+    Conversion_Context* c = static_cast<Conversion_Context*>(context);
+    for (int y = 0; y < image_height; ++y)
+        Pixel_Conversion::convert_row(c->layout, c->source + static_cast<size_t>(y) * c->source_stride,
+            c->destination + static_cast<size_t>(y) * image_width, image_width, c->palette);
+}
+
+static void bench_wic_converter(void* context)
+{
+    Conversion_Context* c = static_cast<Conversion_Context*>(context);
+    const WICRect rect = { 0, 0, image_width, image_height };
+    const UINT size = image_width * image_height * sizeof(UINT32);
+    c->converter->CopyPixels(&rect, image_width * sizeof(UINT32), size, reinterpret_cast<BYTE*>(c->destination));
+}
+
+// Wraps 'source' into a WIC bitmap and a converter to PBGRA. Returns nullptr when WIC doesn't convert the format.
+static IWICFormatConverter* create_wic_converter(IWICImagingFactory* wic, const Layout_Format& layout_format,
+    BYTE* source, UINT source_stride, const UINT32* palette_colors)
+{
+    IWICBitmap* bitmap = nullptr;
+    HRESULT hr = wic->CreateBitmapFromMemory(image_width, image_height, *layout_format.format, source_stride,
+        source_stride * image_height, source, &bitmap);
+    if (FAILED(hr))
+        return nullptr;
+
+    const int bits = Pixel_Conversion::bits_per_pixel(layout_format.layout);
+    if (layout_format.layout >= Pixel_Layout::Indexed1)
+    {
+        IWICPalette* palette = nullptr;
+        hr = wic->CreatePalette(&palette);
+        if (SUCCEEDED(hr))
+            hr = palette->InitializeCustom(const_cast<WICColor*>(palette_colors), 1u << bits);
+        if (SUCCEEDED(hr))
+            hr = bitmap->SetPalette(palette);
+
+        safe_release(palette);
+    }
+
+    IWICFormatConverter* converter = nullptr;
+    if (SUCCEEDED(hr))
+        hr = wic->CreateFormatConverter(&converter);
+    if (SUCCEEDED(hr))
+        hr = converter->Initialize(bitmap, GUID_WICPixelFormat32bppPBGRA, WICBitmapDitherTypeNone, nullptr, 0.0, WICBitmapPaletteTypeCustom);
+
+    safe_release(bitmap);
+    if (FAILED(hr))
+        safe_release(converter);
+
+    return converter;
+}
+
+void run_pixel_conversion_benchmark()
+{
+    // Largest source layout is 64 bits per pixel.
+    const UINT max_source_stride = image_width * 8;
+    BYTE* source = static_cast<BYTE*>(g_standard_allocator->allocate(static_cast<size_t>(max_source_stride) * image_height));
+    UINT32* destination = static_cast<UINT32*>(g_standard_allocator->allocate(static_cast<size_t>(image_width) * image_height * sizeof(UINT32)));
+    if (source == nullptr || destination == nullptr)
+    {
+        wprintf(L"Not enough memory for pixel conversion images.\n");
+        g_standard_allocator->deallocate(source);
+        g_standard_allocator->deallocate(destination);
+        return;
+    }
+
+    // Noise, alpha included, indices cover whole palette.
+    UINT32 state = 12345;
+    for (size_t i = 0; i < static_cast<size_t>(max_source_stride) * image_height; ++i)
+    {
+        state = state * 1664525u + 1013904223u;
+        source[i] = static_cast<BYTE>(state >> 24);
+    }
+
+    WICColor palette_colors[Pixel_Conversion::palette_size];
+    for (int i = 0; i < Pixel_Conversion::palette_size; ++i)
+        palette_colors[i] = 0x80000000u | (i * 0x010203u);
+
+    IWICImagingFactory* wic = nullptr;
+    if (FAILED(CoCreateInstance(CLSID_WICImagingFactory, nullptr, CLSCTX_INPROC_SERVER, IID_PPV_ARGS(&wic))))
+        wprintf(L"WIC is not available, only own kernels are measured.\n");
+
+    wprintf(L"Pixel_Conversion, %dx%d to 32bppPBGRA, throughput of PBGRA written:\n", image_width, image_height);
+    const double destination_bytes = static_cast<double>(image_width) * image_height * sizeof(UINT32);
+
+    Conversion_Context context;
+    for (int i = 0; i < ARRAYSIZE(layout_formats); ++i)
+    {
+        const Layout_Format& layout_format = layout_formats[i];
+        const UINT stride = (image_width * Pixel_Conversion::bits_per_pixel(layout_format.layout) + 7) / 8;
+
+        context.layout = layout_format.layout;
+        context.source = source;
+        context.source_stride = stride;
+        context.destination = destination;
+        memcpy(context.palette, palette_colors, sizeof(palette_colors));
+        Pixel_Conversion::premultiply_palette(context.palette, Pixel_Conversion::palette_size);
+
+        wchar_t name[64];
+        swprintf(name, ARRAYSIZE(name), L"%s, own kernel", layout_format.name);
+        report_benchmark(name, measure_ms(bench_convert_row, &context), destination_bytes);
+
+        if (wic != nullptr)
+            context.converter = create_wic_converter(wic, layout_format, source, stride, palette_colors);
+
+        if (context.converter != nullptr)
+        {
+            swprintf(name, ARRAYSIZE(name), L"%s, IWICFormatConverter", layout_format.name);
+            report_benchmark(name, measure_ms(bench_wic_converter, &context), destination_bytes);
+            safe_release(context.converter);
+        }
+    }
+
+    safe_release(wic);
+    g_standard_allocator->deallocate(source);
+    g_standard_allocator->deallocate(destination);
+}
@@ -0,0 +1,294 @@
+#include <Windows.h>
+#include <stdio.h>
+#include <wchar.h>
+
+#include "test.hpp"
+#include "string.hpp"
+#include "string_simd.hpp"
+#include "allocator.hpp"
+
+static const int corpus_count = 200 * 1000;
+static const int max_path_length = 128;
+
+// Absolute paths of files named the way cameras, phones and people name them, in folders of a photo library.
+struct Corpus
+{
+    wchar_t* text = nullptr;
+    String* paths = nullptr;
+    // File name part of 'paths'.
+    String* names = nullptr;
+    // Copies of 'names' in upper case.
+    String* upper_names = nullptr;
+    double path_bytes = 0.0;
+    double name_bytes = 0.0;
+    volatile int sink = 0;
+};
+
+static const wchar_t* albums[] = {
+    L"Camera Roll", L"Trip to the mountains", L"Birthday", L"Screenshots", L"Scans", L"Wedding - edited", L"Misc",
+};
+
+static void make_name(int i, wchar_t* buffer, int size)
+{
+    switch (i % 6)
+    {
+        case 0: swprintf(buffer, size, L"IMG_%04d.JPG", i % 10000); break;
+        case 1: swprintf(buffer, size, L"DSC%05d.jpg", i % 100000); break;
+        case 2: swprintf(buffer, size, L"%04d%02d%02d_%06d.jpg", 2010 + i % 12, 1 + i % 12, 1 + i % 28, i); break;
+        case 3: swprintf(buffer, size, L"Screenshot %04d-%02d-%02d %02d%02d%02d.png", 2015 + i % 8, 1 + i % 12, 1 + i % 28, i % 24, i % 60, i % 59); break;
+        case 4: swprintf(buffer, size, L"scan_%d.tif", i); break;
+        case 5: swprintf(buffer, size, L"Panorama %d (edited, final).jpeg", i); break;
+    }
+}
+
+static bool make_corpus(Corpus* corpus)
+{
+    const size_t text_size = static_cast<size_t>(corpus_count) * 3 * max_path_length * sizeof(wchar_t);
+    corpus->text = static_cast<wchar_t*>(g_standard_allocator->allocate(text_size));
+    corpus->paths = static_cast<String*>(g_standard_allocator->allocate(corpus_count * sizeof(String)));
+    corpus->names = static_cast<String*>(g_standard_allocator->allocate(corpus_count * sizeof(String)));
+    corpus->upper_names = static_cast<String*>(g_standard_allocator->allocate(corpus_count * sizeof(String)));
+    if (corpus->text == nullptr || corpus->paths == nullptr || corpus->names == nullptr || corpus->upper_names == nullptr)
+        return false;
+
+    wchar_t name[max_path_length];
+    for (int i = 0; i < corpus_count; ++i)
+    {
+        make_name(i, name, max_path_length);
+
+        wchar_t* path = corpus->text + static_cast<size_t>(i) * 3 * max_path_length;
+        const int path_length = swprintf(path, max_path_length, L"C:\\Users\\Public\\Pictures\\%d\\%s\\%s",
+            2010 + i % 12, albums[i % ARRAYSIZE(albums)], name);
+        const int name_length = static_cast<int>(wcslen(name));
+        corpus->paths[i] = String(path, path_length);
+        corpus->names[i] = String(path + path_length - name_length, name_length);
+
+        wchar_t* upper = path + 2 * max_path_length;
+        for (int j = 0; j <= name_length; ++j)
+            upper[j] = name[j] >= L'a' && name[j] <= L'z' ? name[j] - L'a' + L'A' : name[j];
+        corpus->upper_names[i] = String(upper, name_length);
+
+        corpus->path_bytes += path_length * sizeof(wchar_t);
+        corpus->name_bytes += name_length * sizeof(wchar_t);
+    }
+
+    return true;
+}
+
+static void release_corpus(Corpus* corpus)
+{
+    g_standard_allocator->deallocate(corpus->text);
+    g_standard_allocator->deallocate(corpus->paths);
+    g_standard_allocator->deallocate(corpus->names);
+    g_standard_allocator->deallocate(corpus->upper_names);
+}
+
+#pragma region Baseline
+// Loops String used before it was vectorized.
+static int scalar_index_of(const String& string, wchar_t c)
+{
+    for (int i = 0; i < string.count; ++i)
+    {
+        if (string.data[i] == c)
+            return i;
+    }
+
+    return -1;
+}
+
+static int scalar_last_index_of(const String& string, wchar_t c)
+{
+    for (int i = string.count - 1; i >= 0; --i)
+    {
+        if (string.data[i] == c)
+            return i;
+    }
+
+    return -1;
+}
+
+static bool scalar_equals(const String& a, const String& b)
+{
+    if (a.count != b.count)
+        return false;
+
+    for (int i = 0; i < a.count; ++i)
+    {
+        if (a.data[i] != b.data[i])
+            return false;
+    }
+
+    return true;
+}
+
+static bool scalar_equals_ignore_case(const String& a, const String& b)
+{
+    if (a.count != b.count)
+        return false;
+
+    for (int i = 0; i < a.count; ++i)
+    {
+        if (String_Simd::fold_char(a.data[i]) != String_Simd::fold_char(b.data[i]))
+            return false;
+    }
+
+    return true;
+}
+
+static bool scalar_ends_with_ignore_case(const String& string, const wchar_t* suffix)
+{
+    const int suffix_length = static_cast<int>(wcslen(suffix));
+    if (string.count < suffix_length)
+        return false;
+
+    const String end(string.data + string.count - suffix_length, suffix_length);
+    return scalar_equals_ignore_case(end, String::reference_to_const_wchar_t(suffix));
+}
+
+// FNV-1a over folded code units, what a hash table of names would use otherwise.
+static unsigned int scalar_hash_ignore_case(const String& string)
+{
+    unsigned int h = 2166136261u;
+    for (int i = 0; i < string.count; ++i)
+        h = (h ^ String_Simd::fold_char(string.data[i])) * 16777619u;
+
+    return h;
+}
+#pragma endregion
+
+#pragma region Benchmarks
+static void bench_scalar_last_index_of(void* context)
+{
+    Corpus* corpus = static_cast<Corpus*>(context);
+    int sum = 0;
+    for (int i = 0; i < corpus_count; ++i)
+        sum += scalar_last_index_of(corpus->paths[i], L'\\');
+    corpus->sink = sum;
+}
+
+static void bench_last_index_of(void* context)
+{
+    Corpus* corpus = static_cast<Corpus*>(context);
+    int sum = 0;
+    for (int i = 0; i < corpus_count; ++i)
+        sum += corpus->paths[i].last_index_of(L'\\');
+    corpus->sink = sum;
+}
+
+static void bench_scalar_index_of(void* context)
+{
+    Corpus* corpus = static_cast<Corpus*>(context);
+    int sum = 0;
+    for (int i = 0; i < corpus_count; ++i)
+        sum += scalar_index_of(corpus->paths[i], L'.');
+    corpus->sink = sum;
+}
+
+static void bench_index_of(void* context)
+{
+    Corpus* corpus = static_cast<Corpus*>(context);
+    int sum = 0;
+    for (int i = 0; i < corpus_count; ++i)
+        sum += corpus->paths[i].index_of(L'.');
+    corpus->sink = sum;
+}
+
+static void bench_scalar_equals(void* context)
+{
+    Corpus* corpus = static_cast<Corpus*>(context);
+    int sum = 0;
+    for (int i = 0; i < corpus_count; ++i)
+        sum += scalar_equals(corpus->paths[i], corpus->paths[corpus_count - 1 - i]) ? 1 : 0;
+    corpus->sink = sum;
+}
+
+static void bench_equals(void* context)
+{
+    Corpus* corpus = static_cast<Corpus*>(context);
+    int sum = 0;
+    for (int i = 0; i < corpus_count; ++i)
+        sum += String::equals(corpus->paths[i], corpus->paths[corpus_count - 1 - i]) ? 1 : 0;
+    corpus->sink = sum;
+}
+
+static void bench_scalar_equals_ignore_case(void* context)
+{
+    Corpus* corpus = static_cast<Corpus*>(context);
+    int sum = 0;
+    for (int i = 0; i < corpus_count; ++i)
+        sum += scalar_equals_ignore_case(corpus->names[i], corpus->upper_names[i]) ? 1 : 0;
+    corpus->sink = sum;
+}
+
+static void bench_equals_ignore_case(void* context)
+{
+    Corpus* corpus = static_cast<Corpus*>(context);
+    int sum = 0;
+    for (int i = 0; i < corpus_count; ++i)
+        sum += String::equals_ignore_case(corpus->names[i], corpus->upper_names[i]) ? 1 : 0;
+    corpus->sink = sum;
+}
+
+static void bench_scalar_ends_with_ignore_case(void* context)
+{
+    Corpus* corpus = static_cast<Corpus*>(context);
+    int sum = 0;
+    for (int i = 0; i < corpus_count; ++i)
+        sum += scalar_ends_with_ignore_case(corpus->names[i], L".jpeg") ? 1 : 0;
+    corpus->sink = sum;
+}
+
+static void bench_ends_with_ignore_case(void* context)
+{
+    Corpus* corpus = static_cast<Corpus*>(context);
+    int sum = 0;
+    for (int i = 0; i < corpus_count; ++i)
+        sum += corpus->names[i].ends_with_ignore_case(L".jpeg") ? 1 : 0;
+    corpus->sink = sum;
+}
+
+static void bench_scalar_hash_ignore_case(void* context)
+{
+    Corpus* corpus = static_cast<Corpus*>(context);
+    unsigned int sum = 0;
+    for (int i = 0; i < corpus_count; ++i)
+        sum += scalar_hash_ignore_case(corpus->names[i]);
+    corpus->sink = static_cast<int>(sum);
+}
+
+static void bench_hash_ignore_case(void* context)
+{
+    Corpus* corpus = static_cast<Corpus*>(context);
+    unsigned int sum = 0;
+    for (int i = 0; i < corpus_count; ++i)
+        sum += String::hash_ignore_case(corpus->names[i]);
+    corpus->sink = static_cast<int>(sum);
+}
+#pragma endregion
+
+void run_string_benchmark()
+{
+    Corpus corpus;
+    if (!make_corpus(&corpus))
+    {
+        wprintf(L"Not enough memory for string corpus.\n");
+        release_corpus(&corpus);
+        return;
+    }
+
+    wprintf(L"String, %d paths of %.0f code units on average:\n", corpus_count, corpus.path_bytes / sizeof(wchar_t) / corpus_count);
+    report_benchmark(L"last_index_of('\\') on paths, scalar", measure_ms(bench_scalar_last_index_of, &corpus), corpus.path_bytes);
+    report_benchmark(L"last_index_of('\\') on paths", measure_ms(bench_last_index_of, &corpus), corpus.path_bytes);
+    report_benchmark(L"index_of('.') on paths, scalar", measure_ms(bench_scalar_index_of, &corpus), corpus.path_bytes);
+    report_benchmark(L"index_of('.') on paths", measure_ms(bench_index_of, &corpus), corpus.path_bytes);
+    report_benchmark(L"equals on paths, scalar", measure_ms(bench_scalar_equals, &corpus));
+    report_benchmark(L"equals on paths", measure_ms(bench_equals, &corpus));
+    report_benchmark(L"equals_ignore_case on names, scalar", measure_ms(bench_scalar_equals_ignore_case, &corpus), corpus.name_bytes);
+    report_benchmark(L"equals_ignore_case on names", measure_ms(bench_equals_ignore_case, &corpus), corpus.name_bytes);
+    report_benchmark(L"ends_with_ignore_case(\".jpeg\"), scalar", measure_ms(bench_scalar_ends_with_ignore_case, &corpus));
+    report_benchmark(L"ends_with_ignore_case(\".jpeg\")", measure_ms(bench_ends_with_ignore_case, &corpus));
+    report_benchmark(L"hash_ignore_case on names, scalar FNV-1a", measure_ms(bench_scalar_hash_ignore_case, &corpus), corpus.name_bytes);
+    report_benchmark(L"hash_ignore_case on names", measure_ms(bench_hash_ignore_case, &corpus), corpus.name_bytes);
+
+    release_corpus(&corpus);
+}
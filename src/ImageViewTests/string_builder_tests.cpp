@@ -0,0 +1,88 @@
+#include <Windows.h>
+#include <stdio.h>
+#include <wchar.h>
+
+#include "test.hpp"
+#include "string_builder.hpp"
+
+// Typed formatting prints the same text as printf for the format it stands for.
+static bool equals_printf(const String_Builder& sb, const wchar_t* format, ...)
+{
+    wchar_t expected[512];
+    va_list args;
+    va_start(args, format);
+    const int count = vswprintf_s(expected, ARRAYSIZE(expected), format, args);
+    va_end(args);
+
+    return count == sb.count && wmemcmp(expected, sb.buffer, count) == 0;
+}
+
+static void test_integers()
+{
+    wchar_t text[64];
+    String_Builder sb{ text, ARRAYSIZE(text) };
+
+    const __int64 values[] = { 0, 7, -7, 10, 99, 100, -12345, 2147483647, -2147483647 - 1, 9223372036854775807ll, -9223372036854775807ll - 1 };
+    for (int i = 0; i < ARRAYSIZE(values); ++i)
+    {
+        sb.clear();
+        CHECK(sb.append(values[i]));
+        CHECK(equals_printf(sb, L"%lld", values[i]));
+    }
+
+    sb.clear();
+    CHECK(sb.append(18446744073709551615ull));
+    CHECK(equals_printf(sb, L"%llu", 18446744073709551615ull));
+
+    sb.clear();
+    CHECK(sb.append(format_hex(0x8007000E, 8), L' ', format_hex(0xAB, 4, false)));
+    CHECK(equals_printf(sb, L"%#010x %04x", 0x8007000E, 0xAB));
+}
+
+static void test_fixed()
+{
+    wchar_t text[512];
+    String_Builder sb{ text, ARRAYSIZE(text) };
+
+    // Away from halfway points, where rounding of scaled value and printf's exact rounding may differ.
+    const double values[] = { 0.0, 0.3, -0.7, 2.8, 1.0 / 3.0, -1234.5678, 8000000.004, 123456789.0123, 1e12 + 0.3, 9.87654321e17 };
+    for (int i = 0; i < ARRAYSIZE(values); ++i)
+    {
+        for (int precision = 0; precision <= 9; ++precision)
+        {
+            sb.clear();
+            CHECK(sb.append(format_fixed(values[i], precision)));
+            CHECK(equals_printf(sb, L"%.*f", precision, values[i]));
+        }
+    }
+
+    sb.clear();
+    CHECK(sb.append(format_fixed(1e20, 3)));
+    CHECK(equals_printf(sb, L"%.*e", 3, 1e20));
+}
+
+// Terminating null is counted, callers pass 'count' on as length of the text.
+static void test_end()
+{
+    String_Builder sb{ g_standard_allocator };
+    sb.begin();
+    sb.append(L"abc", 12);
+    CHECK(sb.end());
+    CHECK(sb.count == 6);
+    CHECK(wcscmp(sb.buffer, L"abc12") == 0);
+    g_standard_allocator->deallocate(sb.buffer);
+
+    // Fixed buffer doesn't grow, text that doesn't fit fails.
+    wchar_t text[4];
+    String_Builder fixed{ text, ARRAYSIZE(text) };
+    fixed.begin();
+    fixed.append(L"abcd");
+    CHECK(!fixed.end());
+}
+
+void run_string_builder_tests()
+{
+    test_integers();
+    test_fixed();
+    test_end();
+}
@@ -0,0 +1,40 @@
+#include <stdio.h>
+
+#include "test.hpp"
+#include "windows_utility.hpp"
+
+static int failed_check_count = 0;
+
+void report_failed_check(const wchar_t* file, int line, const wchar_t* condition)
+{
+    ++failed_check_count;
+    wprintf(L"%s(%d): check failed: %s\n", file, line, condition);
+}
+
+int get_failed_check_count()
+{
+    return failed_check_count;
+}
+
+double measure_ms(Benchmark_Func func, void* context, int runs)
+{
+    double fastest = 0.0;
+    for (int i = 0; i < runs; ++i)
+    {
+        const double start = Windows_Utility::get_time_ms();
+        func(context);
+        const double ms = Windows_Utility::get_time_ms() - start;
+        if (i == 0 || ms < fastest)
+            fastest = ms;
+    }
+
+    return fastest;
+}
+
+void report_benchmark(const wchar_t* name, double ms, double bytes)
+{
+    if (bytes > 0.0)
+        wprintf(L"  %-48s %10.3f ms %8.2f GB/s\n", name, ms, bytes / (ms * 1e6));
+    else
+        wprintf(L"  %-48s %10.3f ms\n", name, ms);
+}
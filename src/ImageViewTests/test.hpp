@@ -0,0 +1,40 @@
+#pragma once
+#include <Windows.h>
+
+#define TEST_WIDEN2(text) L ## text
+#define TEST_WIDEN(text) TEST_WIDEN2(text)
+
+// Checks 'condition'. Failure is printed with the line it's on and counted, later checks still run.
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) \
+            report_failed_check(__FILEW__, __LINE__, TEST_WIDEN(#condition)); \
+    } while (0)
+
+void report_failed_check(const wchar_t* file, int line, const wchar_t* condition);
+int get_failed_check_count();
+
+typedef void (*Benchmark_Func)(void* context);
+
+// Milliseconds of the fastest of 'runs' calls of func(context), the others are warmup and noise.
+double measure_ms(Benchmark_Func func, void* context, int runs = 7);
+// Prints time of a benchmark, and throughput if it processed 'bytes'.
+void report_benchmark(const wchar_t* name, double ms, double bytes = 0.0);
+
+// Tests, each group checks one module.
+void run_utf8_tests();
+void run_line_reader_tests();
+void run_string_builder_tests();
+void run_memory_governor_tests();
+void run_exif_reader_tests();
+void run_name_index_tests();
+void run_jpeg_restart_decoder_tests();
+void run_image_rotation_tests();
+void run_bcn_decoder_tests();
+
+// Benchmarks, each compares a module with the code it replaced.
+void run_string_benchmark();
+void run_format_benchmark();
+void run_pixel_conversion_benchmark();
+void run_name_index_benchmark();
+void run_jpeg_restart_benchmark();
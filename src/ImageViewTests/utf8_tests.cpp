@@ -0,0 +1,121 @@
+#include <Windows.h>
+#include <string.h>
+
+#include "test.hpp"
+#include "utf8.hpp"
+
+// Long enough that vector kernels convert the ASCII runs around the tested code units.
+static const int run_length = 40;
+
+// Code units U+8000..U+807F have the bits of ASCII in their low byte, a kernel that only looks at
+// some of the high bits narrows them to ASCII.
+static void test_narrow_high_code_units()
+{
+    for (int unit = 0x8000; unit <= 0x807F; ++unit)
+    {
+        for (int position = 0; position < run_length; ++position)
+        {
+            wchar_t source[run_length];
+            for (int i = 0; i < run_length; ++i)
+                source[i] = static_cast<wchar_t>(L'a' + i % 26);
+            source[position] = static_cast<wchar_t>(unit);
+
+            char utf8[run_length + 2];
+            const int count = Utf8::to_utf8(source, run_length, utf8, ARRAYSIZE(utf8));
+            CHECK(count == run_length + 2);
+            CHECK(Utf8::utf8_length(source, run_length) == run_length + 2);
+            if (count != run_length + 2)
+                continue;
+
+            const unsigned char* bytes = reinterpret_cast<const unsigned char*>(utf8);
+            CHECK(bytes[position] == 0xE8);
+            CHECK(bytes[position + 1] == (0x80 | ((unit >> 6) & 0x3F)));
+            CHECK(bytes[position + 2] == (0x80 | (unit & 0x3F)));
+
+            wchar_t back[run_length];
+            CHECK(Utf8::to_utf16(utf8, count, back, ARRAYSIZE(back)) == run_length);
+            CHECK(memcmp(back, source, sizeof(source)) == 0);
+        }
+    }
+}
+
+static void test_ascii_round_trip()
+{
+    char ascii[1000];
+    for (int i = 0; i < ARRAYSIZE(ascii); ++i)
+        ascii[i] = static_cast<char>(1 + i % 127);
+
+    for (int count = 0; count <= ARRAYSIZE(ascii); count += 37)
+    {
+        CHECK(Utf8::ascii_prefix_length(ascii, count) == count);
+        CHECK(Utf8::utf16_length(ascii, count) == count);
+
+        wchar_t wide[ARRAYSIZE(ascii)];
+        CHECK(Utf8::to_utf16(ascii, count, wide, ARRAYSIZE(wide)) == count);
+
+        char narrow[ARRAYSIZE(ascii)];
+        CHECK(Utf8::to_utf8(wide, count, narrow, ARRAYSIZE(narrow)) == count);
+        CHECK(memcmp(narrow, ascii, count) == 0);
+    }
+}
+
+static void test_multibyte_round_trip()
+{
+    // 2, 3 and 4 byte sequences, the last one is a surrogate pair.
+    const wchar_t source[] = { L'x', 0x00E9, 0x0800, 0x7FF, 0xFFFD, 0xD83D, 0xDE00, L'y' };
+    const unsigned char expected[] = { 'x', 0xC3, 0xA9, 0xE0, 0xA0, 0x80, 0xDF, 0xBF, 0xEF, 0xBF, 0xBD, 0xF0, 0x9F, 0x98, 0x80, 'y' };
+
+    char utf8[32];
+    const int count = Utf8::to_utf8(source, ARRAYSIZE(source), utf8, ARRAYSIZE(utf8));
+    CHECK(count == ARRAYSIZE(expected));
+    CHECK(memcmp(utf8, expected, sizeof(expected)) == 0);
+
+    wchar_t back[ARRAYSIZE(source)];
+    CHECK(Utf8::to_utf16(utf8, count, back, ARRAYSIZE(back)) == ARRAYSIZE(source));
+    CHECK(memcmp(back, source, sizeof(source)) == 0);
+}
+
+static void test_invalid_input()
+{
+    const char* invalid[] = {
+        "\xC0\xAF",         // Overlong '/'.
+        "\xE0\x80\xAF",     // Overlong '/' in 3 bytes.
+        "\xED\xA0\x80",     // Surrogate U+D800.
+        "\xF4\x90\x80\x80", // Above U+10FFFF.
+        "\xE2\x82",         // Truncated sequence.
+        "\x80",             // Continuation byte without lead byte.
+    };
+
+    for (int i = 0; i < ARRAYSIZE(invalid); ++i)
+    {
+        const int count = static_cast<int>(strlen(invalid[i]));
+        wchar_t wide[8];
+        CHECK(!Utf8::validate(invalid[i], count));
+        CHECK(Utf8::to_utf16(invalid[i], count, wide, ARRAYSIZE(wide)) == -1);
+    }
+
+    const wchar_t lone_surrogate[] = { L'a', 0xDC00, L'b' };
+    char utf8[8];
+    CHECK(Utf8::utf8_length(lone_surrogate, ARRAYSIZE(lone_surrogate)) == -1);
+    CHECK(Utf8::to_utf8(lone_surrogate, ARRAYSIZE(lone_surrogate), utf8, ARRAYSIZE(utf8)) == -1);
+}
+
+static void test_destination_too_small()
+{
+    const char ascii[] = "0123456789abcdefghijklmnopqrstuvwxyz";
+    wchar_t wide[ARRAYSIZE(ascii)];
+    CHECK(Utf8::to_utf16(ascii, ARRAYSIZE(ascii) - 1, wide, 20) == -1);
+
+    char narrow[ARRAYSIZE(ascii)];
+    CHECK(Utf8::to_utf16(ascii, ARRAYSIZE(ascii) - 1, wide, ARRAYSIZE(wide)) == ARRAYSIZE(ascii) - 1);
+    CHECK(Utf8::to_utf8(wide, ARRAYSIZE(ascii) - 1, narrow, 20) == -1);
+}
+
+void run_utf8_tests()
+{
+    test_narrow_high_code_units();
+    test_ascii_round_trip();
+    test_multibyte_round_trip();
+    test_invalid_input();
+    test_destination_too_small();
+}